@@ -33,6 +33,11 @@ bool LSFetchQueueWaitForMessage(LSFetchQueue *fq, LSMessage **message,
                                  LSError *lserror) LS_DEPRECATED;
 bool LSFetchQueueWakeUp(LSFetchQueue *fq, LSError *lserror) LS_DEPRECATED;
 
+/* for embedding a fetch queue in another event loop */
+bool LSFetchQueueGetFd(LSFetchQueue *fq, int *ret_fd, LSError *lserror);
+bool LSFetchQueueDispatch(LSFetchQueue *fq, LSError *lserror);
+bool LSFetchQueueFetchMessage(LSFetchQueue *fq, LSMessage **message, LSError *lserror);
+
 
 bool LSCustomWaitForMessage(LSHandle *sh, LSMessage **message,
                                LSError *lserror) LS_DEPRECATED;
@@ -34,6 +34,8 @@
 #define LS_ERROR_CODE_DEPRECATED        (-6 - _LS_ERROR_CODE_OFFSET)    /**< API is deprecated */
 #define LS_ERROR_CODE_NOT_PRIVILEGED    (-7 - _LS_ERROR_CODE_OFFSET)    /**< service is not privileged */
 #define LS_ERROR_CODE_PROTOCOL_VERSION  (-8 - _LS_ERROR_CODE_OFFSET)    /**< protocol version mismatch */
+#define LS_ERROR_CODE_SERVICE_NOT_EXIST (-9 - _LS_ERROR_CODE_OFFSET)    /**< service does not exist */
+#define LS_ERROR_CODE_QUEUE_FULL        (-10 - _LS_ERROR_CODE_OFFSET)   /**< too many messages waiting for a service */
 
 /** @} LunaServiceErrorCodes */
 
@@ -70,6 +72,9 @@
 /** Badly formatted message */
 #define LUNABUS_ERROR_BAD_MESSAGE       "BadMessage"
 
+/** Sent to callback when there was no reply by the call's deadline */
+#define LUNABUS_ERROR_TIMEOUT "Timeout"
+
 /** Out of memory */
 #define LUNABUS_ERROR_OOM "OutOfMemory"
 
@@ -337,6 +337,14 @@ typedef bool (*LSPropertySetFunction) (LSHandle *sh, LSMessage *msg, void *categ
 */
 typedef enum {
 	LUNA_METHOD_FLAG_DEPRECATED = (1 << 0),
+	LUNA_METHOD_FLAG_PRIORITY = (1 << 1),	/**< replies go ahead of other queued messages */
+	LUNA_METHOD_FLAG_BULK = (1 << 2),		/**< replies go behind other queued messages */
+	LUNA_METHOD_FLAG_IDEMPOTENT = (1 << 3),	/**< the reply depends only on the payload, so identical
+						     calls in flight may share one (see LSSetCallCoalescing()) */
+	LUNA_METHOD_FLAG_CACHEABLE = (1 << 4),	/**< read-only; successful replies are saved and sent
+						     again for the same payload from the same app id, so
+						     the reply must not depend on which service calls
+						     (see LSMethodCacheInvalidate()) */
 } LSMethodFlags;
 
 /**
@@ -408,6 +416,20 @@ typedef void (*LSDisconnectHandler)(LSHandle *sh, void *user_data);
 bool LSSetDisconnectHandler(LSHandle *sh, LSDisconnectHandler disconnect_handler,
                     void *user_data, LSError *lserror);
 
+typedef void (*LSFlowControlHandler)(LSHandle *sh, const char *serviceName,
+                    const char *uniqueName, bool congested, void *user_data);
+bool LSSetFlowControlHandler(LSHandle *sh, LSFlowControlHandler flow_control_handler,
+                    void *user_data, LSError *lserror);
+bool LSSetFlowControlWatermarks(LSHandle *sh, unsigned long high_bytes, unsigned long low_bytes,
+                    unsigned int high_messages, unsigned int low_messages,
+                    LSError *lserror);
+bool LSIsServiceCongested(LSHandle *sh, const char *serviceName);
+
+bool LSSetCompressionThresholds(LSHandle *sh, unsigned long inet_bytes, unsigned long local_bytes,
+                    LSError *lserror);
+
+bool LSSetIdleConnectionTimeout(LSHandle *sh, int timeout_sec, LSError *lserror);
+
 bool LSRegisterCategory(LSHandle *sh, const char *category,
                    LSMethod      *methods,
                    LSSignal      *langis,
@@ -421,6 +443,13 @@ bool LSRegisterCategoryAppend(LSHandle *sh, const char *category,
 bool LSCategorySetData(LSHandle *sh, const char *category,
                        void *user_data, LSError *lserror);
 
+bool LSCategorySetThreadSafe(LSHandle *sh, const char *category,
+                             bool thread_safe, LSError *lserror);
+
+bool LSSetWorkerThreads(LSHandle *sh, int max_threads, LSError *lserror);
+
+bool LSSetSlowCallThreshold(LSHandle *sh, int threshold_ms, LSError *lserror);
+
 bool LSUnregister(LSHandle *service, LSError *lserror);
 
 const char * LSHandleGetName(LSHandle *sh);
@@ -473,6 +502,8 @@ const char * LSMessageGetCategory(LSMessage *message);
 const char * LSMessageGetMethod(LSMessage *message);
 
 const char * LSMessageGetPayload(LSMessage *message);
+long LSMessageGetPayloadLen(LSMessage *message);
+struct json_object * LSMessageGetPayloadObject(LSMessage *message);
 
 bool LSMessageIsSubscription(LSMessage *lsmgs);
 
@@ -485,6 +516,12 @@ bool LSMessageRespond(LSMessage *message, const char *reply_payload,
 bool LSMessageReply(LSHandle *sh, LSMessage *lsmsg, const char *replyPayload,
                 LSError *lserror);
 
+bool LSMessageReplyWithLen(LSHandle *sh, LSMessage *lsmsg, const char *replyPayload,
+                size_t replyPayloadLen, LSError *lserror);
+
+bool LSMessageReplyObject(LSHandle *sh, LSMessage *lsmsg, struct json_object *replyObject,
+                LSError *lserror);
+
 /* @} END OF LunaServiceMessage */
 
 /**
@@ -541,6 +578,14 @@ bool LSCall(LSHandle *sh, const char *uri, const char *payload,
        LSFilterFunc callback, void *user_data,
        LSMessageToken *ret_token, LSError *lserror);
 
+bool LSCallWithLen(LSHandle *sh, const char *uri, const char *payload, size_t payload_len,
+       LSFilterFunc callback, void *user_data,
+       LSMessageToken *ret_token, LSError *lserror);
+
+bool LSCallObject(LSHandle *sh, const char *uri, struct json_object *payload,
+       LSFilterFunc callback, void *user_data,
+       LSMessageToken *ret_token, LSError *lserror);
+
 bool LSCallOneReply(LSHandle *sh, const char *uri, const char *payload,
        LSFilterFunc callback, void *ctx,
        LSMessageToken *ret_token, LSError *lserror);
@@ -558,6 +603,41 @@ bool LSCallFromApplicationOneReply(
 
 bool LSCallCancel(LSHandle *sh, LSMessageToken token, LSError *lserror);
 
+bool LSCallSetTimeout(LSHandle *sh, LSMessageToken token, int timeout_ms, LSError *lserror);
+
+bool LSSetDefaultCallTimeout(LSHandle *sh, int timeout_ms, LSError *lserror);
+
+bool LSSetCallCoalescing(LSHandle *sh, bool enable, LSError *lserror);
+
+bool LSMethodCacheInvalidate(LSHandle *sh, const char *category, const char *method, LSError *lserror);
+
+bool LSMethodCacheSetTimeout(LSHandle *sh, int ttl_ms, LSError *lserror);
+
+typedef struct {
+    const char *uri;            /**< IN  uri to call */
+    const char *payload;        /**< IN  payload */
+    LSMessageToken token;       /**< OUT token for the call (LSMESSAGE_TOKEN_INVALID if it wasn't sent) */
+} LSCallManyEntry;
+
+/** 
+* @brief Callback called once every call of an LSCallMany() batch has
+*        replied (or failed, or been cancelled).
+* 
+* @param  sh             service handle
+* @param  replies        reply for each call, in the order of the batch;
+*                        NULL for calls that were cancelled or not sent.
+*                        Only valid for the duration of the callback; use
+*                        LSMessageRef() to keep one.
+* @param  num_replies    number of calls in the batch
+* @param  ctx            context
+*/
+typedef void (*LSCallManyDoneFunc) (LSHandle *sh, LSMessage **replies,
+                                    int num_replies, void *ctx);
+
+bool LSCallMany(LSHandle *sh, LSCallManyEntry *calls, int num_calls,
+       LSFilterFunc callback, void *ctx,
+       LSCallManyDoneFunc done, void *done_ctx, LSError *lserror);
+
 /* @} END OF LunaServiceClient */
 
 /**
@@ -576,6 +656,9 @@ bool LSSubscriptionSetCancelFunction(LSHandle *sh,
 bool LSSubscriptionAdd(LSHandle *sh, const char *key,
                   LSMessage *message, LSError *lserror);
 
+bool LSSubscriptionSetCoalesce(LSHandle *sh, const char *key,
+                  bool coalesce, LSError *lserror);
+
 bool LSSubscriptionAcquire(LSHandle *sh, const char *key,
                   LSSubscriptionIter **ret_iter, LSError *lserror);
 
@@ -616,6 +699,17 @@ bool LSSignalCall(LSHandle *sh,
          LSMessageToken *ret_token,
          LSError *lserror);
 
+typedef struct {
+    const char *category;       /**< IN  category */
+    const char *method;         /**< IN  method (NULL for every signal in the category) */
+    LSMessageToken token;       /**< OUT token for the match (LSMESSAGE_TOKEN_INVALID if it wasn't added) */
+} LSSignalCallManyEntry;
+
+bool LSSignalCallMany(LSHandle *sh,
+         LSSignalCallManyEntry *signals, int num_signals,
+         LSFilterFunc filterFunc, void *ctx,
+         LSError *lserror);
+
 bool LSSignalCallCancel(LSHandle *sh, LSMessageToken token, LSError *lserror);
 
 
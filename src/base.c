@@ -33,6 +33,7 @@
 #include "subscription.h"
 #include "debug_methods.h"
 #include "transport.h"
+#include "trace.h"
 
 #define __USE_GNU   /* for dladdr() in dlfcn.h */
 #include <dlfcn.h>
@@ -49,6 +50,7 @@
 /* FIXME -- create a callmap.h header file (this function is in callmap.c */
 void _LSHandleMessageFailure(LSMessageToken global_token, _LSTransportMessageFailureType failure_type, void *context);
 void _LSDisconnectHandler(_LSTransportClient *client, _LSTransportDisconnectType type, void *context);
+bool _LSIdleHandler(_LSTransportClient *client, void *context);
 bool _LSHandleReply(LSHandle *sh, _LSTransportMessage *transport_msg);
 
 /**
@@ -136,6 +138,16 @@ bool _LSHandleReply(LSHandle *sh, _LSTransportMessage *transport_msg);
 /** Enable UTF8 validation on the payload */
 bool _ls_enable_utf8_validation = false;
 
+/** Default slow call threshold for new handles (LS_SLOW_CALL_MS); 0 for off */
+static int _ls_slow_call_threshold_ms = 0;
+
+/** Default idle connection timeout for new handles (LS_IDLE_CONNECTION_SEC); 0 for off */
+static int _ls_idle_connection_timeout_sec = 0;
+
+/** Give each handle of a palm service its own transport, catalog and method
+ * tables, as before they were shared (LS_SPLIT_PALM_SERVICE) */
+static bool _ls_split_palm_service = false;
+
 void
 LSDebugLogIncoming(const char *where, _LSTransportMessage *message)
 {
@@ -256,6 +268,28 @@ _LSInit(void)
         _ls_enable_utf8_validation = true;
         g_debug("Enable UTF8 validation on payloads");
     }
+
+    char *ls_slow_call = getenv("LS_SLOW_CALL_MS");
+    if (ls_slow_call)
+    {
+        _ls_slow_call_threshold_ms = atoi(ls_slow_call);
+        g_debug("Recording method handlers slower than %d ms", _ls_slow_call_threshold_ms);
+    }
+
+    char *ls_idle_connection = getenv("LS_IDLE_CONNECTION_SEC");
+    if (ls_idle_connection)
+    {
+        _ls_idle_connection_timeout_sec = atoi(ls_idle_connection);
+        g_debug("Closing connections idle for %d s", _ls_idle_connection_timeout_sec);
+    }
+
+    if (getenv("LS_SPLIT_PALM_SERVICE"))
+    {
+        _ls_split_palm_service = true;
+        g_debug("Not sharing a transport between the handles of a palm service");
+    }
+
+    _LSTraceInit();
 }
 
 bool
@@ -350,6 +384,323 @@ _LSCategoryUnregister(LSHandle *sh, void *user_data)
 }
 #endif
 
+/**
+ * Entry in the dispatch cache. The entry is also its own key; the strings
+ * point at the category path owned by tableHandlers and the name in the
+ * registered LSMethod, which both live as long as the cache entry.
+ */
+typedef struct _LSDispatchEntry {
+    const char      *category;
+    const char      *method;
+    LSCategoryTable *table;
+    LSMethod        *lsmethod;
+} _LSDispatchEntry;
+
+/* One pass over both strings, so a lookup only hashes the names once */
+static guint
+_LSDispatchEntryHash(gconstpointer key)
+{
+    const _LSDispatchEntry *entry = key;
+    const signed char *p;
+    guint32 h = 5381;
+
+    for (p = (const signed char*)entry->category; *p != '\0'; p++)
+        h = (h << 5) + h + *p;
+
+    /* separator, so "a" + "bc" and "ab" + "c" don't collide */
+    h = (h << 5) + h;
+
+    for (p = (const signed char*)entry->method; *p != '\0'; p++)
+        h = (h << 5) + h + *p;
+
+    return h;
+}
+
+static gboolean
+_LSDispatchEntryEqual(gconstpointer a, gconstpointer b)
+{
+    const _LSDispatchEntry *entry_a = a;
+    const _LSDispatchEntry *entry_b = b;
+
+    return (strcmp(entry_a->method, entry_b->method) == 0) &&
+           (strcmp(entry_a->category, entry_b->category) == 0);
+}
+
+static void
+_LSDispatchEntryFree(_LSDispatchEntry *entry)
+{
+    g_slice_free(_LSDispatchEntry, entry);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Get the methods of a category table that a handle dispatches. The
+ * two handles of a palm service that share their tableHandlers each have
+ * their own methods in the table.
+ * 
+ * @param  sh       IN  handle
+ * @param  table    IN  category table
+ * 
+ * @retval  location of the method hash (which is NULL if the handle hasn't
+ *          registered the category)
+ *******************************************************************************
+ */
+static GHashTable**
+_LSCategoryTableMethods(const LSHandle *sh, LSCategoryTable *table)
+{
+    return sh->palm_private ? &table->private_methods : &table->methods;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Resolve a (category, method) pair to the registered method, first
+ * through the handle's dispatch cache and then through tableHandlers,
+ * caching what it finds.
+ * 
+ * @param  sh               IN  handle
+ * @param  category_name    IN  category
+ * @param  method_name      IN  method
+ * @param  ret_table        OUT category table of method
+ * 
+ * @retval  method on success
+ * @retval  NULL if the method isn't registered
+ *******************************************************************************
+ */
+static LSMethod*
+_LSHandleLookupMethod(LSHandle *sh, const char *category_name, const char *method_name,
+                      LSCategoryTable **ret_table)
+{
+    _LSDispatchEntry lookup = { category_name, method_name, NULL, NULL };
+    _LSDispatchEntry *entry = NULL;
+
+    if (sh->dispatchCache)
+    {
+        entry = g_hash_table_lookup(sh->dispatchCache, &lookup);
+
+        if (entry)
+        {
+            *ret_table = entry->table;
+            return entry->lsmethod;
+        }
+    }
+
+    /* find the category in the tableHandlers (LSCategoryTable) */
+    gpointer category_path = NULL;
+    LSCategoryTable *category = NULL;
+
+    if (!sh->tableHandlers ||
+        !g_hash_table_lookup_extended(sh->tableHandlers, category_name, &category_path, (gpointer*)&category) ||
+        !*_LSCategoryTableMethods(sh, category))
+    {
+        g_debug("Couldn't find category: %s", category_name);
+        return NULL;
+    }
+
+    /* find the method in the tableHandlers->methods hash */
+    LSMethod *method = g_hash_table_lookup(*_LSCategoryTableMethods(sh, category), (gpointer)method_name);
+
+    if (!method)
+    {
+        g_debug("couldn't find method: %s", method_name);
+        return NULL;
+    }
+
+    /* Only found methods are cached, so the cache is bounded by the number
+     * of registered methods */
+    if (!sh->dispatchCache)
+    {
+        sh->dispatchCache = g_hash_table_new_full(_LSDispatchEntryHash, _LSDispatchEntryEqual,
+                                                  (GDestroyNotify)_LSDispatchEntryFree, NULL);
+    }
+
+    entry = g_slice_new(_LSDispatchEntry);
+
+    if (entry)
+    {
+        entry->category = category_path;
+        entry->method = method->name;
+        entry->table = category;
+        entry->lsmethod = method;
+        g_hash_table_insert(sh->dispatchCache, entry, entry);
+    }
+
+    *ret_table = category;
+    return method;
+}
+
+/**
+ * Method call handed off to a worker thread
+ */
+typedef struct _LSWorkItem {
+    LSMessage   *message;
+    LSMethod    *method;
+    void        *category_user_data;
+} _LSWorkItem;
+
+/** 
+ *******************************************************************************
+ * @brief Remember a method call in the slow call ring if its handler took
+ * at least the handle's slow call threshold.
+ * 
+ * @param  sh       IN  handle
+ * @param  message  IN  method call
+ * @param  category IN  category of method
+ * @param  method   IN  method
+ * @param  us       IN  handler execution time in microseconds
+ *******************************************************************************
+ */
+static inline void
+_LSRecordSlowCall(LSHandle *sh, LSMessage *message, const char *category, const LSMethod *method, guint64 us)
+{
+    guint64 threshold_us = sh->slow_call_threshold_us;
+
+    if (likely(threshold_us == 0 || us < threshold_us))
+    {
+        return;
+    }
+
+    _LSSlowCallRing *ring = g_atomic_pointer_get(&sh->slow_calls);
+
+    if (ring)
+    {
+        const char *sender = LSMessageGetSenderServiceName(message);
+
+        _LSSlowCallRingAdd(ring, category, method->name, sender ? sender : LSMessageGetSender(message), us);
+    }
+}
+
+/** 
+ *******************************************************************************
+ * @brief Runs a method call on a worker thread. Replies sent by the method go
+ * straight into the destination's outgoing queue, which is locked.
+ * 
+ * @param  data         IN  work item (freed)
+ * @param  user_data    IN  handle
+ *******************************************************************************
+ */
+static void
+_LSWorkerDispatch(gpointer data, gpointer user_data)
+{
+    _LSWorkItem *item = data;
+    LSHandle *sh = user_data;
+
+    gint64 start_us = _LSLatencyNowUs();
+
+    bool handled = item->method->function(sh, item->message, item->category_user_data);
+
+    guint64 handler_us = _LSLatencyNowUs() - start_us;
+
+    _LSLatencyStatsAddMethod(sh->latency_stats, LSMessageGetCategory(item->message), item->method, handler_us);
+    _LSRecordSlowCall(sh, item->message, LSMessageGetCategory(item->message), item->method, handler_us);
+
+    if (!handled)
+    {
+        g_debug("method wasn't handled!");
+        _LSTransportHandleMessageResult(item->message->transport_msg, LSMessageHandlerResultNotHandled);
+    }
+
+    LSMessageUnref(item->message);
+    g_slice_free(_LSWorkItem, item);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Get the handle's reply cache, creating it the first time.
+ * 
+ * @param  sh   IN  handle
+ * 
+ * @retval  cache on success
+ * @retval  NULL on failure
+ *******************************************************************************
+ */
+static _LSReplyCache*
+_LSHandleGetReplyCache(LSHandle *sh)
+{
+    _LSReplyCache *cache = g_atomic_pointer_get(&sh->reply_cache);
+
+    if (likely(cache != NULL))
+    {
+        return cache;
+    }
+
+    cache = _LSReplyCacheNew();
+
+    if (!cache)
+    {
+        return NULL;
+    }
+
+    /* the cache stays until the handle goes away, so worker threads
+     * never see it freed */
+    if (!g_atomic_pointer_compare_and_exchange(&sh->reply_cache, NULL, cache))
+    {
+        _LSReplyCacheFree(cache);
+    }
+
+    return g_atomic_pointer_get(&sh->reply_cache);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Reply to a call of a LUNA_METHOD_FLAG_CACHEABLE method from the
+ * reply cache. On a miss, the message remembers where to save its reply
+ * (see LSMessageReplyWithLen()).
+ *
+ * Subscriptions are never served from the cache, since the method has to
+ * see them to add the subscriber.
+ * 
+ * @param  sh               IN  handle
+ * @param  message          IN  method call
+ * @param  category_name    IN  category
+ * @param  method_name      IN  method
+ * 
+ * @retval  true if the call was replied to
+ * @retval  false if the method has to be called
+ *******************************************************************************
+ */
+static bool
+_LSHandleReplyFromCache(LSHandle *sh, LSMessage *message, const char *category_name,
+                        const char *method_name)
+{
+    if (_LSMessageGetSubscribeState(message) != _LSMessageSubscribeFalse)
+    {
+        return false;
+    }
+
+    _LSReplyCache *cache = _LSHandleGetReplyCache(sh);
+
+    if (!cache)
+    {
+        return false;
+    }
+
+    char *key = _LSReplyCacheKey(category_name, method_name, LSMessageGetApplicationID(message),
+                                 LSMessageGetPayload(message));
+    _LSReplyCacheEntry *entry = _LSReplyCacheLookup(cache, key);
+
+    if (!entry)
+    {
+        message->replyCacheGeneration = _LSReplyCacheGetGeneration(cache);
+        message->replyCacheKey = key;
+        return false;
+    }
+
+    g_free(key);
+
+    LSError lserror;
+    LSErrorInit(&lserror);
+
+    if (!_LSTransportSendReplyWithLen(message->transport_msg, entry->payload, entry->payload_len, &lserror))
+    {
+        LSErrorPrint(&lserror, stderr);
+        LSErrorFree(&lserror);
+    }
+
+    _LSReplyCacheEntryUnref(entry);
+
+    return true;
+}
+
 static LSMessageHandlerResult
 _LSHandleMethodCall(LSHandle *sh, _LSTransportMessage *transport_msg)
 {
@@ -357,33 +708,65 @@ _LSHandleMethodCall(LSHandle *sh, _LSTransportMessage *transport_msg)
 
     LSMessage *message = _LSMessageNewRef(transport_msg, sh);
     
-    /* look up the name in tableHandlers */
-    GHashTable *categories = sh->tableHandlers;
-
     const char* category_name = LSMessageGetCategory(message);
     const char* method_name = LSMessageGetMethod(message);
 
-    /* find the category in the tableHandlers (LSCategoryTable) */
-    LSCategoryTable *category = g_hash_table_lookup(categories, category_name);
-    if (!category)
+    LSCategoryTable *category = NULL;
+    LSMethod *method = _LSHandleLookupMethod(sh, category_name, method_name, &category);
+
+    if (!method)
     {
-        g_debug("Couldn't find category: %s", category_name);
         retVal = LSMessageHandlerResultUnknownMethod;
         goto exit;
     }
 
-    /* find the method in the tableHandlers->methods hash */
-    LSMethod *method = g_hash_table_lookup(category->methods, (gpointer)method_name);
+    if (method->flags & LUNA_METHOD_FLAG_PRIORITY)
+    {
+        _LSTransportMessageSetReplyPriority(transport_msg, _LSTransportPriorityHigh);
+    }
+    else if (method->flags & LUNA_METHOD_FLAG_BULK)
+    {
+        _LSTransportMessageSetReplyPriority(transport_msg, _LSTransportPriorityBulk);
+    }
 
-    if (!method)
+    if (method->flags & LUNA_METHOD_FLAG_IDEMPOTENT)
+    {
+        /* lets callers that coalesce calls know they may share this one */
+        _LSTransportMessageSetReplyFlags(transport_msg, LS_TRANSPORT_HEADER_FLAG_IDEMPOTENT);
+    }
+
+    if ((method->flags & LUNA_METHOD_FLAG_CACHEABLE) &&
+        _LSHandleReplyFromCache(sh, message, category_name, method_name))
     {
-        g_debug("couldn't find method: %s", method_name);
-        retVal = LSMessageHandlerResultUnknownMethod;
         goto exit;
     }
 
+    if (category->thread_safe && sh->worker_pool)
+    {
+        _LSWorkItem *item = g_slice_new(_LSWorkItem);
+
+        if (item)
+        {
+            /* the work item takes over our ref of the message */
+            item->message = message;
+            item->method = method;
+            item->category_user_data = category->category_user_data;
+            g_thread_pool_push(sh->worker_pool, item, NULL);
+            return retVal;
+        }
+
+        /* OOM: just handle it here */
+    }
+
+    gint64 start_us = _LSLatencyNowUs();
+
     bool handled = method->function(sh, message, category->category_user_data);
 
+    guint64 handler_us = _LSLatencyNowUs() - start_us;
+
+    _LSLatencyStatsAddMethod(sh->latency_stats, category_name, method, handler_us);
+    _LSRecordSlowCall(sh, message, category_name, method, handler_us);
+
     if (!handled)
     {
         g_debug("method wasn't handled!");
@@ -439,6 +822,8 @@ _LSCategoryTableFree(LSCategoryTable *table)
 {
     if (table->methods)
         g_hash_table_unref(table->methods);
+    if (table->private_methods)
+        g_hash_table_unref(table->private_methods);
     if (table->signals)
         g_hash_table_unref(table->signals);
     if (table->properties)
@@ -451,6 +836,15 @@ _LSCategoryTableFree(LSCategoryTable *table)
     g_free(table);
 }
 
+/* category path -> LSCategoryTable */
+static GHashTable*
+_LSCategoryTablesNew(void)
+{
+    return g_hash_table_new_full(g_str_hash, g_str_equal,
+        /*key*/ (GDestroyNotify)g_free,
+        /*value*/ (GDestroyNotify)_LSCategoryTableFree);
+}
+
 /* @} END OF LunaServiceInternals */
 
 /**
@@ -584,13 +978,18 @@ _LSPrivatePing(LSHandle* lshandle, LSMessage *message, void *user_data)
 
 static LSMethod _privateMethods[] = {
     { "cancel", _LSPrivateCancel},
-    { "ping", _LSPrivatePing},
+    { "ping", _LSPrivatePing, LUNA_METHOD_FLAG_PRIORITY},
 #ifdef SUBSCRIPTION_DEBUG
     { "subscriptions", _LSPrivateGetSubscriptions},
 #endif
 #ifdef MALLOC_DEBUG
     { "mallinfo", _LSPrivateGetMallinfo},
     { "malloc_trim", _LSPrivateDoMallocTrim},
+#endif
+#ifdef LATENCY_DEBUG
+    { "latency", _LSPrivateGetLatency},
+    { "slowcalls", _LSPrivateGetSlowCalls},
+    { "trace", _LSPrivateGetTrace},
 #endif
     { },
 };
@@ -617,45 +1016,300 @@ LSSetDisconnectHandler(LSHandle *sh, LSDisconnectHandler disconnect_handler,
     return true;
 }
 
-/*
-    We need a common routine one level down from all the public LSRegister* functions
+/** 
+* @brief Set a function to be called when the queue of messages waiting to
+* be sent to a service crosses a high-water mark (congested is true) and
+* again once it drains back below the low-water marks (congested is false).
+*
+* The handler is called from whichever thread sent or drained the queue
+* (i.e., possibly not the mainloop thread) and without any internal locks
+* held, so it may call LSCall/LSMessageReply itself.
+* 
+* @param  sh 
+* @param  flow_control_handler   NULL to stop notifications
+* @param  user_data 
+* @param  lserror 
+* 
+* @retval
 */
 bool
-_LSRegisterCommon(const char *name, LSHandle **ret_sh,
-                  bool public_bus,
-                  void *call_ret_addr,
-                  LSError *lserror)
+LSSetFlowControlHandler(LSHandle *sh, LSFlowControlHandler flow_control_handler,
+                        void *user_data,
+                        LSError *lserror)
 {
-    _LSErrorIfFail(ret_sh != NULL, lserror);
-
-    pthread_once(&state.key_once, _LSInit);
+    _LSErrorIfFail(sh != NULL, lserror);
+    LSHANDLE_VALIDATE(sh);
+    sh->flow_control_handler = flow_control_handler;
+    sh->flow_control_handler_data = user_data;
+    return true;
+}
 
-    LSHandle *sh = g_new0(LSHandle, 1);
-    if (!sh)
-    {
-        _LSErrorSetOOM(lserror);
-        goto error;
-    }
+/** 
+* @brief Set the flow control thresholds for the queues of messages waiting
+* to be sent from this handle. A queue becomes congested when it holds at
+* least high_bytes bytes or high_messages messages and stops being
+* congested once it's at or below both low_bytes and low_messages. A high
+* value of 0 disables that limit.
+* 
+* @param  sh 
+* @param  high_bytes 
+* @param  low_bytes 
+* @param  high_messages 
+* @param  low_messages 
+* @param  lserror 
+* 
+* @retval
+*/
+bool
+LSSetFlowControlWatermarks(LSHandle *sh, unsigned long high_bytes, unsigned long low_bytes,
+                           unsigned int high_messages, unsigned int low_messages,
+                           LSError *lserror)
+{
+    _LSErrorIfFail(sh != NULL, lserror);
+    LSHANDLE_VALIDATE(sh);
 
-    /* For backward compatibility, convert empty string to NULL */
-    if (name && name[0] == '\0')
+    if ((high_bytes && low_bytes > high_bytes) || (high_messages && low_messages > high_messages))
     {
-        name = NULL;
+        _LSErrorSet(lserror, -EINVAL, "Low-water mark is above high-water mark");
+        return false;
     }
 
-    sh->name        = g_strdup(name);
-    sh->transport     = NULL;
+    _LSTransportWatermarks watermarks = {
+        .high_bytes = high_bytes,
+        .low_bytes = low_bytes,
+        .high_messages = high_messages,
+        .low_messages = low_messages
+    };
 
-    LSHANDLE_SET_VALID(sh, call_ret_addr);
+    _LSTransportSetWatermarks(sh->transport, &watermarks);
 
-    if (name && !sh->name)
-    {
-        _LSErrorSetOOM(lserror);
-        goto error;
-    }
+    return true;
+}
 
-    /* custom message queue */
-    sh->custom_message_queue = LSCustomMessageQueueNew();
+/** 
+* @brief Set how big a message has to be before it's compressed on its way
+* to a peer that can decompress it. Compression mostly helps over inet
+* connections (e.g., a bus bridged to the desktop or emulator), which is
+* the only kind that compresses by default. A threshold of 0 turns
+* compression off for that kind of connection.
+* 
+* @param  sh 
+* @param  inet_bytes 
+* @param  local_bytes 
+* @param  lserror 
+* 
+* @retval
+*/
+bool
+LSSetCompressionThresholds(LSHandle *sh, unsigned long inet_bytes, unsigned long local_bytes,
+                           LSError *lserror)
+{
+    _LSErrorIfFail(sh != NULL, lserror);
+    LSHANDLE_VALIDATE(sh);
+
+    _LSTransportSetCompressThresholds(sh->transport, inet_bytes, local_bytes);
+
+    return true;
+}
+
+/** 
+* @brief Close connections to other services after timeout_sec without any
+* traffic, to bound the fds and main loop watches of a service that talks to
+* many peers now and then. A connection is only closed if we have no calls
+* (or subscriptions) outstanding to that service, and the next call to it
+* transparently opens a new one. The default comes from the
+* LS_IDLE_CONNECTION_SEC environment variable.
+*
+* Idle connections are looked for every few seconds while the handle is
+* attached to a main loop, so the timeout is approximate.
+* 
+* @param  sh 
+* @param  timeout_sec  idle time in seconds (0 to keep connections open)
+* @param  lserror 
+* 
+* @retval
+*/
+bool
+LSSetIdleConnectionTimeout(LSHandle *sh, int timeout_sec, LSError *lserror)
+{
+    _LSErrorIfFail(sh != NULL, lserror);
+    LSHANDLE_VALIDATE(sh);
+
+    _LSErrorIfFail(timeout_sec >= 0, lserror);
+
+    _LSTransportSetIdleTimeout(sh->transport, timeout_sec);
+
+    return true;
+}
+
+/** 
+* @brief Check whether there are so many messages queued for a service that
+* the flow control high-water mark was hit (and they haven't drained yet).
+* 
+* @param  sh 
+* @param  serviceName 
+* 
+* @retval true if congested
+*/
+bool
+LSIsServiceCongested(LSHandle *sh, const char *serviceName)
+{
+    if (!sh || !serviceName)
+    {
+        return false;
+    }
+
+    LSHANDLE_VALIDATE(sh);
+
+    return _LSTransportIsServiceCongested(sh->bus, serviceName);
+}
+
+static void
+_LSFlowControlHandler(_LSTransportClient *client, bool congested, void *context)
+{
+    LSHandle *sh = (LSHandle *)context;
+
+    if (sh->flow_control_handler)
+    {
+        sh->flow_control_handler(sh, _LSTransportClientGetServiceName(client),
+                                 _LSTransportClientGetUniqueName(client),
+                                 congested, sh->flow_control_handler_data);
+    }
+}
+
+/** 
+* @brief Free a handle and everything it owns. The handles of a palm service
+*        that share their transport, catalog and method tables go away
+*        together, so the other one is freed as well.
+* 
+* @param  sh 
+* @param  flush_and_send_shutdown 
+* @param  call_ret_addr 
+*/
+static void
+_LSUnregisterHandles(LSHandle *sh, bool flush_and_send_shutdown, void *call_ret_addr)
+{
+    LSHandle *handles[2] = { sh, sh->palm_peer };
+    int num_handles = sh->palm_peer ? 2 : 1;
+    int i;
+
+    /* let queued calls finish; this has to happen outside the global lock
+     * since the methods may take it */
+    for (i = 0; i < num_handles; i++)
+    {
+        if (handles[i]->worker_pool)
+        {
+            g_thread_pool_free(handles[i]->worker_pool, FALSE, TRUE);
+            handles[i]->worker_pool = NULL;
+        }
+    }
+
+    _global_lock();
+
+    if (sh->tableHandlers)
+    {
+        g_hash_table_unref(sh->tableHandlers);
+    }
+
+    /* this cancels the subscribers' server status watches, so it has to
+     * happen while the handles they were added through are still around */
+    _CatalogFree(sh->catalog);
+
+    for (i = 0; i < num_handles; i++)
+    {
+        LSHandle *cur = handles[i];
+
+        if (cur->dispatchCache)
+        {
+            g_hash_table_unref(cur->dispatchCache);
+        }
+
+        if (cur->coalesce_keys)
+        {
+            g_hash_table_unref(cur->coalesce_keys);
+        }
+
+        if (cur->custom_message_queue)
+        {
+            LSCustomMessageQueueFree(cur->custom_message_queue);
+            cur->custom_message_queue = NULL;
+        }
+
+        _CallMapDeinit(cur, cur->callmap);
+
+        if (cur->latency_stats) _LSLatencyStatsFree(cur->latency_stats);
+
+        if (cur->slow_calls) _LSSlowCallRingFree(cur->slow_calls);
+
+        if (cur->reply_cache) _LSReplyCacheFree(cur->reply_cache);
+    }
+
+    if (sh->transport)
+    {
+        _LSTransportDisconnect(sh->transport, flush_and_send_shutdown);
+
+        _LSTransportDeinit(sh->transport);
+    }
+
+    for (i = 0; i < num_handles; i++)
+    {
+        LSHandle *cur = handles[i];
+
+        /* Now we can cleanup the gmainloop connection. */
+        if (cur->context)
+        {
+            g_main_context_unref(cur->context);
+            cur->context = NULL;
+        }
+
+        g_free(cur->name);
+
+        LSHANDLE_SET_DESTROYED(cur, call_ret_addr);
+
+#ifdef MEMCHECK
+        LSHANDLE_POISON(cur);
+#endif
+
+        g_free(cur);
+    }
+
+    _global_unlock();
+}
+
+/** 
+* @brief Allocate a handle, with everything it never shares with another
+*        handle.
+* 
+* @param  name 
+* @param  call_ret_addr 
+* @param  lserror 
+* 
+* @retval handle on success
+* @retval NULL on failure
+*/
+static LSHandle*
+_LSHandleNew(const char *name, void *call_ret_addr, LSError *lserror)
+{
+    LSHandle *sh = g_new0(LSHandle, 1);
+    if (!sh)
+    {
+        _LSErrorSetOOM(lserror);
+        return NULL;
+    }
+
+    sh->name        = g_strdup(name);
+    sh->transport     = NULL;
+
+    LSHANDLE_SET_VALID(sh, call_ret_addr);
+
+    if (name && !sh->name)
+    {
+        _LSErrorSetOOM(lserror);
+        goto error;
+    }
+
+    /* custom message queue */
+    sh->custom_message_queue = LSCustomMessageQueueNew();
 
     if (!sh->custom_message_queue)
     {
@@ -663,39 +1317,109 @@ _LSRegisterCommon(const char *name, LSHandle **ret_sh,
         goto error;
     }
 
-    LSTransportHandlers _LSTransportHandler =
+    sh->latency_stats = _LSLatencyStatsNew();
+
+    if (!sh->latency_stats)
     {
-        .msg_handler = _LSMessageHandler,
-        .msg_context = sh, 
-        .disconnect_handler = _LSDisconnectHandler,
-        .disconnect_context = sh,
-        .message_failure_handler = _LSHandleMessageFailure,
-        .message_failure_context = sh
-    };
+        _LSErrorSetOOM(lserror);
+        goto error;
+    }
 
-    if (!_LSTransportInit(&sh->transport, name, &_LSTransportHandler, lserror))
+    if (_ls_slow_call_threshold_ms > 0 && !LSSetSlowCallThreshold(sh, _ls_slow_call_threshold_ms, lserror))
     {
         goto error;
     }
-    
-    /* Connect to the hub and listen for incoming calls */
-    if (!_LSTransportConnect(sh->transport, true, public_bus, lserror))
+
+    if (!_CallMapInit(sh, &sh->callmap, lserror))
+    {
+        goto error;
+    }
+
+    return sh;
+
+error:
+    _LSUnregisterHandles(sh, true, call_ret_addr);
+    return NULL;
+}
+
+static void
+_LSHandleInitTransportHandlers(LSHandle *sh, LSTransportHandlers *handlers)
+{
+    handlers->msg_handler = _LSMessageHandler;
+    handlers->msg_context = sh;
+    handlers->disconnect_handler = _LSDisconnectHandler;
+    handlers->disconnect_context = sh;
+    handlers->message_failure_handler = _LSHandleMessageFailure;
+    handlers->message_failure_context = sh;
+    handlers->flow_control_handler = _LSFlowControlHandler;
+    handlers->flow_control_context = sh;
+    handlers->idle_handler = _LSIdleHandler;
+    handlers->idle_context = sh;
+}
+
+/* Connect to the hub and listen for incoming calls */
+static bool
+_LSHandleConnect(LSHandle *sh, bool public_bus, LSError *lserror)
+{
+    if (!_LSTransportConnect(sh->bus, true, public_bus, lserror))
     {
         if (lserror->error_code == LS_ERROR_CODE_CONNECT_FAILURE)
         {
             g_critical("Failed to connect. Is the hub running?");
         }
+        return false;
+    }
+
+    return true;
+}
+
+/*
+    We need a common routine one level down from all the public LSRegister* functions
+*/
+bool
+_LSRegisterCommon(const char *name, LSHandle **ret_sh,
+                  bool public_bus,
+                  void *call_ret_addr,
+                  LSError *lserror)
+{
+    _LSErrorIfFail(ret_sh != NULL, lserror);
+
+    pthread_once(&state.key_once, _LSInit);
+
+    /* For backward compatibility, convert empty string to NULL */
+    if (name && name[0] == '\0')
+    {
+        name = NULL;
+    }
+
+    LSHandle *sh = _LSHandleNew(name, call_ret_addr, lserror);
+    if (!sh)
+    {
+        *ret_sh = NULL;
+        return false;
+    }
+
+    LSTransportHandlers _LSTransportHandler;
+    _LSHandleInitTransportHandlers(sh, &_LSTransportHandler);
+
+    if (!_LSTransportInit(&sh->transport, name, &_LSTransportHandler, lserror))
+    {
         goto error;
-    } 
+    }
 
-    if (!_CallMapInit(sh, &sh->callmap, lserror))
+    sh->bus = _LSTransportGetBus(sh->transport);
+
+    _LSTransportSetIdleTimeout(sh->transport, _ls_idle_connection_timeout_sec);
+
+    if (!_LSHandleConnect(sh, public_bus, lserror))
     {
         goto error;
     }
 
-    sh->catalog = _CatalogNew(sh);
+    sh->catalog = _CatalogNew();
     if (!sh->catalog)
     {
+        _LSErrorSetOOM(lserror);
         goto error;
     }
 
@@ -709,26 +1433,7 @@ _LSRegisterCommon(const char *name, LSHandle **ret_sh,
     return true;
 
 error:
-
-    if (sh)
-    {
-        _LSTransportDisconnect(sh->transport, true);
-        _LSTransportDeinit(sh->transport);
-        _CallMapDeinit(sh, sh->callmap);
-        _CatalogFree(sh->catalog);
-
-        if (sh->custom_message_queue) LSCustomMessageQueueFree(sh->custom_message_queue);
-
-        g_free(sh->name);
-
-        LSHANDLE_SET_DESTROYED(sh, call_ret_addr);
-
-#ifdef MEMCHECK
-        LSHANDLE_POISON(sh);
-#endif
-
-        g_free(sh);
-    }
+    _LSUnregisterHandles(sh, true, call_ret_addr);
 
     *ret_sh = NULL;
 
@@ -771,54 +1476,337 @@ LSHandleGetName(LSHandle *sh)
 * it never expects to be sent messages.
 * 
 * @param  name 
-* @param  *serviceHandle 
+* @param  *serviceHandle 
+* @param  lserror 
+* 
+* @retval
+*/
+bool
+LSRegister(const char *name, LSHandle **sh,
+                  LSError *lserror)
+{
+    bool use_public_bus = false;
+    if (access("/var/preferences/com.palm.bus/public_bus_default", R_OK) == 0)
+    {
+        use_public_bus = true;
+    }
+    return _LSRegisterCommon(name, sh, use_public_bus, LSHANDLE_GET_RETURN_ADDR(), lserror);
+}
+
+bool
+_LSUnregisterPalmServiceCommon(LSPalmService *psh, bool flush_and_send_shutdown, void *call_ret_addr, LSError *lserror)
+{
+    bool retVal = true;
+
+    if (psh->public_sh && psh->public_sh->palm_peer)
+    {
+        /* the handles share their transport, catalog and method tables,
+         * so they go away together */
+        _LSUnregisterHandles(psh->public_sh, flush_and_send_shutdown, call_ret_addr);
+        psh->public_sh = NULL;
+        psh->private_sh = NULL;
+        return true;
+    }
+
+    if (psh->public_sh)
+    {
+        retVal = _LSUnregisterCommon(psh->public_sh, flush_and_send_shutdown, call_ret_addr, lserror);
+        if (!retVal) return retVal;
+        psh->public_sh = NULL;
+    }
+
+    if (psh->private_sh)
+    {
+        retVal = _LSUnregisterCommon(psh->private_sh, flush_and_send_shutdown, call_ret_addr, lserror);
+        if (!retVal) return retVal;
+        psh->private_sh = NULL;
+    }
+
+    return retVal;
+}
+
+bool
+LSUnregisterPalmService(LSPalmService *psh, LSError *lserror)
+{
+    _LSErrorIfFail(psh != NULL, lserror);
+
+    (void)_LSUnregisterPalmServiceCommon(psh, true, LSHANDLE_GET_RETURN_ADDR(), lserror);
+
+    g_free(psh);
+    return true;
+}
+
+
+/** Arguments for registering (or just connecting) one handle of a palm
+ * service, possibly on a thread of its own */
+typedef struct _LSRegisterPrivateArgs
+{
+    const char *name;
+    void       *call_ret_addr;
+    LSHandle   *sh;
+    bool        ret;
+    LSError     lserror;
+} _LSRegisterPrivateArgs;
+
+static void*
+_LSRegisterPrivateThread(void *data)
+{
+    _LSRegisterPrivateArgs *args = data;
+
+    args->ret = _LSRegisterCommon(args->name, &args->sh, false, args->call_ret_addr, &args->lserror);
+
+    return NULL;
+}
+
+/* Connects the private handle of a palm service that already has its
+ * transport (see _LSRegisterPalmServiceShared) */
+static void*
+_LSConnectPrivateThread(void *data)
+{
+    _LSRegisterPrivateArgs *args = data;
+
+    args->ret = _LSHandleConnect(args->sh, false, &args->lserror);
+
+    return NULL;
+}
+
+/** 
+* @brief Run the private bus half of registering a palm service on a thread
+*        of its own while the calling thread does the public half. The two
+*        hubs are independent, so both connections are brought up at the
+*        same time rather than one after the other.
+* 
+* @param  public_half   IN  registers or connects the public handle
+* @param  public_arg    IN  argument to public_half
+* @param  private_half  IN  registers or connects the private handle
+* @param  private_args  IN/OUT arguments to private_half, with its result
+* @param  lserror       OUT set on error
+* 
+* @retval true if both halves succeeded
+*/
+static bool
+_LSRegisterPalmServiceHalves(bool (*public_half)(void *arg, LSError *lserror), void *public_arg,
+                             void* (*private_half)(void *data), _LSRegisterPrivateArgs *private_args,
+                             LSError *lserror)
+{
+    pthread_t private_thread;
+
+    bool threaded = (pthread_create(&private_thread, NULL, private_half, private_args) == 0);
+
+    if (!threaded)
+    {
+        /* do it here after the public one */
+        g_debug("%s: could not create thread, registering serially", __FUNCTION__);
+    }
+
+    bool retVal = public_half(public_arg, lserror);
+
+    if (threaded)
+    {
+        pthread_join(private_thread, NULL);
+    }
+    else if (retVal)
+    {
+        private_half(private_args);
+    }
+
+    if (!retVal)
+    {
+        LSErrorFree(&private_args->lserror);
+        return false;
+    }
+
+    if (!private_args->ret)
+    {
+        /* hand the private bus error to the caller */
+        if (lserror)
+        {
+            *lserror = private_args->lserror;
+        }
+        else
+        {
+            LSErrorFree(&private_args->lserror);
+        }
+
+        return false;
+    }
+
+    return true;
+}
+
+static bool
+_LSRegisterPublicHalf(void *arg, LSError *lserror)
+{
+    _LSRegisterPrivateArgs *args = arg;
+
+    return _LSRegisterCommon(args->name, &args->sh, true, args->call_ret_addr, lserror);
+}
+
+static bool
+_LSConnectPublicHalf(void *arg, LSError *lserror)
+{
+    return _LSHandleConnect(arg, true, lserror);
+}
+
+/** 
+* @brief Register the two handles of a palm service independently, each with
+*        its own transport, catalog and method tables.
+* 
+* @param  name 
+* @param  psh           IN/OUT  gets the handles that were registered
+* @param  call_ret_addr 
+* @param  lserror 
+* 
+* @retval
+*/
+static bool
+_LSRegisterPalmServiceSplit(const char *name, LSPalmService *psh, void *call_ret_addr, LSError *lserror)
+{
+    _LSRegisterPrivateArgs public_args = {
+        .name = name,
+        .call_ret_addr = call_ret_addr,
+    };
+    _LSRegisterPrivateArgs private_args = {
+        .name = name,
+        .call_ret_addr = call_ret_addr,
+    };
+
+    LSErrorInit(&private_args.lserror);
+
+    bool retVal = _LSRegisterPalmServiceHalves(_LSRegisterPublicHalf, &public_args,
+                                               _LSRegisterPrivateThread, &private_args, lserror);
+
+    psh->public_sh = public_args.sh;
+    psh->private_sh = private_args.sh;
+
+    return retVal;
+}
+
+/** 
+* @brief Register the two handles of a palm service on one transport, with
+*        one catalog and one set of method tables.
+* 
+*        Only the things that have to be per bus are kept apart: each bus
+*        still has its own hub connection and listen socket (the hub gives
+*        us the listen socket, and which one a connection comes in on tells
+*        us the bus, so what a caller on the public bus can reach doesn't
+*        change). Everything else -- the transport's watches, I/O threads
+*        and connection table, the subscriptions and the registered
+*        categories -- is shared.
+* 
+* @param  name 
+* @param  psh           IN/OUT  gets the handles on success
+* @param  call_ret_addr 
 * @param  lserror 
 * 
 * @retval
 */
-bool
-LSRegister(const char *name, LSHandle **sh,
-                  LSError *lserror)
+static bool
+_LSRegisterPalmServiceShared(const char *name, LSPalmService *psh, void *call_ret_addr, LSError *lserror)
 {
-    bool use_public_bus = false;
-    if (access("/var/preferences/com.palm.bus/public_bus_default", R_OK) == 0)
+    LSTransportHandlers handlers;
+    _LSRegisterPrivateArgs private_args = {
+        .call_ret_addr = call_ret_addr,
+    };
+
+    /* For backward compatibility, convert empty string to NULL */
+    if (name && name[0] == '\0')
     {
-        use_public_bus = true;
+        name = NULL;
     }
-    return _LSRegisterCommon(name, sh, use_public_bus, LSHANDLE_GET_RETURN_ADDR(), lserror);
-}
 
-bool
-LSUnregisterPalmService(LSPalmService *psh, LSError *lserror)
-{
-    _LSErrorIfFail(psh != NULL, lserror);
+    LSHandle *public_sh = _LSHandleNew(name, call_ret_addr, lserror);
+    if (!public_sh)
+    {
+        return false;
+    }
 
-    bool retVal;
+    LSHandle *private_sh = _LSHandleNew(name, call_ret_addr, lserror);
+    if (!private_sh)
+    {
+        _LSUnregisterHandles(public_sh, true, call_ret_addr);
+        return false;
+    }
 
-    if (psh->public_sh)
+    public_sh->palm_peer = private_sh;
+    private_sh->palm_peer = public_sh;
+    private_sh->palm_private = true;
+
+    _LSHandleInitTransportHandlers(public_sh, &handlers);
+
+    if (!_LSTransportInit(&public_sh->transport, name, &handlers, lserror))
     {
-        retVal = _LSUnregisterCommon(psh->public_sh, true, LSHANDLE_GET_RETURN_ADDR(), lserror );
-        if (!retVal) goto error;
+        goto error;
     }
 
-    if (psh->private_sh)
+    public_sh->bus = _LSTransportGetBus(public_sh->transport);
+    private_sh->transport = public_sh->transport;
+
+    _LSHandleInitTransportHandlers(private_sh, &handlers);
+
+    if (!_LSTransportAddBus(private_sh->transport, &handlers, &private_sh->bus, lserror))
     {
-        retVal = _LSUnregisterCommon(psh->private_sh, true, LSHANDLE_GET_RETURN_ADDR(), lserror );
-        if (!retVal) goto error;
+        goto error;
     }
 
-error:
-    g_free(psh);
+    _LSTransportSetIdleTimeout(public_sh->transport, _ls_idle_connection_timeout_sec);
+
+    private_args.sh = private_sh;
+    LSErrorInit(&private_args.lserror);
+
+    if (!_LSRegisterPalmServiceHalves(_LSConnectPublicHalf, public_sh,
+                                      _LSConnectPrivateThread, &private_args, lserror))
+    {
+        goto error;
+    }
+
+    public_sh->catalog = _CatalogNew();
+    public_sh->tableHandlers = _LSCategoryTablesNew();
+
+    if (!public_sh->catalog || !public_sh->tableHandlers)
+    {
+        _LSErrorSetOOM(lserror);
+        goto error;
+    }
+
+    private_sh->catalog = public_sh->catalog;
+    private_sh->tableHandlers = public_sh->tableHandlers;
+
+    if (!LSRegisterCategory(public_sh, "/com/palm/luna/private", _privateMethods, NULL, NULL, lserror) ||
+        !LSRegisterCategory(private_sh, "/com/palm/luna/private", _privateMethods, NULL, NULL, lserror))
+    {
+        goto error;
+    }
+
+    psh->public_sh = public_sh;
+    psh->private_sh = private_sh;
+
     return true;
-}
 
+error:
+    _LSUnregisterHandles(public_sh, true, call_ret_addr);
+    return false;
+}
 
 /** 
 * @brief Register a service that may expose public methods on the public bus,
 *        and internal methods on the private bus.
 * 
+*        The two hubs are independent, so both connections are brought up
+*        at the same time rather than one after the other.
+* 
+*        Both handles run on one transport (so one set of mainloop watches
+*        and threads), and share one subscription catalog and one set of
+*        category tables; subscribers are told apart by the handle they
+*        were added through, and each handle still has its own methods in
+*        a category. Category data, thread safety and settings of the
+*        transport (e.g., LSSetFlowControlWatermarks()) are shared by the
+*        two handles, and they can only be unregistered together, with
+*        LSUnregisterPalmService(). Set LS_SPLIT_PALM_SERVICE in the
+*        environment to give each handle its own instead.
+* 
 * @param  name 
-* @param  *ret_public_service
+* @param  *ret_public_service 
 * @param  lserror 
 * 
 * @retval
@@ -831,15 +1819,25 @@ LSRegisterPalmService(const char *name,
     _LSErrorIfFailMsg(ret_public_service != NULL, lserror,
         -EINVAL, "Invalid parameter ret_public_service to %s", __FUNCTION__);
 
+    pthread_once(&state.key_once, _LSInit);
+
     bool retVal;
 
     LSPalmService *psh = g_new0(LSPalmService,1);
-    
-    retVal = _LSRegisterCommon(name, &psh->public_sh, true, LSHANDLE_GET_RETURN_ADDR(), lserror);
-    if (!retVal) goto error;
 
-    retVal = _LSRegisterCommon(name, &psh->private_sh, false, LSHANDLE_GET_RETURN_ADDR(), lserror);
-    if (!retVal) goto error;
+    if (_ls_split_palm_service)
+    {
+        retVal = _LSRegisterPalmServiceSplit(name, psh, LSHANDLE_GET_RETURN_ADDR(), lserror);
+    }
+    else
+    {
+        retVal = _LSRegisterPalmServiceShared(name, psh, LSHANDLE_GET_RETURN_ADDR(), lserror);
+    }
+
+    if (!retVal)
+    {
+        goto error;
+    }
 
     *ret_public_service = psh;
     return retVal;
@@ -926,9 +1924,7 @@ LSRegisterCategoryAppend(LSHandle *sh, const char *category,
 
     if (!sh->tableHandlers)
     {
-        sh->tableHandlers = g_hash_table_new_full(g_str_hash, g_str_equal,
-            /*key*/ (GDestroyNotify)g_free,
-            /*value*/ (GDestroyNotify)_LSCategoryTableFree);
+        sh->tableHandlers = _LSCategoryTablesNew();
     }
 
     char *category_path = _category_to_object_path_alloc(category);
@@ -940,7 +1936,6 @@ LSRegisterCategoryAppend(LSHandle *sh, const char *category,
         _LSErrorGotoIfFail(fail, table != NULL, lserror, -ENOMEM, "OOM");
 
         table->sh = sh;
-        table->methods    = g_hash_table_new(g_str_hash, g_str_equal);
         table->signals    = g_hash_table_new(g_str_hash, g_str_equal);
         table->category_user_data = NULL;
 
@@ -959,14 +1954,28 @@ LSRegisterCategoryAppend(LSHandle *sh, const char *category,
         category_path = NULL;
     }
 
+    /* the other handle of a palm service may have created the table */
+    GHashTable **table_methods = _LSCategoryTableMethods(sh, table);
+
+    if (!*table_methods)
+    {
+        *table_methods = g_hash_table_new(g_str_hash, g_str_equal);
+    }
+
     /* Add methods to table. */
 
     if (methods)
     {
+        /* methods may be replaced, so drop anything we've resolved */
+        if (sh->dispatchCache)
+        {
+            g_hash_table_remove_all(sh->dispatchCache);
+        }
+
         LSMethod *m;
         for (m = methods; m->name && m->function; m++)
         {
-            g_hash_table_replace(table->methods, (gpointer)m->name, m);
+            g_hash_table_replace(*table_methods, (gpointer)m->name, m);
         }
     }
 
@@ -1072,6 +2081,214 @@ fail:
     return false;
 }
 
+/** 
+* @brief Mark the methods of a category as safe to be called from worker
+*        threads. They are only run on worker threads once
+*        LSSetWorkerThreads() has been called on the handle; everything
+*        else is still dispatched on the mainloop.
+* 
+* @param  sh 
+* @param  category 
+* @param  thread_safe 
+* @param  lserror 
+* 
+* @retval
+*/
+bool
+LSCategorySetThreadSafe(LSHandle *sh, const char *category, bool thread_safe, LSError *lserror)
+{
+    LSHANDLE_VALIDATE(sh);
+
+    LSCategoryTable *table;
+
+    char *categoryPath = _category_to_object_path_alloc(category);
+
+    _global_lock();
+
+    _LSErrorGotoIfFail(fail, sh->tableHandlers != NULL, lserror,
+        -1, "%s: %s not registered.", __FUNCTION__, category);
+
+    table = g_hash_table_lookup(sh->tableHandlers, categoryPath);
+    _LSErrorGotoIfFail(fail, table != NULL, lserror,
+        -1, "%s: %s not registered.", __FUNCTION__, category);
+
+    table->thread_safe = thread_safe;
+
+    _global_unlock();
+    g_free(categoryPath);
+    return true;
+
+fail:
+    _global_unlock();
+    g_free(categoryPath);
+
+    return false;
+}
+
+/** 
+* @brief Start (or resize) a pool of worker threads that run the methods of
+*        categories marked with LSCategorySetThreadSafe(). I/O and all other
+*        dispatch stays on the mainloop.
+*
+*        The pool is shut down in LSUnregister(), after the queued calls
+*        have run, so LSUnregister() must not be called from a method
+*        running on a worker thread.
+* 
+* @param  sh 
+* @param  max_threads   maximum number of threads (> 0)
+* @param  lserror 
+* 
+* @retval
+*/
+bool
+LSSetWorkerThreads(LSHandle *sh, int max_threads, LSError *lserror)
+{
+    LSHANDLE_VALIDATE(sh);
+
+    _LSErrorIfFail(max_threads > 0, lserror);
+
+    GError *gerror = NULL;
+    bool ret = true;
+
+    _global_lock();
+
+    if (sh->worker_pool)
+    {
+        g_thread_pool_set_max_threads(sh->worker_pool, max_threads, &gerror);
+    }
+    else
+    {
+        sh->worker_pool = g_thread_pool_new(_LSWorkerDispatch, sh, max_threads, FALSE, &gerror);
+    }
+
+    if (gerror)
+    {
+        _LSErrorSet(lserror, -1, "Unable to start worker threads: %s", gerror->message);
+        g_error_free(gerror);
+        ret = false;
+    }
+
+    _global_unlock();
+
+    return ret;
+}
+
+/** 
+* @brief Record method calls whose handler takes at least threshold_ms in a
+*        small ring, which can be read with the "slowcalls" private method
+*        (ls-monitor --slow-calls). The default comes from the LS_SLOW_CALL_MS
+*        environment variable.
+*
+*        Recording only happens for slow calls and doesn't take a lock, so
+*        this is cheap enough to leave on.
+* 
+* @param  sh 
+* @param  threshold_ms  threshold in ms (0 to stop recording)
+* @param  lserror 
+* 
+* @retval
+*/
+bool
+LSSetSlowCallThreshold(LSHandle *sh, int threshold_ms, LSError *lserror)
+{
+    _LSErrorIfFail(sh != NULL, lserror);
+    _LSErrorIfFail(threshold_ms >= 0, lserror);
+
+    LSHANDLE_VALIDATE(sh);
+
+    if (threshold_ms > 0 && !sh->slow_calls)
+    {
+        _LSSlowCallRing *ring = _LSSlowCallRingNew();
+
+        if (!ring)
+        {
+            _LSErrorSetOOM(lserror);
+            return false;
+        }
+
+        /* the ring stays until the handle goes away, so worker threads
+         * never see it freed */
+        if (!g_atomic_pointer_compare_and_exchange(&sh->slow_calls, NULL, ring))
+        {
+            _LSSlowCallRingFree(ring);
+        }
+    }
+
+    sh->slow_call_threshold_us = (guint64)threshold_ms * 1000;
+
+    return true;
+}
+
+/** 
+* @brief Forget the cached replies of a LUNA_METHOD_FLAG_CACHEABLE method,
+*        e.g., when the data it returns changes. Calls that are already
+*        running when this is called don't save their replies.
+* 
+* @param  sh 
+* @param  category  category of the method (may be NULL for default '/' category)
+* @param  method    method (NULL for every method in the category)
+* @param  lserror 
+* 
+* @retval
+*/
+bool
+LSMethodCacheInvalidate(LSHandle *sh, const char *category, const char *method, LSError *lserror)
+{
+    _LSErrorIfFail(sh != NULL, lserror);
+
+    LSHANDLE_VALIDATE(sh);
+
+    _LSReplyCache *cache = g_atomic_pointer_get(&sh->reply_cache);
+
+    /* nothing has been cached yet */
+    if (!cache)
+    {
+        return true;
+    }
+
+    char *category_path = _category_to_object_path_alloc(category);
+
+    _LSReplyCacheInvalidate(cache, category_path, method);
+
+    g_free(category_path);
+
+    return true;
+}
+
+/** 
+* @brief Set how long replies of LUNA_METHOD_FLAG_CACHEABLE methods are
+*        served from the cache (default LS_REPLY_CACHE_DEFAULT_TTL_MS). Only
+*        replies saved after this is called are affected.
+* 
+* @param  sh 
+* @param  ttl_ms    time in ms (0 to serve replies until they're invalidated
+*                   with LSMethodCacheInvalidate())
+* @param  lserror 
+* 
+* @retval
+*/
+bool
+LSMethodCacheSetTimeout(LSHandle *sh, int ttl_ms, LSError *lserror)
+{
+    _LSErrorIfFail(sh != NULL, lserror);
+
+    LSHANDLE_VALIDATE(sh);
+
+    _LSErrorIfFail(ttl_ms >= 0, lserror);
+
+    _LSReplyCache *cache = _LSHandleGetReplyCache(sh);
+
+    if (!cache)
+    {
+        _LSErrorSetOOM(lserror);
+        return false;
+    }
+
+    _LSReplyCacheSetTtl(cache, ttl_ms);
+
+    return true;
+}
+
 static bool
 _category_exists(LSHandle *sh, const char *category)
 {
@@ -1080,7 +2297,11 @@ _category_exists(LSHandle *sh, const char *category)
     char *category_path = _category_to_object_path_alloc(category);
     bool exists = false;
 
-    if (g_hash_table_lookup(sh->tableHandlers, category_path))
+    LSCategoryTable *table = g_hash_table_lookup(sh->tableHandlers, category_path);
+
+    /* if the tables are shared, the other handle registering the category
+     * doesn't count */
+    if (table && *_LSCategoryTableMethods(sh, table))
     {
         exists = true;
     }
@@ -1126,45 +2347,11 @@ _LSUnregisterCommon(LSHandle *sh, bool flush_and_send_shutdown, void *call_ret_a
 {
     _LSErrorIfFail(sh != NULL, lserror);
 
-    _global_lock();
-
-    if (sh->tableHandlers)
-    {
-        g_hash_table_unref(sh->tableHandlers);
-    }
-
-    if (sh->custom_message_queue)
-    {
-        LSCustomMessageQueueFree(sh->custom_message_queue);
-        sh->custom_message_queue = NULL;
-    }
-
-    _CatalogFree(sh->catalog);
-
-    _CallMapDeinit(sh, sh->callmap);
-
-    _LSTransportDisconnect(sh->transport, flush_and_send_shutdown);
-
-    _LSTransportDeinit(sh->transport);
-
-    /* Now we can cleanup the gmainloop connection. */
-    if (sh->context)
-    {
-        g_main_context_unref(sh->context);
-        sh->context = NULL;
-    }
-
-    g_free(sh->name);
-
-    LSHANDLE_SET_DESTROYED(sh, call_ret_addr);
-
-#ifdef MEMCHECK
-    LSHANDLE_POISON(sh);
-#endif
+    _LSErrorIfFailMsg(sh->palm_peer == NULL, lserror, -EINVAL,
+                      "%s: the handle shares its transport with the other handle of its palm service, "
+                      "use LSUnregisterPalmService()", __FUNCTION__);
 
-    g_free(sh);
-
-    _global_unlock();
+    _LSUnregisterHandles(sh, flush_and_send_shutdown, call_ret_addr);
 
     return true;
 }
@@ -1203,7 +2390,7 @@ LSPushRole(LSHandle *sh, const char *role_path, LSError *lserror)
 
     LSHANDLE_VALIDATE(sh);
 
-    return LSTransportPushRole(sh->transport, role_path, lserror);
+    return LSTransportPushRole(sh->bus, role_path, lserror);
 }
 
 /** 
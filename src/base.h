@@ -29,6 +29,8 @@
 #include <cjson/json.h>
 
 #include "error.h"
+#include "latency.h"
+#include "reply_cache.h"
 #include "signal.h"
 #include "subscription.h"
 #include "transport.h"
@@ -51,11 +53,16 @@ struct LSCategoryTable {
 
     LSHandle       *sh;
 
-    GHashTable     *methods;
+    GHashTable     *methods;        /**< for a palm service sharing its tables,
+                                         the methods of the public handle */
+    GHashTable     *private_methods; /**< methods of the private handle of a palm
+                                          service sharing its tables (NULL otherwise) */
     GHashTable     *signals;
     GHashTable     *properties;
 
     void           *category_user_data;
+
+    bool            thread_safe;    /**< methods may be called from worker threads */
 };
 
 typedef struct LSCategoryTable LSCategoryTable;
@@ -75,6 +82,7 @@ bool _CallMapInit(LSHandle *sh, _CallMap **ret_map, LSError *lserror);
 void _CallMapDeinit(LSHandle *sh, _CallMap *map);
 
 bool _LSUnregisterCommon(LSHandle *sh, bool flush_and_send_shutdown, void *call_ret_addr, LSError *lserror);
+bool _LSUnregisterPalmServiceCommon(LSPalmService *psh, bool flush_and_send_shutdown, void *call_ret_addr, LSError *lserror);
 
 #ifdef LSHANDLE_CHECK
 /**
@@ -127,17 +135,46 @@ struct LSHandle {
     char           *name;
 
     _LSTransport    *transport;     /**< underlying transport */
+    _LSTransportBus *bus;           /**< bus of the transport this handle is on */
+
+    LSHandle       *palm_peer;     /**< other handle of a palm service that shares
+                                        this one's transport, catalog and
+                                        tableHandlers (NULL if nothing is shared) */
+    bool            palm_private;  /**< private handle of such a palm service */
 
     GMainContext   *context;       /**< context associated with this handle */
 
     _CallMap       *callmap;       /**< contains outbound calls -> cbs */
     _Catalog       *catalog;       /**< contains subscriptions */
 
+    LSFilterFunc    subscription_cancel_function;
+    void           *subscription_cancel_function_ctx;
+    GHashTable     *coalesce_keys; /**< subscription keys whose updates replace
+                                        queued ones (guarded by the catalog lock) */
+
     GHashTable     *tableHandlers; /**< contains method tables */
+    GHashTable     *dispatchCache; /**< (category, method) -> resolved method;
+                                        see _LSHandleMethodCall */
+
+    GThreadPool    *worker_pool;   /**< runs methods of thread-safe categories
+                                        (NULL unless LSSetWorkerThreads is called) */
+
+    _LSLatencyStats *latency_stats; /**< method and call latency histograms */
+
+    guint64         slow_call_threshold_us; /**< record handlers that take at least
+                                                 this long (0 for none) */
+    _LSSlowCallRing *slow_calls;    /**< recent slow handlers (NULL until the
+                                         threshold is first set) */
+
+    _LSReplyCache   *reply_cache;   /**< replies of LUNA_METHOD_FLAG_CACHEABLE methods
+                                         (NULL until one is called) */
 
     LSDisconnectHandler disconnect_handler;
     void           *disconnect_handler_data;
 
+    LSFlowControlHandler flow_control_handler;
+    void           *flow_control_handler_data;
+
     /* FIXME: remove when we don't have a custom mainloop for java */
     _FetchMessageQueue *fetch_message_queue;
                                   /**< queue for fetch style retreival */
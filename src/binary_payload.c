@@ -0,0 +1,580 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2008-2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include <stdint.h>
+#include <string.h>
+#include <glib.h>
+
+#include "binary_payload.h"
+
+/**
+ * @defgroup LunaServiceBinaryPayload
+ * @ingroup LunaServiceInternals
+ * @brief Compact binary payload encoding for connections that negotiated it
+ */
+
+/**
+ * @addtogroup LunaServiceBinaryPayload
+ * @{
+ */
+
+/**
+ * A payload is encoded as a version byte followed by a tree of tagged
+ * values:
+ *
+ *   'n'                            null
+ *   't' / 'f'                      true / false
+ *   'i' varint                     integer (zigzag)
+ *   'd' 8 bytes                    double (host byte order)
+ *   's' varint bytes               string (length, then the bytes)
+ *   '[' value ... ']'              array
+ *   '{' 's'-string value ... '}'   object (key, then its value)
+ *
+ * The encoded payload travels in the same nul-terminated slot of the
+ * message body as a JSON payload, so the tree is then COBS (consistent
+ * overhead byte stuffing) encoded, which removes every 0 byte at a cost of
+ * one byte in 254.
+ *
+ * Like capture files, doubles are in host byte order, so this is only
+ * negotiated between peers on the same architecture.
+ */
+#define BINARY_PAYLOAD_VERSION      1
+#define BINARY_PAYLOAD_MAX_DEPTH    64      /**< deepest nesting encoded or decoded */
+
+#define COBS_MAX_BLOCK              0xFF    /**< code of a block of 254 bytes not followed by a 0 */
+
+typedef struct _LSBinaryPayloadReader
+{
+    const guint8 *p;
+    const guint8 *end;
+} _LSBinaryPayloadReader;
+
+static inline void
+_LSBinaryPayloadPutTag(GByteArray *out, guint8 tag)
+{
+    g_byte_array_append(out, &tag, 1);
+}
+
+static inline void
+_LSBinaryPayloadPutVarint(GByteArray *out, guint64 value)
+{
+    guint8 bytes[10];
+    int len = 0;
+
+    do
+    {
+        bytes[len] = value & 0x7F;
+        value >>= 7;
+        if (value) bytes[len] |= 0x80;
+        len++;
+    } while (value);
+
+    g_byte_array_append(out, bytes, len);
+}
+
+static inline void
+_LSBinaryPayloadPutString(GByteArray *out, const char *str, size_t len)
+{
+    _LSBinaryPayloadPutTag(out, 's');
+    _LSBinaryPayloadPutVarint(out, len);
+    g_byte_array_append(out, (const guint8*)str, len);
+}
+
+static bool
+_LSBinaryPayloadPutValue(GByteArray *out, struct json_object *object, int depth)
+{
+    if (depth > BINARY_PAYLOAD_MAX_DEPTH)
+    {
+        return false;
+    }
+
+    switch (json_object_get_type(object))
+    {
+    case json_type_null:
+        _LSBinaryPayloadPutTag(out, 'n');
+        return true;
+
+    case json_type_boolean:
+        _LSBinaryPayloadPutTag(out, json_object_get_boolean(object) ? 't' : 'f');
+        return true;
+
+    case json_type_int:
+    {
+        gint64 value = json_object_get_int(object);
+
+        _LSBinaryPayloadPutTag(out, 'i');
+        _LSBinaryPayloadPutVarint(out, ((guint64)value << 1) ^ (guint64)(value >> 63));
+        return true;
+    }
+
+    case json_type_double:
+    {
+        double value = json_object_get_double(object);
+
+        _LSBinaryPayloadPutTag(out, 'd');
+        g_byte_array_append(out, (const guint8*)&value, sizeof(value));
+        return true;
+    }
+
+    case json_type_string:
+    {
+        const char *str = json_object_get_string(object);
+
+        _LSBinaryPayloadPutString(out, str, strlen(str));
+        return true;
+    }
+
+    case json_type_array:
+    {
+        int i;
+        int len = json_object_array_length(object);
+
+        _LSBinaryPayloadPutTag(out, '[');
+
+        for (i = 0; i < len; i++)
+        {
+            if (!_LSBinaryPayloadPutValue(out, json_object_array_get_idx(object, i), depth + 1))
+            {
+                return false;
+            }
+        }
+
+        _LSBinaryPayloadPutTag(out, ']');
+        return true;
+    }
+
+    case json_type_object:
+    {
+        _LSBinaryPayloadPutTag(out, '{');
+
+        json_object_object_foreach(object, key, val)
+        {
+            _LSBinaryPayloadPutString(out, key, strlen(key));
+
+            if (!_LSBinaryPayloadPutValue(out, val, depth + 1))
+            {
+                return false;
+            }
+        }
+
+        _LSBinaryPayloadPutTag(out, '}');
+        return true;
+    }
+
+    default:
+        return false;
+    }
+}
+
+/**
+ *******************************************************************************
+ * @brief COBS encode a buffer.
+ *
+ * @param  data     IN  data
+ * @param  len      IN  size of data
+ * @param  out_len  OUT length of the result, not including the nul
+ *
+ * @retval  nul-terminated result without any other 0 bytes (caller frees)
+ *******************************************************************************
+ */
+static char*
+_LSBinaryPayloadStuff(const guint8 *data, size_t len, unsigned long *out_len)
+{
+    /* one code byte per (partial) block of 254, plus the nul */
+    guint8 *out = g_malloc(len + len / (COBS_MAX_BLOCK - 1) + 2);
+    size_t code_pos = 0;
+    size_t pos = 1;
+    guint8 code = 1;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        if (data[i] == 0)
+        {
+            out[code_pos] = code;
+            code_pos = pos++;
+            code = 1;
+        }
+        else
+        {
+            out[pos++] = data[i];
+            code++;
+
+            if (code == COBS_MAX_BLOCK)
+            {
+                out[code_pos] = code;
+                code_pos = pos++;
+                code = 1;
+            }
+        }
+    }
+
+    out[code_pos] = code;
+    out[pos] = '\0';
+
+    *out_len = pos;
+
+    return (char*)out;
+}
+
+/**
+ *******************************************************************************
+ * @brief Undo @ref _LSBinaryPayloadStuff.
+ *
+ * @param  data     IN  COBS encoded data
+ * @param  len      IN  size of data
+ * @param  out      OUT decoded data (at most len bytes)
+ * @param  out_len  OUT size of decoded data
+ *
+ * @retval  true on success
+ * @retval  false if data isn't valid COBS
+ *******************************************************************************
+ */
+static bool
+_LSBinaryPayloadUnstuff(const guint8 *data, size_t len, guint8 *out, size_t *out_len)
+{
+    size_t pos = 0;
+    size_t o = 0;
+
+    while (pos < len)
+    {
+        guint8 code = data[pos++];
+
+        if (code == 0 || pos + code - 1 > len)
+        {
+            return false;
+        }
+
+        memcpy(out + o, data + pos, code - 1);
+        o += code - 1;
+        pos += code - 1;
+
+        if (code != COBS_MAX_BLOCK && pos < len)
+        {
+            out[o++] = 0;
+        }
+    }
+
+    *out_len = o;
+
+    return true;
+}
+
+static bool
+_LSBinaryPayloadGetVarint(_LSBinaryPayloadReader *reader, guint64 *value)
+{
+    guint64 result = 0;
+    int shift;
+
+    for (shift = 0; shift < 64 && reader->p < reader->end; shift += 7)
+    {
+        guint8 byte = *reader->p++;
+
+        result |= (guint64)(byte & 0x7F) << shift;
+
+        if (!(byte & 0x80))
+        {
+            *value = result;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool
+_LSBinaryPayloadGetString(_LSBinaryPayloadReader *reader, const char **str, size_t *len)
+{
+    guint64 str_len;
+
+    if (reader->p >= reader->end || *reader->p++ != 's')
+    {
+        return false;
+    }
+
+    if (!_LSBinaryPayloadGetVarint(reader, &str_len) || str_len > (guint64)(reader->end - reader->p))
+    {
+        return false;
+    }
+
+    *str = (const char*)reader->p;
+    *len = str_len;
+    reader->p += str_len;
+
+    return true;
+}
+
+/**
+ *******************************************************************************
+ * @brief Decode one value (and everything nested in it).
+ *
+ * @param  reader   IN  position in the (unstuffed) payload
+ * @param  depth    IN  nesting depth of the value
+ * @param  value    OUT value (NULL for a JSON null)
+ *
+ * @retval  true on success
+ * @retval  false if the payload is malformed
+ *******************************************************************************
+ */
+static bool
+_LSBinaryPayloadGetValue(_LSBinaryPayloadReader *reader, int depth, struct json_object **value)
+{
+    *value = NULL;
+
+    if (depth > BINARY_PAYLOAD_MAX_DEPTH || reader->p >= reader->end)
+    {
+        return false;
+    }
+
+    switch (*reader->p)
+    {
+    case 'n':
+        reader->p++;
+        return true;
+
+    case 't':
+    case 'f':
+        *value = json_object_new_boolean(*reader->p++ == 't');
+        return true;
+
+    case 'i':
+    {
+        guint64 zigzag;
+
+        reader->p++;
+
+        if (!_LSBinaryPayloadGetVarint(reader, &zigzag))
+        {
+            return false;
+        }
+
+        *value = json_object_new_int((int)((gint64)(zigzag >> 1) ^ -(gint64)(zigzag & 1)));
+        return true;
+    }
+
+    case 'd':
+    {
+        double d;
+
+        reader->p++;
+
+        if (reader->end - reader->p < (ptrdiff_t)sizeof(d))
+        {
+            return false;
+        }
+
+        memcpy(&d, reader->p, sizeof(d));
+        reader->p += sizeof(d);
+
+        *value = json_object_new_double(d);
+        return true;
+    }
+
+    case 's':
+    {
+        const char *str;
+        size_t len;
+
+        if (!_LSBinaryPayloadGetString(reader, &str, &len))
+        {
+            return false;
+        }
+
+        *value = json_object_new_string_len(str, len);
+        return true;
+    }
+
+    case '[':
+    {
+        struct json_object *array = json_object_new_array();
+
+        reader->p++;
+
+        while (reader->p < reader->end && *reader->p != ']')
+        {
+            struct json_object *element;
+
+            if (!_LSBinaryPayloadGetValue(reader, depth + 1, &element))
+            {
+                json_object_put(array);
+                return false;
+            }
+
+            json_object_array_add(array, element);
+        }
+
+        if (reader->p >= reader->end)
+        {
+            json_object_put(array);
+            return false;
+        }
+
+        reader->p++;
+        *value = array;
+        return true;
+    }
+
+    case '{':
+    {
+        struct json_object *object = json_object_new_object();
+
+        reader->p++;
+
+        while (reader->p < reader->end && *reader->p != '}')
+        {
+            const char *key;
+            size_t key_len;
+            struct json_object *member;
+
+            if (!_LSBinaryPayloadGetString(reader, &key, &key_len) ||
+                !_LSBinaryPayloadGetValue(reader, depth + 1, &member))
+            {
+                json_object_put(object);
+                return false;
+            }
+
+            char *key_str = g_strndup(key, key_len);
+            json_object_object_add(object, key_str, member);
+            g_free(key_str);
+        }
+
+        if (reader->p >= reader->end)
+        {
+            json_object_put(object);
+            return false;
+        }
+
+        reader->p++;
+        *value = object;
+        return true;
+    }
+
+    default:
+        return false;
+    }
+}
+
+/**
+ *******************************************************************************
+ * @brief Encode a payload.
+ *
+ * @param  object       IN  payload
+ * @param  encoded_len  OUT length of the result, not including the nul
+ *
+ * @retval  nul-terminated encoded payload (free with g_free) on success
+ * @retval  NULL if the payload can't be encoded (e.g., nested too deeply)
+ *******************************************************************************
+ */
+char*
+_LSBinaryPayloadEncode(struct json_object *object, unsigned long *encoded_len)
+{
+    GByteArray *tree = g_byte_array_sized_new(256);
+    char *ret = NULL;
+
+    _LSBinaryPayloadPutTag(tree, BINARY_PAYLOAD_VERSION);
+
+    if (_LSBinaryPayloadPutValue(tree, object, 0))
+    {
+        ret = _LSBinaryPayloadStuff(tree->data, tree->len, encoded_len);
+    }
+
+    g_byte_array_free(tree, TRUE);
+
+    return ret;
+}
+
+/**
+ *******************************************************************************
+ * @brief Decode a payload.
+ *
+ * @param  encoded      IN  encoded payload
+ * @param  encoded_len  IN  length of encoded payload, not including the nul
+ * @param  object       OUT payload (NULL for a JSON null; release with
+ *                          json_object_put)
+ *
+ * @retval  true on success
+ * @retval  false if the payload is malformed
+ *******************************************************************************
+ */
+bool
+_LSBinaryPayloadDecode(const char *encoded, unsigned long encoded_len, struct json_object **object)
+{
+    guint8 *tree = g_malloc(encoded_len ? encoded_len : 1);
+    size_t tree_len = 0;
+    bool ret = false;
+
+    *object = NULL;
+
+    if (_LSBinaryPayloadUnstuff((const guint8*)encoded, encoded_len, tree, &tree_len) &&
+        tree_len > 0 && tree[0] == BINARY_PAYLOAD_VERSION)
+    {
+        _LSBinaryPayloadReader reader = {
+            .p = tree + 1,
+            .end = tree + tree_len
+        };
+
+        ret = _LSBinaryPayloadGetValue(&reader, 0, object);
+
+        if (ret && reader.p != reader.end)
+        {
+            /* trailing garbage */
+            if (*object) json_object_put(*object);
+            *object = NULL;
+            ret = false;
+        }
+    }
+
+    g_free(tree);
+
+    return ret;
+}
+
+/**
+ *******************************************************************************
+ * @brief Decode a payload into JSON text, for a receiver that wants the
+ * payload as a string.
+ *
+ * @param  encoded      IN  encoded payload
+ * @param  encoded_len  IN  length of encoded payload, not including the nul
+ * @param  json_len     OUT length of the result, not including the nul
+ *                          (may be NULL)
+ *
+ * @retval  JSON (free with g_free) on success
+ * @retval  NULL if the payload is malformed
+ *******************************************************************************
+ */
+char*
+_LSBinaryPayloadDecodeToJson(const char *encoded, unsigned long encoded_len, unsigned long *json_len)
+{
+    struct json_object *object = NULL;
+
+    if (!_LSBinaryPayloadDecode(encoded, encoded_len, &object))
+    {
+        return NULL;
+    }
+
+    char *ret = g_strdup(json_object_to_json_string(object));
+
+    if (object) json_object_put(object);
+
+    if (json_len) *json_len = strlen(ret);
+
+    return ret;
+}
+
+/* @} END OF LunaServiceBinaryPayload */
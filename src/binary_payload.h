@@ -0,0 +1,31 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2008-2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+
+#ifndef _BINARY_PAYLOAD_H_
+#define _BINARY_PAYLOAD_H_
+
+#include <stdbool.h>
+#include <cjson/json.h>
+
+char* _LSBinaryPayloadEncode(struct json_object *object, unsigned long *encoded_len);
+bool _LSBinaryPayloadDecode(const char *encoded, unsigned long encoded_len, struct json_object **object);
+char* _LSBinaryPayloadDecodeToJson(const char *encoded, unsigned long encoded_len, unsigned long *json_len);
+
+#endif  /* _BINARY_PAYLOAD_H_ */
@@ -37,6 +37,10 @@
 #include "message.h"
 #include "base.h"
 #include "transport_utils.h"
+#include "json_scan.h"
+#include "binary_payload.h"
+#include "trace.h"
+#include "utf8.h"
 
 /**
  * @addtogroup LunaServiceClientInternals
@@ -44,7 +48,7 @@
  */
 
 static bool _LSCallFromApplicationCommon(LSHandle *sh, const char *uri,
-       const char *payload,
+       const char *payload, gssize payload_len, bool binary,
        const char *applicationID,
        LSFilterFunc callback, void *ctx,
        LSMessageToken *ret_token, bool single, LSError *lserror);
@@ -58,14 +62,34 @@ typedef struct _Uri
     char *objectPath;
     char *interfaceName;
     char *methodName;
+
+    gint  ref;          //< held by the parse cache and each user
 } _Uri;
 
+#define URI_CACHE_SIZE  64  /**< max parsed uris kept by _UriParseCached */
+
+/** Recently parsed uris, so that calling the same destinations over and
+ * over doesn't re-parse and re-validate them (and allocate a _Uri) every
+ * time. The queue is in least-recently-used order (head is the most
+ * recent). */
+typedef struct _UriCacheEntry
+{
+    char  *uri;
+    _Uri  *luri;
+} _UriCacheEntry;
+
+static GHashTable *uri_cache = NULL;     //< uri -> GList link in uri_cache_lru
+static GQueue uri_cache_lru = G_QUEUE_INIT;
+static pthread_mutex_t uri_cache_lock = PTHREAD_MUTEX_INITIALIZER;
 
+/* Drops a reference; the _Uri is freed with the last one */
 void
 _UriFree(_Uri *luri)
 {
     if (NULL == luri) return;
 
+    if (!g_atomic_int_dec_and_test(&luri->ref)) return;
+
     g_free(luri->serviceName);
     g_free(luri->objectPath);
     g_free(luri->interfaceName);
@@ -301,6 +325,8 @@ _UriParse(const char *uri, LSError *lserror)
         goto error;
     }
 
+    luri->ref = 1;
+
     service_name_len = first_slash - uri_p;
     luri->serviceName = g_strndup(uri_p, service_name_len);
     uri_p += service_name_len;
@@ -351,6 +377,93 @@ error:
     return NULL;
 }
 
+static _Uri *
+_UriRef(_Uri *luri)
+{
+    g_atomic_int_inc(&luri->ref);
+    return luri;
+}
+
+/** 
+* @brief Like _UriParse(), but served from a small LRU of recently parsed
+* uris when possible. Only valid uris are cached, so errors are reported
+* the same way.
+* 
+* @param  uri 
+* @param  lserror 
+* 
+* @retval parsed uri, release with _UriFree()
+*/
+static _Uri *
+_UriParseCached(const char *uri, LSError *lserror)
+{
+    _Uri *luri = NULL;
+    GList *link = NULL;
+
+    LOCK("UriCache", &uri_cache_lock);
+
+    if (uri_cache)
+    {
+        link = g_hash_table_lookup(uri_cache, uri);
+    }
+
+    if (link)
+    {
+        luri = _UriRef(((_UriCacheEntry*)link->data)->luri);
+
+        /* move to the front */
+        g_queue_unlink(&uri_cache_lru, link);
+        g_queue_push_head_link(&uri_cache_lru, link);
+    }
+
+    UNLOCK("UriCache", &uri_cache_lock);
+
+    if (luri)
+    {
+        return luri;
+    }
+
+    /* parse outside the lock; if another thread adds the same uri in the
+     * meantime we just keep theirs */
+    luri = _UriParse(uri, lserror);
+    if (!luri)
+    {
+        return NULL;
+    }
+
+    LOCK("UriCache", &uri_cache_lock);
+
+    if (!uri_cache)
+    {
+        uri_cache = g_hash_table_new(g_str_hash, g_str_equal);
+    }
+
+    if (!g_hash_table_lookup(uri_cache, uri))
+    {
+        _UriCacheEntry *entry = g_slice_new(_UriCacheEntry);
+
+        entry->uri = g_strdup(uri);
+        entry->luri = _UriRef(luri);
+
+        g_queue_push_head(&uri_cache_lru, entry);
+        g_hash_table_insert(uri_cache, entry->uri, g_queue_peek_head_link(&uri_cache_lru));
+
+        if (g_queue_get_length(&uri_cache_lru) > URI_CACHE_SIZE)
+        {
+            _UriCacheEntry *oldest = g_queue_pop_tail(&uri_cache_lru);
+
+            g_hash_table_remove(uri_cache, oldest->uri);
+            _UriFree(oldest->luri);
+            g_free(oldest->uri);
+            g_slice_free(_UriCacheEntry, oldest);
+        }
+    }
+
+    UNLOCK("UriCache", &uri_cache_lock);
+
+    return luri;
+}
+
 typedef GArray _TokenList;
 
 static _TokenList *
@@ -386,26 +499,48 @@ _TokenListAdd(_TokenList *tokens, LSMessageToken t)
 }
 
 static void
-_TokenListRemove(_TokenList *tokens, LSMessageToken t)
+_TokenListRemoveAll(_TokenList *tokens)
 {
-    if (!tokens) return;
+   tokens->len = 0; 
+}
 
-    int i;
-    for (i = 0; i < tokens->len; i++)
+/** Signal registrations for a single category */
+typedef struct _SignalTokens
+{
+    _TokenList *categoryTokens;  //< tokens registered for the whole category
+    GHashTable *methodMap;       //< Map from method name to list of tokens
+} _SignalTokens;
+
+static _SignalTokens *
+_SignalTokensNew()
+{
+    _SignalTokens *signal_tokens = g_new0(_SignalTokens, 1);
+    if (!signal_tokens) return NULL;
+
+    signal_tokens->methodMap = g_hash_table_new_full(g_str_hash, g_str_equal,
+                    (GDestroyNotify)g_free, (GDestroyNotify)_TokenListFree);
+    if (!signal_tokens->methodMap)
     {
-        LSMessageToken iter = g_array_index(tokens, LSMessageToken, i);
-        if (iter == t)
-        {
-            g_array_remove_index_fast(tokens, i);
-            break;
-        }
+        g_free(signal_tokens);
+        return NULL;
     }
+
+    return signal_tokens;
 }
 
 static void
-_TokenListRemoveAll(_TokenList *tokens)
+_SignalTokensFree(_SignalTokens *signal_tokens)
 {
-   tokens->len = 0; 
+    if (!signal_tokens) return;
+
+    if (signal_tokens->categoryTokens) _TokenListFree(signal_tokens->categoryTokens);
+    g_hash_table_destroy(signal_tokens->methodMap);
+
+#ifdef MEMCHECK
+    memset(signal_tokens, 0xFF, sizeof(_SignalTokens));
+#endif
+
+    g_free(signal_tokens);
 }
 
 typedef struct _ServerStatus
@@ -421,29 +556,67 @@ typedef struct _ServerInfo
     bool connected;
 } _ServerInfo;
 
+/** One slot of a _CallTokenTable. An empty slot has token
+ * LSMESSAGE_TOKEN_INVALID, which is never handed out as a call token. */
+typedef struct _CallTokenEntry
+{
+    LSMessageToken  token;
+    struct _Call   *call;
+} _CallTokenEntry;
+
+/** Open-addressing (linear probing) map from token to _Call. Lookups touch
+ * a single flat array instead of chasing GHashTable node pointers, which
+ * matters with tens of thousands of in-flight calls. */
+typedef struct _CallTokenTable
+{
+    _CallTokenEntry *entries;
+    guint            capacity;   //< number of slots (power of 2)
+    guint            count;      //< number of used slots
+} _CallTokenTable;
+
 struct _CallMap {
 
-    GHashTable *tokenMap;      //< Map from token to _Call
-    GHashTable *signalMap;     //< Map from signal key to list of tokens
+    _CallTokenTable tokenMap;  //< Map from token to _Call
+    GHashTable *signalMap;     //< Map from signal category to _SignalTokens
     GHashTable *serviceMap;    //< Map from serviceName to list of tokens
 
     //DBusHandleMessageFunction message_handler;
 
-    pthread_mutex_t  lock;
+    pthread_rwlock_t lock;     //< shared for lookups, exclusive for insert/remove
+
+    GSequence  *deadlines;        //< method calls waiting for their first reply with a deadline, soonest first
+    GSource    *deadline_source;  //< single timer for the soonest deadline (NULL if not armed)
+    gint64      deadline_armed_us;  //< deadline deadline_source fires for
+    guint       default_timeout_ms; //< deadline given to new method calls (0 for none)
+
+    bool        coalesce;         //< share identical one-reply calls to idempotent methods (see LSSetCallCoalescing())
+    GHashTable *idempotent;       //< uris (see _CallShareUriKey()) whose replies said they're idempotent
+    GHashTable *shares;           //< _CallShare in flight by uri and payload
 };
 
+/* Exclusive lock, for inserting and removing calls */
 void
 _CallMapLock(_CallMap *map)
 {
-    int pthread_mutex_lock_ret = pthread_mutex_lock(&map->lock);
-    LS_ASSERT(pthread_mutex_lock_ret == 0);
+    int pthread_rwlock_wrlock_ret = pthread_rwlock_wrlock(&map->lock);
+    LS_ASSERT(pthread_rwlock_wrlock_ret == 0);
+}
+
+/* Shared lock, for the reply and signal dispatch lookups. Readers only
+ * take atomic refs on the calls they find, so they never block each
+ * other. */
+static void
+_CallMapReadLock(_CallMap *map)
+{
+    int pthread_rwlock_rdlock_ret = pthread_rwlock_rdlock(&map->lock);
+    LS_ASSERT(pthread_rwlock_rdlock_ret == 0);
 }
 
 void
 _CallMapUnlock(_CallMap *map)
 {
-    int pthread_mutex_unlock_ret = pthread_mutex_unlock(&map->lock);
-    LS_ASSERT(pthread_mutex_unlock_ret == 0);
+    int pthread_rwlock_unlock_ret = pthread_rwlock_unlock(&map->lock);
+    LS_ASSERT(pthread_rwlock_unlock_ret == 0);
 }
 
 //static DBusHandlerResult _message_filter(DBusConnection *conn, DBusMessage *msg, void *ctx);
@@ -455,6 +628,60 @@ enum {
     CALL_TYPE_SIGNAL_SERVER_STATUS,
 };
 
+#define CALL_COALESCE_URIS_MAX  256     /**< most idempotent uris remembered per handle */
+
+/**
+ * One-reply calls with the same uri and payload that share a single method
+ * call in flight (see LSSetCallCoalescing()). The call that went out has
+ * _CallShareReply() as its callback; each caller has a call of its own,
+ * with its own token, that gets a copy of the reply.
+ */
+typedef struct _CallShare {
+    int             ref;        //< held by callmap->shares and each call that points to it
+    char           *key;        //< uri and payload; key in callmap->shares
+    LSMessageToken  token;      //< token of the call that went out
+    GArray         *members;    //< tokens of the callers' calls (NULL once replied or abandoned)
+} _CallShare;
+
+static _CallShare*
+_CallShareNew(char *key)
+{
+    _CallShare *share = g_new0(_CallShare, 1);
+
+    share->ref = 1;
+    share->key = key;
+    share->token = LSMESSAGE_TOKEN_INVALID;
+    share->members = g_array_new(false, false, sizeof(LSMessageToken));
+
+    return share;
+}
+
+static _CallShare*
+_CallShareRef(_CallShare *share)
+{
+    LS_ASSERT(g_atomic_int_get(&share->ref) > 0);
+    g_atomic_int_inc(&share->ref);
+    return share;
+}
+
+static void
+_CallShareUnref(_CallShare *share)
+{
+    LS_ASSERT(g_atomic_int_get(&share->ref) > 0);
+
+    if (g_atomic_int_dec_and_test(&share->ref))
+    {
+        if (share->members) g_array_free(share->members, true);
+        g_free(share->key);
+
+#ifdef MEMCHECK
+        memset(share, 0xFF, sizeof(_CallShare));
+#endif
+
+        g_free(share);
+    }
+}
+
 typedef struct _Call {
 
     int           ref;
@@ -475,7 +702,16 @@ typedef struct _Call {
     //char          *rule;
     char          *signal_method;   //< registered signal method (could be NULL)
     char          *signal_category; //< registered signal category (required)
-    char          *match_key;  //<key used in callmap->signalMap
+
+    gint64         issue_us;        //< when a method call was sent (0 once the first reply came in)
+
+    guint          list_pos;        //< index of token in its serviceMap/signalMap _TokenList
+
+    gint64         deadline_us;     //< when the call times out if there's no reply yet
+    GSequenceIter *deadline_iter;   //< position in callmap->deadlines (NULL if no deadline)
+
+    _CallShare    *share;           //< shared call this is (or is waiting on); NULL if not shared
+    char          *coalesce_uri;    //< uri key to learn idempotence from the reply for (NULL if not coalescing)
 } _Call;
 
 
@@ -509,7 +745,9 @@ _CallFree(_Call *call)
     //g_free(call->rule);
     g_free(call->signal_method);
     g_free(call->signal_category);
-    g_free(call->match_key);
+    g_free(call->coalesce_uri);
+
+    if (call->share) _CallShareUnref(call->share);
 
 #ifdef MEMCHECK
     memset(call, 0xFF, sizeof(_Call));
@@ -518,205 +756,563 @@ _CallFree(_Call *call)
     g_free(call);
 }
 
-static bool 
-_service_watch_enable(LSHandle *sh, _Call *call, LSError *lserror)
-{
-    bool retVal = true;
+static void _CallRelease(_Call *call);
 
-    if (CALL_TYPE_SIGNAL_SERVER_STATUS == call->type && call->serviceName)
-    {
-        retVal = LSTransportRegisterSignalServiceStatus(sh->transport, call->serviceName, NULL, lserror);
-
-    }
-    return retVal;
-}
+#define CALL_TOKEN_TABLE_INITIAL_CAPACITY   64
 
-static bool
-_service_watch_disable(LSHandle *sh, _Call *call)
+static inline guint
+_CallTokenTableHash(const _CallTokenTable *table, LSMessageToken token)
 {
-    if (CALL_TYPE_SIGNAL_SERVER_STATUS == call->type && call->serviceName)
-    {
-        return LSTransportUnregisterSignalServiceStatus(sh->transport, call->serviceName, NULL, NULL);
-    }
-    return false;
+    /* Fibonacci hashing spreads the sequential tokens across the table */
+    return (guint)(((guint64)token * G_GUINT64_CONSTANT(0x9E3779B97F4A7C15)) >> 32) & (table->capacity - 1);
 }
 
-/** 
-* @brief Insert a call into the callmap.
-* 
-* @param  map 
-* @param  call 
-*/
 static bool
-_CallInsert(LSHandle *sh, _CallMap *map, _Call *call, bool single,
-            LSError *lserror)
+_CallTokenTableResize(_CallTokenTable *table, guint capacity)
 {
-    bool retVal = true;
-    GHashTable *table = NULL;
-    gpointer    key = NULL;
-
-    switch (call->type)
-    {
-    case CALL_TYPE_METHOD_CALL:
-    case CALL_TYPE_SIGNAL_SERVER_STATUS:
-        table = map->serviceMap;
-        key   = call->serviceName;
-        break;
-    case CALL_TYPE_SIGNAL:
-        table = map->signalMap;
-        key   = call->match_key;
-        break;
-    default:
-        _LSErrorSet(lserror, -1, "Unsupported call type.");
-        return false;
-    }
+    _CallTokenEntry *entries = g_try_new0(_CallTokenEntry, capacity);
+    if (!entries) return false;
 
-    call->single = single;
+    _CallTokenEntry *old_entries = table->entries;
+    guint old_capacity = table->capacity;
 
-    // TODO: LS_ASSERT(call->ref == 0);
-    call->ref = 1;
+    table->entries = entries;
+    table->capacity = capacity;
 
-    _TokenList *token_list = g_hash_table_lookup(table, key);
-    if (_TokenListLen(token_list) == 0)
+    guint i;
+    for (i = 0; i < old_capacity; i++)
     {
-
-        if (!token_list)
+        if (old_entries[i].token != LSMESSAGE_TOKEN_INVALID)
         {
-            token_list = _TokenListNew();
-
-            if (!token_list)
+            guint pos = _CallTokenTableHash(table, old_entries[i].token);
+            while (entries[pos].token != LSMESSAGE_TOKEN_INVALID)
             {
-                _LSErrorSet(lserror, -ENOMEM, "OOM Could not allocate tokens list.");
-                retVal = false;
-                goto error;
+                pos = (pos + 1) & (capacity - 1);
             }
-
-            g_hash_table_replace(table, g_strdup(key), token_list);
+            entries[pos] = old_entries[i];
         }
     }
 
-    _TokenListAdd(token_list, call->token);
-
-    /* It's an error if the key is already in the map */
-    LS_ASSERT(g_hash_table_lookup(map->tokenMap, (gpointer)call->token) == NULL);
-    
-    g_hash_table_replace(map->tokenMap, (gpointer)call->token, call);
+    g_free(old_entries);
+    return true;
+}
 
-error:
-    return retVal;
+static bool
+_CallTokenTableInit(_CallTokenTable *table)
+{
+    table->entries = NULL;
+    table->capacity = 0;
+    table->count = 0;
+    return _CallTokenTableResize(table, CALL_TOKEN_TABLE_INITIAL_CAPACITY);
 }
 
+/** 
+* @brief Release every call in the table and free it.
+*/
 static void
-_CallRemove(LSHandle *sh, _CallMap *map, _Call *call)
+_CallTokenTableDeinit(_CallTokenTable *table)
 {
-    _CallMapLock(map);
-
-    _Call *orig_call = g_hash_table_lookup(map->tokenMap, (gpointer)call->token);
-    if (orig_call == call)
+    guint i;
+    for (i = 0; i < table->capacity; i++)
     {
-        switch(call->type)
+        if (table->entries[i].token != LSMESSAGE_TOKEN_INVALID)
         {
-        case CALL_TYPE_METHOD_CALL:
-        case CALL_TYPE_SIGNAL_SERVER_STATUS:
-            if (call->serviceName)
-            {
-                _TokenList *token_list =
-                    g_hash_table_lookup(map->serviceMap, call->serviceName);
-
-                _TokenListRemove(token_list, call->token);
-            }
-            break;
-        case CALL_TYPE_SIGNAL:
-            if (call->match_key)
-            {
-                _TokenList *token_list =
-                    g_hash_table_lookup(map->signalMap, call->match_key);
-
-                _TokenListRemove(token_list, call->token);
-            }
-            break;
+            _CallRelease(table->entries[i].call);
         }
-
-        g_hash_table_remove(map->tokenMap, (gpointer)call->token);
     }
-    
-    /* <eeh> TODO: what does the else case mean (i.e., orig_call != call) */
 
-    _CallMapUnlock(map);
+    g_free(table->entries);
+    table->entries = NULL;
+    table->capacity = 0;
+    table->count = 0;
 }
 
 static _Call*
-_CallAcquire(_CallMap *map, LSMessageToken token)
+_CallTokenTableLookup(const _CallTokenTable *table, LSMessageToken token)
 {
-    _Call *call;
+    guint pos = _CallTokenTableHash(table, token);
 
-    _CallMapLock(map);
-
-    call = g_hash_table_lookup(map->tokenMap, (gpointer)token);
-    if (call)
+    while (table->entries[pos].token != LSMESSAGE_TOKEN_INVALID)
     {
-        LS_ASSERT(g_atomic_int_get (&call->ref) > 0); 
-        g_atomic_int_inc(&call->ref);
+        if (table->entries[pos].token == token)
+        {
+            return table->entries[pos].call;
+        }
+        pos = (pos + 1) & (table->capacity - 1);
     }
-
-    _CallMapUnlock(map);
-
-    return call;
+    return NULL;
 }
 
-static void
-_CallRelease(_Call *call)
+/** 
+* @brief Add a call to the table. The token must not be in the table.
+* 
+* @retval false on OOM
+*/
+static bool
+_CallTokenTableInsert(_CallTokenTable *table, _Call *call)
 {
-    LS_ASSERT(g_atomic_int_get (&call->ref) > 0); 
+    LS_ASSERT(call->token != LSMESSAGE_TOKEN_INVALID);
 
-    if (g_atomic_int_dec_and_test(&call->ref))
+    /* keep the load factor at or below 1/2 so probe runs stay short */
+    if ((table->count + 1) * 2 > table->capacity)
     {
-        _CallFree(call);
+        if (!_CallTokenTableResize(table, table->capacity * 2)) return false;
+    }
+
+    guint pos = _CallTokenTableHash(table, call->token);
+    while (table->entries[pos].token != LSMESSAGE_TOKEN_INVALID)
+    {
+        LS_ASSERT(table->entries[pos].token != call->token);
+        pos = (pos + 1) & (table->capacity - 1);
     }
+
+    table->entries[pos].token = call->token;
+    table->entries[pos].call = call;
+    table->count++;
+
+    return true;
 }
 
 /** 
-* @brief Initialize callmap.
-* 
-* @param  sh 
-* @param  *ret_map 
-* @param  lserror 
+* @brief Remove a token from the table without releasing its call.
+*
+* Uses backward-shift deletion so the table never accumulates tombstones.
 * 
-* @retval
+* @retval removed call, or NULL if the token wasn't in the table
 */
-bool
-_CallMapInit(LSHandle *sh, _CallMap **ret_map, LSError *lserror)
+static _Call*
+_CallTokenTableRemove(_CallTokenTable *table, LSMessageToken token)
 {
-    _CallMap *map = g_new0(_CallMap, 1);
-    if (!map)
+    guint mask = table->capacity - 1;
+    guint pos = _CallTokenTableHash(table, token);
+
+    while (table->entries[pos].token != token)
     {
-        _LSErrorSet(lserror, -ENOMEM, "OOM");
-        return false;
+        if (table->entries[pos].token == LSMESSAGE_TOKEN_INVALID) return NULL;
+        pos = (pos + 1) & mask;
     }
 
-    map->tokenMap = g_hash_table_new_full(g_direct_hash, g_direct_equal,
-                    NULL, (GDestroyNotify)_CallRelease);
-
-    map->signalMap = g_hash_table_new_full(g_str_hash, g_str_equal,
-                    (GDestroyNotify)g_free, (GDestroyNotify)_TokenListFree);
-    map->serviceMap = g_hash_table_new_full(g_str_hash, g_str_equal,
-                    (GDestroyNotify)g_free, (GDestroyNotify)_TokenListFree);
+    _Call *call = table->entries[pos].call;
 
-    if (!map->tokenMap || !map->signalMap)
+    /* pull back following entries whose home slot is at or before the hole */
+    guint hole = pos;
+    guint next = (pos + 1) & mask;
+    while (table->entries[next].token != LSMESSAGE_TOKEN_INVALID)
     {
-        _LSErrorSet(lserror, -ENOMEM, "OOM");
-        goto error;
+        guint home = _CallTokenTableHash(table, table->entries[next].token);
+        if (((next - home) & mask) >= ((next - hole) & mask))
+        {
+            table->entries[hole] = table->entries[next];
+            hole = next;
+        }
+        next = (next + 1) & mask;
     }
-    if (pthread_mutex_init(&map->lock, NULL))
+
+    table->entries[hole].token = LSMESSAGE_TOKEN_INVALID;
+    table->entries[hole].call = NULL;
+    table->count--;
+
+    /* give memory back after a burst of calls, best effort */
+    if (table->capacity > CALL_TOKEN_TABLE_INITIAL_CAPACITY && table->count * 8 < table->capacity)
     {
-        _LSErrorSet(lserror, -1, "Could not initialize mutex.");
-        goto error;
+        _CallTokenTableResize(table, table->capacity / 2);
     }
 
-    *ret_map = map;
-    return true;
+    return call;
+}
 
-error:
+/** 
+* @brief Remove a call's token from its serviceMap/signalMap list in O(1)
+* using the position saved in the call.
+* 
+* @param  map 
+* @param  tokens 
+* @param  call 
+*/
+static void
+_CallMapTokenListRemove(_CallMap *map, _TokenList *tokens, _Call *call)
+{
+    if (!tokens) return;
+
+    guint pos = call->list_pos;
+
+    LS_ASSERT(pos < tokens->len);
+    LS_ASSERT(g_array_index(tokens, LSMessageToken, pos) == call->token);
+
+    g_array_remove_index_fast(tokens, pos);
+
+    /* the last token was moved into the hole */
+    if (pos < tokens->len)
+    {
+        _Call *moved = _CallTokenTableLookup(&map->tokenMap,
+                                             g_array_index(tokens, LSMessageToken, pos));
+        LS_ASSERT(moved != NULL);
+        moved->list_pos = pos;
+    }
+}
+
+static bool 
+_service_watch_enable(LSHandle *sh, _Call *call, LSError *lserror)
+{
+    bool retVal = true;
+
+    if (CALL_TYPE_SIGNAL_SERVER_STATUS == call->type && call->serviceName)
+    {
+        retVal = LSTransportRegisterSignalServiceStatus(sh->bus, call->serviceName, NULL, lserror);
+
+    }
+    return retVal;
+}
+
+static bool
+_service_watch_disable(LSHandle *sh, _Call *call)
+{
+    if (CALL_TYPE_SIGNAL_SERVER_STATUS == call->type && call->serviceName)
+    {
+        return LSTransportUnregisterSignalServiceStatus(sh->bus, call->serviceName, NULL, NULL);
+    }
+    return false;
+}
+
+/** 
+* @brief Look up the list of tokens registered for a signal.
+* 
+* @param  map 
+* @param  category  signal category
+* @param  method    signal method (NULL for the whole category)
+* @param  create    true to allocate the list if it doesn't exist
+* 
+* @retval token list (NULL if not found and create is false or on OOM)
+*/
+static _TokenList*
+_CallMapLookupSignalTokens(_CallMap *map, const char *category,
+                           const char *method, bool create)
+{
+    _SignalTokens *signal_tokens = g_hash_table_lookup(map->signalMap, category);
+    _TokenList *token_list = NULL;
+
+    if (!signal_tokens)
+    {
+        if (!create) return NULL;
+
+        signal_tokens = _SignalTokensNew();
+        if (!signal_tokens) return NULL;
+
+        g_hash_table_replace(map->signalMap, g_strdup(category), signal_tokens);
+    }
+
+    if (!method)
+    {
+        if (!signal_tokens->categoryTokens && create)
+        {
+            signal_tokens->categoryTokens = _TokenListNew();
+        }
+        return signal_tokens->categoryTokens;
+    }
+
+    token_list = g_hash_table_lookup(signal_tokens->methodMap, method);
+    if (!token_list && create)
+    {
+        token_list = _TokenListNew();
+        if (token_list)
+        {
+            g_hash_table_replace(signal_tokens->methodMap, g_strdup(method), token_list);
+        }
+    }
+    return token_list;
+}
+
+static gboolean _CallDeadlineExpired(gpointer data);
+
+static gint
+_CallDeadlineCompare(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+    const _Call *call_a = a;
+    const _Call *call_b = b;
+
+    if (call_a->deadline_us < call_b->deadline_us) return -1;
+    if (call_a->deadline_us > call_b->deadline_us) return 1;
+    return 0;
+}
+
+/** 
+* @brief (Re)arm the callmap timer for the soonest deadline. Calls with a
+* deadline time out only while the handle is attached to a main loop.
+*
+* Must be called with the callmap lock held.
+* 
+* @param  sh 
+* @param  map 
+*/
+static void
+_CallDeadlineArm(LSHandle *sh, _CallMap *map)
+{
+    GSequenceIter *first = g_sequence_get_begin_iter(map->deadlines);
+
+    if (g_sequence_iter_is_end(first))
+    {
+        /* an armed timer just finds nothing to do */
+        return;
+    }
+
+    _Call *call = g_sequence_get(first);
+
+    if (map->deadline_source && map->deadline_armed_us <= call->deadline_us)
+    {
+        return;
+    }
+
+    GMainContext *context = _LSTransportGetGmainContext(sh->transport);
+    if (!context)
+    {
+        return;
+    }
+
+    if (map->deadline_source)
+    {
+        g_source_destroy(map->deadline_source);
+        g_source_unref(map->deadline_source);
+    }
+
+    gint64 wait_us = call->deadline_us - _LSLatencyNowUs();
+
+    map->deadline_source = g_timeout_source_new(wait_us > 0 ? (wait_us + 999) / 1000 : 0);
+    map->deadline_armed_us = call->deadline_us;
+    g_source_set_callback(map->deadline_source, _CallDeadlineExpired, sh, NULL);
+    g_source_attach(map->deadline_source, context);
+}
+
+/* Must be called with the callmap lock held */
+static void
+_CallDeadlineClear(_CallMap *map, _Call *call)
+{
+    if (call->deadline_iter)
+    {
+        g_sequence_remove(call->deadline_iter);
+        call->deadline_iter = NULL;
+    }
+}
+
+/** 
+* @brief Give a method call a deadline for its first reply, replacing any
+* deadline it already had.
+*
+* Must be called with the callmap lock held.
+* 
+* @param  sh 
+* @param  map 
+* @param  call 
+* @param  timeout_ms   0 to clear the deadline
+*/
+static void
+_CallDeadlineSet(LSHandle *sh, _CallMap *map, _Call *call, guint timeout_ms)
+{
+    _CallDeadlineClear(map, call);
+
+    if (timeout_ms == 0)
+    {
+        return;
+    }
+
+    call->deadline_us = _LSLatencyNowUs() + (gint64)timeout_ms * 1000;
+    call->deadline_iter = g_sequence_insert_sorted(map->deadlines, call, _CallDeadlineCompare, NULL);
+
+    _CallDeadlineArm(sh, map);
+}
+
+/** 
+* @brief Insert a call into the callmap.
+* 
+* @param  map 
+* @param  call 
+*/
+static bool
+_CallInsert(LSHandle *sh, _CallMap *map, _Call *call, bool single,
+            LSError *lserror)
+{
+    bool retVal = true;
+    _TokenList *token_list = NULL;
+
+    switch (call->type)
+    {
+    case CALL_TYPE_METHOD_CALL:
+    case CALL_TYPE_SIGNAL_SERVER_STATUS:
+    case CALL_TYPE_SIGNAL:
+        break;
+    default:
+        _LSErrorSet(lserror, -1, "Unsupported call type.");
+        return false;
+    }
+
+    call->single = single;
+
+    // TODO: LS_ASSERT(call->ref == 0);
+    call->ref = 1;
+
+    if (CALL_TYPE_SIGNAL == call->type)
+    {
+        token_list = _CallMapLookupSignalTokens(map, call->signal_category,
+                                                call->signal_method, true);
+    }
+    else
+    {
+        token_list = g_hash_table_lookup(map->serviceMap, call->serviceName);
+        if (!token_list)
+        {
+            token_list = _TokenListNew();
+            if (token_list)
+            {
+                g_hash_table_replace(map->serviceMap, g_strdup(call->serviceName), token_list);
+            }
+        }
+    }
+
+    if (!token_list)
+    {
+        _LSErrorSet(lserror, -ENOMEM, "OOM Could not allocate tokens list.");
+        retVal = false;
+        goto error;
+    }
+
+    /* It's an error if the key is already in the map */
+    LS_ASSERT(_CallTokenTableLookup(&map->tokenMap, call->token) == NULL);
+
+    if (!_CallTokenTableInsert(&map->tokenMap, call))
+    {
+        _LSErrorSet(lserror, -ENOMEM, "OOM Could not grow token map.");
+        retVal = false;
+        goto error;
+    }
+
+    call->list_pos = token_list->len;
+    _TokenListAdd(token_list, call->token);
+
+    if (CALL_TYPE_METHOD_CALL == call->type && map->default_timeout_ms)
+    {
+        _CallDeadlineSet(sh, map, call, map->default_timeout_ms);
+    }
+
+error:
+    return retVal;
+}
+
+static void
+_CallRemove(LSHandle *sh, _CallMap *map, _Call *call)
+{
+    _CallMapLock(map);
+
+    _Call *orig_call = _CallTokenTableLookup(&map->tokenMap, call->token);
+    if (orig_call == call)
+    {
+        switch(call->type)
+        {
+        case CALL_TYPE_METHOD_CALL:
+        case CALL_TYPE_SIGNAL_SERVER_STATUS:
+            if (call->serviceName)
+            {
+                _TokenList *token_list =
+                    g_hash_table_lookup(map->serviceMap, call->serviceName);
+
+                _CallMapTokenListRemove(map, token_list, call);
+            }
+            break;
+        case CALL_TYPE_SIGNAL:
+            if (call->signal_category)
+            {
+                _TokenList *token_list =
+                    _CallMapLookupSignalTokens(map, call->signal_category,
+                                               call->signal_method, false);
+
+                _CallMapTokenListRemove(map, token_list, call);
+            }
+            break;
+        }
+
+        _CallDeadlineClear(map, call);
+        _CallTokenTableRemove(&map->tokenMap, call->token);
+        _CallRelease(call);
+    }
+    
+    /* <eeh> TODO: what does the else case mean (i.e., orig_call != call) */
+
+    _CallMapUnlock(map);
+}
+
+static _Call*
+_CallAcquire(_CallMap *map, LSMessageToken token)
+{
+    _Call *call;
+
+    _CallMapReadLock(map);
+
+    call = _CallTokenTableLookup(&map->tokenMap, token);
+    if (call)
+    {
+        LS_ASSERT(g_atomic_int_get (&call->ref) > 0); 
+        g_atomic_int_inc(&call->ref);
+    }
+
+    _CallMapUnlock(map);
+
+    return call;
+}
+
+static void
+_CallRelease(_Call *call)
+{
+    LS_ASSERT(g_atomic_int_get (&call->ref) > 0); 
+
+    if (g_atomic_int_dec_and_test(&call->ref))
+    {
+        _CallFree(call);
+    }
+}
+
+/** 
+* @brief Initialize callmap.
+* 
+* @param  sh 
+* @param  *ret_map 
+* @param  lserror 
+* 
+* @retval
+*/
+bool
+_CallMapInit(LSHandle *sh, _CallMap **ret_map, LSError *lserror)
+{
+    _CallMap *map = g_new0(_CallMap, 1);
+    if (!map)
+    {
+        _LSErrorSet(lserror, -ENOMEM, "OOM");
+        return false;
+    }
+
+    map->signalMap = g_hash_table_new_full(g_str_hash, g_str_equal,
+                    (GDestroyNotify)g_free, (GDestroyNotify)_SignalTokensFree);
+    map->serviceMap = g_hash_table_new_full(g_str_hash, g_str_equal,
+                    (GDestroyNotify)g_free, (GDestroyNotify)_TokenListFree);
+
+    map->deadlines = g_sequence_new(NULL);
+
+    map->idempotent = g_hash_table_new_full(g_str_hash, g_str_equal, (GDestroyNotify)g_free, NULL);
+    /* keys belong to the shares */
+    map->shares = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)_CallShareUnref);
+
+    if (!_CallTokenTableInit(&map->tokenMap) || !map->signalMap || !map->serviceMap)
+    {
+        _LSErrorSet(lserror, -ENOMEM, "OOM");
+        goto error;
+    }
+    if (pthread_rwlock_init(&map->lock, NULL))
+    {
+        _LSErrorSet(lserror, -1, "Could not initialize mutex.");
+        goto error;
+    }
+
+    *ret_map = map;
+    return true;
+
+error:
     _CallMapDeinit(sh, map);
     return false;
 }
@@ -732,11 +1328,20 @@ _CallMapDeinit(LSHandle *sh, _CallMap *map)
 {
     if (map)
     {
-        g_hash_table_destroy(map->signalMap);
-        g_hash_table_destroy(map->serviceMap);
-        g_hash_table_destroy(map->tokenMap);
+        if (map->signalMap) g_hash_table_destroy(map->signalMap);
+        if (map->serviceMap) g_hash_table_destroy(map->serviceMap);
+        if (map->tokenMap.entries) _CallTokenTableDeinit(&map->tokenMap);
+        if (map->deadlines) g_sequence_free(map->deadlines);
+        if (map->idempotent) g_hash_table_destroy(map->idempotent);
+        if (map->shares) g_hash_table_destroy(map->shares);
+
+        if (map->deadline_source)
+        {
+            g_source_destroy(map->deadline_source);
+            g_source_unref(map->deadline_source);
+        }
 
-        if (pthread_mutex_destroy(&map->lock))
+        if (pthread_rwlock_destroy(&map->lock))
         {
             g_warning("Could not destroy mutex &map->lock");
         }
@@ -992,13 +1597,45 @@ void
 _LSMessageTranslate(LSHandle *sh, LSMessage *message,
                     _ServerInfo *server_info)
 {
-    _Call *call = _CallAcquire(sh->callmap,
-                               LSMessageGetResponseToken(message));
-    if (!call) return;
+    _Call *call = _CallAcquire(sh->callmap,
+                               LSMessageGetResponseToken(message));
+    if (!call) return;
+
+    _LSMessageTranslateFromCall(call, message, server_info);
+
+    _CallRelease(call);
+}
+
+/** 
+* @brief Remember whether the method at a uri said its replies can be
+* shared by identical calls (see LSSetCallCoalescing()).
+* 
+* @param  map 
+* @param  uri_key      see _CallShareUriKey()
+* @param  idempotent   true if the reply had LS_TRANSPORT_HEADER_FLAG_IDEMPOTENT
+*/
+static void
+_CallMapLearnIdempotent(_CallMap *map, const char *uri_key, bool idempotent)
+{
+    _CallMapLock(map);
 
-    _LSMessageTranslateFromCall(call, message, server_info);
+    if (!idempotent)
+    {
+        /* the service may have changed its mind */
+        g_hash_table_remove(map->idempotent, uri_key);
+    }
+    else if (!g_hash_table_lookup(map->idempotent, uri_key))
+    {
+        if (g_hash_table_size(map->idempotent) >= CALL_COALESCE_URIS_MAX)
+        {
+            /* cheap to re-learn */
+            g_hash_table_remove_all(map->idempotent);
+        }
 
-    _CallRelease(call);
+        g_hash_table_insert(map->idempotent, g_strdup(uri_key), GINT_TO_POINTER(1));
+    }
+
+    _CallMapUnlock(map);
 }
 
 /** 
@@ -1014,18 +1651,16 @@ _LSMessageTranslate(LSHandle *sh, LSMessage *message,
 * @retval
 */
 static bool  
-_handle_reply(LSHandle *sh, _TokenList *tokens, _LSTransportMessage *msg,
-              _ServerInfo *server_info)
+_handle_reply(LSHandle *sh, const LSMessageToken *tokens, int len,
+              _LSTransportMessage *msg, _ServerInfo *server_info)
 {
     //DBusHandlerResult result = DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
     bool ret = true;
 
     int i;
-    int len = tokens->len;
     for (i = 0; i < len; i++)
     {
-        LSMessageToken token =
-            g_array_index(tokens, LSMessageToken, i);
+        LSMessageToken token = tokens[i];
 
         _Call *call = _CallAcquire(sh->callmap, token);
 
@@ -1035,6 +1670,27 @@ _handle_reply(LSHandle *sh, _TokenList *tokens, _LSTransportMessage *msg,
             continue;
         }
 
+        if (call->issue_us)
+        {
+            /* only the first reply counts; later ones are subscription
+             * updates */
+            _LSLatencyStatsAddCall(sh->latency_stats, call->serviceName, _LSLatencyNowUs() - call->issue_us);
+            call->issue_us = 0;
+
+            if (call->coalesce_uri && _LSTransportMessageGetType(msg) == _LSTransportMessageTypeReply)
+            {
+                _CallMapLearnIdempotent(sh->callmap, call->coalesce_uri, _LSTransportMessageIsIdempotentReply(msg));
+            }
+        }
+
+        if (call->deadline_iter)
+        {
+            /* the deadline is only for the first reply */
+            _CallMapLock(sh->callmap);
+            _CallDeadlineClear(sh->callmap, call);
+            _CallMapUnlock(sh->callmap);
+        }
+
         if (call->callback)
         {
             LSMessage *reply = _LSMessageNewRef(msg, sh);
@@ -1045,6 +1701,8 @@ _handle_reply(LSHandle *sh, _TokenList *tokens, _LSTransportMessage *msg,
                 break;
             }
 
+            LS_TRACE(_LSTracePointReply, _LSTransportMessageGetType(msg), token, _LSTransportMessageGetBodySize(msg));
+
             // translate non-jsonized bus messages here...
             _LSMessageTranslateFromCall(call, reply, server_info);
 
@@ -1270,10 +1928,13 @@ _LSDisconnectHandler(_LSTransportClient *client, _LSTransportDisconnectType type
     LSHandle *sh = (LSHandle *)context;
     _CallMap *map = sh->callmap;
 
-    if (NULL != client->service_name)
+    /* our calls only go out on connections that we initiated; the far
+     * side's connection to us going away (e.g., it closed it for being
+     * idle) says nothing about them */
+    if (NULL != client->service_name && client->initiator)
     {
     
-        _CallMapLock(map);
+        _CallMapReadLock(map);
     
         _TokenList *tokens = g_hash_table_lookup(map->serviceMap, client->service_name);
     
@@ -1288,6 +1949,38 @@ _LSDisconnectHandler(_LSTransportClient *client, _LSTransportDisconnectType type
     }
 }
 
+/** 
+* @brief Check whether a connection that has gone idle can be closed by the
+* transport: only if we have no calls (including subscriptions, whose
+* replies keep coming back on it) to that service.
+* 
+* @param  client 
+* @param  context  LSHandle
+* 
+* @retval true if nothing needs the connection
+*/
+bool
+_LSIdleHandler(_LSTransportClient *client, void *context)
+{
+    LSHandle *sh = (LSHandle *)context;
+    _CallMap *map = sh->callmap;
+    bool idle;
+
+    if (NULL == client->service_name)
+    {
+        return false;
+    }
+
+    _CallMapReadLock(map);
+
+    _TokenList *tokens = g_hash_table_lookup(map->serviceMap, client->service_name);
+    idle = (_TokenListLen(tokens) == 0);
+
+    _CallMapUnlock(map);
+
+    return idle;
+}
+
 /* SERVER_STATUS */
 static void
 _parse_service_status_signal(_LSTransportMessage *msg, _ServerInfo *server_info)
@@ -1329,15 +2022,17 @@ _get_signal_tokens(_CallMap *map, _LSTransportMessage *msg, _TokenList *tokens,
     const char *category = _LSTransportMessageGetCategory(msg);
     const char *method = _LSTransportMessageGetMethod(msg);
 
-    char *category_key = g_strdup_printf("%s", category);
-    char *method_key = g_strdup_printf("%s/%s", category, method);
+    _CallMapReadLock(map);
 
-    _CallMapLock(map);
+    _TokenList *category_matches = NULL;
+    _TokenList *method_matches = NULL;
 
-    _TokenList *category_matches = g_hash_table_lookup(
-                    map->signalMap, category_key);
-    _TokenList *method_matches = g_hash_table_lookup(
-                    map->signalMap, method_key);
+    _SignalTokens *signal_tokens = g_hash_table_lookup(map->signalMap, category);
+    if (signal_tokens)
+    {
+        category_matches = signal_tokens->categoryTokens;
+        method_matches = g_hash_table_lookup(signal_tokens->methodMap, method);
+    }
 
     if (server_info->ServiceStatusChanged)
     {
@@ -1351,9 +2046,6 @@ _get_signal_tokens(_CallMap *map, _LSTransportMessage *msg, _TokenList *tokens,
     _TokenListAddList(tokens, method_matches);
 
     _CallMapUnlock(map);
-
-    g_free(category_key);
-    g_free(method_key);
 }
 
 static void
@@ -1415,26 +2107,46 @@ _LSHandleReply(LSHandle *sh, _LSTransportMessage *transport_msg)
 
     bool ret = true; 
     _CallMap   *callmap = sh->callmap;
-    _TokenList *tokens = _TokenListNew();
-
-    /* Find tokens that handle this message. */
 
     _ServerInfo server_info;
     memset(&server_info, 0, sizeof(server_info)); 
 
-    /* Parse the message and find all tokens. */
-    _MessageFindTokens(callmap, transport_msg, &server_info, tokens);
+    switch (_LSTransportMessageGetType(transport_msg))
+    {
+    case _LSTransportMessageTypeReply:
+    case _LSTransportMessageTypeQueryServiceStatusReply:
+    case _LSTransportMessageTypeError:
+    case _LSTransportMessageTypeErrorUnknownMethod:
+    {
+        /* A reply is for exactly one token, so skip building a token list */
+        LSMessageToken token = _LSTransportMessageGetReplyToken(transport_msg);
 
-    /* logging */ 
-    LSDebugLogIncoming("", transport_msg);
+        LSDebugLogIncoming("", transport_msg);
 
-    /* Dispatch message to callbacks referenced by tokens. */
-    if (_TokenListLen(tokens) > 0)
-    {
-        ret = _handle_reply(sh, tokens, transport_msg, &server_info);
+        ret = _handle_reply(sh, &token, 1, transport_msg, &server_info);
+        break;
     }
+    default:
+    {
+        _TokenList *tokens = _TokenListNew();
+
+        /* Parse the message and find all tokens. */
+        _MessageFindTokens(callmap, transport_msg, &server_info, tokens);
+
+        /* logging */ 
+        LSDebugLogIncoming("", transport_msg);
+
+        /* Dispatch message to callbacks referenced by tokens. */
+        if (_TokenListLen(tokens) > 0)
+        {
+            ret = _handle_reply(sh, (const LSMessageToken*)tokens->data, tokens->len,
+                                transport_msg, &server_info);
+        }
 
-    _TokenListFree(tokens);
+        _TokenListFree(tokens);
+        break;
+    }
+    }
 
     /* serviceName may have been allocated in _MessageFindTokens's call to 
      * _parse_name_owner_changed */
@@ -1443,19 +2155,6 @@ _LSHandleReply(LSHandle *sh, _LSTransportMessage *transport_msg)
     return ret;
 }
 
-static const char *
-_json_get_string(struct json_object *object, const char *label)
-{
-    struct json_object *label_obj = NULL;
-    
-    if (!json_object_object_get_ex(object, label, &label_obj))
-    {
-        return NULL;
-    }
-
-    return json_object_get_string(label_obj);
-}
-
 /* 
  * TODO: rename this function. It kind of made sense in the dbus-based world,
  * but doesn't really anymore.
@@ -1470,39 +2169,28 @@ _send_match(LSHandle        *sh,
              LSError        *lserror)
 {
     char *rule = NULL;
-    struct json_object *object = json_tokener_parse(payload);
+    char *category = NULL;
+    char *method = NULL;
     LSMessageToken token;
     bool retVal = false;
-    char *key = NULL;
 
-    if (JSON_ERROR(object))
+    /* small control payload; pick out the two members without a full parse */
+    if (_LSJsonScanString(payload, "category", &category) == _LSJsonScanInvalid ||
+        _LSJsonScanString(payload, "method", &method) == _LSJsonScanInvalid)
     {
         _LSErrorSet(lserror, -EINVAL, "Invalid signal/addmatch payload");
         goto error;
     }
 
-    const char *category = _json_get_string(object, "category");
-    const char *method = _json_get_string(object, "method");
-    
-    retVal = LSTransportRegisterSignal(sh->transport, category, method, &token, lserror);
-    if (!retVal) goto error;
-
-    if (category && method)
-    {
-        key = g_strdup_printf("%s/%s", category, method);
-    }
-    else if (category)
-    {
-        key = g_strdup_printf("%s", category);
-    }
-
-    if (!key)
+    if (!category)
     {
-        _LSErrorSet(lserror, -ENOMEM, "OOM could not allocate signal key.");
-        retVal = false;
+        _LSErrorSet(lserror, -EINVAL, "Invalid signal/addmatch payload (no category)");
         goto error;
     }
 
+    retVal = LSTransportRegisterSignal(sh->bus, category, method, &token, lserror);
+    if (!retVal) goto error;
+
     _Call *call = _CallNew(CALL_TYPE_SIGNAL, luri->serviceName, callback, ctx, token);
     if (!call)
     {
@@ -1512,15 +2200,10 @@ _send_match(LSHandle        *sh,
     }
 
     //call->rule = g_strdup(rule);
-    call->signal_method = g_strdup(method);
-    call->signal_category = g_strdup(category);
-    call->match_key = g_strdup(key);
-    if ((method && !call->signal_method) || !call->signal_category || !call->match_key)
-    {
-        _LSErrorSet(lserror, -ENOMEM, "OOM could not alloc signal_method | signal_category | match_key.");
-        retVal = false;
-        goto error;
-    }
+    call->signal_method = method;
+    call->signal_category = category;
+    method = NULL;
+    category = NULL;
 
     if (ret_call)
     {
@@ -1528,9 +2211,9 @@ _send_match(LSHandle        *sh,
     }
 
 error:
-    if (!JSON_ERROR(object)) json_object_put(object);
+    g_free(category);
+    g_free(method);
 
-    g_free(key);
     g_free(rule);
     return retVal;
 }
@@ -1546,25 +2229,21 @@ _send_reg_server_status(LSHandle *sh,
 {
     bool retVal = false;
     LSMessageToken token;
+    char *serviceName = NULL;
 
-    struct json_object *object = json_tokener_parse(payload);
-    if (is_error(object))
+    if (_LSJsonScanString(payload, "serviceName", &serviceName) == _LSJsonScanInvalid)
     {
         _LSErrorSet(lserror, -1, "Malformed json.");
         goto error;
     }
 
-    struct json_object *child = json_object_object_get(object, "serviceName");
-
-    const char *serviceName = json_object_get_string(child);
-
     if (!serviceName)
     {
         _LSErrorSet(lserror, -1, "Invalid payload.");
         goto error;
     }
 
-    retVal = LSTransportSendQueryServiceStatus(sh->transport, serviceName,
+    retVal = LSTransportSendQueryServiceStatus(sh->bus, serviceName,
                                                &token, lserror);
     if (!retVal)
     {
@@ -1588,7 +2267,7 @@ _send_reg_server_status(LSHandle *sh,
     retVal = true;
 
 error:
-    if (!is_error(object)) json_object_put(object);
+    g_free(serviceName);
 
     return retVal;
 }
@@ -1597,7 +2276,10 @@ static bool
 _send_method_call(LSHandle *sh,
              _Uri       *luri,
              const char *payload,
+             unsigned long payload_len,
+             bool binary,
              const char *applicationID,
+             GPtrArray  *flush,
              LSFilterFunc    callback,
              void           *ctx,
              _Call         **ret_call,
@@ -1605,30 +2287,333 @@ _send_method_call(LSHandle *sh,
 {
     bool retVal;
     LSMessageToken token;
+    gint64 issue_us = _LSLatencyNowUs();
 
-    retVal = LSTransportSend(sh->transport, luri->serviceName, luri->objectPath, luri->methodName, payload, applicationID, &token, lserror);
+    if (flush)
+    {
+        retVal = LSTransportSendDeferred(sh->bus, luri->serviceName, luri->objectPath, luri->methodName,
+                                         payload, payload_len, applicationID, flush, &token, lserror);
+    }
+    else if (binary)
+    {
+        retVal = LSTransportSendBinary(sh->bus, luri->serviceName, luri->objectPath, luri->methodName,
+                                       payload, payload_len, applicationID, &token, lserror);
+    }
+    else
+    {
+        retVal = LSTransportSendWithLen(sh->bus, luri->serviceName, luri->objectPath, luri->methodName,
+                                        payload, payload_len, applicationID, &token, lserror);
+    }
     if (!retVal)
     {
         goto error;
     }
 
+    LS_TRACE(_LSTracePointCall, _LSTransportMessageTypeMethodCall, token, payload_len);
+
     if (callback)
     {
         _Call *call = _CallNew(CALL_TYPE_METHOD_CALL, luri->serviceName, callback, ctx, token);
         if (!call)
         {
-            _LSErrorSet(lserror, -ENOMEM, "OOM: Could not send message");
-            goto error;
+            _LSErrorSet(lserror, -ENOMEM, "OOM: Could not send message");
+            goto error;
+        }
+
+        call->issue_us = issue_us;
+
+        if (ret_call)
+        {
+            *ret_call = call;
+        }
+    }
+
+error:
+    return retVal;
+}
+
+/* Key for the methods known to be idempotent */
+static char*
+_CallShareUriKey(const _Uri *luri)
+{
+    /* '\n' can't appear in any of them */
+    return g_strconcat(luri->serviceName, "\n", luri->objectPath, "\n", luri->methodName, NULL);
+}
+
+/** 
+* @brief Give a copy of the reply to a shared call to one of the callers.
+* 
+* @param  sh 
+* @param  reply 
+* @param  token    token of the caller's call
+* 
+* @retval copy (NULL on OOM)
+*/
+static LSMessage*
+_CallShareCopyReply(LSHandle *sh, LSMessage *reply, LSMessageToken token)
+{
+    LSMessage *copy = _LSMessageNewRef(reply->transport_msg, sh);
+    if (!copy) return NULL;
+
+    copy->responseToken = token;
+    copy->category = reply->category;
+
+    if (reply->methodAllocated)
+    {
+        copy->method = copy->methodAllocated = g_strdup(reply->methodAllocated);
+    }
+    else
+    {
+        copy->method = reply->method;
+    }
+
+    if (reply->payloadAllocated)
+    {
+        copy->payload = copy->payloadAllocated = g_strdup(reply->payloadAllocated);
+    }
+    else
+    {
+        copy->payload = reply->payload;
+    }
+
+    copy->serviceDownMessage = reply->serviceDownMessage;
+
+    return copy;
+}
+
+/** 
+* @brief Callback of a shared call: hand the reply (or failure) to every
+* caller still waiting for it.
+* 
+* @param  sh 
+* @param  reply 
+* @param  ctx      _CallShare
+* 
+* @retval true
+*/
+static bool
+_CallShareReply(LSHandle *sh, LSMessage *reply, void *ctx)
+{
+    _CallShare *share = ctx;
+    _CallMap *map = sh->callmap;
+    GArray *members = NULL;
+    guint i;
+
+    _CallMapLock(map);
+
+    /* calls made from now on go out again */
+    if (g_hash_table_lookup(map->shares, share->key) == share)
+    {
+        g_hash_table_remove(map->shares, share->key);
+    }
+
+    members = share->members;
+    share->members = NULL;
+
+    _CallMapUnlock(map);
+
+    if (!members)
+    {
+        /* everyone gave up on it */
+        return true;
+    }
+
+    for (i = 0; i < members->len; i++)
+    {
+        /* it may have been cancelled or timed out in the meantime */
+        _Call *call = _CallAcquire(map, g_array_index(members, LSMessageToken, i));
+        if (!call)
+        {
+            continue;
+        }
+
+        LSMessage *copy = _CallShareCopyReply(sh, reply, call->token);
+        if (copy)
+        {
+            if (call->callback)
+            {
+                (void)call->callback(sh, copy, call->ctx);
+            }
+
+            LSMessageUnref(copy);
+        }
+
+        _CallRemove(sh, map, call);
+        _CallRelease(call);
+    }
+
+    g_array_free(members, true);
+
+    return true;
+}
+
+/** 
+* @brief Take a caller off a shared call. The call itself is cancelled
+* once nobody is waiting for it anymore.
+* 
+* @param  sh 
+* @param  call     the caller's call
+*/
+static void
+_CallShareLeave(LSHandle *sh, _Call *call)
+{
+    _CallShare *share = call->share;
+    _CallMap *map = sh->callmap;
+    LSMessageToken shared_token = LSMESSAGE_TOKEN_INVALID;
+    guint i;
+
+    _CallMapLock(map);
+
+    if (share->members)
+    {
+        for (i = 0; i < share->members->len; i++)
+        {
+            if (g_array_index(share->members, LSMessageToken, i) == call->token)
+            {
+                g_array_remove_index_fast(share->members, i);
+                break;
+            }
+        }
+
+        if (share->members->len == 0)
+        {
+            g_array_free(share->members, true);
+            share->members = NULL;
+
+            if (g_hash_table_lookup(map->shares, share->key) == share)
+            {
+                g_hash_table_remove(map->shares, share->key);
+            }
+
+            shared_token = share->token;
+        }
+    }
+
+    _CallMapUnlock(map);
+
+    if (shared_token != LSMESSAGE_TOKEN_INVALID)
+    {
+        _Call *shared = _CallAcquire(map, shared_token);
+        if (shared)
+        {
+            LSError lserror;
+            LSErrorInit(&lserror);
+
+            if (!LSTransportCancelMethodCall(sh->bus, shared->serviceName, shared->token, &lserror))
+            {
+                LSErrorPrint(&lserror, stderr);
+                LSErrorFree(&lserror);
+            }
+
+            _CallRemove(sh, map, shared);
+            _CallRelease(shared);
+        }
+    }
+}
+
+/** 
+* @brief Send a one-reply method call, sharing a call that's already in
+* flight with the same uri and payload if the method is known to be
+* idempotent. Otherwise the call goes out on its own, and its reply tells
+* us whether the next ones can be shared.
+*
+* Must be called with the callmap lock held.
+* 
+* @param  sh 
+* @param  luri 
+* @param  payload      nul-terminated at payload_len
+* @param  payload_len 
+* @param  callback 
+* @param  ctx 
+* @param  ret_call     the caller's call (to be inserted like any other)
+* @param  lserror 
+* 
+* @retval
+*/
+static bool
+_send_method_call_coalesced(LSHandle *sh,
+             _Uri       *luri,
+             const char *payload,
+             unsigned long payload_len,
+             LSFilterFunc    callback,
+             void           *ctx,
+             _Call         **ret_call,
+             LSError *lserror)
+{
+    _CallMap *map = sh->callmap;
+    char *uri_key = _CallShareUriKey(luri);
+
+    if (!g_hash_table_lookup(map->idempotent, uri_key))
+    {
+        bool retVal = _send_method_call(sh, luri, payload, payload_len, false, NULL, NULL,
+                                        callback, ctx, ret_call, lserror);
+        if (retVal && *ret_call)
+        {
+            (*ret_call)->coalesce_uri = uri_key;
+        }
+        else
+        {
+            g_free(uri_key);
+        }
+        return retVal;
+    }
+
+    char *key = g_strconcat(uri_key, "\n", payload, NULL);
+    _CallShare *share = g_hash_table_lookup(map->shares, key);
+
+    if (share)
+    {
+        g_free(key);
+    }
+    else
+    {
+        _Call *shared = NULL;
+
+        share = _CallShareNew(key);
+
+        if (!_send_method_call(sh, luri, payload, payload_len, false, NULL, NULL,
+                               _CallShareReply, share, &shared, lserror) || !shared)
+        {
+            _CallShareUnref(share);
+            g_free(uri_key);
+            return false;
         }
 
-        if (ret_call)
+        shared->share = _CallShareRef(share);
+        shared->coalesce_uri = g_strdup(uri_key);
+
+        if (!_CallInsert(sh, map, shared, true, lserror))
         {
-            *ret_call = call;
+            _CallFree(shared);
+            _CallShareUnref(share);
+            g_free(uri_key);
+            return false;
         }
+
+        /* the callers' deadlines are the ones that count */
+        _CallDeadlineClear(map, shared);
+
+        share->token = shared->token;
+        g_hash_table_insert(map->shares, share->key, share);
     }
 
-error:
-    return retVal;
+    g_free(uri_key);
+
+    _Call *call = _CallNew(CALL_TYPE_METHOD_CALL, luri->serviceName, callback, ctx,
+                           _LSTransportGetNextToken(sh->transport));
+    if (!call)
+    {
+        _LSErrorSet(lserror, -ENOMEM, "OOM: Could not send message");
+        return false;
+    }
+
+    call->issue_us = _LSLatencyNowUs();
+    call->share = _CallShareRef(share);
+    g_array_append_val(share->members, call->token);
+
+    *ret_call = call;
+
+    return true;
 }
 
 static bool
@@ -1638,10 +2623,18 @@ _cancel_method_call(LSHandle *sh, _Call *call, LSError *lserror)
     {
         g_debug("TX: %s \"%s\" token <<%ld>>", __FUNCTION__, call->serviceName, call->token);
     }
+
+    if (call->share && call->callback != _CallShareReply)
+    {
+        /* only the call that went out can be cancelled, and only once
+         * nobody else is waiting on it */
+        _CallShareLeave(sh, call);
+        return true;
+    }
     
     // palm://com.hhahha.haha/com/palm/luna/private/cancel {"token":17}
 
-    return LSTransportCancelMethodCall(sh->transport, call->serviceName, call->token, lserror);
+    return LSTransportCancelMethodCall(sh->bus, call->serviceName, call->token, lserror);
 }
 
 static bool
@@ -1655,7 +2648,7 @@ _cancel_signal(LSHandle *sh, _Call *call, LSError *lserror)
     /* SIGNAL */
     if ((call->signal_category != NULL) || (call->signal_method != NULL))
     {
-        if (!LSTransportUnregisterSignal(sh->transport, call->signal_category, call->signal_method, NULL, lserror))
+        if (!LSTransportUnregisterSignal(sh->bus, call->signal_category, call->signal_method, NULL, lserror))
         {
             return false;
         }
@@ -1671,7 +2664,7 @@ _LSSignalSendCommon(LSHandle *sh, const char *uri, const char *payload,
 
     LSHANDLE_VALIDATE(sh);
 
-    luri = _UriParse(uri, lserror);
+    luri = _UriParseCached(uri, lserror);
     if (!luri)
     {
         return false;
@@ -1681,7 +2674,7 @@ _LSSignalSendCommon(LSHandle *sh, const char *uri, const char *payload,
 
     if (unlikely(_ls_enable_utf8_validation))
     {
-        if (!g_utf8_validate (payload, -1, NULL))
+        if (!_LSUtf8Validate(payload, -1, NULL))
         {
             _LSErrorSet(lserror, -EINVAL, "%s: payload is not utf-8",
                         __FUNCTION__);
@@ -1710,7 +2703,7 @@ _LSSignalSendCommon(LSHandle *sh, const char *uri, const char *payload,
         }
     }
 
-    retVal = LSTransportSendSignal(sh->transport, luri->objectPath, luri->methodName, payload, lserror);
+    retVal = LSTransportSendSignal(sh->bus, luri->objectPath, luri->methodName, payload, lserror);
 
     _UriFree(luri);
 
@@ -1760,7 +2753,7 @@ LSCall(LSHandle *sh, const char *uri, const char *payload,
        LSFilterFunc callback, void *ctx,
        LSMessageToken *ret_token, LSError *lserror)
 {
-    return _LSCallFromApplicationCommon(sh, uri, payload, NULL, /*AppID*/
+    return _LSCallFromApplicationCommon(sh, uri, payload, -1, false, NULL, /*AppID*/
                 callback, ctx, ret_token, false, lserror);
 }
 
@@ -1784,11 +2777,79 @@ LSCallOneReply(LSHandle *sh, const char *uri, const char *payload,
        LSFilterFunc callback, void *ctx,
        LSMessageToken *ret_token, LSError *lserror)
 {
-    return _LSCallFromApplicationCommon(sh, uri, payload, NULL, /*AppID*/
+    return _LSCallFromApplicationCommon(sh, uri, payload, -1, false, NULL, /*AppID*/
                 callback, ctx, ret_token, true, lserror);
 }
 
 
+/** 
+* @brief Variant of LSCall() for when the length of the payload is already
+*        known, so the library doesn't have to scan the payload for its end.
+*
+*        payload must still be nul-terminated at payload_len.
+* 
+* @param  sh 
+* @param  uri 
+* @param  payload 
+* @param  payload_len  length of payload, not including the nul
+* @param  callback 
+* @param  ctx 
+* @param  ret_token 
+* @param  lserror 
+* 
+* @retval
+*/
+bool
+LSCallWithLen(LSHandle *sh, const char *uri, const char *payload, size_t payload_len,
+       LSFilterFunc callback, void *ctx,
+       LSMessageToken *ret_token, LSError *lserror)
+{
+    return _LSCallFromApplicationCommon(sh, uri, payload, payload_len, false, NULL, /*AppID*/
+                callback, ctx, ret_token, false, lserror);
+}
+
+/** 
+* @brief Variant of LSCall() that takes the payload as a JSON object.
+*
+*        If the destination can receive binary encoded payloads, the object
+*        is encoded straight into the call, which is smaller and quicker to
+*        decode than JSON text (the service can get at it with
+*        LSMessageGetPayloadObject()); otherwise it's sent as JSON.
+* 
+* @param  sh 
+* @param  uri 
+* @param  payload 
+* @param  callback 
+* @param  ctx 
+* @param  ret_token 
+* @param  lserror 
+* 
+* @retval
+*/
+bool
+LSCallObject(LSHandle *sh, const char *uri, struct json_object *payload,
+       LSFilterFunc callback, void *ctx,
+       LSMessageToken *ret_token, LSError *lserror)
+{
+    _LSErrorIfFail(payload != NULL, lserror);
+
+    unsigned long encoded_len = 0;
+    char *encoded = _LSBinaryPayloadEncode(payload, &encoded_len);
+
+    if (!encoded)
+    {
+        _LSErrorSet(lserror, -EINVAL, "%s: unable to encode payload", __FUNCTION__);
+        return false;
+    }
+
+    bool ret = _LSCallFromApplicationCommon(sh, uri, encoded, encoded_len, true, NULL, /*AppID*/
+                callback, ctx, ret_token, false, lserror);
+
+    g_free(encoded);
+
+    return ret;
+}
+
 /** 
 * @brief Special LSCall() that sends an applicationID.
 *
@@ -1811,7 +2872,7 @@ LSCallFromApplication(LSHandle *sh, const char *uri, const char *payload,
        LSFilterFunc callback, void *ctx,
        LSMessageToken *ret_token, LSError *lserror)
 {
-    return _LSCallFromApplicationCommon(sh, uri, payload, applicationID,
+    return _LSCallFromApplicationCommon(sh, uri, payload, -1, false, applicationID,
                 callback, ctx, ret_token, false, lserror);
 }
 
@@ -1840,13 +2901,13 @@ LSCallFromApplicationOneReply(
        LSFilterFunc callback, void *ctx,
        LSMessageToken *ret_token, LSError *lserror)
 {
-    return _LSCallFromApplicationCommon(sh, uri, payload, applicationID,
+    return _LSCallFromApplicationCommon(sh, uri, payload, -1, false, applicationID,
                 callback, ctx, ret_token, true, lserror);
 }
 
 static bool
 _LSCallFromApplicationCommon(LSHandle *sh, const char *uri,
-       const char *payload,
+       const char *payload, gssize payload_len, bool binary,
        const char *applicationID,
        LSFilterFunc callback, void *ctx,
        LSMessageToken *ret_token, bool single, LSError *lserror)
@@ -1855,7 +2916,7 @@ _LSCallFromApplicationCommon(LSHandle *sh, const char *uri,
     _LSErrorIfFail(uri != NULL, lserror);
     _LSErrorIfFail(payload != NULL, lserror);
 
-    if (applicationID && !_LSTransportGetPrivileged(sh->transport))
+    if (applicationID && !_LSTransportGetPrivileged(sh->bus))
     {
         _LSErrorSet(lserror, LS_ERROR_CODE_NOT_PRIVILEGED, LS_ERROR_TEXT_NOT_PRIVILEGED, applicationID);
         return false;
@@ -1865,6 +2926,7 @@ _LSCallFromApplicationCommon(LSHandle *sh, const char *uri,
 
     _Call *call = NULL;
     _Uri *luri = NULL;
+    char *bus_payload = NULL;
     bool retVal;
 
     if (!g_str_has_prefix(uri, LUNA_PREFIX) &&
@@ -1875,23 +2937,32 @@ _LSCallFromApplicationCommon(LSHandle *sh, const char *uri,
         return false;
     }
 
-    if (unlikely(_ls_enable_utf8_validation))
+    /* binary payloads were built from a json_object, so they're valid */
+    if (unlikely(_ls_enable_utf8_validation) && !binary)
     {
-        if (!g_utf8_validate (payload, -1, NULL))
+        size_t valid_len;
+
+        /* finds the length in the same pass if we don't have it */
+        if (!_LSUtf8Validate(payload, payload_len, &valid_len))
         {
             _LSErrorSet(lserror, -EINVAL, "%s: payload is not utf-8",
                         __FUNCTION__);
             return false;
         }
+        payload_len = valid_len;
+    }
+    else if (payload_len < 0)
+    {
+        payload_len = strlen(payload);
     }
 
-    if (unlikely(strcmp(payload, "") == 0))
+    if (unlikely(payload_len == 0))
     {
         _LSErrorSet(lserror, -EINVAL, "Empty payload is not valid JSON. Use {}");
         return false;
     }
 
-    luri = _UriParse(uri, lserror);
+    luri = _UriParseCached(uri, lserror);
     if (!luri)
     {
         return false;
@@ -1911,6 +2982,17 @@ _LSCallFromApplicationCommon(LSHandle *sh, const char *uri,
             goto error;
         }
 
+        if (binary)
+        {
+            /* the bus itself only takes JSON */
+            payload = bus_payload = _LSBinaryPayloadDecodeToJson(payload, payload_len, NULL);
+            if (!payload)
+            {
+                _LSErrorSet(lserror, -EINVAL, "Invalid binary payload");
+                goto error;
+            }
+        }
+
         if (strcmp(luri->objectPath, "/signal") == 0)
         {
             // uri == "palm://com.palm.bus/signal/addmatch"
@@ -1946,10 +3028,16 @@ _LSCallFromApplicationCommon(LSHandle *sh, const char *uri,
             goto error;
         }
     }
+    else if (map->coalesce && single && callback && !binary && !applicationID)
+    {
+        bool ret = _send_method_call_coalesced(sh, luri, payload, payload_len,
+                            callback, ctx, &call, lserror);
+        if (!ret) goto error;
+    }
     else
     {
-        bool ret = _send_method_call(sh, luri, payload,
-                            applicationID,
+        bool ret = _send_method_call(sh, luri, payload, payload_len, binary,
+                            applicationID, NULL,
                             callback, ctx, &call, lserror);
         if (!ret) goto error;
     }
@@ -1961,62 +3049,358 @@ _LSCallFromApplicationCommon(LSHandle *sh, const char *uri,
         else
             *ret_token = LSMESSAGE_TOKEN_INVALID;
     }
-    
-    if (callback)
+    
+    if (callback)
+    {
+        if (!call)
+        {
+            _LSErrorSet(lserror, -1, "Call is null. we should not be here.");
+            goto error;
+        }
+
+        retVal = _CallInsert(sh, sh->callmap, call, single, lserror);
+        if (!retVal) goto error;
+
+        if (DEBUG_TRACING)
+        {
+            if (DEBUG_VERBOSE)
+            {
+                g_debug("TX: LCall token <<%ld>> %s %s",
+                        call->token, uri, payload);
+            }
+            else
+            {
+            g_debug("TX: LSCall token <<%ld>> %s", call->token, uri);
+            }
+        }
+    }
+    else
+    {
+        /* LS_ASSERT(!call); */
+        if (DEBUG_TRACING)
+        {
+            g_debug("TX: LSCall no token");
+        }
+    }
+
+    _CallMapUnlock(map);
+    _UriFree(luri);
+    g_free(bus_payload);
+    
+#if 0
+    if (sh->transport->service_name && strcmp(sh->transport->service_name, "com.palm.luna") == 0)
+    {
+        debug_print("handle: %p, transport: %p, uri: %s, payload: %s, appID: %s, ret_token: %d, single: %s\n", 
+                sh, sh->transport, uri, payload, applicationID,
+                ret_token ? (int)*ret_token : 0, single ? "true" : "false");
+
+    }
+#endif
+
+    return true;
+
+error:
+    _CallMapUnlock(map);
+    _UriFree(luri);
+    g_free(bus_payload);
+    return false;
+}
+
+
+
+/**
+ * A batch of calls made with LSCallMany(). Each call's ctx is its
+ * _CallGroupEntry; the group goes away once every entry is done.
+ */
+typedef struct _CallGroup _CallGroup;
+
+typedef struct _CallGroupEntry {
+    _CallGroup *group;
+    int         index;
+    gint        done;           //< set once the entry has its reply (or was cancelled)
+} _CallGroupEntry;
+
+struct _CallGroup {
+    gint                remaining;  //< entries that aren't done yet
+    int                 num_calls;
+    LSMessage         **replies;
+    _CallGroupEntry    *entries;
+
+    LSFilterFunc        callback;   //< called for each reply (could be NULL)
+    void               *ctx;
+    LSCallManyDoneFunc  done;       //< called once all entries are done (could be NULL)
+    void               *done_ctx;
+};
+
+static _CallGroup*
+_CallGroupNew(int num_calls, LSFilterFunc callback, void *ctx,
+              LSCallManyDoneFunc done, void *done_ctx)
+{
+    int i;
+    _CallGroup *group = g_new0(_CallGroup, 1);
+
+    group->remaining = num_calls;
+    group->num_calls = num_calls;
+    group->replies = g_new0(LSMessage*, num_calls);
+    group->entries = g_new0(_CallGroupEntry, num_calls);
+    group->callback = callback;
+    group->ctx = ctx;
+    group->done = done;
+    group->done_ctx = done_ctx;
+
+    for (i = 0; i < num_calls; i++)
+    {
+        group->entries[i].group = group;
+        group->entries[i].index = i;
+    }
+
+    return group;
+}
+
+static void
+_CallGroupFree(_CallGroup *group)
+{
+    int i;
+
+    for (i = 0; i < group->num_calls; i++)
+    {
+        if (group->replies[i])
+        {
+            LSMessageUnref(group->replies[i]);
+        }
+    }
+
+    g_free(group->replies);
+    g_free(group->entries);
+
+#ifdef MEMCHECK
+    memset(group, 0xFF, sizeof(_CallGroup));
+#endif
+
+    g_free(group);
+}
+
+/**
+ *******************************************************************************
+ * @brief Mark an entry of a group as done and complete the group if it was
+ * the last one. An entry is only ever done once, so a cancel that races
+ * with the reply is harmless.
+ *
+ * @param  sh       IN  handle
+ * @param  entry    IN  entry
+ * @param  reply    IN  reply (NULL if cancelled or never sent)
+ *******************************************************************************
+ */
+static void
+_CallGroupEntryDone(LSHandle *sh, _CallGroupEntry *entry, LSMessage *reply)
+{
+    _CallGroup *group = entry->group;
+
+    if (!g_atomic_int_compare_and_exchange(&entry->done, 0, 1))
+    {
+        return;
+    }
+
+    if (reply)
+    {
+        LSMessageRef(reply);
+        group->replies[entry->index] = reply;
+    }
+
+    if (g_atomic_int_dec_and_test(&group->remaining))
+    {
+        if (group->done)
+        {
+            group->done(sh, group->replies, group->num_calls, group->done_ctx);
+        }
+
+        _CallGroupFree(group);
+    }
+}
+
+static bool
+_CallGroupReply(LSHandle *sh, LSMessage *reply, void *ctx)
+{
+    _CallGroupEntry *entry = ctx;
+    _CallGroup *group = entry->group;
+    bool ret = true;
+
+    if (group->callback)
+    {
+        ret = group->callback(sh, reply, group->ctx);
+    }
+
+    _CallGroupEntryDone(sh, entry, reply);
+
+    return ret;
+}
+
+/** 
+* @brief Sends a batch of method calls at once, each like LSCallOneReply().
+*
+*        All uris are parsed and the payloads checked before anything is
+*        sent, the calls are added to the call map under a single lock, and
+*        calls to the same destination are written out together, so fanning
+*        out to many services costs much less than a loop of LSCall().
+*
+*        callback is called for each reply as it comes in, and done once
+*        every call has replied, failed, or been cancelled with
+*        LSCallCancel().
+*
+*        If sending fails part way through, false is returned with lserror
+*        set and the calls from the failed one on get
+*        LSMESSAGE_TOKEN_INVALID; the calls that were sent still complete
+*        and done is still called (with NULL for the unsent calls).
+*
+*        Calls to the bus itself (palm://com.palm.bus/...) are not supported.
+* 
+* @param  sh 
+* @param  calls         uris and payloads; token is filled in for each
+* @param  num_calls 
+* @param  callback      called for each reply (could be NULL)
+* @param  ctx 
+* @param  done          called when the whole batch is done (could be NULL)
+* @param  done_ctx 
+* @param  lserror 
+* 
+* @retval
+*/
+bool
+LSCallMany(LSHandle *sh, LSCallManyEntry *calls, int num_calls,
+       LSFilterFunc callback, void *ctx,
+       LSCallManyDoneFunc done, void *done_ctx, LSError *lserror)
+{
+    _LSErrorIfFail(sh != NULL, lserror);
+    _LSErrorIfFail(calls != NULL, lserror);
+    _LSErrorIfFail(num_calls > 0, lserror);
+
+    LSHANDLE_VALIDATE(sh);
+
+    bool retVal = false;
+    int i;
+    int sent = 0;
+    _Uri **luris = g_new0(_Uri*, num_calls);
+    _CallGroup *group = NULL;
+    GPtrArray *flush = NULL;
+    _CallMap *map = sh->callmap;
+
+    for (i = 0; i < num_calls; i++)
+    {
+        const char *uri = calls[i].uri;
+        const char *payload = calls[i].payload;
+
+        calls[i].token = LSMESSAGE_TOKEN_INVALID;
+
+        if (!uri || !payload)
+        {
+            _LSErrorSet(lserror, -EINVAL, "%s: call %d has no uri or payload", __FUNCTION__, i);
+            goto exit;
+        }
+
+        if (!g_str_has_prefix(uri, LUNA_PREFIX) &&
+            !g_str_has_prefix(uri, LUNA_OLD_PREFIX))
+        {
+            _LSErrorSet(lserror, -EINVAL,
+                    "%s: Invalid syntax for uri", __FUNCTION__);
+            goto exit;
+        }
+
+        if (unlikely(_ls_enable_utf8_validation))
+        {
+            if (!_LSUtf8Validate(payload, -1, NULL))
+            {
+                _LSErrorSet(lserror, -EINVAL, "%s: payload is not utf-8",
+                            __FUNCTION__);
+                goto exit;
+            }
+        }
+
+        if (unlikely(payload[0] == '\0'))
+        {
+            _LSErrorSet(lserror, -EINVAL, "Empty payload is not valid JSON. Use {}");
+            goto exit;
+        }
+
+        luris[i] = _UriParseCached(uri, lserror);
+        if (!luris[i])
+        {
+            goto exit;
+        }
+
+        if (strcmp(luris[i]->serviceName, LUNABUS_SERVICE_NAME) == 0 ||
+            strcmp(luris[i]->serviceName, LUNABUS_SERVICE_NAME_OLD) == 0)
+        {
+            _LSErrorSet(lserror, -EINVAL, "%s: calls to the bus are not supported", __FUNCTION__);
+            goto exit;
+        }
+    }
+
+    if (callback || done)
+    {
+        group = _CallGroupNew(num_calls, callback, ctx, done, done_ctx);
+    }
+
+    flush = g_ptr_array_new();
+
+    _CallMapLock(map);
+
+    for (sent = 0; sent < num_calls; sent++)
     {
-        if (!call)
+        _Call *call = NULL;
+
+        if (!_send_method_call(sh, luris[sent], calls[sent].payload, strlen(calls[sent].payload), false,
+                               NULL, flush,
+                               group ? _CallGroupReply : NULL,
+                               group ? &group->entries[sent] : NULL,
+                               &call, lserror))
         {
-            _LSErrorSet(lserror, -1, "Call is null. we should not be here.");
-            goto error;
+            break;
         }
 
-        retVal = _CallInsert(sh, sh->callmap, call, single, lserror);
-        if (!retVal) goto error;
-
-        if (DEBUG_TRACING)
+        if (call)
         {
-            if (DEBUG_VERBOSE)
-            {
-                g_debug("TX: LCall token <<%ld>> %s %s",
-                        call->token, uri, payload);
-            }
-            else
+            if (!_CallInsert(sh, map, call, true, lserror))
             {
-            g_debug("TX: LSCall token <<%ld>> %s", call->token, uri);
+                /* it's on its way, but nobody would see the reply; its
+                 * group entry is completed below along with the unsent ones */
+                _CallFree(call);
+                calls[sent].token = LSMESSAGE_TOKEN_INVALID;
+                break;
             }
+
+            calls[sent].token = call->token;
         }
-    }
-    else
-    {
-        /* LS_ASSERT(!call); */
+
         if (DEBUG_TRACING)
         {
-            g_debug("TX: LSCall no token");
+            g_debug("TX: LSCallMany token <<%ld>> %s", calls[sent].token, calls[sent].uri);
         }
     }
 
     _CallMapUnlock(map);
-    _UriFree(luri);
-    
-#if 0
-    if (sh->transport->service_name && strcmp(sh->transport->service_name, "com.palm.luna") == 0)
-    {
-        debug_print("handle: %p, transport: %p, uri: %s, payload: %s, appID: %s, ret_token: %d, single: %s\n", 
-                sh, sh->transport, uri, payload, applicationID,
-                ret_token ? (int)*ret_token : 0, single ? "true" : "false");
 
-    }
-#endif
+    LSTransportFlushDeferred(flush);
 
-    return true;
+    retVal = (sent == num_calls);
 
-error:
-    _CallMapUnlock(map);
-    _UriFree(luri);
-    return false;
-}
+    if (group)
+    {
+        /* completes the group right here if nothing was sent */
+        for (i = sent; i < num_calls; i++)
+        {
+            _CallGroupEntryDone(sh, &group->entries[i], NULL);
+        }
+    }
 
+exit:
+    for (i = 0; i < num_calls; i++)
+    {
+        _UriFree(luris[i]);
+    }
+    g_free(luris);
 
+    return retVal;
+}
 
 /** 
 * @brief Sends a cancel message to service to end call session and also
@@ -2069,44 +3453,237 @@ LSCallCancel(LSHandle *sh, LSMessageToken token, LSError *lserror)
 
     _CallRemove(sh, callmap, call);
 
+    if (call->callback == _CallGroupReply)
+    {
+        /* the batch won't get a reply for this one */
+        _CallGroupEntryDone(sh, call->ctx, NULL);
+    }
+
     _CallRelease(call); // -0
 
     return retVal;
 }
 
-static bool
-_ServerStatusHelper(LSHandle *sh, LSMessage *message, void *ctx)
+/** 
+* @brief Callmap timer: fail every method call whose deadline has passed,
+* as if the service had replied with a "Timeout" error, and cancel it on
+* the service side.
+* 
+* @param  data   LSHandle
+* 
+* @retval FALSE, the timer is re-armed for the next deadline
+*/
+static gboolean
+_CallDeadlineExpired(gpointer data)
 {
-    const char *payload = LSMessageGetPayload(message);
+    LSHandle *sh = data;
+    _CallMap *map = sh->callmap;
+    GArray *expired = g_array_new(false, false, sizeof(LSMessageToken));
+    gint64 now_us = _LSLatencyNowUs();
+    guint i;
 
-    struct json_object *object = json_tokener_parse(payload);
+    _CallMapLock(map);
 
-    _ServerStatus *server_status = (_ServerStatus*)ctx;
-    if (!server_status) goto error;
+    g_source_unref(map->deadline_source);
+    map->deadline_source = NULL;
+
+    while (!g_sequence_iter_is_end(g_sequence_get_begin_iter(map->deadlines)))
+    {
+        _Call *call = g_sequence_get(g_sequence_get_begin_iter(map->deadlines));
+
+        if (call->deadline_us > now_us)
+        {
+            break;
+        }
+
+        g_array_append_val(expired, call->token);
+        _CallDeadlineClear(map, call);
+    }
+
+    _CallDeadlineArm(sh, map);
 
-    if (!JSON_ERROR(object))
+    _CallMapUnlock(map);
+
+    for (i = 0; i < expired->len; i++)
     {
-        const char *serviceName;
-        bool connected;
+        LSError lserror;
+        LSErrorInit(&lserror);
 
-        struct json_object *serviceObj = NULL;
-        struct json_object *connectedObj = NULL;
+        /* it may have been answered or cancelled in the meantime */
+        _Call *call = _CallAcquire(map, g_array_index(expired, LSMessageToken, i));
+        if (!call)
+        {
+            continue;
+        }
 
-        if (!json_object_object_get_ex(object, "serviceName", &serviceObj)) goto error;
-        if (!json_object_object_get_ex(object, "connected", &connectedObj)) goto error;
-       
-        serviceName = json_object_get_string(serviceObj);
-        connected = json_object_get_boolean(connectedObj);
+        if (!_cancel_method_call(sh, call, &lserror))
+        {
+            LSErrorPrint(&lserror, stderr);
+            LSErrorFree(&lserror);
+        }
 
-        if (server_status->callback)
+        LSMessage *reply = _LSMessageNewRef(NULL, sh);
+        if (reply)
         {
-            server_status->callback
-                (sh, serviceName, connected, server_status->ctx);
+            reply->responseToken = call->token;
+            reply->category = LUNABUS_ERROR_CATEGORY;
+            reply->method = LUNABUS_ERROR_TIMEOUT;
+            reply->payloadAllocated = g_strdup_printf(
+                "{\"returnValue\":false,"
+                 "\"errorCode\":-1,"
+                 "\"errorText\":\"No reply from %s in time.\"}",
+                 call->serviceName);
+            reply->payload = reply->payloadAllocated;
+
+            if (call->callback)
+            {
+                (void)call->callback(sh, reply, call->ctx);
+            }
+
+            LSMessageUnref(reply);
         }
+
+        _CallRemove(sh, map, call);
+        _CallRelease(call);
+    }
+
+    g_array_free(expired, true);
+
+    return FALSE;
+}
+
+/** 
+* @brief Set a deadline for the first reply to a method call. If no reply
+*        has come in by then, the callback gets an error reply with method
+*        LUNABUS_ERROR_TIMEOUT and the call is cancelled. A deadline only
+*        covers the first reply, so subscriptions can use it to bound the
+*        wait for their initial response.
+*
+*        Deadlines are enforced by the main loop the handle is attached to.
+* 
+* @param  sh 
+* @param  token         token of the call (from LSCall() and friends)
+* @param  timeout_ms    time from now, 0 to remove the deadline
+* @param  lserror 
+* 
+* @retval
+*/
+bool
+LSCallSetTimeout(LSHandle *sh, LSMessageToken token, int timeout_ms, LSError *lserror)
+{
+    _LSErrorIfFail(sh != NULL, lserror);
+    _LSErrorIfFail(timeout_ms >= 0, lserror);
+
+    LSHANDLE_VALIDATE(sh);
+
+    bool retVal = false;
+    _CallMap *map = sh->callmap;
+
+    _CallMapLock(map);
+
+    _Call *call = _CallTokenTableLookup(&map->tokenMap, token);
+
+    if (!call || call->type != CALL_TYPE_METHOD_CALL)
+    {
+        _LSErrorSetNoPrint(lserror, -1, "Could not find method call %ld.", token);
+        goto exit;
+    }
+
+    if (!call->issue_us)
+    {
+        _LSErrorSetNoPrint(lserror, -1, "Call %ld already has a reply.", token);
+        goto exit;
+    }
+
+    _CallDeadlineSet(sh, map, call, timeout_ms);
+
+    retVal = true;
+
+exit:
+    _CallMapUnlock(map);
+
+    return retVal;
+}
+
+/** 
+* @brief Set the reply deadline that every method call made on this handle
+*        from now on gets (see LSCallSetTimeout()).
+* 
+* @param  sh 
+* @param  timeout_ms    0 for none (the default)
+* @param  lserror 
+* 
+* @retval
+*/
+bool
+LSSetDefaultCallTimeout(LSHandle *sh, int timeout_ms, LSError *lserror)
+{
+    _LSErrorIfFail(sh != NULL, lserror);
+    _LSErrorIfFail(timeout_ms >= 0, lserror);
+
+    LSHANDLE_VALIDATE(sh);
+
+    _CallMapLock(sh->callmap);
+    sh->callmap->default_timeout_ms = timeout_ms;
+    _CallMapUnlock(sh->callmap);
+
+    return true;
+}
+
+/** 
+* @brief Let identical one-reply calls share a call that's in flight.
+*
+*        While enabled, an LSCallOneReply() with the same uri and payload as
+*        one that hasn't been answered yet doesn't go out again; it gets a
+*        copy of the same reply. Only methods that the service registered
+*        with LUNA_METHOD_FLAG_IDEMPOTENT are shared, which is learned from
+*        their first reply, so the first call to a method always goes out
+*        on its own. Each call still has a token of its own that can be
+*        cancelled and given a timeout.
+*
+*        Calls with an applicationID or a binary payload are never shared.
+* 
+* @param  sh 
+* @param  enable    true to share calls (off by default)
+* @param  lserror 
+* 
+* @retval
+*/
+bool
+LSSetCallCoalescing(LSHandle *sh, bool enable, LSError *lserror)
+{
+    _LSErrorIfFail(sh != NULL, lserror);
+
+    LSHANDLE_VALIDATE(sh);
+
+    _CallMapLock(sh->callmap);
+    sh->callmap->coalesce = enable;
+    _CallMapUnlock(sh->callmap);
+
+    return true;
+}
+
+static bool
+_ServerStatusHelper(LSHandle *sh, LSMessage *message, void *ctx)
+{
+    const char *payload = LSMessageGetPayload(message);
+    char *serviceName = NULL;
+    bool connected;
+
+    _ServerStatus *server_status = (_ServerStatus*)ctx;
+    if (!server_status) goto error;
+
+    if (_LSJsonScanString(payload, "serviceName", &serviceName) != _LSJsonScanFound) goto error;
+    if (_LSJsonScanBoolean(payload, "connected", &connected) != _LSJsonScanFound) goto error;
+
+    if (server_status->callback)
+    {
+        server_status->callback
+            (sh, serviceName, connected, server_status->ctx);
     }
 
 error:
-    if (!JSON_ERROR(object)) json_object_put(object);
+    g_free(serviceName);
     return true;
 }
 
@@ -2227,6 +3804,118 @@ LSSignalCall(LSHandle *sh,
     return retVal;
 }
 
+/** 
+* @brief Attach a callback to several signals at once, like LSSignalCall()
+*        for each of them, but with a single registration message to the
+*        hub instead of one round trip per signal.
+*
+*        The hub acknowledges the whole batch once, with a reply for the
+*        first entry's token. Each match gets its own token and is removed
+*        with LSSignalCallCancel() like any other.
+*
+*        If adding a match fails part way through, false is returned with
+*        lserror set; the matches from the failed one on are not added and
+*        get LSMESSAGE_TOKEN_INVALID.
+* 
+* @param  sh 
+* @param  signals       categories and methods; token is filled in for each
+* @param  num_signals 
+* @param  filterFunc    called for each signal (and the acknowledgement)
+* @param  ctx 
+* @param  lserror 
+* 
+* @retval
+*/
+bool
+LSSignalCallMany(LSHandle *sh,
+         LSSignalCallManyEntry *signals, int num_signals,
+         LSFilterFunc filterFunc, void *ctx,
+         LSError *lserror)
+{
+    _LSErrorIfFail(sh != NULL, lserror);
+    _LSErrorIfFail(signals != NULL, lserror);
+    _LSErrorIfFail(num_signals > 0, lserror);
+    _LSErrorIfFail(filterFunc != NULL, lserror);
+
+    LSHANDLE_VALIDATE(sh);
+
+    bool retVal = false;
+    int i;
+    int added = 0;
+    LSMessageToken token;
+    const char **categories = g_new(const char*, num_signals);
+    const char **methods = g_new(const char*, num_signals);
+    _CallMap *map = sh->callmap;
+
+    for (i = 0; i < num_signals; i++)
+    {
+        signals[i].token = LSMESSAGE_TOKEN_INVALID;
+
+        if (!signals[i].category)
+        {
+            _LSErrorSet(lserror, -EINVAL, "%s: signal %d has no category", __FUNCTION__, i);
+            goto exit;
+        }
+
+        categories[i] = signals[i].category;
+        methods[i] = signals[i].method;
+    }
+
+    /* hold the lock so that no signal comes in before its match is added */
+    _CallMapLock(map);
+
+    if (!LSTransportRegisterSignalMany(sh->bus, categories, methods, num_signals, &token, lserror))
+    {
+        _CallMapUnlock(map);
+        goto exit;
+    }
+
+    for (added = 0; added < num_signals; added++)
+    {
+        /* the hub replies once, to the batch's token */
+        _Call *call = _CallNew(CALL_TYPE_SIGNAL, LUNABUS_SERVICE_NAME, filterFunc, ctx,
+                               added == 0 ? token : _LSTransportGetNextToken(sh->transport));
+        if (!call)
+        {
+            _LSErrorSet(lserror, -ENOMEM, "OOM could not allocate call.");
+            break;
+        }
+
+        call->signal_category = g_strdup(categories[added]);
+        call->signal_method = g_strdup(methods[added]);
+
+        if (!_CallInsert(sh, map, call, false, lserror))
+        {
+            _CallFree(call);
+            break;
+        }
+
+        signals[added].token = call->token;
+
+        if (DEBUG_TRACING)
+        {
+            g_debug("TX: LSSignalCallMany token <<%ld>> %s/%s", call->token,
+                    categories[added], methods[added] ? methods[added] : "");
+        }
+    }
+
+    _CallMapUnlock(map);
+
+    retVal = (added == num_signals);
+
+    /* nobody would see the signals for the rest */
+    for (i = added; i < num_signals; i++)
+    {
+        LSTransportUnregisterSignal(sh->bus, categories[i], methods[i], NULL, NULL);
+    }
+
+exit:
+    g_free(categories);
+    g_free(methods);
+
+    return retVal;
+}
+
 /** 
 * @brief Remove callback & match for specific signal.
 * 
@@ -2296,6 +3985,7 @@ struct _FetchMessageQueue
 {
     _LSTransportMessage *message;
     _TokenList  *tokens;
+    gint num_tokens;        /**< tokens->len, readable without the lock */
 
     _ServerInfo  server_info;
 
@@ -2361,13 +4051,8 @@ _FetchMessageQueueSize(LSHandle *sh)
     _FetchMessageQueue *queue = sh->fetch_message_queue;
     if (!queue) return 0;
 
-    int size;
-
-    _FetchMessageQueueLock(queue);
-    size = queue->tokens->len;
-    _FetchMessageQueueUnlock(queue);
-
-    return size;
+    /* only a hint for the fetch queue, so don't bother with the lock */
+    return g_atomic_int_get(&queue->num_tokens);
 }
 
 /** 
@@ -2464,6 +4149,7 @@ _FetchMessageQueueGet(LSHandle *sh, LSMessage **ret_message, LSError *lserror)
         }
     }
 
+    g_atomic_int_set(&queue->num_tokens, queue->tokens->len);
     _FetchMessageQueueUnlock(queue);
     return true;
 
@@ -2476,6 +4162,7 @@ done_empty:
         queue->message = NULL;
     }
 
+    g_atomic_int_set(&queue->num_tokens, queue->tokens->len);
     _FetchMessageQueueUnlock(queue);
     return retVal;
 }
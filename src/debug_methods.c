@@ -20,6 +20,8 @@
 #include "debug_methods.h"
 #include "subscription.h"
 #include "base.h"
+#include "transport_message.h"
+#include "trace.h"
 
 #ifdef MALLOC_DEBUG
 #include <malloc.h>
@@ -70,6 +72,153 @@ _LSPrivateGetSubscriptions(LSHandle* sh, LSMessage *message, void *ctx)
 }
 #endif  /* SUBSCRIPTION_DEBUG */
 
+#ifdef LATENCY_DEBUG
+/* returnValue: true,
+ * methods: [{category: string, method: string, handler: histogram},...],
+ * calls: [{service: string, reply: histogram},...],
+ * queues: [{service: string, unique_name: string, direct_sends: int,
+ *           queue_depth: histogram, queue_dwell: histogram},...]
+ *
+ * histogram: {count: int, mean_<unit>: int, max_<unit>: int, buckets: [int,...]}
+ * where bucket i counts values in [2^i, 2^(i+1)) */
+bool
+_LSPrivateGetLatency(LSHandle* sh, LSMessage *message, void *ctx)
+{
+    LSError lserror;
+    LSErrorInit(&lserror);
+
+    const char *sender = LSMessageGetSenderServiceName(message);
+
+    if (!sender || strcmp(sender, MONITOR_NAME) != 0)
+    {
+        g_critical("WARNING: latency debug method not called by monitor;"
+                   " ignoring (service name: %s, unique_name: %s)",
+                   sender, LSMessageGetSender(message));
+        return true;
+    }
+
+    struct json_object *ret_obj = _LSLatencyStatsGetJson(sh->latency_stats);
+    if (JSON_ERROR(ret_obj))
+    {
+        g_critical("%s: OOM", __FUNCTION__);
+        return true;
+    }
+
+    struct json_object *queues_obj = _LSTransportGetQueueStatsJson(sh->bus);
+    if (!JSON_ERROR(queues_obj))
+    {
+        json_object_object_add(ret_obj, "queues", queues_obj);
+    }
+
+    json_object_object_add(ret_obj, "returnValue", json_object_new_boolean(true));
+
+    bool reply_ret = LSMessageReply(sh, message, json_object_to_json_string(ret_obj), &lserror);
+    if (!reply_ret)
+    {
+        g_critical("%s: sending latency info failed", __FUNCTION__);
+        LSErrorPrint(&lserror, stderr);
+        LSErrorFree(&lserror);
+    }
+
+    json_object_put(ret_obj);
+
+    return true;
+}
+
+/* returnValue: true, threshold_ms: int,
+ * calls: [{category: string, method: string, sender: string,
+ *          duration_us: int, ago_ms: int},...] (oldest first) */
+bool
+_LSPrivateGetSlowCalls(LSHandle* sh, LSMessage *message, void *ctx)
+{
+    LSError lserror;
+    LSErrorInit(&lserror);
+
+    const char *sender = LSMessageGetSenderServiceName(message);
+
+    if (!sender || strcmp(sender, MONITOR_NAME) != 0)
+    {
+        g_critical("WARNING: slow calls debug method not called by monitor;"
+                   " ignoring (service name: %s, unique_name: %s)",
+                   sender, LSMessageGetSender(message));
+        return true;
+    }
+
+    struct json_object *ret_obj = json_object_new_object();
+    if (JSON_ERROR(ret_obj))
+    {
+        g_critical("%s: OOM", __FUNCTION__);
+        return true;
+    }
+
+    _LSSlowCallRing *ring = g_atomic_pointer_get(&sh->slow_calls);
+    struct json_object *calls_obj = ring ? _LSSlowCallRingGetJson(ring) : json_object_new_array();
+
+    if (!JSON_ERROR(calls_obj))
+    {
+        json_object_object_add(ret_obj, "calls", calls_obj);
+    }
+
+    json_object_object_add(ret_obj, "returnValue", json_object_new_boolean(true));
+    json_object_object_add(ret_obj, "threshold_ms", json_object_new_int(sh->slow_call_threshold_us / 1000));
+
+    bool reply_ret = LSMessageReply(sh, message, json_object_to_json_string(ret_obj), &lserror);
+    if (!reply_ret)
+    {
+        g_critical("%s: sending slow calls failed", __FUNCTION__);
+        LSErrorPrint(&lserror, stderr);
+        LSErrorFree(&lserror);
+    }
+
+    json_object_put(ret_obj);
+
+    return true;
+}
+
+/* returnValue: true, enabled: bool,
+ * points: [string,...],
+ * threads: [{tid: int, records: [[sec, usec, point, type, token, size],...]},...]
+ * (see _LSTraceGetJson) */
+bool
+_LSPrivateGetTrace(LSHandle* sh, LSMessage *message, void *ctx)
+{
+    LSError lserror;
+    LSErrorInit(&lserror);
+
+    const char *sender = LSMessageGetSenderServiceName(message);
+
+    if (!sender || strcmp(sender, MONITOR_NAME) != 0)
+    {
+        g_critical("WARNING: trace debug method not called by monitor;"
+                   " ignoring (service name: %s, unique_name: %s)",
+                   sender, LSMessageGetSender(message));
+        return true;
+    }
+
+    struct json_object *ret_obj = _LSTraceGetJson();
+    if (JSON_ERROR(ret_obj))
+    {
+        g_critical("%s: OOM", __FUNCTION__);
+        return true;
+    }
+
+    json_object_object_add(ret_obj, "returnValue", json_object_new_boolean(true));
+    json_object_object_add(ret_obj, "enabled", json_object_new_boolean(_ls_trace_enabled));
+
+    bool reply_ret = LSMessageReply(sh, message, json_object_to_json_string(ret_obj), &lserror);
+    if (!reply_ret)
+    {
+        g_critical("%s: sending trace failed", __FUNCTION__);
+        LSErrorPrint(&lserror, stderr);
+        LSErrorFree(&lserror);
+    }
+
+    json_object_put(ret_obj);
+
+    return true;
+}
+#endif  /* LATENCY_DEBUG */
+
 #ifdef MALLOC_DEBUG
 bool
 _LSPrivateGetMallinfo(LSHandle* sh, LSMessage *message, void *ctx)
@@ -88,6 +237,7 @@ _LSPrivateGetMallinfo(LSHandle* sh, LSMessage *message, void *ctx)
     struct json_object *slot_h_obj = NULL;
     struct json_object *slot_i_obj = NULL;
     struct json_object *slot_j_obj = NULL;
+    struct json_object *pool_array_obj = NULL;
 
     const char *sender = LSMessageGetSenderServiceName(message);
 
@@ -159,9 +309,29 @@ _LSPrivateGetMallinfo(LSHandle* sh, LSMessage *message, void *ctx)
     json_object_object_add(mallinfo_obj, "malloc_bytes", slot_h_obj);
     json_object_object_add(mallinfo_obj, "slack_bytes", slot_i_obj);
     json_object_object_add(mallinfo_obj, "trimmable_slack_bytes", slot_j_obj);
+
+    /* message_pool: [{size: int, hits: int, misses: int, free: int},...] */
+    pool_array_obj = json_object_new_array();
+    if (JSON_ERROR(pool_array_obj)) goto error;
+
+    int size_class;
+    _LSTransportMessagePoolStats pool_stats;
+
+    for (size_class = 0; _LSTransportMessagePoolGetStats(size_class, &pool_stats); size_class++)
+    {
+        struct json_object *pool_obj = json_object_new_object();
+        if (JSON_ERROR(pool_obj)) goto error;
+
+        json_object_object_add(pool_obj, "size", json_object_new_int(pool_stats.size));
+        json_object_object_add(pool_obj, "hits", json_object_new_int(pool_stats.hits));
+        json_object_object_add(pool_obj, "misses", json_object_new_int(pool_stats.misses));
+        json_object_object_add(pool_obj, "free", json_object_new_int(pool_stats.free));
+        json_object_array_add(pool_array_obj, pool_obj);
+    }
         
     json_object_object_add(ret_obj, "returnValue", true_obj);
     json_object_object_add(ret_obj, "mallinfo", mallinfo_obj);
+    json_object_object_add(ret_obj, "message_pool", pool_array_obj);
 
     bool reply_ret = LSMessageReply(sh, message, json_object_to_json_string(ret_obj), &lserror);
     if (!reply_ret)
@@ -189,6 +359,7 @@ error:
     if (!JSON_ERROR(slot_h_obj)) json_object_put(slot_h_obj);
     if (!JSON_ERROR(slot_i_obj)) json_object_put(slot_i_obj);
     if (!JSON_ERROR(slot_j_obj)) json_object_put(slot_j_obj);
+    if (!JSON_ERROR(pool_array_obj)) json_object_put(pool_array_obj);
     
     return true;
 }
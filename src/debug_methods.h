@@ -25,6 +25,7 @@
 
 #define SUBSCRIPTION_DEBUG
 #define MALLOC_DEBUG
+#define LATENCY_DEBUG
 
 #ifdef SUBSCRIPTION_DEBUG
 bool _LSPrivateGetSubscriptions(LSHandle* sh, LSMessage *message, void *ctx);
@@ -33,5 +34,10 @@ bool _LSPrivateGetSubscriptions(LSHandle* sh, LSMessage *message, void *ctx);
 bool _LSPrivateGetMallinfo(LSHandle* sh, LSMessage *message, void *ctx);
 bool _LSPrivateDoMallocTrim(LSHandle* sh, LSMessage *message, void *ctx);
 #endif
+#ifdef LATENCY_DEBUG
+bool _LSPrivateGetLatency(LSHandle* sh, LSMessage *message, void *ctx);
+bool _LSPrivateGetSlowCalls(LSHandle* sh, LSMessage *message, void *ctx);
+bool _LSPrivateGetTrace(LSHandle* sh, LSMessage *message, void *ctx);
+#endif
 
 #endif // _DEBUG_METHODS_H_
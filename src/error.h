@@ -39,6 +39,8 @@
 #define LS_ERROR_TEXT_DEPRECATED        "API is deprecated"
 #define LS_ERROR_TEXT_NOT_PRIVILEGED    "LSCallFromApplication with application ID %s but not privileged"
 #define LS_ERROR_TEXT_PROTOCOL_VERSION  "Protocol version (%d) does not match the hub"
+#define LS_ERROR_TEXT_SERVICE_NOT_EXIST "Service does not exist: %s"
+#define LS_ERROR_TEXT_QUEUE_FULL        "Too many messages waiting for %s"
 
 /*
     We don't want the LS_ASSERT macro to evaluate the "cond" expression twice since it may have side-effects.
@@ -30,7 +30,10 @@
 
 #ifdef HAVE_SYS_INOTIFY_H
 #include <sys/inotify.h>
+#include <limits.h>
 #define INOTIFY_MASK    (IN_MODIFY | IN_CREATE | IN_DELETE | IN_MOVE)
+#define INOTIFY_DIR_MASK    (IN_CLOSE_WRITE | IN_DELETE | IN_MOVE)  /**< role and service dirs */
+#define INOTIFY_EVENT_BUF_SIZE  (16 * (sizeof(struct inotify_event) + NAME_MAX + 1))
 #endif
 
 #include "hub.h"
@@ -43,7 +46,7 @@
 #define PIPE_READ_END   0
 #define PIPE_WRITE_END  1
 
-#define MAX_KEYS_IN_GROUP   10
+#define MAX_KEYS_IN_GROUP   12
 #define MAX_GROUPS          10
 
 #define DEFAULT_SYSMGR_EXE_PATH             "/usr/bin/LunaSysMgr"
@@ -105,9 +108,13 @@ _ConfigKeySetString(const char *value, const char **conf_var, LSError *lserror);
 bool
 _ConfigKeyProcessDynamicServiceDirs(const char **dirs, void *ctxt, LSError *lserror);
 
+static bool
+_ConfigKeyProcessRoleDirs(const char **dirs, void *ctxt, LSError *lserror);
 static bool
 _ConfigKeyProcessDynamicServiceExecPrefix(char *value, const char **conf_var, LSError *lserror);
 static bool
+_ConfigKeyProcessScanCache(char *value, const char **conf_var, LSError *lserror);
+static bool
 _ConfigKeyProcessWatchdogFailureMode(char *mode_str, LSHubWatchdogFailureMode *conf_var, LSError *lserror);
 
 static void _ConfigSetDefaults(void);
@@ -121,6 +128,11 @@ static void _ConfigFreeSettings(void);
  * PidDirectory=/path/to/some/dir
  * LogServiceStatus=false
  * ConnectTimeout=time_ms
+ * SocketBufferMin=bytes (0 to not autotune socket buffers)
+ * SocketBufferMax=bytes
+ * EpollDispatch=false
+ * ResumeTimeout=time_sec (0 to not snapshot state for hub restarts)
+ * IoThreads=count (0 to do all client I/O on the main thread)
  *
  * [Watchdog]
  * Timeout=time_sec
@@ -128,12 +140,18 @@ static void _ConfigFreeSettings(void);
  *
  * [Dynamic Services]
  * Directories=/path/to/some/dir;/another/path/to/some
+ * ScanCache=/path/to/some/file (empty to parse every service file at boot)
  * ExecPrefix=/path/to/some/bin
  * LaunchTimeout=time_ms
+ * WarmDemand=count (0 to only keep "KeepWarm" services warm)
+ * WarmDemandWindow=time_sec
+ * WarmMinLifetime=time_sec
+ * WarmRelaunchDelay=time_sec
  *
  * [Security]
  * Enabled=bool
  * Directories=/path/to/some/dir;/another/path/to/some
+ * ScanCache=/path/to/some/file (empty to parse every role file at boot)
  * SysMgrExePath=/path/to/LunaSysMgr
  * JsServiceExePath=js
  * MojoAppExePath=mojo
@@ -167,6 +185,42 @@ static _ConfigDOM conf_file_dom = {
                     .user_cb = (_ConfigKeyUser*)_ConfigKeySetInt,
                     .user_ctxt = &g_conf_connect_timeout_ms,
                 },
+                {
+                    .key = "SocketPairHandoff",
+                    .get_value = _ConfigKeyGetBool,
+                    .user_cb = (_ConfigKeyUser*)_ConfigKeySetBool,
+                    .user_ctxt = &g_conf_socket_pair_handoff,
+                },
+                {
+                    .key = "SocketBufferMin",
+                    .get_value = _ConfigKeyGetInt,
+                    .user_cb = (_ConfigKeyUser*)_ConfigKeySetInt,
+                    .user_ctxt = &g_conf_socket_buffer_min,
+                },
+                {
+                    .key = "SocketBufferMax",
+                    .get_value = _ConfigKeyGetInt,
+                    .user_cb = (_ConfigKeyUser*)_ConfigKeySetInt,
+                    .user_ctxt = &g_conf_socket_buffer_max,
+                },
+                {
+                    .key = "EpollDispatch",
+                    .get_value = _ConfigKeyGetBool,
+                    .user_cb = (_ConfigKeyUser*)_ConfigKeySetBool,
+                    .user_ctxt = &g_conf_epoll_dispatch,
+                },
+                {
+                    .key = "ResumeTimeout",
+                    .get_value = _ConfigKeyGetInt,
+                    .user_cb = (_ConfigKeyUser*)_ConfigKeySetInt,
+                    .user_ctxt = &g_conf_resume_timeout_sec,
+                },
+                {
+                    .key = "IoThreads",
+                    .get_value = _ConfigKeyGetInt,
+                    .user_cb = (_ConfigKeyUser*)_ConfigKeySetInt,
+                    .user_ctxt = &g_conf_io_threads,
+                },
                 { NULL }
             }
         },
@@ -185,6 +239,18 @@ static _ConfigDOM conf_file_dom = {
                     .user_cb = (_ConfigKeyUser*)_ConfigKeyProcessWatchdogFailureMode,
                     .user_ctxt = &g_conf_watchdog_failure_mode,
                 },
+                {
+                    .key = "ProbeInterval",
+                    .get_value = _ConfigKeyGetInt,
+                    .user_cb = (_ConfigKeyUser*)_ConfigKeySetInt,
+                    .user_ctxt = &g_conf_watchdog_probe_interval_ms,
+                },
+                {
+                    .key = "StallThreshold",
+                    .get_value = _ConfigKeyGetInt,
+                    .user_cb = (_ConfigKeyUser*)_ConfigKeySetInt,
+                    .user_ctxt = &g_conf_watchdog_stall_threshold_ms,
+                },
                 { NULL }
             }
         },
@@ -197,6 +263,12 @@ static _ConfigDOM conf_file_dom = {
                     .user_cb = (_ConfigKeyUser*)_ConfigKeyProcessDynamicServiceExecPrefix,
                     .user_ctxt = &g_conf_dynamic_service_exec_prefix,
                 },
+                {
+                    .key = "ScanCache",
+                    .get_value = _ConfigKeyGetString,
+                    .user_cb = (_ConfigKeyUser*)_ConfigKeyProcessScanCache,
+                    .user_ctxt = &g_conf_service_scan_cache,
+                },
                 {
                     .key = "Directories",
                     .get_value = _ConfigKeyGetStringList,
@@ -209,6 +281,30 @@ static _ConfigDOM conf_file_dom = {
                     .user_cb = (_ConfigKeyUser*)_ConfigKeySetInt,
                     .user_ctxt = &g_conf_query_name_timeout_ms,
                 },
+                {
+                    .key = "WarmDemand",
+                    .get_value = _ConfigKeyGetInt,
+                    .user_cb = (_ConfigKeyUser*)_ConfigKeySetInt,
+                    .user_ctxt = &g_conf_warm_demand,
+                },
+                {
+                    .key = "WarmDemandWindow",
+                    .get_value = _ConfigKeyGetInt,
+                    .user_cb = (_ConfigKeyUser*)_ConfigKeySetInt,
+                    .user_ctxt = &g_conf_warm_demand_window_sec,
+                },
+                {
+                    .key = "WarmMinLifetime",
+                    .get_value = _ConfigKeyGetInt,
+                    .user_cb = (_ConfigKeyUser*)_ConfigKeySetInt,
+                    .user_ctxt = &g_conf_warm_min_lifetime_sec,
+                },
+                {
+                    .key = "WarmRelaunchDelay",
+                    .get_value = _ConfigKeyGetInt,
+                    .user_cb = (_ConfigKeyUser*)_ConfigKeySetInt,
+                    .user_ctxt = &g_conf_warm_relaunch_delay_sec,
+                },
                 { NULL }
             }
         },
@@ -257,12 +353,18 @@ static _ConfigDOM conf_file_dom = {
                     .user_cb = (_ConfigKeyUser*)_ConfigKeySetBool,
                     .user_ctxt = &g_conf_allow_null_outbound_by_default,
                 },
+                {
+                    .key = "ScanCache",
+                    .get_value = _ConfigKeyGetString,
+                    .user_cb = (_ConfigKeyUser*)_ConfigKeyProcessScanCache,
+                    .user_ctxt = &g_conf_role_scan_cache,
+                },
                 {
                     /* Keep this after the others since it depends on the
                      * other settings to be set */
                     .key = "Directories",
                     .get_value = _ConfigKeyGetStringList,
-                    .user_cb = (_ConfigKeyUser*) ProcessRoleDirectories,
+                    .user_cb = (_ConfigKeyUser*)_ConfigKeyProcessRoleDirs,
                     .user_ctxt = NULL,
                 },
                 { NULL }
@@ -275,17 +377,36 @@ static _ConfigDOM conf_file_dom = {
 /* config globals */
 int g_conf_watchdog_timeout_sec = 60;               /**< watchdog timeout in seconds */
 LSHubWatchdogFailureMode g_conf_watchdog_failure_mode = LSHubWatchdogFailureModeNoop;   /**< behavior of watchdog when it detects a failure */
+int g_conf_watchdog_probe_interval_ms = 200;        /**< mainloop latency probe interval in ms (0 to disable) */
+int g_conf_watchdog_stall_threshold_ms = 0;         /**< log mainloop stalls longer than this in ms (0 to disable) */
 
 int g_conf_query_name_timeout_ms = 20000;      /**< timeout in ms for a "QueryName" message */
+int g_conf_warm_demand = 5;                     /**< QueryNames per window that keep a dynamic service
+                                                     warm (0 to only honor "KeepWarm") */
+int g_conf_warm_demand_window_sec = 10 * 60;    /**< length of a dynamic service demand window */
+int g_conf_warm_min_lifetime_sec = 5;           /**< warm services that exit sooner than this
+                                                     after launch are not relaunched */
+int g_conf_warm_relaunch_delay_sec = 2;         /**< delay before relaunching a warm service */
 bool g_conf_security_enabled = true;           /**< enable/disable security checks */
 bool g_conf_log_service_status = false;         /**< enable service status logging */
 char *g_conf_dynamic_service_exec_prefix = NULL; /**< prefix added to Exec in service file
                                                       when launching dynamic service */
 int g_conf_connect_timeout_ms = 20000;           /**< timeout in ms for connect() to complete */
+bool g_conf_socket_pair_handoff = false;        /**< connect local clients with socketpair() instead of connect() */
+int g_conf_socket_buffer_min = 0;               /**< smallest client socket buffer in bytes (0 to not autotune) */
+int g_conf_socket_buffer_max = 0;               /**< largest client socket buffer in bytes */
+bool g_conf_epoll_dispatch = false;             /**< dispatch all client fds from one epoll fd */
+int g_conf_resume_timeout_sec = 0;              /**< how long clients of a previous hub can resume
+                                                     their registrations (0 to disable) */
+int g_conf_io_threads = 0;                      /**< threads that client connections are spread over
+                                                     (0 to do all I/O on the main thread) */
 char *g_conf_monitor_exe_path = NULL;           /**< path to ls-monitor */
 char *g_conf_sysmgr_exe_path = NULL;            /**< path to LunaSysMgr */
 char *g_conf_triton_service_exe_path = NULL;    /**< special "path" for triton services */
 char *g_conf_mojo_app_exe_path = NULL;          /**< special "path" for mojo apps */
+char *g_conf_service_scan_cache = NULL;         /**< where parsed service files are kept between
+                                                     hub runs (NULL for nowhere) */
+char *g_conf_role_scan_cache = NULL;            /**< same for role files */
 bool g_conf_mojo_apps_allow_all_outbound_by_default = false; /**< whether to allow mojo apps "*" outbound permissions by default */
 bool g_conf_allow_null_outbound_by_default = false; /**< whether to allow connections with "NULL" service names "*" outbound permissions by default */
 char *g_conf_pid_dir = NULL;                    /**< PID file directory */
@@ -298,6 +419,20 @@ static char *config_file_name = NULL;   /**< filename only */
 #ifdef HAVE_SYS_INOTIFY_H
 static int inotify_watch_id = -1;
 static int inotify_conf_file_wd = -1;
+static int inotify_fd = -1;                 /**< shared by all the watches */
+
+/**
+ * A watched role and/or service directory
+ */
+typedef struct _ConfigWatchedDir {
+    char *path;
+    bool has_roles;         /**< listed in [Security] Directories */
+    bool has_services;      /**< listed in [Dynamic Services] Directories */
+} _ConfigWatchedDir;
+
+static GHashTable *inotify_dir_wds = NULL;  /**< wd --> _ConfigWatchedDir */
+static char **watched_role_dirs = NULL;     /**< last [Security] Directories */
+static char **watched_service_dirs = NULL;  /**< last [Dynamic Services] Directories */
 #endif
 
 static int config_reload_pipe[2] = {-1, -1};    /**< used for alerting mainloop
@@ -346,7 +481,9 @@ ConfigInotifyCallback(GIOChannel *channel, GIOCondition condition, gpointer data
     struct inotify_event *event = NULL;
 
     gsize bytes_read;
-    gchar event_buf[256];
+    gchar event_buf[INOTIFY_EVENT_BUF_SIZE];
+    bool roles_changed = false;
+    bool services_changed = false;
 
     GIOStatus status = g_io_channel_read_chars(channel, event_buf, sizeof(event_buf), &bytes_read, &error);
 
@@ -376,11 +513,165 @@ ConfigInotifyCallback(GIOChannel *channel, GIOCondition condition, gpointer data
                 g_critical("Error sending SIGHUP: %d", errno);
             }
         }
+
+        if (event->mask & IN_Q_OVERFLOW)
+        {
+            /* we've lost track of the role and service dirs, so fall back
+             * to a full rescan */
+            g_critical("inotify queue overflow; rescanning all directories");
+            if (kill(getpid(), SIGHUP) != 0)
+            {
+                g_critical("Error sending SIGHUP: %d", errno);
+            }
+        }
+        else if (inotify_dir_wds)
+        {
+            _ConfigWatchedDir *watched_dir = g_hash_table_lookup(inotify_dir_wds, GINT_TO_POINTER(event->wd));
+
+            if (watched_dir && (event->mask & IN_IGNORED))
+            {
+                /* directory was removed (or unmounted) */
+                g_hash_table_remove(inotify_dir_wds, GINT_TO_POINTER(event->wd));
+            }
+            else if (watched_dir && (event->mask & INOTIFY_DIR_MASK) && event->len > 0)
+            {
+                /* apply just this file's change */
+                if (watched_dir->has_roles && LSHubRoleFileUpdate(watched_dir->path, event->name))
+                {
+                    roles_changed = true;
+                }
+
+                if (watched_dir->has_services && ServiceFileUpdate(watched_dir->path, event->name))
+                {
+                    services_changed = true;
+                }
+            }
+        }
+
         offset += sizeof(struct inotify_event) + event->len;
     }
 
+    if (services_changed)
+    {
+        DynamicServiceWarmStart();
+    }
+
+    if (roles_changed || services_changed)
+    {
+        (void)LSHubSendConfScanCompleteSignal();
+    }
+
     return TRUE;    /* FALSE means remove */
 }
+
+static void
+_ConfigWatchedDirFree(_ConfigWatchedDir *watched_dir)
+{
+    g_free(watched_dir->path);
+
+#ifdef MEMCHECK
+    memset(watched_dir, 0xFF, sizeof(_ConfigWatchedDir));
+#endif
+
+    g_slice_free(_ConfigWatchedDir, watched_dir);
+}
+
+static void
+_ConfigWatchDir(GHashTable *wds, const char *path, bool roles)
+{
+    /* IN_MASK_ADD so we don't clobber the config file watch if it happens
+     * to be on the same directory */
+    int wd = inotify_add_watch(inotify_fd, path, INOTIFY_DIR_MASK | IN_MASK_ADD);
+
+    if (wd < 0)
+    {
+        g_critical("Unable to watch directory \"%s\": %s", path, g_strerror(errno));
+        return;
+    }
+
+    /* several paths can lead to the same directory (and wd) */
+    _ConfigWatchedDir *watched_dir = g_hash_table_lookup(wds, GINT_TO_POINTER(wd));
+
+    if (!watched_dir)
+    {
+        watched_dir = g_slice_new0(_ConfigWatchedDir);
+        watched_dir->path = g_strdup(path);
+        g_hash_table_insert(wds, GINT_TO_POINTER(wd), watched_dir);
+    }
+
+    if (roles)
+    {
+        watched_dir->has_roles = true;
+    }
+    else
+    {
+        watched_dir->has_services = true;
+    }
+}
+
+/** 
+ *******************************************************************************
+ * @brief Point the inotify watches at the currently configured role and
+ * service directories, so that changes to the files in them can be applied
+ * one at a time instead of with a full rescan.
+ *******************************************************************************
+ */
+static void
+_ConfigUpdateDirWatches(void)
+{
+    char **cur_dir = NULL;
+
+    if (inotify_fd == -1)
+    {
+        /* not set up yet; ConfigSetupInotify() calls us again */
+        return;
+    }
+
+    GHashTable *wds = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                                            (GDestroyNotify)_ConfigWatchedDirFree);
+
+    for (cur_dir = watched_role_dirs; cur_dir && *cur_dir; cur_dir++)
+    {
+        _ConfigWatchDir(wds, *cur_dir, true);
+    }
+
+    for (cur_dir = watched_service_dirs; cur_dir && *cur_dir; cur_dir++)
+    {
+        _ConfigWatchDir(wds, *cur_dir, false);
+    }
+
+    /* stop watching directories that are no longer configured */
+    if (inotify_dir_wds)
+    {
+        GHashTableIter iter;
+        gpointer key = NULL;
+
+        g_hash_table_iter_init(&iter, inotify_dir_wds);
+
+        while (g_hash_table_iter_next(&iter, &key, NULL))
+        {
+            int wd = GPOINTER_TO_INT(key);
+
+            if (!g_hash_table_lookup(wds, key) && wd != inotify_conf_file_wd)
+            {
+                inotify_rm_watch(inotify_fd, wd);
+            }
+        }
+
+        g_hash_table_destroy(inotify_dir_wds);
+    }
+
+    inotify_dir_wds = wds;
+}
+
+static void
+_ConfigSetWatchedDirs(char ***watched_dirs, const char **dirs)
+{
+    g_strfreev(*watched_dirs);
+    *watched_dirs = g_strdupv((char**)dirs);
+
+    _ConfigUpdateDirWatches();
+}
 #endif
 
 /** 
@@ -472,7 +763,6 @@ _ConfigCreateBinaryChannel(int fd, LSError *lserror)
 bool
 ConfigSetupInotify(const char* conf_file, LSError *lserror)
 {
-    int inotify_fd = -1;
     GIOChannel *config_reload_channel = NULL;
     GIOChannel *inotify_channel = NULL;
 
@@ -536,15 +826,21 @@ ConfigSetupInotify(const char* conf_file, LSError *lserror)
     
     g_io_channel_unref(inotify_channel);
 
+    /* the config file has already been parsed, so we know the directories */
+    _ConfigUpdateDirWatches();
+
 #endif  /* HAVE_SYS_INOTIFY_H */
 
     return true;
 
 error:
+#ifdef HAVE_SYS_INOTIFY_H
     if (inotify_fd != -1) 
     {
         close(inotify_fd);
+        inotify_fd = -1;
     }
+#endif
 
     if (config_reload_channel)
     {
@@ -746,6 +1042,18 @@ _ConfigFreeSettings(void)
         g_free(g_conf_mojo_app_exe_path);
     }
     g_conf_mojo_app_exe_path = NULL;
+
+    if (g_conf_service_scan_cache)
+    {
+        g_free(g_conf_service_scan_cache);
+    }
+    g_conf_service_scan_cache = NULL;
+
+    if (g_conf_role_scan_cache)
+    {
+        g_free(g_conf_role_scan_cache);
+    }
+    g_conf_role_scan_cache = NULL;
 }
 
 static bool
@@ -762,6 +1070,19 @@ _ConfigKeyProcessDynamicServiceExecPrefix(char *value, const char **conf_var, LS
     return _ConfigKeySetString(value, conf_var, lserror);
 }
 
+static bool
+_ConfigKeyProcessScanCache(char *value, const char **conf_var, LSError *lserror)
+{
+    /* empty means don't keep one */
+    if (value && value[0] == '\0')
+    {
+        g_free(value);
+        value = NULL;
+    }
+
+    return _ConfigKeySetString(value, conf_var, lserror);
+}
+
 /** 
  *******************************************************************************
  * @brief Set the watchdog failure mode.
@@ -809,7 +1130,7 @@ _ConfigKeyProcessDynamicServiceDirs(const char **dirs, void *ctxt, LSError *lser
 
     const char **cur_dir = NULL;
 
-    if (!ServiceInitMap(lserror))
+    if (!ServiceInitMap(dirs, lserror))
     {
         return false;
     }
@@ -823,6 +1144,40 @@ _ConfigKeyProcessDynamicServiceDirs(const char **dirs, void *ctxt, LSError *lser
         }
     }
 
+    ServiceFinishMap();
+    DynamicServiceWarmStart();
+
+#ifdef HAVE_SYS_INOTIFY_H
+    _ConfigSetWatchedDirs(&watched_service_dirs, dirs);
+#endif
+
+    return true;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Parse all role directories and load the role and permission maps.
+ * 
+ * @param  *dirs    IN  array of directories 
+ * @param  ctxt     IN  unused 
+ * @param  lserror  OUT set on error 
+ * 
+ * @retval  true on success
+ * @retval  false on failure
+ *******************************************************************************
+ */
+static bool
+_ConfigKeyProcessRoleDirs(const char **dirs, void *ctxt, LSError *lserror)
+{
+    if (!ProcessRoleDirectories(dirs, ctxt, lserror))
+    {
+        return false;
+    }
+
+#ifdef HAVE_SYS_INOTIFY_H
+    _ConfigSetWatchedDirs(&watched_role_dirs, dirs);
+#endif
+
     return true;
 }
 
@@ -1011,6 +1366,15 @@ ConfigCleanup(GIOChannel *inotify_channel)
     g_free(config_file_name);
 
     _ConfigFreeSettings();
+
+#ifdef HAVE_SYS_INOTIFY_H
+    if (inotify_dir_wds) g_hash_table_destroy(inotify_dir_wds);
+    inotify_dir_wds = NULL;
+    g_strfreev(watched_role_dirs);
+    watched_role_dirs = NULL;
+    g_strfreev(watched_service_dirs);
+    watched_service_dirs = NULL;
+#endif
     
     /* inotify fd and read end of pipe fd are closed when the channel
      * is unref'd (in this case when watch is destroyed) */
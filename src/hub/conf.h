@@ -31,15 +31,29 @@ bool ConfigSetupInotify(const char* conf_file, LSError *lserror);
 
 extern int g_conf_watchdog_timeout_sec;
 extern LSHubWatchdogFailureMode g_conf_watchdog_failure_mode;
+extern int g_conf_watchdog_probe_interval_ms;
+extern int g_conf_watchdog_stall_threshold_ms;
 extern int g_conf_query_name_timeout_ms;
+extern int g_conf_warm_demand;
+extern int g_conf_warm_demand_window_sec;
+extern int g_conf_warm_min_lifetime_sec;
+extern int g_conf_warm_relaunch_delay_sec;
 extern char* g_conf_dynamic_service_exec_prefix;
 extern bool g_conf_security_enabled;
 extern bool g_conf_log_service_status;
 extern int g_conf_connect_timeout_ms;
+extern bool g_conf_socket_pair_handoff;
+extern int g_conf_socket_buffer_min;
+extern int g_conf_socket_buffer_max;
+extern bool g_conf_epoll_dispatch;
+extern int g_conf_resume_timeout_sec;
+extern int g_conf_io_threads;
 extern char* g_conf_monitor_exe_path;
 extern char* g_conf_sysmgr_exe_path;
 extern char* g_conf_triton_service_exe_path;
 extern char* g_conf_mojo_app_exe_path;
+extern char* g_conf_service_scan_cache;
+extern char* g_conf_role_scan_cache;
 extern bool g_conf_mojo_apps_allow_all_outbound_by_default;
 extern bool g_conf_allow_null_outbound_by_default;
 extern char *g_conf_pid_dir;
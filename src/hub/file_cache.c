@@ -0,0 +1,840 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2008-2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "error.h"
+#include "transport_utils.h"
+#include "file_cache.h"
+
+/**
+ * Remembers what was parsed out of each file in the role and service
+ * directories so that a rescan only has to re-parse the files that changed.
+ * Parsing happens at boot and on every SIGHUP / conf reload, and the hub
+ * isn't servicing clients while it does it.
+ *
+ * With a snapshot path set (see @ref LSHubFileCacheSetSnapshot) the cache is
+ * also written to disk shortly after it changes and mmap'd back in by the
+ * first scan after the hub starts, so that boot only parses the files
+ * that changed since. The snapshot is binary, in host byte order:
+ *
+ * @code
+ * "LS2SCAN\0" version:u32
+ * count:u32 { dir:string stamp }...                (directories scanned)
+ * count:u32 { path:string tag:string stamp len:u32 data[len] }...
+ *
+ * string = len:u32 bytes[len] '\0' (len 0xFFFFFFFF for NULL)
+ * stamp = dev ino size mtime_sec mtime_nsec ctime_sec ctime_nsec, each u64
+ * @endcode
+ *
+ * data is whatever the cache's LSHubFileCacheSaveFunc wrote. A snapshot is
+ * only used if it lists the same directories and none of them changed
+ * since (i.e., no file was added, removed or renamed); files changed in
+ * place are caught by their own stamps. Since roles are in there, a
+ * snapshot that isn't ours or is writable by others is ignored.
+ */
+struct LSHubFileCache
+{
+    GHashTable *entries;        /**< full path --> _LSHubFileCacheEntry */
+    GDestroyNotify data_free;
+    guint generation;           /**< bumped at the start of each scan */
+    bool scanning;              /**< between ScanBegin and ScanEnd */
+
+    char *snapshot_path;        /**< where the cache is saved (NULL for nowhere) */
+    char **snapshot_dirs;       /**< directories it's for */
+    LSHubFileCacheSaveFunc save;
+    LSHubFileCacheLoadFunc load;
+    bool dirty;                 /**< changed since the snapshot was written */
+    guint save_source;          /**< pending _LSHubFileCacheSaveTimeout */
+};
+
+/** Delay before writing a changed cache, so a scan or a burst of file
+ * changes is one write (and boot itself doesn't wait for it) */
+#define FILE_CACHE_SAVE_DELAY_MS    1000
+
+#define FILE_SNAPSHOT_MAGIC         "LS2SCAN"
+#define FILE_SNAPSHOT_MAGIC_LEN     8           /**< including the nul */
+#define FILE_SNAPSHOT_VERSION       1
+#define FILE_RECORD_NULL_STRING     0xFFFFFFFF
+
+typedef struct _LSHubFileCacheEntry
+{
+    LSHubFileStamp stamp;
+    char *tag;                  /**< extra input the parse depended on */
+    gpointer data;
+    guint generation;           /**< last scan that saw this file */
+    GDestroyNotify data_free;
+} _LSHubFileCacheEntry;
+
+static void _LSHubFileCacheChanged(LSHubFileCache *cache);
+static bool _LSHubFileCacheLoad(LSHubFileCache *cache, LSError *lserror);
+
+static void
+_LSHubFileCacheEntryFree(_LSHubFileCacheEntry *entry)
+{
+    LS_ASSERT(entry != NULL);
+
+    if (entry->data && entry->data_free) entry->data_free(entry->data);
+    g_free(entry->tag);
+
+#ifdef MEMCHECK
+    memset(entry, 0xFF, sizeof(_LSHubFileCacheEntry));
+#endif
+
+    g_slice_free(_LSHubFileCacheEntry, entry);
+}
+
+/**
+ *******************************************************************************
+ * @brief Allocate a new file cache.
+ *
+ * @param  data_free    IN  called on cached data when an entry is dropped
+ *
+ * @retval  cache on success
+ * @retval  NULL on failure
+ *******************************************************************************
+ */
+LSHubFileCache*
+LSHubFileCacheNew(GDestroyNotify data_free)
+{
+    LSHubFileCache *cache = g_slice_new0(LSHubFileCache);
+
+    if (cache)
+    {
+        cache->data_free = data_free;
+        cache->entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                               (GDestroyNotify)_LSHubFileCacheEntryFree);
+    }
+
+    return cache;
+}
+
+void
+LSHubFileCacheFree(LSHubFileCache *cache)
+{
+    LS_ASSERT(cache != NULL);
+
+    if (cache->save_source) g_source_remove(cache->save_source);
+
+    g_hash_table_destroy(cache->entries);
+    g_free(cache->snapshot_path);
+    g_strfreev(cache->snapshot_dirs);
+
+#ifdef MEMCHECK
+    memset(cache, 0xFF, sizeof(LSHubFileCache));
+#endif
+
+    g_slice_free(LSHubFileCache, cache);
+}
+
+/**
+ *******************************************************************************
+ * @brief Stat a file into a stamp. On failure the stamp is zeroed, which
+ * never matches a real file.
+ *
+ * @param  path     IN  file path
+ * @param  stamp    OUT stamp
+ *
+ * @retval  true on success
+ * @retval  false on failure
+ *******************************************************************************
+ */
+bool
+LSHubFileStampGet(const char *path, LSHubFileStamp *stamp)
+{
+    struct stat st;
+
+    memset(stamp, 0, sizeof(*stamp));
+
+    if (stat(path, &st) != 0)
+    {
+        return false;
+    }
+
+    stamp->dev = st.st_dev;
+    stamp->ino = st.st_ino;
+    stamp->size = st.st_size;
+    stamp->mtime_sec = st.st_mtim.tv_sec;
+    stamp->mtime_nsec = st.st_mtim.tv_nsec;
+    stamp->ctime_sec = st.st_ctim.tv_sec;
+    stamp->ctime_nsec = st.st_ctim.tv_nsec;
+
+    return true;
+}
+
+static bool
+_LSHubFileStampEqual(const LSHubFileStamp *a, const LSHubFileStamp *b)
+{
+    return a->ino != 0 &&
+           a->dev == b->dev &&
+           a->ino == b->ino &&
+           a->size == b->size &&
+           a->mtime_sec == b->mtime_sec &&
+           a->mtime_nsec == b->mtime_nsec &&
+           a->ctime_sec == b->ctime_sec &&
+           a->ctime_nsec == b->ctime_nsec;
+}
+
+/**
+ *******************************************************************************
+ * @brief Look up what was last parsed out of a file. The file is stat'ed
+ * and the cached data is only returned if the file hasn't changed since
+ * and was parsed with the same tag. A hit marks the entry as seen by the
+ * current scan.
+ *
+ * @param  cache    IN  cache
+ * @param  path     IN  full path to file
+ * @param  tag      IN  extra parse input (e.g., a conf value), may be NULL
+ * @param  stamp    OUT current stamp of the file, to pass to @ref
+ *                      LSHubFileCacheStore on a miss
+ *
+ * @retval  cached data on hit
+ * @retval  NULL on miss
+ *******************************************************************************
+ */
+gpointer
+LSHubFileCacheLookup(LSHubFileCache *cache, const char *path, const char *tag, LSHubFileStamp *stamp)
+{
+    LS_ASSERT(cache != NULL);
+    LS_ASSERT(path != NULL);
+    LS_ASSERT(stamp != NULL);
+
+    LSHubFileStampGet(path, stamp);
+
+    _LSHubFileCacheEntry *entry = g_hash_table_lookup(cache->entries, path);
+
+    if (!entry)
+    {
+        return NULL;
+    }
+
+    /* a stale entry stays until it's replaced or the scan ends, so its
+     * data can still be undone with LSHubFileCacheGet() */
+    if (!_LSHubFileStampEqual(&entry->stamp, stamp) || g_strcmp0(entry->tag, tag) != 0)
+    {
+        return NULL;
+    }
+
+    entry->generation = cache->generation;
+
+    return entry->data;
+}
+
+/**
+ *******************************************************************************
+ * @brief Get what was last parsed out of a file, whether or not the file
+ * has changed since.
+ *
+ * @param  cache    IN  cache
+ * @param  path     IN  full path to file
+ *
+ * @retval  cached data if there is any
+ * @retval  NULL otherwise
+ *******************************************************************************
+ */
+gpointer
+LSHubFileCacheGet(LSHubFileCache *cache, const char *path)
+{
+    LS_ASSERT(cache != NULL);
+    LS_ASSERT(path != NULL);
+
+    _LSHubFileCacheEntry *entry = g_hash_table_lookup(cache->entries, path);
+
+    return entry ? entry->data : NULL;
+}
+
+static void
+_LSHubFileCacheInsert(LSHubFileCache *cache, const char *path, const char *tag, const LSHubFileStamp *stamp, gpointer data)
+{
+    _LSHubFileCacheEntry *entry = g_slice_new0(_LSHubFileCacheEntry);
+
+    entry->stamp = *stamp;
+    entry->tag = g_strdup(tag);
+    entry->data = data;
+    entry->generation = cache->generation;
+    entry->data_free = cache->data_free;
+
+    g_hash_table_replace(cache->entries, g_strdup(path), entry);
+}
+
+/**
+ *******************************************************************************
+ * @brief Remember what was parsed out of a file. The cache takes ownership
+ * of data.
+ *
+ * The stamp must be the one taken before the file was read (i.e., from
+ * @ref LSHubFileCacheLookup), so that a write racing with the parse shows
+ * up as a change on the next scan.
+ *
+ * @param  cache    IN  cache
+ * @param  path     IN  full path to file
+ * @param  tag      IN  extra parse input, may be NULL
+ * @param  stamp    IN  stamp of the file before it was parsed
+ * @param  data     IN  parsed data (may be NULL to remember a bad file)
+ *******************************************************************************
+ */
+void
+LSHubFileCacheStore(LSHubFileCache *cache, const char *path, const char *tag, const LSHubFileStamp *stamp, gpointer data)
+{
+    LS_ASSERT(cache != NULL);
+    LS_ASSERT(path != NULL);
+    LS_ASSERT(stamp != NULL);
+
+    _LSHubFileCacheInsert(cache, path, tag, stamp, data);
+    _LSHubFileCacheChanged(cache);
+}
+
+/**
+ *******************************************************************************
+ * @brief Forget a file (e.g., it was deleted).
+ *
+ * @param  cache    IN  cache
+ * @param  path     IN  full path to file
+ *******************************************************************************
+ */
+void
+LSHubFileCacheRemove(LSHubFileCache *cache, const char *path)
+{
+    LS_ASSERT(cache != NULL);
+
+    if (g_hash_table_remove(cache->entries, path))
+    {
+        _LSHubFileCacheChanged(cache);
+    }
+}
+
+/**
+ *******************************************************************************
+ * @brief Start a full rescan of the directories backing this cache. The
+ * first scan loads the snapshot, if there is a usable one.
+ *
+ * @param  cache    IN  cache
+ *******************************************************************************
+ */
+void
+LSHubFileCacheScanBegin(LSHubFileCache *cache)
+{
+    LS_ASSERT(cache != NULL);
+
+    if (cache->snapshot_path && g_hash_table_size(cache->entries) == 0)
+    {
+        LSError lserror;
+        LSErrorInit(&lserror);
+
+        if (_LSHubFileCacheLoad(cache, &lserror))
+        {
+            _ls_verbose("%s: %u files from \"%s\"\n", __func__,
+                        g_hash_table_size(cache->entries), cache->snapshot_path);
+        }
+        else
+        {
+            _ls_verbose("%s: %s\n", __func__, lserror.message);
+            LSErrorFree(&lserror);
+        }
+    }
+
+    cache->generation++;
+    cache->scanning = true;
+}
+
+/**
+ *******************************************************************************
+ * @brief Finish a full rescan, dropping entries for files that the scan
+ * didn't see.
+ *
+ * @param  cache    IN  cache
+ *******************************************************************************
+ */
+void
+LSHubFileCacheScanEnd(LSHubFileCache *cache)
+{
+    LS_ASSERT(cache != NULL);
+
+    GHashTableIter iter;
+    gpointer value = NULL;
+
+    g_hash_table_iter_init(&iter, cache->entries);
+
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+    {
+        _LSHubFileCacheEntry *entry = value;
+
+        if (entry->generation != cache->generation)
+        {
+            g_hash_table_iter_remove(&iter);
+            cache->dirty = true;
+        }
+    }
+
+    cache->scanning = false;
+
+    if (cache->dirty)
+    {
+        _LSHubFileCacheChanged(cache);
+    }
+}
+
+/**
+ *******************************************************************************
+ * @brief Set where the cache is saved between hub runs. Takes effect for
+ * the next scan; the first scan after the hub starts loads the snapshot.
+ *
+ * @param  cache    IN  cache
+ * @param  path     IN  snapshot file (NULL to not save the cache)
+ * @param  dirs     IN  NULL-terminated list of directories the cached files
+ *                      come from
+ * @param  save     IN  writes one file's data to the snapshot
+ * @param  load     IN  reads one file's data from the snapshot
+ *******************************************************************************
+ */
+void
+LSHubFileCacheSetSnapshot(LSHubFileCache *cache, const char *path, const char **dirs,
+                          LSHubFileCacheSaveFunc save, LSHubFileCacheLoadFunc load)
+{
+    LS_ASSERT(cache != NULL);
+    LS_ASSERT(dirs != NULL);
+
+    if (g_strcmp0(path, cache->snapshot_path) != 0)
+    {
+        /* write it where it's expected now */
+        cache->dirty = true;
+    }
+
+    g_free(cache->snapshot_path);
+    g_strfreev(cache->snapshot_dirs);
+
+    cache->snapshot_path = g_strdup(path);
+    cache->snapshot_dirs = g_strdupv((char**)dirs);
+    cache->save = save;
+    cache->load = load;
+}
+
+void
+LSHubFileRecordPutUint32(GByteArray *out, guint32 value)
+{
+    g_byte_array_append(out, (const guint8*)&value, sizeof(value));
+}
+
+void
+LSHubFileRecordPutString(GByteArray *out, const char *str)
+{
+    if (!str)
+    {
+        LSHubFileRecordPutUint32(out, FILE_RECORD_NULL_STRING);
+        return;
+    }
+
+    guint32 len = strlen(str);
+
+    LSHubFileRecordPutUint32(out, len);
+    g_byte_array_append(out, (const guint8*)str, len + 1);
+}
+
+bool
+LSHubFileRecordGetUint32(LSHubFileRecord *record, guint32 *value)
+{
+    if ((size_t)(record->end - record->pos) < sizeof(*value))
+    {
+        return false;
+    }
+
+    memcpy(value, record->pos, sizeof(*value));
+    record->pos += sizeof(*value);
+
+    return true;
+}
+
+/**
+ *******************************************************************************
+ * @brief Read a string written by @ref LSHubFileRecordPutString.
+ *
+ * @param  record   IN/OUT  record
+ * @param  str      OUT     string (or NULL), pointing into the snapshot, so
+ *                          only valid during the LSHubFileCacheLoadFunc
+ *
+ * @retval  true on success
+ * @retval  false if the record is malformed
+ *******************************************************************************
+ */
+bool
+LSHubFileRecordGetString(LSHubFileRecord *record, const char **str)
+{
+    guint32 len = 0;
+
+    if (!LSHubFileRecordGetUint32(record, &len))
+    {
+        return false;
+    }
+
+    if (len == FILE_RECORD_NULL_STRING)
+    {
+        *str = NULL;
+        return true;
+    }
+
+    if ((size_t)(record->end - record->pos) <= len || record->pos[len] != '\0')
+    {
+        return false;
+    }
+
+    *str = record->pos;
+    record->pos += len + 1;
+
+    return true;
+}
+
+static void
+_LSHubFileRecordPutStamp(GByteArray *out, const LSHubFileStamp *stamp)
+{
+    guint64 fields[] = {
+        stamp->dev, stamp->ino, stamp->size,
+        stamp->mtime_sec, stamp->mtime_nsec,
+        stamp->ctime_sec, stamp->ctime_nsec,
+    };
+
+    g_byte_array_append(out, (const guint8*)fields, sizeof(fields));
+}
+
+static bool
+_LSHubFileRecordGetStamp(LSHubFileRecord *record, LSHubFileStamp *stamp)
+{
+    guint64 fields[7];
+
+    if ((size_t)(record->end - record->pos) < sizeof(fields))
+    {
+        return false;
+    }
+
+    memcpy(fields, record->pos, sizeof(fields));
+    record->pos += sizeof(fields);
+
+    stamp->dev = fields[0];
+    stamp->ino = fields[1];
+    stamp->size = fields[2];
+    stamp->mtime_sec = fields[3];
+    stamp->mtime_nsec = fields[4];
+    stamp->ctime_sec = fields[5];
+    stamp->ctime_nsec = fields[6];
+
+    return true;
+}
+
+/**
+ *******************************************************************************
+ * @brief Write the cache to its snapshot file. The file is replaced
+ * atomically, so a hub that dies while writing leaves the previous snapshot
+ * behind. Files that didn't parse aren't saved, so they are tried again.
+ *
+ * @param  cache    IN  cache
+ * @param  lserror  OUT set on error
+ *
+ * @retval  true on success
+ * @retval  false on failure
+ *******************************************************************************
+ */
+static bool
+_LSHubFileCacheSave(LSHubFileCache *cache, LSError *lserror)
+{
+    GError *gerror = NULL;
+    GHashTableIter iter;
+    gpointer key = NULL;
+    gpointer value = NULL;
+    LSHubFileStamp stamp;
+    guint32 count = 0;
+    bool ret = true;
+    char **dir = NULL;
+
+    GByteArray *out = g_byte_array_new();
+
+    g_byte_array_append(out, (const guint8*)FILE_SNAPSHOT_MAGIC, FILE_SNAPSHOT_MAGIC_LEN);
+    LSHubFileRecordPutUint32(out, FILE_SNAPSHOT_VERSION);
+
+    LSHubFileRecordPutUint32(out, g_strv_length(cache->snapshot_dirs));
+
+    for (dir = cache->snapshot_dirs; *dir != NULL; dir++)
+    {
+        LSHubFileStampGet(*dir, &stamp);
+        LSHubFileRecordPutString(out, *dir);
+        _LSHubFileRecordPutStamp(out, &stamp);
+    }
+
+    /* filled in below */
+    guint count_offset = out->len;
+    LSHubFileRecordPutUint32(out, 0);
+
+    g_hash_table_iter_init(&iter, cache->entries);
+
+    while (g_hash_table_iter_next(&iter, &key, &value))
+    {
+        _LSHubFileCacheEntry *entry = value;
+
+        if (!entry->data) continue;
+
+        LSHubFileRecordPutString(out, key);
+        LSHubFileRecordPutString(out, entry->tag);
+        _LSHubFileRecordPutStamp(out, &entry->stamp);
+
+        guint len_offset = out->len;
+        LSHubFileRecordPutUint32(out, 0);
+
+        cache->save(entry->data, out);
+
+        guint32 len = out->len - len_offset - sizeof(guint32);
+        memcpy(out->data + len_offset, &len, sizeof(len));
+
+        count++;
+    }
+
+    memcpy(out->data + count_offset, &count, sizeof(count));
+
+    char *snapshot_dir = g_path_get_dirname(cache->snapshot_path);
+    (void)g_mkdir_with_parents(snapshot_dir, 0755);
+    g_free(snapshot_dir);
+
+    if (!g_file_set_contents(cache->snapshot_path, (const char*)out->data, out->len, &gerror))
+    {
+        _LSErrorSetFromGError(lserror, gerror);
+        ret = false;
+    }
+    else
+    {
+        _ls_verbose("%s: %u files to \"%s\"\n", __func__, count, cache->snapshot_path);
+    }
+
+    g_byte_array_free(out, TRUE);
+
+    return ret;
+}
+
+static gboolean
+_LSHubFileCacheSaveTimeout(gpointer data)
+{
+    LSHubFileCache *cache = data;
+    LSError lserror;
+    LSErrorInit(&lserror);
+
+    cache->save_source = 0;
+
+    if (!cache->snapshot_path || !cache->dirty)
+    {
+        return FALSE;
+    }
+
+    /* cleared first so a failed write isn't retried until the next change */
+    cache->dirty = false;
+
+    if (!_LSHubFileCacheSave(cache, &lserror))
+    {
+        LSErrorPrint(&lserror, stderr);
+        LSErrorFree(&lserror);
+    }
+
+    return FALSE;
+}
+
+/**
+ *******************************************************************************
+ * @brief Note that the cache changed and write the snapshot soon, unless a
+ * scan is running (@ref LSHubFileCacheScanEnd calls us again).
+ *
+ * @param  cache    IN  cache
+ *******************************************************************************
+ */
+static void
+_LSHubFileCacheChanged(LSHubFileCache *cache)
+{
+    cache->dirty = true;
+
+    if (cache->scanning || !cache->snapshot_path || cache->save_source)
+    {
+        return;
+    }
+
+    cache->save_source = g_timeout_add(FILE_CACHE_SAVE_DELAY_MS, _LSHubFileCacheSaveTimeout, cache);
+}
+
+static bool
+_LSHubFileSnapshotDirStampEqual(const LSHubFileStamp *a, const LSHubFileStamp *b)
+{
+    /* a directory that didn't exist then and doesn't now is unchanged */
+    if (a->ino == 0 && b->ino == 0)
+    {
+        return true;
+    }
+
+    return _LSHubFileStampEqual(a, b);
+}
+
+/**
+ *******************************************************************************
+ * @brief Fill an empty cache from its snapshot file. Nothing is loaded if
+ * the snapshot is from another version, for other directories, if any of
+ * the directories changed since it was written, or if any of it is
+ * malformed.
+ *
+ * @param  cache    IN  cache
+ * @param  lserror  OUT set on error
+ *
+ * @retval  true on success
+ * @retval  false on failure
+ *******************************************************************************
+ */
+static bool
+_LSHubFileCacheLoad(LSHubFileCache *cache, LSError *lserror)
+{
+    bool ret = false;
+    struct stat st;
+    void *map = MAP_FAILED;
+    LSHubFileRecord record;
+    LSHubFileStamp stamp;
+    LSHubFileStamp saved_stamp;
+    guint32 version = 0;
+    guint32 count = 0;
+    guint32 i = 0;
+
+    int fd = open(cache->snapshot_path, O_RDONLY);
+
+    if (fd < 0)
+    {
+        _LSErrorSetNoPrint(lserror, -1, "Unable to open \"%s\": %s", cache->snapshot_path, g_strerror(errno));
+        return false;
+    }
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != geteuid() ||
+        (st.st_mode & (S_IWGRP | S_IWOTH)))
+    {
+        _LSErrorSetNoPrint(lserror, -1, "Not using \"%s\": not a file only we can write", cache->snapshot_path);
+        goto exit;
+    }
+
+    if (st.st_size < FILE_SNAPSHOT_MAGIC_LEN)
+    {
+        _LSErrorSetNoPrint(lserror, -1, "\"%s\" is truncated", cache->snapshot_path);
+        goto exit;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (map == MAP_FAILED)
+    {
+        _LSErrorSetNoPrint(lserror, -1, "Unable to map \"%s\": %s", cache->snapshot_path, g_strerror(errno));
+        goto exit;
+    }
+
+    record.pos = map;
+    record.end = (const char*)map + st.st_size;
+
+    if (memcmp(record.pos, FILE_SNAPSHOT_MAGIC, FILE_SNAPSHOT_MAGIC_LEN) != 0)
+    {
+        _LSErrorSetNoPrint(lserror, -1, "\"%s\" isn't a snapshot", cache->snapshot_path);
+        goto exit;
+    }
+
+    record.pos += FILE_SNAPSHOT_MAGIC_LEN;
+
+    if (!LSHubFileRecordGetUint32(&record, &version) || version != FILE_SNAPSHOT_VERSION)
+    {
+        _LSErrorSetNoPrint(lserror, -1, "Unsupported snapshot version in \"%s\"", cache->snapshot_path);
+        goto exit;
+    }
+
+    /* same directories, none of which changed */
+    if (!LSHubFileRecordGetUint32(&record, &count) || count != g_strv_length(cache->snapshot_dirs))
+    {
+        _LSErrorSetNoPrint(lserror, -1, "\"%s\" is for other directories", cache->snapshot_path);
+        goto exit;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        const char *dir = NULL;
+
+        if (!LSHubFileRecordGetString(&record, &dir) ||
+            !_LSHubFileRecordGetStamp(&record, &saved_stamp) ||
+            g_strcmp0(dir, cache->snapshot_dirs[i]) != 0)
+        {
+            _LSErrorSetNoPrint(lserror, -1, "\"%s\" is for other directories", cache->snapshot_path);
+            goto exit;
+        }
+
+        LSHubFileStampGet(cache->snapshot_dirs[i], &stamp);
+
+        if (!_LSHubFileSnapshotDirStampEqual(&saved_stamp, &stamp))
+        {
+            _LSErrorSetNoPrint(lserror, -1, "\"%s\" changed since \"%s\" was written", dir, cache->snapshot_path);
+            goto exit;
+        }
+    }
+
+    if (!LSHubFileRecordGetUint32(&record, &count))
+    {
+        _LSErrorSetNoPrint(lserror, -1, "\"%s\" is truncated", cache->snapshot_path);
+        goto exit;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        const char *path = NULL;
+        const char *tag = NULL;
+        guint32 len = 0;
+
+        if (!LSHubFileRecordGetString(&record, &path) || !path ||
+            !LSHubFileRecordGetString(&record, &tag) ||
+            !_LSHubFileRecordGetStamp(&record, &saved_stamp) ||
+            !LSHubFileRecordGetUint32(&record, &len) ||
+            (size_t)(record.end - record.pos) < len)
+        {
+            _LSErrorSetNoPrint(lserror, -1, "\"%s\" is malformed", cache->snapshot_path);
+            goto exit;
+        }
+
+        LSHubFileRecord data_record = { record.pos, record.pos + len };
+        gpointer data = cache->load(&data_record);
+
+        if (!data)
+        {
+            _LSErrorSetNoPrint(lserror, -1, "\"%s\" has a malformed entry for \"%s\"", cache->snapshot_path, path);
+            goto exit;
+        }
+
+        _LSHubFileCacheInsert(cache, path, tag, &saved_stamp, data);
+
+        record.pos += len;
+    }
+
+    cache->dirty = false;
+    ret = true;
+
+exit:
+    if (!ret)
+    {
+        /* all or nothing */
+        g_hash_table_remove_all(cache->entries);
+    }
+
+    if (map != MAP_FAILED) munmap(map, st.st_size);
+    close(fd);
+
+    return ret;
+}
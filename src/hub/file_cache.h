@@ -0,0 +1,80 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2008-2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+#ifndef _FILE_CACHE_H
+#define _FILE_CACHE_H
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <glib.h>
+
+#include <luna-service2/lunaservice.h>
+
+/** Identity of a file's contents as far as stat(2) can tell */
+typedef struct LSHubFileStamp
+{
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime_sec;
+    long mtime_nsec;
+    time_t ctime_sec;
+    long ctime_nsec;
+} LSHubFileStamp;
+
+typedef struct LSHubFileCache LSHubFileCache;
+
+/** Cursor over the saved data of one file in a snapshot */
+typedef struct LSHubFileRecord
+{
+    const char *pos;
+    const char *end;
+} LSHubFileRecord;
+
+/** Appends the data parsed out of one file to a snapshot */
+typedef void (*LSHubFileCacheSaveFunc)(gconstpointer data, GByteArray *out);
+
+/** Rebuilds the data saved by a LSHubFileCacheSaveFunc (NULL if it's malformed) */
+typedef gpointer (*LSHubFileCacheLoadFunc)(LSHubFileRecord *record);
+
+LSHubFileCache* LSHubFileCacheNew(GDestroyNotify data_free);
+void LSHubFileCacheFree(LSHubFileCache *cache);
+void LSHubFileCacheSetSnapshot(LSHubFileCache *cache, const char *path, const char **dirs,
+                               LSHubFileCacheSaveFunc save, LSHubFileCacheLoadFunc load);
+
+bool LSHubFileStampGet(const char *path, LSHubFileStamp *stamp);
+
+gpointer LSHubFileCacheLookup(LSHubFileCache *cache, const char *path, const char *tag, LSHubFileStamp *stamp);
+gpointer LSHubFileCacheGet(LSHubFileCache *cache, const char *path);
+void LSHubFileCacheStore(LSHubFileCache *cache, const char *path, const char *tag, const LSHubFileStamp *stamp, gpointer data);
+void LSHubFileCacheRemove(LSHubFileCache *cache, const char *path);
+
+void LSHubFileCacheScanBegin(LSHubFileCache *cache);
+void LSHubFileCacheScanEnd(LSHubFileCache *cache);
+
+void LSHubFileRecordPutUint32(GByteArray *out, guint32 value);
+void LSHubFileRecordPutString(GByteArray *out, const char *str);
+bool LSHubFileRecordGetUint32(LSHubFileRecord *record, guint32 *value);
+bool LSHubFileRecordGetString(LSHubFileRecord *record, const char **str);
+
+#endif  /* _FILE_CACHE_H */
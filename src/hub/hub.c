@@ -29,17 +29,21 @@
 #include <sys/stat.h>
 #include <libgen.h>
 #include <glib.h>
+#include <cjson/json.h>
 
 #include "hub.h"
 #include "conf.h"
 #include "log.h"
 #include "security.h"
 #include "watchdog.h"
+#include "file_cache.h"
+#include "state.h"
 #include "transport.h"
 #include "transport_utils.h"
 #include "transport_client.h"
 #include "transport_security.h"
-#include "timersource.h"
+#include "timerwheel.h"
+#include "latency.h"
 #include "utils.h"
 
 /**
@@ -65,7 +69,12 @@
 /** private hub pid file */
 #define HUB_PRIVATE_LOCK_FILENAME       "ls-hubd.private.pid"
 
-#define MESSAGE_TIMEOUT_GRANULARITY_MS 100  /**< glib timer granularity for message timeouts */
+#define HUB_PUBLIC_STATE_FILENAME       "ls-hubd.public.state"
+#define HUB_PRIVATE_STATE_FILENAME      "ls-hubd.private.state"
+
+#define HUB_STATE_WRITE_DELAY_MS        500     /**< batches changes into one snapshot write */
+
+#define MESSAGE_TIMEOUT_GRANULARITY_MS 100  /**< timer wheel tick for message timeouts */
 
 char **pid_dir = NULL;                  /**< pid file directory */
 
@@ -103,6 +112,8 @@ static char *media_service_names[] = {
 #define SERVICE_EXEC_KEY    "Exec"          /**< key for executable path for 
                                                  service */
 #define SERVICE_TYPE_KEY    "Type"          /**< type of service (dynamic or static) */
+#define SERVICE_KEEP_WARM_KEY   "KeepWarm"  /**< keep a dynamic service running
+                                                 (relaunch it when it exits) */
 
 #define SERVICE_TYPE_DYNAMIC    "dynamic"
 #define SERVICE_TYPE_STATIC     "static"
@@ -118,6 +129,20 @@ typedef enum _DynamicServiceState {
                                                 service was launched dynamically */
 } _DynamicServiceState;
 
+/**
+ * Dynamic services are kept warm (relaunched g_conf_warm_relaunch_delay_sec
+ * after they exit, instead of on the next request) if their service file says
+ * "KeepWarm=true" or if they're asked for at least g_conf_warm_demand times
+ * over the last one to two g_conf_warm_demand_window_sec windows. Services
+ * that exit sooner than g_conf_warm_min_lifetime_sec after launch are not
+ * relaunched, so a crashing service doesn't spin.
+ */
+static inline gint64
+_DynamicServiceDemandWindowUs(void)
+{
+    return (gint64)MAX(g_conf_warm_demand_window_sec, 1) * G_USEC_PER_SEC;
+}
+
 /* TODO: make the transport a shared library, so the hub can link it in as
  * well */
 
@@ -150,10 +175,11 @@ static _ConnectedClients connected_clients;     /**< all connected clients
                                                      TODO: may want to build this 
                                                      into transport layer */
 
-static GSList *waiting_for_service = NULL;      /**< list of messages waiting for a
-                                                  service that is in the pending list;
-                                                  it's assumed that this will not
-                                                  happen very often, so we use a list */
+static GHashTable *waiting_for_service = NULL;  /**< hash of service name to list of
+                                                  QueryName messages waiting for that
+                                                  service, which is in the pending list */
+
+static _LSTimerWheel *message_timeouts = NULL;  /**< timeouts for QueryName and connect() */
 
 static GSList *waiting_for_connect = NULL;      /**< list of messages waiting for a
                                                   connect() to complete;
@@ -176,6 +202,40 @@ static GHashTable *dynamic_service_states = NULL;
  */
 static GHashTable *all_services = NULL;
 
+/**
+ * Service files parsed by previous scans: full path to _Service ptr (ref'd),
+ * tagged with the exec prefix the Exec line was built with
+ */
+static LSHubFileCache *service_file_cache = NULL;
+
+/**
+ * Snapshot of connected clients and their signal registrations, so that
+ * after a restart clients can resume with their unique names (see
+ * _LSHubResumeClient). NULL if "ResumeTimeout" is 0.
+ */
+static char *state_file_path = NULL;
+static guint state_write_source = 0;    /**< pending _LSHubStateWrite */
+
+/** clients of the previous hub instance that haven't resumed yet (or NULL) */
+static LSHubState *resumable = NULL;
+
+/**
+ * With "IoThreads", client connections are read from and written to on I/O
+ * threads. Everything they receive (and their disconnects) is handed over
+ * to the main thread through one queue, so all routing state is still only
+ * touched from the main thread and each client's messages are handled in
+ * the order they arrived.
+ */
+typedef struct _LSHubHandoff {
+    _LSTransportMessage *message;       /**< message received (ref'd), or NULL
+                                             for a disconnect */
+    _LSTransportClient *client;         /**< disconnected client (ref'd) */
+    _LSTransportDisconnectType type;    /**< disconnect reason */
+} _LSHubHandoff;
+
+static GAsyncQueue *handoff_queue = NULL;   /**< _LSHubHandoff, from the I/O threads */
+static gint handoff_scheduled = 0;          /**< 1 while a drain of handoff_queue is pending */
+
 // NOTE: All connected nodes are available in the clients hash in transport
 
 
@@ -199,34 +259,73 @@ typedef struct _ClientId {
     _LocalName local;           /**< local name */
     _InetName inet;             /**< inet name */
    bool is_monitor;             /**< true if this client is the monitor */ 
+    guint64 query_names;        /**< QueryName messages from this client */
+    guint64 signals;            /**< signals from this client */
+    guint64 signal_fanout;      /**< copies of its signals that were sent out */
+    GSList *waiting;            /**< its QueryName messages that are in
+                                     waiting_for_service */
 } _ClientId;
 
-typedef struct _SignalMap {
-    GHashTable *category_map;   /**< category to _LSTransportClient list */
-    GHashTable *method_map;     /**< category/method to _LSTransportClient list */
+typedef struct _LSTransportClientList {
+    GList *list; 
+} _LSTransportClientList;
 
-    /* 
-     * TODO: fast way to go from _LSTransportClient to any categories and
-     * methods to that it has registered 
-     *
-     * this reverse lookup is so that we can quickly remove all items in the
-     * above hash table for a client that goes down
-     */
-    GHashTable *client_map;     /**< _LSTransportClient* to items (elements) in
-                                     the above hashed lists */
+typedef struct _LSTransportClientMapEntry {
+    _LSTransportClient *client;
+    int ref;
+} _LSTransportClientMapEntry;
+
+/**
+ * Set of clients registered for a signal path. Kept as an array sorted by
+ * client pointer instead of a hash table: most paths only have a handful
+ * of clients, so this is a fraction of the memory, a lookup is a binary
+ * search over contiguous entries and a signal is fanned out by walking
+ * the array.
+ */
+typedef struct _LSTransportClientMap {
+    GArray *entries;    /**< _LSTransportClientMapEntry sorted by client */
+} _LSTransportClientMap;
+
+typedef struct _SignalCategory {
+    _LSTransportClientMap *clients;     /**< clients registered for the whole
+                                             category (NULL if there are none) */
+    GHashTable *method_map;             /**< method to _LSTransportClientMap */
+} _SignalCategory;
+
+typedef struct _SignalMap {
+    GHashTable *category_map;   /**< category to _SignalCategory, which holds the
+                                     clients for the category and for each of
+                                     its methods, so a signal is routed with a
+                                     category lookup followed by a method lookup */
+
+    GHashTable *client_map;     /**< reverse lookup of _LSTransportClient* to a
+                                     hash of the _LSTransportClientMap* it is
+                                     in to its _SignalRegistration, so that a
+                                     client that goes down is removed from just
+                                     the maps that it's in */
 } _SignalMap;
 
+typedef struct _SignalRegistration {
+    char *category;     /**< category of the _LSTransportClientMap */
+    char *method;       /**< method of the _LSTransportClientMap (NULL if
+                             it's the map for the whole category) */
+} _SignalRegistration;
+
 static _SignalMap *signal_map = NULL;    /**< keeps track of signals */
 
 static _ClientId *monitor = NULL;	 /**< non-NULL when a monitor is connected */
 
-typedef struct _LSTransportClientList {
-    GList *list; 
-} _LSTransportClientList;
+/* filter the monitor asked for; passed on to clients so that they can skip
+ * mirroring what the monitor would throw away */
+static char *monitor_filter_names = NULL;       /**< comma-separated name globs */
+static int32_t monitor_filter_types = 0;        /**< LS_TRANSPORT_MONITOR_TYPE_* mask */
+static int32_t monitor_filter_sample_rate = 0;  /**< 1 in N sampling of calls */
 
-typedef struct _LSTransportClientMap {
-    GHashTable *map;
-} _LSTransportClientMap;
+/* hub statistics; see _LSHubHandleHubStats */
+static gint64 hub_start_us = 0;                 /**< when the hub started (monotonic, us) */
+static guint64 hub_signal_fanout = 0;           /**< signal copies sent to clients */
+static _LSLatencyHistogram hub_handler_time[_LSTransportMessageTypeUnknown + 1];   /**< time (us) in
+                                                     _LSHubHandleMessage by message type */
 
 typedef struct _Service {
     int ref;                    /**< ref count */
@@ -243,6 +342,11 @@ typedef struct _Service {
     bool is_dynamic;            /**< true if dynamic; false if static */
     char *service_file_dir;     /**< directory where the service file for this service lives */
     char *service_file_name;    /**< file name of the service file for this service */
+    bool keep_warm;             /**< "KeepWarm" from the service file */
+    gint64 launch_time;         /**< monotonic time of last launch (us) */
+    gint64 demand_window_start; /**< monotonic time the current demand window started (us) */
+    int demand;                 /**< QueryNames for this service in the current window */
+    int prev_demand;            /**< QueryNames for this service in the previous window */
 } _Service;              /**< struct representing a dynamic service */
 
 static void _LSHubCleanupSocketLocal(const char *unique_name);
@@ -262,10 +366,16 @@ static bool _LSHubSendServiceWaitListReply(_ClientId *id, bool success, bool is_
 static void _LSHubAddPendingConnect(_LSTransportMessage *message, _LSTransportClient *client, int fd);
 static void _LSHubAddMessageTimeout(_LSTransportMessage *message, int timeout_ms, GSourceFunc callback);
 static void _LSHubRemoveMessageTimeout(_LSTransportMessage *message);
+static void _LSHubWaitListRemove(_LSTransportMessage *message);
 static void _LSHubAddConnectMessageTimeout(_LSTransportMessage *message);
 static void _LSHubRemoveConnectMessageTimeout(_LSTransportMessage *message);
 
 bool _DynamicServiceLaunch(_Service *service, LSError *lserror);
+static void _DynamicServiceKeepWarm(const _Service *service_state);
+
+static void _LSHubStateChanged(void);
+static int32_t _LSHubResumeClient(_LSTransportClient *client, const char *service_name,
+                                  const char *resume_name, const char *resume_digest);
 
 /** 
  *******************************************************************************
@@ -658,6 +768,8 @@ _DynamicServiceReap(GPid pid, gint status, _Service *service)
     {
         /* Remove from state map since we're not running anymore */
         _DynamicServiceStateMapRemove(service);
+
+        _DynamicServiceKeepWarm(service);
     }
     
     _ServiceUnref(service);  /* ref from child_watch_add */
@@ -767,6 +879,8 @@ _DynamicServiceLaunch(_Service *service, LSError *lserror)
         goto error;
     }
 
+    service->launch_time = g_get_monotonic_time();
+
     /* set up child watch so we can reap the child */
     _ServiceRef(service);
     g_child_watch_add(service->pid, (GChildWatchFunc)_DynamicServiceReap, service);
@@ -781,6 +895,235 @@ error:
     return ret;
 }
 
+/** 
+ *******************************************************************************
+ * @brief Get the state tracked for a dynamic service, creating it if it
+ * isn't being tracked yet.
+ * 
+ * @param  service_name     IN  name of service 
+ * @param  service          IN  service from the service files providing @ref service_name 
+ * @param  lserror          OUT set on error 
+ * 
+ * @retval  service state on success
+ * @retval  NULL on failure
+ *******************************************************************************
+ */
+static _Service*
+_DynamicServiceStateGet(const char *service_name, _Service *service, LSError *lserror)
+{
+    /* Check to see if the service state is already being tracked */
+    _Service *service_state = _DynamicServiceStateMapLookup(service_name);
+
+    if (!service_state)
+    {
+        /* Create a new service state */
+        service_state = _ServiceNewRef(&service_name, 1, service->exec_path, true,
+                                       service->service_file_dir, service->service_file_name);
+        if (!service_state)
+        {
+            _LSErrorSetOOM(lserror);
+            return NULL;
+        }
+
+        if (!_DynamicServiceStateMapAdd(service_state, lserror))
+        {
+            _ServiceUnref(service_state);
+            return NULL;
+        }
+        _ServiceUnref(service_state);
+    }
+
+    return service_state;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Record that a dynamic service was asked for (used to decide
+ * whether to keep it warm).
+ * 
+ * @param  service  IN  service from the service files 
+ *******************************************************************************
+ */
+static void
+_DynamicServiceNoteDemand(_Service *service)
+{
+    gint64 now = g_get_monotonic_time();
+    gint64 window = _DynamicServiceDemandWindowUs();
+
+    if (now - service->demand_window_start >= window)
+    {
+        /* the previous window only counts if it's the one right before this one */
+        service->prev_demand = (now - service->demand_window_start < 2 * window) ? service->demand : 0;
+        service->demand = 0;
+        service->demand_window_start = now;
+    }
+
+    service->demand++;
+}
+
+static bool
+_DynamicServiceIsWarm(const _Service *service)
+{
+    if (service->keep_warm)
+    {
+        return true;
+    }
+
+    if (g_conf_warm_demand <= 0)
+    {
+        return false;
+    }
+
+    gint64 window = _DynamicServiceDemandWindowUs();
+
+    if (g_get_monotonic_time() - service->demand_window_start >= 2 * window)
+    {
+        /* nobody has asked for a while */
+        return false;
+    }
+
+    return service->demand + service->prev_demand >= g_conf_warm_demand;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Launch a dynamic service ahead of any request for it, unless it's
+ * already running or being launched.
+ * 
+ * @param  service_name     IN  name of service 
+ * @param  lserror          OUT set on error 
+ * 
+ * @retval  true on success (or if there was nothing to do)
+ * @retval  false on failure
+ *******************************************************************************
+ */
+static bool
+_DynamicServiceWarmLaunch(const char *service_name, LSError *lserror)
+{
+    _Service *service = _ServiceMapLookup(service_name);
+
+    if (!service || !service->is_dynamic)
+    {
+        /* service file went away */
+        return true;
+    }
+
+    _Service *service_state = _DynamicServiceStateMapLookup(service_name);
+
+    if (service_state && service_state->state != _DynamicServiceStateStopped)
+    {
+        return true;
+    }
+
+    if (g_hash_table_lookup(available_services, service_name) || g_hash_table_lookup(pending, service_name))
+    {
+        /* someone started it by hand */
+        return true;
+    }
+
+    _ls_verbose("%s: warm launching: \"%s\"\n", __func__, service_name);
+
+    service_state = _DynamicServiceStateGet(service_name, service, lserror);
+
+    if (!service_state)
+    {
+        return false;
+    }
+
+    return _DynamicServiceLaunch(service_state, lserror);
+}
+
+static gboolean
+_DynamicServiceWarmLaunchCallback(gpointer data)
+{
+    LSError lserror;
+    LSErrorInit(&lserror);
+
+    if (!_DynamicServiceWarmLaunch((const char*)data, &lserror))
+    {
+        LSErrorPrint(&lserror, stderr);
+        LSErrorFree(&lserror);
+    }
+
+    return FALSE;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Called when a dynamic service has stopped. Schedules a relaunch if
+ * the service should be kept warm.
+ * 
+ * @param  service_state    IN  state of the service that stopped 
+ *******************************************************************************
+ */
+static void
+_DynamicServiceKeepWarm(const _Service *service_state)
+{
+    const char *service_name = service_state->service_names[0];
+    _Service *service = _ServiceMapLookup(service_name);
+
+    if (!service || !_DynamicServiceIsWarm(service))
+    {
+        return;
+    }
+
+    gint64 lifetime = g_get_monotonic_time() - service_state->launch_time;
+
+    if (lifetime < (gint64)g_conf_warm_min_lifetime_sec * G_USEC_PER_SEC)
+    {
+        g_warning("%s: \"%s\" exited after %" G_GINT64_FORMAT " ms; not keeping it warm",
+                  __func__, service_name, lifetime / 1000);
+        return;
+    }
+
+    g_timeout_add_seconds_full(G_PRIORITY_DEFAULT_IDLE, MAX(g_conf_warm_relaunch_delay_sec, 0),
+                               _DynamicServiceWarmLaunchCallback, g_strdup(service_name), g_free);
+}
+
+static gboolean
+_DynamicServiceWarmStartCallback(gpointer data)
+{
+    GHashTableIter iter;
+    gpointer key = NULL;
+    gpointer value = NULL;
+    LSError lserror;
+    LSErrorInit(&lserror);
+
+    g_hash_table_iter_init(&iter, all_services);
+
+    while (g_hash_table_iter_next(&iter, &key, &value))
+    {
+        _Service *service = value;
+
+        /* services providing several names are launched once, by the first name */
+        if (!service->is_dynamic || !service->keep_warm || strcmp(key, service->service_names[0]) != 0)
+        {
+            continue;
+        }
+
+        if (!_DynamicServiceWarmLaunch(key, &lserror))
+        {
+            LSErrorPrint(&lserror, stderr);
+            LSErrorFree(&lserror);
+        }
+    }
+
+    return FALSE;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Launch all the "KeepWarm" dynamic services once the mainloop is
+ * running (i.e., after the service directories have been (re)scanned and the
+ * hub is accepting connections).
+ *******************************************************************************
+ */
+void
+DynamicServiceWarmStart(void)
+{
+    g_idle_add(_DynamicServiceWarmStartCallback, NULL);
+}
+
 /** 
  *******************************************************************************
  * @brief Find and launch a dynamic service given a service name.
@@ -805,20 +1148,11 @@ _DynamicServiceFindandLaunch(const char *service_name, const _LSTransportClient
     {
         LS_ASSERT(service->is_dynamic == true);
 
-        /* Check to see if the service state is already being tracked */
-        _Service *service_state = _DynamicServiceStateMapLookup(service_name);
+        _Service *service_state = _DynamicServiceStateGet(service_name, service, lserror);
 
         if (!service_state)
         {
-            /* Create a new service state */
-            service_state = _ServiceNewRef(&service_name, 1, service->exec_path, true,
-                                           service->service_file_dir, service->service_file_name);
-            if (!_DynamicServiceStateMapAdd(service_state, lserror))
-            {
-                _ServiceUnref(service_state);
-                return false;
-            }
-            _ServiceUnref(service_state);
+            return false;
         }
 
         return _DynamicServiceLaunch(service_state, lserror);
@@ -913,24 +1247,101 @@ _ServiceInitMap(GHashTable **service_map, LSError *lserror)
 
 /** 
  *******************************************************************************
- * @brief Initialize the service map that contains all services.
- * 
- * @param  lserror  OUT set on error 
- * 
- * @retval  true on success
- * @retval  false on failure
+ * @brief Write a parsed service file to the service file cache snapshot.
+ *
+ * @code
+ * count:u32 name:string... exec:string dir:string file:string
+ * is_dynamic:u32 keep_warm:u32
+ * @endcode
+ *
+ * @param  data     IN  _Service
+ * @param  out      IN  snapshot being written
  *******************************************************************************
  */
-bool
-ServiceInitMap(LSError *lserror)
+static void
+_ServiceSave(gconstpointer data, GByteArray *out)
 {
-    return _ServiceInitMap(&all_services, lserror);
+    const _Service *service = data;
+    int i = 0;
+
+    LSHubFileRecordPutUint32(out, service->num_services);
+
+    for (i = 0; i < service->num_services; i++)
+    {
+        LSHubFileRecordPutString(out, service->service_names[i]);
+    }
+
+    LSHubFileRecordPutString(out, service->exec_path);
+    LSHubFileRecordPutString(out, service->service_file_dir);
+    LSHubFileRecordPutString(out, service->service_file_name);
+    LSHubFileRecordPutUint32(out, service->is_dynamic);
+    LSHubFileRecordPutUint32(out, service->keep_warm);
 }
 
 /** 
  *******************************************************************************
- * @brief Initialize the dynamic service map that contains service states.
+ * @brief Rebuild a service written by _ServiceSave().
+ *
+ * @param  record   IN  saved service
+ *
+ * @retval  newly created and ref'd service on success
+ * @retval  NULL if the record is malformed
+ *******************************************************************************
+ */
+static _Service*
+_ServiceLoad(LSHubFileRecord *record)
+{
+    _Service *service = NULL;
+    const char **names = NULL;
+    const char *exec_path = NULL;
+    const char *dir = NULL;
+    const char *file = NULL;
+    guint32 num_services = 0;
+    guint32 is_dynamic = 0;
+    guint32 keep_warm = 0;
+    guint32 i = 0;
+
+    /* every name takes at least a length */
+    if (!LSHubFileRecordGetUint32(record, &num_services) || num_services == 0 ||
+        num_services > (size_t)(record->end - record->pos) / sizeof(guint32))
+    {
+        return NULL;
+    }
+
+    names = g_new0(const char*, num_services);
+
+    for (i = 0; i < num_services; i++)
+    {
+        if (!LSHubFileRecordGetString(record, &names[i]) || !names[i]) goto exit;
+    }
+
+    if (!LSHubFileRecordGetString(record, &exec_path) || !exec_path ||
+        !LSHubFileRecordGetString(record, &dir) ||
+        !LSHubFileRecordGetString(record, &file) ||
+        !LSHubFileRecordGetUint32(record, &is_dynamic) ||
+        !LSHubFileRecordGetUint32(record, &keep_warm))
+    {
+        goto exit;
+    }
+
+    service = _ServiceNewRef(names, num_services, (char*)exec_path, is_dynamic, (char*)dir, (char*)file);
+
+    if (service)
+    {
+        service->keep_warm = keep_warm;
+    }
+
+exit:
+    g_free(names);
+
+    return service;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Initialize the service map that contains all services.
  * 
+ * @param  dirs     IN  service directories about to be parsed
  * @param  lserror  OUT set on error 
  * 
  * @retval  true on success
@@ -938,21 +1349,63 @@ ServiceInitMap(LSError *lserror)
  *******************************************************************************
  */
 bool
-DynamicServiceInitStateMap(LSError *lserror)
+ServiceInitMap(const char **dirs, LSError *lserror)
 {
-    return _ServiceInitMap(&dynamic_service_states, lserror);
+    if (!service_file_cache)
+    {
+        service_file_cache = LSHubFileCacheNew((GDestroyNotify)_ServiceUnref);
+    }
+
+    LSHubFileCacheSetSnapshot(service_file_cache, g_conf_service_scan_cache, dirs,
+                              _ServiceSave, (LSHubFileCacheLoadFunc)_ServiceLoad);
+    LSHubFileCacheScanBegin(service_file_cache);
+
+    return _ServiceInitMap(&all_services, lserror);
 }
 
 /** 
  *******************************************************************************
- * @brief Parse (and validate) a service file.
- *
-   @verbatim
+ * @brief Finish (re)loading the service map after all the service
+ * directories have been parsed. Forgets service files that were not seen
+ * (i.e., removed since the last scan).
+ *******************************************************************************
+ */
+void
+ServiceFinishMap(void)
+{
+    if (service_file_cache)
+    {
+        LSHubFileCacheScanEnd(service_file_cache);
+    }
+}
+
+/** 
+ *******************************************************************************
+ * @brief Initialize the dynamic service map that contains service states.
+ * 
+ * @param  lserror  OUT set on error 
+ * 
+ * @retval  true on success
+ * @retval  false on failure
+ *******************************************************************************
+ */
+bool
+DynamicServiceInitStateMap(LSError *lserror)
+{
+    return _ServiceInitMap(&dynamic_service_states, lserror);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Parse (and validate) a service file.
+ *
+   @verbatim
    Example:
 
    [Luna Service]
    Name=com.palm.foo
    Exec=/path/to/executable
+   KeepWarm=true        (optional, dynamic services only)
    @endverbatim
  * 
  * @param  path     IN  path to service file 
@@ -1114,6 +1567,12 @@ _ParseServiceFile(const char *service_file_dir, const char *service_file_name, L
         _LSErrorSet(lserror, -1, "OOM");
         goto error;
     }
+
+    /* optional */
+    if (g_key_file_has_key(key_file, service_group, SERVICE_KEEP_WARM_KEY, NULL))
+    {
+        new_service->keep_warm = g_key_file_get_boolean(key_file, service_group, SERVICE_KEEP_WARM_KEY, NULL);
+    }
     
 error:
     /* free up memory */
@@ -1161,8 +1620,36 @@ ParseServiceDirectory(const char *path, LSError *lserror)
         /* check file extension */
         if (g_str_has_suffix(filename, SERVICE_FILE_SUFFIX))
         {
-            /* get newly created and ref'd service */
-            _Service *new_service = _ParseServiceFile(path, filename, lserror);
+            char *full_path = g_strconcat(path, "/", filename, NULL);
+            LSHubFileStamp stamp;
+
+            /* unchanged since the last scan? */
+            _Service *new_service = NULL;
+
+            if (service_file_cache)
+            {
+                new_service = LSHubFileCacheLookup(service_file_cache, full_path,
+                                                   g_conf_dynamic_service_exec_prefix, &stamp);
+            }
+
+            if (new_service)
+            {
+                _ServiceRef(new_service);
+            }
+            else
+            {
+                /* get newly created and ref'd service */
+                new_service = _ParseServiceFile(path, filename, lserror);
+
+                if (new_service && service_file_cache)
+                {
+                    _ServiceRef(new_service);
+                    LSHubFileCacheStore(service_file_cache, full_path,
+                                        g_conf_dynamic_service_exec_prefix, &stamp, new_service);
+                }
+            }
+
+            g_free(full_path);
 
             if (new_service)
             {
@@ -1193,6 +1680,96 @@ ParseServiceDirectory(const char *path, LSError *lserror)
 }
 
 
+/** 
+ *******************************************************************************
+ * @brief Apply a change to a single service file (added, modified, or
+ * removed) to the service map without rebuilding it.
+ * 
+ * @param  dir          IN  service directory
+ * @param  filename     IN  file in dir that changed
+ * 
+ * @retval  true if the service map changed
+ * @retval  false if this isn't a service file or nothing changed
+ *******************************************************************************
+ */
+bool
+ServiceFileUpdate(const char *dir, const char *filename)
+{
+    LS_ASSERT(dir != NULL);
+    LS_ASSERT(filename != NULL);
+
+    bool ret = false;
+    int i = 0;
+    LSHubFileStamp stamp;
+    LSError lserror;
+    LSErrorInit(&lserror);
+
+    if (!g_str_has_suffix(filename, SERVICE_FILE_SUFFIX) || !all_services || !service_file_cache)
+    {
+        return false;
+    }
+
+    char *full_path = g_strconcat(dir, "/", filename, NULL);
+
+    _Service *old_service = LSHubFileCacheGet(service_file_cache, full_path);
+
+    if (old_service && LSHubFileCacheLookup(service_file_cache, full_path,
+                                            g_conf_dynamic_service_exec_prefix, &stamp))
+    {
+        /* e.g., closed without writing anything */
+        goto exit;
+    }
+
+    _ls_verbose("%s: service file changed: \"%s\"\n", __func__, full_path);
+
+    if (old_service)
+    {
+        /* only the names that another file hasn't taken over since */
+        for (i = 0; i < old_service->num_services; i++)
+        {
+            if (g_hash_table_lookup(all_services, old_service->service_names[i]) == old_service)
+            {
+                g_hash_table_remove(all_services, old_service->service_names[i]);
+            }
+        }
+
+        /* unrefs old_service */
+        LSHubFileCacheRemove(service_file_cache, full_path);
+        ret = true;
+    }
+
+    if (!LSHubFileStampGet(full_path, &stamp))
+    {
+        /* removed */
+        goto exit;
+    }
+
+    /* get newly created and ref'd service */
+    _Service *new_service = _ParseServiceFile(dir, filename, &lserror);
+
+    if (!new_service)
+    {
+        LSErrorPrint(&lserror, stderr);
+        LSErrorFree(&lserror);
+        goto exit;
+    }
+
+    if (!_ServiceMapAdd(new_service, &lserror))
+    {
+        LSErrorPrint(&lserror, stderr);
+        LSErrorFree(&lserror);
+    }
+
+    /* cache takes our ref */
+    LSHubFileCacheStore(service_file_cache, full_path, g_conf_dynamic_service_exec_prefix, &stamp, new_service);
+    ret = true;
+
+exit:
+    g_free(full_path);
+
+    return ret;
+}
+
 /** 
  *******************************************************************************
  * @brief Send a signal to all registered clients that the config file scanning
@@ -1343,6 +1920,19 @@ _LSHubHandleDisconnect(_LSTransportClient *client, _LSTransportDisconnectType ty
         return;
     }
 
+    /* drop any QueryName messages that it is still waiting on, since
+     * there's no one left to reply to */
+    while (id->waiting)
+    {
+        _LSTransportMessage *query_message = id->waiting->data;
+
+        _LSHubWaitListRemove(query_message);
+        _LSHubRemoveMessageTimeout(query_message);
+
+        /* ref associated with waiting_for_service list */
+        _LSTransportMessageUnref(query_message);
+    }
+
     /* remove from available_services and/or pending */
     if (id->service_name != NULL)
     {
@@ -1425,6 +2015,11 @@ _LSHubHandleDisconnect(_LSTransportClient *client, _LSTransportDisconnectType ty
         id->is_monitor = false;
         _LSHubClientIdLocalUnref(monitor);
         monitor = NULL;
+
+        g_free(monitor_filter_names);
+        monitor_filter_names = NULL;
+        monitor_filter_types = 0;
+        monitor_filter_sample_rate = 0;
     }
     
     /* remove the socket file; we do this in the hub so that we clean up
@@ -1445,6 +2040,8 @@ _LSHubHandleDisconnect(_LSTransportClient *client, _LSTransportDisconnectType ty
         LSErrorFree(&lserror);
     }
 
+    _LSHubStateChanged();
+
     /* transport code will handle cleaning up the client and removing the watches */
 }
 
@@ -1495,6 +2092,7 @@ _LSHubClientIdLocalFree(_ClientId *id)
     
     if (id->service_name) g_free(id->service_name);
     if (id->local.name) g_free(id->local.name);
+    g_slist_free(id->waiting);
     _LSTransportClientUnref(id->client);
 
 #ifdef MEMCHECK
@@ -1587,6 +2185,7 @@ _LSHubClientIdLocalUnrefVoid(void *id)
  * @param  err_code    IN  numeric error code 
  * @param  ret_str     IN  error string
  * @param  privileged  IN true if the service is privileged
+ * @param  resumed     IN  LS_TRANSPORT_REQUEST_NAME_RESUME_*
  * @param  lserror     OUT set on error 
  * 
  * @retval  message on success
@@ -1596,7 +2195,7 @@ _LSHubClientIdLocalUnrefVoid(void *id)
 static _LSTransportMessage*
 _LSHubConstructRequestNameReply(_LSTransportMessage *message, 
                                 _LSTransportMessageType type, long err_code,
-                                const char *ret_str, bool privileged, LSError *lserror)
+                                const char *ret_str, bool privileged, int32_t resumed, LSError *lserror)
 {
     _LSTransportMessageIter iter;
 
@@ -1610,6 +2209,7 @@ _LSHubConstructRequestNameReply(_LSTransportMessage *message,
     if (!_LSTransportMessageAppendInt32(&iter, err_code)) goto error;
     if (!_LSTransportMessageAppendBool(&iter, privileged)) goto error;
     if (!_LSTransportMessageAppendString(&iter, ret_str)) goto error;
+    if (!_LSTransportMessageAppendInt32(&iter, resumed)) goto error;
     if (!_LSTransportMessageAppendInvalid(&iter)) goto error;
 
     return reply_message;
@@ -1627,6 +2227,8 @@ error:
  * @param  message      IN  request name message 
  * @param  err_code     IN  numeric error code (0 means success) 
  * @param  ret_str      IN  return string 
+ * @param  resumed      IN  LS_TRANSPORT_REQUEST_NAME_RESUME_* (the client
+ *                          keeps its listen socket unless this is NONE)
  * @param  lserror      OUT set on error 
  * 
  * @retval  true on success
@@ -1635,7 +2237,7 @@ error:
  */
 static bool
 _LSHubSendRequestNameReply(_LSTransportMessage *message, _LSTransportType transport_type,
-                           long err_code, char* ret_str, LSError *lserror)
+                           long err_code, char* ret_str, int32_t resumed, LSError *lserror)
 {
     int fd = -1;
 
@@ -1654,7 +2256,7 @@ _LSHubSendRequestNameReply(_LSTransportMessage *message, _LSTransportType transp
 
         /* tdh -- if replying with success, then go ahead and set up socket for
          * listening */
-        if (err_code == 0)
+        if (err_code == 0 && resumed == LS_TRANSPORT_REQUEST_NAME_RESUME_NONE)
         {
             /* read and write only by hub user (root) */
             if (!_LSTransportListenLocal(ret_str, S_IRUSR | S_IWUSR, &fd, lserror))
@@ -1668,14 +2270,14 @@ _LSHubSendRequestNameReply(_LSTransportMessage *message, _LSTransportType transp
         message_type = _LSTransportMessageTypeRequestNameInetReply;
     }
 
-    _LSTransportMessage *reply_message = _LSHubConstructRequestNameReply(message, message_type, err_code, ret_str, LSHubClientGetPrivileged(client), lserror);
+    _LSTransportMessage *reply_message = _LSHubConstructRequestNameReply(message, message_type, err_code, ret_str, LSHubClientGetPrivileged(client), resumed, lserror);
 
     if (!reply_message)
     {
         return false;
     }
 
-    if (transport_type == _LSTransportTypeLocal)
+    if (transport_type == _LSTransportTypeLocal && fd != -1)
     {
         _LSTransportMessageSetConnectionFd(reply_message, fd);
     }
@@ -1773,7 +2375,7 @@ _LSHubHandleRequestName(_LSTransportMessage *message)
         g_critical("Transport protocol mismatch. Client version: %d. Hub version: %d",
                     protocol_version, LS_TRANSPORT_PROTOCOL_VERSION);
 
-        if (!_LSHubSendRequestNameReply(message, transport_type, LS_TRANSPORT_REQUEST_NAME_INVALID_PROTOCOL_VERSION, NULL, &lserror))
+        if (!_LSHubSendRequestNameReply(message, transport_type, LS_TRANSPORT_REQUEST_NAME_INVALID_PROTOCOL_VERSION, NULL, LS_TRANSPORT_REQUEST_NAME_RESUME_NONE, &lserror))
         {
             LSErrorPrint(&lserror, stderr);
             LSErrorFree(&lserror);
@@ -1791,7 +2393,7 @@ _LSHubHandleRequestName(_LSTransportMessage *message)
     /* Check security permissions */
     if (!LSHubIsClientAllowedToRequestName(client, service_name))
     {
-        if (!_LSHubSendRequestNameReply(message, transport_type, LS_TRANSPORT_REQUEST_NAME_PERMISSION_DENIED, NULL, &lserror))
+        if (!_LSHubSendRequestNameReply(message, transport_type, LS_TRANSPORT_REQUEST_NAME_PERMISSION_DENIED, NULL, LS_TRANSPORT_REQUEST_NAME_RESUME_NONE, &lserror))
         {
             LSErrorPrint(&lserror, stderr);
             LSErrorFree(&lserror);
@@ -1806,7 +2408,7 @@ _LSHubHandleRequestName(_LSTransportMessage *message)
         if (g_hash_table_lookup(pending, service_name) || g_hash_table_lookup(available_services, service_name))
         {
             /* construct and send error reply */
-            if (!_LSHubSendRequestNameReply(message, transport_type, LS_TRANSPORT_REQUEST_NAME_NAME_ALREADY_REGISTERED, NULL, &lserror))
+            if (!_LSHubSendRequestNameReply(message, transport_type, LS_TRANSPORT_REQUEST_NAME_NAME_ALREADY_REGISTERED, NULL, LS_TRANSPORT_REQUEST_NAME_RESUME_NONE, &lserror))
             {
                 LSErrorPrint(&lserror, stderr);
                 LSErrorFree(&lserror);
@@ -1815,7 +2417,33 @@ _LSHubHandleRequestName(_LSTransportMessage *message)
         }
     }
 
-    if (transport_type == _LSTransportTypeLocal)
+    /* a client of the previous hub instance may ask for its old name back */
+    const char *resume_name = NULL;
+    const char *resume_digest = NULL;
+    int32_t resumed = LS_TRANSPORT_REQUEST_NAME_RESUME_NONE;
+
+    _LSTransportMessageIter resume_iter = iter;
+
+    if (transport_type == _LSTransportTypeInet)
+    {
+        /* inet port comes first */
+        _LSTransportMessageIterNext(&resume_iter);
+    }
+    _LSTransportMessageIterNext(&resume_iter);
+    if (_LSTransportMessageGetString(&resume_iter, &resume_name))
+    {
+        _LSTransportMessageIterNext(&resume_iter);
+        _LSTransportMessageGetString(&resume_iter, &resume_digest);
+    }
+
+    resumed = _LSHubResumeClient(client, service_name, resume_name, resume_digest);
+
+    if (resumed != LS_TRANSPORT_REQUEST_NAME_RESUME_NONE)
+    {
+        /* the client still has the socket for its name */
+        unique_name = g_strdup(resume_name);
+    }
+    else if (transport_type == _LSTransportTypeLocal)
     {
         /* generate a unique name */
         unique_name = g_strdup_printf("%s/XXXXXX", *local_socket_path);
@@ -1899,7 +2527,7 @@ _LSHubHandleRequestName(_LSTransportMessage *message)
     _LSHubClientIdLocalUnref(id);
 
     /* send reply with name */
-    if (!_LSHubSendRequestNameReply(message, transport_type, LS_TRANSPORT_REQUEST_NAME_SUCCESS, unique_name, &lserror))
+    if (!_LSHubSendRequestNameReply(message, transport_type, LS_TRANSPORT_REQUEST_NAME_SUCCESS, unique_name, resumed, &lserror))
     {
         LSErrorPrint(&lserror, stdout);
         LSErrorFree(&lserror);
@@ -1907,6 +2535,8 @@ _LSHubHandleRequestName(_LSTransportMessage *message)
         /* TODO: can we do anything else if there's an error ? */
     }
 
+    _LSHubStateChanged();
+
 error:
     if (unique_name) g_free(unique_name);
 }
@@ -2048,6 +2678,78 @@ _LSHubHandleConnectReady(GIOChannel *channel, GIOCondition cond, _LSTransportMes
     return FALSE;
 }
 
+/** 
+ *******************************************************************************
+ * @brief Connect a client to a local service without going through the
+ * service's listening socket: make a socketpair() and hand one end to the
+ * service over its hub connection. The other end is for the client.
+ * Only services that advertised LS_TRANSPORT_CAP_INCOMING_CONNECTION get
+ * connections this way.
+ * 
+ * @param  unique_name  IN      unique name of the service 
+ * @param  fd           OUT     client end of the connection 
+ * @param  lserror      OUT     set on error 
+ * 
+ * @retval  true on success
+ * @retval  false on failure (fall back to connecting normally)
+ *******************************************************************************
+ */
+static bool
+_LSHubHandOffSocketPair(const char *unique_name, int *fd, LSError *lserror)
+{
+    LS_ASSERT(unique_name != NULL);
+    LS_ASSERT(fd != NULL);
+
+    int fds[2] = { -1, -1 };
+    _ClientId *id = g_hash_table_lookup(connected_clients.by_unique_name, unique_name);
+
+    if (!id || !id->client)
+    {
+        _LSErrorSetNoPrint(lserror, -1, "No hub connection for \"%s\"", unique_name);
+        return false;
+    }
+
+    /* older services (or one whose "ClientInfo" we haven't seen yet)
+     * would drop the fd */
+    if (!(id->client->peer_caps & LS_TRANSPORT_CAP_INCOMING_CONNECTION))
+    {
+        _LSErrorSetNoPrint(lserror, -1, "\"%s\" doesn't take handed-off connections", unique_name);
+        return false;
+    }
+
+    _LSTransportMessage *message = _LSTransportMessageNewRef(LS_TRANSPORT_MESSAGE_DEFAULT_PAYLOAD_SIZE);
+
+    if (!message)
+    {
+        _LSErrorSetOOM(lserror);
+        return false;
+    }
+
+    _LSTransportMessageSetType(message, _LSTransportMessageTypeIncomingConnection);
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+    {
+        _LSErrorSetFromErrno(lserror, errno);
+        _LSTransportMessageUnref(message);
+        return false;
+    }
+
+    /* the service's end is closed along with the message once it's sent */
+    _LSTransportMessageSetConnectionFd(message, fds[1]);
+
+    if (!_LSTransportSendMessage(message, id->client, NULL, lserror))
+    {
+        _LSTransportMessageUnref(message);
+        close(fds[0]);
+        return false;
+    }
+
+    _LSTransportMessageUnref(message);
+
+    *fd = fds[0];
+    return true;
+}
+
 /** 
  *******************************************************************************
  * @brief Send a reply to a "QueryName" message.
@@ -2100,7 +2802,28 @@ _LSHubSendQueryNameReply(const _LSTransportMessage *message, long err_code,
     if (err_code >= 0 &&
         _LSTransportGetTransportType(_LSTransportClientGetTransport(client)) == _LSTransportTypeLocal)
     {
-        connect_state = _LSTransportConnectLocal(unique_name, true, &fd, lserror);
+        if (g_conf_socket_pair_handoff)
+        {
+            LSError handoff_error;
+            LSErrorInit(&handoff_error);
+
+            if (!_LSHubHandOffSocketPair(unique_name, &fd, &handoff_error))
+            {
+                _ls_verbose("%s: socketpair handoff to \"%s\" failed: %s\n", __func__, unique_name, handoff_error.message);
+                LSErrorFree(&handoff_error);
+                fd = -1;
+            }
+        }
+
+        if (fd != -1)
+        {
+            /* already connected, no connect() needed */
+            connect_state = _LSTransportConnectStateNoError;
+        }
+        else
+        {
+            connect_state = _LSTransportConnectLocal(unique_name, true, &fd, lserror);
+        }
 
         _LSTransportMessageSetConnectState(reply_message, connect_state);
 
@@ -2158,6 +2881,95 @@ error:
     return false;
 }
 
+/** 
+ *******************************************************************************
+ * @brief Look up the client id that sent a QueryName message.
+ * 
+ * @param  message  IN  query name message 
+ * 
+ * @retval  id if the sender is still connected
+ * @retval  NULL otherwise
+ *******************************************************************************
+ */
+static _ClientId*
+_LSHubWaitListOwner(_LSTransportMessage *message)
+{
+    _LSTransportClient *client = _LSTransportMessageGetClient(message);
+    _ClientId *id = g_hash_table_lookup(connected_clients.by_fd, GINT_TO_POINTER(client->channel.fd));
+
+    if (id && id->client == client)
+    {
+        return id;
+    }
+    return NULL;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Add a QueryName message to the list of messages waiting for its
+ * service (and to the sender's own list). The caller holds a ref on behalf
+ * of the list.
+ * 
+ * @param  message  IN  query name message 
+ *******************************************************************************
+ */
+static void
+_LSHubWaitListAdd(_LSTransportMessage *message)
+{
+    const char *requested_service = _LSTransportMessageTypeQueryNameGetQueryName(message);
+
+    if (!waiting_for_service)
+    {
+        waiting_for_service = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    }
+
+    GSList *waiting = g_hash_table_lookup(waiting_for_service, requested_service);
+
+    g_hash_table_replace(waiting_for_service, g_strdup(requested_service), g_slist_prepend(waiting, message));
+
+    _ClientId *owner = _LSHubWaitListOwner(message);
+    if (owner)
+    {
+        owner->waiting = g_slist_prepend(owner->waiting, message);
+    }
+}
+
+/** 
+ *******************************************************************************
+ * @brief Remove a QueryName message from the list of messages waiting for
+ * its service (and from the sender's own list). The caller drops the ref
+ * held on behalf of the list.
+ * 
+ * @param  message  IN  query name message 
+ *******************************************************************************
+ */
+static void
+_LSHubWaitListRemove(_LSTransportMessage *message)
+{
+    const char *requested_service = _LSTransportMessageTypeQueryNameGetQueryName(message);
+
+    if (waiting_for_service && requested_service)
+    {
+        GSList *waiting = g_hash_table_lookup(waiting_for_service, requested_service);
+        GSList *new_waiting = g_slist_remove(waiting, message);
+
+        if (!new_waiting)
+        {
+            g_hash_table_remove(waiting_for_service, requested_service);
+        }
+        else if (new_waiting != waiting)
+        {
+            g_hash_table_replace(waiting_for_service, g_strdup(requested_service), new_waiting);
+        }
+    }
+
+    _ClientId *owner = _LSHubWaitListOwner(message);
+    if (owner)
+    {
+        owner->waiting = g_slist_remove(owner->waiting, message);
+    }
+}
+
 /** 
  *******************************************************************************
  * @brief Send a query name reply to all clients waiting for this service.
@@ -2190,44 +3002,45 @@ _LSHubSendServiceWaitListReply(_ClientId *id, bool success, bool is_dynamic, LSE
      * Multiple clients may be waiting for this service, so we iterate over
      * all of those waiting and send replies
      */
+    GSList *waiting = NULL;
+
+    if (waiting_for_service)
+    {
+        waiting = g_hash_table_lookup(waiting_for_service, id->service_name);
+        g_hash_table_remove(waiting_for_service, id->service_name);
+    }
 
-    GSList *iter = waiting_for_service;
-    while (iter)
+    GSList *iter;
+    for (iter = waiting; iter != NULL; iter = g_slist_next(iter))
     {
         _LSTransportMessage *query_message = (_LSTransportMessage*)iter->data;
         const char *requested_service = _LSTransportMessageTypeQueryNameGetQueryName(query_message);
-       
-        if (strcmp(requested_service, id->service_name) == 0)
-        {
-            /* we found a client waiting for this service */
 
 #ifdef DEBUG
-            printf("Sending QueryNameReply for service: \"%s\" to client: \"%s\" (\"%s\")\n", id->service_name, query_message->client->service_name, query_message->client->unique_name);
+        printf("Sending QueryNameReply for service: \"%s\" to client: \"%s\" (\"%s\")\n", id->service_name, query_message->client->service_name, query_message->client->unique_name);
 #endif
 
-            if (!_LSHubSendQueryNameReply(query_message, ret_code, requested_service, id->local.name, is_dynamic, lserror))
-            {
-                LSErrorPrint(lserror, stderr);
-                LSErrorFree(lserror);
-            }
-
-            /* remove the timeout if there is one */
-            _LSHubRemoveMessageTimeout(query_message);
-
-            /* ref associated with waiting_for_service list */
-            _LSTransportMessageUnref(query_message);
-
-            GSList *remove_node = iter;
-            iter = g_slist_next(iter);
-
-            waiting_for_service = g_slist_delete_link(waiting_for_service, remove_node);
+        if (!_LSHubSendQueryNameReply(query_message, ret_code, requested_service, id->local.name, is_dynamic, lserror))
+        {
+            LSErrorPrint(lserror, stderr);
+            LSErrorFree(lserror);
         }
-        else
+
+        _ClientId *owner = _LSHubWaitListOwner(query_message);
+        if (owner)
         {
-            iter = g_slist_next(iter);
+            owner->waiting = g_slist_remove(owner->waiting, query_message);
         }
+
+        /* remove the timeout if there is one */
+        _LSHubRemoveMessageTimeout(query_message);
+
+        /* ref associated with waiting_for_service list */
+        _LSTransportMessageUnref(query_message);
     }
 
+    g_slist_free(waiting);
+
     return true;
 }
 
@@ -2289,7 +3102,10 @@ _LSHubHandleNodeUp(_LSTransportMessage *message)
 
     if (!id)
     {
-        g_critical("Could not find client using fd");
+        /* clients send "NodeUp" right behind "RequestName" without waiting
+         * for the reply, so this is a client whose name request we turned
+         * down; it's about to go away */
+        _ls_verbose("%s: no client id for fd %d (name request failed?)\n", __func__, client->channel.fd);
         return;
     }
 
@@ -2422,7 +3238,7 @@ _LSHubHandleQueryNameTimeout(_LSTransportMessage *message)
     LSErrorInit(&lserror);
 
     /* remove the message from the waiting list */
-    waiting_for_service = g_slist_remove(waiting_for_service, message);
+    _LSHubWaitListRemove(message);
 
     const char *requested_service = _LSTransportMessageTypeQueryNameGetQueryName(message);
 
@@ -2514,13 +3330,15 @@ static void
 _LSHubAddMessageTimeout(_LSTransportMessage *message, int timeout_ms, GSourceFunc callback)
 {
     _LSTransportMessageRef(message);
-    
-    GTimerSource *source = g_timer_source_new (timeout_ms, MESSAGE_TIMEOUT_GRANULARITY_MS);
 
-    g_source_set_callback ((GSource*)source, callback, message, NULL);
-    guint timeout_id = g_source_attach ((GSource*)source, NULL);
+    if (!message_timeouts)
+    {
+        message_timeouts = _LSTimerWheelNew(MESSAGE_TIMEOUT_GRANULARITY_MS);
+        LS_ASSERT(message_timeouts != NULL);
+        _LSTimerWheelAttach(message_timeouts, NULL);
+    }
 
-    _LSTransportMessageSetTimeoutId(message, timeout_id);
+    _LSTimerWheelArm(message_timeouts, _LSTransportMessageGetTimeout(message), timeout_ms, callback, message);
 }
 
 /** 
@@ -2533,16 +3351,8 @@ _LSHubAddMessageTimeout(_LSTransportMessage *message, int timeout_ms, GSourceFun
 static void
 _LSHubRemoveMessageTimeout(_LSTransportMessage *message)
 {
-    /* remove timeout source from mainloop */
-    GSource *timeout_source = g_main_context_find_source_by_id(NULL, _LSTransportMessageGetTimeoutId(message));
-
-    if (timeout_source)
-    {
-        g_source_destroy(timeout_source);
-    }
-
-    /* clear timeout id */
-    _LSTransportMessageSetTimeoutId(message, 0);
+    /* no-op if the timeout is what fired */
+    _LSTimerWheelCancel(message_timeouts, _LSTransportMessageGetTimeout(message));
 
     _LSTransportMessageUnref(message);
 }
@@ -2559,7 +3369,7 @@ static void
 _LSHubAddConnectMessageTimeout(_LSTransportMessage *message)
 {
     _LSTransportMessageRef(message);
-    waiting_for_connect = g_slist_prepend(waiting_for_service, message);
+    waiting_for_connect = g_slist_prepend(waiting_for_connect, message);
     _LSHubAddMessageTimeout(message, g_conf_connect_timeout_ms, (GSourceFunc)_LSHubHandleConnectTimeout);
 }
 
@@ -2589,7 +3399,7 @@ static void
 _LSHubAddQueryNameMessageTimeout(_LSTransportMessage *message)
 {
     _LSTransportMessageRef(message);
-    waiting_for_service = g_slist_prepend(waiting_for_service, message);
+    _LSHubWaitListAdd(message);
     _LSHubAddMessageTimeout(message, g_conf_query_name_timeout_ms, (GSourceFunc)_LSHubHandleQueryNameTimeout);
 }
 
@@ -2661,6 +3471,11 @@ _LSHubHandleQueryName(_LSTransportMessage *message)
         return;
     }
 
+    if (service_is_dynamic)
+    {
+        _DynamicServiceNoteDemand(service);
+    }
+
     _ClientId *id = g_hash_table_lookup(available_services, service_name);
 
     if (!id)
@@ -2738,8 +3553,51 @@ _LSHubHandleQueryName(_LSTransportMessage *message)
 
 /** 
  *******************************************************************************
- * @brief Allocate a new _LSTransportClientMap, which has a key of
- * _LSTransportClient* and value of a ref count (stored in ptr).
+ * @brief Find the slot for a client in a client map.
+ * 
+ * @param  map      IN  map 
+ * @param  client   IN  client 
+ * @param  index    OUT index of the client if found, otherwise the index at
+ *                      which it should be inserted to keep the map sorted
+ * 
+ * @retval  true if client was found in map
+ * @retval  false otherwise
+ *******************************************************************************
+ */
+static bool
+_LSTransportClientMapFind(const _LSTransportClientMap *map, const _LSTransportClient *client, guint *index)
+{
+    guint lo = 0;
+    guint hi = map->entries->len;
+
+    while (lo < hi)
+    {
+        guint mid = lo + (hi - lo) / 2;
+        const _LSTransportClient *mid_client = g_array_index(map->entries, _LSTransportClientMapEntry, mid).client;
+
+        if (mid_client == client)
+        {
+            *index = mid;
+            return true;
+        }
+        else if ((uintptr_t)mid_client < (uintptr_t)client)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    *index = lo;
+    return false;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Allocate a new _LSTransportClientMap, which holds
+ * _LSTransportClient* with a ref count for each.
  * 
  * @retval map on success
  * @retal  NULL on failure
@@ -2752,8 +3610,8 @@ _LSTransportClientMapNew(void)
 
     if (ret)
     {
-        ret->map = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, NULL);
-        if (!ret->map)
+        ret->entries = g_array_sized_new(FALSE, FALSE, sizeof(_LSTransportClientMapEntry), 1);
+        if (!ret->entries)
         {
             g_free(ret);
             return NULL;
@@ -2772,7 +3630,7 @@ _LSTransportClientMapNew(void)
 static void
 _LSTransportClientMapFree(_LSTransportClientMap *map)
 {
-    g_hash_table_unref(map->map);
+    g_array_free(map->entries, TRUE);
 
 #ifdef MEMCHECK
     memset(map, 0xFF, sizeof(_LSTransportClientMap));
@@ -2793,20 +3651,21 @@ _LSTransportClientMapFree(_LSTransportClientMap *map)
 static void 
 _LSTransportClientMapAddRefClient(_LSTransportClientMap *map, _LSTransportClient *client)
 {
-    gpointer value = g_hash_table_lookup(map->map, client);
+    guint index;
 
-    if (value == NULL)
+    if (_LSTransportClientMapFind(map, client, &index))
     {
-        _LSTransportClientRef(client);
-
-        /* add with ref count of 1 */
-        g_hash_table_replace(map->map, client, GINT_TO_POINTER(1));
+        /* increment ref count */
+        g_array_index(map->entries, _LSTransportClientMapEntry, index).ref++;
     }
     else
     {
-        /* increment ref count */
-        gint new_value = GPOINTER_TO_INT(value) + 1;
-        g_hash_table_replace(map->map, client, GINT_TO_POINTER(new_value));
+        _LSTransportClientMapEntry entry = { client, 1 };
+
+        _LSTransportClientRef(client);
+
+        /* add with ref count of 1 */
+        g_array_insert_val(map->entries, index, entry);
     }
 }
 
@@ -2825,21 +3684,17 @@ _LSTransportClientMapAddRefClient(_LSTransportClientMap *map, _LSTransportClient
 static bool
 _LSTransportClientMapUnrefClient(_LSTransportClientMap *map, _LSTransportClient *client)
 {
-    gpointer value = g_hash_table_lookup(map->map, client);
+    guint index;
 
-    if (value)
+    if (_LSTransportClientMapFind(map, client, &index))
     {
-        gint new_value = GPOINTER_TO_INT(value) - 1;
+        _LSTransportClientMapEntry *entry = &g_array_index(map->entries, _LSTransportClientMapEntry, index);
 
-        if (new_value == 0)
+        if (--entry->ref == 0)
         {
-            g_hash_table_remove(map->map, client);
+            g_array_remove_index(map->entries, index);
             _LSTransportClientUnref(client);
         }
-        else
-        {
-            g_hash_table_replace(map->map, client, GINT_TO_POINTER(new_value));
-        }
         return true;
     }
     return false;
@@ -2860,11 +3715,11 @@ _LSTransportClientMapUnrefClient(_LSTransportClientMap *map, _LSTransportClient
 static bool
 _LSTransportClientMapRemove(_LSTransportClientMap *map, _LSTransportClient *client)
 {
-    gpointer value = g_hash_table_lookup(map->map, client);
+    guint index;
 
-    if (value)
+    if (_LSTransportClientMapFind(map, client, &index))
     {
-        g_hash_table_remove(map->map, client);
+        g_array_remove_index(map->entries, index);
         _LSTransportClientUnref(client);
         return true;
     }
@@ -2886,7 +3741,7 @@ _LSTransportClientMapIsEmpty(_LSTransportClientMap *map)
 {
     LS_ASSERT(map != NULL);
     
-    if (g_hash_table_size(map->map) == 0)
+    if (map->entries->len == 0)
     {
         return true;
     }
@@ -2895,7 +3750,8 @@ _LSTransportClientMapIsEmpty(_LSTransportClientMap *map)
 
 /** 
  *******************************************************************************
- * @brief Call the specified function for each item in the map.
+ * @brief Call the specified function for each item in the map. The
+ * callback gets the client, its ref count (stored in ptr) and the message.
  * 
  * @param  map      IN  map 
  * @param  func     IN  callback
@@ -2905,7 +3761,15 @@ _LSTransportClientMapIsEmpty(_LSTransportClientMap *map)
 static void
 _LSTransportClientMapForEach(_LSTransportClientMap *map, GHFunc func, _LSTransportMessage *message)
 {
-    g_hash_table_foreach(map->map, func, message);
+    guint i;
+
+    /* re-check the length every time in case the callback drops a client */
+    for (i = 0; i < map->entries->len; i++)
+    {
+        _LSTransportClientMapEntry *entry = &g_array_index(map->entries, _LSTransportClientMapEntry, i);
+
+        func(entry->client, GINT_TO_POINTER(entry->ref), message);
+    }
 }
 
 /** 
@@ -2924,15 +3788,13 @@ _LSHubSendSignal(_LSTransportClient *client, void *dummy, _LSTransportMessage *m
     LSErrorInit(&lserror);
     LSMessageToken token;
 
-    /* Need to make a copy of the message, since this function gets called
-     * multiple times with the same message.
-     *
-     * TODO: It would be nice to avoid the message copies for performance,
-     * but we need to have independent message transmit counts since the
-     * message is sent to different clients
+    /* This function gets called multiple times with the same message, so
+     * each client gets its own lightweight message that shares the body
+     * with the original. That gives every client an independent token and
+     * transmit count without copying the body for each one.
      */
 
-    _LSTransportMessage *msg_copy = _LSTransportMessageCopyNewRef(message);
+    _LSTransportMessage *msg_copy = _LSTransportMessageShareNewRef(message);
 
     if (msg_copy)
     {
@@ -2941,6 +3803,10 @@ _LSHubSendSignal(_LSTransportClient *client, void *dummy, _LSTransportMessage *m
             LSErrorPrint(&lserror, stderr);
             LSErrorFree(&lserror);
         }
+        else
+        {
+            hub_signal_fanout++;
+        }
         //g_critical("%s: sent signal to client: %p (unique_name: \"%s\", service_name: \"%s\") with token: %d, category: \"%s\", method: \"%s\", payload: \"%s\"", __func__, client, client->unique_name, client->service_name, (int)token, _LSTransportMessageGetCategory(message), _LSTransportMessageGetMethod(message), _LSTransportMessageGetPayload(message));
 
 #if 0
@@ -2960,11 +3826,76 @@ _LSHubSendSignal(_LSTransportClient *client, void *dummy, _LSTransportMessage *m
     }
 }
 
+/** 
+ *******************************************************************************
+ * @brief Allocate a new signal category, which tracks the clients registered
+ * for a category as a whole and a hash of method strings to @ref
+ * _LSTransportClientMap for the methods in that category.
+ * 
+ * @retval category on success
+ * @retval NULL on failure
+ *******************************************************************************
+ */
+static _SignalCategory*
+_SignalCategoryNew(void)
+{
+    _SignalCategory *ret = g_new0(_SignalCategory, 1);
+
+    if (ret)
+    {
+        ret->method_map = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)_LSTransportClientMapFree);
+        if (!ret->method_map)
+        {
+            g_free(ret);
+            return NULL;
+        }
+    }
+    return ret;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Free a signal category.
+ * 
+ * @param  category     IN  category to free 
+ *******************************************************************************
+ */
+static void
+_SignalCategoryFree(_SignalCategory *category)
+{
+    if (category->clients)
+    {
+        _LSTransportClientMapFree(category->clients);
+    }
+    g_hash_table_unref(category->method_map);
+
+#ifdef MEMCHECK
+    memset(category, 0xFF, sizeof(_SignalCategory));
+#endif
+
+    g_free(category);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Check to see if a signal category has no registered clients.
+ * 
+ * @param  category     IN  category 
+ * 
+ * @retval  true if category is empty
+ * @retval  false otherwise
+ *******************************************************************************
+ */
+static bool
+_SignalCategoryIsEmpty(_SignalCategory *category)
+{
+    return category->clients == NULL && g_hash_table_size(category->method_map) == 0;
+}
+
 /** 
  *******************************************************************************
  * @brief Allocate a new signal map, which has a hash of category strings to
- * @ref _LSTransportClientMap and hash of method strings to @ref
- * _LSTransportClientMap.
+ * @ref _SignalCategory.
  * 
  * @retval map on success
  * @retval NULL on failure
@@ -2977,8 +3908,8 @@ _SignalMapNew(void)
 
     if (ret)
     {
-        ret->category_map = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)_LSTransportClientMapFree);
-        ret->method_map = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)_LSTransportClientMapFree);
+        ret->category_map = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)_SignalCategoryFree);
+        ret->client_map = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)g_hash_table_unref);
     }
     return ret;
 }
@@ -2993,8 +3924,8 @@ _SignalMapNew(void)
 static void
 _SignalMapFree(_SignalMap *signal_map)
 {
+    g_hash_table_unref(signal_map->client_map);
     g_hash_table_unref(signal_map->category_map);
-    g_hash_table_unref(signal_map->method_map);
 
 #ifdef MEMCHECK
     memset(signal_map, 0xFF, sizeof(_SignalMap));
@@ -3005,38 +3936,86 @@ _SignalMapFree(_SignalMap *signal_map)
 
 /** 
  *******************************************************************************
- * @brief Remove a @ref LSTransportClient from the @ref _LSTransportClientMap
- * regardless of the ref count in the @ref _LSTransportClientMap.
+ * @brief Free a signal registration in the reverse lookup.
  * 
- * @param  key          IN  unused
- * @param  value        IN  @ref _LSTransportClientMap 
- * @param  user_data    IN  @ref _LSTransportClient 
+ * @param  reg  IN  registration to free 
+ *******************************************************************************
+ */
+static void
+_SignalRegistrationFree(_SignalRegistration *reg)
+{
+    g_free(reg->category);
+    g_free(reg->method);
+
+#ifdef MEMCHECK
+    memset(reg, 0xFF, sizeof(_SignalRegistration));
+#endif
+
+    g_slice_free(_SignalRegistration, reg);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Record in the reverse lookup that a client was added to the
+ * client map for a signal.
  * 
- * @retval  TRUE if the @ref _LSTransportClientMap is empty and should be
- * free'd
- * @retval  FALSE otherwise
+ * @param  client       IN  client 
+ * @param  client_map   IN  map that client was added to
+ * @param  category     IN  signal category 
+ * @param  method       IN  signal method (NULL for the whole category)
  *******************************************************************************
  */
-static gboolean
-_LSTransportClientMapRemoveCallback(gpointer key, gpointer value, gpointer user_data)
+static void
+_SignalMapAddClientRegistration(_LSTransportClient *client, _LSTransportClientMap *client_map,
+                                const char *category, const char *method)
 {
-    _LSTransportClient *client = (_LSTransportClient*)user_data;
-    _LSTransportClientMap *client_map = (_LSTransportClientMap*)value;
+    GHashTable *regs = g_hash_table_lookup(signal_map->client_map, client);
+
+    if (!regs)
+    {
+        regs = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)_SignalRegistrationFree);
+        g_hash_table_insert(signal_map->client_map, client, regs);
+    }
 
-    /* remove regardless of ref_count because the client is going down */
-    _LSTransportClientMapRemove(client_map, client);
+    _SignalRegistration *reg = g_slice_new(_SignalRegistration);
+    reg->category = g_strdup(category);
+    reg->method = g_strdup(method);
 
-    if (_LSTransportClientMapIsEmpty(client_map))
+    g_hash_table_insert(regs, client_map, reg);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Drop a client's entry for a client map from the reverse lookup
+ * once the client is no longer in that map.
+ * 
+ * @param  client       IN  client 
+ * @param  client_map   IN  map that client was removed from
+ *******************************************************************************
+ */
+static void
+_SignalMapRemoveClientRegistration(_LSTransportClient *client, _LSTransportClientMap *client_map)
+{
+    GHashTable *regs = g_hash_table_lookup(signal_map->client_map, client);
+
+    if (regs)
     {
-        return TRUE;    /* client map is free'd by destroy func */
+        g_hash_table_remove(regs, client_map);
+
+        if (g_hash_table_size(regs) == 0)
+        {
+            g_hash_table_remove(signal_map->client_map, client);
+        }
     }
-    return FALSE;
 }
 
 /** 
  *******************************************************************************
  * @brief Remove all references to the client in the signal map (all the
  * signals that it registered for).
+ *
+ * Uses the reverse lookup, so this is O(number of signals the client
+ * registered for) instead of a walk over every registered signal.
  * 
  * @param  client   client 
  * 
@@ -3046,11 +4025,55 @@ _LSTransportClientMapRemoveCallback(gpointer key, gpointer value, gpointer user_
 static bool
 _LSHubRemoveClientSignals(_LSTransportClient *client)
 {
-    /* 
-     * FIXME: this is quite inefficient: O(num_registered_signals * num_clients)
-     */
-    g_hash_table_foreach_remove(signal_map->category_map, _LSTransportClientMapRemoveCallback, client);
-    g_hash_table_foreach_remove(signal_map->method_map, _LSTransportClientMapRemoveCallback, client);
+    GHashTable *regs = g_hash_table_lookup(signal_map->client_map, client);
+
+    if (!regs)
+    {
+        return true;
+    }
+
+    g_hash_table_steal(signal_map->client_map, client);
+
+    GHashTableIter iter;
+    gpointer key;
+    gpointer value;
+
+    g_hash_table_iter_init(&iter, regs);
+
+    while (g_hash_table_iter_next(&iter, &key, &value))
+    {
+        _LSTransportClientMap *client_map = key;
+        _SignalRegistration *reg = value;
+
+        _SignalCategory *signal_category = g_hash_table_lookup(signal_map->category_map, reg->category);
+        LS_ASSERT(signal_category != NULL);
+
+        /* remove regardless of ref_count because the client is going down */
+        _LSTransportClientMapRemove(client_map, client);
+
+        if (_LSTransportClientMapIsEmpty(client_map))
+        {
+            if (reg->method)
+            {
+                /* client_map is free'd by destroy func */
+                g_hash_table_remove(signal_category->method_map, reg->method);
+            }
+            else
+            {
+                _LSTransportClientMapFree(client_map);
+                signal_category->clients = NULL;
+            }
+
+            if (_SignalCategoryIsEmpty(signal_category))
+            {
+                /* signal_category is free'd by destroy func */
+                g_hash_table_remove(signal_map->category_map, reg->category);
+            }
+        }
+    }
+
+    g_hash_table_unref(regs);
+
     return true;
 }
 
@@ -3058,8 +4081,9 @@ _LSHubRemoveClientSignals(_LSTransportClient *client)
  *******************************************************************************
  * @brief Remove a client's registration for the given signal.
  * 
- * @param  map      IN  signal's "method_map" or "category_map" 
- * @param  path     IN  signal to unregister for 
+ * @param  category IN  signal category 
+ * @param  method   IN  signal method (empty string or NULL for the whole
+ *                      category)
  * @param  client   In  client 
  * 
  * @retval  true if signal registration was removed
@@ -3067,26 +4091,64 @@ _LSHubRemoveClientSignals(_LSTransportClient *client)
  *******************************************************************************
  */
 static bool
-_LSHubRemoveSignal(GHashTable *map, const char *path, _LSTransportClient *client)
+_LSHubRemoveSignal(const char *category, const char *method, _LSTransportClient *client)
 {
     bool ret = false;
+    guint index;
 
-    _LSTransportClientMap *client_map = g_hash_table_lookup(map, path);
+    _SignalCategory *signal_category = g_hash_table_lookup(signal_map->category_map, category);
 
-    if (client_map)
+    if (!signal_category)
     {
-        ret = _LSTransportClientMapUnrefClient(client_map, client);
+        return false;
+    }
 
-        if (_LSTransportClientMapIsEmpty(client_map))
+    if (method && method[0] != '\0')
+    {
+        _LSTransportClientMap *client_map = g_hash_table_lookup(signal_category->method_map, method);
+
+        if (client_map)
         {
-            /* if client_map is empty, we should remove "path" from
-             * the hash table */
-            bool remove_ret = g_hash_table_remove(map, path);
-            LS_ASSERT(remove_ret == true);
+            ret = _LSTransportClientMapUnrefClient(client_map, client);
 
-            /* client_map is free'd by destroy func when remove is called */
+            if (!_LSTransportClientMapFind(client_map, client, &index))
+            {
+                _SignalMapRemoveClientRegistration(client, client_map);
+            }
+
+            if (_LSTransportClientMapIsEmpty(client_map))
+            {
+                /* if client_map is empty, we should remove "method" from
+                 * the hash table */
+                bool remove_ret = g_hash_table_remove(signal_category->method_map, method);
+                LS_ASSERT(remove_ret == true);
+
+                /* client_map is free'd by destroy func when remove is called */
+            }
         }
     }
+    else if (signal_category->clients)
+    {
+        ret = _LSTransportClientMapUnrefClient(signal_category->clients, client);
+
+        if (!_LSTransportClientMapFind(signal_category->clients, client, &index))
+        {
+            _SignalMapRemoveClientRegistration(client, signal_category->clients);
+        }
+
+        if (_LSTransportClientMapIsEmpty(signal_category->clients))
+        {
+            _LSTransportClientMapFree(signal_category->clients);
+            signal_category->clients = NULL;
+        }
+    }
+
+    if (_SignalCategoryIsEmpty(signal_category))
+    {
+        /* signal_category is free'd by destroy func */
+        bool remove_ret = g_hash_table_remove(signal_map->category_map, category);
+        LS_ASSERT(remove_ret == true);
+    }
     
     return ret;
 }
@@ -3113,41 +4175,31 @@ _LSHubHandleSignalUnregister(_LSTransportMessage *message)
     /* if method, remove from category/method hash */
     if (strlen(method) > 0)
     {
-        char *full_path = g_strdup_printf("%s/%s", category, method);
-
-        if (full_path)
-        {
-            //g_critical("%s: removing from category/method: category: \"%s\", method: \"%s\", client: %p\n", __func__, category, method, client);
+        //g_critical("%s: removing from category/method: category: \"%s\", method: \"%s\", client: %p\n", __func__, category, method, client);
 #if 0
-            /* SIGNAL debug */
-            if (strcmp(category, SERVICE_STATUS_CATEGORY) == 0)
-            {
-                const _LSTransportCred *cred = _LSTransportClientGetCred(client);
-                g_critical("Unregistering server status of [\"%s\"] by client: %p "
-                           "(service_name: \"%s\", unique_name: \"%s\", pid: "LS_PID_PRINTF_FORMAT
-                           ", exe: \"%s\")", 
-                           method, client, client->service_name, client->unique_name,
-                           LS_PID_PRINTF_CAST(_LSTransportCredGetPid(cred)),
-                           _LSTransportCredGetExePath(cred));
-            }
+        /* SIGNAL debug */
+        if (strcmp(category, SERVICE_STATUS_CATEGORY) == 0)
+        {
+            const _LSTransportCred *cred = _LSTransportClientGetCred(client);
+            g_critical("Unregistering server status of [\"%s\"] by client: %p "
+                       "(service_name: \"%s\", unique_name: \"%s\", pid: "LS_PID_PRINTF_FORMAT
+                       ", exe: \"%s\")", 
+                       method, client, client->service_name, client->unique_name,
+                       LS_PID_PRINTF_CAST(_LSTransportCredGetPid(cred)),
+                       _LSTransportCredGetExePath(cred));
+        }
 #endif
 
-            if (!_LSHubRemoveSignal(signal_map->method_map, full_path, client))
-            {
-                const _LSTransportCred *cred = _LSTransportClientGetCred(client);
-                g_critical("Unable to remove signal: \"%s\" (requester pid: "LS_PID_PRINTF_FORMAT", "
-                           "requester exe: \"%s\", "
-                           "requester cmdline: \"%s\")",
-                           full_path,
-                           LS_PID_PRINTF_CAST(_LSTransportCredGetPid(cred)),
-                           _LSTransportCredGetExePath(cred),
-                           _LSTransportCredGetCmdLine(cred));
-            }
-            g_free(full_path);
-        }
-        else
+        if (!_LSHubRemoveSignal(category, method, client))
         {
-            g_critical("OOM, unable to remove signal: %s/%s", category, method);
+            const _LSTransportCred *cred = _LSTransportClientGetCred(client);
+            g_critical("Unable to remove signal: \"%s/%s\" (requester pid: "LS_PID_PRINTF_FORMAT", "
+                       "requester exe: \"%s\", "
+                       "requester cmdline: \"%s\")",
+                       category, method,
+                       LS_PID_PRINTF_CAST(_LSTransportCredGetPid(cred)),
+                       _LSTransportCredGetExePath(cred),
+                       _LSTransportCredGetCmdLine(cred));
         }
     }
     else
@@ -3155,7 +4207,7 @@ _LSHubHandleSignalUnregister(_LSTransportMessage *message)
         //g_critical("%s: removing from category: category: \"%s\", method: \"%s\", client: %p\n", __func__, category, method, client);
         
         /* remove from category hash */
-        if (!_LSHubRemoveSignal(signal_map->category_map, category, client))
+        if (!_LSHubRemoveSignal(category, NULL, client))
         {
             const _LSTransportCred *cred = _LSTransportClientGetCred(client);
             g_critical("Unable to remove signal: \"%s\" (requester pid: "LS_PID_PRINTF_FORMAT", "
@@ -3168,15 +4220,16 @@ _LSHubHandleSignalUnregister(_LSTransportMessage *message)
         }
     }
 
-    /* TODO: remove from reverse lookup */
+    _LSHubStateChanged();
 }
 
 /** 
  *******************************************************************************
  * @brief Add a client's registration for a given signal.
  * 
- * @param  map      IN  signal's "method_map" or "category_map" 
- * @param  path     IN  signal to register for
+ * @param  category IN  signal category to register for
+ * @param  method   IN  signal method to register for (empty string or NULL
+ *                      for the whole category)
  * @param  client   In  client 
  * 
  * @retval  true if signal registration was added
@@ -3184,36 +4237,370 @@ _LSHubHandleSignalUnregister(_LSTransportMessage *message)
  *******************************************************************************
  */
 static bool
-_LSHubAddSignal(GHashTable *map, const char *path, _LSTransportClient *client)
+_LSHubAddSignal(const char *category, const char *method, _LSTransportClient *client)
 {
-    _LSTransportClientMap *client_map = g_hash_table_lookup(map, path);
+    _SignalCategory *signal_category = g_hash_table_lookup(signal_map->category_map, category);
 
-    if (!client_map)
+    if (!signal_category)
     {
-        client_map = _LSTransportClientMapNew();
+        signal_category = _SignalCategoryNew();
 
-        if (!client_map)
+        if (!signal_category)
         {
-            g_critical("Unable to allocate client_map, OOM");
+            g_critical("Unable to allocate signal_category, OOM");
             return false;
         }
 
-        char *path_copy = g_strdup(path);
-        if (path_copy)
+        char *category_copy = g_strdup(category);
+        if (category_copy)
         {
-            g_hash_table_replace(map, (gpointer)path_copy, client_map);
+            g_hash_table_replace(signal_map->category_map, (gpointer)category_copy, signal_category);
         }
         else
         {
-            _LSTransportClientMapFree(client_map);
-            g_critical("Unable to allocate path_copy, OOM");
+            _SignalCategoryFree(signal_category);
+            g_critical("Unable to allocate category_copy, OOM");
             return false;
         }
     }
+
+    _LSTransportClientMap *client_map = NULL;
+
+    if (method && method[0] != '\0')
+    {
+        client_map = g_hash_table_lookup(signal_category->method_map, method);
+
+        if (!client_map)
+        {
+            client_map = _LSTransportClientMapNew();
+
+            if (!client_map)
+            {
+                g_critical("Unable to allocate client_map, OOM");
+                goto error;
+            }
+
+            char *method_copy = g_strdup(method);
+            if (method_copy)
+            {
+                g_hash_table_replace(signal_category->method_map, (gpointer)method_copy, client_map);
+            }
+            else
+            {
+                _LSTransportClientMapFree(client_map);
+                g_critical("Unable to allocate method_copy, OOM");
+                goto error;
+            }
+        }
+    }
+    else
+    {
+        if (!signal_category->clients)
+        {
+            signal_category->clients = _LSTransportClientMapNew();
+
+            if (!signal_category->clients)
+            {
+                g_critical("Unable to allocate client_map, OOM");
+                goto error;
+            }
+        }
+        client_map = signal_category->clients;
+    }
     
+    guint index;
+
+    if (!_LSTransportClientMapFind(client_map, client, &index))
+    {
+        _SignalMapAddClientRegistration(client, client_map, category,
+                                        client_map == signal_category->clients ? NULL : method);
+    }
+
     _LSTransportClientMapAddRefClient(client_map, client); 
 
     return true;
+
+error:
+    if (_SignalCategoryIsEmpty(signal_category))
+    {
+        g_hash_table_remove(signal_map->category_map, category);
+    }
+    return false;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Add a connected client and its signal registrations to a
+ * snapshot.
+ * 
+ * @param  key          IN  unique name
+ * @param  value        IN  _ClientId
+ * @param  user_data    IN  LSHubState
+ *******************************************************************************
+ */
+static void
+_LSHubStateCollectClient(gpointer key, gpointer value, gpointer user_data)
+{
+    _ClientId *id = value;
+    LSHubState *state = user_data;
+
+    /* a new monitor has to ask to be the monitor again */
+    if (id->is_monitor) return;
+
+    pid_t pid = _LSTransportCredGetPid(_LSTransportClientGetCred(id->client));
+    LSHubStateClient *saved = LSHubStateAddClient(state, id->local.name, id->service_name, pid);
+
+    GHashTable *regs = g_hash_table_lookup(signal_map->client_map, id->client);
+
+    if (regs)
+    {
+        GHashTableIter iter;
+        gpointer map_key, map_value;
+
+        g_hash_table_iter_init(&iter, regs);
+
+        while (g_hash_table_iter_next(&iter, &map_key, &map_value))
+        {
+            _LSTransportClientMap *client_map = map_key;
+            _SignalRegistration *reg = map_value;
+            guint index;
+
+            if (_LSTransportClientMapFind(client_map, id->client, &index))
+            {
+                LSHubStateClientAddSignal(saved, reg->category, reg->method,
+                                          g_array_index(client_map->entries, _LSTransportClientMapEntry, index).ref);
+            }
+        }
+    }
+}
+
+/** 
+ *******************************************************************************
+ * @brief Carry a client that hasn't resumed yet over into a new snapshot, so
+ * that it can still resume if we are restarted again before it does.
+ * 
+ * @param  client   IN  saved client
+ * @param  data     IN  LSHubState being written
+ *******************************************************************************
+ */
+static void
+_LSHubStateCopyClient(LSHubStateClient *client, gpointer data)
+{
+    LSHubState *state = data;
+
+    if (LSHubStateLookup(state, client->unique_name)) return;
+
+    LSHubStateClient *copy = LSHubStateAddClient(state, client->unique_name, client->service_name, client->pid);
+    guint i;
+
+    for (i = 0; i < client->signals->len; i++)
+    {
+        LSHubStateSignal *signal = &g_array_index(client->signals, LSHubStateSignal, i);
+        LSHubStateClientAddSignal(copy, signal->category, signal->method, signal->count);
+    }
+}
+
+static gboolean
+_LSHubStateWrite(gpointer data)
+{
+    LSError lserror;
+    LSErrorInit(&lserror);
+
+    state_write_source = 0;
+
+    LSHubState *state = LSHubStateNew();
+
+    g_hash_table_foreach(connected_clients.by_unique_name, _LSHubStateCollectClient, state);
+
+    if (resumable)
+    {
+        LSHubStateForEach(resumable, _LSHubStateCopyClient, state);
+    }
+
+    if (!LSHubStateWrite(state, state_file_path, &lserror))
+    {
+        LSErrorPrint(&lserror, stderr);
+        LSErrorFree(&lserror);
+    }
+
+    LSHubStateFree(state);
+
+    return FALSE;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Note that the clients or their signal registrations changed. The
+ * snapshot is written shortly after, so that a burst of changes (e.g., at
+ * boot) is written once.
+ *******************************************************************************
+ */
+static void
+_LSHubStateChanged(void)
+{
+    if (!state_file_path || state_write_source) return;
+
+    state_write_source = g_timeout_add(HUB_STATE_WRITE_DELAY_MS, _LSHubStateWrite, NULL);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Let a client of the previous hub instance resume with its unique
+ * name. It has to be the same process (pid) with the same service name,
+ * so clients without credentials (e.g., inet) never resume.
+ * If the digest of its signal registrations matches the one we saved, we
+ * also restore its registrations so that it doesn't have to send them.
+ * 
+ * @param  client           IN  client 
+ * @param  service_name     IN  service name it requested (or NULL)
+ * @param  resume_name      IN  unique name it had (or NULL)
+ * @param  resume_digest    IN  digest of its registrations, as hex (or NULL)
+ * 
+ * @retval  LS_TRANSPORT_REQUEST_NAME_RESUME_*
+ *******************************************************************************
+ */
+static int32_t
+_LSHubResumeClient(_LSTransportClient *client, const char *service_name,
+                   const char *resume_name, const char *resume_digest)
+{
+    if (!resumable || !resume_name)
+    {
+        return LS_TRANSPORT_REQUEST_NAME_RESUME_NONE;
+    }
+
+    LSHubStateClient *saved = LSHubStateLookup(resumable, resume_name);
+
+    if (!saved || g_hash_table_lookup(connected_clients.by_unique_name, resume_name))
+    {
+        return LS_TRANSPORT_REQUEST_NAME_RESUME_NONE;
+    }
+
+    const _LSTransportCred *cred = _LSTransportClientGetCred(client);
+    pid_t pid = cred ? _LSTransportCredGetPid(cred) : LS_PID_INVALID;
+
+    /* the pid is all that ties the client to the saved one, so anyone could
+     * take over the names of a client whose credentials we can't get */
+    if (pid == LS_PID_INVALID)
+    {
+        return LS_TRANSPORT_REQUEST_NAME_RESUME_NONE;
+    }
+
+    if (saved->pid != pid || g_strcmp0(saved->service_name, service_name) != 0)
+    {
+        return LS_TRANSPORT_REQUEST_NAME_RESUME_NONE;
+    }
+
+    int32_t resumed = LS_TRANSPORT_REQUEST_NAME_RESUME_NAME;
+
+    if (resume_digest && g_ascii_strtoull(resume_digest, NULL, 16) == saved->digest)
+    {
+        guint i;
+        int j;
+
+        for (i = 0; i < saved->signals->len; i++)
+        {
+            LSHubStateSignal *signal = &g_array_index(saved->signals, LSHubStateSignal, i);
+
+            for (j = 0; j < signal->count; j++)
+            {
+                if (!_LSHubAddSignal(signal->category, signal->method, client))
+                {
+                    g_critical("OOM, unable to add signal: %s/%s", signal->category, signal->method);
+                }
+            }
+        }
+
+        resumed = LS_TRANSPORT_REQUEST_NAME_RESUME_ALL;
+    }
+
+    _ls_verbose("%s: \"%s\" resumed (%s)\n", __func__, resume_name,
+                resumed == LS_TRANSPORT_REQUEST_NAME_RESUME_ALL ? "with signals" : "name only");
+
+    LSHubStateRemove(resumable, resume_name);
+
+    return resumed;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Give up on a client of the previous hub instance that didn't
+ * resume: clean up its socket and let everyone know it's gone, as if it
+ * had disconnected from us.
+ * 
+ * @param  client   IN  saved client
+ * @param  data     IN  unused
+ *******************************************************************************
+ */
+static void
+_LSHubResumeExpireClient(LSHubStateClient *client, gpointer data)
+{
+    if (!enable_inet)
+    {
+        _LSHubCleanupSocketLocal(client->unique_name);
+    }
+
+    /* the service may have come back up with a new unique name */
+    if (client->service_name &&
+        !g_hash_table_lookup(pending, client->service_name) &&
+        !g_hash_table_lookup(available_services, client->service_name))
+    {
+        _LSHubSendServiceDownSignal(client->service_name, client->unique_name);
+    }
+
+    _LSHubSendServiceDownSignal(client->unique_name, client->unique_name);
+}
+
+static gboolean
+_LSHubResumeTimeout(gpointer data)
+{
+    if (LSHubStateSize(resumable) > 0)
+    {
+        g_message("%u clients of the previous hub didn't resume", LSHubStateSize(resumable));
+    }
+
+    LSHubStateForEach(resumable, _LSHubResumeExpireClient, NULL);
+    LSHubStateFree(resumable);
+    resumable = NULL;
+
+    _LSHubStateChanged();
+
+    return FALSE;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Load the snapshot left behind by the previous hub instance (if
+ * any) and start taking snapshots of our own.
+ *
+ * @param  public_hub   IN  true if this is the public hub
+ *******************************************************************************
+ */
+static void
+_LSHubStateSetup(bool public_hub)
+{
+    LSError lserror;
+    LSErrorInit(&lserror);
+
+    if (g_conf_resume_timeout_sec <= 0)
+    {
+        return;
+    }
+
+    state_file_path = g_build_filename(*pid_dir, public_hub ? HUB_PUBLIC_STATE_FILENAME : HUB_PRIVATE_STATE_FILENAME, NULL);
+
+    resumable = LSHubStateRead(state_file_path, &lserror);
+
+    if (!resumable)
+    {
+        _ls_verbose("%s: %s\n", __func__, lserror.message);
+        LSErrorFree(&lserror);
+        return;
+    }
+
+    g_message("%u clients of the previous hub can resume in the next %d seconds",
+              LSHubStateSize(resumable), g_conf_resume_timeout_sec);
+
+    g_timeout_add_seconds(g_conf_resume_timeout_sec, _LSHubResumeTimeout, NULL);
 }
 
 /** 
@@ -3310,53 +4697,41 @@ _LSHubHandleSignalRegister(_LSTransportMessage* message)
     if (strlen(method) > 0)
     {
         /* method is optional for registration */
-        char *full_path = g_strdup_printf("%s/%s", category, method);
-        
-        if (full_path)
-        {
 #if 0
-            /* SIGNAL DEBUG */
-            if (strcmp(category, SERVICE_STATUS_CATEGORY) == 0)
-            {
-                const _LSTransportCred *cred = _LSTransportClientGetCred(client);
-                g_critical("Registering server status of [\"%s\"] by client: %p "
-                           "(service_name: \"%s\", unique_name: \"%s\", pid: "LS_PID_PRINTF_FORMAT
-                           ", exe: \"%s\")",
-                           method, client, client->service_name, client->unique_name,
-                           LS_PID_PRINTF_CAST(_LSTransportCredGetPid(cred)),
-                           _LSTransportCredGetExePath(cred));
-            }
+        /* SIGNAL DEBUG */
+        if (strcmp(category, SERVICE_STATUS_CATEGORY) == 0)
+        {
+            const _LSTransportCred *cred = _LSTransportClientGetCred(client);
+            g_critical("Registering server status of [\"%s\"] by client: %p "
+                       "(service_name: \"%s\", unique_name: \"%s\", pid: "LS_PID_PRINTF_FORMAT
+                       ", exe: \"%s\")",
+                       method, client, client->service_name, client->unique_name,
+                       LS_PID_PRINTF_CAST(_LSTransportCredGetPid(cred)),
+                       _LSTransportCredGetExePath(cred));
+        }
 #endif
 
-            _LSHubAddSignal(signal_map->method_map, full_path, client);
-            g_free(full_path);
-        }
-        else
+        if (!_LSHubAddSignal(category, method, client))
         {
             g_critical("OOM, unable to add signal: %s/%s", category, method);
         }
     }
     else
     {
-        char *path = g_strdup(category);
-
-        if (path)
-        {
 #if 0
-            if (strcmp(category, SERVICE_STATUS_CATEGORY) == 0)
-            {
-                g_critical("Registering server status of \"%s\" for client: %p (service_name: \"%s\", unique_name: \"%s\")", method, client, client->service_name, client->unique_name);
-            }
-#endif
-            _LSHubAddSignal(signal_map->category_map, path, client);
-            g_free(path);
+        if (strcmp(category, SERVICE_STATUS_CATEGORY) == 0)
+        {
+            g_critical("Registering server status of \"%s\" for client: %p (service_name: \"%s\", unique_name: \"%s\")", method, client, client->service_name, client->unique_name);
         }
-        else
+#endif
+        if (!_LSHubAddSignal(category, NULL, client))
         {
             g_critical("OOM, unable to add signal: \"%s\"", category);
         }
     }
 
+    _LSHubStateChanged();
+
     /* FIXME: we need to create a new "signal reply" function, so that we can
      * differentiate between method call replies and signal registration replies
      * for the shutdown logic */
@@ -3374,22 +4749,100 @@ _LSHubHandleSignalRegister(_LSTransportMessage* message)
         
         if (!_LSTransportSendReply(message, payload, &lserror))
         {
-            g_critical("error sending signal registration reply");
-            LSErrorPrint(&lserror, stderr);
-            LSErrorFree(&lserror);
+            g_critical("error sending signal registration reply");
+            LSErrorPrint(&lserror, stderr);
+            LSErrorFree(&lserror);
+        }
+        g_free(payload);
+        return;
+    }         
+     
+    if (!_LSTransportSendReply(message, "{\"returnValue\":true}", &lserror))
+    {
+        g_critical("error sending signal registration reply");
+        LSErrorPrint(&lserror, stderr);
+        LSErrorFree(&lserror);
+    }
+
+    /* TODO: add reverse lookup */
+}
+
+/** 
+ *******************************************************************************
+ * @brief Process a message registering several signals at once. Each
+ * category/method pair is added as if it came in its own signal register
+ * message and a single reply is sent back.
+ * 
+ * @param  message  IN  signal register many message 
+ *******************************************************************************
+ */
+static void
+_LSHubHandleSignalRegisterMany(_LSTransportMessage* message)
+{
+    LSError lserror;
+    LSErrorInit(&lserror);
+
+    _LSTransportClient *client = _LSTransportMessageGetClient(message);
+    const char *body = _LSTransportMessageGetBody(message);
+    const char *body_end = body + _LSTransportMessageGetBodySize(message);
+    bool all_services = false;
+    int count = 0;
+
+    while (body < body_end)
+    {
+        const char *category = body;
+        const char *category_end = memchr(category, '\0', body_end - category);
+
+        if (!category_end || category_end + 1 >= body_end)
+        {
+            break;
+        }
+
+        const char *method = category_end + 1;
+        const char *method_end = memchr(method, '\0', body_end - method);
+
+        if (!method_end)
+        {
+            break;
+        }
+
+        body = method_end + 1;
+
+        _ls_verbose("%s: category: \"%s\", method: \"%s\", client: %p\n", __func__, category, method, client);
+
+        if (!_LSHubAddSignal(category, method, client))
+        {
+            g_critical("OOM, unable to add signal: %s/%s", category, method);
+        }
+
+        if (method[0] == '\0' && strcmp(category, SERVICE_STATUS_CATEGORY) == 0)
+        {
+            all_services = true;
         }
-        g_free(payload);
-        return;
-    }         
-     
-    if (!_LSTransportSendReply(message, "{\"returnValue\":true}", &lserror))
+
+        count++;
+    }
+
+    if (body < body_end)
+    {
+        g_warning("Malformed signal register many message from client: %p "
+                  "(registered %d signals before the bad entry)", client, count);
+    }
+
+    _LSHubStateChanged();
+
+    /* same ACK as for a single registration; methodless serviceStatus still
+     * gets the current status of all services */
+    gchar *payload = all_services ? _LSHubSignalRegisterAllServices(available_services) : NULL;
+
+    if (!_LSTransportSendReply(message, payload ? payload : "{\"returnValue\":true}", &lserror))
     {
         g_critical("error sending signal registration reply");
         LSErrorPrint(&lserror, stderr);
         LSErrorFree(&lserror);
     }
 
-    /* TODO: add reverse lookup */
+    g_free(payload);
 }
 
 /** 
@@ -3414,31 +4867,25 @@ _LSHubHandleSignal(_LSTransportMessage *message, bool generated_by_hub)
         return;
     }
 
-    /* look up all clients that handle this category */
-    _LSTransportClientMap *client_map = g_hash_table_lookup(signal_map->category_map, category);
+    _SignalCategory *signal_category = g_hash_table_lookup(signal_map->category_map, category);
 
-    if (client_map)
+    if (!signal_category)
     {
-        _LSTransportClientMapForEach(client_map, (GHFunc)_LSHubSendSignal, message);
+        return;
     }
 
-    /* look up all clients that handle this category/method */
-    char *category_method = g_strdup_printf("%s/%s", category, method);
-
-    if (category_method)
+    /* all clients that handle this category */
+    if (signal_category->clients)
     {
-        _LSTransportClientMap *client_map = g_hash_table_lookup(signal_map->method_map, category_method);
+        _LSTransportClientMapForEach(signal_category->clients, (GHFunc)_LSHubSendSignal, message);
+    }
 
-        if (client_map)
-        {
-            _LSTransportClientMapForEach(client_map, (GHFunc)_LSHubSendSignal, message);
-        }
+    /* look up all clients that handle this category/method */
+    _LSTransportClientMap *client_map = g_hash_table_lookup(signal_category->method_map, method);
 
-        g_free(category_method);
-    }
-    else
+    if (client_map)
     {
-        g_critical("OOM, unable to send signal");
+        _LSTransportClientMapForEach(client_map, (GHFunc)_LSHubSendSignal, message);
     }
 }
 
@@ -3490,6 +4937,12 @@ _LSHubSendMonitorMessage(int ignored_fd, _ClientId *id, const char *unique_name)
 
     _LSTransportMessageIterInit(monitor_message, &iter);
     if (!_LSTransportMessageAppendString(&iter, unique_name)) goto error;
+    if (monitor_is_connected)
+    {
+        if (!_LSTransportMessageAppendString(&iter, monitor_filter_names ? monitor_filter_names : "")) goto error;
+        if (!_LSTransportMessageAppendInt32(&iter, monitor_filter_types)) goto error;
+        if (!_LSTransportMessageAppendInt32(&iter, monitor_filter_sample_rate)) goto error;
+    }
     if (!_LSTransportMessageAppendInvalid(&iter)) goto error;
 
     /* set up the connection to the monitor if it exists and we're local */
@@ -3584,6 +5037,28 @@ _LSHubHandleMonitorRequest(_LSTransportMessage *message)
     id->is_monitor = true;
     _LSHubClientIdLocalRef(id);
     monitor = id;
+
+    /* optional filter; an older monitor doesn't send one */
+    const char *filter_names = NULL;
+    _LSTransportMessageIter iter;
+    _LSTransportMessageIterInit(message, &iter);
+
+    g_free(monitor_filter_names);
+    monitor_filter_names = NULL;
+    monitor_filter_types = 0;
+    monitor_filter_sample_rate = 0;
+
+    if (_LSTransportMessageGetString(&iter, &filter_names))
+    {
+        monitor_filter_names = g_strdup(filter_names);
+        _LSTransportMessageIterNext(&iter);
+        _LSTransportMessageGetInt32(&iter, &monitor_filter_types);
+        _LSTransportMessageIterNext(&iter);
+        _LSTransportMessageGetInt32(&iter, &monitor_filter_sample_rate);
+
+        _ls_verbose("%s: monitor filter: names: \"%s\", types: 0x%x, sample rate: %d\n", __func__,
+                    monitor_filter_names ? monitor_filter_names : "", monitor_filter_types, monitor_filter_sample_rate);
+    }
     
     if (monitor_client->unique_name)
     {
@@ -3870,6 +5345,240 @@ error:
     if (reply) _LSTransportMessageUnref(reply);
 }
 
+/** 
+ *******************************************************************************
+ * @brief Get a short name for a message type for the hub statistics.
+ * 
+ * @param  type     IN  message type 
+ * 
+ * @retval  name
+ *******************************************************************************
+ */
+static const char*
+_LSHubMessageTypeName(_LSTransportMessageType type)
+{
+    switch (type)
+    {
+    case _LSTransportMessageTypeRequestNameLocal:   return "RequestNameLocal";
+    case _LSTransportMessageTypeRequestNameInet:    return "RequestNameInet";
+    case _LSTransportMessageTypeNodeUp:             return "NodeUp";
+    case _LSTransportMessageTypeListClients:        return "ListClients";
+    case _LSTransportMessageTypeQueryName:          return "QueryName";
+    case _LSTransportMessageTypeSignalRegister:     return "SignalRegister";
+    case _LSTransportMessageTypeSignalRegisterMany: return "SignalRegisterMany";
+    case _LSTransportMessageTypeSignalUnregister:   return "SignalUnregister";
+    case _LSTransportMessageTypeSignal:             return "Signal";
+    case _LSTransportMessageTypeMonitorRequest:     return "MonitorRequest";
+    case _LSTransportMessageTypeQueryServiceStatus: return "QueryServiceStatus";
+    case _LSTransportMessageTypePushRole:           return "PushRole";
+    case _LSTransportMessageTypeHubStats:           return "HubStats";
+    default:                                        return "Other";
+    }
+}
+
+/** 
+ *******************************************************************************
+ * @brief Get the traffic counters for a connected client as json.
+ * 
+ * @param  id   IN  client id 
+ * 
+ * @retval  json object on success
+ * @retval  NULL on failure
+ *******************************************************************************
+ */
+static struct json_object*
+_LSHubClientStatsGetJson(const _ClientId *id)
+{
+    _LSTransportClient *client = id->client;
+    const _LSTransportCred *cred = _LSTransportClientGetCred(client);
+    const char *exe_path = _LSTransportCredGetExePath(cred);
+
+    struct json_object *client_obj = json_object_new_object();
+
+    if (!client_obj || is_error(client_obj)) return NULL;
+
+    json_object_object_add(client_obj, "unique_name", json_object_new_string(id->local.name ? id->local.name : ""));
+    json_object_object_add(client_obj, "service", json_object_new_string(id->service_name ? id->service_name : ""));
+    json_object_object_add(client_obj, "pid", json_object_new_int(_LSTransportCredGetPid(cred)));
+    json_object_object_add(client_obj, "exe", json_object_new_string(exe_path ? exe_path : ""));
+
+    json_object_object_add(client_obj, "messages_in", json_object_new_int64(client->incoming->received_messages));
+    json_object_object_add(client_obj, "bytes_in", json_object_new_int64(client->incoming->received_bytes));
+    json_object_object_add(client_obj, "query_names", json_object_new_int64(id->query_names));
+    json_object_object_add(client_obj, "signals", json_object_new_int64(id->signals));
+    json_object_object_add(client_obj, "signal_fanout", json_object_new_int64(id->signal_fanout));
+
+    OUTGOING_LOCK(&client->outgoing->lock);
+    json_object_object_add(client_obj, "messages_out", json_object_new_int64(client->outgoing->sent_messages));
+    json_object_object_add(client_obj, "bytes_out", json_object_new_int64(client->outgoing->sent_bytes));
+    json_object_object_add(client_obj, "queued_messages", json_object_new_int64(client->outgoing->queued_messages));
+    json_object_object_add(client_obj, "queued_bytes", json_object_new_int64(client->outgoing->queued_bytes));
+    json_object_object_add(client_obj, "peak_queued_messages", json_object_new_int64(client->outgoing->peak_queued_messages));
+    json_object_object_add(client_obj, "peak_queued_bytes", json_object_new_int64(client->outgoing->peak_queued_bytes));
+    json_object_object_add(client_obj, "congested", json_object_new_boolean(client->outgoing->congested));
+    OUTGOING_UNLOCK(&client->outgoing->lock);
+
+    return client_obj;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Replies with the hub statistics as a json string:
+ *
+ * {"uptime_s": int, "signal_fanout": int, "loop_latency": histogram,
+ *  "clients": [{"unique_name": string, "service": string, "pid": int,
+ *               "exe": string, "messages_in": int, "bytes_in": int,
+ *               "messages_out": int, "bytes_out": int, "query_names": int,
+ *               "signals": int, "signal_fanout": int, "queued_messages": int,
+ *               "queued_bytes": int, "peak_queued_messages": int,
+ *               "peak_queued_bytes": int, "congested": bool},...],
+ *  "handlers": [{"type": string, "id": int, "time": histogram},...]}
+ *
+ * The counters are kept all the time; they're only collected into json
+ * when asked for. "loop_latency" is how late the watchdog's probe ran and
+ * is left out if the probe is turned off.
+ * 
+ * @param  message  IN  hub stats message 
+ *******************************************************************************
+ */
+static void
+_LSHubHandleHubStats(const _LSTransportMessage *message)
+{
+    LS_ASSERT(_LSTransportMessageGetType(message) == _LSTransportMessageTypeHubStats);
+
+    gpointer value = NULL;
+    int i;
+
+    LSError lserror;
+    LSErrorInit(&lserror);
+
+    _LSTransportMessageIter iter;
+    GHashTableIter hash_iter;
+
+    _LSTransportClient *reply_client = _LSTransportMessageGetClient(message);
+
+    _LSTransportMessage *reply = NULL;
+    struct json_object *stats_obj = json_object_new_object();
+    struct json_object *clients_obj = json_object_new_array();
+    struct json_object *handlers_obj = json_object_new_array();
+
+    if (!stats_obj || is_error(stats_obj)) goto error;
+    if (!clients_obj || is_error(clients_obj)) goto error;
+    if (!handlers_obj || is_error(handlers_obj)) goto error;
+
+    g_hash_table_iter_init(&hash_iter, connected_clients.by_unique_name);
+
+    while (g_hash_table_iter_next(&hash_iter, NULL, &value))
+    {
+        struct json_object *client_obj = _LSHubClientStatsGetJson(value);
+
+        if (client_obj)
+        {
+            json_object_array_add(clients_obj, client_obj);
+        }
+    }
+
+    for (i = 0; i <= _LSTransportMessageTypeUnknown; i++)
+    {
+        if (hub_handler_time[i].count == 0)
+        {
+            continue;
+        }
+
+        struct json_object *handler_obj = json_object_new_object();
+
+        if (!handler_obj || is_error(handler_obj)) continue;
+
+        json_object_object_add(handler_obj, "type", json_object_new_string(_LSHubMessageTypeName(i)));
+        json_object_object_add(handler_obj, "id", json_object_new_int(i));
+        json_object_object_add(handler_obj, "time", _LSLatencyHistogramGetJson(&hub_handler_time[i], "us"));
+        json_object_array_add(handlers_obj, handler_obj);
+    }
+
+    json_object_object_add(stats_obj, "uptime_s", json_object_new_int((_LSLatencyNowUs() - hub_start_us) / 1000000));
+    json_object_object_add(stats_obj, "signal_fanout", json_object_new_int64(hub_signal_fanout));
+
+    struct json_object *loop_latency_obj = LSHubWatchdogGetProbeJson();
+    if (loop_latency_obj)
+    {
+        json_object_object_add(stats_obj, "loop_latency", loop_latency_obj);
+    }
+
+    json_object_object_add(stats_obj, "clients", clients_obj);
+    clients_obj = NULL;
+    json_object_object_add(stats_obj, "handlers", handlers_obj);
+    handlers_obj = NULL;
+
+    reply = _LSTransportMessageNewRef(LS_TRANSPORT_MESSAGE_DEFAULT_PAYLOAD_SIZE);
+
+    if (!reply) goto error;
+
+    _LSTransportMessageSetType(reply, _LSTransportMessageTypeHubStatsReply);
+
+    _LSTransportMessageIterInit(reply, &iter);
+
+    if (!_LSTransportMessageAppendString(&iter, json_object_to_json_string(stats_obj))) goto error;
+    if (!_LSTransportMessageAppendInvalid(&iter)) goto error;
+
+    if (!_LSTransportSendMessage(reply, reply_client, NULL, &lserror))
+    {
+        LSErrorPrint(&lserror, stderr);
+        LSErrorFree(&lserror);
+    }
+
+error:
+    if (reply) _LSTransportMessageUnref(reply);
+    if (clients_obj && !is_error(clients_obj)) json_object_put(clients_obj);
+    if (handlers_obj && !is_error(handlers_obj)) json_object_put(handlers_obj);
+    if (stats_obj && !is_error(stats_obj)) json_object_put(stats_obj);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Update the statistics of the client that sent a message once the
+ * message has been handled.
+ * 
+ * @param  message      IN  message
+ * @param  type         IN  message type
+ * @param  start_us     IN  when handling the message started
+ * @param  fanout_start IN  @ref hub_signal_fanout when handling started
+ *******************************************************************************
+ */
+static void
+_LSHubMessageHandled(_LSTransportMessage *message, _LSTransportMessageType type,
+                     gint64 start_us, guint64 fanout_start)
+{
+    if ((unsigned int)type > _LSTransportMessageTypeUnknown)
+    {
+        type = _LSTransportMessageTypeUnknown;
+    }
+
+    _LSLatencyHistogramAdd(&hub_handler_time[type], _LSLatencyNowUs() - start_us);
+
+    if (type != _LSTransportMessageTypeQueryName && type != _LSTransportMessageTypeSignal)
+    {
+        return;
+    }
+
+    _LSTransportClient *client = _LSTransportMessageGetClient(message);
+    _ClientId *id = g_hash_table_lookup(connected_clients.by_fd, GINT_TO_POINTER(client->channel.fd));
+
+    if (!id)
+    {
+        return;
+    }
+
+    if (type == _LSTransportMessageTypeQueryName)
+    {
+        id->query_names++;
+    }
+    else
+    {
+        id->signals++;
+        id->signal_fanout += hub_signal_fanout - fanout_start;
+    }
+}
+
 /** 
  *******************************************************************************
  * @brief Process incoming messages from underlying transport.
@@ -3883,7 +5592,13 @@ error:
 static LSMessageHandlerResult
 _LSHubHandleMessage(_LSTransportMessage* message, void *context)
 {
-    switch (_LSTransportMessageGetType(message))
+    _LSTransportMessageType type = _LSTransportMessageGetType(message);
+    gint64 start_us = _LSLatencyNowUs();
+    guint64 fanout_start = hub_signal_fanout;
+
+    LSHubWatchdogSetCurrentMessage(_LSHubMessageTypeName(type));
+
+    switch (type)
     {
     case _LSTransportMessageTypeRequestNameLocal:
     case _LSTransportMessageTypeRequestNameInet:
@@ -3901,6 +5616,10 @@ _LSHubHandleMessage(_LSTransportMessage* message, void *context)
         _LSHubHandleListClients(message);
         break;
 
+    case _LSTransportMessageTypeHubStats:
+        _LSHubHandleHubStats(message);
+        break;
+
     case _LSTransportMessageTypeQueryName:
         _LSHubHandleQueryName(message);
         break;
@@ -3908,6 +5627,10 @@ _LSHubHandleMessage(_LSTransportMessage* message, void *context)
     case _LSTransportMessageTypeSignalRegister:
         _LSHubHandleSignalRegister(message);
         break;
+
+    case _LSTransportMessageTypeSignalRegisterMany:
+        _LSHubHandleSignalRegisterMany(message);
+        break;
     
     case _LSTransportMessageTypeSignalUnregister:
         _LSHubHandleSignalUnregister(message);
@@ -3932,13 +5655,123 @@ _LSHubHandleMessage(_LSTransportMessage* message, void *context)
     case _LSTransportMessageTypeMethodCall:
     case _LSTransportMessageTypeReply:
     default:
-        g_critical("Received unhandled message type: %d", _LSTransportMessageGetType(message));
+        g_critical("Received unhandled message type: %d", type);
         break;
     }
 
+    _LSHubMessageHandled(message, type, start_us, fanout_start);
+
+    LSHubWatchdogSetCurrentMessage(NULL);
+
+    return LSMessageHandlerResultHandled;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Handle everything the I/O threads handed over so far. Items that
+ * arrive while we're at it are left for the next drain, so that other
+ * sources on the main context aren't starved.
+ * 
+ * @param  data     IN  unused 
+ * 
+ * @retval  FALSE always
+ *******************************************************************************
+ */
+static gboolean
+_LSHubHandleHandoffs(gpointer data)
+{
+    /* cleared first, so a handoff from now on schedules another drain */
+    g_atomic_int_set(&handoff_scheduled, 0);
+
+    gint count = g_async_queue_length(handoff_queue);
+
+    while (count-- > 0)
+    {
+        _LSHubHandoff *item = g_async_queue_try_pop(handoff_queue);
+
+        if (!item) break;
+
+        if (item->message)
+        {
+            LSMessageHandlerResult ret = _LSHubHandleMessage(item->message, NULL);
+            _LSTransportHandleMessageResult(item->message, ret);
+            _LSTransportMessageUnref(item->message);
+        }
+        else
+        {
+            _LSHubHandleDisconnect(item->client, item->type, NULL);
+            _LSTransportClientUnref(item->client);
+        }
+
+        g_slice_free(_LSHubHandoff, item);
+    }
+
+    return FALSE;
+}
+
+static void
+_LSHubHandOff(_LSHubHandoff *item)
+{
+    g_async_queue_push(handoff_queue, item);
+
+    if (g_atomic_int_compare_and_exchange(&handoff_scheduled, 0, 1))
+    {
+        GSource *source = g_idle_source_new();
+        g_source_set_priority(source, G_PRIORITY_DEFAULT);
+        g_source_set_callback(source, _LSHubHandleHandoffs, NULL, NULL);
+        g_source_attach(source, g_main_loop_get_context(mainloop));
+        g_source_unref(source);
+    }
+}
+
+/** 
+ *******************************************************************************
+ * @brief Message handler used with "IoThreads". Called on an I/O thread;
+ * the message is handled on the main thread by @ref _LSHubHandleHandoffs.
+ * 
+ * @param  message  IN  message 
+ * @param  context  IN  unused 
+ * 
+ * @retval LSMessageHandlerResultHandled always (the result of actually
+ * handling it is acted on by the main thread)
+ *******************************************************************************
+ */
+static LSMessageHandlerResult
+_LSHubHandOffMessage(_LSTransportMessage *message, void *context)
+{
+    _LSHubHandoff *item = g_slice_new0(_LSHubHandoff);
+
+    _LSTransportMessageRef(message);
+    item->message = message;
+
+    _LSHubHandOff(item);
+
     return LSMessageHandlerResultHandled;
 }
 
+/** 
+ *******************************************************************************
+ * @brief Disconnect handler used with "IoThreads". The ref we take keeps
+ * the client (and its fd, which is what we look it up by) around until the
+ * main thread has handled the disconnect.
+ * 
+ * @param  client   IN  client that disconnected 
+ * @param  type     IN  disconnect reason 
+ * @param  context  IN  unused 
+ *******************************************************************************
+ */
+static void
+_LSHubHandOffDisconnect(_LSTransportClient *client, _LSTransportDisconnectType type, void *context)
+{
+    _LSHubHandoff *item = g_slice_new0(_LSHubHandoff);
+
+    _LSTransportClientRef(client);
+    item->client = client;
+    item->type = type;
+
+    _LSHubHandOff(item);
+}
+
 /** 
  *******************************************************************************
  * @brief Checks to see if the hub is already running. It saves the PID
@@ -4054,6 +5887,12 @@ main(int argc, char *argv[])
     GOptionContext *opt_context = NULL;
     _ls_debug_tracing = 0;
 
+    /* needed before any threads are started ("IoThreads") */
+    if (!g_thread_supported())
+    {
+        g_thread_init(NULL);
+    }
+
     opt_context = g_option_context_new("- Luna Service Hub");
     g_option_context_add_main_entries(opt_context, opt_entries, NULL);
 
@@ -4090,6 +5929,8 @@ main(int argc, char *argv[])
 
     _ls_verbose("hub starting\n");
 
+    hub_start_us = _LSLatencyNowUs();
+
     mainloop = g_main_loop_new(NULL, FALSE);
 
     if (!mainloop)
@@ -4164,10 +6005,28 @@ main(int argc, char *argv[])
         g_critical("Unable to allocate signal map");
     }
 
+    _LSHubStateSetup(public);
+
+    /* read exe paths and cmdlines off the mainloop; failing that they're
+     * read inline when clients connect */
+    if (!_LSTransportCredResolveInit(&lserror))
+    {
+        LSErrorPrint(&lserror, stderr);
+        LSErrorFree(&lserror);
+    }
+
     _LSHubHandler.msg_handler = _LSHubHandleMessage;
     _LSHubHandler.msg_context = NULL;
     _LSHubHandler.disconnect_handler = _LSHubHandleDisconnect;
     _LSHubHandler.disconnect_context = NULL;
+
+    if (g_conf_io_threads > 0)
+    {
+        /* the transport calls these on the I/O threads */
+        handoff_queue = g_async_queue_new();
+        _LSHubHandler.msg_handler = _LSHubHandOffMessage;
+        _LSHubHandler.disconnect_handler = _LSHubHandOffDisconnect;
+    }
     _LSHubHandler.message_failure_handler = NULL;
     _LSHubHandler.message_failure_context = NULL;
 
@@ -4179,6 +6038,20 @@ main(int argc, char *argv[])
         g_critical("Unable to initialize transport");
     }
 
+    _LSTransportSetSocketBufferLimits(hub_transport, g_conf_socket_buffer_min, g_conf_socket_buffer_max);
+
+    if (!_LSTransportSetEpollDispatch(hub_transport, g_conf_epoll_dispatch, &lserror))
+    {
+        LSErrorPrint(&lserror, stderr);
+        LSErrorFree(&lserror);
+    }
+
+    if (!_LSTransportSetShards(hub_transport, g_conf_io_threads, &lserror))
+    {
+        LSErrorPrint(&lserror, stderr);
+        LSErrorFree(&lserror);
+    }
+
     if (enable_inet)
     {
         uint16_t hub_inet_port = 0;
@@ -4193,7 +6066,7 @@ main(int argc, char *argv[])
         }
 
         /* inet */
-        if (!_LSTransportSetupListenerInet(hub_transport, hub_inet_port, &lserror))
+        if (!_LSTransportSetupListenerInet(_LSTransportGetBus(hub_transport), hub_inet_port, &lserror))
         {
             LSErrorPrint(&lserror, stderr);
             LSErrorFree(&lserror);
@@ -4214,7 +6087,7 @@ main(int argc, char *argv[])
         }
 
         /* everyone needs to be able to talk to the hub */
-        if (!_LSTransportSetupListenerLocal(hub_transport, hub_local_addr, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH, &lserror))
+        if (!_LSTransportSetupListenerLocal(_LSTransportGetBus(hub_transport), hub_local_addr, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH, &lserror))
         {
             LSErrorPrint(&lserror, stderr);
             LSErrorFree(&lserror);
@@ -4278,6 +6151,14 @@ main(int argc, char *argv[])
     g_main_loop_run(mainloop);
     g_main_loop_unref(mainloop);
 
+    /* clients reconnect to the next hub instance, so leave it an up to date
+     * snapshot */
+    if (state_write_source)
+    {
+        g_source_remove(state_write_source);
+        _LSHubStateWrite(NULL);
+    }
+
     /* TODO: clean up other allocations */
     _SignalMapFree(signal_map);
 
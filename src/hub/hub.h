@@ -26,8 +26,11 @@
 #include <stdbool.h>
 #include "error.h"
 
-bool ServiceInitMap(LSError *lserror);
+bool ServiceInitMap(const char **dirs, LSError *lserror);
+void ServiceFinishMap(void);
 bool ParseServiceDirectory(const char *path, LSError *lserror);
+bool ServiceFileUpdate(const char *dir, const char *filename);
+void DynamicServiceWarmStart(void);
 bool SetupSignalHandler(int signal, void (*handler)(int));
 const char* IsMediaService(const char *service_name);
 bool LSHubSendConfScanCompleteSignal(void);
@@ -25,10 +25,12 @@
 
 #include "transport.h"
 #include "transport_utils.h"
+#include "utf8.h"
 
 #include "hub.h"
 #include "conf.h"
 #include "security.h"
+#include "file_cache.h"
 
 #define ROLE_FILE_SUFFIX    ".json"
 
@@ -50,12 +52,37 @@
 
 #define PALM_SERVICE_PREFIX     "com.palm."
 
+#define PERMISSION_CACHE_MAX    1024    /**< max remembered QueryName decisions */
+
+#define PERMISSION_LOG_INTERVAL_SEC 60  /**< how often repeated permission messages are summarized */
+
+#define ROLE_PARSE_THREADS_MAX  4       /**< max threads parsing role files */
+
 static inline bool _LSTransportSupportsSecurityFeatures(const _LSTransport *transport);
 static inline bool _LSHubClientExePathMatches(const _LSTransportClient *client, const char *path);
+static void _LSHubPermissionCacheFlush(void);
+static void _LSHubPermissionCacheClientRemove(const _LSTransportClient *client);
+static void _LSHubPermissionCacheServiceRemove(const char *service_name);
+
+/**
+ * Node of the trie that the literal ("com.palm.foo") and prefix
+ * ("com.palm.*") patterns of a queue are compiled into. Nodes live in a
+ * GArray and refer to each other by index; node 0 is the root, so an index
+ * of 0 means "none".
+ */
+typedef struct _LSHubPatternTrieNode {
+    char c;                 /**< byte on the edge leading to this node */
+    bool exact;             /**< a literal pattern ends here */
+    bool prefix;            /**< a prefix pattern ends here (anything below matches) */
+    guint first_child;
+    guint next_sibling;
+} _LSHubPatternTrieNode;
 
 struct _LSHubPatternQueue {
     int ref;
-    GQueue *q;
+    GQueue *q;              /**< _LSHubPatternSpec in the order they were added */
+    GArray *trie;           /**< compiled literal and prefix patterns */
+    GPtrArray *globs;       /**< any other patterns (strings owned by the specs in q) */
 };
 
 typedef struct _LSHubPatternQueue _LSHubPatternQueue;
@@ -63,7 +90,6 @@ typedef struct _LSHubPatternQueue _LSHubPatternQueue;
 struct _LSHubPatternSpec {
     int ref;
     const char *pattern_str;
-    GPatternSpec *pattern_spec;
 };
 
 typedef struct _LSHubPatternSpec _LSHubPatternSpec;
@@ -100,6 +126,59 @@ static GHashTable *role_map = NULL;
  */
 static GHashTable *permission_map = NULL;
 
+/**
+ * Hash of QueryName decisions (see _LSHubPermissionCacheKey()) to
+ * GINT_TO_POINTER() of PERMISSION_CACHE_* bits.
+ *
+ * The decisions only depend on the maps above and the conf, so this is
+ * flushed whenever they change.
+ */
+static GHashTable *permission_cache = NULL;
+
+/**
+ * Bits of a permission_cache value. The messages that the original decision
+ * printed are remembered so repeats still reach the log (rate limited, see
+ * _LSHubPermissionLogShouldPrint()).
+ */
+#define PERMISSION_CACHE_VALID              (1 << 0)    /**< always set, keeps values non-NULL */
+#define PERMISSION_CACHE_ALLOWED            (1 << 1)
+#define PERMISSION_CACHE_OUTBOUND_LOGGED    (1 << 2)
+#define PERMISSION_CACHE_INBOUND_LOGGED     (1 << 3)
+
+/**
+ * Permission messages printed recently: key built by
+ * _LSHubPermissionLogKey() to _LSHubPermissionLog
+ */
+static GHashTable *permission_log = NULL;
+static guint permission_log_source = 0;
+
+/**
+ * Bits of PERMISSION_CACHE_*_LOGGED set by _LSHubPrintPermissionsMessage()
+ * while a decision is being made
+ */
+static int permission_logged = 0;
+
+/**
+ * Role files parsed by previous scans: full path to _LSHubRoleFile
+ */
+static LSHubFileCache *role_file_cache = NULL;
+
+/** What a role file parses to */
+typedef struct _LSHubRoleFile
+{
+    LSHubRole *role;        /**< NULL if the file has no valid role */
+    GSList *perm_list;      /**< list of LSHubPermission refs */
+} _LSHubRoleFile;
+
+/** One role file in a directory scan */
+typedef struct _LSHubRoleFileJob
+{
+    char *full_path;
+    LSHubFileStamp stamp;
+    _LSHubRoleFile *role_file;
+    bool cached;            /**< role_file came from role_file_cache */
+} _LSHubRoleFileJob;
+
 static _LSHubPatternSpec*
 _LSHubPatternSpecNew(const char *pattern)
 {
@@ -112,17 +191,12 @@ _LSHubPatternSpecNew(const char *pattern)
         ret->pattern_str = g_strdup(pattern);
 
         if (!ret->pattern_str) goto error;
-
-        ret->pattern_spec = g_pattern_spec_new(pattern);
-
-        if (!ret->pattern_spec) goto error;
     }
 
     return ret;
 
 error:
-    if (ret->pattern_str) g_free((char*)ret->pattern_str);
-    if (ret->pattern_spec) g_pattern_spec_free(ret->pattern_spec);
+    g_slice_free(_LSHubPatternSpec, ret);
     return NULL;
 }
 
@@ -156,7 +230,6 @@ _LSHubPatternSpecFree(_LSHubPatternSpec *pattern)
     LS_ASSERT(pattern != NULL);
 
     g_free((char*)pattern->pattern_str);
-    g_pattern_spec_free(pattern->pattern_spec);
     g_slice_free(_LSHubPatternSpec, pattern);
 }
 
@@ -183,7 +256,12 @@ _LSHubPatternQueueNew(void)
 
     if (q)
     {
+        _LSHubPatternTrieNode root = { 0 };
+
         q->q = g_queue_new();
+        q->trie = g_array_new(FALSE, TRUE, sizeof(_LSHubPatternTrieNode));
+        g_array_append_val(q->trie, root);
+        q->globs = g_ptr_array_new();
     }
     
     return q;
@@ -226,6 +304,8 @@ _LSHubPatternQueueFree(_LSHubPatternQueue *q)
     }
 
     g_queue_free(q->q);
+    g_array_free(q->trie, TRUE);
+    g_ptr_array_free(q->globs, TRUE);
     g_slice_free(_LSHubPatternQueue, q);
 }
 
@@ -245,6 +325,146 @@ _LSHubPatternQueueUnref(_LSHubPatternQueue *q)
     return false;
 }
 
+static void
+_LSHubPatternTrieInsert(GArray *trie, const char *str, size_t len, bool prefix)
+{
+    guint index = 0;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        guint child = g_array_index(trie, _LSHubPatternTrieNode, index).first_child;
+
+        while (child && g_array_index(trie, _LSHubPatternTrieNode, child).c != str[i])
+        {
+            child = g_array_index(trie, _LSHubPatternTrieNode, child).next_sibling;
+        }
+
+        if (!child)
+        {
+            _LSHubPatternTrieNode node = { 0 };
+
+            node.c = str[i];
+            node.next_sibling = g_array_index(trie, _LSHubPatternTrieNode, index).first_child;
+            g_array_append_val(trie, node);
+
+            child = trie->len - 1;
+            g_array_index(trie, _LSHubPatternTrieNode, index).first_child = child;
+        }
+
+        index = child;
+    }
+
+    if (prefix)
+    {
+        g_array_index(trie, _LSHubPatternTrieNode, index).prefix = true;
+    }
+    else
+    {
+        g_array_index(trie, _LSHubPatternTrieNode, index).exact = true;
+    }
+}
+
+static bool
+_LSHubPatternTrieMatch(const GArray *trie, const char *str)
+{
+    const _LSHubPatternTrieNode *node = &g_array_index(trie, _LSHubPatternTrieNode, 0);
+
+    while (!node->prefix)
+    {
+        if (*str == '\0')
+        {
+            return node->exact;
+        }
+
+        guint child = node->first_child;
+
+        while (child && g_array_index(trie, _LSHubPatternTrieNode, child).c != *str)
+        {
+            child = g_array_index(trie, _LSHubPatternTrieNode, child).next_sibling;
+        }
+
+        if (!child)
+        {
+            return false;
+        }
+
+        node = &g_array_index(trie, _LSHubPatternTrieNode, child);
+        str++;
+    }
+
+    return true;
+}
+
+/* Same semantics as GPatternSpec ('*' matches any run of characters, '?'
+ * matches a single UTF-8 character), but without needing the reversed
+ * string or any allocation. Both strings must be valid UTF-8. */
+static bool
+_LSHubPatternGlobMatch(const char *pattern, const char *str)
+{
+    const char *star_pattern = NULL;
+    const char *star_str = NULL;
+
+    while (*str)
+    {
+        if (*pattern == '*')
+        {
+            star_pattern = ++pattern;
+            star_str = str;
+        }
+        else if (*pattern == '?')
+        {
+            pattern++;
+            str = g_utf8_next_char(str);
+        }
+        else if (*pattern == *str)
+        {
+            pattern++;
+            str++;
+        }
+        else if (star_pattern)
+        {
+            /* let the last '*' swallow one more character and retry */
+            pattern = star_pattern;
+            star_str = g_utf8_next_char(star_str);
+            str = star_str;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    while (*pattern == '*')
+    {
+        pattern++;
+    }
+
+    return *pattern == '\0';
+}
+
+/* add the pattern to the queue's compiled matcher */
+static void
+_LSHubPatternQueueCompile(_LSHubPatternQueue *q, const _LSHubPatternSpec *pattern)
+{
+    const char *str = pattern->pattern_str;
+    size_t len = strlen(str);
+    const char *wildcard = strpbrk(str, "*?");
+
+    if (!wildcard)
+    {
+        _LSHubPatternTrieInsert(q->trie, str, len, false);
+    }
+    else if (wildcard == str + len - 1 && *wildcard == '*')
+    {
+        _LSHubPatternTrieInsert(q->trie, str, len - 1, true);
+    }
+    else
+    {
+        g_ptr_array_add(q->globs, (gpointer)str);
+    }
+}
+
 static void
 _LSHubPatternQueuePushTail(_LSHubPatternQueue *q, _LSHubPatternSpec *pattern)
 {
@@ -253,6 +473,7 @@ _LSHubPatternQueuePushTail(_LSHubPatternQueue *q, _LSHubPatternSpec *pattern)
 
     _LSHubPatternSpecRef(pattern);
     g_queue_push_tail(q->q, pattern);
+    _LSHubPatternQueueCompile(q, pattern);
 }
 
 void
@@ -288,44 +509,27 @@ _LSHubPatternQueueHasMatch(const _LSHubPatternQueue *q, const char *str)
     LS_ASSERT(q != NULL);
     LS_ASSERT(str != NULL);
 
-    GList *list = NULL;
-    char *rev_str = NULL;
-    bool ret = false;
-
-    list = q->q->head;
+    guint i;
 
-    if (!g_utf8_validate(str, -1, NULL))
+    if (!_LSUtf8Validate(str, -1, NULL))
     {
-        ret = false;
-        goto Exit;
+        return false;
     }
 
-    rev_str = g_utf8_strreverse(str, -1);
-
-    if (!rev_str)
+    if (_LSHubPatternTrieMatch(q->trie, str))
     {
-        ret = false;
-        goto Exit;
+        return true;
     }
 
-    while (list)
+    for (i = 0; i < q->globs->len; i++)
     {
-        _LSHubPatternSpec *pattern = (_LSHubPatternSpec*)list->data;
-        if (g_pattern_match(pattern->pattern_spec, strlen(str), str, rev_str))
+        if (_LSHubPatternGlobMatch(g_ptr_array_index(q->globs, i), str))
         {
-            ret = true;
-            goto Exit;
+            return true;
         }
-
-        list = list->next;
     }
 
-    ret = false;
-
-Exit:
-    if (rev_str) g_free(rev_str);
-
-    return ret;
+    return false;
 }
 
 static void
@@ -1231,171 +1435,612 @@ exit:
     return ret;
 }
 
-bool
-ParseRoleDirectory(const char *path, GHashTable *role_hash, GHashTable *perm_hash, LSError *lserror)
+static void
+_LSHubRoleFileFree(_LSHubRoleFile *role_file)
 {
-    GError *gerror = NULL;
-    const char *filename = NULL;
+    LS_ASSERT(role_file != NULL);
 
-    _ls_verbose("%s: parsing role directory: \"%s\"\n", __func__, path);
-
-    GDir *dir = g_dir_open(path, 0, &gerror);
+    if (role_file->role) LSHubRoleUnref(role_file->role);
 
-    if (!dir)
+    for (; role_file->perm_list != NULL;
+         role_file->perm_list = g_slist_delete_link(role_file->perm_list, role_file->perm_list))
     {
-        _LSErrorSetFromGError(lserror, gerror);
-        return false;
+        LSHubPermissionUnref(role_file->perm_list->data);
     }
 
-    while ((filename = g_dir_read_name(dir)) != NULL)
-    {
-        /* check file extension */
-        if (g_str_has_suffix(filename, ROLE_FILE_SUFFIX))
-        {
-            char *full_path = g_strconcat(path, "/", filename, NULL);
+#ifdef MEMCHECK
+    memset(role_file, 0xFF, sizeof(_LSHubRoleFile));
+#endif
 
-            LSHubRole *role = NULL;
-            GSList *perm_list = NULL;
+    g_slice_free(_LSHubRoleFile, role_file);
+}
 
-            /* Create role and permission objects */
-            struct json_object *json = NULL;
-            if (!ParseJSONFile(full_path, &json, lserror))
-            {
-                LSErrorPrint(lserror, stderr);
-                LSErrorFree(lserror);
-                goto next;
-            }
+static void
+_LSHubPatternQueueSave(const _LSHubPatternQueue *q, GByteArray *out)
+{
+    GList *list = NULL;
 
-            if (!ParseJSONGetRole(json, full_path, &role, lserror))
-            {
-                LSErrorPrint(lserror, stderr);
-                LSErrorFree(lserror);
-            }
+    LSHubFileRecordPutUint32(out, g_queue_get_length(q->q));
 
+    for (list = q->q->head; list != NULL; list = list->next)
+    {
+        _LSHubPatternSpec *pattern = (_LSHubPatternSpec*)list->data;
+        LSHubFileRecordPutString(out, pattern->pattern_str);
+    }
+}
 
-            if (!ParseJSONGetPermissions(json, full_path, &perm_list, lserror))
-            {
-                LSErrorPrint(lserror, stderr);
-                LSErrorFree(lserror);
-            }
+/**
+ *******************************************************************************
+ * @brief Write a parsed role file to the role file cache snapshot.
+ *
+ * @code
+ * exe_path:string (NULL if there's no role) [type:u32 names...]
+ * count:u32 { service:string inbound... outbound... }...
+ *
+ * names, inbound, outbound = count:u32 pattern:string...
+ * @endcode
+ *
+ * @param  data     IN  _LSHubRoleFile
+ * @param  out      IN  snapshot being written
+ *******************************************************************************
+ */
+static void
+_LSHubRoleFileSave(gconstpointer data, GByteArray *out)
+{
+    const _LSHubRoleFile *role_file = data;
+    const GSList *iter = NULL;
 
-            /* Add role object to hash table */
-            if (role)
-            {
-                /* Don't add the role (but do add permissions) for a triton
-                 * service, since triton will push the role file when it wants to
-                 * use it
-                 *
-                 * Similarly, don't add the role for a mojo app, since they
-                 * do not register for a service name (sysmgr just sets the
-                 * appId and we do the check on that */
-                if (strcmp(role->exe_path, g_conf_triton_service_exe_path) != 0 &&
-                    strcmp(role->exe_path, g_conf_mojo_app_exe_path) != 0)
-                {
-                    if (!LSHubRoleMapAddRef(role, lserror))
-                    {
-                        LSErrorPrint(lserror, stderr);
-                        LSErrorFree(lserror);
-                    }
-                }
-            }
-                
-            /* Add permission object to hash table */
-            for (; perm_list != NULL; perm_list = g_slist_delete_link(perm_list, perm_list)/*perm_list = g_slist_next(perm_list)*/)
-            {
-                LSHubPermission *perm = perm_list->data;
-
-                if (!LSHubPermissionMapAddRef(perm, lserror))
-                {
-                    LSErrorPrint(lserror, stderr);
-                    LSErrorFree(lserror);
-                }
-                LSHubPermissionUnref(perm);
-            }
-           
-next: 
-            if (role) LSHubRoleUnref(role);
-            if (json && !is_error(json)) json_object_put(json);
-            g_free(full_path);
-        }
+    if (role_file->role)
+    {
+        LSHubFileRecordPutString(out, role_file->role->exe_path);
+        LSHubFileRecordPutUint32(out, role_file->role->type);
+        _LSHubPatternQueueSave(role_file->role->allowed_names, out);
+    }
+    else
+    {
+        LSHubFileRecordPutString(out, NULL);
     }
 
-    g_dir_close(dir);
+    LSHubFileRecordPutUint32(out, g_slist_length(role_file->perm_list));
 
-    return true;
+    for (iter = role_file->perm_list; iter != NULL; iter = g_slist_next(iter))
+    {
+        const LSHubPermission *perm = iter->data;
+
+        LSHubFileRecordPutString(out, perm->service_name);
+        _LSHubPatternQueueSave(perm->inbound, out);
+        _LSHubPatternQueueSave(perm->outbound, out);
+    }
 }
 
-bool
-LSHubPushRole(const _LSTransportClient *client, const char *path, LSError *lserror)
+/**
+ *******************************************************************************
+ * @brief Rebuild a role file written by _LSHubRoleFileSave(). The patterns
+ * go through the same Add functions as when parsing the JSON.
+ *
+ * @param  record   IN  saved role file
+ *
+ * @retval  _LSHubRoleFile on success
+ * @retval  NULL if the record is malformed
+ *******************************************************************************
+ */
+static _LSHubRoleFile*
+_LSHubRoleFileLoad(LSHubFileRecord *record)
 {
-    bool ret = false;
-    struct json_object *json = NULL;
-    LSHubRole *role = NULL;
+    LSError lserror;
+    LSErrorInit(&lserror);
 
-    /* Remove current role from active role map if there is one */
-    const _LSTransportCred *cred = _LSTransportClientGetCred(client);
+    const char *str = NULL;
+    guint32 type = 0;
+    guint32 count = 0;
+    guint32 num_patterns = 0;
+    guint32 i = 0;
+    guint32 j = 0;
 
-    if (!cred)
-    {
-        _LSErrorSet(lserror, LS_TRANSPORT_PUSH_ROLE_PERMISSION_DENIED, LS_TRANSPORT_PUSH_ROLE_PERMISSION_DENIED_TEXT);
-        goto exit;
-    }
+    _LSHubRoleFile *role_file = g_slice_new0(_LSHubRoleFile);
 
-    /* DFISH-23679: Only root users can push a role */
-    uid_t uid = _LSTransportCredGetUid(cred);
+    if (!LSHubFileRecordGetString(record, &str)) goto error;
 
-    if (uid != 0)
+    if (str)
     {
-        _LSErrorSet(lserror, LS_TRANSPORT_PUSH_ROLE_PERMISSION_DENIED, LS_TRANSPORT_PUSH_ROLE_PERMISSION_DENIED_TEXT);
-        goto exit;
+        if (!LSHubFileRecordGetUint32(record, &type) ||
+            !LSHubFileRecordGetUint32(record, &num_patterns))
+        {
+            goto error;
+        }
+
+        role_file->role = LSHubRoleNewRef(str, (LSHubRoleType)(gint32)type);
+
+        if (!role_file->role) goto error;
+
+        for (j = 0; j < num_patterns; j++)
+        {
+            if (!LSHubFileRecordGetString(record, &str) || !str ||
+                !LSHubRoleAddAllowedName(role_file->role, str, &lserror))
+            {
+                goto error;
+            }
+        }
     }
 
-    pid_t pid = _LSTransportCredGetPid(cred);
+    if (!LSHubFileRecordGetUint32(record, &count)) goto error;
 
-    /* Unref the existing role for this pid if there is one. */
-    if ((role = LSHubActiveRoleMapLookup(pid)) != NULL)
+    for (i = 0; i < count; i++)
     {
-        /* Check that this client is allowed to push a role */
-        if (!LSHubClientGetPrivileged(client))
+        if (!LSHubFileRecordGetString(record, &str) || !str) goto error;
+
+        LSHubPermission *perm = LSHubPermissionNewRef(str);
+
+        if (!perm) goto error;
+
+        /* in saved order once reversed below */
+        role_file->perm_list = g_slist_prepend(role_file->perm_list, perm);
+
+        if (!LSHubFileRecordGetUint32(record, &num_patterns)) goto error;
+
+        for (j = 0; j < num_patterns; j++)
         {
-            _LSErrorSet(lserror, LS_TRANSPORT_PUSH_ROLE_PERMISSION_DENIED, LS_TRANSPORT_PUSH_ROLE_PERMISSION_DENIED_TEXT);
-            goto exit;
+            if (!LSHubFileRecordGetString(record, &str) || !str ||
+                !LSHubPermissionAddAllowedInbound(perm, str, &lserror))
+            {
+                goto error;
+            }
         }
 
-        /* Verify that there should only be a single ref and the role is freed */
-        if (!LSHubActiveRoleMapUnref(pid))
+        if (!LSHubFileRecordGetUint32(record, &num_patterns)) goto error;
+
+        for (j = 0; j < num_patterns; j++)
         {
-            _LSErrorSet(lserror, LS_TRANSPORT_PUSH_ROLE_DUPLICATE, LS_TRANSPORT_PUSH_ROLE_DUPLICATE_TEXT);
-            goto exit;
+            if (!LSHubFileRecordGetString(record, &str) || !str ||
+                !LSHubPermissionAddAllowedOutbound(perm, str, &lserror))
+            {
+                goto error;
+            }
         }
     }
-    else
-    {
-        /* Couldn't verify that this pid is allowed to push a role */
-        _LSErrorSet(lserror, LS_TRANSPORT_PUSH_ROLE_PERMISSION_DENIED, LS_TRANSPORT_PUSH_ROLE_PERMISSION_DENIED_TEXT);
-        goto exit;
-    }
 
-    /* create the new role from the file */
-    if (!ParseJSONFile(path, &json, lserror))
-    {
-        LSErrorPrint(lserror, stderr);
-        LSErrorFree(lserror);
-        _LSErrorSet(lserror, LS_TRANSPORT_PUSH_ROLE_FILE_ERROR, LS_TRANSPORT_PUSH_ROLE_FILE_ERROR_TEXT, path);
-        goto exit;
-    }
+    role_file->perm_list = g_slist_reverse(role_file->perm_list);
 
-    if (!ParseJSONGetRole(json, path, &role, lserror))
+    return role_file;
+
+error:
+    if (LSErrorIsSet(&lserror))
     {
-        LSErrorPrint(lserror, stderr);
-        LSErrorFree(lserror);
-        _LSErrorSet(lserror, LS_TRANSPORT_PUSH_ROLE_FILE_ERROR, LS_TRANSPORT_PUSH_ROLE_FILE_ERROR_TEXT, path);
-        goto exit;
+        LSErrorFree(&lserror);
     }
 
-    /* ignore any permissions in the file */
+    _LSHubRoleFileFree(role_file);
 
-    if (!LSHubActiveRoleMapAddRef(pid, role, lserror))
+    return NULL;
+}
+
+static void
+_LSHubRoleFileCacheInit(void)
+{
+    if (!role_file_cache)
+    {
+        role_file_cache = LSHubFileCacheNew((GDestroyNotify)_LSHubRoleFileFree);
+    }
+}
+
+/**
+ *******************************************************************************
+ * @brief Parse a role file into its role and permissions. Errors are
+ * printed and leave the corresponding part of the result empty.
+ *
+ * This only creates new objects and doesn't touch any of the maps, so it's
+ * safe to call from the role parsing threads.
+ *
+ * @param  full_path    IN  path to role file
+ *
+ * @retval  parsed file
+ *******************************************************************************
+ */
+static _LSHubRoleFile*
+_LSHubRoleFileParse(const char *full_path)
+{
+    LSError lserror;
+    LSErrorInit(&lserror);
+
+    _LSHubRoleFile *role_file = g_slice_new0(_LSHubRoleFile);
+
+    /* Create role and permission objects */
+    struct json_object *json = NULL;
+    if (!ParseJSONFile(full_path, &json, &lserror))
+    {
+        LSErrorPrint(&lserror, stderr);
+        LSErrorFree(&lserror);
+        return role_file;
+    }
+
+    if (!ParseJSONGetRole(json, full_path, &role_file->role, &lserror))
+    {
+        LSErrorPrint(&lserror, stderr);
+        LSErrorFree(&lserror);
+    }
+
+    if (!ParseJSONGetPermissions(json, full_path, &role_file->perm_list, &lserror))
+    {
+        LSErrorPrint(&lserror, stderr);
+        LSErrorFree(&lserror);
+    }
+
+    json_object_put(json);
+
+    return role_file;
+}
+
+static void
+_LSHubRoleFileParseJob(gpointer data, gpointer user_data)
+{
+    _LSHubRoleFileJob *job = data;
+
+    job->role_file = _LSHubRoleFileParse(job->full_path);
+}
+
+/**
+ *******************************************************************************
+ * @brief Add a parsed role file's role and permissions to the maps.
+ *
+ * @param  role_file    IN  parsed role file
+ *******************************************************************************
+ */
+static void
+_LSHubRoleFileAddToMaps(const _LSHubRoleFile *role_file)
+{
+    LSError lserror;
+    LSErrorInit(&lserror);
+
+    LSHubRole *role = role_file->role;
+    GSList *iter = NULL;
+
+    /* Add role object to hash table */
+    if (role)
+    {
+        /* Don't add the role (but do add permissions) for a triton
+         * service, since triton will push the role file when it wants to
+         * use it
+         *
+         * Similarly, don't add the role for a mojo app, since they
+         * do not register for a service name (sysmgr just sets the
+         * appId and we do the check on that */
+        if (strcmp(role->exe_path, g_conf_triton_service_exe_path) != 0 &&
+            strcmp(role->exe_path, g_conf_mojo_app_exe_path) != 0)
+        {
+            if (!LSHubRoleMapAddRef(role, &lserror))
+            {
+                LSErrorPrint(&lserror, stderr);
+                LSErrorFree(&lserror);
+            }
+        }
+    }
+
+    /* Add permission object to hash table */
+    for (iter = role_file->perm_list; iter != NULL; iter = g_slist_next(iter))
+    {
+        LSHubPermission *perm = iter->data;
+
+        if (!LSHubPermissionMapAddRef(perm, &lserror))
+        {
+            LSErrorPrint(&lserror, stderr);
+            LSErrorFree(&lserror);
+        }
+    }
+}
+
+/**
+ *******************************************************************************
+ * @brief Undo _LSHubRoleFileAddToMaps() for a role file. Only the map
+ * entries that actually came from this file are removed (i.e., not the ones
+ * from another file that won the duplicate check).
+ *
+ * @param  role_file    IN  parsed role file
+ *******************************************************************************
+ */
+static void
+_LSHubRoleFileRemoveFromMaps(const _LSHubRoleFile *role_file)
+{
+    LSError lserror;
+    LSErrorInit(&lserror);
+
+    LSHubRole *role = role_file->role;
+    GSList *iter = NULL;
+
+    if (role && g_hash_table_lookup(LSHubGetRoleMap(), role->exe_path) == role)
+    {
+        g_hash_table_remove(LSHubGetRoleMap(), role->exe_path);
+        LSHubRoleUnref(role);
+    }
+
+    for (iter = role_file->perm_list; iter != NULL; iter = g_slist_next(iter))
+    {
+        LSHubPermission *perm = iter->data;
+
+        if (g_hash_table_lookup(LSHubGetPermissionMap(), perm->service_name) == perm)
+        {
+            if (!LSHubPermissionMapUnref(perm->service_name, &lserror))
+            {
+                LSErrorPrint(&lserror, stderr);
+                LSErrorFree(&lserror);
+            }
+        }
+    }
+}
+
+static void
+_LSHubRoleFileInvalidatePermissionCache(const _LSHubRoleFile *role_file)
+{
+    GSList *iter = NULL;
+
+    for (iter = role_file->perm_list; iter != NULL; iter = g_slist_next(iter))
+    {
+        LSHubPermission *perm = iter->data;
+        _LSHubPermissionCacheServiceRemove(perm->service_name);
+    }
+}
+
+/**
+ *******************************************************************************
+ * @brief Apply a change to a single role file (added, modified, or removed)
+ * to the role and permission maps without rebuilding them.
+ *
+ * If the file lost a duplicate check against another file, that other
+ * file's entries only come back on the next full scan.
+ *
+ * @param  dir          IN  role directory
+ * @param  filename     IN  file in dir that changed
+ *
+ * @retval  true if the maps changed
+ * @retval  false if this isn't a role file or nothing changed
+ *******************************************************************************
+ */
+bool
+LSHubRoleFileUpdate(const char *dir, const char *filename)
+{
+    LS_ASSERT(dir != NULL);
+    LS_ASSERT(filename != NULL);
+
+    bool ret = false;
+    LSHubFileStamp stamp;
+
+    if (!g_str_has_suffix(filename, ROLE_FILE_SUFFIX) || !role_map || !permission_map)
+    {
+        return false;
+    }
+
+    _LSHubRoleFileCacheInit();
+
+    char *full_path = g_strconcat(dir, "/", filename, NULL);
+
+    _LSHubRoleFile *old_role_file = LSHubFileCacheGet(role_file_cache, full_path);
+
+    if (old_role_file && LSHubFileCacheLookup(role_file_cache, full_path, NULL, &stamp))
+    {
+        /* e.g., closed without writing anything */
+        goto exit;
+    }
+
+    _ls_verbose("%s: role file changed: \"%s\"\n", __func__, full_path);
+
+    if (old_role_file)
+    {
+        _LSHubRoleFileRemoveFromMaps(old_role_file);
+        _LSHubRoleFileInvalidatePermissionCache(old_role_file);
+        ret = true;
+    }
+
+    if (!LSHubFileStampGet(full_path, &stamp))
+    {
+        /* removed; this frees old_role_file */
+        LSHubFileCacheRemove(role_file_cache, full_path);
+        goto exit;
+    }
+
+    _LSHubRoleFile *role_file = _LSHubRoleFileParse(full_path);
+
+    /* frees old_role_file */
+    LSHubFileCacheStore(role_file_cache, full_path, NULL, &stamp, role_file);
+
+    _LSHubRoleFileAddToMaps(role_file);
+    _LSHubRoleFileInvalidatePermissionCache(role_file);
+    ret = true;
+
+exit:
+    g_free(full_path);
+
+    return ret;
+}
+
+/**
+ *******************************************************************************
+ * @brief Parse all the role files in a directory and add them to the role
+ * and permission maps.
+ *
+ * Files that haven't changed since the last scan are taken from
+ * role_file_cache. The rest are parsed on a small thread pool when there
+ * are several of them (i.e., at boot), and then added to the maps in
+ * directory order so duplicate handling doesn't depend on timing.
+ *
+ * @param  path         IN  directory
+ * @param  role_hash    IN  unused
+ * @param  perm_hash    IN  unused
+ * @param  lserror      OUT set on error
+ *
+ * @retval  true on success
+ * @retval  false on failure
+ *******************************************************************************
+ */
+bool
+ParseRoleDirectory(const char *path, GHashTable *role_hash, GHashTable *perm_hash, LSError *lserror)
+{
+    GError *gerror = NULL;
+    const char *filename = NULL;
+    int misses = 0;
+    int i = 0;
+
+    _ls_verbose("%s: parsing role directory: \"%s\"\n", __func__, path);
+
+    _LSHubRoleFileCacheInit();
+
+    GDir *dir = g_dir_open(path, 0, &gerror);
+
+    if (!dir)
+    {
+        _LSErrorSetFromGError(lserror, gerror);
+        return false;
+    }
+
+    GPtrArray *jobs = g_ptr_array_new();
+
+    while ((filename = g_dir_read_name(dir)) != NULL)
+    {
+        /* check file extension */
+        if (g_str_has_suffix(filename, ROLE_FILE_SUFFIX))
+        {
+            _LSHubRoleFileJob *job = g_slice_new0(_LSHubRoleFileJob);
+
+            job->full_path = g_strconcat(path, "/", filename, NULL);
+            job->role_file = LSHubFileCacheLookup(role_file_cache, job->full_path, NULL, &job->stamp);
+            job->cached = (job->role_file != NULL);
+
+            if (!job->cached) misses++;
+
+            g_ptr_array_add(jobs, job);
+        }
+    }
+
+    g_dir_close(dir);
+
+    _ls_verbose("%s: %d role files, %d changed\n", __func__, jobs->len, misses);
+
+    GThreadPool *pool = NULL;
+
+    if (misses > 1)
+    {
+        pool = g_thread_pool_new(_LSHubRoleFileParseJob, NULL, MIN(misses, ROLE_PARSE_THREADS_MAX),
+                                 false, &gerror);
+        if (!pool)
+        {
+            /* just parse them here */
+            g_critical("Unable to create role parsing threads: %s", gerror->message);
+            g_error_free(gerror);
+            gerror = NULL;
+        }
+    }
+
+    for (i = 0; i < jobs->len; i++)
+    {
+        _LSHubRoleFileJob *job = g_ptr_array_index(jobs, i);
+
+        if (job->cached) continue;
+
+        if (pool)
+        {
+            g_thread_pool_push(pool, job, NULL);
+        }
+        else
+        {
+            _LSHubRoleFileParseJob(job, NULL);
+        }
+    }
+
+    if (pool)
+    {
+        /* wait for all the jobs */
+        g_thread_pool_free(pool, false, true);
+    }
+
+    for (i = 0; i < jobs->len; i++)
+    {
+        _LSHubRoleFileJob *job = g_ptr_array_index(jobs, i);
+
+        _LSHubRoleFileAddToMaps(job->role_file);
+
+        if (!job->cached)
+        {
+            LSHubFileCacheStore(role_file_cache, job->full_path, NULL, &job->stamp, job->role_file);
+        }
+
+        g_free(job->full_path);
+        g_slice_free(_LSHubRoleFileJob, job);
+    }
+
+    g_ptr_array_free(jobs, true);
+
+    return true;
+}
+
+bool
+LSHubPushRole(const _LSTransportClient *client, const char *path, LSError *lserror)
+{
+    bool ret = false;
+    struct json_object *json = NULL;
+    LSHubRole *role = NULL;
+
+    /* Remove current role from active role map if there is one */
+    const _LSTransportCred *cred = _LSTransportClientGetCred(client);
+
+    if (!cred)
+    {
+        _LSErrorSet(lserror, LS_TRANSPORT_PUSH_ROLE_PERMISSION_DENIED, LS_TRANSPORT_PUSH_ROLE_PERMISSION_DENIED_TEXT);
+        goto exit;
+    }
+
+    /* DFISH-23679: Only root users can push a role */
+    uid_t uid = _LSTransportCredGetUid(cred);
+
+    if (uid != 0)
+    {
+        _LSErrorSet(lserror, LS_TRANSPORT_PUSH_ROLE_PERMISSION_DENIED, LS_TRANSPORT_PUSH_ROLE_PERMISSION_DENIED_TEXT);
+        goto exit;
+    }
+
+    pid_t pid = _LSTransportCredGetPid(cred);
+
+    /* Unref the existing role for this pid if there is one. */
+    if ((role = LSHubActiveRoleMapLookup(pid)) != NULL)
+    {
+        /* Check that this client is allowed to push a role */
+        if (!LSHubClientGetPrivileged(client))
+        {
+            _LSErrorSet(lserror, LS_TRANSPORT_PUSH_ROLE_PERMISSION_DENIED, LS_TRANSPORT_PUSH_ROLE_PERMISSION_DENIED_TEXT);
+            goto exit;
+        }
+
+        /* Verify that there should only be a single ref and the role is freed */
+        if (!LSHubActiveRoleMapUnref(pid))
+        {
+            _LSErrorSet(lserror, LS_TRANSPORT_PUSH_ROLE_DUPLICATE, LS_TRANSPORT_PUSH_ROLE_DUPLICATE_TEXT);
+            goto exit;
+        }
+    }
+    else
+    {
+        /* Couldn't verify that this pid is allowed to push a role */
+        _LSErrorSet(lserror, LS_TRANSPORT_PUSH_ROLE_PERMISSION_DENIED, LS_TRANSPORT_PUSH_ROLE_PERMISSION_DENIED_TEXT);
+        goto exit;
+    }
+
+    /* create the new role from the file */
+    if (!ParseJSONFile(path, &json, lserror))
+    {
+        LSErrorPrint(lserror, stderr);
+        LSErrorFree(lserror);
+        _LSErrorSet(lserror, LS_TRANSPORT_PUSH_ROLE_FILE_ERROR, LS_TRANSPORT_PUSH_ROLE_FILE_ERROR_TEXT, path);
+        goto exit;
+    }
+
+    if (!ParseJSONGetRole(json, path, &role, lserror))
+    {
+        LSErrorPrint(lserror, stderr);
+        LSErrorFree(lserror);
+        _LSErrorSet(lserror, LS_TRANSPORT_PUSH_ROLE_FILE_ERROR, LS_TRANSPORT_PUSH_ROLE_FILE_ERROR_TEXT, path);
+        goto exit;
+    }
+
+    /* ignore any permissions in the file */
+
+    if (!LSHubActiveRoleMapAddRef(pid, role, lserror))
     {
         LSErrorPrint(lserror, stderr);
         LSErrorFree(lserror);
@@ -1406,6 +2051,8 @@ LSHubPushRole(const _LSTransportClient *client, const char *path, LSError *lserr
 
     LSHubRoleUnref(role);
 
+    _LSHubPermissionCacheFlush();
+
     ret = true;
 
 exit:
@@ -1450,6 +2097,8 @@ done:
 bool
 LSHubActiveRoleMapClientRemove(const _LSTransportClient *client, LSError *lserror)
 {
+    _LSHubPermissionCacheClientRemove(client);
+
     if (!g_conf_security_enabled)
     {
         return true;
@@ -1704,11 +2353,146 @@ _LSHubIsClientSysMgrAppProxy(const _LSTransportClient *client)
     return client->is_sysmgr_app_proxy;
 }
 
-static inline void
+typedef struct _LSHubPermissionLog
+{
+    char *sender_service_name;
+    char *dest_service_name;
+    bool inbound;
+    bool is_error;
+    unsigned int suppressed;    /**< repeats not printed since the last summary */
+} _LSHubPermissionLog;
+
+static void
+_LSHubPermissionLogFree(_LSHubPermissionLog *log)
+{
+    g_free(log->sender_service_name);
+    g_free(log->dest_service_name);
+
+#ifdef MEMCHECK
+    memset(log, 0xFF, sizeof(_LSHubPermissionLog));
+#endif
+
+    g_free(log);
+}
+
+static char*
+_LSHubPermissionLogKey(const _LSTransportClient *client, const char *sender_service_name,
+                       const char *dest_service_name, bool inbound)
+{
+    const _LSTransportCred *cred = _LSTransportClientGetCred(client);
+    const char *exe_path = cred ? _LSTransportCredGetExePath(cred) : NULL;
+
+    /* same encoding as _LSHubPermissionCacheKey() */
+    return g_strdup_printf("%s%s\n%s%s\n%s\n%d",
+                           exe_path ? "=" : "!", exe_path ? exe_path : "",
+                           sender_service_name ? "=" : "!", sender_service_name ? sender_service_name : "",
+                           dest_service_name, (int)inbound);
+}
+
+static gboolean
+_LSHubPermissionLogSummarize(gpointer key, gpointer value, gpointer user_data)
+{
+    _LSHubPermissionLog *log = value;
+
+    if (log->suppressed == 0)
+    {
+        /* quiet for a whole interval; the next message is printed again */
+        return TRUE;
+    }
+
+    g_critical("%s: %u more \"%s\" %s \"%s\" %s permissions messages "
+               "suppressed in the last %d seconds",
+               log->is_error ? "ERROR" : "WARNING", log->suppressed,
+               log->sender_service_name, log->inbound ? "->" : "=>",
+               log->dest_service_name, log->inbound ? "inbound" : "outbound",
+               PERMISSION_LOG_INTERVAL_SEC);
+
+    log->suppressed = 0;
+
+    return FALSE;
+}
+
+static gboolean
+_LSHubPermissionLogTimeout(gpointer user_data)
+{
+    g_hash_table_foreach_remove(permission_log, _LSHubPermissionLogSummarize, NULL);
+
+    if (g_hash_table_size(permission_log) == 0)
+    {
+        permission_log_source = 0;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Decide whether a permissions message is printed in full.
+ *
+ * The first message for a requester/service pair is always printed; repeats
+ * within PERMISSION_LOG_INTERVAL_SEC are counted and reported in a summary
+ * line at the end of the interval.
+ * 
+ * @param  client               IN  requester
+ * @param  sender_service_name  IN  requester service name
+ * @param  dest_service_name    IN  destination service
+ * @param  inbound              IN  true for inbound message, false for outbound
+ * @param  is_error             IN  true if the message is an error
+ * 
+ * @retval  true if the message should be printed
+ * @retval  false if it was counted for the next summary
+ *******************************************************************************
+ */
+static bool
+_LSHubPermissionLogShouldPrint(const _LSTransportClient *client, const char *sender_service_name,
+                               const char *dest_service_name, bool inbound, bool is_error)
+{
+    if (!permission_log)
+    {
+        permission_log = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                               (GDestroyNotify)_LSHubPermissionLogFree);
+    }
+
+    char *key = _LSHubPermissionLogKey(client, sender_service_name, dest_service_name, inbound);
+    _LSHubPermissionLog *log = g_hash_table_lookup(permission_log, key);
+
+    if (log)
+    {
+        g_free(key);
+        log->suppressed++;
+        return false;
+    }
+
+    log = g_new0(_LSHubPermissionLog, 1);
+    log->sender_service_name = g_strdup(sender_service_name);
+    log->dest_service_name = g_strdup(dest_service_name);
+    log->inbound = inbound;
+    log->is_error = is_error;
+
+    /* takes ownership of key */
+    g_hash_table_insert(permission_log, key, log);
+
+    if (!permission_log_source)
+    {
+        permission_log_source = g_timeout_add_seconds(PERMISSION_LOG_INTERVAL_SEC, _LSHubPermissionLogTimeout, NULL);
+    }
+
+    return true;
+}
+
+static void
 _LSHubPrintPermissionsMessage(const _LSTransportClient *client, const char *sender_service_name,
                               const char *dest_service_name, bool inbound, bool is_error)
 {
     const _LSTransportCred *cred  = _LSTransportClientGetCred(client);
+
+    permission_logged |= inbound ? PERMISSION_CACHE_INBOUND_LOGGED : PERMISSION_CACHE_OUTBOUND_LOGGED;
+
+    if (!_LSHubPermissionLogShouldPrint(client, sender_service_name, dest_service_name, inbound, is_error))
+    {
+        return;
+    }
     
     if (inbound)
     {
@@ -1960,6 +2744,186 @@ Exit:
     return ret;
 }
 
+/** 
+ *******************************************************************************
+ * @brief Build the key for a client's QueryName decision.
+ *
+ * The decision made by _LSHubIsClientAllowedOutbound() and
+ * _LSHubIsClientAllowedInbound() only depends on the sender's exe path,
+ * its service name, the destination, whether it is the sysmgr app proxy, and
+ * (for sysmgr only) the sender's app id without the pid. The key begins with
+ * the part that identifies the sender, see
+ * _LSHubPermissionCacheClientPrefix().
+ * 
+ * @param  client               IN  sender 
+ * @param  dest_service_name    IN  destination service 
+ * @param  sender_app_id        IN  app id the sender is calling on behalf of
+ * 
+ * @retval  newly allocated key
+ *******************************************************************************
+ */
+static char*
+_LSHubPermissionCacheKey(const _LSTransportClient *client, const char *dest_service_name, const char *sender_app_id)
+{
+    const char *sender_service_name = _LSTransportClientGetServiceName(client);
+    const _LSTransportCred *cred = _LSTransportClientGetCred(client);
+    const char *exe_path = cred ? _LSTransportCredGetExePath(cred) : NULL;
+    char *app_id_class = NULL;
+
+    if (_LSHubIsClientSysMgr(client))
+    {
+        app_id_class = _LSHubAppIdStripPidAndDup(sender_app_id);
+    }
+
+    /* '\n' can't appear in an exe path we care about or a service name;
+     * '=' and '!' tell NULL apart from "" */
+    char *key = g_strdup_printf("%s%s\n%s%s\n%s\n%s%s\n%d",
+                                exe_path ? "=" : "!", exe_path ? exe_path : "",
+                                sender_service_name ? "=" : "!", sender_service_name ? sender_service_name : "",
+                                dest_service_name,
+                                app_id_class ? "=" : "!", app_id_class ? app_id_class : "",
+                                (int)_LSHubIsClientSysMgrAppProxy(client));
+
+    g_free(app_id_class);
+
+    return key;
+}
+
+static char*
+_LSHubPermissionCacheClientPrefix(const _LSTransportClient *client)
+{
+    const char *sender_service_name = _LSTransportClientGetServiceName(client);
+    const _LSTransportCred *cred = _LSTransportClientGetCred(client);
+    const char *exe_path = cred ? _LSTransportCredGetExePath(cred) : NULL;
+
+    return g_strdup_printf("%s%s\n%s%s\n",
+                           exe_path ? "=" : "!", exe_path ? exe_path : "",
+                           sender_service_name ? "=" : "!", sender_service_name ? sender_service_name : "");
+}
+
+static void
+_LSHubPermissionCacheFlush(void)
+{
+    if (permission_cache)
+    {
+        g_hash_table_remove_all(permission_cache);
+    }
+}
+
+static gboolean
+_LSHubPermissionCacheKeyHasPrefix(gpointer key, gpointer value, gpointer prefix)
+{
+    return g_str_has_prefix(key, prefix);
+}
+
+/* drop the decisions made for a client that is going away */
+static void
+_LSHubPermissionCacheClientRemove(const _LSTransportClient *client)
+{
+    if (!permission_cache || g_hash_table_size(permission_cache) == 0)
+    {
+        return;
+    }
+
+    char *prefix = _LSHubPermissionCacheClientPrefix(client);
+    g_hash_table_foreach_remove(permission_cache, _LSHubPermissionCacheKeyHasPrefix, prefix);
+    g_free(prefix);
+}
+
+/* true if name is looked up as service_name in the permission map */
+static bool
+_LSHubPermissionNameUses(const char *name, const char *service_name)
+{
+    if (strcmp(name, service_name) == 0)
+    {
+        return true;
+    }
+
+    const char *media_service_name = IsMediaService(name);
+
+    return media_service_name && strcmp(media_service_name, service_name) == 0;
+}
+
+static gboolean
+_LSHubPermissionCacheKeyUsesService(gpointer key, gpointer value, gpointer service_name)
+{
+    /* see _LSHubPermissionCacheKey(): exe path, sender service name,
+     * destination, sysmgr app id, proxy flag */
+    char **fields = g_strsplit(key, "\n", 5);
+    gboolean ret = FALSE;
+
+    if (g_strv_length(fields) == 5)
+    {
+        ret = (fields[1][0] == '=' && _LSHubPermissionNameUses(fields[1] + 1, service_name)) ||
+              _LSHubPermissionNameUses(fields[2], service_name) ||
+              (fields[3][0] == '=' && _LSHubPermissionNameUses(fields[3] + 1, service_name));
+    }
+    else
+    {
+        ret = TRUE;
+    }
+
+    g_strfreev(fields);
+
+    return ret;
+}
+
+/* drop the decisions that depend on the permissions for service_name */
+static void
+_LSHubPermissionCacheServiceRemove(const char *service_name)
+{
+    if (!permission_cache || g_hash_table_size(permission_cache) == 0)
+    {
+        return;
+    }
+
+    g_hash_table_foreach_remove(permission_cache, _LSHubPermissionCacheKeyUsesService, (gpointer)service_name);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Print again the permissions messages of a cached QueryName decision,
+ * so that a cache hit is logged (rate limited) like the original decision.
+ *
+ * The sender name matches the one _LSHubIsClientAllowedOutbound() and
+ * _LSHubIsClientAllowedInbound() used: sysmgr is logged by app id.
+ * 
+ * @param  client               IN  sender
+ * @param  dest_service_name    IN  destination service
+ * @param  sender_app_id        IN  app id the sender is calling on behalf of
+ * @param  bits                 IN  PERMISSION_CACHE_* bits of the decision
+ *******************************************************************************
+ */
+static void
+_LSHubPermissionCacheReprint(const _LSTransportClient *client, const char *dest_service_name,
+                             const char *sender_app_id, int bits)
+{
+    if (!(bits & (PERMISSION_CACHE_OUTBOUND_LOGGED | PERMISSION_CACHE_INBOUND_LOGGED)))
+    {
+        return;
+    }
+
+    const char *sender_service_name = _LSTransportClientGetServiceName(client);
+    bool is_sysmgr = _LSHubIsClientSysMgr(client);
+    char *app_id_class = is_sysmgr ? _LSHubAppIdStripPidAndDup(sender_app_id) : NULL;
+
+    if (bits & PERMISSION_CACHE_OUTBOUND_LOGGED)
+    {
+        bool by_app_id = is_sysmgr && !g_conf_mojo_apps_allow_all_outbound_by_default;
+
+        _LSHubPrintPermissionsMessage(client, by_app_id ? app_id_class : sender_service_name,
+                                      dest_service_name, false, g_conf_security_enabled);
+    }
+
+    if (bits & PERMISSION_CACHE_INBOUND_LOGGED)
+    {
+        _LSHubPrintPermissionsMessage(client, is_sysmgr ? app_id_class : sender_service_name,
+                                      dest_service_name, true, g_conf_security_enabled);
+    }
+
+    g_free(app_id_class);
+}
+
 bool
 LSHubIsClientAllowedToQueryName(_LSTransportClient *client, const char *dest_service_name, const char *sender_app_id)
 {
@@ -1971,12 +2935,44 @@ LSHubIsClientAllowedToQueryName(_LSTransportClient *client, const char *dest_ser
         return true;
     }
 
-    if (_LSHubIsClientAllowedOutbound(client, dest_service_name, sender_app_id) && _LSHubIsClientAllowedInbound(client, dest_service_name, sender_app_id))
+    /* _LSHubIsClientAllowedOutbound() marks the sysmgr app proxy as a side
+     * effect; do that here first so a cached answer doesn't skip it */
+    if (!_LSHubIsClientSysMgrAppProxy(client) && _LSHubIsClientSysMgr(client)
+        && g_conf_mojo_apps_allow_all_outbound_by_default && sender_app_id != NULL)
     {
-        return true;
+        client->is_sysmgr_app_proxy = true;
     }
 
-    return false;
+    if (!permission_cache)
+    {
+        permission_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    }
+
+    char *key = _LSHubPermissionCacheKey(client, dest_service_name, sender_app_id);
+    gpointer cached = g_hash_table_lookup(permission_cache, key);
+
+    if (cached)
+    {
+        g_free(key);
+        _LSHubPermissionCacheReprint(client, dest_service_name, sender_app_id, GPOINTER_TO_INT(cached));
+        return GPOINTER_TO_INT(cached) & PERMISSION_CACHE_ALLOWED;
+    }
+
+    permission_logged = 0;
+
+    bool allowed = _LSHubIsClientAllowedOutbound(client, dest_service_name, sender_app_id)
+                   && _LSHubIsClientAllowedInbound(client, dest_service_name, sender_app_id);
+
+    if (g_hash_table_size(permission_cache) >= PERMISSION_CACHE_MAX)
+    {
+        g_hash_table_remove_all(permission_cache);
+    }
+
+    /* takes ownership of key */
+    g_hash_table_insert(permission_cache, key,
+                        GINT_TO_POINTER(PERMISSION_CACHE_VALID | permission_logged | (allowed ? PERMISSION_CACHE_ALLOWED : 0)));
+
+    return allowed;
 }
 
 bool
@@ -2004,6 +3000,9 @@ LSHubIsClientAllowedToSendSignal(_LSTransportClient *client)
 static bool
 _PermissionsAndRolesInit(LSError *lserror)
 {
+    /* the role directories (and possibly conf) are being re-read */
+    _LSHubPermissionCacheFlush();
+
     if (role_map)
     {
         if (!LSHubRoleMapClear(lserror))
@@ -2073,6 +3072,11 @@ ProcessRoleDirectories(const char **dirs, void *ctxt, LSError *lserror)
         return false;
     }
 
+    _LSHubRoleFileCacheInit();
+    LSHubFileCacheSetSnapshot(role_file_cache, g_conf_role_scan_cache, dirs,
+                              _LSHubRoleFileSave, (LSHubFileCacheLoadFunc)_LSHubRoleFileLoad);
+    LSHubFileCacheScanBegin(role_file_cache);
+
     for (cur_dir = dirs; *cur_dir != NULL; cur_dir++)
     {
         if (!ParseRoleDirectory(*cur_dir, LSHubGetRoleMap(), LSHubGetPermissionMap(), lserror))
@@ -2081,6 +3085,9 @@ ProcessRoleDirectories(const char **dirs, void *ctxt, LSError *lserror)
             LSErrorFree(lserror);
         }
     }
+
+    /* forget role files that have been removed */
+    LSHubFileCacheScanEnd(role_file_cache);
     
     fprintf(stderr, "Done parsing role directories\n");
 
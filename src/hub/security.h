@@ -34,6 +34,7 @@ typedef struct LSHubRole LSHubRole;
 typedef struct LSHubPermission LSHubPermission;
 
 bool ProcessRoleDirectories(const char **dirs, void *ctxt, LSError *lserror);
+bool LSHubRoleFileUpdate(const char *dir, const char *filename);
 bool LSHubIsClientAllowedToQueryName(_LSTransportClient *client, const char *dest_service_name, const char *sender_app_id);
 bool LSHubIsClientAllowedToRequestName(const _LSTransportClient *client, const char *service_name);
 bool LSHubIsClientAllowedToSendSignal(_LSTransportClient *client);
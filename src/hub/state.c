@@ -0,0 +1,406 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2008-2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+#include <string.h>
+#include <time.h>
+
+#include "error.h"
+#include "transport_signal.h"
+#include "state.h"
+
+/**
+ * Snapshot of the clients that are connected to the hub, written to disk
+ * so that a restarted hub can let them resume their unique names and signal
+ * registrations instead of every client reconnecting from scratch at once.
+ *
+ * The file is a key file:
+ *
+ * @code
+ * [Hub]
+ * Version=1
+ * BootId=<contents of /proc/sys/kernel/random/boot_id>
+ * Written=<time(2) when written, for debugging>
+ *
+ * [<unique name>]
+ * Service=<service name, if any>
+ * Pid=<pid>
+ * SignalCategories=<category>;...
+ * SignalMethods=<method or empty for the whole category>;...
+ * SignalCounts=<count>;...
+ * @endcode
+ *
+ * A snapshot from a previous boot is never used, since none of the clients
+ * in it can still be around.
+ */
+struct LSHubState
+{
+    GHashTable *clients;        /**< unique name --> LSHubStateClient */
+};
+
+#define STATE_VERSION           1
+#define STATE_BOOT_ID_PATH      "/proc/sys/kernel/random/boot_id"
+
+#define STATE_GROUP_HUB         "Hub"
+#define STATE_KEY_VERSION       "Version"
+#define STATE_KEY_BOOT_ID       "BootId"
+#define STATE_KEY_WRITTEN       "Written"
+#define STATE_KEY_SERVICE       "Service"
+#define STATE_KEY_PID           "Pid"
+#define STATE_KEY_CATEGORIES    "SignalCategories"
+#define STATE_KEY_METHODS       "SignalMethods"
+#define STATE_KEY_COUNTS        "SignalCounts"
+
+static void
+_LSHubStateClientFree(LSHubStateClient *client)
+{
+    LS_ASSERT(client != NULL);
+
+    guint i;
+    for (i = 0; i < client->signals->len; i++)
+    {
+        LSHubStateSignal *signal = &g_array_index(client->signals, LSHubStateSignal, i);
+        g_free(signal->category);
+        g_free(signal->method);
+    }
+    g_array_free(client->signals, TRUE);
+
+    g_free(client->unique_name);
+    g_free(client->service_name);
+
+#ifdef MEMCHECK
+    memset(client, 0xFF, sizeof(LSHubStateClient));
+#endif
+
+    g_slice_free(LSHubStateClient, client);
+}
+
+/**
+ *******************************************************************************
+ * @brief Allocate a new, empty, state.
+ *
+ * @retval  state on success
+ * @retval  NULL on failure
+ *******************************************************************************
+ */
+LSHubState*
+LSHubStateNew(void)
+{
+    LSHubState *state = g_slice_new0(LSHubState);
+
+    if (state)
+    {
+        state->clients = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                               (GDestroyNotify)_LSHubStateClientFree);
+    }
+
+    return state;
+}
+
+void
+LSHubStateFree(LSHubState *state)
+{
+    LS_ASSERT(state != NULL);
+
+    g_hash_table_destroy(state->clients);
+
+#ifdef MEMCHECK
+    memset(state, 0xFF, sizeof(LSHubState));
+#endif
+
+    g_slice_free(LSHubState, state);
+}
+
+/**
+ *******************************************************************************
+ * @brief Add a client to the state, replacing any client with the same
+ * unique name.
+ *
+ * @param  state        IN  state
+ * @param  unique_name  IN  unique name of the client
+ * @param  service_name IN  service name of the client (or NULL)
+ * @param  pid          IN  pid of the client
+ *
+ * @retval  client, owned by the state
+ *******************************************************************************
+ */
+LSHubStateClient*
+LSHubStateAddClient(LSHubState *state, const char *unique_name, const char *service_name, pid_t pid)
+{
+    LSHubStateClient *client = g_slice_new0(LSHubStateClient);
+
+    client->unique_name = g_strdup(unique_name);
+    client->service_name = g_strdup(service_name);
+    client->pid = pid;
+    client->signals = g_array_new(FALSE, FALSE, sizeof(LSHubStateSignal));
+
+    g_hash_table_replace(state->clients, client->unique_name, client);
+
+    return client;
+}
+
+/**
+ *******************************************************************************
+ * @brief Add a signal registration to a client.
+ *
+ * @param  client   IN  client
+ * @param  category IN  category
+ * @param  method   IN  method (or NULL for the whole category)
+ * @param  count    IN  number of times it was registered
+ *******************************************************************************
+ */
+void
+LSHubStateClientAddSignal(LSHubStateClient *client, const char *category, const char *method, int count)
+{
+    LSHubStateSignal signal;
+
+    LS_ASSERT(category != NULL);
+
+    if (count <= 0) return;
+
+    signal.category = g_strdup(category);
+    signal.method = g_strdup(method);
+    signal.count = count;
+
+    g_array_append_val(client->signals, signal);
+
+    client->digest = _LSTransportSignalDigestAdd(client->digest, category, method, count);
+}
+
+LSHubStateClient*
+LSHubStateLookup(LSHubState *state, const char *unique_name)
+{
+    return g_hash_table_lookup(state->clients, unique_name);
+}
+
+void
+LSHubStateRemove(LSHubState *state, const char *unique_name)
+{
+    g_hash_table_remove(state->clients, unique_name);
+}
+
+guint
+LSHubStateSize(LSHubState *state)
+{
+    return g_hash_table_size(state->clients);
+}
+
+void
+LSHubStateForEach(LSHubState *state, LSHubStateForEachFunc func, gpointer data)
+{
+    GHashTableIter iter;
+    gpointer value;
+
+    g_hash_table_iter_init(&iter, state->clients);
+
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+    {
+        func(value, data);
+    }
+}
+
+/**
+ *******************************************************************************
+ * @brief Get the id of the current boot.
+ *
+ * @retval  boot id (free with g_free()), empty if it's unavailable
+ *******************************************************************************
+ */
+static char*
+_LSHubStateGetBootId(void)
+{
+    char *boot_id = NULL;
+
+    if (!g_file_get_contents(STATE_BOOT_ID_PATH, &boot_id, NULL, NULL))
+    {
+        return g_strdup("");
+    }
+
+    return g_strstrip(boot_id);
+}
+
+/**
+ *******************************************************************************
+ * @brief Write the state to a file. The file is replaced atomically, so a
+ * hub that dies while writing leaves the previous snapshot behind.
+ *
+ * @param  state    IN  state
+ * @param  path     IN  file path
+ * @param  lserror  OUT set on error
+ *
+ * @retval  true on success
+ * @retval  false on failure
+ *******************************************************************************
+ */
+bool
+LSHubStateWrite(LSHubState *state, const char *path, LSError *lserror)
+{
+    GError *gerror = NULL;
+    GHashTableIter iter;
+    gpointer value;
+    bool ret = true;
+
+    GKeyFile *key_file = g_key_file_new();
+    char *boot_id = _LSHubStateGetBootId();
+
+    g_key_file_set_integer(key_file, STATE_GROUP_HUB, STATE_KEY_VERSION, STATE_VERSION);
+    g_key_file_set_string(key_file, STATE_GROUP_HUB, STATE_KEY_BOOT_ID, boot_id);
+    g_key_file_set_uint64(key_file, STATE_GROUP_HUB, STATE_KEY_WRITTEN, (guint64)time(NULL));
+
+    g_hash_table_iter_init(&iter, state->clients);
+
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+    {
+        LSHubStateClient *client = value;
+        guint len = client->signals->len;
+        guint i;
+
+        const char **categories = g_new0(const char*, len + 1);
+        const char **methods = g_new0(const char*, len + 1);
+        gint *counts = g_new0(gint, len + 1);
+
+        for (i = 0; i < len; i++)
+        {
+            LSHubStateSignal *signal = &g_array_index(client->signals, LSHubStateSignal, i);
+            categories[i] = signal->category;
+            methods[i] = signal->method ? signal->method : "";
+            counts[i] = signal->count;
+        }
+
+        if (client->service_name)
+        {
+            g_key_file_set_string(key_file, client->unique_name, STATE_KEY_SERVICE, client->service_name);
+        }
+        g_key_file_set_integer(key_file, client->unique_name, STATE_KEY_PID, client->pid);
+        g_key_file_set_string_list(key_file, client->unique_name, STATE_KEY_CATEGORIES, categories, len);
+        g_key_file_set_string_list(key_file, client->unique_name, STATE_KEY_METHODS, methods, len);
+        g_key_file_set_integer_list(key_file, client->unique_name, STATE_KEY_COUNTS, counts, len);
+
+        g_free(categories);
+        g_free(methods);
+        g_free(counts);
+    }
+
+    gsize data_len = 0;
+    char *data = g_key_file_to_data(key_file, &data_len, NULL);
+
+    if (!g_file_set_contents(path, data, data_len, &gerror))
+    {
+        _LSErrorSetFromGError(lserror, gerror);
+        ret = false;
+    }
+
+    g_free(data);
+    g_free(boot_id);
+    g_key_file_free(key_file);
+
+    return ret;
+}
+
+/**
+ *******************************************************************************
+ * @brief Read a state written by @ref LSHubStateWrite.
+ *
+ * @param  path     IN  file path
+ * @param  lserror  OUT set on error (or if the snapshot is from a previous
+ *                      boot)
+ *
+ * @retval  state on success
+ * @retval  NULL on failure
+ *******************************************************************************
+ */
+LSHubState*
+LSHubStateRead(const char *path, LSError *lserror)
+{
+    GError *gerror = NULL;
+    LSHubState *state = NULL;
+    char *boot_id = NULL;
+    char *saved_boot_id = NULL;
+    char **groups = NULL;
+    gsize i;
+
+    GKeyFile *key_file = g_key_file_new();
+
+    if (!g_key_file_load_from_file(key_file, path, G_KEY_FILE_NONE, &gerror))
+    {
+        _LSErrorSetNoPrint(lserror, -1, "Unable to load hub state \"%s\": %s", path, gerror->message);
+        g_error_free(gerror);
+        goto exit;
+    }
+
+    if (g_key_file_get_integer(key_file, STATE_GROUP_HUB, STATE_KEY_VERSION, NULL) != STATE_VERSION)
+    {
+        _LSErrorSetNoPrint(lserror, -1, "Unsupported hub state version in \"%s\"", path);
+        goto exit;
+    }
+
+    boot_id = _LSHubStateGetBootId();
+    saved_boot_id = g_key_file_get_string(key_file, STATE_GROUP_HUB, STATE_KEY_BOOT_ID, NULL);
+
+    if (!saved_boot_id || strcmp(boot_id, saved_boot_id) != 0)
+    {
+        _LSErrorSetNoPrint(lserror, -1, "Hub state \"%s\" is from a previous boot", path);
+        goto exit;
+    }
+
+    state = LSHubStateNew();
+    groups = g_key_file_get_groups(key_file, NULL);
+
+    for (i = 0; groups[i]; i++)
+    {
+        const char *unique_name = groups[i];
+
+        if (strcmp(unique_name, STATE_GROUP_HUB) == 0) continue;
+
+        char *service_name = g_key_file_get_string(key_file, unique_name, STATE_KEY_SERVICE, NULL);
+        int pid = g_key_file_get_integer(key_file, unique_name, STATE_KEY_PID, NULL);
+
+        gsize categories_len = 0, methods_len = 0, counts_len = 0;
+        char **categories = g_key_file_get_string_list(key_file, unique_name, STATE_KEY_CATEGORIES, &categories_len, NULL);
+        char **methods = g_key_file_get_string_list(key_file, unique_name, STATE_KEY_METHODS, &methods_len, NULL);
+        gint *counts = g_key_file_get_integer_list(key_file, unique_name, STATE_KEY_COUNTS, &counts_len, NULL);
+
+        if (categories_len == methods_len && categories_len == counts_len)
+        {
+            LSHubStateClient *client = LSHubStateAddClient(state, unique_name, service_name, pid);
+            gsize j;
+
+            for (j = 0; j < categories_len; j++)
+            {
+                LSHubStateClientAddSignal(client, categories[j], methods[j][0] ? methods[j] : NULL, counts[j]);
+            }
+        }
+        else
+        {
+            g_warning("%s: ignoring malformed entry \"%s\" in \"%s\"", __func__, unique_name, path);
+        }
+
+        g_free(service_name);
+        g_strfreev(categories);
+        g_strfreev(methods);
+        g_free(counts);
+    }
+
+exit:
+    g_strfreev(groups);
+    g_free(saved_boot_id);
+    g_free(boot_id);
+    g_key_file_free(key_file);
+
+    return state;
+}
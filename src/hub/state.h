@@ -0,0 +1,69 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2008-2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+#ifndef _STATE_H
+#define _STATE_H
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <glib.h>
+
+#include <luna-service2/lunaservice.h>
+
+/** One signal registration of a client */
+typedef struct LSHubStateSignal
+{
+    char *category;
+    char *method;               /**< NULL for the whole category */
+    int count;                  /**< number of times it was registered */
+} LSHubStateSignal;
+
+/** What the hub knew about a connected client */
+typedef struct LSHubStateClient
+{
+    char *unique_name;
+    char *service_name;         /**< NULL if the client has no service name */
+    pid_t pid;
+    GArray *signals;            /**< array of LSHubStateSignal */
+    guint64 digest;             /**< @ref _LSTransportSignalDigestAdd over signals */
+} LSHubStateClient;
+
+typedef struct LSHubState LSHubState;
+
+typedef void (*LSHubStateForEachFunc)(LSHubStateClient *client, gpointer data);
+
+LSHubState* LSHubStateNew(void);
+void LSHubStateFree(LSHubState *state);
+
+LSHubStateClient* LSHubStateAddClient(LSHubState *state, const char *unique_name, const char *service_name, pid_t pid);
+void LSHubStateClientAddSignal(LSHubStateClient *client, const char *category, const char *method, int count);
+
+LSHubStateClient* LSHubStateLookup(LSHubState *state, const char *unique_name);
+void LSHubStateRemove(LSHubState *state, const char *unique_name);
+guint LSHubStateSize(LSHubState *state);
+void LSHubStateForEach(LSHubState *state, LSHubStateForEachFunc func, gpointer data);
+
+bool LSHubStateWrite(LSHubState *state, const char *path, LSError *lserror);
+LSHubState* LSHubStateRead(const char *path, LSError *lserror);
+
+#endif  /* _STATE_H */
@@ -20,6 +20,7 @@
 #include <sys/time.h>
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 #if 0
 #if !(defined TARGET_DESKTOP)
@@ -30,6 +31,7 @@
 #include "error.h"
 #include "transport_utils.h"
 #include "conf.h"
+#include "latency.h"
 #include "watchdog.h"
 
 #define WATCHDOG_FAILURE_MODE_STRING_NOOP   "noop"
@@ -45,9 +47,21 @@
 
 #define WATCHDOG_RDX_REPORTER_CMD    "/bin/echo \"Watchdog timeout\" | /usr/bin/rdx_reporter --component \"ls-hubd.watchdog\" --cause \"Watchdog timer expired\" --detail \"Watchdog timeout\" &"
 
+#define WATCHDOG_STALL_CHECKS_PER_THRESHOLD  4   /**< how often the stall thread looks, per threshold */
+
 static gint last_count_seen = 0;
 static gint watchdog_count = 0;
 
+/* mainloop latency probe */
+static bool probe_enabled = false;
+static _LSLatencyHistogram probe_lateness;      /**< how late (us) each probe tick ran; mainloop only */
+static gint64 probe_due_us = 0;                 /**< when the next probe tick should run; mainloop only */
+static gpointer probe_current_message = NULL;   /**< type name of the message the hub is handling (atomic) */
+
+static pthread_mutex_t probe_lock = PTHREAD_MUTEX_INITIALIZER;  /**< protects the two below */
+static gint64 probe_last_tick_us = 0;           /**< when the last probe tick ran */
+static bool probe_stall_reported = false;       /**< true if the current stall was logged */
+
 #if !(defined TARGET_DESKTOP)
 /* Can't use librdx because it creates a circular build dependency */
 #if 0
@@ -142,6 +156,162 @@ _WatchdogMainloopTimeout(gpointer data)
     return TRUE;
 }
 
+/** 
+ *******************************************************************************
+ * @brief Called from the mainloop every probe interval; records how late it
+ * ran.
+ * 
+ * @param  data     IN  unused
+ * 
+ * @retval  TRUE to keep the probe going
+ *******************************************************************************
+ */
+static gboolean
+_WatchdogProbeTick(gpointer data)
+{
+    gint64 now = _LSLatencyNowUs();
+    gint64 late = now - probe_due_us;
+
+    if (late < 0)
+    {
+        late = 0;
+    }
+
+    _LSLatencyHistogramAdd(&probe_lateness, late);
+    probe_due_us = now + (gint64)g_conf_watchdog_probe_interval_ms * 1000;
+
+    pthread_mutex_lock(&probe_lock);
+    bool reported = probe_stall_reported;
+    probe_last_tick_us = now;
+    probe_stall_reported = false;
+    pthread_mutex_unlock(&probe_lock);
+
+    if (reported)
+    {
+        g_warning("Hub mainloop stall ended; probe ran %lld ms late", (long long)(late / 1000));
+    }
+
+    return TRUE;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Thread that logs a mainloop stall as soon as the probe is more than
+ * the stall threshold late, along with the type of message the hub is
+ * handling at that point.
+ * 
+ * @param  arg  IN  unused
+ * 
+ * @retval  never returns
+ *******************************************************************************
+ */
+static void*
+_WatchdogStallThread(void *arg)
+{
+    gint64 threshold_us = (gint64)g_conf_watchdog_stall_threshold_ms * 1000;
+    gint64 interval_us = (gint64)g_conf_watchdog_probe_interval_ms * 1000;
+
+    for (;;)
+    {
+        g_usleep(threshold_us / WATCHDOG_STALL_CHECKS_PER_THRESHOLD);
+
+        gint64 now = _LSLatencyNowUs();
+        bool report = false;
+        gint64 stalled_us = 0;
+
+        pthread_mutex_lock(&probe_lock);
+        stalled_us = now - probe_last_tick_us - interval_us;
+        if (!probe_stall_reported && stalled_us > threshold_us)
+        {
+            probe_stall_reported = true;
+            report = true;
+        }
+        pthread_mutex_unlock(&probe_lock);
+
+        if (report)
+        {
+            const char *type_name = g_atomic_pointer_get(&probe_current_message);
+
+            g_warning("Hub mainloop stalled for %lld ms (%s%s)", (long long)(stalled_us / 1000),
+                      type_name ? "handling " : "not handling a message",
+                      type_name ? type_name : "");
+        }
+    }
+
+    return NULL;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Start the mainloop latency probe and, if there's a stall threshold,
+ * the thread that watches for stalls.
+ *******************************************************************************
+ */
+static void
+_WatchdogSetupProbe(void)
+{
+    if (g_conf_watchdog_probe_interval_ms <= 0)
+    {
+        return;
+    }
+
+    probe_due_us = _LSLatencyNowUs() + (gint64)g_conf_watchdog_probe_interval_ms * 1000;
+    probe_last_tick_us = _LSLatencyNowUs();
+    g_timeout_add(g_conf_watchdog_probe_interval_ms, _WatchdogProbeTick, NULL);
+    probe_enabled = true;
+
+    if (g_conf_watchdog_stall_threshold_ms > 0)
+    {
+        pthread_t thread;
+        pthread_attr_t attr;
+
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+        if (pthread_create(&thread, &attr, _WatchdogStallThread, NULL) != 0)
+        {
+            g_critical("Unable to create watchdog stall thread; stalls won't be logged");
+        }
+
+        pthread_attr_destroy(&attr);
+    }
+}
+
+/** 
+ *******************************************************************************
+ * @brief Record the message the hub is handling so that a stall can be
+ * attributed to it.
+ * 
+ * @param  type_name    IN  message type name (must be static), or NULL when
+ *                          done handling
+ *******************************************************************************
+ */
+void
+LSHubWatchdogSetCurrentMessage(const char *type_name)
+{
+    g_atomic_pointer_set(&probe_current_message, (gpointer)type_name);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Get the mainloop latency probe histogram (how late, in us, each
+ * probe tick ran) as json.
+ * 
+ * @retval  json histogram
+ * @retval  NULL if the probe is disabled
+ *******************************************************************************
+ */
+struct json_object*
+LSHubWatchdogGetProbeJson(void)
+{
+    if (!probe_enabled)
+    {
+        return NULL;
+    }
+
+    return _LSLatencyHistogramGetJson(&probe_lateness, "us");
+}
+
 /** 
  *******************************************************************************
  * @brief Set a watchdog timer on the mainloop. The timeout is sepcified by the
@@ -155,6 +325,9 @@ _WatchdogMainloopTimeout(gpointer data)
 bool
 SetupWatchdog(LSError *lserror)
 {
+    /* the probe only measures, so it runs whatever the failure mode */
+    _WatchdogSetupProbe();
+
     if (g_conf_watchdog_failure_mode == LSHubWatchdogFailureModeNoop)
     {
         /* no-op mode chosen so don't set up the watchdog */
@@ -35,7 +35,11 @@ typedef enum
     LSHubWatchdogFailureModeRdx,            /**< generate rdx report */
 } LSHubWatchdogFailureMode;
 
+struct json_object;
+
 bool SetupWatchdog(LSError *lserror);
 LSHubWatchdogFailureMode LSHubWatchdogProcessFailureMode(const char *mode_str);
+void LSHubWatchdogSetCurrentMessage(const char *type_name);
+struct json_object* LSHubWatchdogGetProbeJson(void);
 
 #endif  /* _WATCHDOG_H */
@@ -0,0 +1,425 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2008-2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "json_scan.h"
+
+/**
+ * @defgroup LunaServiceJsonScan
+ * @ingroup LunaServiceInternals
+ * @brief Top-level key lookup in JSON payloads without a full parse
+ */
+
+/**
+ * @addtogroup LunaServiceJsonScan
+ * @{
+ */
+
+/** Deepest nesting accepted when skipping over a member value */
+#define JSON_SCAN_MAX_DEPTH     64
+
+static inline const char*
+_LSJsonScanSkipSpace(const char *p)
+{
+    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+    {
+        p++;
+    }
+    return p;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Skip over a JSON string.
+ * 
+ * @param  p    IN  pointer to the opening quote 
+ * 
+ * @retval  pointer just past the closing quote on success
+ * @retval  NULL if the string is unterminated or malformed
+ *******************************************************************************
+ */
+static const char*
+_LSJsonScanSkipString(const char *p)
+{
+    for (p++; *p != '"'; p++)
+    {
+        if (*p == '\\')
+        {
+            p++;
+            if (*p == '\0') return NULL;
+        }
+        else if ((unsigned char)*p < 0x20)
+        {
+            /* includes the terminating nul */
+            return NULL;
+        }
+    }
+    return p + 1;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Skip over any JSON value. Containers are skipped by matching
+ * brackets (strings inside them are honored), without checking the
+ * grammar of their contents.
+ * 
+ * @param  p    IN  pointer to the first character of the value 
+ * 
+ * @retval  pointer just past the value on success
+ * @retval  NULL if the value is malformed
+ *******************************************************************************
+ */
+static const char*
+_LSJsonScanSkipValue(const char *p)
+{
+    char closers[JSON_SCAN_MAX_DEPTH];
+    int depth = 0;
+
+    if (*p == '"')
+    {
+        return _LSJsonScanSkipString(p);
+    }
+
+    if (*p != '{' && *p != '[')
+    {
+        /* number or literal */
+        const char *start = p;
+        while (*p && *p != ',' && *p != '}' && *p != ']' &&
+               *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r')
+        {
+            p++;
+        }
+        return p > start ? p : NULL;
+    }
+
+    while (*p)
+    {
+        switch (*p)
+        {
+        case '"':
+            p = _LSJsonScanSkipString(p);
+            if (!p) return NULL;
+            continue;
+        case '{':
+        case '[':
+            if (depth == JSON_SCAN_MAX_DEPTH) return NULL;
+            closers[depth++] = (*p == '{') ? '}' : ']';
+            break;
+        case '}':
+        case ']':
+            if (closers[--depth] != *p) return NULL;
+            if (depth == 0) return p + 1;
+            break;
+        default:
+            break;
+        }
+        p++;
+    }
+
+    return NULL;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Check that a top-level payload that isn't an object is a single
+ * well-formed value. Numbers are only checked for their first character.
+ * 
+ * @param  p    IN  start of the value 
+ * 
+ * @retval  true if it's a value
+ * @retval  false otherwise
+ *******************************************************************************
+ */
+static bool
+_LSJsonScanIsValue(const char *p)
+{
+    const char *end = NULL;
+
+    if (*p == '"' || *p == '[')
+    {
+        end = _LSJsonScanSkipValue(p);
+    }
+    else if (*p == '-' || g_ascii_isdigit(*p))
+    {
+        end = _LSJsonScanSkipValue(p);
+    }
+    else if (strncmp(p, "true", 4) == 0 || strncmp(p, "null", 4) == 0)
+    {
+        end = p + 4;
+    }
+    else if (strncmp(p, "false", 5) == 0)
+    {
+        end = p + 5;
+    }
+
+    return end && *_LSJsonScanSkipSpace(end) == '\0';
+}
+
+/** 
+ *******************************************************************************
+ * @brief Find a top-level member of a JSON object without building a
+ * json_object tree.
+ *
+ * The whole top level is walked so that, as with json_tokener_parse, the
+ * last of several members with the same name wins and a truncated payload
+ * is reported as invalid. A well-formed payload that isn't an object (an
+ * array, string, number or literal) has no members, just as
+ * json_object_object_get_ex finds nothing in one. Member names containing
+ * escapes never match.
+ * 
+ * @param  json         IN  nul-terminated JSON text 
+ * @param  key          IN  member name 
+ * @param  value        OUT start of the raw member value (may be NULL)
+ * @param  value_len    OUT length of the raw member value (may be NULL)
+ * 
+ * @retval  _LSJsonScanFound if the member exists
+ * @retval  _LSJsonScanNotFound if it doesn't (or @json isn't an object)
+ * @retval  _LSJsonScanInvalid if @json isn't well-formed
+ *******************************************************************************
+ */
+_LSJsonScanResult
+_LSJsonScanTopLevel(const char *json, const char *key, const char **value, size_t *value_len)
+{
+    _LSJsonScanResult result = _LSJsonScanNotFound;
+    size_t key_len = strlen(key);
+    const char *p;
+
+    if (!json) return _LSJsonScanInvalid;
+
+    p = _LSJsonScanSkipSpace(json);
+    if (*p != '{')
+    {
+        return _LSJsonScanIsValue(p) ? _LSJsonScanNotFound : _LSJsonScanInvalid;
+    }
+
+    p = _LSJsonScanSkipSpace(p + 1);
+    if (*p == '}') return _LSJsonScanNotFound;
+
+    for (;;)
+    {
+        if (*p != '"') return _LSJsonScanInvalid;
+
+        const char *name = p + 1;
+        p = _LSJsonScanSkipString(p);
+        if (!p) return _LSJsonScanInvalid;
+        size_t name_len = p - 1 - name;
+
+        p = _LSJsonScanSkipSpace(p);
+        if (*p != ':') return _LSJsonScanInvalid;
+        p = _LSJsonScanSkipSpace(p + 1);
+
+        const char *start = p;
+        p = _LSJsonScanSkipValue(p);
+        if (!p) return _LSJsonScanInvalid;
+
+        if (name_len == key_len && memcmp(name, key, key_len) == 0)
+        {
+            result = _LSJsonScanFound;
+            if (value) *value = start;
+            if (value_len) *value_len = p - start;
+        }
+
+        p = _LSJsonScanSkipSpace(p);
+        if (*p == '}') break;
+        if (*p != ',') return _LSJsonScanInvalid;
+        p = _LSJsonScanSkipSpace(p + 1);
+    }
+
+    return result;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Get a top-level member as a boolean, converting other types the
+ * way json_object_get_boolean does (non-zero numbers and non-empty strings
+ * are true; null, objects and arrays are false).
+ * 
+ * @param  json     IN  nul-terminated JSON text 
+ * @param  key      IN  member name 
+ * @param  value    OUT member value (false unless found)
+ * 
+ * @retval  see _LSJsonScanTopLevel
+ *******************************************************************************
+ */
+_LSJsonScanResult
+_LSJsonScanBoolean(const char *json, const char *key, bool *value)
+{
+    const char *raw = NULL;
+    size_t raw_len = 0;
+
+    *value = false;
+
+    _LSJsonScanResult result = _LSJsonScanTopLevel(json, key, &raw, &raw_len);
+    if (result != _LSJsonScanFound) return result;
+
+    *value = _LSJsonScanRawToBoolean(raw, raw_len);
+
+    return result;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Convert a raw value from _LSJsonScanTopLevel to a boolean the way
+ * json_object_get_boolean does.
+ * 
+ * @param  raw      IN  raw value 
+ * @param  raw_len  IN  length of raw value 
+ * 
+ * @retval  value as a boolean
+ *******************************************************************************
+ */
+bool
+_LSJsonScanRawToBoolean(const char *raw, size_t raw_len)
+{
+    if (raw_len == 4 && memcmp(raw, "true", 4) == 0)
+    {
+        return true;
+    }
+    else if (raw[0] == '"')
+    {
+        return raw_len > 2;
+    }
+    else if (raw[0] == '-' || g_ascii_isdigit(raw[0]))
+    {
+        return g_ascii_strtod(raw, NULL) != 0.0;
+    }
+
+    return false;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Append the UTF-8 for a "\uXXXX" escape (and its low surrogate, if
+ * any) to @str.
+ * 
+ * @param  str  IN  string to append to 
+ * @param  p    IN  pointer to the 'u' of the escape 
+ * 
+ * @retval  pointer to the last character of the escape on success
+ * @retval  NULL on malformed escape
+ *******************************************************************************
+ */
+static const char*
+_LSJsonScanUnescapeUnicode(GString *str, const char *p)
+{
+    gunichar c = 0;
+    int i;
+
+    for (i = 1; i <= 4; i++)
+    {
+        if (!g_ascii_isxdigit(p[i])) return NULL;
+        c = (c << 4) | g_ascii_xdigit_value(p[i]);
+    }
+    p += 4;
+
+    if (c >= 0xD800 && c <= 0xDBFF && p[1] == '\\' && p[2] == 'u')
+    {
+        gunichar low = 0;
+        for (i = 3; i <= 6; i++)
+        {
+            if (!g_ascii_isxdigit(p[i])) return NULL;
+            low = (low << 4) | g_ascii_xdigit_value(p[i]);
+        }
+
+        if (low >= 0xDC00 && low <= 0xDFFF)
+        {
+            c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+            p += 6;
+        }
+    }
+
+    g_string_append_unichar(str, c);
+    return p;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Get a top-level string member.
+ * 
+ * @param  json     IN  nul-terminated JSON text 
+ * @param  key      IN  member name 
+ * @param  value    OUT unescaped copy of the string, free with g_free()
+ *                      (NULL unless found)
+ * 
+ * @retval  _LSJsonScanFound if the member exists and is a string
+ * @retval  _LSJsonScanNotFound if it doesn't exist or isn't a string
+ * @retval  _LSJsonScanInvalid if @json isn't a well-formed object
+ *******************************************************************************
+ */
+_LSJsonScanResult
+_LSJsonScanString(const char *json, const char *key, char **value)
+{
+    const char *raw = NULL;
+    size_t raw_len = 0;
+
+    *value = NULL;
+
+    _LSJsonScanResult result = _LSJsonScanTopLevel(json, key, &raw, &raw_len);
+    if (result != _LSJsonScanFound) return result;
+
+    if (raw[0] != '"') return _LSJsonScanNotFound;
+
+    /* skip the quotes */
+    const char *p = raw + 1;
+    const char *end = raw + raw_len - 1;
+
+    if (!memchr(p, '\\', end - p))
+    {
+        *value = g_strndup(p, end - p);
+        return result;
+    }
+
+    GString *str = g_string_sized_new(end - p);
+
+    for (; p < end; p++)
+    {
+        if (*p != '\\')
+        {
+            g_string_append_c(str, *p);
+            continue;
+        }
+
+        p++;
+        switch (*p)
+        {
+        case '"':  g_string_append_c(str, '"');  break;
+        case '\\': g_string_append_c(str, '\\'); break;
+        case '/':  g_string_append_c(str, '/');  break;
+        case 'b':  g_string_append_c(str, '\b'); break;
+        case 'f':  g_string_append_c(str, '\f'); break;
+        case 'n':  g_string_append_c(str, '\n'); break;
+        case 'r':  g_string_append_c(str, '\r'); break;
+        case 't':  g_string_append_c(str, '\t'); break;
+        case 'u':
+            p = _LSJsonScanUnescapeUnicode(str, p);
+            if (p && p < end) break;
+            /* fall through */
+        default:
+            g_string_free(str, TRUE);
+            return _LSJsonScanInvalid;
+        }
+    }
+
+    *value = g_string_free(str, FALSE);
+    return result;
+}
+
+/* @} END OF LunaServiceJsonScan */
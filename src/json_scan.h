@@ -0,0 +1,43 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2008-2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+
+#ifndef _JSON_SCAN_H_
+#define _JSON_SCAN_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Result of looking up a top-level key without building a json_object
+ * tree.
+ */
+typedef enum {
+    _LSJsonScanInvalid = -1,    /**< payload isn't well-formed JSON */
+    _LSJsonScanNotFound = 0,    /**< key isn't a top-level member (or has the wrong type,
+                                     or the payload isn't an object) */
+    _LSJsonScanFound = 1,
+} _LSJsonScanResult;
+
+_LSJsonScanResult _LSJsonScanTopLevel(const char *json, const char *key, const char **value, size_t *value_len);
+_LSJsonScanResult _LSJsonScanBoolean(const char *json, const char *key, bool *value);
+bool _LSJsonScanRawToBoolean(const char *raw, size_t raw_len);
+_LSJsonScanResult _LSJsonScanString(const char *json, const char *key, char **value);
+
+#endif  /* _JSON_SCAN_H_ */
@@ -0,0 +1,504 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2008-2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "base.h"
+#include "clock.h"
+#include "latency.h"
+
+/**
+ * @defgroup LunaServiceLatency
+ * @ingroup LunaServiceInternals
+ * @brief Always-on latency counters and histograms
+ */
+
+/**
+ * @addtogroup LunaServiceLatency
+ * @{
+ */
+
+/**
+ * Per-handle latency stats, reported by the "latency" private debug method
+ */
+struct _LSLatencyStats {
+    pthread_mutex_t lock;       /**< protects everything below */
+    GHashTable *methods;        /**< LSMethod* -> _LSMethodLatency (handler execution time) */
+    GHashTable *destinations;   /**< service name -> _LSLatencyHistogram (call to first reply) */
+};
+
+typedef struct _LSMethodLatency {
+    char *category;
+    char *method;
+    _LSLatencyHistogram hist;
+} _LSMethodLatency;
+
+#define LS_SLOW_CALL_NAME_LEN   64
+
+/**
+ * A method call whose handler took longer than the slow call threshold.
+ * The names are copied in so that recording one doesn't allocate.
+ */
+typedef struct _LSSlowCall {
+    gint seq;                   /**< odd while the entry is being written */
+    gint64 time_us;             /**< when the handler finished (monotonic) */
+    guint64 duration_us;        /**< handler execution time */
+    char category[LS_SLOW_CALL_NAME_LEN];
+    char method[LS_SLOW_CALL_NAME_LEN];
+    char sender[LS_SLOW_CALL_NAME_LEN];
+} _LSSlowCall;
+
+/**
+ * Ring of the most recent slow calls. Writers (the mainloop and any worker
+ * threads) claim a slot with an atomic increment and don't take a lock;
+ * each slot is a seqlock so that a reader skips entries that are being
+ * rewritten.
+ */
+struct _LSSlowCallRing {
+    guint next;                 /**< total calls recorded; next slot is this mod the size */
+    _LSSlowCall calls[LS_SLOW_CALL_RING_SIZE];
+};
+
+/** 
+ *******************************************************************************
+ * @brief Get the current monotonic time in microseconds.
+ * 
+ * @retval  time
+ *******************************************************************************
+ */
+gint64
+_LSLatencyNowUs(void)
+{
+    struct timespec now;
+    ClockGetTime(&now);
+
+    return (gint64)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Add a value to a histogram.
+ * 
+ * @param  hist     IN  histogram
+ * @param  value    IN  value
+ *******************************************************************************
+ */
+void
+_LSLatencyHistogramAdd(_LSLatencyHistogram *hist, guint64 value)
+{
+    int bucket = value ? 63 - __builtin_clzll(value) : 0;
+
+    if (bucket >= LS_LATENCY_HISTOGRAM_NUM_BUCKETS)
+    {
+        bucket = LS_LATENCY_HISTOGRAM_NUM_BUCKETS - 1;
+    }
+
+    hist->buckets[bucket]++;
+    hist->count++;
+    hist->sum += value;
+
+    if (value > hist->max)
+    {
+        hist->max = value;
+    }
+}
+
+/** 
+ *******************************************************************************
+ * @brief Get a histogram as json:
+ *
+ * {"count": int, "mean_<unit>": int, "max_<unit>": int, "buckets": [int,...]}
+ * 
+ * Trailing empty buckets are left out.
+ *
+ * @param  hist     IN  histogram
+ * @param  unit     IN  unit of values (used in key names)
+ * 
+ * @retval  json object on success
+ * @retval  NULL on failure
+ *******************************************************************************
+ */
+struct json_object*
+_LSLatencyHistogramGetJson(const _LSLatencyHistogram *hist, const char *unit)
+{
+    struct json_object *hist_obj = json_object_new_object();
+    if (JSON_ERROR(hist_obj)) return NULL;
+
+    struct json_object *buckets_obj = json_object_new_array();
+    if (JSON_ERROR(buckets_obj))
+    {
+        json_object_put(hist_obj);
+        return NULL;
+    }
+
+    int last = LS_LATENCY_HISTOGRAM_NUM_BUCKETS - 1;
+    while (last >= 0 && hist->buckets[last] == 0)
+    {
+        last--;
+    }
+
+    int i;
+    for (i = 0; i <= last; i++)
+    {
+        json_object_array_add(buckets_obj, json_object_new_int64(hist->buckets[i]));
+    }
+
+    char key[32];
+
+    json_object_object_add(hist_obj, "count", json_object_new_int64(hist->count));
+
+    snprintf(key, sizeof(key), "mean_%s", unit);
+    json_object_object_add(hist_obj, key, json_object_new_int64(hist->count ? hist->sum / hist->count : 0));
+
+    snprintf(key, sizeof(key), "max_%s", unit);
+    json_object_object_add(hist_obj, key, json_object_new_int64(hist->max));
+
+    json_object_object_add(hist_obj, "buckets", buckets_obj);
+
+    return hist_obj;
+}
+
+static void
+_LSMethodLatencyFree(_LSMethodLatency *method_latency)
+{
+    g_free(method_latency->category);
+    g_free(method_latency->method);
+
+#ifdef MEMCHECK
+    memset(method_latency, 0xFF, sizeof(_LSMethodLatency));
+#endif
+
+    g_slice_free(_LSMethodLatency, method_latency);
+}
+
+static void
+_LSLatencyHistogramFree(_LSLatencyHistogram *hist)
+{
+    g_slice_free(_LSLatencyHistogram, hist);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Allocate latency stats.
+ * 
+ * @retval  stats on success
+ * @retval  NULL on failure
+ *******************************************************************************
+ */
+_LSLatencyStats*
+_LSLatencyStatsNew(void)
+{
+    _LSLatencyStats *stats = g_slice_new0(_LSLatencyStats);
+
+    if (stats)
+    {
+        pthread_mutex_init(&stats->lock, NULL);
+        stats->methods = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                               NULL, (GDestroyNotify)_LSMethodLatencyFree);
+        stats->destinations = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                    g_free, (GDestroyNotify)_LSLatencyHistogramFree);
+    }
+
+    return stats;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Free latency stats.
+ * 
+ * @param  stats    IN  stats
+ *******************************************************************************
+ */
+void
+_LSLatencyStatsFree(_LSLatencyStats *stats)
+{
+    LS_ASSERT(stats != NULL);
+
+    g_hash_table_unref(stats->methods);
+    g_hash_table_unref(stats->destinations);
+    pthread_mutex_destroy(&stats->lock);
+
+#ifdef MEMCHECK
+    memset(stats, 0xFF, sizeof(_LSLatencyStats));
+#endif
+
+    g_slice_free(_LSLatencyStats, stats);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Record the execution time of a method handler.
+ * 
+ * @param  stats    IN  stats
+ * @param  category IN  category of method
+ * @param  method   IN  registered method
+ * @param  us       IN  execution time in microseconds
+ *******************************************************************************
+ */
+void
+_LSLatencyStatsAddMethod(_LSLatencyStats *stats, const char *category, const LSMethod *method, guint64 us)
+{
+    pthread_mutex_lock(&stats->lock);
+
+    _LSMethodLatency *method_latency = g_hash_table_lookup(stats->methods, method);
+
+    if (!method_latency)
+    {
+        method_latency = g_slice_new0(_LSMethodLatency);
+
+        if (!method_latency)
+        {
+            pthread_mutex_unlock(&stats->lock);
+            return;
+        }
+
+        method_latency->category = g_strdup(category);
+        method_latency->method = g_strdup(method->name);
+        g_hash_table_insert(stats->methods, (gpointer)method, method_latency);
+    }
+
+    _LSLatencyHistogramAdd(&method_latency->hist, us);
+
+    pthread_mutex_unlock(&stats->lock);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Record the time from issuing a method call to its first reply.
+ * 
+ * @param  stats        IN  stats
+ * @param  service_name IN  destination service
+ * @param  us           IN  latency in microseconds
+ *******************************************************************************
+ */
+void
+_LSLatencyStatsAddCall(_LSLatencyStats *stats, const char *service_name, guint64 us)
+{
+    if (!service_name) return;
+
+    pthread_mutex_lock(&stats->lock);
+
+    _LSLatencyHistogram *hist = g_hash_table_lookup(stats->destinations, service_name);
+
+    if (!hist)
+    {
+        hist = g_slice_new0(_LSLatencyHistogram);
+
+        if (!hist)
+        {
+            pthread_mutex_unlock(&stats->lock);
+            return;
+        }
+
+        g_hash_table_insert(stats->destinations, g_strdup(service_name), hist);
+    }
+
+    _LSLatencyHistogramAdd(hist, us);
+
+    pthread_mutex_unlock(&stats->lock);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Get the stats as json:
+ *
+ * {"methods": [{"category": string, "method": string, "handler": histogram},...],
+ *  "calls": [{"service": string, "reply": histogram},...]}
+ * 
+ * @param  stats    IN  stats
+ * 
+ * @retval  json object on success
+ * @retval  NULL on failure
+ *******************************************************************************
+ */
+struct json_object*
+_LSLatencyStatsGetJson(_LSLatencyStats *stats)
+{
+    GHashTableIter iter;
+    gpointer key = NULL;
+    gpointer value = NULL;
+
+    struct json_object *ret_obj = json_object_new_object();
+    if (JSON_ERROR(ret_obj)) return NULL;
+
+    struct json_object *methods_obj = json_object_new_array();
+    struct json_object *calls_obj = json_object_new_array();
+
+    if (JSON_ERROR(methods_obj) || JSON_ERROR(calls_obj))
+    {
+        if (!JSON_ERROR(methods_obj)) json_object_put(methods_obj);
+        if (!JSON_ERROR(calls_obj)) json_object_put(calls_obj);
+        json_object_put(ret_obj);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&stats->lock);
+
+    g_hash_table_iter_init(&iter, stats->methods);
+    while (g_hash_table_iter_next(&iter, &key, &value))
+    {
+        _LSMethodLatency *method_latency = value;
+        struct json_object *method_obj = json_object_new_object();
+        if (JSON_ERROR(method_obj)) continue;
+
+        json_object_object_add(method_obj, "category", json_object_new_string(method_latency->category));
+        json_object_object_add(method_obj, "method", json_object_new_string(method_latency->method));
+        json_object_object_add(method_obj, "handler", _LSLatencyHistogramGetJson(&method_latency->hist, "us"));
+        json_object_array_add(methods_obj, method_obj);
+    }
+
+    g_hash_table_iter_init(&iter, stats->destinations);
+    while (g_hash_table_iter_next(&iter, &key, &value))
+    {
+        struct json_object *call_obj = json_object_new_object();
+        if (JSON_ERROR(call_obj)) continue;
+
+        json_object_object_add(call_obj, "service", json_object_new_string(key));
+        json_object_object_add(call_obj, "reply", _LSLatencyHistogramGetJson(value, "us"));
+        json_object_array_add(calls_obj, call_obj);
+    }
+
+    pthread_mutex_unlock(&stats->lock);
+
+    json_object_object_add(ret_obj, "methods", methods_obj);
+    json_object_object_add(ret_obj, "calls", calls_obj);
+
+    return ret_obj;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Allocate a slow call ring.
+ * 
+ * @retval  ring on success
+ * @retval  NULL on failure
+ *******************************************************************************
+ */
+_LSSlowCallRing*
+_LSSlowCallRingNew(void)
+{
+    return g_slice_new0(_LSSlowCallRing);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Free a slow call ring.
+ * 
+ * @param  ring     IN  ring
+ *******************************************************************************
+ */
+void
+_LSSlowCallRingFree(_LSSlowCallRing *ring)
+{
+    LS_ASSERT(ring != NULL);
+
+#ifdef MEMCHECK
+    memset(ring, 0xFF, sizeof(_LSSlowCallRing));
+#endif
+
+    g_slice_free(_LSSlowCallRing, ring);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Record a slow method call, overwriting the oldest one if the ring
+ * is full. Safe to call from any thread.
+ * 
+ * @param  ring     IN  ring
+ * @param  category IN  category of method
+ * @param  method   IN  method name
+ * @param  sender   IN  service (or unique) name of the caller
+ * @param  us       IN  handler execution time in microseconds
+ *******************************************************************************
+ */
+void
+_LSSlowCallRingAdd(_LSSlowCallRing *ring, const char *category, const char *method,
+                   const char *sender, guint64 us)
+{
+    guint slot = __sync_fetch_and_add(&ring->next, 1) % LS_SLOW_CALL_RING_SIZE;
+    _LSSlowCall *call = &ring->calls[slot];
+
+    __sync_add_and_fetch(&call->seq, 1);
+
+    call->time_us = _LSLatencyNowUs();
+    call->duration_us = us;
+    g_strlcpy(call->category, category ? category : "", sizeof(call->category));
+    g_strlcpy(call->method, method ? method : "", sizeof(call->method));
+    g_strlcpy(call->sender, sender ? sender : "", sizeof(call->sender));
+
+    __sync_add_and_fetch(&call->seq, 1);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Get the slow calls as json, oldest first:
+ *
+ * [{"category": string, "method": string, "sender": string,
+ *   "duration_us": int, "ago_ms": int},...]
+ * 
+ * Entries that are being written while we read are left out.
+ *
+ * @param  ring     IN  ring
+ * 
+ * @retval  json array on success
+ * @retval  NULL on failure
+ *******************************************************************************
+ */
+struct json_object*
+_LSSlowCallRingGetJson(_LSSlowCallRing *ring)
+{
+    struct json_object *ret_obj = json_object_new_array();
+    if (JSON_ERROR(ret_obj)) return NULL;
+
+    guint next = g_atomic_int_get((gint*)&ring->next);
+    guint count = MIN(next, LS_SLOW_CALL_RING_SIZE);
+    gint64 now = _LSLatencyNowUs();
+    guint i;
+
+    for (i = next - count; i != next; i++)
+    {
+        _LSSlowCall *slot = &ring->calls[i % LS_SLOW_CALL_RING_SIZE];
+        _LSSlowCall call;
+
+        gint seq = g_atomic_int_get(&slot->seq);
+        if (seq & 1) continue;
+
+        memcpy(&call, slot, sizeof(call));
+        __sync_synchronize();
+
+        if (g_atomic_int_get(&slot->seq) != seq) continue;
+
+        struct json_object *call_obj = json_object_new_object();
+        if (JSON_ERROR(call_obj)) continue;
+
+        json_object_object_add(call_obj, "category", json_object_new_string(call.category));
+        json_object_object_add(call_obj, "method", json_object_new_string(call.method));
+        json_object_object_add(call_obj, "sender", json_object_new_string(call.sender));
+        json_object_object_add(call_obj, "duration_us", json_object_new_int(call.duration_us));
+        json_object_object_add(call_obj, "ago_ms", json_object_new_int((now - call.time_us) / 1000));
+        json_object_array_add(ret_obj, call_obj);
+    }
+
+    return ret_obj;
+}
+
+/* @} END OF LunaServiceLatency */
@@ -0,0 +1,72 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2008-2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+
+#ifndef _LATENCY_H_
+#define _LATENCY_H_
+
+#include <stdint.h>
+#include <glib.h>
+#include <luna-service2/lunaservice.h>
+
+/**
+ * Number of buckets in a latency histogram. Bucket i counts values in
+ * [2^i, 2^(i+1)) (bucket 0 also counts 0); the last bucket counts everything
+ * larger.
+ */
+#define LS_LATENCY_HISTOGRAM_NUM_BUCKETS    24
+
+/**
+ * Log-bucketed histogram. Not locked; callers protect it with whatever lock
+ * protects the thing it describes.
+ */
+typedef struct _LSLatencyHistogram {
+    guint64 count;
+    guint64 sum;
+    guint64 max;
+    guint32 buckets[LS_LATENCY_HISTOGRAM_NUM_BUCKETS];
+} _LSLatencyHistogram;
+
+typedef struct _LSLatencyStats _LSLatencyStats;
+
+/** Number of slow method calls remembered */
+#define LS_SLOW_CALL_RING_SIZE              32
+
+typedef struct _LSSlowCallRing _LSSlowCallRing;
+
+struct json_object;
+
+gint64 _LSLatencyNowUs(void);
+
+void _LSLatencyHistogramAdd(_LSLatencyHistogram *hist, guint64 value);
+struct json_object* _LSLatencyHistogramGetJson(const _LSLatencyHistogram *hist, const char *unit);
+
+_LSLatencyStats* _LSLatencyStatsNew(void);
+void _LSLatencyStatsFree(_LSLatencyStats *stats);
+void _LSLatencyStatsAddMethod(_LSLatencyStats *stats, const char *category, const LSMethod *method, guint64 us);
+void _LSLatencyStatsAddCall(_LSLatencyStats *stats, const char *service_name, guint64 us);
+struct json_object* _LSLatencyStatsGetJson(_LSLatencyStats *stats);
+
+_LSSlowCallRing* _LSSlowCallRingNew(void);
+void _LSSlowCallRingFree(_LSSlowCallRing *ring);
+void _LSSlowCallRingAdd(_LSSlowCallRing *ring, const char *category, const char *method,
+                        const char *sender, guint64 us);
+struct json_object* _LSSlowCallRingGetJson(_LSSlowCallRing *ring);
+
+#endif  /* _LATENCY_H_ */
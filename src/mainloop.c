@@ -24,6 +24,8 @@
 #include <pthread.h>
 #include <errno.h>
 #include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 
 #include <luna-service2/lunaservice.h>
 #include "lunaservice-custom-priv.h"
@@ -32,21 +34,60 @@
 #include "message.h"
 #include "transport_priv.h"
 
+#define FETCH_QUEUE_POLL_FDS_INITIAL    16  /**< initial size of poll_fds */
+#define FETCH_QUEUE_EPOLL_EVENTS_MAX    64  /**< epoll events read per wait */
+
+/**
+ * The fetch queue's connections are all attached to one GMainContext, but
+ * that context is driven by hand: the fds it wants polled are kept in an
+ * epoll set instead of being handed to poll(2) on every iteration, and the
+ * epoll fd can be given to another event loop (see LSFetchQueueGetFd()).
+ * A timerfd in the same set stands in for the context's next timeout.
+ */
 struct LSFetchQueue {
     GSList *sh_list;
     GSList *dispatch_iter;
     GMainContext *main_context;
+
+    int epoll_fd;
+    int timer_fd;               /**< -1 until LSFetchQueueGetFd() */
+    GHashTable *epoll_fds;      /**< fd --> epoll events currently registered */
+    GPollFD *poll_fds;          /**< last g_main_context_query() result */
+    gint poll_fds_size;         /**< allocated size of poll_fds */
 };
 
+#define CUSTOM_MESSAGE_QUEUE_SIZE   256     /**< ring slots; must be a power of 2 */
+#define CUSTOM_MESSAGE_QUEUE_MASK   (CUSTOM_MESSAGE_QUEUE_SIZE - 1)
+
+typedef struct _LSCustomMessageQueueSlot {
+    gint sequence;                  /**< slot's turn: == push position when free,
+                                         push position + 1 when it holds a message */
+    _LSTransportMessage *message;
+} _LSCustomMessageQueueSlot;
+
+/**
+ * Incoming messages for a custom mainloop. This is a bounded lock-free ring
+ * (multiple producers, one consumer: pops are serialized by the fetch
+ * message queue lock). If the ring fills up, messages spill over into a
+ * locked GQueue until the consumer catches up, so nothing is ever dropped.
+ */
 struct LSCustomMessageQueue {
-    pthread_mutex_t lock; 
-    GQueue *queue;   
+    _LSCustomMessageQueueSlot slots[CUSTOM_MESSAGE_QUEUE_SIZE];
+    gint head;                      /**< next position to pop (consumer only) */
+    gint tail;                      /**< next position to push */
+    gint count;                     /**< messages in the ring and overflow */
+
+    gint overflow_len;              /**< length of overflow; read without the lock */
+    pthread_mutex_t lock;           /**< protects overflow */
+    GQueue *overflow;
 };
 
-void LSCustomMessageQueuePush(LSCustomMessageQueue *q, _LSTransportMessage *message);
+bool LSCustomMessageQueuePush(LSCustomMessageQueue *q, _LSTransportMessage *message);
 _LSTransportMessage* LSCustomMessageQueuePop(LSCustomMessageQueue *q);
 bool LSCustomMessageQueueIsEmpty(LSCustomMessageQueue *q);
 
+static bool _LSFetchQueueFetch(LSFetchQueue *fq, LSMessage **ret_message, LSError *lserror);
+
 /**
  * @addtogroup LunaServiceMainloop
  *
@@ -63,6 +104,7 @@ LSGmainAttachPalmService(LSPalmService *psh,
     bool retVal;
     retVal = LSGmainAttach(psh->public_sh, mainLoop, lserror);
     if (!retVal) return retVal;
+    /* if the handles share a transport, this just takes a ref on the context */
     retVal = LSGmainAttach(psh->private_sh, mainLoop, lserror);
     if (!retVal) return retVal;
 
@@ -90,7 +132,19 @@ LSGmainAttach(LSHandle *sh, GMainLoop *mainLoop, LSError *lserror)
     _LSErrorIfFailMsg(context != NULL, lserror, -1,
                    "%s: %s", __FUNCTION__, ": No maincontext.");
 
-    _LSTransportGmainAttach(sh->transport, context);
+    if (sh->palm_peer && sh->palm_peer->context)
+    {
+        /* the handles of the palm service share a transport, and the other
+         * one already attached it */
+        _LSErrorIfFailMsg(sh->palm_peer->context == context, lserror, -EINVAL,
+                          "%s: the other handle of the palm service is attached to a different main context",
+                          __FUNCTION__);
+    }
+    else
+    {
+        _LSTransportGmainAttach(sh->transport, context);
+    }
+
     sh->context = g_main_context_ref(context);
 
     return true;
@@ -136,6 +190,15 @@ LSGmainDetachPalmService(LSPalmService *psh, LSError *lserror)
 {
     bool retVal;
 
+    if (psh->public_sh->palm_peer)
+    {
+        _LSErrorIfFailMsg(psh->public_sh->context != NULL, lserror, -1,
+                          "%s: %s", __FUNCTION__, ": No maincontext.");
+
+        /* the handles share a transport, so they're detached together */
+        return _LSUnregisterPalmServiceCommon(psh, false, LSHANDLE_GET_RETURN_ADDR(), lserror);
+    }
+
     retVal = LSGmainDetach(psh->public_sh, lserror);
     if (!retVal) return retVal;
     retVal = LSGmainDetach(psh->private_sh, lserror);
@@ -199,7 +262,19 @@ _LSCustomMessageHandler(_LSTransportMessage *message, void *context)
     /* add the messages to our internal queue */
     LSHandle *sh = (LSHandle*)context;
     _LSTransportMessageRef(message);
-    LSCustomMessageQueuePush(sh->custom_message_queue, message);
+
+    bool was_empty = LSCustomMessageQueuePush(sh->custom_message_queue, message);
+
+    /* We normally run inside the context's own dispatch, in which case the
+     * consumer will look at the queue as soon as we return. Otherwise only
+     * the first message of a batch needs to wake it up. */
+    GMainContext *context_wake = sh->transport->mainloop_context;
+
+    if (was_empty && context_wake && !g_main_context_is_owner(context_wake))
+    {
+        g_main_context_wakeup(context_wake);
+    }
+
     return LSMessageHandlerResultHandled;
 }
 
@@ -236,8 +311,15 @@ LSCustomMessageQueueNew(void)
 
     if (ret)
     {
+        int i;
+
+        for (i = 0; i < CUSTOM_MESSAGE_QUEUE_SIZE; i++)
+        {
+            ret->slots[i].sequence = i;
+        }
+
         pthread_mutex_init(&ret->lock, NULL);
-        ret->queue = g_queue_new();
+        ret->overflow = g_queue_new();
     }
 
     return ret;
@@ -247,13 +329,16 @@ void
 LSCustomMessageQueueFree(LSCustomMessageQueue *q)
 {
     /* clean up any remaining messages on the queue */
-    while (!g_queue_is_empty(q->queue))
+    _LSTransportMessage *message;
+
+    while ((message = LSCustomMessageQueuePop(q)) != NULL)
     {
-        _LSTransportMessage *message = g_queue_pop_head(q->queue);
+        /* Pop() dropped the queue's ref; drop the handler's too */
         _LSTransportMessageUnref(message);
     }
 
-    g_queue_free(q->queue);
+    g_queue_free(q->overflow);
+    pthread_mutex_destroy(&q->lock);
 
 #ifdef MEMCHECK
     memset(q, 0xFF, sizeof(LSCustomMessageQueue));
@@ -265,44 +350,150 @@ LSCustomMessageQueueFree(LSCustomMessageQueue *q)
 bool
 LSCustomMessageQueueIsEmpty(LSCustomMessageQueue *q)
 {
-    bool ret = true;
+    return g_atomic_int_get(&q->count) == 0;
+}
 
-    pthread_mutex_lock(&q->lock);
-    ret = g_queue_is_empty(q->queue);
-    pthread_mutex_unlock(&q->lock);
-    
-    return ret;
+/** 
+ *******************************************************************************
+ * @brief Try to put a message on the ring.
+ * 
+ * @param  q        IN  queue
+ * @param  message  IN  message
+ * 
+ * @retval  true on success
+ * @retval  false if the ring is full
+ *******************************************************************************
+ */
+static bool
+_LSCustomMessageQueueRingPush(LSCustomMessageQueue *q, _LSTransportMessage *message)
+{
+    _LSCustomMessageQueueSlot *slot;
+    gint pos = g_atomic_int_get(&q->tail);
+
+    for (;;)
+    {
+        slot = &q->slots[(guint)pos & CUSTOM_MESSAGE_QUEUE_MASK];
+
+        gint diff = (gint)((guint)g_atomic_int_get(&slot->sequence) - (guint)pos);
+
+        if (diff == 0)
+        {
+            /* slot is free; claim this position */
+            if (g_atomic_int_compare_and_exchange(&q->tail, pos, (gint)((guint)pos + 1)))
+            {
+                break;
+            }
+            pos = g_atomic_int_get(&q->tail);
+        }
+        else if (diff < 0)
+        {
+            /* the consumer hasn't gotten to this slot's last message yet */
+            return false;
+        }
+        else
+        {
+            /* another producer got here first */
+            pos = g_atomic_int_get(&q->tail);
+        }
+    }
+
+    slot->message = message;
+
+    /* publish (full barrier) */
+    g_atomic_int_set(&slot->sequence, (gint)((guint)pos + 1));
+
+    return true;
+}
+
+static _LSTransportMessage*
+_LSCustomMessageQueueRingPop(LSCustomMessageQueue *q)
+{
+    gint pos = q->head;
+    _LSCustomMessageQueueSlot *slot = &q->slots[(guint)pos & CUSTOM_MESSAGE_QUEUE_MASK];
+
+    if (g_atomic_int_get(&slot->sequence) != (gint)((guint)pos + 1))
+    {
+        /* empty (or a producer hasn't finished publishing yet) */
+        return NULL;
+    }
+
+    _LSTransportMessage *message = slot->message;
+    slot->message = NULL;
+
+    /* hand the slot back to producers for the next lap */
+    g_atomic_int_set(&slot->sequence, (gint)((guint)pos + CUSTOM_MESSAGE_QUEUE_SIZE));
+    q->head = (gint)((guint)pos + 1);
+
+    return message;
 }
 
 _LSTransportMessage*
 LSCustomMessageQueuePop(LSCustomMessageQueue *q)
 {
-    /* lock queue */
-    pthread_mutex_lock(&q->lock);
+    _LSTransportMessage *ret = _LSCustomMessageQueueRingPop(q);
 
-    _LSTransportMessage *ret = g_queue_pop_head(q->queue);
-    
-    /* unlock queue */
-    pthread_mutex_unlock(&q->lock);
-    
-    if (ret) _LSTransportMessageUnref(ret);
+    /* The overflow only fills while the ring is full, so everything on it
+     * is newer than what's on the ring */
+    if (!ret && g_atomic_int_get(&q->overflow_len) > 0)
+    {
+        pthread_mutex_lock(&q->lock);
+        ret = g_queue_pop_head(q->overflow);
+        g_atomic_int_set(&q->overflow_len, q->overflow->length);
+        pthread_mutex_unlock(&q->lock);
+    }
+
+    if (ret)
+    {
+        g_atomic_int_add(&q->count, -1);
+        _LSTransportMessageUnref(ret);
+    }
 
     return ret;
 }
 
-void
+/** 
+ *******************************************************************************
+ * @brief Add a message to the queue.
+ * 
+ * @param  q        IN  queue
+ * @param  message  IN  message (ref'd by the queue)
+ * 
+ * @retval  true if the queue was empty before this message
+ * @retval  false otherwise
+ *******************************************************************************
+ */
+bool
 LSCustomMessageQueuePush(LSCustomMessageQueue *q, _LSTransportMessage *message)
 {
     _LSTransportMessageRef(message);
-    
-    /* lock queue */
-    pthread_mutex_lock(&q->lock);
 
-    g_queue_push_tail(q->queue, message);
-    
-    /* unlock queue */
-    pthread_mutex_unlock(&q->lock);
+    /* fast path: nothing has spilled over, so the ring is in order */
+    if (g_atomic_int_get(&q->overflow_len) > 0 || !_LSCustomMessageQueueRingPush(q, message))
+    {
+        pthread_mutex_lock(&q->lock);
+
+        /* Once anything has spilled over, keep spilling until the consumer
+         * has drained it so that messages stay in order. A producer only
+         * goes back to the ring after seeing the overflow empty with the
+         * lock held (the ring may have room again by now, e.g., if we lost
+         * a race with the consumer) */
+        if (q->overflow->length > 0 || !_LSCustomMessageQueueRingPush(q, message))
+        {
+            g_queue_push_tail(q->overflow, message);
+            g_atomic_int_set(&q->overflow_len, q->overflow->length);
+        }
+
+        pthread_mutex_unlock(&q->lock);
+    }
 
+    gint count;
+
+    do
+    {
+        count = g_atomic_int_get(&q->count);
+    } while (!g_atomic_int_compare_and_exchange(&q->count, count, count + 1));
+
+    return count == 0;
 }
 
 /** 
@@ -335,20 +526,24 @@ LSCustomWaitForMessage(LSHandle *sh, LSMessage **message,
         return true;
     
     /* install custom message callback if not done already */
-    if (G_UNLIKELY(sh->transport->msg_handler != _LSCustomMessageHandler))
+    if (G_UNLIKELY(sh->bus->msg_handler != _LSCustomMessageHandler))
     {
-        sh->transport->msg_handler = _LSCustomMessageHandler;
-        sh->transport->msg_context = sh;
+        _LSTransportBusSetMessageHandler(sh->bus, _LSCustomMessageHandler, sh);
         
-        sh->transport->mainloop_context = g_main_context_new();
-
+        /* the other handle of a palm service may have set up the shared
+         * transport already */
         if (!sh->transport->mainloop_context)
         {
-            _LSErrorSet(lserror, -ENOMEM, "OOM");
-            return false;
-        }
+            sh->transport->mainloop_context = g_main_context_new();
 
-        _LSTransportAddInitialWatches(sh->transport, sh->transport->mainloop_context);
+            if (!sh->transport->mainloop_context)
+            {
+                _LSErrorSet(lserror, -ENOMEM, "OOM");
+                return false;
+            }
+
+            _LSTransportAddInitialWatches(sh->transport, sh->transport->mainloop_context);
+        }
     }
 
     /* 
@@ -370,16 +565,300 @@ LSFetchQueueNew(LSFetchQueue **ret_fetch_queue)
 {
     if (!ret_fetch_queue) return false;
 
-    *ret_fetch_queue = g_new0(LSFetchQueue, 1);
+    LSFetchQueue *fq = g_new0(LSFetchQueue, 1);
+
+    fq->timer_fd = -1;
+    fq->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
 
-    if (*ret_fetch_queue)
+    if (fq->epoll_fd == -1)
     {
-        (*ret_fetch_queue)->main_context = g_main_context_new();
+        g_critical("%s: epoll_create1: %s", __func__, g_strerror(errno));
+        g_free(fq);
+        *ret_fetch_queue = NULL;
+        return false;
     }
 
+    fq->main_context = g_main_context_new();
+    fq->epoll_fds = g_hash_table_new(g_direct_hash, g_direct_equal);
+    fq->poll_fds_size = FETCH_QUEUE_POLL_FDS_INITIAL;
+    fq->poll_fds = g_new(GPollFD, fq->poll_fds_size);
+
+    *ret_fetch_queue = fq;
+
     return true;
 }
 
+static uint32_t
+_LSFetchQueueEpollEvents(gushort events)
+{
+    uint32_t ret = 0;
+
+    if (events & G_IO_IN) ret |= EPOLLIN;
+    if (events & G_IO_OUT) ret |= EPOLLOUT;
+    if (events & G_IO_PRI) ret |= EPOLLPRI;
+
+    return ret;
+}
+
+static gushort
+_LSFetchQueueGlibEvents(uint32_t events)
+{
+    gushort ret = 0;
+
+    if (events & EPOLLIN) ret |= G_IO_IN;
+    if (events & EPOLLOUT) ret |= G_IO_OUT;
+    if (events & EPOLLPRI) ret |= G_IO_PRI;
+    if (events & EPOLLERR) ret |= G_IO_ERR;
+    if (events & EPOLLHUP) ret |= G_IO_HUP;
+
+    return ret;
+}
+
+/**
+ *******************************************************************************
+ * @brief Make the epoll set match the fds (and events) from the last query.
+ * The same fd can show up more than once (e.g., the send and receive
+ * watches for a connection), so the events are merged per fd.
+ *
+ * @param  fq       IN  fetch queue
+ * @param  n_fds    IN  number of valid entries in fq->poll_fds
+ *******************************************************************************
+ */
+static void
+_LSFetchQueueEpollSync(LSFetchQueue *fq, gint n_fds)
+{
+    GHashTable *wanted = g_hash_table_new(g_direct_hash, g_direct_equal);
+    GHashTableIter iter;
+    gpointer key, value;
+    gint i;
+
+    for (i = 0; i < n_fds; i++)
+    {
+        gpointer fd_key = GINT_TO_POINTER(fq->poll_fds[i].fd);
+        uint32_t events = GPOINTER_TO_UINT(g_hash_table_lookup(wanted, fd_key));
+
+        events |= _LSFetchQueueEpollEvents(fq->poll_fds[i].events);
+
+        /* store something non-zero so that an fd with no events (only
+         * interested in errors) is still registered */
+        g_hash_table_replace(wanted, fd_key, GUINT_TO_POINTER(events | EPOLLERR));
+    }
+
+    /* drop fds that nobody is waiting on any more; a closed fd has already
+     * left the epoll set on its own, so errors are expected here */
+    g_hash_table_iter_init(&iter, fq->epoll_fds);
+    while (g_hash_table_iter_next(&iter, &key, NULL))
+    {
+        if (!g_hash_table_lookup(wanted, key))
+        {
+            epoll_ctl(fq->epoll_fd, EPOLL_CTL_DEL, GPOINTER_TO_INT(key), NULL);
+            g_hash_table_iter_remove(&iter);
+        }
+    }
+
+    g_hash_table_iter_init(&iter, wanted);
+    while (g_hash_table_iter_next(&iter, &key, &value))
+    {
+        int fd = GPOINTER_TO_INT(key);
+        struct epoll_event event = { .events = GPOINTER_TO_UINT(value), .data.fd = fd };
+        gpointer registered = g_hash_table_lookup(fq->epoll_fds, key);
+
+        if (registered == value)
+        {
+            continue;
+        }
+
+        int op = registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+
+        if (epoll_ctl(fq->epoll_fd, op, fd, &event) != 0)
+        {
+            /* the fd number was closed and reused since we last looked */
+            op = (errno == ENOENT) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+
+            if (epoll_ctl(fq->epoll_fd, op, fd, &event) != 0)
+            {
+                g_warning("%s: unable to watch fd %d: %s", __func__, fd, g_strerror(errno));
+                g_hash_table_remove(fq->epoll_fds, key);
+                continue;
+            }
+        }
+
+        g_hash_table_replace(fq->epoll_fds, key, value);
+    }
+
+    g_hash_table_destroy(wanted);
+}
+
+/**
+ *******************************************************************************
+ * @brief Acquire and prepare the fetch queue's context and bring the epoll
+ * set up to date with what it wants polled. Must be followed by @ref
+ * _LSFetchQueueCheck() to finish the iteration.
+ *
+ * @param  fq           IN  fetch queue
+ * @param  max_priority OUT priority to pass to @ref _LSFetchQueueCheck()
+ * @param  timeout_ms   OUT how long the context is willing to wait
+ *
+ * @retval  number of valid entries in fq->poll_fds
+ *******************************************************************************
+ */
+static gint
+_LSFetchQueuePrepare(LSFetchQueue *fq, gint *max_priority, gint *timeout_ms)
+{
+    gint n_fds;
+
+    g_main_context_acquire(fq->main_context);
+
+    /* if something is already ready, the query's timeout comes back 0 */
+    g_main_context_prepare(fq->main_context, max_priority);
+
+    while ((n_fds = g_main_context_query(fq->main_context, *max_priority, timeout_ms,
+                                         fq->poll_fds, fq->poll_fds_size)) > fq->poll_fds_size)
+    {
+        fq->poll_fds_size = n_fds;
+        fq->poll_fds = g_renew(GPollFD, fq->poll_fds, fq->poll_fds_size);
+    }
+
+    _LSFetchQueueEpollSync(fq, n_fds);
+
+    return n_fds;
+}
+
+/**
+ *******************************************************************************
+ * @brief Wait on the epoll set, check the context with the results and
+ * dispatch whatever is ready. Incoming messages end up on the queues of the
+ * connections they arrived on (see _LSCustomMessageHandler()).
+ *
+ * @param  fq           IN  fetch queue
+ * @param  n_fds        IN  from @ref _LSFetchQueuePrepare()
+ * @param  max_priority IN  from @ref _LSFetchQueuePrepare()
+ * @param  timeout_ms   IN  how long to wait (-1 forever, 0 don't wait at all)
+ *******************************************************************************
+ */
+static void
+_LSFetchQueueCheck(LSFetchQueue *fq, gint n_fds, gint max_priority, gint timeout_ms)
+{
+    struct epoll_event events[FETCH_QUEUE_EPOLL_EVENTS_MAX];
+    GHashTable *ready = NULL;
+    gint i;
+
+    int num_events = epoll_wait(fq->epoll_fd, events, ARRAY_SIZE(events), timeout_ms);
+
+    if (num_events > 0)
+    {
+        ready = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+        for (i = 0; i < num_events; i++)
+        {
+            if (events[i].data.fd == fq->timer_fd)
+            {
+                /* just a wakeup for the context's timeout; clear it */
+                uint64_t expirations;
+                if (read(fq->timer_fd, &expirations, sizeof(expirations)) < 0)
+                {
+                    /* already cleared by a re-arm */
+                }
+                continue;
+            }
+
+            g_hash_table_insert(ready, GINT_TO_POINTER(events[i].data.fd), GUINT_TO_POINTER(events[i].events));
+        }
+    }
+
+    for (i = 0; i < n_fds; i++)
+    {
+        uint32_t revents = ready ? GPOINTER_TO_UINT(g_hash_table_lookup(ready, GINT_TO_POINTER(fq->poll_fds[i].fd))) : 0;
+
+        fq->poll_fds[i].revents = _LSFetchQueueGlibEvents(revents) & (fq->poll_fds[i].events | G_IO_ERR | G_IO_HUP);
+    }
+
+    if (ready) g_hash_table_destroy(ready);
+
+    if (g_main_context_check(fq->main_context, max_priority, fq->poll_fds, n_fds))
+    {
+        g_main_context_dispatch(fq->main_context);
+    }
+
+    g_main_context_release(fq->main_context);
+}
+
+/**
+ *******************************************************************************
+ * @brief Run one iteration of the fetch queue's context.
+ *
+ * @param  fq       IN  fetch queue
+ * @param  block    IN  true to wait for something to happen
+ *******************************************************************************
+ */
+static void
+_LSFetchQueueIterate(LSFetchQueue *fq, bool block)
+{
+    gint max_priority = G_MAXINT;
+    gint timeout_ms = -1;
+
+    gint n_fds = _LSFetchQueuePrepare(fq, &max_priority, &timeout_ms);
+
+    _LSFetchQueueCheck(fq, n_fds, max_priority, block ? timeout_ms : 0);
+}
+
+/**
+ *******************************************************************************
+ * @brief Re-arm the external fd: bring the epoll set up to date with any
+ * watches added since the last iteration and set the timerfd for the
+ * context's next timeout, without dispatching anything.
+ *
+ * @param  fq       IN  fetch queue
+ *******************************************************************************
+ */
+static void
+_LSFetchQueueArm(LSFetchQueue *fq)
+{
+    gint max_priority = G_MAXINT;
+    gint timeout_ms = -1;
+    gint i;
+
+    if (fq->timer_fd == -1)
+    {
+        return;
+    }
+
+    gint n_fds = _LSFetchQueuePrepare(fq, &max_priority, &timeout_ms);
+
+    /* finish the iteration without polling or dispatching */
+    for (i = 0; i < n_fds; i++)
+    {
+        fq->poll_fds[i].revents = 0;
+    }
+
+    if (g_main_context_check(fq->main_context, max_priority, fq->poll_fds, n_fds))
+    {
+        /* ready without any I/O (e.g., an idle); wake up right away */
+        timeout_ms = 0;
+    }
+
+    g_main_context_release(fq->main_context);
+
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+
+    if (timeout_ms == 0)
+    {
+        spec.it_value.tv_nsec = 1;
+    }
+    else if (timeout_ms > 0)
+    {
+        spec.it_value.tv_sec = timeout_ms / 1000;
+        spec.it_value.tv_nsec = (timeout_ms % 1000) * 1000000;
+    }
+    /* else -1: all zero disarms the timer */
+
+    if (timerfd_settime(fq->timer_fd, 0, &spec, NULL) != 0)
+    {
+        g_warning("%s: timerfd_settime: %s", __func__, g_strerror(errno));
+    }
+}
+
 // TODO
 bool
 LSFetchQueueWakeUp(LSFetchQueue *fq, LSError *lserror)
@@ -410,6 +889,11 @@ LSFetchQueueFree(LSFetchQueue *fq)
         g_slist_free(fq->sh_list);
         g_main_context_unref(fq->main_context);
 
+        g_hash_table_destroy(fq->epoll_fds);
+        g_free(fq->poll_fds);
+        if (fq->timer_fd != -1) close(fq->timer_fd);
+        close(fq->epoll_fd);
+
 #ifdef MEMCHECK
         memset(fq, 0xFF, sizeof(LSFetchQueue));
 #endif
@@ -427,12 +911,19 @@ LSFetchQueueAddConnection(LSFetchQueue *fq, LSHandle *sh)
         fq->sh_list = g_slist_prepend(fq->sh_list, sh);
         
         /* use custom message handler and attach context */
-        if ((sh->transport->msg_handler != _LSCustomMessageHandler))
+        if ((sh->bus->msg_handler != _LSCustomMessageHandler))
+        {
+            _LSTransportBusSetMessageHandler(sh->bus, _LSCustomMessageHandler, sh);
+        }
+
+        /* the other handle of a palm service may have attached the shared
+         * transport already */
+        if (sh->transport->mainloop_context != fq->main_context)
         {
-            sh->transport->msg_handler = _LSCustomMessageHandler;
-            sh->transport->msg_context = sh;
+            _LSTransportGmainAttach(sh->transport, fq->main_context);
         }
-        _LSTransportGmainAttach(sh->transport, fq->main_context);
+
+        _LSFetchQueueArm(fq);
     }
 }
 
@@ -449,7 +940,6 @@ LSFetchQueueWaitForMessage(LSFetchQueue *fq, LSMessage **ret_message,
 
     GSList *iter;
     //int nfd = -1;
-    bool retVal;
     bool do_iteration = true;
 
     /* If we have already pending data we don't want to block on the iteration
@@ -466,15 +956,134 @@ LSFetchQueueWaitForMessage(LSFetchQueue *fq, LSMessage **ret_message,
     }
 
     /* 
-     * Run an interation of the context: g_main_context_iteration, which
-     * will call our special custom message callback and add to the queue of
-     * messages
+     * Run an interation of the context, which will call our special custom
+     * message callback and add to the queue of messages
      */
     if (do_iteration)
     {
-        g_main_context_iteration(fq->main_context, TRUE);
+        _LSFetchQueueIterate(fq, true);
+    }
+
+    return _LSFetchQueueFetch(fq, ret_message, lserror);
+}
+
+/**
+ *******************************************************************************
+ * @brief Get an fd that becomes readable when the fetch queue has work to
+ * do, for embedding the fetch queue in another event loop (libuv, etc.)
+ * instead of blocking in LSFetchQueueWaitForMessage().
+ *
+ * When the fd is readable, call LSFetchQueueDispatch() and then
+ * LSFetchQueueFetchMessage() until it returns no message; the fd is re-armed
+ * when the queue runs dry. The fd covers every connection added with
+ * LSFetchQueueAddConnection() (and any it opens later) as well as timeouts.
+ *
+ * @param  fq       IN  fetch queue
+ * @param  ret_fd   OUT fd to wait for readability on; owned by fq
+ * @param  lserror  OUT set on error
+ *
+ * @retval  true on success
+ * @retval  false on failure
+ *******************************************************************************
+ */
+bool
+LSFetchQueueGetFd(LSFetchQueue *fq, int *ret_fd, LSError *lserror)
+{
+    _LSErrorIfFail(fq != NULL, lserror);
+    _LSErrorIfFail(ret_fd != NULL, lserror);
+
+    if (fq->timer_fd == -1)
+    {
+        fq->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+        if (fq->timer_fd == -1)
+        {
+            _LSErrorSetFromErrno(lserror, errno);
+            return false;
+        }
+
+        struct epoll_event event = { .events = EPOLLIN, .data.fd = fq->timer_fd };
+
+        if (epoll_ctl(fq->epoll_fd, EPOLL_CTL_ADD, fq->timer_fd, &event) != 0)
+        {
+            _LSErrorSetFromErrno(lserror, errno);
+            close(fq->timer_fd);
+            fq->timer_fd = -1;
+            return false;
+        }
+
+        _LSFetchQueueArm(fq);
     }
 
+    *ret_fd = fq->epoll_fd;
+
+    return true;
+}
+
+/**
+ *******************************************************************************
+ * @brief Read whatever is ready on the fetch queue's connections, without
+ * blocking. Use with LSFetchQueueGetFd().
+ *
+ * @param  fq       IN  fetch queue
+ * @param  lserror  OUT set on error
+ *
+ * @retval  true on success
+ * @retval  false on failure
+ *******************************************************************************
+ */
+bool
+LSFetchQueueDispatch(LSFetchQueue *fq, LSError *lserror)
+{
+    _LSErrorIfFail(fq != NULL, lserror);
+
+    _LSFetchQueueIterate(fq, false);
+
+    return true;
+}
+
+/**
+ *******************************************************************************
+ * @brief Fetch the next message from the fetch queue without blocking. Use
+ * with LSFetchQueueGetFd().
+ *
+ * @param  fq           IN  fetch queue
+ * @param  ret_message  OUT ref'd message (LSMessageUnref() when done), NULL
+ *                          if there are no more messages
+ * @param  lserror      OUT set on error
+ *
+ * @retval  true on success
+ * @retval  false on failure
+ *******************************************************************************
+ */
+bool
+LSFetchQueueFetchMessage(LSFetchQueue *fq, LSMessage **ret_message, LSError *lserror)
+{
+    _LSErrorIfFail(fq != NULL, lserror);
+    _LSErrorIfFail(ret_message != NULL, lserror);
+
+    if (!_LSFetchQueueFetch(fq, ret_message, lserror))
+    {
+        return false;
+    }
+
+    if (*ret_message == NULL)
+    {
+        /* handling the messages may have added watches (e.g., a send that
+         * would block) that the fd doesn't know about yet */
+        _LSFetchQueueArm(fq);
+    }
+
+    return true;
+}
+
+/* 
+ * Fetch a message from the connections in the fetch queue, round robin.
+ */
+static bool
+_LSFetchQueueFetch(LSFetchQueue *fq, LSMessage **ret_message, LSError *lserror)
+{
+    bool retVal;
 
     /**********
      * Dispatch
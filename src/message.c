@@ -27,7 +27,11 @@
 #include <luna-service2/lunaservice.h>
 
 #include "base.h"
+#include "json_scan.h"
 #include "message.h"
+#include "reply_cache.h"
+#include "binary_payload.h"
+#include "utf8.h"
 
 /**
  * @addtogroup LunaServiceInternals
@@ -69,6 +73,10 @@ _LSMessageFree(LSMessage *message)
     g_free(message->methodAllocated);
     g_free(message->payloadAllocated);
 
+    if (message->payloadObject) json_object_put(message->payloadObject);
+
+    g_free(message->replyCacheKey);
+
 #ifdef MEMCHECK
     memset(message, 0xFF, sizeof(LSMessage));
 #endif
@@ -76,6 +84,79 @@ _LSMessageFree(LSMessage *message)
     g_free(message);
 }
 
+/** 
+* @brief Look for a top-level "subscribe" in the message payload.
+*
+* The payload is scanned without building a json_object tree, and the
+* result is cached on the message since LSMessageIsSubscription and
+* LSSubscriptionProcess are often both called for the same message.
+* 
+* @param  message 
+* 
+* @retval
+*/
+_LSMessageSubscribeState
+_LSMessageGetSubscribeState(LSMessage *message)
+{
+    if (message->subscribeState == _LSMessageSubscribeUnknown
+        && _LSTransportMessageIsBinaryPayload(message->transport_msg))
+    {
+        /* already a tree, so there's nothing to gain from scanning */
+        struct json_object *object = LSMessageGetPayloadObject(message);
+        struct json_object *subscribe = NULL;
+
+        if (!object)
+        {
+            message->subscribeState = _LSMessageSubscribeInvalid;
+        }
+        else if (!json_object_object_get_ex(object, "subscribe", &subscribe)
+                 || !json_object_get_boolean(subscribe))
+        {
+            message->subscribeState = _LSMessageSubscribeFalse;
+        }
+        else if (json_object_is_type(subscribe, json_type_boolean))
+        {
+            message->subscribeState = _LSMessageSubscribeTrue;
+        }
+        else
+        {
+            message->subscribeState = _LSMessageSubscribeTrueNotBoolean;
+        }
+    }
+
+    if (message->subscribeState == _LSMessageSubscribeUnknown)
+    {
+        const char *raw = NULL;
+        size_t raw_len = 0;
+
+        switch (_LSJsonScanTopLevel(LSMessageGetPayload(message), "subscribe", &raw, &raw_len))
+        {
+        case _LSJsonScanInvalid:
+            message->subscribeState = _LSMessageSubscribeInvalid;
+            break;
+        case _LSJsonScanFound:
+            if (!_LSJsonScanRawToBoolean(raw, raw_len))
+            {
+                message->subscribeState = _LSMessageSubscribeFalse;
+            }
+            else if (raw_len == 4 && memcmp(raw, "true", 4) == 0)
+            {
+                message->subscribeState = _LSMessageSubscribeTrue;
+            }
+            else
+            {
+                message->subscribeState = _LSMessageSubscribeTrueNotBoolean;
+            }
+            break;
+        default:
+            message->subscribeState = _LSMessageSubscribeFalse;
+            break;
+        }
+    }
+
+    return message->subscribeState;
+}
+
 /* @} END OF LunaServiceInternals */
 
 /**
@@ -350,11 +431,127 @@ LSMessageGetPayload(LSMessage *message)
         return message->payload;
     }
 
-    message->payload = _LSTransportMessageGetPayload(message->transport_msg);
+    if (_LSTransportMessageIsBinaryPayload(message->transport_msg))
+    {
+        /* callers expect JSON */
+        const char *encoded = _LSTransportMessageGetPayload(message->transport_msg);
+        long encoded_len = _LSTransportMessageGetPayloadLen(message->transport_msg);
+
+        if (encoded && encoded_len >= 0)
+        {
+            message->payloadAllocated = _LSBinaryPayloadDecodeToJson(encoded, encoded_len, NULL);
+        }
+
+        if (!message->payloadAllocated)
+        {
+            g_warning("%s: unable to decode binary payload", __FUNCTION__);
+            return NULL;
+        }
+
+        message->payload = message->payloadAllocated;
+    }
+    else
+    {
+        message->payload = _LSTransportMessageGetPayload(message->transport_msg);
+    }
 
     return message->payload;
 }
 
+/** 
+* @brief Get the length of the payload of this message, not including the
+*        nul, without scanning the payload.
+* 
+* @param  message 
+* 
+* @retval length of payload
+* @retval -1 if the message has no payload
+*/
+long
+LSMessageGetPayloadLen(LSMessage *message)
+{
+    if (unlikely(message == NULL))
+    {
+        g_critical("%s: message is NULL", __FUNCTION__);
+        return -1;
+    }
+
+    const char *transport_payload = _LSTransportMessageGetPayload(message->transport_msg);
+
+    if (message->payload && message->payload != transport_payload)
+    {
+        /* replaced (e.g., a translated reply or a decoded binary payload),
+         * so it's not the one the transport knows the length of */
+        return (long)strlen(message->payload);
+    }
+
+    if (_LSTransportMessageIsBinaryPayload(message->transport_msg))
+    {
+        /* length of the JSON that LSMessageGetPayload() returns */
+        const char *payload = LSMessageGetPayload(message);
+        return payload ? (long)strlen(payload) : -1;
+    }
+
+    return _LSTransportMessageGetPayloadLen(message->transport_msg);
+}
+
+/** 
+* @brief Get the payload of this message as a parsed JSON object.
+*
+*        If the payload was sent binary encoded (e.g., with LSCallObject()),
+*        it's decoded straight into the object without going through a JSON
+*        string. The object is owned by the message; take a reference with
+*        json_object_get() to keep it after the message is freed.
+* 
+* @param  message 
+* 
+* @retval object on success
+* @retval NULL if the payload can't be parsed
+*/
+struct json_object *
+LSMessageGetPayloadObject(LSMessage *message)
+{
+    _LSErrorIfFail(message != NULL, NULL);
+
+    if (message->payloadObject)
+    {
+        return message->payloadObject;
+    }
+
+    struct json_object *object = NULL;
+
+    if (_LSTransportMessageIsBinaryPayload(message->transport_msg))
+    {
+        const char *encoded = _LSTransportMessageGetPayload(message->transport_msg);
+        long encoded_len = _LSTransportMessageGetPayloadLen(message->transport_msg);
+
+        if (!encoded || encoded_len < 0 || !_LSBinaryPayloadDecode(encoded, encoded_len, &object))
+        {
+            return NULL;
+        }
+    }
+    else
+    {
+        const char *payload = LSMessageGetPayload(message);
+
+        if (!payload)
+        {
+            return NULL;
+        }
+
+        object = json_tokener_parse(payload);
+
+        if (JSON_ERROR(object))
+        {
+            return NULL;
+        }
+    }
+
+    message->payloadObject = object;
+
+    return message->payloadObject;
+}
+
 /** 
 * @brief Get the payload of the message as a JSON object.
 *
@@ -385,22 +582,7 @@ LSMessageGetPayloadJSON(LSMessage  *message)
 bool
 LSMessageIsSubscription(LSMessage *message)
 {
-    bool ret = false;
-    struct json_object *sub_object = NULL;
-    const char *payload = LSMessageGetPayload(message);
-
-    struct json_object *object = json_tokener_parse(payload);
-    if (JSON_ERROR(object)) goto exit;
-   
-    if (!json_object_object_get_ex(object, "subscribe", &sub_object)) goto exit;
-
-    _LSErrorIfFail(json_object_get_type(sub_object) == json_type_boolean, NULL);
-    
-    ret = json_object_get_boolean(sub_object);
-
-exit:
-    if (!JSON_ERROR(object)) json_object_put(object);
-    return ret;
+    return _LSMessageGetSubscribeState(message) == _LSMessageSubscribeTrue;
 }
 
 /** 
@@ -437,6 +619,65 @@ LSMessageRespond(LSMessage *message, const char *reply_payload,
 bool
 LSMessageReply(LSHandle *sh, LSMessage *lsmsg, const char *replyPayload,
                 LSError *lserror)
+{
+    _LSErrorIfFail (replyPayload != NULL, lserror);
+
+    return LSMessageReplyWithLen(sh, lsmsg, replyPayload, strlen(replyPayload), lserror);
+}
+
+/**
+ *******************************************************************************
+ * @brief Save the first reply to a call of a LUNA_METHOD_FLAG_CACHEABLE
+ * method that wasn't served from the reply cache. Only replies that don't
+ * have "returnValue": false are saved, so errors are always recomputed.
+ *
+ * @param  sh           IN  handle
+ * @param  lsmsg        IN  call being replied to
+ * @param  payload      IN  reply payload
+ * @param  payload_len  IN  length of payload
+ *******************************************************************************
+ */
+static void
+_LSMessageSaveCachedReply(LSHandle *sh, LSMessage *lsmsg, const char *payload, size_t payload_len)
+{
+    /* only the first reply is saved, even if the method replies again */
+    char *key = g_atomic_pointer_get(&lsmsg->replyCacheKey);
+
+    if (!key || !g_atomic_pointer_compare_and_exchange(&lsmsg->replyCacheKey, key, NULL))
+    {
+        return;
+    }
+
+    bool return_value = true;
+
+    if (_LSJsonScanBoolean(payload, "returnValue", &return_value) != _LSJsonScanInvalid
+        && return_value)
+    {
+        _LSReplyCacheSave(sh->reply_cache, key, lsmsg->replyCacheGeneration,
+                          payload, payload_len);
+    }
+
+    g_free(key);
+}
+
+/** 
+* @brief Variant of LSMessageReply() for when the length of the payload is
+*        already known (e.g., it was built in a GString), so the library
+*        doesn't have to scan the payload for its end.
+*
+*        replyPayload must still be nul-terminated at replyPayloadLen.
+* 
+* @param  sh 
+* @param  lsmsg 
+* @param  replyPayload 
+* @param  replyPayloadLen  length of replyPayload, not including the nul
+* @param  lserror 
+* 
+* @retval
+*/
+bool
+LSMessageReplyWithLen(LSHandle *sh, LSMessage *lsmsg, const char *replyPayload,
+                      size_t replyPayloadLen, LSError *lserror)
 {
     _LSErrorIfFail (sh != NULL, lserror);
     _LSErrorIfFail (lsmsg != NULL, lserror);
@@ -446,7 +687,7 @@ LSMessageReply(LSHandle *sh, LSMessage *lsmsg, const char *replyPayload,
 
     if (unlikely(_ls_enable_utf8_validation))
     {
-        if (!g_utf8_validate (replyPayload, -1, NULL))
+        if (!_LSUtf8Validate(replyPayload, replyPayloadLen, NULL))
         {
             _LSErrorSet(lserror, -EINVAL, "%s: payload is not utf-8",
                         __FUNCTION__);
@@ -454,7 +695,7 @@ LSMessageReply(LSHandle *sh, LSMessage *lsmsg, const char *replyPayload,
         }
     }
 
-    if (unlikely(strcmp(replyPayload, "") == 0))
+    if (unlikely(replyPayloadLen == 0))
     {
         _LSErrorSet(lserror, -EINVAL, "Empty payload is not valid JSON. Use {}");
         return false;
@@ -493,7 +734,75 @@ LSMessageReply(LSHandle *sh, LSMessage *lsmsg, const char *replyPayload,
         return false;
     }
 
-    bool retVal = _LSTransportSendReply(lsmsg->transport_msg, replyPayload, lserror);
+    bool retVal = _LSTransportSendReplyWithLen(lsmsg->transport_msg, replyPayload, replyPayloadLen, lserror);
+
+    if (retVal && lsmsg->replyCacheKey)
+    {
+        _LSMessageSaveCachedReply(sh, lsmsg, replyPayload, replyPayloadLen);
+    }
+
+    return retVal;
+}
+
+/** 
+* @brief Send a reply built as a JSON object rather than a string.
+*
+*        If the caller can receive binary encoded payloads, the object is
+*        encoded straight into the reply, which is smaller and quicker to
+*        decode than JSON text; otherwise it's sent as JSON.
+* 
+* @param  sh 
+* @param  lsmsg 
+* @param  replyObject 
+* @param  lserror 
+* 
+* @retval
+*/
+bool
+LSMessageReplyObject(LSHandle *sh, LSMessage *lsmsg, struct json_object *replyObject,
+                     LSError *lserror)
+{
+    _LSErrorIfFail (sh != NULL, lserror);
+    _LSErrorIfFail (lsmsg != NULL, lserror);
+    _LSErrorIfFail (replyObject != NULL, lserror);
+
+    LSHANDLE_VALIDATE(sh);
+
+    if (!(lsmsg->transport_msg->client->peer_caps & LS_TRANSPORT_CAP_BINARY_PAYLOAD))
+    {
+        const char *json = json_object_to_json_string(replyObject);
+
+        return LSMessageReplyWithLen(sh, lsmsg, json, strlen(json), lserror);
+    }
+
+    if (unlikely(LSMessageGetConnection(lsmsg) != sh))
+    {
+        _LSErrorSet(lserror, -EINVAL,
+            "%s: You are replying to message on different bus.\n"
+            " If you can't identify which bus, "
+            "try LSMessageRespond() instead.",
+            __FUNCTION__);
+        return false;
+    }
+
+    if (DEBUG_TRACING)
+    {
+        g_debug("TX: LSMessageReplyObject token <<%ld>>",
+                LSMessageGetToken(lsmsg));
+    }
+
+    unsigned long encoded_len = 0;
+    char *encoded = _LSBinaryPayloadEncode(replyObject, &encoded_len);
+
+    if (!encoded)
+    {
+        _LSErrorSet(lserror, -EINVAL, "%s: unable to encode payload", __FUNCTION__);
+        return false;
+    }
+
+    bool retVal = _LSTransportSendReplyBinary(lsmsg->transport_msg, encoded, encoded_len, lserror);
+
+    g_free(encoded);
 
     return retVal;
 }
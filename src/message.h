@@ -19,6 +19,17 @@
 
 #include "transport.h"
 
+/** Cached result of looking for a top-level "subscribe" in the payload */
+typedef enum {
+    _LSMessageSubscribeUnknown = 0,     /**< payload not scanned yet */
+    _LSMessageSubscribeInvalid,         /**< payload isn't valid JSON */
+    _LSMessageSubscribeFalse,           /**< missing or false (or the payload isn't an object) */
+    _LSMessageSubscribeTrue,            /**< boolean true */
+    _LSMessageSubscribeTrueNotBoolean,  /**< not a boolean, but true to json_object_get_boolean;
+                                             LSSubscriptionProcess subscribes, while
+                                             LSMessageIsSubscription says no */
+} _LSMessageSubscribeState;
+
 struct LSMessage {
     int          ref;           //< refcount
 
@@ -46,8 +57,16 @@ struct LSMessage {
 
     bool         ignore;
     bool         serviceDownMessage;
+
+    _LSMessageSubscribeState subscribeState;
+
+    struct json_object *payloadObject;  //< cache of LSMessageGetPayloadObject()
+
+    char        *replyCacheKey;         //< save the first reply under this key (reply cache miss)
+    guint        replyCacheGeneration;  //< reply cache generation when the call came in
 };
 
 LSMessage *_LSMessageNewRef(_LSTransportMessage *transport_msg, LSHandle *sh);
 char *_LSMessageGetKindHelper(const char *category, const char *method);
+_LSMessageSubscribeState _LSMessageGetSubscribeState(LSMessage *message);
 
@@ -27,11 +27,15 @@
 #include "utils.h"
 #include "transport.h"
 #include "monitor_queue.h"
+#include "monitor_capture.h"
 
 #define DYNAMIC_SERVICE_STR         "dynamic"
 #define STATIC_SERVICE_STR          "static"
 #define SUBSCRIPTION_DEBUG_METHOD   "/com/palm/luna/private/subscriptions"
 #define MALLOC_DEBUG_METHOD         "/com/palm/luna/private/mallinfo"
+#define LATENCY_DEBUG_METHOD        "/com/palm/luna/private/latency"
+#define SLOW_CALLS_DEBUG_METHOD     "/com/palm/luna/private/slowcalls"
+#define TRACE_DEBUG_METHOD          "/com/palm/luna/private/trace"
 
 #ifdef TARGET_DESKTOP
 #   define PID_DIR             "/tmp"
@@ -62,14 +66,28 @@ typedef struct SubscriptionReplyData
 static GHashTable *dup_hash_table;
 
 static const char *message_filter_str = NULL;
+static char **message_filter_globs = NULL;
+static const char *message_filter_types_str = NULL;
+static gint message_sample_rate = 1;
+static char *monitor_filter_names = NULL;
+static int32_t monitor_filter_types = 0;
+static _LSTransportMonitorFilter *monitor_filter = NULL;
 static gboolean list_clients = false;
 static gboolean list_subscriptions = false;
 static gboolean list_malloc = false;
+static gboolean list_latency = false;
+static gboolean list_slow_calls = false;
+static gboolean list_trace = false;
+static gboolean list_hub_stats = false;
 static gboolean debug_output = false;
+static const char *capture_path = NULL;
+static _LSMonitorCapture *capture = NULL;
 static GMainLoop *mainloop = NULL;
 
-static _LSTransport *transport_priv = NULL;
-static _LSTransport *transport_pub = NULL;
+/* one transport for both hubs */
+static _LSTransport *transport = NULL;
+static _LSTransportBus *bus_priv = NULL;
+static _LSTransportBus *bus_pub = NULL;
 
 /* List of _SubscriptionReplyData for public and private hubs */
 static GSList *private_sub_replies = NULL;
@@ -130,37 +148,43 @@ _LSMonitorPrintTime(struct timespec *time)
 }
 
 static gboolean
-_LSMonitorIdleHandlerPrivate(gpointer data)
+_LSMonitorIdleHandler(gpointer data)
 {
-    _LSMonitorQueue *queue = data;
-    _LSMonitorQueuePrint(queue, 1000, dup_hash_table, debug_output);
-    return TRUE;
-}
-
-static gboolean
-_LSMonitorIdleHandlerPublic(gpointer data)
-{
-    _LSMonitorQueue *queue = data;
-    _LSMonitorQueuePrint(queue, 1000, dup_hash_table, debug_output);
+    _LSMonitorQueuePrint(private_queue, public_queue, 1000, dup_hash_table, debug_output);
     return TRUE;
 }
 
 void
 _LSMonitorMessagePrint(_LSTransportMessage *message, struct timespec *time, bool public_bus)
 {
-    if (LSTransportMessageFilterMatch(message, message_filter_str))
+    if (LSTransportMessageFilterMatch(message, message_filter_str) &&
+        LSTransportMonitorFilterMatch(monitor_filter, message))
     {
-        if (time)
+        struct timespec now;
+
+        if (!time)
         {
-            _LSMonitorPrintTime(time);
+            _LSMonitorGetTime(&now);
+            time = &now;
         }
-        else
+
+        if (capture)
         {
-            struct timespec now;
-            _LSMonitorGetTime(&now);
-            _LSMonitorPrintTime(&now);
+            LSError lserror;
+            LSErrorInit(&lserror);
+
+            if (!_LSMonitorCaptureWrite(capture, message, time, public_bus, &lserror))
+            {
+                /* e.g., out of disk space */
+                LSErrorPrint(&lserror, stderr);
+                LSErrorFree(&lserror);
+                g_main_loop_quit(mainloop);
+            }
+            return;
         }
 
+        _LSMonitorPrintTime(time);
+
         if (public_bus)
         {
             fprintf(stdout, "[PUB]\t");    
@@ -277,10 +301,34 @@ _PrintSubscriptionResultsList(GSList *sub_list)
 static void
 _PrintSubscriptionResults()
 {
-    fprintf(stdout, list_subscriptions ? "PRIVATE SUBSCRIPTIONS:\n" : "PRIVATE BUS MALLOC DATA:\n");
+    const char *private_title = "PRIVATE BUS MALLOC DATA:\n";
+    const char *public_title = "PUBLIC BUS MALLOC DATA:\n";
+
+    if (list_subscriptions)
+    {
+        private_title = "PRIVATE SUBSCRIPTIONS:\n";
+        public_title = "PUBLIC SUBSCRIPTIONS:\n";
+    }
+    else if (list_latency)
+    {
+        private_title = "PRIVATE BUS LATENCY DATA:\n";
+        public_title = "PUBLIC BUS LATENCY DATA:\n";
+    }
+    else if (list_slow_calls)
+    {
+        private_title = "PRIVATE BUS SLOW CALLS:\n";
+        public_title = "PUBLIC BUS SLOW CALLS:\n";
+    }
+    else if (list_trace)
+    {
+        private_title = "PRIVATE BUS TRACES:\n";
+        public_title = "PUBLIC BUS TRACES:\n";
+    }
+
+    fprintf(stdout, "%s", private_title);
     _PrintSubscriptionResultsList(private_sub_replies);
 
-    fprintf(stdout, list_subscriptions ? "PUBLIC SUBSCRIPTIONS:\n" : "PUBLIC BUS MALLOC DATA:\n");
+    fprintf(stdout, "%s", public_title);
     _PrintSubscriptionResultsList(public_sub_replies);
 }
 
@@ -344,7 +392,26 @@ _ListServiceSubscriptions(LSHandle *sh, LSFilterFunc callback, GSList *monitor_l
             continue;
         }
 
-        char *uri = g_strconcat("palm://", cur->service_name, list_subscriptions ? SUBSCRIPTION_DEBUG_METHOD : MALLOC_DEBUG_METHOD, NULL);
+        const char *debug_method = MALLOC_DEBUG_METHOD;
+
+        if (list_subscriptions)
+        {
+            debug_method = SUBSCRIPTION_DEBUG_METHOD;
+        }
+        else if (list_latency)
+        {
+            debug_method = LATENCY_DEBUG_METHOD;
+        }
+        else if (list_slow_calls)
+        {
+            debug_method = SLOW_CALLS_DEBUG_METHOD;
+        }
+        else if (list_trace)
+        {
+            debug_method = TRACE_DEBUG_METHOD;
+        }
+
+        char *uri = g_strconcat("palm://", cur->service_name, debug_method, NULL);
 
         retVal = LSCall(sh, uri, "{}", callback, data, NULL, &lserror);
         if (!retVal)
@@ -363,10 +430,8 @@ _DisconnectCustomTransport()
 
     if (!is_disconnected)
     {
-        _LSTransportDisconnect(transport_priv, true);
-        _LSTransportDeinit(transport_priv);
-        _LSTransportDisconnect(transport_pub, true);
-        _LSTransportDeinit(transport_pub);
+        _LSTransportDisconnect(transport, true);
+        _LSTransportDeinit(transport);
         is_disconnected = true;
     }
 }
@@ -451,7 +516,7 @@ _LSMonitorListMessageHandler(_LSTransportMessage *message, void *context)
     /* Process and display when we receive public and private responses */
     if (++call_count == 2)
     {
-        if (list_subscriptions || list_malloc)
+        if (list_subscriptions || list_malloc || list_latency || list_slow_calls || list_trace)
         {
             LSError lserror;
             LSErrorInit(&lserror);
@@ -514,6 +579,36 @@ Done:
     return LSMessageHandlerResultHandled;
 }
 
+static LSMessageHandlerResult
+_LSMonitorHubStatsMessageHandler(_LSTransportMessage *message, void *context)
+{
+    LS_ASSERT(_LSTransportMessageGetType(message) == _LSTransportMessageTypeHubStatsReply);
+
+    static int call_count = 0;
+    const char *stats = NULL;
+
+    int type = *(int*)context;
+
+    _LSTransportMessageIter iter;
+
+    _LSTransportMessageIterInit(message, &iter);
+
+    if (!_LSTransportMessageGetString(&iter, &stats) || !stats)
+    {
+        stats = "{}";
+    }
+
+    fprintf(stdout, "%s HUB STATS:\n%s\n\n", type == HUB_TYPE_PUBLIC ? "PUBLIC" : "PRIVATE", stats);
+
+    /* done once both hubs have answered */
+    if (++call_count == 2)
+    {
+        g_main_loop_quit(mainloop);
+    }
+
+    return LSMessageHandlerResultHandled;
+}
+
 static void
 _HandleShutdown(int signal)
 {
@@ -530,10 +625,18 @@ _HandleCommandline(int argc, char *argv[])
     static GOptionEntry opt_entries[] =
     {
         {"filter", 'f', 0, G_OPTION_ARG_STRING, &message_filter_str, "Filter by service name (or unique name)", "com.palm.foo"},
+        {"glob", 'g', 0, G_OPTION_ARG_STRING_ARRAY, &message_filter_globs, "Only monitor messages to or from services (or unique names) matching a glob (may be repeated)", "com.palm.*"},
+        {"types", 't', 0, G_OPTION_ARG_STRING, &message_filter_types_str, "Only monitor these message types", "call,reply,signal"},
+        {"sample", 'S', 0, G_OPTION_ARG_INT, &message_sample_rate, "Only monitor 1 in N calls (and their replies)", "N"},
         {"list", 'l', 0, G_OPTION_ARG_NONE, &list_clients, "List all entities connected to the hub", NULL},
         {"subscriptions", 's', 0, G_OPTION_ARG_NONE, &list_subscriptions, "List all subscriptions in the system", NULL},
         {"malloc", 'm', 0, G_OPTION_ARG_NONE, &list_malloc, "List malloc data from all services in the system", NULL},
+        {"latency", 'L', 0, G_OPTION_ARG_NONE, &list_latency, "List latency histograms from all services in the system", NULL},
+        {"slow-calls", 'C', 0, G_OPTION_ARG_NONE, &list_slow_calls, "List recent slow method handlers from all services in the system (see LS_SLOW_CALL_MS)", NULL},
+        {"trace", 'T', 0, G_OPTION_ARG_NONE, &list_trace, "Dump the message trace rings from all services in the system (see LS_TRACE)", NULL},
+        {"hub-stats", 'H', 0, G_OPTION_ARG_NONE, &list_hub_stats, "Show per-client traffic and message handling statistics from the hubs", NULL},
         {"debug", 'd', 0, G_OPTION_ARG_NONE, &debug_output, "Print extra output for debugging monitor but with UNBOUNDED MEMORY GROWTH", NULL},
+        {"capture", 'c', 0, G_OPTION_ARG_FILENAME, &capture_path, "Write messages to a binary capture file instead of printing them (see ls-monitor-decode)", "FILE"},
         { NULL }
     };
     
@@ -549,6 +652,58 @@ _HandleCommandline(int argc, char *argv[])
 
     g_option_context_free(opt_context);
 
+    /* The filter is also pushed to every client (through the hub) so that
+     * they don't bother sending us what we'd throw away */
+    if (message_filter_globs && message_filter_globs[0])
+    {
+        monitor_filter_names = g_strjoinv(",", message_filter_globs);
+    }
+    else if (message_filter_str)
+    {
+        /* same substring match as the printing filter */
+        monitor_filter_names = g_strdup_printf("*%s*", message_filter_str);
+    }
+
+    if (message_filter_types_str)
+    {
+        char **types = g_strsplit(message_filter_types_str, ",", -1);
+        char **type;
+
+        for (type = types; *type; type++)
+        {
+            if (strcmp(*type, "call") == 0)
+            {
+                monitor_filter_types |= LS_TRANSPORT_MONITOR_TYPE_CALL;
+            }
+            else if (strcmp(*type, "reply") == 0)
+            {
+                monitor_filter_types |= LS_TRANSPORT_MONITOR_TYPE_REPLY;
+            }
+            else if (strcmp(*type, "signal") == 0)
+            {
+                monitor_filter_types |= LS_TRANSPORT_MONITOR_TYPE_SIGNAL;
+            }
+            else
+            {
+                g_critical("Unknown message type: \"%s\" (expected call, reply or signal)", *type);
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        g_strfreev(types);
+    }
+
+    if (message_sample_rate < 1)
+    {
+        g_critical("Sample rate must be at least 1");
+        exit(EXIT_FAILURE);
+    }
+
+    /* "-f" alone is applied by LSTransportMessageFilterMatch(); only the
+     * globs, types and sampling need the monitor filter here */
+    monitor_filter = _LSTransportMonitorFilterNew((message_filter_globs && message_filter_globs[0]) ? monitor_filter_names : NULL,
+                                                  monitor_filter_types, message_sample_rate);
+
     if (debug_output)
     {
         g_warning("extra output for debugging monitor enabled, causes UNBOUNDED MEMORY GROWTH");
@@ -599,82 +754,114 @@ main(int argc, char *argv[])
 
     _HandleCommandline(argc, argv);
 
-    if (list_clients || list_subscriptions || list_malloc)
+    if (list_clients || list_subscriptions || list_malloc || list_latency || list_slow_calls || list_trace)
     {
         handler_priv.msg_handler = _LSMonitorListMessageHandler;
         handler_pub.msg_handler = _LSMonitorListMessageHandler;
     }
+    else if (list_hub_stats)
+    {
+        handler_priv.msg_handler = _LSMonitorHubStatsMessageHandler;
+        handler_pub.msg_handler = _LSMonitorHubStatsMessageHandler;
+    }
+    else if (capture_path)
+    {
+        capture = _LSMonitorCaptureOpen(capture_path, &lserror);
+
+        if (!capture)
+        {
+            goto error;
+        }
+
+        /* the debug columns are text only */
+        debug_output = false;
+    }
 
-    if (!_LSTransportInit(&transport_priv, MONITOR_NAME, &handler_priv, &lserror))
+    if (!_LSTransportInit(&transport, MONITOR_NAME, &handler_priv, &lserror))
     {
         goto error;
     }
+
+    bus_priv = _LSTransportGetBus(transport);
     
-    if (!_LSTransportInit(&transport_pub, MONITOR_NAME, &handler_pub, &lserror))
+    if (!_LSTransportAddBus(transport, &handler_pub, &bus_pub, &lserror))
     {
         goto error;
     }
    
     /* connect for "private" messages */ 
-    if (!_LSTransportConnect(transport_priv, true, false, &lserror))
+    if (!_LSTransportConnect(bus_priv, true, false, &lserror))
     {
         goto error;
     }
 
     /* connect for "public" messages */
-    if (!_LSTransportConnect(transport_pub, true, true, &lserror))
+    if (!_LSTransportConnect(bus_pub, true, true, &lserror))
     {
         goto error;
     }
    
-    _LSTransportGmainAttach(transport_priv, g_main_loop_get_context(mainloop)); 
-    _LSTransportGmainAttach(transport_pub, g_main_loop_get_context(mainloop)); 
+    _LSTransportGmainAttach(transport, g_main_loop_get_context(mainloop)); 
 
-    if (_LSTransportGetTransportType(transport_priv) == _LSTransportTypeLocal)
+    /* both buses always have the same kind of hub connection */
+    if (_LSTransportGetTransportType(transport) == _LSTransportTypeLocal)
     {
         transport_priv_local = true;
-
-        /* message printing callback */
-        //g_idle_add(_LSMonitorIdleHandlerPrivate, NULL);
         private_queue = _LSMonitorQueueNew(false);
-        g_timeout_add(500, _LSMonitorIdleHandlerPrivate, private_queue);
-    }
 
-    if (_LSTransportGetTransportType(transport_pub) == _LSTransportTypeLocal)
-    {
         transport_pub_local = true;
-        
-        //g_idle_add(_LSMonitorIdleHandlerPublic, NULL);
         public_queue = _LSMonitorQueueNew(true);
-        g_timeout_add(500, _LSMonitorIdleHandlerPublic, public_queue);
     }
 
-    if (list_clients || list_subscriptions || list_malloc)
+    if (private_queue || public_queue)
     {
-        if (!_LSTransportSendMessageListClients(transport_priv, &lserror))
+        /* message printing callback; handles both buses so that they can be
+         * merged */
+        g_timeout_add(500, _LSMonitorIdleHandler, NULL);
+    }
+
+    if (list_clients || list_subscriptions || list_malloc || list_latency || list_slow_calls || list_trace)
+    {
+        if (!_LSTransportSendMessageListClients(bus_priv, &lserror))
         {
             goto error;
         }
 
-        if (!_LSTransportSendMessageListClients(transport_pub, &lserror))
+        if (!_LSTransportSendMessageListClients(bus_pub, &lserror))
         {
             goto error;
         }
     } 
+    else if (list_hub_stats)
+    {
+        if (!_LSTransportSendMessageHubStats(bus_priv, &lserror))
+        {
+            goto error;
+        }
+
+        if (!_LSTransportSendMessageHubStats(bus_pub, &lserror))
+        {
+            goto error;
+        }
+    }
     else
     {
         /* send the message to the hub to tell clients to connect to us */
-        if (!LSTransportSendMessageMonitorRequest(transport_priv, &lserror))
+        if (!LSTransportSendMessageMonitorRequest(bus_priv, monitor_filter_names, monitor_filter_types, message_sample_rate, &lserror))
         {
             goto error;
         }
         
-        if (!LSTransportSendMessageMonitorRequest(transport_pub, &lserror))
+        if (!LSTransportSendMessageMonitorRequest(bus_pub, monitor_filter_names, monitor_filter_types, message_sample_rate, &lserror))
         {
             goto error;
         }
 
-        if (debug_output)
+        if (capture)
+        {
+            /* no text output */
+        }
+        else if (debug_output)
         {
             fprintf(stdout, "Debug\tTime\t\tProt\tType\tSerial\t\tSender\t\tDestination\t\tMethod                            \tPayload\n");
         }
@@ -688,6 +875,16 @@ main(int argc, char *argv[])
     LS_ASSERT(dup_hash_table);
 
     g_main_loop_run(mainloop);
+
+    /* flush whatever is still waiting to be put in order */
+    _LSMonitorQueuePrint(private_queue, public_queue, 0, dup_hash_table, debug_output);
+
+    if (capture)
+    {
+        _LSMonitorCaptureClose(capture);
+        capture = NULL;
+    }
+
     g_main_loop_unref(mainloop);
 
     _DisconnectCustomTransport();
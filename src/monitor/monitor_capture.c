@@ -0,0 +1,384 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2008-2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <glib.h>
+
+#include "transport.h"
+#include "monitor_capture.h"
+
+#define CAPTURE_MAP_CHUNK_SIZE  (4 * 1024 * 1024)       /**< file is grown and mapped this much at a time */
+
+#define CAPTURE_ALIGN(size)     (((size) + 7) & ~((size_t)7))
+
+/**
+ * Capture output. Records are appended to a window of the file that is
+ * mapped shared; the file is grown a chunk at a time so that writing a
+ * record is just a memcpy, and it's trimmed to the real size on close.
+ */
+struct _LSMonitorCapture
+{
+    int fd;
+    char *map;          /**< mapped window of the file */
+    off_t map_offset;   /**< file offset of @ref map */
+    size_t map_size;    /**< size of @ref map */
+    size_t pos;         /**< write position in @ref map */
+};
+
+/**
+ *******************************************************************************
+ * @brief Map a new window of the capture file that starts at (or just
+ * before) the current write position and has room for at least need more
+ * bytes.
+ *
+ * @param  capture  IN  capture
+ * @param  need     IN  bytes about to be written
+ * @param  lserror  OUT set on error
+ *
+ * @retval  true on success
+ * @retval  false on failure
+ *******************************************************************************
+ */
+static bool
+_LSMonitorCaptureRemap(_LSMonitorCapture *capture, size_t need, LSError *lserror)
+{
+    off_t end = capture->map_offset + capture->pos;
+    long page_size = sysconf(_SC_PAGESIZE);
+    off_t new_offset = end - (end % page_size);
+    size_t new_size = CAPTURE_MAP_CHUNK_SIZE;
+
+    while (new_size < (end - new_offset) + need)
+    {
+        new_size *= 2;
+    }
+
+    if (capture->map)
+    {
+        munmap(capture->map, capture->map_size);
+        capture->map = NULL;
+        capture->map_size = 0;  /* so a failure here is retried on the next write */
+    }
+
+    if (ftruncate(capture->fd, new_offset + new_size) != 0)
+    {
+        _LSErrorSetFromErrno(lserror, errno);
+        return false;
+    }
+
+    char *map = mmap(NULL, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, capture->fd, new_offset);
+
+    if (map == MAP_FAILED)
+    {
+        _LSErrorSetFromErrno(lserror, errno);
+        return false;
+    }
+
+    capture->map = map;
+    capture->map_offset = new_offset;
+    capture->map_size = new_size;
+    capture->pos = end - new_offset;
+
+    return true;
+}
+
+/**
+ *******************************************************************************
+ * @brief Create (or truncate) a capture file.
+ *
+ * @param  path     IN  path to capture file
+ * @param  lserror  OUT set on error
+ *
+ * @retval  capture on success
+ * @retval  NULL on failure
+ *******************************************************************************
+ */
+_LSMonitorCapture*
+_LSMonitorCaptureOpen(const char *path, LSError *lserror)
+{
+    _LSMonitorCaptureFileHeader header;
+
+    _LSMonitorCapture *capture = g_new0(_LSMonitorCapture, 1);
+
+    capture->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    if (capture->fd == -1)
+    {
+        _LSErrorSetFromErrno(lserror, errno);
+        goto error;
+    }
+
+    if (!_LSMonitorCaptureRemap(capture, sizeof(header), lserror))
+    {
+        goto error;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, LS_MONITOR_CAPTURE_MAGIC, sizeof(LS_MONITOR_CAPTURE_MAGIC));
+    header.version = LS_MONITOR_CAPTURE_VERSION;
+    header.transport_header_size = sizeof(_LSTransportHeader);
+
+    memcpy(capture->map + capture->pos, &header, sizeof(header));
+    capture->pos += sizeof(header);
+
+    return capture;
+
+error:
+    if (capture->fd != -1) close(capture->fd);
+    g_free(capture);
+
+    return NULL;
+}
+
+/**
+ *******************************************************************************
+ * @brief Append a message to a capture.
+ *
+ * @param  capture      IN  capture
+ * @param  message      IN  message
+ * @param  time         IN  time the message was received
+ * @param  public_bus   IN  true if message is from the public bus
+ * @param  lserror      OUT set on error
+ *
+ * @retval  true on success
+ * @retval  false on failure
+ *******************************************************************************
+ */
+bool
+_LSMonitorCaptureWrite(_LSMonitorCapture *capture, _LSTransportMessage *message,
+                       const struct timespec *time, bool public_bus, LSError *lserror)
+{
+    LS_ASSERT(capture != NULL);
+    LS_ASSERT(message != NULL);
+
+    _LSMonitorCaptureRecord record;
+    _LSTransportMessage *inline_copy = NULL;
+
+    if (message->shm_payload)
+    {
+        /* the capture only has room for the raw message, so the payload
+         * segment has to go inline */
+        inline_copy = _LSTransportMessageCopyNewRef(message);
+
+        if (!inline_copy)
+        {
+            _LSErrorSetOOM(lserror);
+            return false;
+        }
+
+        message = inline_copy;
+    }
+
+    size_t raw_size = sizeof(_LSTransportHeader) + _LSTransportMessageGetBodySize(message);
+    size_t total_size = sizeof(record) + CAPTURE_ALIGN(raw_size);
+
+    if (capture->pos + total_size > capture->map_size)
+    {
+        if (!_LSMonitorCaptureRemap(capture, total_size, lserror))
+        {
+            if (inline_copy) _LSTransportMessageUnref(inline_copy);
+            return false;
+        }
+    }
+
+    record.size = raw_size;
+    record.flags = public_bus ? LS_MONITOR_CAPTURE_FLAG_PUBLIC : 0;
+    record.tv_sec = time->tv_sec;
+    record.tv_nsec = time->tv_nsec;
+
+    /* the padding is already zero since the file was just extended */
+    memcpy(capture->map + capture->pos, &record, sizeof(record));
+    memcpy(capture->map + capture->pos + sizeof(record), _LSTransportMessageGetHeader(message), raw_size);
+
+    capture->pos += total_size;
+
+    if (inline_copy) _LSTransportMessageUnref(inline_copy);
+
+    return true;
+}
+
+/**
+ *******************************************************************************
+ * @brief Finish a capture, trimming the preallocated tail of the file.
+ *
+ * @param  capture  IN  capture
+ *******************************************************************************
+ */
+void
+_LSMonitorCaptureClose(_LSMonitorCapture *capture)
+{
+    LS_ASSERT(capture != NULL);
+
+    off_t end = capture->map_offset + capture->pos;
+
+    if (capture->map)
+    {
+        munmap(capture->map, capture->map_size);
+    }
+
+    if (ftruncate(capture->fd, end) != 0)
+    {
+        g_warning("Unable to trim capture file: %s", g_strerror(errno));
+    }
+
+    close(capture->fd);
+
+#ifdef MEMCHECK
+    memset(capture, 0xFF, sizeof(_LSMonitorCapture));
+#endif
+
+    g_free(capture);
+}
+
+/**
+ *******************************************************************************
+ * @brief Read back a capture file, calling func for each message in the
+ * order they were written.
+ *
+ * @param  path     IN  path to capture file
+ * @param  func     IN  called for each message; return false to stop
+ * @param  ctxt     IN  passed to func
+ * @param  lserror  OUT set on error
+ *
+ * @retval  true on success
+ * @retval  false on failure
+ *******************************************************************************
+ */
+bool
+_LSMonitorCaptureRead(const char *path, _LSMonitorCaptureReadFunc func, void *ctxt, LSError *lserror)
+{
+    bool ret = false;
+    char *map = MAP_FAILED;
+    struct stat st;
+    _LSMonitorCaptureFileHeader header;
+    _LSMonitorCaptureRecord record;
+
+    int fd = open(path, O_RDONLY);
+
+    if (fd == -1)
+    {
+        _LSErrorSetFromErrno(lserror, errno);
+        return false;
+    }
+
+    if (fstat(fd, &st) != 0)
+    {
+        _LSErrorSetFromErrno(lserror, errno);
+        goto exit;
+    }
+
+    if (st.st_size < sizeof(header))
+    {
+        _LSErrorSet(lserror, -1, "Not a capture file: \"%s\"", path);
+        goto exit;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (map == MAP_FAILED)
+    {
+        _LSErrorSetFromErrno(lserror, errno);
+        goto exit;
+    }
+
+    memcpy(&header, map, sizeof(header));
+
+    if (memcmp(header.magic, LS_MONITOR_CAPTURE_MAGIC, sizeof(LS_MONITOR_CAPTURE_MAGIC)) != 0
+        || header.version != LS_MONITOR_CAPTURE_VERSION)
+    {
+        _LSErrorSet(lserror, -1, "Not a capture file (or unsupported version): \"%s\"", path);
+        goto exit;
+    }
+
+    if (header.transport_header_size != sizeof(_LSTransportHeader))
+    {
+        _LSErrorSet(lserror, -1, "Capture file \"%s\" is from a different architecture", path);
+        goto exit;
+    }
+
+    size_t offset = sizeof(header);
+
+    while (offset + sizeof(record) <= st.st_size)
+    {
+        memcpy(&record, map + offset, sizeof(record));
+
+        if (record.size == 0)
+        {
+            /* preallocated tail of a capture that wasn't closed */
+            break;
+        }
+
+        if (record.size < sizeof(_LSTransportHeader) || offset + sizeof(record) + record.size > st.st_size)
+        {
+            g_warning("Capture file \"%s\" is truncated", path);
+            break;
+        }
+
+        struct iovec iov = {
+            .iov_base = map + offset + sizeof(record),
+            .iov_len = record.size
+        };
+
+        _LSTransportMessage *message = _LSTransportMessageFromVectorNewRef(&iov, 1, record.size);
+
+        if (!message)
+        {
+            _LSErrorSetOOM(lserror);
+            goto exit;
+        }
+
+        if (_LSTransportMessageGetHeader(message)->len != record.size - sizeof(_LSTransportHeader))
+        {
+            g_warning("Capture file \"%s\" has a bad record at offset %zu", path, offset);
+            _LSTransportMessageUnref(message);
+            break;
+        }
+
+        _LSTransportMessageIndexFields(message);
+
+        struct timespec time = {
+            .tv_sec = record.tv_sec,
+            .tv_nsec = record.tv_nsec
+        };
+
+        bool keep_going = func(message, &time, record.flags & LS_MONITOR_CAPTURE_FLAG_PUBLIC, ctxt);
+
+        _LSTransportMessageUnref(message);
+
+        if (!keep_going)
+        {
+            break;
+        }
+
+        offset += sizeof(record) + CAPTURE_ALIGN(record.size);
+    }
+
+    ret = true;
+
+exit:
+    if (map != MAP_FAILED) munmap(map, st.st_size);
+    close(fd);
+
+    return ret;
+}
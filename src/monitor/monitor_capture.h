@@ -0,0 +1,72 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2008-2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+#ifndef _MONITOR_CAPTURE_H
+#define _MONITOR_CAPTURE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "transport.h"
+
+/**
+ * Binary capture file written by "ls-monitor --capture" and rendered by
+ * ls-monitor-decode.
+ *
+ * The file is a @ref _LSMonitorCaptureFileHeader followed by records. Each
+ * record is a @ref _LSMonitorCaptureRecord followed by the raw transport
+ * message (header + body), padded to 8 bytes. A record with size 0 (e.g.,
+ * the preallocated tail of a capture that wasn't closed cleanly) ends the
+ * file.
+ *
+ * Messages are stored as they came off the wire, so captures can only be
+ * decoded on the same architecture they were taken on.
+ */
+#define LS_MONITOR_CAPTURE_MAGIC        "LS2MCAP"   /**< includes the nul */
+#define LS_MONITOR_CAPTURE_VERSION      1
+
+#define LS_MONITOR_CAPTURE_FLAG_PUBLIC  (1 << 0)    /**< message is from the public bus */
+
+typedef struct _LSMonitorCaptureFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t transport_header_size;     /**< sizeof(_LSTransportHeader) of the writer */
+} _LSMonitorCaptureFileHeader;
+
+typedef struct _LSMonitorCaptureRecord {
+    uint32_t size;          /**< size of the raw message that follows */
+    uint32_t flags;         /**< LS_MONITOR_CAPTURE_FLAG_* */
+    int64_t tv_sec;         /**< receive time (CLOCK_MONOTONIC) */
+    int64_t tv_nsec;
+} _LSMonitorCaptureRecord;
+
+typedef struct _LSMonitorCapture _LSMonitorCapture;
+
+_LSMonitorCapture* _LSMonitorCaptureOpen(const char *path, LSError *lserror);
+bool _LSMonitorCaptureWrite(_LSMonitorCapture *capture, _LSTransportMessage *message,
+                            const struct timespec *time, bool public_bus, LSError *lserror);
+void _LSMonitorCaptureClose(_LSMonitorCapture *capture);
+
+typedef bool (*_LSMonitorCaptureReadFunc)(_LSTransportMessage *message, const struct timespec *time,
+                                          bool public_bus, void *ctxt);
+
+bool _LSMonitorCaptureRead(const char *path, _LSMonitorCaptureReadFunc func, void *ctxt, LSError *lserror);
+
+#endif  /* _MONITOR_CAPTURE_H */
@@ -0,0 +1,88 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2008-2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+/**
+ * ls-monitor-decode: print a capture taken with "ls-monitor --capture" in
+ * the same format that ls-monitor prints messages.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <glib.h>
+
+#include "transport.h"
+#include "monitor_capture.h"
+
+static const char *message_filter_str = NULL;
+
+static bool
+_LSMonitorDecodePrint(_LSTransportMessage *message, const struct timespec *time, bool public_bus, void *ctxt)
+{
+    if (LSTransportMessageFilterMatch(message, message_filter_str))
+    {
+        fprintf(stdout, "%.3f\t", ((double)(time->tv_sec)) + (((double)time->tv_nsec) / (double)1000000000.0));
+        fprintf(stdout, public_bus ? "[PUB]\t" : "[PRV]\t");
+        LSTransportMessagePrint(message, stdout);
+    }
+
+    return true;
+}
+
+int
+main(int argc, char *argv[])
+{
+    GError *gerror = NULL;
+    GOptionContext *opt_context = NULL;
+    LSError lserror;
+    LSErrorInit(&lserror);
+
+    static GOptionEntry opt_entries[] =
+    {
+        {"filter", 'f', 0, G_OPTION_ARG_STRING, &message_filter_str, "Filter by service name (or unique name)", "com.palm.foo"},
+        { NULL }
+    };
+
+    opt_context = g_option_context_new("CAPTURE_FILE - decode an ls-monitor capture");
+    g_option_context_add_main_entries(opt_context, opt_entries, NULL);
+
+    if (!g_option_context_parse(opt_context, &argc, &argv, &gerror))
+    {
+        g_critical("Error processing commandline args: %s", gerror->message);
+        g_error_free(gerror);
+        exit(EXIT_FAILURE);
+    }
+
+    g_option_context_free(opt_context);
+
+    if (argc != 2)
+    {
+        fprintf(stderr, "Usage: %s [-f com.palm.foo] CAPTURE_FILE\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(stdout, "Time\t\tProt\tType\tSerial\t\tSender\t\tDestination\t\tMethod                            \tPayload\n");
+
+    if (!_LSMonitorCaptureRead(argv[1], _LSMonitorDecodePrint, NULL, &lserror))
+    {
+        LSErrorPrint(&lserror, stderr);
+        LSErrorFree(&lserror);
+        exit(EXIT_FAILURE);
+    }
+
+    exit(EXIT_SUCCESS);
+}
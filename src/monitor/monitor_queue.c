@@ -23,13 +23,20 @@
 struct _LSMonitorQueueItem
 {
     struct timespec timestamp;
+    _LSTransportMonitorSerial serial;   /**< cached from message */
     _LSTransportMessage *message;
 };
 
+/**
+ * Messages from one bus waiting to be printed, as a binary min-heap on
+ * monitor serial (see _LSMonitorQueueItemLess()). Messages arrive roughly,
+ * but not exactly, in serial order, so they are held for a while to let
+ * stragglers catch up.
+ */
 struct _LSMonitorQueue
 {
     bool public;
-    GQueue *queue;
+    GPtrArray *heap;
 };
 
 typedef struct _LSMonitorQueueItem _LSMonitorQueueItem;
@@ -41,16 +48,111 @@ _LSMonitorQueueNew(bool public_bus)
     if (queue)
     {
         queue->public = public_bus;
-        queue->queue = g_queue_new();
+        queue->heap = g_ptr_array_new();
     }
     return queue; 
 }
 
+static void
+_LSMonitorQueueItemFree(_LSMonitorQueueItem *item)
+{
+    _LSTransportMessageUnref(item->message);
+    g_slice_free(_LSMonitorQueueItem, item);
+}
+
 void
 _LSMonitorQueueFree(_LSMonitorQueue *queue)
 {
     LS_ASSERT(queue != NULL);
-    g_queue_free(queue->queue);
+    g_ptr_array_foreach(queue->heap, (GFunc)_LSMonitorQueueItemFree, NULL);
+    g_ptr_array_free(queue->heap, TRUE);
+    g_free(queue);
+}
+
+static inline bool
+_LSMonitorQueueItemLess(const _LSMonitorQueueItem *a, const _LSMonitorQueueItem *b)
+{
+    if (a->serial != b->serial)
+    {
+        return a->serial < b->serial;
+    }
+
+    /* e.g., no serial: keep arrival order */
+    if (a->timestamp.tv_sec != b->timestamp.tv_sec)
+    {
+        return a->timestamp.tv_sec < b->timestamp.tv_sec;
+    }
+    return a->timestamp.tv_nsec < b->timestamp.tv_nsec;
+}
+
+#define HEAP_ITEM(heap, i)  ((_LSMonitorQueueItem*)g_ptr_array_index((heap), (i)))
+
+static void
+_LSMonitorQueueHeapPush(GPtrArray *heap, _LSMonitorQueueItem *item)
+{
+    guint i = heap->len;
+
+    g_ptr_array_add(heap, item);
+
+    /* sift up */
+    while (i > 0)
+    {
+        guint parent = (i - 1) / 2;
+
+        if (!_LSMonitorQueueItemLess(item, HEAP_ITEM(heap, parent)))
+        {
+            break;
+        }
+
+        heap->pdata[i] = heap->pdata[parent];
+        i = parent;
+    }
+
+    heap->pdata[i] = item;
+}
+
+static _LSMonitorQueueItem*
+_LSMonitorQueueHeapPop(GPtrArray *heap)
+{
+    LS_ASSERT(heap->len > 0);
+
+    _LSMonitorQueueItem *top = HEAP_ITEM(heap, 0);
+    _LSMonitorQueueItem *last = g_ptr_array_remove_index(heap, heap->len - 1);
+
+    if (heap->len == 0)
+    {
+        return top;
+    }
+
+    /* sift down */
+    guint i = 0;
+
+    while (true)
+    {
+        guint child = 2 * i + 1;
+
+        if (child >= heap->len)
+        {
+            break;
+        }
+
+        if (child + 1 < heap->len && _LSMonitorQueueItemLess(HEAP_ITEM(heap, child + 1), HEAP_ITEM(heap, child)))
+        {
+            child++;
+        }
+
+        if (!_LSMonitorQueueItemLess(HEAP_ITEM(heap, child), last))
+        {
+            break;
+        }
+
+        heap->pdata[i] = heap->pdata[child];
+        i = child;
+    }
+
+    heap->pdata[i] = last;
+
+    return top;
 }
 
 void
@@ -61,18 +163,11 @@ _LSMonitorQueueMessage(_LSMonitorQueue *queue, _LSTransportMessage *message)
 
     _LSMonitorGetTime(&item->timestamp);
     item->message = message;
+    item->serial = _LSTransportMessageGetMonitorSerial(message);
     _LSTransportMessageRef(message);
 
-    g_queue_push_tail(queue->queue, item);
-}
-
-static void
-_LSMonitorQueueItemFree(_LSMonitorQueueItem *item)
-{
-    _LSTransportMessageUnref(item->message);
-    g_slice_free(_LSMonitorQueueItem, item);
+    _LSMonitorQueueHeapPush(queue->heap, item);
 }
-
 static bool
 _OutOfOrder(GHashTable *hash_table, _LSTransportMessage *message)
 {
@@ -105,65 +200,82 @@ _OutOfOrder(GHashTable *hash_table, _LSTransportMessage *message)
     return out_of_order;
 }
 
-static gint
-_LSMonitorQueueSortFunc(gconstpointer a, gconstpointer b, gpointer user_data)
+/* move the messages that have waited at least msecs to ready, in serial order */
+static void
+_LSMonitorQueuePopReady(_LSMonitorQueue *queue, const struct timespec *now, int msecs, GQueue *ready)
 {
-    const _LSMonitorQueueItem *item_a = a;
-    const _LSMonitorQueueItem *item_b = b;
+    while (queue->heap->len > 0)
+    {
+        _LSMonitorQueueItem *item = HEAP_ITEM(queue->heap, 0);
+
+        if (_LSMonitorTimeDiff((struct timespec*)now, &item->timestamp) * 1000.0 < msecs)
+        {
+            /* the smallest serial we have is still young, so something
+             * older than it might still be on the way */
+            break;
+        }
 
-    _LSTransportMonitorSerial serial_a = _LSTransportMessageGetMonitorSerial(item_a->message);
-    _LSTransportMonitorSerial serial_b = _LSTransportMessageGetMonitorSerial(item_b->message);
+        g_queue_push_tail(ready, _LSMonitorQueueHeapPop(queue->heap));
+    }
+}
 
-    return (serial_a - serial_b);
+static inline bool
+_LSMonitorQueueItemReceivedBefore(const _LSMonitorQueueItem *a, const _LSMonitorQueueItem *b)
+{
+    if (a->timestamp.tv_sec != b->timestamp.tv_sec)
+    {
+        return a->timestamp.tv_sec < b->timestamp.tv_sec;
+    }
+    return a->timestamp.tv_nsec <= b->timestamp.tv_nsec;
 }
 
+/**
+ * Print (or capture) the messages that have been queued for at least msecs.
+ *
+ * Each bus is put in monitor serial order (the serials are per bus), and
+ * the two buses are then merged by receive time. Either queue may be NULL.
+ */
 void
-_LSMonitorQueuePrint(_LSMonitorQueue *queue, int msecs, GHashTable *hash_table, gboolean debug_output)
+_LSMonitorQueuePrint(_LSMonitorQueue *private_queue, _LSMonitorQueue *public_queue,
+                     int msecs, GHashTable *hash_table, gboolean debug_output)
 {
     struct timespec now;
     _LSMonitorGetTime(&now);
 
-    double time_diff = 0.0;
-
-    /* Get all messages older than msecs and save in a new queue */
-    GQueue *orig_queue = queue->queue;
-    GQueue *print_queue = g_queue_new();
+    GQueue private_ready = G_QUEUE_INIT;
+    GQueue public_ready = G_QUEUE_INIT;
     _LSMonitorQueueItem *item = NULL;
 
-    while ((item = g_queue_peek_head(orig_queue)) != NULL)
+    if (private_queue) _LSMonitorQueuePopReady(private_queue, &now, msecs, &private_ready);
+    if (public_queue) _LSMonitorQueuePopReady(public_queue, &now, msecs, &public_ready);
+
+    char first = 'F';
+    /* print and free the merged items */
+    while (!g_queue_is_empty(&private_ready) || !g_queue_is_empty(&public_ready))
     {
-        time_diff = _LSMonitorTimeDiff(&now, &item->timestamp);
+        _LSMonitorQueueItem *private_head = g_queue_peek_head(&private_ready);
+        _LSMonitorQueueItem *public_head = g_queue_peek_head(&public_ready);
+        bool public_bus = false;
 
-        if (time_diff * 1000.0 >= msecs)
+        if (!private_head || (public_head && !_LSMonitorQueueItemReceivedBefore(private_head, public_head)))
         {
-            g_queue_push_tail(print_queue, g_queue_pop_head(orig_queue));
+            item = g_queue_pop_head(&public_ready);
+            public_bus = true;
         }
         else
         {
-           break;
-        } 
-    }
-
-    /* sort the print list by serial number */
-    g_queue_sort(print_queue, _LSMonitorQueueSortFunc, NULL);
-
-    char first = 'F';
-    /* print and free the sorted items */
-    while (!g_queue_is_empty(print_queue))
-    {
-        item = g_queue_pop_head(print_queue);
+            item = g_queue_pop_head(&private_ready);
+        }
 
         if (debug_output)
         {
-            char last = g_queue_is_empty(print_queue) ? 'L' : ' ';
-            fprintf(stdout, "[%c%c%c %"PRIu64"]\t", _OutOfOrder(hash_table, item->message) ? 'X' : ' ', first, last, _LSTransportMessageGetMonitorSerial(item->message));
+            char last = (g_queue_is_empty(&private_ready) && g_queue_is_empty(&public_ready)) ? 'L' : ' ';
+            fprintf(stdout, "[%c%c%c %"PRIu64"]\t", _OutOfOrder(hash_table, item->message) ? 'X' : ' ', first, last, item->serial);
         }
 
-        _LSMonitorMessagePrint(item->message, &item->timestamp, queue->public);
+        _LSMonitorMessagePrint(item->message, &item->timestamp, public_bus);
         _LSMonitorQueueItemFree(item);
 
         first = ' ';
     }
-
-    g_queue_free(print_queue);
 }
@@ -0,0 +1,358 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2008-2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+
+#include <pthread.h>
+#include <string.h>
+
+#include "base.h"
+#include "latency.h"
+#include "reply_cache.h"
+
+/**
+ * @defgroup LunaServiceReplyCache
+ * @ingroup LunaServiceInternals
+ * @brief Replies of LUNA_METHOD_FLAG_CACHEABLE methods, served without
+ * calling the method again
+ */
+
+/**
+ * @addtogroup LunaServiceReplyCache
+ * @{
+ */
+
+/**
+ * Per-handle reply cache. Keys are the category, method and payload (with
+ * the whitespace outside of strings taken out), separated by '\n', which
+ * can't appear in a category or method name.
+ */
+struct _LSReplyCache {
+    pthread_mutex_t lock;       /**< protects everything below */
+    GHashTable *entries;        /**< key -> _LSReplyCacheEntry */
+    gint64 ttl_us;              /**< how long entries are served (0 for until invalidated) */
+    guint generation;           /**< bumped by every invalidation, so a reply computed
+                                     before one isn't saved after it */
+};
+
+static void
+_LSReplyCacheLock(_LSReplyCache *cache)
+{
+    int lock_ret = pthread_mutex_lock(&cache->lock);
+    LS_ASSERT(lock_ret == 0);
+}
+
+static void
+_LSReplyCacheUnlock(_LSReplyCache *cache)
+{
+    int unlock_ret = pthread_mutex_unlock(&cache->lock);
+    LS_ASSERT(unlock_ret == 0);
+}
+
+/**
+ *******************************************************************************
+ * @brief Drop a reference to a cache entry; it's freed with the last one.
+ *
+ * @param  entry    IN  entry
+ *******************************************************************************
+ */
+void
+_LSReplyCacheEntryUnref(_LSReplyCacheEntry *entry)
+{
+    LS_ASSERT(g_atomic_int_get(&entry->ref) > 0);
+
+    if (g_atomic_int_dec_and_test(&entry->ref))
+    {
+#ifdef MEMCHECK
+        memset(entry, 0xFF, sizeof(_LSReplyCacheEntry) + entry->payload_len + 1);
+#endif
+
+        g_free(entry);
+    }
+}
+
+/**
+ *******************************************************************************
+ * @brief Allocate a reply cache.
+ *
+ * @retval  cache on success
+ * @retval  NULL on failure
+ *******************************************************************************
+ */
+_LSReplyCache*
+_LSReplyCacheNew(void)
+{
+    _LSReplyCache *cache = g_new0(_LSReplyCache, 1);
+
+    if (pthread_mutex_init(&cache->lock, NULL))
+    {
+        g_free(cache);
+        return NULL;
+    }
+
+    cache->entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                           (GDestroyNotify)_LSReplyCacheEntryUnref);
+    cache->ttl_us = (gint64)LS_REPLY_CACHE_DEFAULT_TTL_MS * 1000;
+
+    return cache;
+}
+
+/**
+ *******************************************************************************
+ * @brief Free a reply cache.
+ *
+ * @param  cache    IN  cache
+ *******************************************************************************
+ */
+void
+_LSReplyCacheFree(_LSReplyCache *cache)
+{
+    LS_ASSERT(cache != NULL);
+
+    g_hash_table_destroy(cache->entries);
+    pthread_mutex_destroy(&cache->lock);
+
+#ifdef MEMCHECK
+    memset(cache, 0xFF, sizeof(_LSReplyCache));
+#endif
+
+    g_free(cache);
+}
+
+/**
+ *******************************************************************************
+ * @brief Set how long replies saved from now on are served.
+ *
+ * @param  cache    IN  cache
+ * @param  ttl_ms   IN  time in ms (0 for until invalidated)
+ *******************************************************************************
+ */
+void
+_LSReplyCacheSetTtl(_LSReplyCache *cache, guint ttl_ms)
+{
+    _LSReplyCacheLock(cache);
+    cache->ttl_us = (gint64)ttl_ms * 1000;
+    _LSReplyCacheUnlock(cache);
+}
+
+/**
+ *******************************************************************************
+ * @brief Build the cache key for a call. Whitespace outside of strings is
+ * left out, so calls that only differ in formatting share a reply. Calls
+ * from different apps never share one.
+ *
+ * @param  category IN  category of the method
+ * @param  method   IN  method
+ * @param  app_id   IN  app id of the caller (NULL if it isn't an app)
+ * @param  payload  IN  payload of the call
+ *
+ * @retval  key (free with g_free())
+ *******************************************************************************
+ */
+char*
+_LSReplyCacheKey(const char *category, const char *method, const char *app_id,
+                 const char *payload)
+{
+    if (!app_id) app_id = "";
+
+    GString *key = g_string_sized_new(strlen(category) + strlen(method) + strlen(app_id)
+                                      + strlen(payload) + 3);
+    bool in_string = false;
+    bool escaped = false;
+    const char *p;
+
+    /* category and method go first for _LSReplyCacheInvalidate() */
+    g_string_append(key, category);
+    g_string_append_c(key, '\n');
+    g_string_append(key, method);
+    g_string_append_c(key, '\n');
+    g_string_append(key, app_id);
+    g_string_append_c(key, '\n');
+
+    for (p = payload; *p != '\0'; p++)
+    {
+        char c = *p;
+
+        if (in_string)
+        {
+            if (escaped)
+            {
+                escaped = false;
+            }
+            else if (c == '\\')
+            {
+                escaped = true;
+            }
+            else if (c == '"')
+            {
+                in_string = false;
+            }
+        }
+        else if (c == ' ' || c == '\t' || c == '\n' || c == '\r')
+        {
+            continue;
+        }
+        else if (c == '"')
+        {
+            in_string = true;
+        }
+
+        g_string_append_c(key, c);
+    }
+
+    return g_string_free(key, FALSE);
+}
+
+/**
+ *******************************************************************************
+ * @brief Look up a cached reply.
+ *
+ * @param  cache    IN  cache
+ * @param  key      IN  key from _LSReplyCacheKey()
+ *
+ * @retval  entry with a ref the caller has to drop with
+ *          _LSReplyCacheEntryUnref()
+ * @retval  NULL if there is no reply (or it expired)
+ *******************************************************************************
+ */
+_LSReplyCacheEntry*
+_LSReplyCacheLookup(_LSReplyCache *cache, const char *key)
+{
+    _LSReplyCacheLock(cache);
+
+    _LSReplyCacheEntry *entry = g_hash_table_lookup(cache->entries, key);
+
+    if (entry && entry->expires_us && entry->expires_us <= _LSLatencyNowUs())
+    {
+        g_hash_table_remove(cache->entries, key);
+        entry = NULL;
+    }
+
+    if (entry)
+    {
+        g_atomic_int_inc(&entry->ref);
+    }
+
+    _LSReplyCacheUnlock(cache);
+
+    return entry;
+}
+
+/**
+ *******************************************************************************
+ * @brief Get the current generation of the cache, to be passed to
+ * _LSReplyCacheSave() once the reply has been computed.
+ *
+ * @param  cache    IN  cache
+ *
+ * @retval  generation
+ *******************************************************************************
+ */
+guint
+_LSReplyCacheGetGeneration(_LSReplyCache *cache)
+{
+    _LSReplyCacheLock(cache);
+    guint generation = cache->generation;
+    _LSReplyCacheUnlock(cache);
+
+    return generation;
+}
+
+/**
+ *******************************************************************************
+ * @brief Save a reply. Nothing is saved if the cache was invalidated since
+ * generation was taken, since the reply may be out of date.
+ *
+ * @param  cache        IN  cache
+ * @param  key          IN  key from _LSReplyCacheKey()
+ * @param  generation   IN  generation from before the reply was computed
+ * @param  payload      IN  reply payload (nul-terminated at payload_len)
+ * @param  payload_len  IN  length of payload, not including the nul
+ *******************************************************************************
+ */
+void
+_LSReplyCacheSave(_LSReplyCache *cache, const char *key, guint generation,
+                  const char *payload, unsigned long payload_len)
+{
+    if (payload_len > LS_REPLY_CACHE_MAX_PAYLOAD)
+    {
+        return;
+    }
+
+    _LSReplyCacheEntry *entry = g_malloc(sizeof(_LSReplyCacheEntry) + payload_len + 1);
+
+    entry->ref = 1;
+    entry->payload_len = payload_len;
+    memcpy(entry->payload, payload, payload_len);
+    entry->payload[payload_len] = '\0';
+
+    _LSReplyCacheLock(cache);
+
+    if (generation != cache->generation)
+    {
+        _LSReplyCacheUnlock(cache);
+        _LSReplyCacheEntryUnref(entry);
+        return;
+    }
+
+    entry->expires_us = cache->ttl_us ? _LSLatencyNowUs() + cache->ttl_us : 0;
+
+    if (g_hash_table_size(cache->entries) >= LS_REPLY_CACHE_MAX_ENTRIES)
+    {
+        /* simplest possible bound; replies are cheap to recompute */
+        g_hash_table_remove_all(cache->entries);
+    }
+
+    g_hash_table_replace(cache->entries, g_strdup(key), entry);
+
+    _LSReplyCacheUnlock(cache);
+}
+
+static gboolean
+_LSReplyCacheKeyHasPrefix(gpointer key, gpointer value, gpointer prefix)
+{
+    return g_str_has_prefix(key, prefix);
+}
+
+/**
+ *******************************************************************************
+ * @brief Forget the cached replies of a method, or of every method in a
+ * category.
+ *
+ * @param  cache    IN  cache
+ * @param  category IN  category (as an object path)
+ * @param  method   IN  method (NULL for the whole category)
+ *******************************************************************************
+ */
+void
+_LSReplyCacheInvalidate(_LSReplyCache *cache, const char *category, const char *method)
+{
+    char *prefix = method ? g_strconcat(category, "\n", method, "\n", NULL)
+                          : g_strconcat(category, "\n", NULL);
+
+    _LSReplyCacheLock(cache);
+
+    cache->generation++;
+    g_hash_table_foreach_remove(cache->entries, _LSReplyCacheKeyHasPrefix, prefix);
+
+    _LSReplyCacheUnlock(cache);
+
+    g_free(prefix);
+}
+
+/* @} END OF LunaServiceReplyCache */
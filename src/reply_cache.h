@@ -0,0 +1,61 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2008-2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+#ifndef _REPLY_CACHE_H_
+#define _REPLY_CACHE_H_
+
+#include <stdbool.h>
+#include <glib.h>
+
+/** How long a cached reply is served by default (see LSMethodCacheSetTimeout()) */
+#define LS_REPLY_CACHE_DEFAULT_TTL_MS   60000
+
+/** Most replies cached per handle */
+#define LS_REPLY_CACHE_MAX_ENTRIES      256
+
+/** Replies bigger than this aren't cached */
+#define LS_REPLY_CACHE_MAX_PAYLOAD      (64 * 1024)
+
+/**
+ * A cached reply payload. Entries are ref counted so that a reply can be
+ * sent from one while another thread replaces or invalidates it.
+ */
+typedef struct _LSReplyCacheEntry {
+    gint ref;
+    gint64 expires_us;              /**< monotonic time the entry stops being served (0 for never) */
+    unsigned long payload_len;      /**< length of @ref payload, not including the nul */
+    char payload[];                 /**< nul-terminated payload */
+} _LSReplyCacheEntry;
+
+typedef struct _LSReplyCache _LSReplyCache;
+
+_LSReplyCache* _LSReplyCacheNew(void);
+void _LSReplyCacheFree(_LSReplyCache *cache);
+void _LSReplyCacheSetTtl(_LSReplyCache *cache, guint ttl_ms);
+
+char* _LSReplyCacheKey(const char *category, const char *method, const char *app_id,
+                       const char *payload);
+_LSReplyCacheEntry* _LSReplyCacheLookup(_LSReplyCache *cache, const char *key);
+void _LSReplyCacheEntryUnref(_LSReplyCacheEntry *entry);
+guint _LSReplyCacheGetGeneration(_LSReplyCache *cache);
+void _LSReplyCacheSave(_LSReplyCache *cache, const char *key, guint generation,
+                       const char *payload, unsigned long payload_len);
+void _LSReplyCacheInvalidate(_LSReplyCache *cache, const char *category, const char *method);
+
+#endif  /* _REPLY_CACHE_H_ */
@@ -26,49 +26,65 @@
 #include "message.h"
 #include "base.h"
 #include "subscription.h"
+#include "utf8.h"
 
 /**
  * @addtogroup LunaServiceInternals
  * @{
  */
 
-/** 
-* @brief Internal representation of a subscription list.
-*/
-typedef GPtrArray _SubList;
-
 /** 
 * @brief One subscription.
 */
 typedef struct _Subscription
 {
     LSMessage       *message;
-    GPtrArray       *keys;
+    LSHandle        *sh;         //< handle it was added through (a catalog
+                                 //  may be shared by both handles of a
+                                 //  palm service)
+    char            *token;      //< unique token; also the key in token_map
+    GHashTable      *keys;       //< set of keys it is in the lists for
 
     LSMessageToken   serverStatusWatch;
 
     int              ref;
+    int              removed;    //< no longer in the catalog (set under
+                                 //  the exclusive lock, read atomically)
 
 } _Subscription;
 
+/** 
+* @brief Internal representation of a subscription list.
+*
+* An insertion-ordered set of subscriptions. Removed entries leave a hole
+* in the array (so positions in the index stay valid) and the array is
+* compacted once half of it is holes, so add, remove and membership are
+* all O(1) and iteration stays a walk over an array.
+*/
+typedef struct _SubList
+{
+    GPtrArray   *subs;           //< _Subscription* in the order added;
+                                 //  NULL for removed entries
+    GHashTable  *index;          //< _Subscription* -> position in subs
+    guint        holes;          //< NULL entries in subs
+} _SubList;
+
 /** 
 * @brief Internal struct that contains all the subscriptions.
 */
 struct _Catalog {
 
-    pthread_mutex_t  lock;
-
-    LSHandle  *sh;
+    pthread_rwlock_t lock;           //< shared for lookups, exclusive for changes
 
     // each key is user defined 
     // each token is ':sender.connection.serial'
     
     GHashTable *token_map;           //< map of token -> _Subscription
     GHashTable *subscription_lists;  //< map from key ->
-                                     //   list of tokens (_SubList)
+                                     //   list of subscriptions (_SubList)
 
-    LSFilterFunc cancel_function;
-    void*        cancel_function_ctx;
+    // the cancel function and the set of coalesced keys are kept on the
+    // LSHandle, since a palm service's two handles may share a catalog
 };
 
 /** 
@@ -76,7 +92,7 @@ struct _Catalog {
 */
 struct LSSubscriptionIter {
 
-    _SubList *tokens;          //< copy of the subscription list
+    GPtrArray *subs;           //< ref'd copy of the subscription list
     _Catalog *catalog;
 
     GSList   *seen_messages;   //< ref-counted references to messages iterated
@@ -86,26 +102,26 @@ struct LSSubscriptionIter {
 static bool _subscriber_down(LSHandle *sh, LSMessage *message, void *ctx);
 static void _SubscriptionRelease(_Catalog *catalog, _Subscription *subs);
 
+/* Exclusive lock, for anything that changes token_map or
+ * subscription_lists */
 static void
 _CatalogLock(_Catalog *catalog)
 {
-    pthread_mutex_lock(&catalog->lock);
+    pthread_rwlock_wrlock(&catalog->lock);
 }
 
+/* Shared lock, for lookups and iteration. Readers only take atomic refs
+ * on what they find, so they never block each other. */
 static void
-_CatalogUnlock(_Catalog *catalog)
+_CatalogReadLock(_Catalog *catalog)
 {
-    pthread_mutex_unlock(&catalog->lock);
+    pthread_rwlock_rdlock(&catalog->lock);
 }
 
 static void
-_SubscriptionRemove(_Catalog *catalog, _Subscription *subs, const char *token)
+_CatalogUnlock(_Catalog *catalog)
 {
-    _CatalogLock(catalog);
-    g_hash_table_remove(catalog->token_map, token);
-    _CatalogUnlock(catalog);
-
-    _SubscriptionRelease(catalog, subs);
+    pthread_rwlock_unlock(&catalog->lock);
 }
 
 static void
@@ -117,8 +133,7 @@ _SubscriptionFree(_Catalog *catalog, _Subscription *subs)
 
         if (subs->keys)
         {
-            g_ptr_array_foreach(subs->keys, (GFunc)g_free, NULL);
-            g_ptr_array_free(subs->keys, TRUE);
+            g_hash_table_destroy(subs->keys);
         }
 
         if (subs->serverStatusWatch)
@@ -126,7 +141,7 @@ _SubscriptionFree(_Catalog *catalog, _Subscription *subs)
             bool retVal;
             LSError lserror;
             LSErrorInit(&lserror);
-            retVal = LSCallCancel(catalog->sh, subs->serverStatusWatch,
+            retVal = LSCallCancel(subs->sh, subs->serverStatusWatch,
                         &lserror);
             if (!retVal)
             {
@@ -137,6 +152,8 @@ _SubscriptionFree(_Catalog *catalog, _Subscription *subs)
             }
         }
 
+        g_free(subs->token);
+
 #ifdef MEMCHECK
         memset(subs, 0xFF, sizeof(_Subscription));
 #endif
@@ -148,7 +165,7 @@ _SubscriptionFree(_Catalog *catalog, _Subscription *subs)
 static _Subscription *
 _SubscriptionAcquire(_Catalog *catalog, const char *uniqueToken)
 {
-    _CatalogLock(catalog);
+    _CatalogReadLock(catalog);
 
     _Subscription *subs=
         g_hash_table_lookup(catalog->token_map, uniqueToken);
@@ -185,7 +202,7 @@ _SubscriptionRelease(_Catalog *catalog, _Subscription *subs)
 * @retval
 */
 static _Subscription *
-_SubscriptionNew(LSHandle *sh, LSMessage *message)
+_SubscriptionNew(LSHandle *sh, LSMessage *message, const char *token)
 {
     _Subscription *subs;
     bool retVal;
@@ -194,8 +211,12 @@ _SubscriptionNew(LSHandle *sh, LSMessage *message)
     if (!subs) goto error;
 
     subs->ref = 1;
+    subs->sh = sh;
+
+    subs->token = g_strdup(token);
+    if (!subs->token) goto error;
 
-    subs->keys = g_ptr_array_new();
+    subs->keys = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
     if (!subs->keys) goto error;
 
     LSMessageRef(message);
@@ -208,10 +229,10 @@ _SubscriptionNew(LSHandle *sh, LSMessage *message)
     LSError lserror;
     LSErrorInit(&lserror);
 
-    LSMessageToken token = LSMessageGetToken(message);
+    LSMessageToken msg_token = LSMessageGetToken(message);
 
     retVal = LSCall(sh, "palm://com.palm.bus/signal/registerServerStatus",
-           payload, _subscriber_down, (void*)token,
+           payload, _subscriber_down, (void*)msg_token,
            &subs->serverStatusWatch, &lserror);
     g_free(payload);
 
@@ -237,120 +258,183 @@ error:
 static _SubList *
 _SubListNew()
 {
-    return g_ptr_array_new();
+    _SubList *list = g_new0(_SubList, 1);
+
+    list->subs = g_ptr_array_new();
+    list->index = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+    return list;
 }
 
 static void
-_SubListFree(_SubList *tokens)
+_SubListFree(_SubList *list)
 {
-    if (!tokens) return;
+    if (!list) return;
+
+    g_ptr_array_free(list->subs, TRUE);
+    g_hash_table_destroy(list->index);
 
-    g_ptr_array_foreach(tokens, (GFunc)g_free, NULL);
-    g_ptr_array_free(tokens, TRUE);
+#ifdef MEMCHECK
+    memset(list, 0xFF, sizeof(_SubList));
+#endif
+
+    g_free(list);
 }
 
 static int
-_SubListLen(_SubList *tokens)
+_SubListLen(_SubList *list)
+{
+    if (!list) return 0;
+    return g_hash_table_size(list->index);
+}
+
+static bool
+_SubListContains(_SubList *list, _Subscription *subs)
+{
+    if (!list) return false;
+    return g_hash_table_lookup_extended(list->index, subs, NULL, NULL);
+}
+
+/** 
+* @brief Whether a handle added any of the subscriptions in a _SubList.
+* 
+* @param  list 
+* @param  sh 
+* 
+* @retval
+*/
+static bool
+_SubListHasHandle(_SubList *list, LSHandle *sh)
 {
-    if (!tokens) return 0;
-    return tokens->len;
+    guint i;
+
+    for (i = 0; list && i < list->subs->len; i++)
+    {
+        _Subscription *subs = g_ptr_array_index(list->subs, i);
+        if (subs && subs->sh == sh) return true;
+    }
+
+    return false;
 }
 
 /** 
-* @brief Add _SubList.
+* @brief Add to _SubList if it isn't already in it.
 * 
-* @param  tokens 
-* @param  data 
+* @param  list 
+* @param  subs 
 */
 static void
-_SubListAdd(_SubList *tokens, char *data)
+_SubListAdd(_SubList *list, _Subscription *subs)
 {
-    if (tokens && data)
-        g_ptr_array_add(tokens, data);
+    if (list && subs && !_SubListContains(list, subs))
+    {
+        g_hash_table_insert(list->index, subs, GUINT_TO_POINTER(list->subs->len));
+        g_ptr_array_add(list->subs, subs);
+    }
 }
 
-static _SubList* 
-_SubListDup(_SubList *src)
+/** 
+* @brief Squeeze the holes out of a _SubList, keeping the order.
+* 
+* @param  list 
+*/
+static void
+_SubListCompact(_SubList *list)
 {
-    _SubList *dst = NULL;
+    guint i;
+    guint j = 0;
 
-    if (src)
+    for (i = 0; i < list->subs->len; i++)
     {
-        dst = _SubListNew();
-
-        int i;
-        for (i = 0; i < src->len; i++)
+        _Subscription *subs = g_ptr_array_index(list->subs, i);
+        if (subs)
         {
-            char *tok = g_ptr_array_index(src, i);
-            g_ptr_array_add(dst, g_strdup(tok));
+            g_ptr_array_index(list->subs, j) = subs;
+            g_hash_table_insert(list->index, subs, GUINT_TO_POINTER(j));
+            j++;
         }
     }
 
-    return dst;
+    g_ptr_array_set_size(list->subs, j);
+    list->holes = 0;
 }
 
 /** 
-* @brief Remove from _SubList.  This is more expensive.
+* @brief Remove from _SubList.
 * 
-* @param  tokens 
-* @param  data 
+* @param  list 
+* @param  subs 
 */
 static void
-_SubListRemove(_SubList *tokens, const char *data)
+_SubListRemove(_SubList *list, _Subscription *subs)
 {
-    if (!tokens) return;
+    gpointer pos;
 
-    int i;
-    for (i = 0; i < tokens->len; i++)
+    if (!list) return;
+
+    if (g_hash_table_lookup_extended(list->index, subs, NULL, &pos))
     {
-        char *tok = g_ptr_array_index(tokens, i);
-        if (strncmp(tok, data, 50) == 0)
+        g_hash_table_remove(list->index, subs);
+        g_ptr_array_index(list->subs, GPOINTER_TO_UINT(pos)) = NULL;
+        list->holes++;
+
+        if (list->holes > list->subs->len / 2)
         {
-            g_ptr_array_remove_index(tokens, i);
-            g_free(tok);
-            break;
+            _SubListCompact(list);
         }
     }
 }
 
-static bool
-g_char_ptr_array_contains(GPtrArray *array, const char *data)
+/** 
+* @brief Copy the subscriptions a handle added to a _SubList, taking a ref
+*        on each. Call with the catalog lock held.
+* 
+* @param  list 
+* @param  sh 
+* 
+* @retval array of _Subscription* (release with _SubscriptionArrayFree())
+*/
+static GPtrArray *
+_SubListDup(_SubList *list, LSHandle *sh)
 {
-    if (!array) return false;
+    GPtrArray *dst = NULL;
 
-    int i;
-    for (i = 0; i < array->len; i++)
+    if (list)
     {
-        char *tok = g_ptr_array_index(array, i);
-        if (strcmp(tok, data) == 0)
+        dst = g_ptr_array_sized_new(_SubListLen(list));
+
+        guint i;
+        for (i = 0; i < list->subs->len; i++)
         {
-            return true;
+            _Subscription *subs = g_ptr_array_index(list->subs, i);
+            if (subs && subs->sh == sh)
+            {
+                g_atomic_int_inc(&subs->ref);
+                g_ptr_array_add(dst, subs);
+            }
         }
     }
-    return false;
+
+    return dst;
 }
 
-static bool
-_SubListContains(_SubList *tokens, const char *data)
+static void
+_SubscriptionArrayFree(_Catalog *catalog, GPtrArray *array)
 {
-    if (!tokens) return false;
+    if (!array) return;
 
-    int i;
-    for (i = 0; i < tokens->len; i++)
+    guint i;
+    for (i = 0; i < array->len; i++)
     {
-        char *tok = g_ptr_array_index(tokens, i);
-        if (strncmp(tok, data, 50) == 0)
-        {
-            return true;
-        }
+        _SubscriptionRelease(catalog, g_ptr_array_index(array, i));
     }
-    return false;
+    g_ptr_array_free(array, TRUE);
 }
 
-const char *
-_SubListGet(_SubList *tokens, int i)
+static _Subscription *
+_SubscriptionIterGet(LSSubscriptionIter *iter, int i)
 {
-    if (i < 0 || i >= tokens->len)
+    if (!iter->subs || i < 0 || i >= iter->subs->len)
     {
         g_critical("%s: attempting to get out of range subscription %d\n"
                "It is possible you forgot to follow the pattern: "
@@ -359,32 +443,29 @@ _SubListGet(_SubList *tokens, int i)
         return NULL;
     }
 
-    LS_ASSERT(i >= 0 && i < tokens->len);
-    return g_ptr_array_index(tokens, i);
+    return g_ptr_array_index(iter->subs, i);
 }
 
 _Catalog *
-_CatalogNew(LSHandle *sh)
+_CatalogNew(void)
 {
     _Catalog *catalog = g_new0(_Catalog, 1);
     if (!catalog) goto error_before_mutex;
 
-    pthread_mutex_init(&catalog->lock, NULL);
+    pthread_rwlock_init(&catalog->lock, NULL);
 
-    catalog->token_map = g_hash_table_new_full(
-            g_str_hash, g_str_equal, g_free, NULL);
+    /* keys are owned by the _Subscription */
+    catalog->token_map = g_hash_table_new(g_str_hash, g_str_equal);
     if (!catalog->token_map) goto error;
 
     catalog->subscription_lists = g_hash_table_new_full(
             g_str_hash, g_str_equal, g_free, (GDestroyNotify)_SubListFree);
     if (!catalog->subscription_lists) goto error;
 
-    catalog->sh = sh;
-
     return catalog;
 
 error:
-    pthread_mutex_destroy(&catalog->lock);
+    pthread_rwlock_destroy(&catalog->lock);
 
 error_before_mutex:
 
@@ -424,7 +505,7 @@ _CatalogFree(_Catalog *catalog)
 }
 
 static bool
-_CatalogAdd(_Catalog *catalog, const char *key,
+_CatalogAdd(_Catalog *catalog, LSHandle *sh, const char *key,
               LSMessage *message, LSError *lserror)
 {
     bool retVal = false;
@@ -455,10 +536,11 @@ _CatalogAdd(_Catalog *catalog, const char *key,
     _Subscription *subs = g_hash_table_lookup(catalog->token_map, token);
     if (!subs)
     {
-        subs = _SubscriptionNew(catalog->sh, message);
+        subs = _SubscriptionNew(sh, message, token);
         if (subs)
         {
-            g_hash_table_replace(catalog->token_map, g_strdup(token), subs);
+            /* the token is interned in the subscription */
+            g_hash_table_replace(catalog->token_map, subs->token, subs);
         }
         else
         {
@@ -467,14 +549,11 @@ _CatalogAdd(_Catalog *catalog, const char *key,
     }
     LS_ASSERT(subs->message == message);
 
-    if (!_SubListContains(list, token))
-    {
-        _SubListAdd(list, g_strdup(token));
-    }
+    _SubListAdd(list, subs);
 
-    if (!g_char_ptr_array_contains(subs->keys, key))
+    if (!g_hash_table_lookup_extended(subs->keys, key, NULL, NULL))
     {
-        g_ptr_array_add(subs->keys, g_strdup(key));
+        g_hash_table_insert(subs->keys, g_strdup(key), NULL);
     }
 
     retVal = true;
@@ -484,38 +563,62 @@ cleanup:
     return retVal;
 }
 
-static bool
-_CatalogRemoveToken(_Catalog *catalog, const char *token,
-                             bool notify)
+static void
+_CatalogRemoveSubscription(_Catalog *catalog, _Subscription *subs,
+                           bool notify)
 {
-    _Subscription *subs = _SubscriptionAcquire(catalog, token);
-    if (!subs) return false; 
-
-    if (notify && catalog->cancel_function)
+    if (notify && subs->sh->subscription_cancel_function)
     {
-        catalog->cancel_function(catalog->sh,
-                subs->message, catalog->cancel_function_ctx);
+        subs->sh->subscription_cancel_function(subs->sh,
+                subs->message, subs->sh->subscription_cancel_function_ctx);
     }
 
     _CatalogLock(catalog);
-    int i;
-    for (i = 0; i < subs->keys->len; i++)
+
+    if (subs->removed)
     {
-        const char *key = g_ptr_array_index(subs->keys, i);
+        /* someone else got to it first */
+        _CatalogUnlock(catalog);
+        return;
+    }
 
+    GHashTableIter iter;
+    gpointer key;
+
+    g_hash_table_iter_init(&iter, subs->keys);
+    while (g_hash_table_iter_next(&iter, &key, NULL))
+    {
         _SubList *sub_list =
             g_hash_table_lookup(catalog->subscription_lists, key);
 
-        _SubListRemove(sub_list, token);
+        _SubListRemove(sub_list, subs);
 
-        if (_SubListLen(sub_list) == 0)
+        if (sub_list && _SubListLen(sub_list) == 0)
         {
             g_hash_table_remove(catalog->subscription_lists, key);
         }
     }
+    g_hash_table_remove_all(subs->keys);
+
+    /* drop it from token_map in the same critical section, so that
+     * _CatalogAdd can't put it back in a list after it's gone */
+    g_hash_table_remove(catalog->token_map, subs->token);
+    g_atomic_int_set(&subs->removed, 1);
+
     _CatalogUnlock(catalog);
 
-    _SubscriptionRemove(catalog, subs, token);
+    /* ref held by token_map */
+    _SubscriptionRelease(catalog, subs);
+}
+
+static bool
+_CatalogRemoveToken(_Catalog *catalog, const char *token,
+                             bool notify)
+{
+    _Subscription *subs = _SubscriptionAcquire(catalog, token);
+    if (!subs) return false; 
+
+    _CatalogRemoveSubscription(catalog, subs, notify);
 
     _SubscriptionRelease(catalog, subs);
 
@@ -570,10 +673,10 @@ error:
 static _SubList*
 _CatalogGetSubList_unlocked(_Catalog *catalog, const char *key)
 {
-    _SubList *tokens =
+    _SubList *list =
         g_hash_table_lookup(catalog->subscription_lists, key);
 
-    return tokens;
+    return list;
 }
 
 static bool
@@ -657,12 +760,19 @@ _LSSubscriptionGetJson(LSHandle *sh, struct json_object **ret_obj, LSError *lser
      *  ...
      * ]
      */
-    _CatalogLock(catalog);
+    _CatalogReadLock(catalog);
 
     g_hash_table_iter_init(&iter, catalog->subscription_lists);
 
     while (g_hash_table_iter_next(&iter, (gpointer)&key, (gpointer)&sub_list))
     {
+        if (!_SubListHasHandle(sub_list, sh))
+        {
+            /* only the other handle of a palm service sharing this
+             * catalog has subscribers for the key */
+            continue;
+        }
+
         cur_obj = json_object_new_object();
         if (JSON_ERROR(cur_obj)) goto error;
 
@@ -673,19 +783,13 @@ _LSSubscriptionGetJson(LSHandle *sh, struct json_object **ret_obj, LSError *lser
         if (JSON_ERROR(key_name)) goto error;
 
         /* iterate over SubList */
-        int i = 0;
-        const char *token = NULL;
-        const int len = _SubListLen(sub_list);
-        for (i = 0; i < len; i++)
+        guint i = 0;
+        for (i = 0; i < sub_list->subs->len; i++)
         {
-            token = _SubListGet(sub_list, i);
+            _Subscription *sub = g_ptr_array_index(sub_list->subs, i);
 
-            if (token)
+            if (sub && sub->sh == sh)
             {
-                _Subscription *sub = g_hash_table_lookup(catalog->token_map, token);
-
-                if (!sub) continue;
-    
                 LSMessage *msg = sub->message;
                 const char *unique_name = LSMessageGetSender(msg);
                 const char *service_name = LSMessageGetSenderServiceName(msg);
@@ -778,8 +882,57 @@ LSSubscriptionSetCancelFunction(LSHandle *sh, LSFilterFunc cancelFunction,
 {
     LSHANDLE_VALIDATE(sh);
 
-    sh->catalog->cancel_function = cancelFunction;
-    sh->catalog->cancel_function_ctx = ctx;
+    sh->subscription_cancel_function = cancelFunction;
+    sh->subscription_cancel_function_ctx = ctx;
+    return true;
+}
+
+/** 
+* @brief Coalesce updates sent to the subscription list 'key'.
+*
+*  When a subscriber isn't reading fast enough, an update sent with
+*  LSSubscriptionReply() or LSSubscriptionPost() replaces the previous one
+*  for that subscription if it is still queued, instead of queueing behind
+*  it. A subscriber that is behind only ever gets the latest value, so the
+*  memory used and the time it takes to catch up are bounded. Only use this
+*  for keys whose subscribers don't need every intermediate update (e.g.,
+*  sensor readings and status).
+* 
+* @param  sh 
+* @param  key 
+* @param  coalesce  true to coalesce, false to queue every update (default)
+* @param  lserror 
+* 
+* @retval
+*/
+bool
+LSSubscriptionSetCoalesce(LSHandle *sh, const char *key, bool coalesce,
+                          LSError *lserror)
+{
+    LSHANDLE_VALIDATE(sh);
+
+    _LSErrorIfFail (key != NULL, lserror);
+
+    _Catalog *catalog = sh->catalog;
+
+    _CatalogLock(catalog);
+
+    if (!sh->coalesce_keys)
+    {
+        sh->coalesce_keys = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    }
+
+    if (coalesce)
+    {
+        g_hash_table_replace(sh->coalesce_keys, g_strdup(key), GINT_TO_POINTER(1));
+    }
+    else
+    {
+        g_hash_table_remove(sh->coalesce_keys, key);
+    }
+
+    _CatalogUnlock(catalog);
+
     return true;
 }
 
@@ -799,7 +952,7 @@ LSSubscriptionAdd(LSHandle *sh, const char *key,
 {
     LSHANDLE_VALIDATE(sh);
 
-    return _CatalogAdd(sh->catalog, key, message, lserror);
+    return _CatalogAdd(sh->catalog, sh, key, message, lserror);
 }
 
 /** 
@@ -827,9 +980,9 @@ LSSubscriptionAcquire(LSHandle *sh, const char *key,
         return false;
     }
 
-    _CatalogLock(catalog);
-    _SubList *tokens = _CatalogGetSubList_unlocked(catalog, key);
-    iter->tokens = _SubListDup(tokens);
+    _CatalogReadLock(catalog);
+    _SubList *list = _CatalogGetSubList_unlocked(catalog, key);
+    iter->subs = _SubListDup(list, sh);
     _CatalogUnlock(catalog);
 
     iter->catalog = catalog;
@@ -861,7 +1014,7 @@ LSSubscriptionRelease(LSSubscriptionIter *iter)
         seen_iter = seen_iter->next;
     }
 
-    _SubListFree(iter->tokens);
+    _SubscriptionArrayFree(iter->catalog, iter->subs);
     g_slist_free(iter->seen_messages);
     g_free(iter);
 }
@@ -876,12 +1029,12 @@ LSSubscriptionRelease(LSSubscriptionIter *iter)
 bool
 LSSubscriptionHasNext(LSSubscriptionIter *iter)
 {
-    if (!iter->tokens)
+    if (!iter->subs)
     {
         return false;
     }
 
-    return iter->index+1 < _SubListLen(iter->tokens);
+    return iter->index+1 < iter->subs->len;
 }
 
 /** 
@@ -894,24 +1047,19 @@ LSSubscriptionHasNext(LSSubscriptionIter *iter)
 LSMessage *
 LSSubscriptionNext(LSSubscriptionIter *iter)
 {
-    _Subscription *subs = NULL;
     LSMessage *message = NULL;
 
     iter->index++;
-    const char *tok = _SubListGet(iter->tokens, iter->index);
-    if (tok)
-    {
-        subs = _SubscriptionAcquire(iter->catalog, tok);
-        if (subs)
-        {
-            message = subs->message;
-            LSMessageRef(message);
+    _Subscription *subs = _SubscriptionIterGet(iter, iter->index);
 
-            iter->seen_messages =
-                g_slist_prepend(iter->seen_messages, message);
+    /* skip it if it was cancelled since the iterator was acquired */
+    if (subs && !g_atomic_int_get(&subs->removed))
+    {
+        message = subs->message;
+        LSMessageRef(message);
 
-            _SubscriptionRelease(iter->catalog, subs);
-        }
+        iter->seen_messages =
+            g_slist_prepend(iter->seen_messages, message);
     }
 
     return message;
@@ -925,15 +1073,119 @@ LSSubscriptionNext(LSSubscriptionIter *iter)
 void
 LSSubscriptionRemove(LSSubscriptionIter *iter)
 {
-    const char *tok = _SubListGet(iter->tokens, iter->index);
-    if (tok)
+    _Subscription *subs = _SubscriptionIterGet(iter, iter->index);
+    if (subs)
+    {
+        _CatalogRemoveSubscription(iter->catalog, subs, false);
+    }
+}
+
+/** 
+* @brief Do the checks LSMessageReply() does on a payload, once for all
+*        subscribers.
+* 
+* @param  payload 
+* @param  payload_len   OUT length of payload
+* @param  lserror 
+* 
+* @retval
+*/
+static bool
+_LSSubscriptionCheckPayload(const char *payload, size_t *payload_len, LSError *lserror)
+{
+    _LSErrorIfFail (payload != NULL, lserror);
+
+    if (unlikely(_ls_enable_utf8_validation))
+    {
+        /* finds the length in the same pass */
+        if (!_LSUtf8Validate(payload, -1, payload_len))
+        {
+            _LSErrorSet(lserror, -EINVAL, "%s: payload is not utf-8",
+                        __FUNCTION__);
+            return false;
+        }
+    }
+    else
+    {
+        *payload_len = strlen(payload);
+    }
+
+    if (unlikely(*payload_len == 0))
     {
-        _CatalogRemoveToken(iter->catalog, tok, false);
+        _LSErrorSet(lserror, -EINVAL, "Empty payload is not valid JSON. Use {}");
+        return false;
     }
+
+    return true;
+}
+
+/** 
+* @brief Append a ref'd transport message for each subscriber of 'key' to
+*        the messages of the handle that added it, in one pass over the
+*        catalog the handles share.
+* 
+* @param  handles       IN  handles with the same catalog
+* @param  num_handles   IN  number of handles
+* @param  key 
+* @param  messages      IN/OUT _LSTransportMessage* per handle, unref'd by
+*                              the caller
+* @param  coalesce      OUT true per handle if its replies to key replace
+*                           older queued ones
+*/
+static void
+_LSSubscriptionCollect(LSHandle **handles, int num_handles, const char *key,
+                       GPtrArray **messages, bool *coalesce)
+{
+    _Catalog *catalog = handles[0]->catalog;
+    int i;
+    int j;
+
+    _CatalogReadLock(catalog);
+
+    _SubList *list = _CatalogGetSubList_unlocked(catalog, key);
+
+    for (j = 0; j < num_handles; j++)
+    {
+        coalesce[j] = handles[j]->coalesce_keys &&
+                      g_hash_table_lookup(handles[j]->coalesce_keys, key) != NULL;
+    }
+
+    for (i = 0; list && i < list->subs->len; i++)
+    {
+        _Subscription *subs = g_ptr_array_index(list->subs, i);
+        if (!subs) continue;
+
+        for (j = 0; j < num_handles; j++)
+        {
+            if (subs->sh == handles[j])
+            {
+                g_ptr_array_add(messages[j], _LSTransportMessageRef(subs->message->transport_msg));
+                break;
+            }
+        }
+    }
+
+    _CatalogUnlock(catalog);
+}
+
+static void
+_LSSubscriptionMessagesFree(GPtrArray *messages)
+{
+    int i;
+
+    for (i = 0; i < messages->len; i++)
+    {
+        _LSTransportMessageUnref(g_ptr_array_index(messages, i));
+    }
+
+    g_ptr_array_free(messages, TRUE);
 }
 
 /** 
 * @brief Sends a message to subscription list with name 'key'.
+*
+* The reply is built once and shared by all subscribers. The catalog lock is
+* only held while collecting the subscribers, not while sending.
 * 
 * @param  sh 
 * @param  key 
@@ -948,43 +1200,45 @@ LSSubscriptionReply(LSHandle *sh, const char *key,
 {
     LSHANDLE_VALIDATE(sh);
 
+    size_t payload_len;
+
+    if (!_LSSubscriptionCheckPayload(payload, &payload_len, lserror))
+    {
+        return false;
+    }
+
     bool retVal = true;
-    _Catalog *catalog = sh->catalog;
+    bool coalesce = false;
+    GPtrArray *messages = g_ptr_array_new();
 
-    _CatalogLock(catalog);
+    _LSSubscriptionCollect(&sh, 1, key, &messages, &coalesce);
 
-    _SubList *tokens = _CatalogGetSubList_unlocked(catalog, key);
-    if (!tokens)
+    if (DEBUG_TRACING)
     {
-        retVal = true;
-        goto cleanup;
+        g_debug("TX: LSSubscriptionReply key: %s subscribers: %d", key, messages->len);
     }
 
-    int i;
-    for (i = 0; i < tokens->len; i++)
+    if (messages->len > 0)
     {
-        char *tok = g_ptr_array_index(tokens, i);
-
-        _Subscription *subs =
-            g_hash_table_lookup(catalog->token_map, tok);
-        if (!subs) continue;
+        retVal = _LSTransportSendReplyShared((_LSTransportMessage**)messages->pdata, messages->len,
+                                             payload, payload_len, coalesce, lserror);
+    }
 
-        LSMessage *message = subs->message;
+    _LSSubscriptionMessagesFree(messages);
 
-        retVal = LSMessageReply(sh, message, payload, lserror);
-        if (!retVal) goto cleanup;
-    }
-cleanup:
-    _CatalogUnlock(catalog);
     return retVal;
 }
 
 /** 
 * @brief Post a notification to all subscribers with name 'key'.
 *
-* This is equivalent to:
+* This has the same effect as:
 * LSSubscriptionReply(public_bus, ...)
 * LSSubscriptionReply(private_bus, ...)
+*
+* but the payload is only checked once and the subscribers of both buses
+* share one reply. When the handles share a catalog (see
+* LSRegisterPalmService()) the subscribers are also found in one pass.
 * 
 * @param  psh 
 * @param  key 
@@ -997,17 +1251,83 @@ bool
 LSSubscriptionRespond(LSPalmService *psh, const char *key,
                       const char *payload, LSError *lserror)
 {
+    _LSErrorIfFail(psh != NULL, lserror);
+
     LSHandle *public_bus = LSPalmServiceGetPublicConnection(psh);
     LSHandle *private_bus = LSPalmServiceGetPrivateConnection(psh);
-    bool retVal;
 
-    retVal = LSSubscriptionReply(public_bus, key, payload, lserror);
-    if (!retVal) return retVal;
+    LSHANDLE_VALIDATE(public_bus);
+    LSHANDLE_VALIDATE(private_bus);
 
-    retVal = LSSubscriptionReply(private_bus, key, payload, lserror);
-    if (!retVal) return retVal;
+    size_t payload_len;
 
-    return true;
+    if (!_LSSubscriptionCheckPayload(payload, &payload_len, lserror))
+    {
+        return false;
+    }
+
+    bool retVal = true;
+    LSHandle *handles[2] = { public_bus, private_bus };
+    GPtrArray *messages[2] = { g_ptr_array_new(), g_ptr_array_new() };
+    bool coalesce[2] = { false, false };
+
+    if (public_bus->catalog == private_bus->catalog)
+    {
+        /* the handles share a catalog, so one pass finds both buses'
+         * subscribers */
+        _LSSubscriptionCollect(handles, 2, key, messages, coalesce);
+    }
+    else
+    {
+        _LSSubscriptionCollect(&handles[0], 1, key, &messages[0], &coalesce[0]);
+        _LSSubscriptionCollect(&handles[1], 1, key, &messages[1], &coalesce[1]);
+    }
+
+    int num_public = messages[0]->len;
+    int num_private = messages[1]->len;
+
+    if (DEBUG_TRACING)
+    {
+        g_debug("TX: LSSubscriptionRespond key: %s subscribers: %d public, %d private",
+                key, num_public, num_private);
+    }
+
+    if (coalesce[0] == coalesce[1])
+    {
+        /* both buses get the same reply */
+        int i;
+        for (i = 0; i < num_private; i++)
+        {
+            g_ptr_array_add(messages[0], g_ptr_array_index(messages[1], i));
+        }
+        g_ptr_array_set_size(messages[1], 0);
+
+        if (messages[0]->len > 0)
+        {
+            retVal = _LSTransportSendReplyShared((_LSTransportMessage**)messages[0]->pdata, messages[0]->len,
+                                                 payload, payload_len, coalesce[0], lserror);
+        }
+    }
+    else
+    {
+        /* the key was only marked for coalescing on one of the buses */
+        if (num_public > 0)
+        {
+            retVal = _LSTransportSendReplyShared((_LSTransportMessage**)messages[0]->pdata, num_public,
+                                                 payload, payload_len, coalesce[0], lserror);
+        }
+
+        if (retVal && num_private > 0)
+        {
+            retVal = _LSTransportSendReplyShared((_LSTransportMessage**)messages[1]->pdata, num_private,
+                                                 payload, payload_len, coalesce[1], lserror);
+        }
+    }
+
+    _LSSubscriptionMessagesFree(messages[0]);
+    _LSSubscriptionMessagesFree(messages[1]);
+
+    return retVal;
 }
 
 /** 
@@ -1030,30 +1350,21 @@ LSSubscriptionProcess (LSHandle *sh, LSMessage *message, bool *subscribed,
 {
     bool retVal = false;
     bool subscribePayload = false;
-    struct json_object *subObj = NULL;
 
-    const char *payload = LSMessageGetPayload(message);
-    struct json_object *object = json_tokener_parse(payload);
+    _LSMessageSubscribeState state = _LSMessageGetSubscribeState(message);
 
-    if (JSON_ERROR(object))
+    if (state == _LSMessageSubscribeInvalid)
     {
-        _LSErrorSet(lserror, -1, "Unable to parse JSON: %s", payload);
+        _LSErrorSet(lserror, -1, "Unable to parse JSON: %s", LSMessageGetPayload(message));
         goto exit;
     }
 
-    if (!json_object_object_get_ex(object, "subscribe", &subObj))
-    {
-        subscribePayload = false;
-        /* FIXME: I think retVal should be false, but I don't know if anyone
-         * is relying on this behavior. If set to false, make sure to set
-         * LSError */
-        retVal = true;
-    }
-    else
-    {
-        subscribePayload = json_object_get_boolean(subObj);
-        retVal = true;
-    }
+    /* FIXME: if "subscribe" is missing, I think retVal should be false, but
+     * I don't know if anyone is relying on this behavior. If set to false,
+     * make sure to set LSError */
+    subscribePayload = (state == _LSMessageSubscribeTrue ||
+                        state == _LSMessageSubscribeTrueNotBoolean);
+    retVal = true;
 
     if (subscribePayload)
     {
@@ -1071,8 +1382,6 @@ LSSubscriptionProcess (LSHandle *sh, LSMessage *message, bool *subscribed,
     }
 
 exit:
-    if (!JSON_ERROR(object)) json_object_put(object);
-
     return retVal;
 }
 
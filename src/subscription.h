@@ -23,7 +23,7 @@
 typedef struct LSSubscriptionList LSSubscriptionList;
 typedef struct _Catalog _Catalog;
 
-_Catalog * _CatalogNew(LSHandle *sh);
+_Catalog * _CatalogNew(void);
 void _CatalogFree(_Catalog *catalog);
 
 bool _CatalogHandleCancel(_Catalog *catalog, LSMessage *cancelMsg,
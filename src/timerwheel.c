@@ -0,0 +1,383 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2008-2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+/**
+ * Timer wheel for large numbers of one-shot timeouts (e.g., the hub's
+ * timeouts for every pending QueryName and connect()).
+ *
+ * Timeouts are hashed by expiration tick into a fixed ring of slots, so
+ * arming and cancelling are O(1) list operations. The whole wheel is a
+ * single GSource that waits on a timerfd, which is only reprogrammed when
+ * a new timeout expires before the one it's already set for.
+ */
+
+#include <sys/timerfd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "timerwheel.h"
+
+#define TIMER_WHEEL_SLOTS       512     /**< must be a power of 2 */
+#define TIMER_WHEEL_SLOTS_MASK  (TIMER_WHEEL_SLOTS - 1)
+
+#define TIMER_WHEEL_DISARMED    G_MAXUINT64
+
+struct LSTimerWheel {
+    GSource source;
+    GPollFD poll_fd;                /**< timerfd */
+    guint tick_ms;
+    guint64 current_tick;           /**< last tick that was processed */
+    guint64 armed_tick;             /**< tick the timerfd is set for */
+    guint num_entries;
+    _LSTimerWheelEntry *expired;    /**< entries about to be fired */
+    _LSTimerWheelEntry *slots[TIMER_WHEEL_SLOTS];
+};
+
+static guint64
+_LSTimerWheelNowTick(_LSTimerWheel *wheel)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((guint64)now.tv_sec * 1000 + now.tv_nsec / 1000000) / wheel->tick_ms;
+}
+
+static void
+_LSTimerWheelListAdd(_LSTimerWheelEntry **list, _LSTimerWheelEntry *entry)
+{
+    entry->prev = NULL;
+    entry->next = *list;
+    if (*list) (*list)->prev = entry;
+    *list = entry;
+    entry->list = list;
+}
+
+static void
+_LSTimerWheelListRemove(_LSTimerWheelEntry *entry)
+{
+    if (entry->prev) entry->prev->next = entry->next;
+    else *entry->list = entry->next;
+
+    if (entry->next) entry->next->prev = entry->prev;
+
+    entry->next = NULL;
+    entry->prev = NULL;
+    entry->list = NULL;
+}
+
+/**
+ *******************************************************************************
+ * @brief Program the timerfd to go off at the start of a tick.
+ *
+ * @param  wheel    IN  wheel
+ * @param  tick     IN  tick, or TIMER_WHEEL_DISARMED to disarm
+ *******************************************************************************
+ */
+static void
+_LSTimerWheelSetTimer(_LSTimerWheel *wheel, guint64 tick)
+{
+    struct itimerspec spec;
+
+    memset(&spec, 0, sizeof(spec));
+
+    if (tick != TIMER_WHEEL_DISARMED)
+    {
+        guint64 ms = tick * wheel->tick_ms;
+        spec.it_value.tv_sec = ms / 1000;
+        spec.it_value.tv_nsec = (ms % 1000) * 1000000;
+    }
+
+    if (timerfd_settime(wheel->poll_fd.fd, TFD_TIMER_ABSTIME, &spec, NULL) != 0)
+    {
+        g_critical("%s: timerfd_settime: %s", __func__, g_strerror(errno));
+    }
+
+    wheel->armed_tick = tick;
+}
+
+/* set the timer for the next slot that has anything in it */
+static void
+_LSTimerWheelRearm(_LSTimerWheel *wheel)
+{
+    guint64 tick = TIMER_WHEEL_DISARMED;
+    guint i;
+
+    if (wheel->num_entries > 0)
+    {
+        for (i = 1; i <= TIMER_WHEEL_SLOTS; i++)
+        {
+            if (wheel->slots[(wheel->current_tick + i) & TIMER_WHEEL_SLOTS_MASK])
+            {
+                /* may only hold entries for a later lap; then we just
+                 * wake up, find nothing and come back here */
+                tick = wheel->current_tick + i;
+                break;
+            }
+        }
+    }
+
+    if (tick != wheel->armed_tick)
+    {
+        _LSTimerWheelSetTimer(wheel, tick);
+    }
+}
+
+static gboolean
+_LSTimerWheelPrepare(GSource *source, gint *timeout)
+{
+    *timeout = -1;
+    return FALSE;
+}
+
+static gboolean
+_LSTimerWheelCheck(GSource *source)
+{
+    _LSTimerWheel *wheel = (_LSTimerWheel*)source;
+
+    return (wheel->poll_fd.revents & G_IO_IN) ? TRUE : FALSE;
+}
+
+static gboolean
+_LSTimerWheelDispatch(GSource *source, GSourceFunc callback, gpointer user_data)
+{
+    _LSTimerWheel *wheel = (_LSTimerWheel*)source;
+    guint64 expirations;
+    guint64 tick;
+    guint64 now_tick = _LSTimerWheelNowTick(wheel);
+
+    if (read(wheel->poll_fd.fd, &expirations, sizeof(expirations)) < 0)
+    {
+        /* EAGAIN: the timer was reprogrammed since it went off */
+    }
+
+    /* the timer is one-shot, so it's disarmed now */
+    wheel->armed_tick = TIMER_WHEEL_DISARMED;
+
+    /* after a long stall, one lap covers every slot */
+    guint64 first_tick = wheel->current_tick + 1;
+    if (now_tick >= first_tick + TIMER_WHEEL_SLOTS)
+    {
+        first_tick = now_tick - TIMER_WHEEL_SLOTS + 1;
+    }
+
+    for (tick = first_tick; tick <= now_tick; tick++)
+    {
+        _LSTimerWheelEntry *entry = wheel->slots[tick & TIMER_WHEEL_SLOTS_MASK];
+
+        while (entry)
+        {
+            _LSTimerWheelEntry *next = entry->next;
+
+            if (entry->expires_tick <= now_tick)
+            {
+                _LSTimerWheelListRemove(entry);
+                _LSTimerWheelListAdd(&wheel->expired, entry);
+            }
+
+            entry = next;
+        }
+    }
+
+    if (now_tick > wheel->current_tick)
+    {
+        wheel->current_tick = now_tick;
+    }
+
+    /* Callbacks may arm and cancel other entries (including ones on the
+     * expired list), so take them off one at a time */
+    while (wheel->expired)
+    {
+        _LSTimerWheelEntry *entry = wheel->expired;
+
+        _LSTimerWheelListRemove(entry);
+        wheel->num_entries--;
+
+        entry->func(entry->user_data);
+    }
+
+    _LSTimerWheelRearm(wheel);
+
+    return TRUE;
+}
+
+static void
+_LSTimerWheelFinalize(GSource *source)
+{
+    _LSTimerWheel *wheel = (_LSTimerWheel*)source;
+
+    if (wheel->poll_fd.fd != -1) close(wheel->poll_fd.fd);
+}
+
+static GSourceFuncs _LSTimerWheelSourceFuncs = {
+    .prepare  = _LSTimerWheelPrepare,
+    .check    = _LSTimerWheelCheck,
+    .dispatch = _LSTimerWheelDispatch,
+    .finalize = _LSTimerWheelFinalize,
+};
+
+/**
+ *******************************************************************************
+ * @brief Create a timer wheel. Timeouts are rounded up to a whole number of
+ * ticks.
+ *
+ * @param  tick_ms  IN  resolution of the wheel
+ *
+ * @retval  wheel on success
+ * @retval  NULL on failure
+ *******************************************************************************
+ */
+_LSTimerWheel*
+_LSTimerWheelNew(guint tick_ms)
+{
+    LS_ASSERT(tick_ms > 0);
+
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    if (fd == -1)
+    {
+        g_critical("%s: timerfd_create: %s", __func__, g_strerror(errno));
+        return NULL;
+    }
+
+    _LSTimerWheel *wheel = (_LSTimerWheel*)g_source_new(&_LSTimerWheelSourceFuncs, sizeof(_LSTimerWheel));
+
+    wheel->poll_fd.fd = fd;
+    wheel->poll_fd.events = G_IO_IN;
+    wheel->tick_ms = tick_ms;
+    wheel->current_tick = _LSTimerWheelNowTick(wheel);
+    wheel->armed_tick = TIMER_WHEEL_DISARMED;
+
+    g_source_add_poll((GSource*)wheel, &wheel->poll_fd);
+
+    return wheel;
+}
+
+/**
+ *******************************************************************************
+ * @brief Attach a timer wheel to the context its callbacks should run on.
+ *
+ * @param  wheel    IN  wheel
+ * @param  context  IN  context (NULL for the default context)
+ *******************************************************************************
+ */
+void
+_LSTimerWheelAttach(_LSTimerWheel *wheel, GMainContext *context)
+{
+    LS_ASSERT(wheel != NULL);
+
+    g_source_attach((GSource*)wheel, context);
+}
+
+/**
+ *******************************************************************************
+ * @brief Free a timer wheel. Any entries that are still armed are
+ * forgotten without being called.
+ *
+ * @param  wheel    IN  wheel
+ *******************************************************************************
+ */
+void
+_LSTimerWheelFree(_LSTimerWheel *wheel)
+{
+    guint i;
+
+    LS_ASSERT(wheel != NULL);
+
+    for (i = 0; i < TIMER_WHEEL_SLOTS; i++)
+    {
+        while (wheel->slots[i]) _LSTimerWheelListRemove(wheel->slots[i]);
+    }
+
+    g_source_destroy((GSource*)wheel);
+    g_source_unref((GSource*)wheel);
+}
+
+/**
+ *******************************************************************************
+ * @brief Arm (or re-arm) a timeout. func is called once from the wheel's
+ * context after timeout_ms, unless the entry is cancelled first.
+ *
+ * @param  wheel        IN  wheel
+ * @param  entry        IN  entry
+ * @param  timeout_ms   IN  timeout
+ * @param  func         IN  callback (its return value is ignored)
+ * @param  user_data    IN  passed to func
+ *******************************************************************************
+ */
+void
+_LSTimerWheelArm(_LSTimerWheel *wheel, _LSTimerWheelEntry *entry, guint timeout_ms,
+                 GSourceFunc func, gpointer user_data)
+{
+    LS_ASSERT(wheel != NULL);
+    LS_ASSERT(entry != NULL);
+    LS_ASSERT(func != NULL);
+
+    _LSTimerWheelCancel(wheel, entry);
+
+    guint64 ticks = (timeout_ms + wheel->tick_ms - 1) / wheel->tick_ms;
+
+    /* we're part way through the current tick, so round the other way
+     * rather than fire early */
+    entry->expires_tick = _LSTimerWheelNowTick(wheel) + MAX(ticks, 1) + 1;
+    entry->func = func;
+    entry->user_data = user_data;
+
+    _LSTimerWheelListAdd(&wheel->slots[entry->expires_tick & TIMER_WHEEL_SLOTS_MASK], entry);
+    wheel->num_entries++;
+
+    if (entry->expires_tick < wheel->armed_tick)
+    {
+        _LSTimerWheelSetTimer(wheel, entry->expires_tick);
+    }
+}
+
+/**
+ *******************************************************************************
+ * @brief Cancel a timeout. Does nothing if the entry isn't armed (e.g.,
+ * it has already fired).
+ *
+ * @param  wheel    IN  wheel
+ * @param  entry    IN  entry
+ *******************************************************************************
+ */
+void
+_LSTimerWheelCancel(_LSTimerWheel *wheel, _LSTimerWheelEntry *entry)
+{
+    LS_ASSERT(wheel != NULL);
+    LS_ASSERT(entry != NULL);
+
+    if (entry->list)
+    {
+        _LSTimerWheelListRemove(entry);
+        wheel->num_entries--;
+
+        /* the timerfd may now go off early for nothing, which is cheaper
+         * than finding the next entry on every cancel */
+    }
+}
+
+bool
+_LSTimerWheelEntryIsArmed(const _LSTimerWheelEntry *entry)
+{
+    return entry->list != NULL;
+}
@@ -0,0 +1,52 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2008-2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+#ifndef _TIMERWHEEL_H_
+#define _TIMERWHEEL_H_
+
+#include <stdbool.h>
+#include <glib.h>
+
+typedef struct LSTimerWheel _LSTimerWheel;
+typedef struct LSTimerWheelEntry _LSTimerWheelEntry;
+
+/**
+ * A one-shot timeout on a @ref _LSTimerWheel. Embed this in whatever the
+ * timeout belongs to and zero it before first use; arming and cancelling
+ * don't allocate.
+ */
+struct LSTimerWheelEntry {
+    _LSTimerWheelEntry *next;
+    _LSTimerWheelEntry *prev;
+    _LSTimerWheelEntry **list;  /**< list the entry is on; NULL when not armed */
+    guint64 expires_tick;
+    GSourceFunc func;           /**< return value is ignored */
+    gpointer user_data;
+};
+
+_LSTimerWheel* _LSTimerWheelNew(guint tick_ms);
+void _LSTimerWheelAttach(_LSTimerWheel *wheel, GMainContext *context);
+void _LSTimerWheelFree(_LSTimerWheel *wheel);
+
+void _LSTimerWheelArm(_LSTimerWheel *wheel, _LSTimerWheelEntry *entry, guint timeout_ms,
+                      GSourceFunc func, gpointer user_data);
+void _LSTimerWheelCancel(_LSTimerWheel *wheel, _LSTimerWheelEntry *entry);
+bool _LSTimerWheelEntryIsArmed(const _LSTimerWheelEntry *entry);
+
+#endif  /* _TIMERWHEEL_H_ */
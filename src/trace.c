@@ -0,0 +1,261 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2008-2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <cjson/json.h>
+
+#include "base.h"
+#include "latency.h"
+#include "trace.h"
+
+/**
+ * @defgroup LunaServiceTrace
+ * @ingroup LunaServiceInternals
+ * @brief Binary flight recorder of message traffic
+ *
+ * When the LS_TRACE environment variable is set, each thread that goes
+ * through a tracepoint gets a ring of fixed-size records (LS_TRACE is the
+ * number of records; 1 means @ref LS_TRACE_DEFAULT_RECORDS). Recording is a
+ * timestamp and a few stores into the thread's own ring, without locks or
+ * formatting; the rings are only turned into json when someone asks for
+ * them (the "trace" private method).
+ *
+ * Rings are never freed, so the last records of a thread that has exited
+ * are still there for a post-mortem.
+ */
+
+/**
+ * @addtogroup LunaServiceTrace
+ * @{
+ */
+
+typedef struct _LSTraceEntry {
+    gint64 time_us;             /**< monotonic time */
+    guint64 token;
+    guint32 size;               /**< body size */
+    guint8 point;               /**< _LSTracePoint */
+    guint8 type;                /**< _LSTransportMessageType */
+} _LSTraceEntry;
+
+typedef struct _LSTraceRing {
+    long tid;                   /**< kernel thread id */
+    guint next;                 /**< records written; only the owning thread writes it */
+    guint mask;                 /**< number of records - 1 (a power of 2) */
+    _LSTraceEntry entries[];
+} _LSTraceRing;
+
+bool _ls_trace_enabled = false;
+
+static guint trace_ring_records = 0;
+
+static __thread _LSTraceRing *trace_ring = NULL;
+
+static pthread_mutex_t trace_rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static GSList *trace_rings = NULL;      /**< every thread's ring */
+
+static const char *trace_point_names[_LSTracePointCount] = {
+    [_LSTracePointSend] = "send",
+    [_LSTracePointReceive] = "receive",
+    [_LSTracePointDispatch] = "dispatch",
+    [_LSTracePointCall] = "call",
+    [_LSTracePointReply] = "reply",
+};
+
+/** 
+ *******************************************************************************
+ * @brief Turn on tracing if the LS_TRACE environment variable asks for it.
+ *******************************************************************************
+ */
+void
+_LSTraceInit(void)
+{
+    char *ls_trace = getenv("LS_TRACE");
+
+    if (!ls_trace)
+    {
+        return;
+    }
+
+    int records = atoi(ls_trace);
+
+    if (records <= 1)
+    {
+        records = LS_TRACE_DEFAULT_RECORDS;
+    }
+
+    /* round up to a power of 2 so the ring index is a mask */
+    trace_ring_records = 1;
+    while (trace_ring_records < (guint)records)
+    {
+        trace_ring_records <<= 1;
+    }
+
+    _ls_trace_enabled = true;
+    g_debug("Tracing enabled with %u records per thread", trace_ring_records);
+}
+
+static _LSTraceRing*
+_LSTraceRingNew(void)
+{
+    _LSTraceRing *ring = g_malloc0(sizeof(_LSTraceRing) + trace_ring_records * sizeof(_LSTraceEntry));
+
+    if (!ring) return NULL;
+
+    ring->tid = syscall(SYS_gettid);
+    ring->mask = trace_ring_records - 1;
+
+    pthread_mutex_lock(&trace_rings_lock);
+    trace_rings = g_slist_prepend(trace_rings, ring);
+    pthread_mutex_unlock(&trace_rings_lock);
+
+    trace_ring = ring;
+
+    return ring;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Add a record to this thread's ring. Use LS_TRACE() instead of
+ * calling this directly.
+ * 
+ * @param  point    IN  tracepoint
+ * @param  type     IN  message type
+ * @param  token    IN  message token
+ * @param  size     IN  message body size
+ *******************************************************************************
+ */
+void
+_LSTraceRecord(_LSTracePoint point, int type, LSMessageToken token, unsigned long size)
+{
+    _LSTraceRing *ring = trace_ring;
+
+    if (G_UNLIKELY(!ring))
+    {
+        ring = _LSTraceRingNew();
+        if (!ring) return;
+    }
+
+    _LSTraceEntry *entry = &ring->entries[ring->next & ring->mask];
+
+    entry->time_us = _LSLatencyNowUs();
+    entry->token = token;
+    entry->size = size;
+    entry->point = point;
+    entry->type = type;
+
+    /* publish the entry before moving past it */
+    __sync_synchronize();
+    ring->next++;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Get the trace rings as json, oldest record first:
+ *
+ * {"points": [string,...],
+ *  "threads": [{"tid": int, "records": [[sec, usec, point, type, token, size],...]},...]}
+ *
+ * sec and usec are the monotonic time of the record; point is an index into
+ * "points"; type is the transport message type.
+ * Records are read while other threads may be writing, so the oldest few of
+ * a busy thread can be torn.
+ * 
+ * @retval  json object on success
+ * @retval  NULL on failure
+ *******************************************************************************
+ */
+struct json_object*
+_LSTraceGetJson(void)
+{
+    GSList *cur = NULL;
+    int i;
+
+    struct json_object *ret_obj = json_object_new_object();
+    if (JSON_ERROR(ret_obj)) return NULL;
+
+    struct json_object *points_obj = json_object_new_array();
+    struct json_object *threads_obj = json_object_new_array();
+
+    if (JSON_ERROR(points_obj) || JSON_ERROR(threads_obj))
+    {
+        if (!JSON_ERROR(points_obj)) json_object_put(points_obj);
+        if (!JSON_ERROR(threads_obj)) json_object_put(threads_obj);
+        json_object_put(ret_obj);
+        return NULL;
+    }
+
+    for (i = 0; i < _LSTracePointCount; i++)
+    {
+        json_object_array_add(points_obj, json_object_new_string(trace_point_names[i]));
+    }
+
+    pthread_mutex_lock(&trace_rings_lock);
+
+    for (cur = trace_rings; cur != NULL; cur = g_slist_next(cur))
+    {
+        _LSTraceRing *ring = cur->data;
+        guint next = g_atomic_int_get((gint*)&ring->next);
+        guint count = MIN(next, ring->mask + 1);
+        guint n;
+
+        struct json_object *thread_obj = json_object_new_object();
+        struct json_object *records_obj = json_object_new_array();
+
+        if (JSON_ERROR(thread_obj) || JSON_ERROR(records_obj))
+        {
+            if (!JSON_ERROR(thread_obj)) json_object_put(thread_obj);
+            if (!JSON_ERROR(records_obj)) json_object_put(records_obj);
+            continue;
+        }
+
+        for (n = next - count; n != next; n++)
+        {
+            const _LSTraceEntry *entry = &ring->entries[n & ring->mask];
+            struct json_object *record_obj = json_object_new_array();
+
+            if (JSON_ERROR(record_obj)) continue;
+
+            json_object_array_add(record_obj, json_object_new_int64(entry->time_us / 1000000));
+            json_object_array_add(record_obj, json_object_new_int(entry->time_us % 1000000));
+            json_object_array_add(record_obj, json_object_new_int(entry->point));
+            json_object_array_add(record_obj, json_object_new_int(entry->type));
+            json_object_array_add(record_obj, json_object_new_int64(entry->token));
+            json_object_array_add(record_obj, json_object_new_int(entry->size));
+            json_object_array_add(records_obj, record_obj);
+        }
+
+        json_object_object_add(thread_obj, "tid", json_object_new_int(ring->tid));
+        json_object_object_add(thread_obj, "records", records_obj);
+        json_object_array_add(threads_obj, thread_obj);
+    }
+
+    pthread_mutex_unlock(&trace_rings_lock);
+
+    json_object_object_add(ret_obj, "points", points_obj);
+    json_object_object_add(ret_obj, "threads", threads_obj);
+
+    return ret_obj;
+}
+
+/* @} END OF LunaServiceTrace */
@@ -0,0 +1,69 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2008-2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdbool.h>
+#include <glib.h>
+#include "transport_message.h"
+
+/* comment out to compile the tracepoints out entirely */
+#define LS_TRACEPOINTS
+
+/** Default number of records kept per thread (LS_TRACE=1) */
+#define LS_TRACE_DEFAULT_RECORDS    4096
+
+typedef enum {
+    _LSTracePointSend,          /**< message handed to the transport to send */
+    _LSTracePointReceive,       /**< message completely received */
+    _LSTracePointDispatch,      /**< message about to be dispatched */
+    _LSTracePointCall,          /**< method call sent (token is the call's) */
+    _LSTracePointReply,         /**< reply handed to its call's callback (token is the call's) */
+    _LSTracePointCount,
+} _LSTracePoint;
+
+struct json_object;
+
+extern bool _ls_trace_enabled;
+
+void _LSTraceInit(void);
+void _LSTraceRecord(_LSTracePoint point, int type, LSMessageToken token, unsigned long size);
+struct json_object* _LSTraceGetJson(void);
+
+#ifdef LS_TRACEPOINTS
+/** Record a tracepoint; just a predicted-not-taken branch when tracing is off */
+#define LS_TRACE(point, type, token, size)                              \
+do {                                                                    \
+    if (G_UNLIKELY(_ls_trace_enabled))                                  \
+    {                                                                   \
+        _LSTraceRecord((point), (type), (token), (size));               \
+    }                                                                   \
+} while (0)
+#else
+#define LS_TRACE(point, type, token, size)  do { } while (0)
+#endif
+
+#define LS_TRACE_MESSAGE(point, message)                                \
+    LS_TRACE((point), _LSTransportMessageGetType(message),              \
+             _LSTransportMessageGetToken(message),                      \
+             _LSTransportMessageGetBodySize(message))
+
+#endif  /* _TRACE_H_ */
@@ -36,6 +36,9 @@
 #include "transport_utils.h"
 #include "base.h"
 #include "message.h"
+#include "binary_payload.h"
+#include "transport_compress.h"
+#include "trace.h"
 //#include "callmap.h"
 
 /**
@@ -85,22 +88,27 @@ void _LSTransportAddSendWatch(_LSTransportChannel *channel, GMainContext *contex
 void _LSTransportRemoveSendWatch(_LSTransportChannel *channel);
 void _LSTransportAddReceiveWatch(_LSTransportChannel *channel, GMainContext *context, _LSTransportClient *client);
 void _LSTransportRemoveReceiveWatch(_LSTransportChannel *channel);
+static gboolean _LSTransportTrimIdleConnections(gpointer data);
 
 bool _LSTransportProcessIncomingMessages(_LSTransportClient *client, LSError *lserror);
 
 
 bool _LSTransportSendMessageClientInfo(_LSTransportClient *client, const char *service_name, const char *unique_name, bool prepend, LSError *lserror);
+static bool _LSTransportSendMessageCapabilities(_LSTransportClient *client, LSError *lserror);
+static void _LSTransportPublishClientsLocked(_LSTransportBus *bus);
 static bool _LSTransportSendMessageMonitor(_LSTransportMessage *message, _LSTransportClient *monitor, LSError *lserror);
 static bool _LSTransportSendMessageRaw(_LSTransportMessage *message, _LSTransportClient *client, bool set_token, LSMessageToken *token, bool prepend, LSError *lserror);
-bool _LSTransportSendMessageToService(_LSTransport *transport, const char *service_name, _LSTransportMessage *message, LSMessageToken *token, LSError *lserror);
-bool _LSTransportAddPendingMessageWithToken(_LSTransport *transport, const char *service_name, _LSTransportMessage *message, LSMessageToken msg_token, LSError *lserror);
-bool _LSTransportAddPendingMessage(_LSTransport *transport, const char *service_name, _LSTransportMessage *message, LSMessageToken *token, LSError *lserror);
+bool _LSTransportSendMessageToService(_LSTransportBus *bus, const char *service_name, _LSTransportMessage *message, LSMessageToken *token, LSError *lserror);
+bool _LSTransportAddPendingMessageWithToken(_LSTransportBus *bus, const char *service_name, _LSTransportMessage *message, LSMessageToken msg_token, LSError *lserror);
+bool _LSTransportAddPendingMessage(_LSTransportBus *bus, const char *service_name, _LSTransportMessage *message, LSMessageToken *token, LSError *lserror);
 bool _LSTransportSendErrorReply(const _LSTransportMessage *message, _LSTransportMessageType error_type, const char *error_msg, LSError *lserror);
 
-void _LSTransportRemoveClientHash(_LSTransport *transport, _LSTransportClient *client);
+void _LSTransportRemoveClientHash(_LSTransportBus *bus, _LSTransportClient *client);
 bool _LSTransportRemoveAllConnectionHash(_LSTransport *transport, _LSTransportClient *client);
 
 bool _LSTransportQueryName(_LSTransportClient *hub, _LSTransportMessage *trigger_message, const char *service_name, LSError *lserror);
+static void _LSTransportQueryNameCacheInvalidateLocked(_LSTransportBus *bus, const char *service_name);
+static void _LSTransportHubLost(_LSTransportBus *bus);
 
 static bool s_is_hub = false;   /**< true if the process using this library is
                                   the hub. Note that this is not secure in any
@@ -110,9 +118,8 @@ static bool s_is_hub = false;   /**< true if the process using this library is
 /** 
  *******************************************************************************
  * @brief Get the next token for the given transport. This will wrap around
- * when exceeding the size of @ref LSMessageToken.
- *
- * @attention Locks the global token lock.
+ * when exceeding the size of @ref LSMessageToken. Lock-free, so it can be
+ * called from any number of threads at once.
  * 
  * @param  transport    IN  transport 
  * 
@@ -122,18 +129,15 @@ static bool s_is_hub = false;   /**< true if the process using this library is
 LSMessageToken
 _LSTransportGetNextToken(_LSTransport *transport)
 {
-    LSMessageToken ret;
-    
-    GLOBAL_TOKEN_LOCK(&transport->global_token->lock);
-    ret = ++transport->global_token->value;
+    LSMessageToken ret = __sync_add_and_fetch(&transport->global_token->value, 1);
 
-    /* skip over invalid token */
-    if (ret == LSMESSAGE_TOKEN_INVALID)
+    /* skip over invalid token; only the thread that got it skips, so no
+     * one else can be handed the same value */
+    if (unlikely(ret == LSMESSAGE_TOKEN_INVALID))
     {
         g_critical("Token value rolled over");
-        ret = ++transport->global_token->value;
+        ret = __sync_add_and_fetch(&transport->global_token->value, 1);
     }
-    GLOBAL_TOKEN_UNLOCK(&transport->global_token->lock);
 
     return ret;
 }
@@ -183,14 +187,11 @@ _LSTransportSerialHandleShutdown(_LSTransportSerial *serial_info, LSMessageToken
 
     SERIAL_INFO_LOCK(&serial_info->lock);
 
-    GList *iter = g_queue_peek_head_link(serial_info->queue);
+    LSMessageToken serial;
     bool not_processed = false;
 
-    while (iter != NULL)
+    while (_LSTransportSerialPopHeadSerialLocked(serial_info, &serial))
     {
-        GList *tmp = iter;
-        LSMessageToken serial = ((_LSTransportSerialListItem*)(iter->data))->serial;
-
         if (serial > last_serial)
         {
             /* last_serial is the last serial that the far side processed. We've
@@ -231,16 +232,6 @@ _LSTransportSerialHandleShutdown(_LSTransportSerial *serial_info, LSMessageToken
                 g_critical("Unable to allocate memory for failure item");
             }
         }
-
-        iter = g_list_next(iter);
-        
-        /* remove item from list */
-        _LSTransportSerialListItemFree(tmp->data);
-        g_queue_delete_link(serial_info->queue, tmp);
-        
-        /* remove from hash table */
-        _LSTransportSerialMapEntry *entry = g_hash_table_lookup(serial_info->map, &serial);
-        g_hash_table_remove(serial_info->map, &entry->serial);
     }
 
     SERIAL_INFO_UNLOCK(&serial_info->lock);
@@ -276,7 +267,7 @@ _LSTransportDisconnectCleanup(_LSTransportClient *client)
     LS_ASSERT(client != NULL);
 
     /* remove send watch */
-    if (client->channel.send_watch)
+    if (_LSTransportChannelHasSendWatch(&client->channel))
     {
         _LSTransportRemoveSendWatch(&client->channel);
     }
@@ -323,16 +314,16 @@ _LSTransportGetShutdownToken(_LSTransportMessage *message, LSMessageToken *token
  *
  * @attention locks outgoing lock
  * 
- * @param  transport    IN  transport
+ * @param  bus          IN  bus the queue's client is on
  * @param  outgoing     IN  outgoing queue 
  * @param  last_serial  IN  last serial processed 
  * @param  type         IN  disconnect reason 
  *******************************************************************************
  */
 void
-_LSTransportClientShutdownProcessQueue(_LSTransport *transport, _LSTransportOutgoing *outgoing, LSMessageToken last_serial, _LSTransportDisconnectType type)
+_LSTransportClientShutdownProcessQueue(_LSTransportBus *bus, _LSTransportOutgoing *outgoing, LSMessageToken last_serial, _LSTransportDisconnectType type)
 {
-    LS_ASSERT(transport != NULL);
+    LS_ASSERT(bus != NULL);
     LS_ASSERT(outgoing != NULL);
 
     /* TODO: make sure that the client going down is removed from the clients
@@ -350,7 +341,7 @@ _LSTransportClientShutdownProcessQueue(_LSTransport *transport, _LSTransportOutg
        up the serial number and getting the globally unique token */
 
     /* custom message failure handler */ 
-    if (transport->message_failure_handler)
+    if (bus->message_failure_handler)
     { 
         _ls_verbose("last serial: %d\n", (int)last_serial);
     
@@ -360,11 +351,11 @@ _LSTransportClientShutdownProcessQueue(_LSTransport *transport, _LSTransportOutg
         while (!g_queue_is_empty(outgoing->queue))
         {
             /* grab message off queue */
-            _LSTransportMessage *failed_message = (_LSTransportMessage*)g_queue_pop_head(outgoing->queue);
+            _LSTransportMessage *failed_message = _LSTransportOutgoingPop(outgoing);
 
             // We can be reentered from the callback. So don't hold the lock during the callback
             OUTGOING_UNLOCK(&outgoing->lock);
-            transport->message_failure_handler(_LSTransportMessageGetToken(failed_message), _LSTransportMessageFailureTypeNotProcessed, transport->message_failure_context);
+            bus->message_failure_handler(_LSTransportMessageGetToken(failed_message), _LSTransportMessageFailureTypeNotProcessed, bus->message_failure_context);
             OUTGOING_LOCK(&outgoing->lock); 
 
             /* remove the serial from the set if it is a method call; other control
@@ -379,7 +370,7 @@ _LSTransportClientShutdownProcessQueue(_LSTransport *transport, _LSTransportOutg
    
         OUTGOING_UNLOCK(&outgoing->lock);
         
-        _LSTransportSerialHandleShutdown(outgoing->serial, last_serial, type, transport->message_failure_handler, transport->message_failure_context);
+        _LSTransportSerialHandleShutdown(outgoing->serial, last_serial, type, bus->message_failure_handler, bus->message_failure_context);
     }
 }
 
@@ -406,6 +397,7 @@ _LSTransportClientShutdown(_LSTransportClient *client, LSMessageToken last_seria
 
     _LSTransportOutgoing *pending = NULL;
     _LSTransport *transport = client->transport;
+    _LSTransportBus *bus = client->bus;
 
     /* Remove ref-counted client from hash tables.
      *
@@ -418,7 +410,7 @@ _LSTransportClientShutdown(_LSTransportClient *client, LSMessageToken last_seria
 
     /* First, attempt to remove from client hash; it may not be in here
      * if it's not providing a service (i.e., doesn't have a service name */
-    _LSTransportRemoveClientHash(client->transport, client);
+    _LSTransportRemoveClientHash(bus, client);
 
     /* Then, remove from all connection hash which must have it */
     _LSTransportRemoveAllConnectionHash(client->transport, client);
@@ -433,11 +425,11 @@ _LSTransportClientShutdown(_LSTransportClient *client, LSMessageToken last_seria
     if (client->service_name)
     {
         /* NOTE: this lookup needs to be protected by the transport lock */
-        pending = g_hash_table_lookup(transport->pending, client->service_name);
+        pending = g_hash_table_lookup(bus->pending, client->service_name);
         
         if (pending)
         {
-            g_hash_table_remove(transport->pending, client->service_name);
+            g_hash_table_remove(bus->pending, client->service_name);
         }
     }
     
@@ -457,23 +449,28 @@ _LSTransportClientShutdown(_LSTransportClient *client, LSMessageToken last_seria
          */
         if (pending)
         {
-            _LSTransportClientShutdownProcessQueue(transport, pending, last_serial, type);
+            _LSTransportClientShutdownProcessQueue(bus, pending, last_serial, type);
             _LSTransportOutgoingFree(pending);
         }
 
-        _LSTransportClientShutdownProcessQueue(transport, client->outgoing, last_serial, type);
+        _LSTransportClientShutdownProcessQueue(bus, client->outgoing, last_serial, type);
     }
 
 skip_pending:
     /* call custom disconnect cleanup handler */
-    if (!no_fail && transport->disconnect_handler)
+    if (!no_fail && bus->disconnect_handler)
     {
-        transport->disconnect_handler(client, type, transport->disconnect_context);
+        bus->disconnect_handler(client, type, bus->disconnect_context);
     }
 
     /* default cleanup */
     _LSTransportDisconnectCleanup(client);
 
+    if (client == bus->hub)
+    {
+        _LSTransportHubLost(bus);
+    }
+
     _LSTransportClientUnref(client);
 }
 
@@ -491,23 +488,8 @@ _LSTransportClientShutdownDirty(_LSTransportClient *client)
 {
     /* "last_serial" is the first item on the serial list because we
      * need to treat all of them as having failed */
-    LSMessageToken last_serial;
-
-    OUTGOING_SERIAL_LOCK(&client->outgoing->serial->lock); 
-
-    _LSTransportSerialListItem *item = (_LSTransportSerialListItem*) g_queue_peek_head(client->outgoing->serial->queue);
-
-    if (item)
-    {
-        last_serial = item->serial;
-    }
-    else
-    {
-        /* no outstanding method calls */
-        last_serial = LSMESSAGE_TOKEN_INVALID;
-    }
-
-    OUTGOING_SERIAL_UNLOCK(&client->outgoing->serial->lock); 
+    /* LSMESSAGE_TOKEN_INVALID if there are no outstanding method calls */
+    LSMessageToken last_serial = _LSTransportSerialPeekHeadSerial(client->outgoing->serial);
 
     _LSTransportClientShutdown(client, last_serial, _LSTransportDisconnectTypeDirty, false);
 
@@ -545,14 +527,23 @@ error:
     return success;
 }
 
+static gint
+_LSTransportMessageCompareToken(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+    LSMessageToken token_a = _LSTransportMessageGetToken((const _LSTransportMessage*)a);
+    LSMessageToken token_b = _LSTransportMessageGetToken((const _LSTransportMessage*)b);
+
+    return (token_a > token_b) - (token_a < token_b);
+}
+
 static bool
 _call_pending(_LSTransportClient *client, int serial)
 {
-    _LSTransportOutgoing *pending = g_hash_table_lookup(client->transport->pending, client->service_name);
+    _LSTransportOutgoing *pending = g_hash_table_lookup(client->bus->pending, client->service_name);
 
     if (pending)
     {
-        return g_hash_table_lookup(pending->serial->map, &serial) != NULL;
+        return _LSTransportSerialContains(pending->serial, serial);
     }
     else
     {    
@@ -600,7 +591,7 @@ _LSTransportHandleShutdown(_LSTransportMessage *message)
 
         OUTGOING_LOCK(&client->outgoing->lock);
 
-        LS_ASSERT(g_hash_table_lookup(client->transport->pending, client->service_name) == NULL);
+        LS_ASSERT(g_hash_table_lookup(client->bus->pending, client->service_name) == NULL);
 
         /*
             A message can be:
@@ -614,6 +605,17 @@ _LSTransportHandleShutdown(_LSTransportMessage *message)
         _LSTransportMessage *outgoing_message = NULL;
         LSMessageToken serial_message_token = 0;
 
+        /* The outgoing queue is in priority order, so put what's on it back
+         * in token (i.e., queueing) order to merge it with the serial queue */
+        GQueue *queued = g_queue_new();
+
+        while ((outgoing_message = _LSTransportOutgoingPop(client->outgoing)) != NULL)
+        {
+            g_queue_push_tail(queued, outgoing_message);
+        }
+
+        g_queue_sort(queued, _LSTransportMessageCompareToken, NULL);
+
         while ((serial_message = _LSTransportSerialPopHead(client->outgoing->serial)) != NULL)
         {
             LS_ASSERT(_LSTransportMessageTypeMethodCall == _LSTransportMessageGetType(serial_message));
@@ -621,15 +623,15 @@ _LSTransportHandleShutdown(_LSTransportMessage *message)
             LSMessageToken outgoing_message_token;
 
             /*
-                Process all tokens in outgoing->queue that are less than or equal to the token of the message from
-                outgoing->serial. This assumes that lower token numbers come first in outgoing->queue.
+                Process all tokens in queued that are less than or equal to the token of the message from
+                outgoing->serial. This assumes that lower token numbers come first in queued.
             */
             while (
-                   (outgoing_message = g_queue_peek_head(client->outgoing->queue)) != NULL &&
+                   (outgoing_message = g_queue_peek_head(queued)) != NULL &&
                    (outgoing_message_token = _LSTransportMessageGetToken(outgoing_message)) <= serial_message_token
             )
             {
-                outgoing_message = g_queue_pop_head(client->outgoing->queue);
+                outgoing_message = g_queue_pop_head(queued);
 
                 if (outgoing_message_token < serial_message_token)
                 {
@@ -649,13 +651,15 @@ _LSTransportHandleShutdown(_LSTransportMessage *message)
         }
 
         // Move the remaining contents (if any) of the outgoing queue to the new pending queue
-        while ((outgoing_message = g_queue_pop_head(client->outgoing->queue)) != NULL)
+        while ((outgoing_message = g_queue_pop_head(queued)) != NULL)
         {
             LS_ASSERT(_LSTransportMessageTypeMethodCall != _LSTransportMessageGetType(outgoing_message));
             LS_ASSERT(_LSTransportMessageGetToken(outgoing_message) > serial_message_token);
             g_queue_push_tail(new_pending, outgoing_message);
         }
 
+        g_queue_free(queued);
+
         OUTGOING_UNLOCK(&client->outgoing->lock);
 
         TRANSPORT_UNLOCK(&client->transport->lock);
@@ -676,7 +680,7 @@ _LSTransportHandleShutdown(_LSTransportMessage *message)
 #if 0
         // FIXME - take this expensive operation out after testing    
         OUTGOING_LOCK(&client->outgoing->serial->lock);
-        LS_ASSERT(g_queue_get_length(client->outgoing->serial->queue) == 0);
+        LS_ASSERT(client->outgoing->serial->len == 0);
         OUTGOING_UNLOCK(&client->outgoing->serial->lock);
 
         // FIXME - take this expensive operation out after testing    
@@ -686,7 +690,7 @@ _LSTransportHandleShutdown(_LSTransportMessage *message)
 #endif
 
         // There should still be no pending messages after calling _LSTransportClientShutdown
-        LS_ASSERT(g_hash_table_lookup(client->transport->pending, client->service_name) == NULL);
+        LS_ASSERT(g_hash_table_lookup(client->bus->pending, client->service_name) == NULL);
 
         guint pending_length = g_queue_get_length(new_pending);
         if (pending_length)
@@ -708,7 +712,7 @@ _LSTransportHandleShutdown(_LSTransportMessage *message)
                 {
                     _LSTransportMessageReset(message);
                     /* ref's the message */
-                    if (!_LSTransportAddPendingMessageWithToken(client->transport, client->service_name, message, _LSTransportMessageGetToken(message), &lserror))
+                    if (!_LSTransportAddPendingMessageWithToken(client->bus, client->service_name, message, _LSTransportMessageGetToken(message), &lserror))
                     {
                         LSErrorPrint(&lserror, stderr);
                         LSErrorFree(&lserror);
@@ -809,11 +813,26 @@ _LSTransportAddSendWatch(_LSTransportChannel *channel, GMainContext *context, _L
     LS_ASSERT(channel != NULL);
     LS_ASSERT(context != NULL);
 
-    if (!channel->send_watch)
+    if (!_LSTransportChannelHasSendWatch(channel))
     {
+        if (channel->context) context = channel->context;
+
         _ls_verbose("%s: channel: %p, context: %p, client: %p\n", __func__, channel, context, client);
         
         _LSTransportClientRef(client);
+
+#ifdef LS_TRANSPORT_EPOLL
+        if (channel->transport->epoll)
+        {
+            channel->send_epoll = true;
+            if (!_LSTransportEpollAddWatch(channel->transport->epoll, channel, G_IO_OUT, _LSTransportSendClient, client, (GDestroyNotify) _LSTransportClientUnref))
+            {
+                _LSTransportClientUnref(client);
+            }
+            return;
+        }
+#endif
+
         _LSTransportAddWatch(channel, G_IO_OUT, context, _LSTransportSendClient, client, (GDestroyNotify) _LSTransportClientUnref, &channel->send_watch);
     }
 }
@@ -829,10 +848,23 @@ void
 _LSTransportRemoveSendWatch(_LSTransportChannel *channel)
 {
     LS_ASSERT(channel != NULL);
-    LS_ASSERT(channel->send_watch != NULL);
+    LS_ASSERT(_LSTransportChannelHasSendWatch(channel));
     
     _ls_verbose("%s: channel: %p\n", __func__, channel);
 
+#ifdef LS_TRANSPORT_EPOLL
+    if (channel->send_epoll)
+    {
+        channel->send_epoll = false;
+        if (channel->transport->epoll)
+        {
+            /* client is unref'd by destroy callback */
+            _LSTransportEpollRemoveWatch(channel->transport->epoll, channel, G_IO_OUT);
+        }
+        return;
+    }
+#endif
+
     if (channel->send_watch)
     {
         _LSTransportRemoveWatch(channel, &channel->send_watch);
@@ -855,11 +887,26 @@ _LSTransportAddReceiveWatch(_LSTransportChannel *channel, GMainContext *context,
     LS_ASSERT(channel != NULL);
     LS_ASSERT(context != NULL);
 
-    if (!channel->recv_watch)
+    if (!_LSTransportChannelHasReceiveWatch(channel))
     {
+        if (channel->context) context = channel->context;
+
         _ls_verbose("%s: channel: %p, context: %p, client: %p\n", __func__, channel, context, client);
        
         _LSTransportClientRef(client); 
+
+#ifdef LS_TRANSPORT_EPOLL
+        if (channel->transport->epoll)
+        {
+            channel->recv_epoll = true;
+            if (!_LSTransportEpollAddWatch(channel->transport->epoll, channel, G_IO_IN | G_IO_ERR | G_IO_HUP, _LSTransportReceiveClient, client, (GDestroyNotify) _LSTransportClientUnref))
+            {
+                _LSTransportClientUnref(client);
+            }
+            return;
+        }
+#endif
+
         _LSTransportAddWatch(channel, G_IO_IN | G_IO_ERR | G_IO_HUP, context, _LSTransportReceiveClient, client, (GDestroyNotify) _LSTransportClientUnref, &channel->recv_watch);
     }
 }
@@ -875,10 +922,23 @@ void
 _LSTransportRemoveReceiveWatch(_LSTransportChannel *channel)
 {
     LS_ASSERT(channel != NULL);
-    LS_ASSERT(channel->recv_watch != NULL);
+    LS_ASSERT(_LSTransportChannelHasReceiveWatch(channel));
     
     _ls_verbose("%s: channel: %p\n", __func__, channel);
 
+#ifdef LS_TRANSPORT_EPOLL
+    if (channel->recv_epoll)
+    {
+        channel->recv_epoll = false;
+        if (channel->transport->epoll)
+        {
+            /* client is unref'd by destroy callback */
+            _LSTransportEpollRemoveWatch(channel->transport->epoll, channel, G_IO_IN);
+        }
+        return;
+    }
+#endif
+
     if (channel->recv_watch)
     {
         _LSTransportRemoveWatch(channel, &channel->recv_watch);
@@ -958,20 +1018,28 @@ _LSTransportAddClientWatches(void *ignored, _LSTransportClient *client, GMainCon
 void
 _LSTransportAddInitialWatches(_LSTransport *transport, GMainContext *context)
 {
-    /* set up send/receive watches on all clients and hub so we can
-     * kickstart sending of messages */
-    TRANSPORT_LOCK(&transport->lock);
-    g_hash_table_foreach(transport->clients, (GHFunc)_LSTransportAddClientWatches, context);
-    TRANSPORT_UNLOCK(&transport->lock);
+    int i;
 
-    /* kickstart the monitor */
-    if (transport->monitor)
+    for (i = 0; i < transport->num_buses; i++)
     {
-        _LSTransportAddClientWatches(NULL, transport->monitor, context);
+        _LSTransportBus *bus = transport->buses[i];
+
+        /* set up send/receive watches on all clients and hub so we can
+         * kickstart sending of messages */
+        TRANSPORT_LOCK(&transport->lock);
+        g_hash_table_foreach(bus->clients, (GHFunc)_LSTransportAddClientWatches, context);
+        TRANSPORT_UNLOCK(&transport->lock);
+
+        /* kickstart the monitor */
+        if (bus->monitor)
+        {
+            _LSTransportAddClientWatches(NULL, bus->monitor, context);
+        }
+       
+        /* Watch and accept incoming connections; which listen channel a
+         * connection arrives on decides the bus it belongs to */ 
+        _LSTransportAddAcceptWatch(&bus->listen_channel, context, bus);
     }
-   
-    /* Watch and accept incoming connections */ 
-    _LSTransportAddAcceptWatch(&transport->listen_channel, context, transport);
 }
 
 /** 
@@ -992,6 +1060,46 @@ _LSTransportGmainAttach(_LSTransport *transport, GMainContext *context)
 
     transport->mainloop_context = g_main_context_ref(context);
 
+    if (!transport->trim_source)
+    {
+        transport->trim_source = g_timeout_source_new_seconds(LS_TRANSPORT_TRIM_INTERVAL_SEC);
+        g_source_set_callback(transport->trim_source, _LSTransportTrimIdleConnections, transport, NULL);
+        g_source_attach(transport->trim_source, transport->mainloop_context);
+    }
+
+    if (transport->shard_count > 0 && !transport->shards)
+    {
+        LSError lserror;
+        LSErrorInit(&lserror);
+
+        transport->shards = _LSTransportShardsNew(transport->shard_count, &lserror);
+
+        if (!transport->shards)
+        {
+            /* fall back to doing all I/O on the main context */
+            LSErrorPrint(&lserror, stderr);
+            LSErrorFree(&lserror);
+        }
+    }
+
+#ifdef LS_TRANSPORT_EPOLL
+    /* the epoll dispatcher only serves the main context */
+    if (transport->epoll_dispatch && !transport->epoll && !transport->shards)
+    {
+        LSError lserror;
+        LSErrorInit(&lserror);
+
+        transport->epoll = _LSTransportEpollNew(transport->mainloop_context, transport->source_priority, &lserror);
+
+        if (!transport->epoll)
+        {
+            /* fall back to a GSource per watch */
+            LSErrorPrint(&lserror, stderr);
+            LSErrorFree(&lserror);
+        }
+    }
+#endif
+
     _LSTransportAddInitialWatches(transport, transport->mainloop_context);
 }
 
@@ -1053,8 +1161,19 @@ _LSTransportGmainSetPriority(_LSTransport *transport, int priority, LSError *lse
     g_hash_table_foreach(transport->all_connections, (GHFunc)_LSTransportClientSetPriority, GINT_TO_POINTER(priority));
     TRANSPORT_UNLOCK(&transport->lock);
 
-    /* set the priority for our accept watch */
-    _LSTransportChannelSetPriority(&transport->listen_channel, priority);
+    /* set the priority for our accept watches */
+    int i;
+    for (i = 0; i < transport->num_buses; i++)
+    {
+        _LSTransportChannelSetPriority(&transport->buses[i]->listen_channel, priority);
+    }
+
+#ifdef LS_TRANSPORT_EPOLL
+    if (transport->epoll)
+    {
+        _LSTransportEpollSetPriority(transport->epoll, priority);
+    }
+#endif
 
     /* keep track of priority for future source creation */
     transport->source_priority = priority;
@@ -1111,13 +1230,14 @@ error:
 }
 
 bool
-_LSTransportSetupListenerLocalRaw(_LSTransport *transport, const char *name, int listen_fd, mode_t mode, LSError* lserror)
+_LSTransportSetupListenerLocalRaw(_LSTransportBus *bus, const char *name, int listen_fd, mode_t mode, LSError* lserror)
 {
     bool ret = true;
+    _LSTransport *transport = bus->transport;
 
     _ls_verbose("%s: transport: %p, name: %s\n", __func__, transport, name);
 
-    transport->type = _LSTransportTypeLocal;
+    bus->type = _LSTransportTypeLocal;
 
     /* -1 means that we don't have a valid fd already set up */
     if (listen_fd == -1)
@@ -1128,7 +1248,7 @@ _LSTransportSetupListenerLocalRaw(_LSTransport *transport, const char *name, int
     /* create the channel */
     if (ret)
     {
-        _LSTransportChannelInit(transport, &transport->listen_channel, listen_fd, transport->source_priority);
+        _LSTransportChannelInit(transport, &bus->listen_channel, listen_fd, transport->source_priority);
     }
    
     /* we'll add the accept watch when we get a gmain context to attach it to */ 
@@ -1137,10 +1257,10 @@ _LSTransportSetupListenerLocalRaw(_LSTransport *transport, const char *name, int
 }
 
 static bool
-_LSTransportSetupListenerLocalWithFd(_LSTransport *transport, const char *name, int listen_fd, LSError *lserror)
+_LSTransportSetupListenerLocalWithFd(_LSTransportBus *bus, const char *name, int listen_fd, LSError *lserror)
 {
     LS_ASSERT(listen_fd != -1);
-    return _LSTransportSetupListenerLocalRaw(transport, name, listen_fd, 0, lserror);
+    return _LSTransportSetupListenerLocalRaw(bus, name, listen_fd, 0, lserror);
 
 #if 0
     _ls_verbose("%s: transport: %p, name: %s\n", __func__, transport, name);
@@ -1159,7 +1279,7 @@ _LSTransportSetupListenerLocalWithFd(_LSTransport *transport, const char *name,
  *******************************************************************************
  * @brief Set up the listen channel for the unix domain socket @ref name.
  * 
- * @param  transport    IN  transport 
+ * @param  bus          IN  bus to accept connections for 
  * @param  name         IN  full path to unix domain socket 
  * @param  listen_fd    IN  fd that is already bound to @name and set up to listen
  * @mode   mode         IN  permissions for 
@@ -1170,9 +1290,9 @@ _LSTransportSetupListenerLocalWithFd(_LSTransport *transport, const char *name,
  *******************************************************************************
  */
 bool
-_LSTransportSetupListenerLocal(_LSTransport *transport, const char *name, mode_t mode, LSError *lserror)
+_LSTransportSetupListenerLocal(_LSTransportBus *bus, const char *name, mode_t mode, LSError *lserror)
 {
-    return _LSTransportSetupListenerLocalRaw(transport, name, -1, mode, lserror);
+    return _LSTransportSetupListenerLocalRaw(bus, name, -1, mode, lserror);
 
 #if 0
     //char err_buf[256];
@@ -1236,7 +1356,7 @@ error:
  *******************************************************************************
  * @brief Set up the listen channel on an inet address.
  * 
- * @param  transport    IN  transport 
+ * @param  bus          IN  bus to accept connections for 
  * @param  port         IN  port to listen on (negative means any)
  * @param  lserror      OUT set on error 
  * 
@@ -1245,13 +1365,14 @@ error:
  *******************************************************************************
  */
 bool
-_LSTransportSetupListenerInet(_LSTransport *transport, int port, LSError *lserror)
+_LSTransportSetupListenerInet(_LSTransportBus *bus, int port, LSError *lserror)
 {
     struct sockaddr_in addr;
+    _LSTransport *transport = bus->transport;
 
     _ls_verbose("%s: transport: %p, port: %d\n", __func__, transport, port);
 
-    transport->type = _LSTransportTypeInet;
+    bus->type = _LSTransportTypeInet;
 
     int fd = socket(AF_INET, SOCK_STREAM, 0);
 
@@ -1285,7 +1406,7 @@ _LSTransportSetupListenerInet(_LSTransport *transport, int port, LSError *lserro
     }
 
     /* create the channel */
-    _LSTransportChannelInit(transport, &transport->listen_channel, fd, transport->source_priority);
+    _LSTransportChannelInit(transport, &bus->listen_channel, fd, transport->source_priority);
    
     /* we'll add the accept watch when we get a gmain context to attach it to */ 
     
@@ -1308,7 +1429,7 @@ error:
  *
  * @attention should be called with transport lock
  * 
- * @param  transport    IN  transport 
+ * @param  bus          IN  bus the client is on
  * @param  client       IN  client to add (value)
  * @param  client_name  IN  client service name (key) 
  * 
@@ -1317,7 +1438,7 @@ error:
  *******************************************************************************
  */
 bool
-_LSTransportAddClientHash(_LSTransport *transport, _LSTransportClient *client, const char *client_name)
+_LSTransportAddClientHash(_LSTransportBus *bus, _LSTransportClient *client, const char *client_name)
 {
     _ls_verbose("%s: inserting client: %s (%p)\n", __func__, client_name, client);
 
@@ -1330,7 +1451,9 @@ _LSTransportAddClientHash(_LSTransport *transport, _LSTransportClient *client, c
     _LSTransportClientRef(client);
     
     /* TODO: insert or replace ? */
-    g_hash_table_insert(transport->clients, (gpointer)name, client);
+    g_hash_table_insert(bus->clients, (gpointer)name, client);
+
+    _LSTransportPublishClientsLocked(bus);
     
     return true;
 }
@@ -1365,22 +1488,130 @@ _LSTransportClientHashRemoveFunc(gpointer key, gpointer value, gpointer user_dat
  *******************************************************************************
  * @brief Remove the specified client from the client hash.
  * 
- * @param  transport    IN  transport 
+ * @param  bus          IN  bus the client is on
  * @param  client       IN  client to remove 
  *******************************************************************************
  */
 void
-_LSTransportRemoveClientHash(_LSTransport *transport, _LSTransportClient *client)
+_LSTransportRemoveClientHash(_LSTransportBus *bus, _LSTransportClient *client)
 {
-    _ls_verbose("%s: transport: %p, client: %p\n", __func__, transport, client);
+    _ls_verbose("%s: bus: %p, client: %p\n", __func__, bus, client);
     
     /*
      * TODO: this is a linear search; it's only done on shutdown, but we should
      * still probably change it.
      */
-    int ret = g_hash_table_foreach_remove(transport->clients, _LSTransportClientHashRemoveFunc, client);
+    int ret = g_hash_table_foreach_remove(bus->clients, _LSTransportClientHashRemoveFunc, client);
 
     LS_ASSERT(ret == 1 || ret == 0);
+
+    if (ret == 1)
+    {
+        _LSTransportPublishClientsLocked(bus);
+    }
+
+    /* the next connection may find a restarted service somewhere else */
+    if (ret == 1 && client->service_name)
+    {
+        _LSTransportQueryNameCacheInvalidateLocked(bus, client->service_name);
+    }
+}
+
+/** 
+ *******************************************************************************
+ * @brief Free the snapshots of the client hash that have been replaced, if
+ * no lock-free lookup can still be using them.
+ *
+ * @attention must be called with transport lock
+ * 
+ * @param  bus          IN  bus 
+ *******************************************************************************
+ */
+static void
+_LSTransportReclaimClientsLocked(_LSTransportBus *bus)
+{
+    /* A lookup that starts after this check loads the current snapshot,
+     * which is never on the retired list */
+    if (bus->clients_retired && g_atomic_int_get(&bus->clients_readers) == 0)
+    {
+        g_slist_foreach(bus->clients_retired, (GFunc)g_hash_table_unref, NULL);
+        g_slist_free(bus->clients_retired);
+        bus->clients_retired = NULL;
+    }
+}
+
+/** 
+ *******************************************************************************
+ * @brief Replace the read-only snapshot of the client hash after the hash
+ * has changed (RCU-style). The snapshot that's replaced is retired until
+ * no lookup can be using it.
+ *
+ * @attention must be called with transport lock
+ * 
+ * @param  bus          IN  bus 
+ *******************************************************************************
+ */
+static void
+_LSTransportPublishClientsLocked(_LSTransportBus *bus)
+{
+    GHashTableIter iter;
+    gpointer key = NULL;
+    gpointer value = NULL;
+
+    GHashTable *snapshot = g_hash_table_new_full(g_str_hash, g_str_equal,
+        (GDestroyNotify)g_free, (GDestroyNotify)_LSTransportClientUnref);
+
+    g_hash_table_iter_init(&iter, bus->clients);
+    while (g_hash_table_iter_next(&iter, &key, &value))
+    {
+        _LSTransportClientRef(value);
+        g_hash_table_insert(snapshot, g_strdup(key), value);
+    }
+
+    GHashTable *old = g_atomic_pointer_get(&bus->clients_snapshot);
+    g_atomic_pointer_set(&bus->clients_snapshot, snapshot);
+
+    if (old)
+    {
+        bus->clients_retired = g_slist_prepend(bus->clients_retired, old);
+    }
+
+    _LSTransportReclaimClientsLocked(bus);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Look up a connected client by service name without taking the
+ * transport lock, so that threads sending at the same time don't serialize
+ * on it.
+ * 
+ * @param  bus              IN  bus 
+ * @param  service_name     IN  service name 
+ * 
+ * @retval  client with an added ref (unref when done) if connected
+ * @retval  NULL otherwise
+ *******************************************************************************
+ */
+static _LSTransportClient*
+_LSTransportLookupClientRef(_LSTransportBus *bus, const char *service_name)
+{
+    _LSTransportClient *client = NULL;
+
+    g_atomic_int_inc(&bus->clients_readers);
+
+    GHashTable *snapshot = g_atomic_pointer_get(&bus->clients_snapshot);
+
+    if (snapshot)
+    {
+        client = g_hash_table_lookup(snapshot, service_name);
+
+        /* the snapshot holds a ref, so this can't be the last one */
+        if (client) _LSTransportClientRef(client);
+    }
+
+    (void)g_atomic_int_dec_and_test(&bus->clients_readers);
+
+    return client;
 }
 
 /** 
@@ -1429,11 +1660,11 @@ _LSTransportRemoveAllConnectionHash(_LSTransport *transport, _LSTransportClient
     _ls_verbose("%s: removing client: %p\n", __func__, client);
 
     /* Monitor connection is going down */
-    if (client == transport->monitor)
+    if (client == client->bus->monitor)
     {
         /* we had a ref associated with this */
         _LSTransportClientUnref(client);
-        transport->monitor = NULL;
+        client->bus->monitor = NULL;
     }
 
     /* destroy function will unref client */
@@ -1660,7 +1891,7 @@ _LSTransportConnectInet(const char *unique_name, int *fd, LSError *lserror)
  * specified, then use it as the outbound queue of messages. Otherwise,
  * create a new one.
  * 
- * @param  transport 
+ * @param  bus                  IN      bus to connect on
  * @param  service_name 
  * @param  unique_name
  * @param  connected_fd         IN      use the already connected fd (local only) 
@@ -1672,11 +1903,11 @@ _LSTransportConnectInet(const char *unique_name, int *fd, LSError *lserror)
  *******************************************************************************
  */
 _LSTransportClient*
-_LSTransportConnectClient(_LSTransport *transport, const char *service_name, const char *unique_name, int connected_fd, _LSTransportOutgoing *outgoing, LSError *lserror)
+_LSTransportConnectClient(_LSTransportBus *bus, const char *service_name, const char *unique_name, int connected_fd, _LSTransportOutgoing *outgoing, LSError *lserror)
 {
     int fd = -1;
 
-    if (transport->type == _LSTransportTypeLocal)
+    if (bus->type == _LSTransportTypeLocal)
     {
         if (connected_fd != -1)
         {
@@ -1699,7 +1930,7 @@ _LSTransportConnectClient(_LSTransport *transport, const char *service_name, con
         }
     }
 
-    _LSTransportClient *client = _LSTransportClientNewRef(transport, fd, service_name, unique_name, outgoing, true);
+    _LSTransportClient *client = _LSTransportClientNewRef(bus, fd, service_name, unique_name, outgoing, true);
 
     if (!client)
     {
@@ -1944,6 +2175,58 @@ _LSTransportRecvComplete(int fd, void *buf, int len, LSError *lserror)
     return total_bytes_recvd;
 }
 
+/** 
+ *******************************************************************************
+ * @brief Only honor the flags in a received message's header if the peer
+ * negotiated them (@ref LS_TRANSPORT_CAP_HEADER_FLAGS).
+ *
+ * The peer's capabilities are taken from its "ClientInfo" or "Capabilities"
+ * message as soon as that's received, instead of when it's processed, so
+ * that the flags on messages right behind it in the same read are honored.
+ * 
+ * @param  client   IN      client the message came from
+ * @param  message  IN/OUT  complete received message
+ *******************************************************************************
+ */
+static void
+_LSTransportIncomingCheckHeaderFlags(_LSTransportClient *client, _LSTransportMessage *message)
+{
+    _LSTransportHeader *header = _LSTransportMessageGetHeader(message);
+    _LSTransportMessageIter iter;
+    int32_t caps = 0;
+
+    switch (LS_TRANSPORT_HEADER_GET_TYPE(header))
+    {
+    case _LSTransportMessageTypeClientInfo:
+        /* service name, unique name, then the optional capabilities (see
+         * _LSTransportHandleClientInfo()) */
+        _LSTransportMessageIterInit(message, &iter);
+        _LSTransportMessageIterNext(&iter);
+        _LSTransportMessageIterNext(&iter);
+        if (_LSTransportMessageGetInt32(&iter, &caps))
+        {
+            client->peer_caps = caps & LS_TRANSPORT_CAPS;
+        }
+        break;
+
+    case _LSTransportMessageTypeCapabilities:
+        _LSTransportMessageIterInit(message, &iter);
+        if (_LSTransportMessageGetInt32(&iter, &caps))
+        {
+            client->peer_caps = caps & LS_TRANSPORT_CAPS;
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    if (!(client->peer_caps & LS_TRANSPORT_CAP_HEADER_FLAGS))
+    {
+        header->type &= LS_TRANSPORT_HEADER_TYPE_MASK;
+    }
+}
+
 /** 
  *******************************************************************************
  * @brief  Block until we receive the complete message of the specified type.
@@ -2003,7 +2286,7 @@ _LSTransportRecvMessageBlocking(_LSTransportClient *client, _LSTransportMessageT
     bool msg_type_match = false;
     for (i = 0; i < num_types; i++)
     {
-        if (header.type == types[i])
+        if (LS_TRANSPORT_HEADER_GET_TYPE(&header) == types[i])
         {
             msg_type_match = true;
             break;
@@ -2051,6 +2334,18 @@ _LSTransportRecvMessageBlocking(_LSTransportClient *client, _LSTransportMessageT
         _LSTransportMessageSetConnectionFd(message, recv_fd);
     }
 
+    _LSTransportIncomingCheckHeaderFlags(client, message);
+
+    if ((_LSTransportMessageGetHeader(message)->type & LS_TRANSPORT_HEADER_FLAG_COMPRESSED)
+        && !_LSTransportMessageDecompress(message, lserror))
+    {
+        _LSTransportMessageUnref(message);
+        message = NULL;
+        goto exit;
+    }
+
+    _LSTransportMessageIndexFields(message);
+
 exit:
     _LSTransportChannelRestoreBlockState(_LSTransportClientGetChannel(client), &old_block_state);
 
@@ -2066,29 +2361,32 @@ exit:
 
 /** 
  *******************************************************************************
- * @brief Send a message and block until it has been completely sent. The
- * message ref count does not change when calling this function.
+ * @brief Send several messages back to back with a single write and block
+ * until they have all been sent. Each message gets its own token. The
+ * message ref counts do not change when calling this function.
  *
  * If there is a send watch for the client, this function will remove and restore
  * it so that the two do not conflict if running in different threads.
  * 
- * @param  message  IN  message to send 
- * @param  client   IN  client performing send
- * @param  token    OUT token of message 
- * @param  lserror  OUT set on error 
+ * @param  messages         IN  messages to send, in order
+ * @param  num_messages     IN  number of messages
+ * @param  client           IN  client performing send
+ * @param  lserror          OUT set on error 
  * 
  * @retval  true on success
  * @retval  false on failure
  *******************************************************************************
  */
-bool
-_LSTransportSendMessageBlocking(_LSTransportMessage *message, _LSTransportClient *client,
-                                LSMessageToken *token, LSError *lserror)
+static bool
+_LSTransportSendMessagesBlocking(_LSTransportMessage **messages, int num_messages,
+                                 _LSTransportClient *client, LSError *lserror)
 {
-    _ls_verbose("%s: client: %p, message type: %d\n", __func__, client, _LSTransportMessageGetType(message));
-
     bool ret = false;
     bool restore_watch = false;
+    char *buf = NULL;
+    char *buf_p = NULL;
+    int total_len = 0;
+    int i;
 
     /* If there is a send watch for this client, temporarily remove it so that
      * the two won't conflict if the mainloop is running in one thread and this
@@ -2106,12 +2404,36 @@ _LSTransportSendMessageBlocking(_LSTransportMessage *message, _LSTransportClient
     /* TODO: flush the outgoing queue before sending the requested message
      * so that we preserve ordering? */
 
-    /* LOCK -- this grabs global_token lock */
-    _LSTransportMessageSetToken(message, _LSTransportGetNextToken(client->transport));
+    for (i = 0; i < num_messages; i++)
+    {
+        _ls_verbose("%s: client: %p, message type: %d\n", __func__, client, _LSTransportMessageGetType(messages[i]));
+
+        LS_ASSERT(messages[i]->shared == NULL);
+
+        _LSTransportMessageSetToken(messages[i], _LSTransportGetNextToken(client->transport));
+        total_len += messages[i]->raw->header.len + sizeof(_LSTransportHeader);
+    }
+
+    if (num_messages == 1)
+    {
+        buf = (char*)messages[0]->raw;
+    }
+    else
+    {
+        /* these are small handshake messages, so a copy is cheaper than
+         * a write per message */
+        buf = g_malloc(total_len);
 
-    message->tx_bytes_remaining = message->raw->header.len + sizeof(_LSTransportHeader);
+        for (i = 0, buf_p = buf; i < num_messages; i++)
+        {
+            int len = messages[i]->raw->header.len + sizeof(_LSTransportHeader);
+
+            memcpy(buf_p, messages[i]->raw, len);
+            buf_p += len;
+        }
+    }
 
-    int send_ret = _LSTransportSendComplete(client->channel.fd, (char*)message->raw + message->raw->header.len + sizeof(_LSTransportHeader) - message->tx_bytes_remaining, message->tx_bytes_remaining, lserror);
+    int send_ret = _LSTransportSendComplete(client->channel.fd, buf, total_len, lserror);
 
     if (send_ret == -1)
     {
@@ -2119,12 +2441,11 @@ _LSTransportSendMessageBlocking(_LSTransportMessage *message, _LSTransportClient
         goto exit;
     }
 
-    LS_ASSERT(send_ret == message->tx_bytes_remaining);
-    message->tx_bytes_remaining = 0;
+    LS_ASSERT(send_ret == total_len);
 
-    if (token)
+    for (i = 0; i < num_messages; i++)
     {
-        *token = _LSTransportMessageGetToken(message); 
+        messages[i]->tx_bytes_remaining = 0;
     }
 
     /* TODO: MONITOR: send message to monitor as well */
@@ -2132,6 +2453,8 @@ _LSTransportSendMessageBlocking(_LSTransportMessage *message, _LSTransportClient
     ret = true;
 
 exit:
+    if (num_messages > 1) g_free(buf);
+
     _LSTransportChannelRestoreBlockState(_LSTransportClientGetChannel(client), &old_block_state);
 
     if (restore_watch)
@@ -2145,23 +2468,62 @@ exit:
 
 /** 
  *******************************************************************************
- * @brief Process a monitor message, which involves connecting to the monitor
- * and sending our client info to it.
+ * @brief Send a message and block until it has been completely sent. The
+ * message ref count does not change when calling this function.
  *
- * @attention locks transport lock
+ * If there is a send watch for the client, this function will remove and restore
+ * it so that the two do not conflict if running in different threads.
  * 
- * @param  message  IN  monitor message 
+ * @param  message  IN  message to send 
+ * @param  client   IN  client performing send
+ * @param  token    OUT token of message 
+ * @param  lserror  OUT set on error 
+ * 
+ * @retval  true on success
+ * @retval  false on failure
  *******************************************************************************
  */
-static void
-_LSTransportHandleMonitor(_LSTransportMessage *message)
+bool
+_LSTransportSendMessageBlocking(_LSTransportMessage *message, _LSTransportClient *client,
+                                LSMessageToken *token, LSError *lserror)
 {
-    LSError lserror;
+    if (!_LSTransportSendMessagesBlocking(&message, 1, client, lserror))
+    {
+        return false;
+    }
+
+    if (token)
+    {
+        *token = _LSTransportMessageGetToken(message); 
+    }
+
+    return true;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Process a monitor message, which involves connecting to the monitor
+ * and sending our client info to it.
+ *
+ * @attention locks transport lock
+ * 
+ * @param  message  IN  monitor message 
+ *******************************************************************************
+ */
+static void
+_LSTransportHandleMonitor(_LSTransportMessage *message)
+{
+    LSError lserror;
     LSErrorInit(&lserror);
     
     const char *unique_name = NULL;
 
     _LSTransport *transport = message->client->transport;
+    _LSTransportBus *bus = message->client->bus;
+
+    const char *filter_names = NULL;
+    int32_t filter_types = 0;
+    int32_t filter_sample_rate = 0;
 
     /* get the unique name out of the message */
     _LSTransportMessageIter iter;
@@ -2175,11 +2537,33 @@ _LSTransportHandleMonitor(_LSTransportMessage *message)
         return;
     }
 
+    /* optional filter; an older hub doesn't send it */
+    _LSTransportMessageIterNext(&iter);
+    if (_LSTransportMessageGetString(&iter, &filter_names))
+    {
+        _LSTransportMessageIterNext(&iter);
+        _LSTransportMessageGetInt32(&iter, &filter_types);
+        _LSTransportMessageIterNext(&iter);
+        _LSTransportMessageGetInt32(&iter, &filter_sample_rate);
+    }
+
     _ls_verbose("%s: connecting to monitor: %s\n", __func__, unique_name);
 
-    transport->monitor = _LSTransportConnectClient(transport, NULL, unique_name, dup(_LSTransportMessageGetConnectionFd(message)), NULL, &lserror);
+    /* set before the monitor so that senders never see the monitor without
+     * its filter */
+    _LSTransportMonitorFilter *new_filter = _LSTransportMonitorFilterNew(filter_names, filter_types, filter_sample_rate);
+
+    pthread_mutex_lock(&bus->monitor_filter_lock);
+    _LSTransportMonitorFilter *old_filter = bus->monitor_filter;
+    bus->monitor_filter = new_filter;
+    pthread_mutex_unlock(&bus->monitor_filter_lock);
+
+    /* no sender can be using it once we've had the lock */
+    _LSTransportMonitorFilterFree(old_filter);
+
+    bus->monitor = _LSTransportConnectClient(bus, NULL, unique_name, dup(_LSTransportMessageGetConnectionFd(message)), NULL, &lserror);
 
-    if (!transport->monitor)
+    if (!bus->monitor)
     {
         LSErrorPrint(&lserror, stderr);
         LSErrorFree(&lserror);
@@ -2187,7 +2571,7 @@ _LSTransportHandleMonitor(_LSTransportMessage *message)
     }
 
     /* MONITOR -- send client info so monitor knows who we are */
-    if (!_LSTransportSendMessageClientInfo(transport->monitor, transport->service_name, transport->unique_name, false, &lserror))
+    if (!_LSTransportSendMessageClientInfo(bus->monitor, transport->service_name, bus->unique_name, false, &lserror))
     {
         LSErrorPrint(&lserror, stderr);
         LSErrorFree(&lserror);
@@ -2196,13 +2580,13 @@ _LSTransportHandleMonitor(_LSTransportMessage *message)
     /* add to hash of all connected clients, but not named client hash */
     TRANSPORT_LOCK(&transport->lock);
     /* client ref +1 (total = 2) */
-    _LSTransportAddAllConnectionHash(transport, transport->monitor);
+    _LSTransportAddAllConnectionHash(transport, bus->monitor);
     TRANSPORT_UNLOCK(&transport->lock);
    
     if (transport->mainloop_context)
     { 
-        _LSTransportAddSendWatch(&transport->monitor->channel, transport->mainloop_context, transport->monitor);
-        _LSTransportAddReceiveWatch(&transport->monitor->channel, transport->mainloop_context, transport->monitor);
+        _LSTransportAddSendWatch(&bus->monitor->channel, transport->mainloop_context, bus->monitor);
+        _LSTransportAddReceiveWatch(&bus->monitor->channel, transport->mainloop_context, bus->monitor);
     }
 }
 
@@ -2220,13 +2604,31 @@ _LSTransportHandleUserMessageHandler(_LSTransportMessage *message)
 {
     _ls_verbose("%s: calling user's msg_handler\n", __func__);
     
-    LSError lserror;
-    LSErrorInit(&lserror);
-
     _LSTransportClient *client = _LSTransportMessageGetClient(message); 
-    void *msg_context = client->transport->msg_context;
+    void *msg_context = client->bus->msg_context;
+
+    LSMessageHandlerResult ret = (*client->bus->msg_handler)(message, msg_context);
 
-    LSMessageHandlerResult ret = (*client->transport->msg_handler)(message, msg_context);
+    _LSTransportHandleMessageResult(message, ret);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Act on the result of handling a message. If the message is of method
+ * call type and it wasn't handled, send an error message in reply.
+ *
+ * This is safe to call from a thread other than the one that received the
+ * message (e.g., a worker thread that handled the message).
+ * 
+ * @param  message  IN  message 
+ * @param  ret      IN  result of handling the message
+ *******************************************************************************
+ */
+void
+_LSTransportHandleMessageResult(const _LSTransportMessage *message, LSMessageHandlerResult ret)
+{
+    LSError lserror;
+    LSErrorInit(&lserror);
 
     /* 
      * We only care about whether the message was handled if the message type
@@ -2331,6 +2733,41 @@ _LSTransportReceiveMonitorStatus(_LSTransport *transport, _LSTransportClient *cl
     return true;
 }
 
+/** 
+ *******************************************************************************
+ * @brief Append what a restarted hub needs to resume our registration to a
+ * "RequestName" message: our previous unique name (empty if we don't have
+ * one) and the digest of our signal registrations, in hex since there are
+ * no 64-bit message arguments.
+ * 
+ * @param  iter             IN  iterator at the end of the message
+ * @param  resume_name      IN  previous unique name (or NULL)
+ * @param  resume_digest    IN  digest of our signal registrations
+ * 
+ * @retval  true on success
+ * @retval  false on failure
+ *******************************************************************************
+ */
+static bool
+_LSTransportRequestNameAppendResume(_LSTransportMessageIter *iter, const char *resume_name, guint64 resume_digest)
+{
+    char digest_str[17];
+
+    g_snprintf(digest_str, sizeof(digest_str), "%016" G_GINT64_MODIFIER "x", resume_digest);
+
+    return _LSTransportMessageAppendString(iter, resume_name ? resume_name : "") &&
+           _LSTransportMessageAppendString(iter, digest_str);
+}
+
+static void
+_LSTransportRequestNameGetResume(_LSTransportMessageIter *iter, int32_t *resumed)
+{
+    if (!_LSTransportMessageGetInt32(iter, resumed))
+    {
+        *resumed = LS_TRANSPORT_REQUEST_NAME_RESUME_NONE;
+    }
+}
+
 /** 
  *******************************************************************************
  * @brief Request a service name from the hub. NULL means we just need a unique
@@ -2340,8 +2777,18 @@ _LSTransportReceiveMonitorStatus(_LSTransport *transport, _LSTransportClient *cl
  * 
  * @param  requested_name   IN  service name or NULL for only unique name 
  * @param  client           IN  client
- * @param  fd               OUT fd passed from hub that we should listen on 
+ * @param  send_after       IN  message to pipeline right behind the request
+ *                              in the same write (or NULL)
+ * @param  resume_name      IN  unique name we had with a hub that went away
+ *                              (NULL when first connecting)
+ * @param  resume_digest    IN  digest of our signal registrations (see
+ *                              @ref _LSTransportSignalDigestAdd)
+ * @param  fd               OUT fd passed from hub that we should listen on
+ *                              (-1 if we got resume_name back and keep listening
+ *                              on our socket)
  * @param  privileged       OUT true if the service is privileged
+ * @param  resumed          OUT how much of our registration the hub restored
+ *                              (LS_TRANSPORT_REQUEST_NAME_RESUME_*)
  * @param  lserror          OUT set on error 
  * 
  * @retval  name that is allocated (and must be free'd) on success
@@ -2349,7 +2796,9 @@ _LSTransportReceiveMonitorStatus(_LSTransport *transport, _LSTransportClient *cl
  *******************************************************************************
  */
 char*
-_LSTransportRequestNameLocal(const char *requested_name, _LSTransportClient *client, int *fd, bool *privileged, LSError *lserror)
+_LSTransportRequestNameLocal(const char *requested_name, _LSTransportClient *client, _LSTransportMessage *send_after,
+                             const char *resume_name, guint64 resume_digest,
+                             int *fd, bool *privileged, int32_t *resumed, LSError *lserror)
 {
     _LSTransportMessageIter iter;
     const char *unique_name_tmp = NULL;
@@ -2366,9 +2815,12 @@ _LSTransportRequestNameLocal(const char *requested_name, _LSTransportClient *cli
     _LSTransportMessageIterInit(message, &iter);
     if (!_LSTransportMessageAppendInt32(&iter, LS_TRANSPORT_PROTOCOL_VERSION)) goto error;
     if (!_LSTransportMessageAppendString(&iter, requested_name)) goto error;
+    if (!_LSTransportRequestNameAppendResume(&iter, resume_name, resume_digest)) goto error;
     if (!_LSTransportMessageAppendInvalid(&iter)) goto error;
 
-    if (!_LSTransportSendMessageBlocking(message, client, NULL, lserror))
+    _LSTransportMessage *messages[2] = { message, send_after };
+
+    if (!_LSTransportSendMessagesBlocking(messages, send_after ? 2 : 1, client, lserror))
     {
         _LSTransportMessageUnref(message);
         return NULL;
@@ -2413,6 +2865,16 @@ _LSTransportRequestNameLocal(const char *requested_name, _LSTransportClient *cli
         {
             LS_ASSERT(0);
         }
+
+        _LSTransportMessageIterNext(&iter);
+        _LSTransportRequestNameGetResume(&iter, resumed);
+
+        if (*resumed != LS_TRANSPORT_REQUEST_NAME_RESUME_NONE)
+        {
+            /* we're still listening on the socket for our old name */
+            *fd = -1;
+            break;
+        }
     
         int message_fd = _LSTransportMessageGetConnectionFd(message);
         LS_ASSERT(message_fd != -1);
@@ -2461,7 +2923,14 @@ error:
  * 
  * @param  requested_name   IN  service name or NULL for only unique name 
  * @param  client           IN  client 
+ * @param  send_after       IN  message to pipeline right behind the request
+ *                              in the same write (or NULL)
+ * @param  resume_name      IN  unique name we had with a hub that went away
+ *                              (NULL when first connecting)
+ * @param  resume_digest    IN  digest of our signal registrations
  * @param  privileged       OUT true if the service is privileged
+ * @param  resumed          OUT how much of our registration the hub restored
+ *                              (LS_TRANSPORT_REQUEST_NAME_RESUME_*)
  * @param  lserror          OUT set on error 
  * 
  * @retval  name that is allocated (and must be free'd) on success
@@ -2469,7 +2938,9 @@ error:
  *******************************************************************************
  */
 char*
-_LSTransportRequestNameInet(const char *requested_name, _LSTransportClient *client, bool *privileged, LSError *lserror)
+_LSTransportRequestNameInet(const char *requested_name, _LSTransportClient *client, _LSTransportMessage *send_after,
+                            const char *resume_name, guint64 resume_digest,
+                            bool *privileged, int32_t *resumed, LSError *lserror)
 {
     const char *unique_name_tmp = NULL;
     char *unique_name = NULL;
@@ -2480,7 +2951,7 @@ _LSTransportRequestNameInet(const char *requested_name, _LSTransportClient *clie
     
     _ls_verbose("%s: requested_name: %s, client: %p\n", __func__, requested_name, client);
 
-    int listen_fd = _LSTransportChannelGetFd(&client->transport->listen_channel);
+    int listen_fd = _LSTransportChannelGetFd(&client->bus->listen_channel);
 
     /* send our listen port to the hub */
     struct sockaddr_in addr;
@@ -2506,9 +2977,12 @@ _LSTransportRequestNameInet(const char *requested_name, _LSTransportClient *clie
     if (!_LSTransportMessageAppendInt32(&iter, LS_TRANSPORT_PROTOCOL_VERSION)) goto error;
     if (!_LSTransportMessageAppendString(&iter, requested_name)) goto error;
     if (!_LSTransportMessageAppendInt32(&iter, port)) goto error;
+    if (!_LSTransportRequestNameAppendResume(&iter, resume_name, resume_digest)) goto error;
     if (!_LSTransportMessageAppendInvalid(&iter)) goto error;
      
-    if (!_LSTransportSendMessageBlocking(message, client, NULL, lserror)) goto exit;
+    _LSTransportMessage *messages[2] = { message, send_after };
+
+    if (!_LSTransportSendMessagesBlocking(messages, send_after ? 2 : 1, client, lserror)) goto exit;
 
     _LSTransportMessageUnref(message);
 
@@ -2546,6 +3020,9 @@ _LSTransportRequestNameInet(const char *requested_name, _LSTransportClient *clie
         {
             LS_ASSERT(0);
         }
+
+        _LSTransportMessageIterNext(&iter);
+        _LSTransportRequestNameGetResume(&iter, resumed);
         
         _ls_verbose("%s: received unique_name: %s, %sprivileged\n", __func__, unique_name, *privileged ? "" : "not ");
 
@@ -2584,15 +3061,21 @@ error:
 }
 
 char*
-_LSTransportRequestName(const char *requested_name, _LSTransportClient *client, int *fd, bool *privileged, LSError *lserror)
+_LSTransportRequestName(const char *requested_name, _LSTransportClient *client, _LSTransportMessage *send_after,
+                        const char *resume_name, guint64 resume_digest,
+                        int *fd, bool *privileged, int32_t *resumed, LSError *lserror)
 {
-    if (client->transport->type == _LSTransportTypeLocal)
+    *resumed = LS_TRANSPORT_REQUEST_NAME_RESUME_NONE;
+
+    if (client->bus->type == _LSTransportTypeLocal)
     {
-        return _LSTransportRequestNameLocal(requested_name, client, fd, privileged, lserror);
+        return _LSTransportRequestNameLocal(requested_name, client, send_after, resume_name, resume_digest,
+                                            fd, privileged, resumed, lserror);
     }
     else
     {
-        return _LSTransportRequestNameInet(requested_name, client, privileged, lserror);
+        return _LSTransportRequestNameInet(requested_name, client, send_after, resume_name, resume_digest,
+                                           privileged, resumed, lserror);
     }
 }
 
@@ -2772,6 +3255,53 @@ _LSTransportQueryNameReplyGetIsDynamic(_LSTransportMessage *message)
     return false;
 }
 
+/** 
+ *******************************************************************************
+ * @brief Check the monitor's filter before mirroring a message to it, so
+ * that filtered traffic doesn't cost a copy and a write.
+ * 
+ * @param  bus          IN  bus
+ * @param  type         IN  message type
+ * @param  token        IN  message token (reply token for replies)
+ * @param  client       IN  destination client
+ * 
+ * @retval  true if the monitor wants the message
+ * @retval  false otherwise
+ *******************************************************************************
+ */
+static inline bool
+_LSTransportMonitorWants(_LSTransportBus *bus, _LSTransportMessageType type, LSMessageToken token, _LSTransportClient *client)
+{
+    _LSTransport *transport = bus->transport;
+
+    bool ret = true;
+
+    /* the monitor thread can replace the filter at any time */
+    pthread_mutex_lock(&bus->monitor_filter_lock);
+
+    if (bus->monitor_filter)
+    {
+        ret = _LSTransportMonitorFilterMatchFields(bus->monitor_filter, type, token,
+                                                   transport->service_name, bus->unique_name,
+                                                   client->service_name, client->unique_name);
+    }
+
+    pthread_mutex_unlock(&bus->monitor_filter_lock);
+
+    return ret;
+}
+
+static inline bool
+_LSTransportMonitorWantsMessage(_LSTransportMessage *message, _LSTransportClient *client)
+{
+    _LSTransportMessageType type = _LSTransportMessageGetType(message);
+    LSMessageToken token = (type == _LSTransportMessageTypeReply) ?
+                           _LSTransportMessageGetReplyToken(message) :
+                           _LSTransportMessageGetToken(message);
+
+    return _LSTransportMonitorWants(client->bus, type, token, client);
+}
+
 /** 
  *******************************************************************************
  * @brief Helper callback to send a message to a monitor if it's a message
@@ -2784,7 +3314,7 @@ _LSTransportQueryNameReplyGetIsDynamic(_LSTransportMessage *message)
 static void
 _LSTransportSendMessageMonitorHelper(_LSTransportMessage *message, _LSTransportClient *client)
 {
-    if (_LSTransportMessageIsMonitorType(message))
+    if (_LSTransportMessageIsMonitorType(message) && _LSTransportMonitorWantsMessage(message, client))
     {
         _LSTransportSendMessageMonitor(message, client, NULL);
     }
@@ -2796,13 +3326,13 @@ _LSTransportSendMessageMonitorHelper(_LSTransportMessage *message, _LSTransportC
  * 
  * @attention locks the outgoing lock
  *
- * @param  transport    IN  transport
+ * @param  bus          IN  bus
  * @param  client       IN  client 
  * @param  pending      IN  outgoing queue 
  *******************************************************************************
  */
 static void
-_LSTransportSendPendingMonitorMessages(_LSTransport *transport, _LSTransportClient *client, _LSTransportOutgoing *pending)
+_LSTransportSendPendingMonitorMessages(_LSTransportBus *bus, _LSTransportClient *client, _LSTransportOutgoing *pending)
 {
     _ls_verbose("%s: client: %p, pending: %p\n", __func__, client, pending);
 
@@ -2811,9 +3341,229 @@ _LSTransportSendPendingMonitorMessages(_LSTransport *transport, _LSTransportClie
     OUTGOING_UNLOCK(&pending->lock);
 }
 
+/**
+ * Remembered result of a "QueryName" for a service and app id: permission
+ * denied, no such service, or the unique name of a service we were allowed
+ * to reach, which lets us connect to it ourselves next time instead of
+ * asking the hub.
+ */
+typedef struct LSTransportQueryNameCacheEntry {
+    int32_t ret_code;               /**< LS_TRANSPORT_QUERY_NAME_* result */
+    char *unique_name;              /**< unique name (successes only) */
+    bool is_dynamic;                /**< true if the service is dynamic */
+    gint64 expires_us;              /**< monotonic time after which the entry is ignored */
+} _LSTransportQueryNameCacheEntry;
+
+static void
+_LSTransportQueryNameCacheEntryFree(_LSTransportQueryNameCacheEntry *entry)
+{
+    g_free(entry->unique_name);
+
+#ifdef MEMCHECK
+    memset(entry, 0xFF, sizeof(_LSTransportQueryNameCacheEntry));
+#endif
+
+    g_slice_free(_LSTransportQueryNameCacheEntry, entry);
+}
+
+static inline char*
+_LSTransportQueryNameCacheKey(const char *service_name, const char *app_id)
+{
+    /* the hub keys its decisions on the sender too (exe path and service
+     * name), which is the same for everything this transport sends;
+     * '\n' can't appear in a service name */
+    return g_strconcat(service_name, "\n", app_id ? app_id : "", NULL);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Look up a remembered "QueryName" result.
+ *
+ * @attention caller must hold the transport lock
+ * 
+ * @param  bus              IN  bus
+ * @param  service_name     IN  service name 
+ * @param  app_id           IN  app id of the message (NULL if none)
+ * 
+ * @retval  entry if there is an unexpired result
+ * @retval  NULL otherwise
+ *******************************************************************************
+ */
+static _LSTransportQueryNameCacheEntry*
+_LSTransportQueryNameCacheLookup(_LSTransportBus *bus, const char *service_name, const char *app_id)
+{
+    if (g_hash_table_size(bus->query_name_cache) == 0)
+    {
+        return NULL;
+    }
+
+    char *key = _LSTransportQueryNameCacheKey(service_name, app_id);
+    _LSTransportQueryNameCacheEntry *entry = g_hash_table_lookup(bus->query_name_cache, key);
+
+    if (entry && entry->expires_us <= g_get_monotonic_time())
+    {
+        g_hash_table_remove(bus->query_name_cache, key);
+        entry = NULL;
+    }
+
+    g_free(key);
+    return entry;
+}
+
+static gboolean
+_LSTransportQueryNameCacheWatchCallback(gpointer data)
+{
+    _LSTransportBus *bus = data;
+    _LSTransport *transport = bus->transport;
+    LSMessageToken token;
+    LSError lserror;
+    LSErrorInit(&lserror);
+
+    TRANSPORT_LOCK(&transport->lock);
+    g_source_unref(bus->query_name_cache_watch_source);
+    bus->query_name_cache_watch_source = NULL;
+    TRANSPORT_UNLOCK(&transport->lock);
+
+    /* the hub applies policy changes as soon as it has reloaded, so drop
+     * everything we've remembered when it tells us it has (see
+     * _LSTransportReceiveClient) */
+    if (!bus->hub ||
+        !LSTransportRegisterSignal(bus, HUB_CONTROL_CATEGORY, HUB_CONF_SCAN_COMPLETE_METHOD, &token, &lserror))
+    {
+        if (LSErrorIsSet(&lserror))
+        {
+            LSErrorPrint(&lserror, stderr);
+            LSErrorFree(&lserror);
+        }
+
+        /* try again with the next result we remember */
+        TRANSPORT_LOCK(&transport->lock);
+        bus->query_name_cache_watched = false;
+        TRANSPORT_UNLOCK(&transport->lock);
+    }
+
+    return FALSE;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Make sure we hear about the hub reloading its config once there is
+ * something in the "QueryName" cache. Registering takes the transport lock,
+ * so it's done from an idle callback.
+ *
+ * @attention caller must hold the transport lock
+ * 
+ * @param  bus              IN  bus
+ *******************************************************************************
+ */
+static void
+_LSTransportQueryNameCacheWatchReload(_LSTransportBus *bus)
+{
+    _LSTransport *transport = bus->transport;
+
+    if (bus->query_name_cache_watched || !transport->mainloop_context)
+    {
+        return;
+    }
+
+    bus->query_name_cache_watched = true;
+
+    bus->query_name_cache_watch_source = g_idle_source_new();
+    g_source_set_callback(bus->query_name_cache_watch_source, _LSTransportQueryNameCacheWatchCallback, bus, NULL);
+    g_source_attach(bus->query_name_cache_watch_source, transport->mainloop_context);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Remember a "QueryName" result.
+ *
+ * @attention caller must hold the transport lock
+ * 
+ * @param  bus              IN  bus
+ * @param  service_name     IN  service name 
+ * @param  app_id           IN  app id of the message that triggered the query (NULL if none)
+ * @param  ret_code         IN  LS_TRANSPORT_QUERY_NAME_* result 
+ * @param  unique_name      IN  unique name on success 
+ * @param  is_dynamic       IN  true if the service is dynamic 
+ *******************************************************************************
+ */
+static void
+_LSTransportQueryNameCacheSave(_LSTransportBus *bus, const char *service_name, const char *app_id,
+                               int32_t ret_code, const char *unique_name, bool is_dynamic)
+{
+    if (g_hash_table_size(bus->query_name_cache) >= LS_TRANSPORT_QUERY_NAME_CACHE_MAX)
+    {
+        /* simplest possible bound; the entries are cheap to re-learn */
+        g_hash_table_remove_all(bus->query_name_cache);
+    }
+
+    _LSTransportQueryNameCacheEntry *entry = g_slice_new0(_LSTransportQueryNameCacheEntry);
+
+    entry->ret_code = ret_code;
+    entry->unique_name = g_strdup(unique_name);
+    entry->is_dynamic = is_dynamic;
+    entry->expires_us = g_get_monotonic_time() +
+                        (ret_code == LS_TRANSPORT_QUERY_NAME_SERVICE_NOT_EXIST
+                         ? LS_TRANSPORT_QUERY_NAME_NOT_EXIST_TTL_US : LS_TRANSPORT_QUERY_NAME_CACHE_TTL_US);
+
+    g_hash_table_replace(bus->query_name_cache, _LSTransportQueryNameCacheKey(service_name, app_id), entry);
+
+    _LSTransportQueryNameCacheWatchReload(bus);
+}
+
+static gboolean
+_LSTransportQueryNameCacheKeyIsService(gpointer key, gpointer value, gpointer service_prefix)
+{
+    return g_str_has_prefix(key, service_prefix);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Forget every remembered "QueryName" result for a service.
+ *
+ * @attention caller must hold the transport lock
+ * 
+ * @param  bus              IN  bus
+ * @param  service_name     IN  service name 
+ *******************************************************************************
+ */
+static void
+_LSTransportQueryNameCacheInvalidateLocked(_LSTransportBus *bus, const char *service_name)
+{
+    if (g_hash_table_size(bus->query_name_cache) > 0)
+    {
+        char *prefix = _LSTransportQueryNameCacheKey(service_name, NULL);
+        g_hash_table_foreach_remove(bus->query_name_cache, _LSTransportQueryNameCacheKeyIsService, prefix);
+        g_free(prefix);
+    }
+}
+
+/** 
+ *******************************************************************************
+ * @brief Forget every remembered "QueryName" result for a service.
+ *
+ * @attention locks the transport lock
+ * 
+ * @param  bus              IN  bus
+ * @param  service_name     IN  service name 
+ *******************************************************************************
+ */
+static void
+_LSTransportQueryNameCacheInvalidate(_LSTransportBus *bus, const char *service_name)
+{
+    _LSTransport *transport = bus->transport;
+
+    TRANSPORT_LOCK(&transport->lock);
+    _LSTransportQueryNameCacheInvalidateLocked(bus, service_name);
+    TRANSPORT_UNLOCK(&transport->lock);
+}
+
 /** 
  *******************************************************************************
- * @brief Handle a failure reply to a "QueryName" message.
+ * @brief Handle a failure reply to a "QueryName" message. The query is for
+ * the message at the head of the pending queue; the messages behind it are
+ * failed along with it if the service doesn't exist or it ran out of
+ * retries, and otherwise get their own query.
  *
  * @attention locks both the transport and outgoing lock
  * 
@@ -2839,10 +3589,11 @@ _LSTransportHandleQueryNameFailure(_LSTransportMessage *message, long err_code,
 
     /* error case */
     _LSTransport *transport = _LSTransportMessageGetClient(message)->transport;
+    _LSTransportBus *bus = _LSTransportMessageGetClient(message)->bus;
 
     TRANSPORT_LOCK(&transport->lock);
     
-    _LSTransportOutgoing *pending = g_hash_table_lookup(transport->pending, service_name);
+    _LSTransportOutgoing *pending = g_hash_table_lookup(bus->pending, service_name);
 
     if (!pending)
     {
@@ -2855,7 +3606,7 @@ _LSTransportHandleQueryNameFailure(_LSTransportMessage *message, long err_code,
 
     /* Grab the first message on the pending queue, since the target that it is
      * destined for has failed in some manner */
-    _LSTransportMessage *failed_message = g_queue_pop_head(pending->queue);
+    _LSTransportMessage *failed_message = _LSTransportOutgoingPop(pending);
 
     LS_ASSERT(failed_message);
     
@@ -2866,17 +3617,35 @@ _LSTransportHandleQueryNameFailure(_LSTransportMessage *message, long err_code,
     LS_ASSERT(msg_type == _LSTransportMessageTypeMethodCall
               || msg_type == _LSTransportMessageTypeCancelMethodCall);
     
+    /* true to fail everything queued for the service, not just the head */
+    bool fail_all = false;
+
+    if (msg_type == _LSTransportMessageTypeMethodCall &&
+        (err_code == LS_TRANSPORT_QUERY_NAME_PERMISSION_DENIED || err_code == LS_TRANSPORT_QUERY_NAME_SERVICE_NOT_EXIST))
+    {
+        /* permissions only change when the hub reloads its config, so
+         * this answer stays good until the service comes or goes; a
+         * missing service is only remembered briefly */
+        _LSTransportQueryNameCacheSave(bus, service_name, _LSTransportMessageGetAppId(failed_message),
+                                       err_code, NULL, is_dynamic);
+    }
+
+    if (err_code == LS_TRANSPORT_QUERY_NAME_SERVICE_NOT_EXIST)
+    {
+        /* no app id will make it exist */
+        fail_all = true;
+    }
     
     if (is_dynamic && LS_TRANSPORT_QUERY_NAME_SERVICE_NOT_AVAILABLE == err_code)
     {
         if (--failed_message->retries > 0)
         {
-            g_queue_push_head(pending->queue, failed_message);
+            _LSTransportOutgoingPush(pending, failed_message, true);
             OUTGOING_UNLOCK(&pending->lock);
 
             g_warning("%s: retrying sending query name to service \"%s\", %d retries remain", __func__, service_name, failed_message->retries); 
     
-            if (!_LSTransportQueryName(transport->hub, failed_message, service_name, &lserror))
+            if (!_LSTransportQueryName(bus->hub, failed_message, service_name, &lserror))
             {
                 LS_ASSERT(!"_LSTransportQueryName failed");
             }
@@ -2886,12 +3655,35 @@ _LSTransportHandleQueryNameFailure(_LSTransportMessage *message, long err_code,
         else
         {
             g_critical("%s: too many retries sending query name to service \"%s\"", __func__, service_name); 
+
+            /* a service that keeps failing to come up would otherwise get
+             * a full set of retries for every message queued behind this one */
+            fail_all = true;
+        }
+    }
+
+    GSList *failed = g_slist_prepend(NULL, failed_message);
+
+    if (fail_all)
+    {
+        _LSTransportMessage *queued = NULL;
+
+        while ((queued = _LSTransportOutgoingPop(pending)) != NULL)
+        {
+            failed = g_slist_prepend(failed, queued);
         }
     }
 
-    if (msg_type == _LSTransportMessageTypeMethodCall)
+    failed = g_slist_reverse(failed);
+
+    GSList *iter = NULL;
+
+    for (iter = failed; iter != NULL; iter = g_slist_next(iter))
     {
-        _LSTransportSerialRemove(pending->serial, _LSTransportMessageGetToken(failed_message));
+        if (_LSTransportMessageGetType(iter->data) == _LSTransportMessageTypeMethodCall)
+        {
+            _LSTransportSerialRemove(pending->serial, _LSTransportMessageGetToken(iter->data));
+        }
     }
 
     _LSTransportMessage *next_message = g_queue_peek_head(pending->queue);
@@ -2899,13 +3691,13 @@ _LSTransportHandleQueryNameFailure(_LSTransportMessage *message, long err_code,
     {
         OUTGOING_UNLOCK(&pending->lock);
         
-        LS_ASSERT(transport->hub);
+        LS_ASSERT(bus->hub);
         /* we still have messages destined for this service, so send another
          * query message to see if the service has come up since */
 
         LS_ASSERT(MAX_SEND_RETRIES == next_message->retries);
 
-        if (!_LSTransportQueryName(transport->hub, next_message, service_name, &lserror))
+        if (!_LSTransportQueryName(bus->hub, next_message, service_name, &lserror))
         {
             LS_ASSERT(0);
         }
@@ -2913,7 +3705,7 @@ _LSTransportHandleQueryNameFailure(_LSTransportMessage *message, long err_code,
     else
     {
         /* pending queue is empty, so we need to clean up */
-        if (!g_hash_table_remove(transport->pending, service_name))
+        if (!g_hash_table_remove(bus->pending, service_name))
         {
             LS_ASSERT(0);
         }
@@ -2926,146 +3718,115 @@ _LSTransportHandleQueryNameFailure(_LSTransportMessage *message, long err_code,
     
     TRANSPORT_UNLOCK(&transport->lock);
     
-    /* call failure handler for this message -- only makes sense for method calls */
-    if (msg_type == _LSTransportMessageTypeMethodCall)
+    _LSTransportMessageFailureType failure_type;
+
+    switch (err_code)
     {
-        _LSTransportMessageFailureType failure_type;
+    case LS_TRANSPORT_QUERY_NAME_SERVICE_NOT_AVAILABLE:
+    case LS_TRANSPORT_QUERY_NAME_TIMEOUT:
+    case LS_TRANSPORT_QUERY_NAME_CONNECT_TIMEOUT:
+        failure_type = _LSTransportMessageFailureTypeServiceUnavailable;
+        break;
+    case LS_TRANSPORT_QUERY_NAME_SERVICE_NOT_EXIST:
+        failure_type = _LSTransportMessageFailureTypeServiceNotExist;
+        break;
+    case LS_TRANSPORT_QUERY_NAME_PERMISSION_DENIED:
+        failure_type = _LSTransportMessageFailureTypePermissionDenied;
+        break;
+    case LS_TRANSPORT_QUERY_NAME_MESSAGE_CONTENT_ERROR:
+        failure_type = _LSTransportMessageFailureTypeMessageContentError;
+        break;
+    default:
+        failure_type = _LSTransportMessageFailureTypeUnknown;
+        break;
+    }
 
-        switch (err_code)
+    for (iter = failed; iter != NULL; iter = g_slist_next(iter))
+    {
+        /* call failure handler for this message -- only makes sense for method calls */
+        if (_LSTransportMessageGetType(iter->data) == _LSTransportMessageTypeMethodCall)
         {
-        case LS_TRANSPORT_QUERY_NAME_SERVICE_NOT_AVAILABLE:
-        case LS_TRANSPORT_QUERY_NAME_TIMEOUT:
-        case LS_TRANSPORT_QUERY_NAME_CONNECT_TIMEOUT:
-            failure_type = _LSTransportMessageFailureTypeServiceUnavailable;
-            break;
-        case LS_TRANSPORT_QUERY_NAME_SERVICE_NOT_EXIST:
-            failure_type = _LSTransportMessageFailureTypeServiceNotExist;
-            break;
-        case LS_TRANSPORT_QUERY_NAME_PERMISSION_DENIED:
-            failure_type = _LSTransportMessageFailureTypePermissionDenied;
-            break;
-        case LS_TRANSPORT_QUERY_NAME_MESSAGE_CONTENT_ERROR:
-            failure_type = _LSTransportMessageFailureTypeMessageContentError;
-            break;
-        default:
-            failure_type = _LSTransportMessageFailureTypeUnknown;
-            break;
+            bus->message_failure_handler(_LSTransportMessageGetToken(iter->data), failure_type, bus->message_failure_context);
         }
 
-        transport->message_failure_handler(_LSTransportMessageGetToken(failed_message), failure_type, transport->message_failure_context);
+        /* we're done with this message */ 
+        _LSTransportMessageUnref(iter->data);
     }
-    
-    /* we're done with this message */ 
-    _LSTransportMessageUnref(failed_message);
+
+    g_slist_free(failed);
 done:;
 }
 
 /** 
  *******************************************************************************
- * @brief Handle a reply to a "QueryName" message from the hub.
+ * @brief Connect to a service that has messages waiting in the pending
+ * queue and start sending them.
  *
  * @attention locks transport lock
  *
- * @param  message  IN  query name reply message 
+ * @param  bus              IN  bus
+ * @param  service_name     IN  service name 
+ * @param  unique_name      IN  unique name of the service 
+ * @param  connected_fd     IN  fd already connected to the service by the hub
+ *                              (-1 to connect to @ref unique_name ourselves)
+ * @param  is_dynamic       IN  true if the service is dynamic 
+ * @param  remember         IN  true to remember the result
+ * @param  lserror          OUT set on error 
+ * 
+ * @retval  true on success
+ * @retval  false on failure (the pending queue is left alone)
  *******************************************************************************
  */
-void
-_LSTransportHandleQueryNameReply(_LSTransportMessage *message)
+static bool
+_LSTransportConnectPendingService(_LSTransportBus *bus, const char *service_name, const char *unique_name,
+                                  int connected_fd, bool is_dynamic, bool remember, LSError *lserror)
 {
-    _ls_verbose("%s\n", __func__);
-    
-    LSError lserror;
-    LSErrorInit(&lserror);
-
-    int32_t ret_code = 0;
-    int dup_fd = -1;
-    
-    _LSTransport *transport = _LSTransportClientGetTransport(_LSTransportMessageGetClient(message));
-    
-    /* get the service name out of the message -- always have this, even in failure */
-    const char *service_name = _LSTransportQueryNameReplyGetServiceName(message);
-
-    /* check return code */
-    ret_code = _LSTransportQueryNameReplyGetReturnVal(message);
-
-    int message_fd = _LSTransportMessageGetConnectionFd(message);
-
-    /* get is_dynamic out of the message */
-    bool is_dynamic = _LSTransportQueryNameReplyGetIsDynamic(message);
-
-    /*
-        In the hub there *was* a race where the reply was created with a non-error code but the
-        client went down before we could connect. In that case we arrive here with an error code of
-        LS_TRANSPORT_QUERY_NAME_SUCCESS but message_fd is -1. This race has been fixed but a
-        little paranoia is in order.
-    */
-    if (unlikely((ret_code == LS_TRANSPORT_QUERY_NAME_SUCCESS) && (message_fd == -1)))
-    {
-        if (_LSTransportGetTransportType(transport) == _LSTransportTypeLocal)
-        {
-            ret_code = LS_TRANSPORT_QUERY_NAME_SERVICE_NOT_AVAILABLE;
-        }
-    }
-
-    if (ret_code != LS_TRANSPORT_QUERY_NAME_SUCCESS)
-    {
-        _LSTransportHandleQueryNameFailure(message, ret_code, service_name, is_dynamic);
-        return;
-    }
-
-    /* get the unique name out of the message */
-    const char *unique_name = _LSTransportQueryNameReplyGetUniqueName(message);
-
-    /* make sure we have a valid service_name and unique_name */
-    if (unique_name == NULL || service_name == NULL)
-    {
-        _LSTransportHandleQueryNameFailure(message, LS_TRANSPORT_QUERY_NAME_MESSAGE_CONTENT_ERROR, service_name, is_dynamic);
-        return;
-    }
-
-    _ls_verbose("%s: service_name: %s, unique_name: %s, %s\n", __func__, service_name, unique_name, is_dynamic ? "dynamic" : "static");
+    _LSTransport *transport = bus->transport;
 
     /* Atomically move messages from pending queue to hash of available services */ 
     TRANSPORT_LOCK(&transport->lock);
  
     /* move set of messages in pending queue to outbound queue for the now-connected client -- by defintion if we get here there should be at least one message on the queue for this service */
-    _LSTransportOutgoing *pending = (_LSTransportOutgoing*)g_hash_table_lookup(transport->pending, service_name);
+    _LSTransportOutgoing *pending = (_LSTransportOutgoing*)g_hash_table_lookup(bus->pending, service_name);
     
     LS_ASSERT(pending);
-   
-    if (_LSTransportGetTransportType(transport) == _LSTransportTypeLocal)
+
+    if (remember)
     {
-        dup_fd = dup(message_fd);
-        if (-1 == dup_fd)
+        _LSTransportMessage *head = g_queue_peek_head(pending->queue);
+
+        if (head && _LSTransportMessageGetType(head) == _LSTransportMessageTypeMethodCall)
         {
-            g_critical("%s: dup() failed, errno %d, \"%s\"", __func__, errno, g_strerror(errno));
+            _LSTransportQueryNameCacheSave(bus, service_name, _LSTransportMessageGetAppId(head),
+                                           LS_TRANSPORT_QUERY_NAME_SUCCESS, unique_name, is_dynamic);
         }
-        LS_ASSERT(dup_fd != -1);
     }
 
     /* connect to our new friend */
-    _LSTransportClient *client = _LSTransportConnectClient(transport, service_name,
+    _LSTransportClient *client = _LSTransportConnectClient(bus, service_name,
                                                            unique_name,
-                                                           dup_fd,
-                                                           pending, &lserror);
+                                                           connected_fd,
+                                                           pending, lserror);
 
     if (!client)
     {
-        LSErrorPrint(&lserror, stderr);
-        LSErrorFree(&lserror);
         TRANSPORT_UNLOCK(&transport->lock);
-        _LSTransportHandleQueryNameFailure(message, LS_TRANSPORT_QUERY_NAME_SERVICE_NOT_AVAILABLE, service_name, is_dynamic);
-        return;
+        return false;
     }
     
     client->is_dynamic = is_dynamic;
+
+    /* the pending queue was kept in FIFO order for the name queries */
+    OUTGOING_LOCK(&client->outgoing->lock);
+    _LSTransportOutgoingPrioritize(client->outgoing);
+    OUTGOING_UNLOCK(&client->outgoing->lock);
         
     /* We successfully connected to the far side, so remove the service from
      * the transport lookup queue.
      * 
      * This frees the key, but not the value due to choice in
      * g_hash_table_new_full */
-    if (!g_hash_table_remove(transport->pending, service_name))
+    if (!g_hash_table_remove(bus->pending, service_name))
     {
         LS_ASSERT(0);
     }
@@ -3073,7 +3834,7 @@ _LSTransportHandleQueryNameReply(_LSTransportMessage *message)
     /* client ref +1 (total = 1) */
 
     /* client ref +1 (total = 2) */ 
-    if (!_LSTransportAddClientHash(transport, client, service_name))
+    if (!_LSTransportAddClientHash(bus, client, service_name))
     {
         LS_ASSERT(0);
     }
@@ -3093,18 +3854,21 @@ _LSTransportHandleQueryNameReply(_LSTransportMessage *message)
      * to know our service name and unique name so that it can put that in
      * the message to the monitor)
      */
-    if (!_LSTransportSendMessageClientInfo(client, transport->service_name, transport->unique_name, true, &lserror))
+    LSError info_error;
+    LSErrorInit(&info_error);
+
+    if (!_LSTransportSendMessageClientInfo(client, transport->service_name, bus->unique_name, true, &info_error))
     {
-        LSErrorPrint(&lserror, stderr);
-        LSErrorFree(&lserror);
+        LSErrorPrint(&info_error, stderr);
+        LSErrorFree(&info_error);
     }
 
     /* kickstart sending to the monitor */
-    if (transport->monitor)
+    if (bus->monitor)
     {
         /* MONITOR -- we need to send any pending method calls to the monitor
          * and add the destination info to the message */
-        _LSTransportSendPendingMonitorMessages(transport, client, pending);
+        _LSTransportSendPendingMonitorMessages(bus, client, pending);
     }
 
     /* By definition, when we receive this message, there is at least
@@ -3116,44 +3880,113 @@ _LSTransportHandleQueryNameReply(_LSTransportMessage *message)
     /* client ref -1 (total = 2) */
     _ls_verbose("%s: unref'ing\n", __func__);
     _LSTransportClientUnref(client); 
+
+    return true;
 }
 
 /** 
  *******************************************************************************
- * @brief Tell the client (always the hub) that we're up
- * 
- * @param  client   IN  hub
- * @param  lserror  OUT set on error 
- * 
- * @retval true on success
- * @retval false on failure
+ * @brief Handle a reply to a "QueryName" message from the hub.
+ *
+ * @attention locks transport lock
+ *
+ * @param  message  IN  query name reply message 
  *******************************************************************************
  */
-bool
-_LSTransportNodeUp(_LSTransportClient *client, LSError *lserror)
+void
+_LSTransportHandleQueryNameReply(_LSTransportMessage *message)
 {
-    _ls_verbose("%s: client: %p\n", __func__, client);
+    _ls_verbose("%s\n", __func__);
+    
+    LSError lserror;
+    LSErrorInit(&lserror);
 
-    bool ret = true;
+    int32_t ret_code = 0;
+    int dup_fd = -1;
+    
+    _LSTransportBus *bus = _LSTransportClientGetBus(_LSTransportMessageGetClient(message));
+    
+    /* get the service name out of the message -- always have this, even in failure */
+    const char *service_name = _LSTransportQueryNameReplyGetServiceName(message);
 
-    _LSTransportMessage *message = _LSTransportMessageNewRef(0);
+    /* check return code */
+    ret_code = _LSTransportQueryNameReplyGetReturnVal(message);
 
-    if (!message)
+    int message_fd = _LSTransportMessageGetConnectionFd(message);
+
+    /* get is_dynamic out of the message */
+    bool is_dynamic = _LSTransportQueryNameReplyGetIsDynamic(message);
+
+    /*
+        In the hub there *was* a race where the reply was created with a non-error code but the
+        client went down before we could connect. In that case we arrive here with an error code of
+        LS_TRANSPORT_QUERY_NAME_SUCCESS but message_fd is -1. This race has been fixed but a
+        little paranoia is in order.
+    */
+    if (unlikely((ret_code == LS_TRANSPORT_QUERY_NAME_SUCCESS) && (message_fd == -1)))
     {
-        _LSErrorSetOOM(lserror);
-        return false;
+        if (bus->type == _LSTransportTypeLocal)
+        {
+            ret_code = LS_TRANSPORT_QUERY_NAME_SERVICE_NOT_AVAILABLE;
+        }
     }
-    
-    _LSTransportMessageSetType(message, _LSTransportMessageTypeNodeUp);
 
-    if (!_LSTransportSendMessageBlocking(message, client, NULL, lserror))
+    if (ret_code != LS_TRANSPORT_QUERY_NAME_SUCCESS)
     {
-        ret = false;
+        _LSTransportHandleQueryNameFailure(message, ret_code, service_name, is_dynamic);
+        return;
     }
 
-    _LSTransportMessageUnref(message);
+    /* get the unique name out of the message */
+    const char *unique_name = _LSTransportQueryNameReplyGetUniqueName(message);
 
-    return ret;
+    /* make sure we have a valid service_name and unique_name */
+    if (unique_name == NULL || service_name == NULL)
+    {
+        _LSTransportHandleQueryNameFailure(message, LS_TRANSPORT_QUERY_NAME_MESSAGE_CONTENT_ERROR, service_name, is_dynamic);
+        return;
+    }
+
+    _ls_verbose("%s: service_name: %s, unique_name: %s, %s\n", __func__, service_name, unique_name, is_dynamic ? "dynamic" : "static");
+
+    if (bus->type == _LSTransportTypeLocal)
+    {
+        dup_fd = dup(message_fd);
+        if (-1 == dup_fd)
+        {
+            g_critical("%s: dup() failed, errno %d, \"%s\"", __func__, errno, g_strerror(errno));
+        }
+        LS_ASSERT(dup_fd != -1);
+    }
+
+    if (!_LSTransportConnectPendingService(bus, service_name, unique_name, dup_fd, is_dynamic, true, &lserror))
+    {
+        LSErrorPrint(&lserror, stderr);
+        LSErrorFree(&lserror);
+        _LSTransportHandleQueryNameFailure(message, LS_TRANSPORT_QUERY_NAME_SERVICE_NOT_AVAILABLE, service_name, is_dynamic);
+        return;
+    }
+}
+
+/** 
+ *******************************************************************************
+ * @brief Create the message that tells the hub that we're up
+ * 
+ * @retval message on success
+ * @retval NULL on failure
+ *******************************************************************************
+ */
+static _LSTransportMessage*
+_LSTransportNodeUpMessageNew(void)
+{
+    _LSTransportMessage *message = _LSTransportMessageNewRef(0);
+
+    if (message)
+    {
+        _LSTransportMessageSetType(message, _LSTransportMessageTypeNodeUp);
+    }
+
+    return message;
 }
 
 
@@ -3162,8 +3995,12 @@ _LSTransportNodeUp(_LSTransportClient *client, LSError *lserror)
  * @brief Connect and get a name from the hub.
  *
  * @attention This blocks until we get a name from the hub.
+ *
+ * The buses of a transport may be connected at the same time from
+ * different threads, but they all have to end up with the same kind of hub
+ * connection (local or inet).
  * 
- * @param  transport    IN  transport
+ * @param  bus          IN  bus to connect
  * @param  local        IN  true for unix domain sockets 
  * @param  public_bus   IN  true to connect to public hub 
  * @param  lserror      OUT set on error 
@@ -3173,8 +4010,10 @@ _LSTransportNodeUp(_LSTransportClient *client, LSError *lserror)
  *******************************************************************************
  */
 bool
-_LSTransportConnect(_LSTransport *transport, bool local, bool public_bus, LSError *lserror)
+_LSTransportConnect(_LSTransportBus *bus, bool local, bool public_bus, LSError *lserror)
 {
+    _LSTransport *transport = bus->transport;
+
     _ls_verbose("%s: transport: %p, service_name: %s\n", __func__, transport, transport->service_name);
     
     bool ret = false;
@@ -3183,8 +4022,10 @@ _LSTransportConnect(_LSTransport *transport, bool local, bool public_bus, LSErro
     /* ignore SIGPIPE -- we'll handle the synchronous return val (EPIPE) */
     signal(SIGPIPE, SIG_IGN);
 
+    bus->public_bus = public_bus;
+
     /* set up shared memory for the monitor */
-    if (!_LSTransportShmInit(&transport->shm, public_bus, lserror))
+    if (!_LSTransportShmInit(&bus->shm, public_bus, lserror))
     {
         return false;
     }
@@ -3195,7 +4036,7 @@ _LSTransportConnect(_LSTransport *transport, bool local, bool public_bus, LSErro
      * 3. Attempt to connecto to inet hub on emulator.
      */
 
-    transport->type = _LSTransportTypeLocal;
+    bus->type = _LSTransportTypeLocal;
 
     if (public_bus)
     {
@@ -3207,7 +4048,7 @@ _LSTransportConnect(_LSTransport *transport, bool local, bool public_bus, LSErro
     }
     
     /* try to connect to the local hub */
-    _LSTransportClient *hub = _LSTransportConnectClient(transport, HUB_NAME, hub_addr, -1, NULL, lserror);
+    _LSTransportClient *hub = _LSTransportConnectClient(bus, HUB_NAME, hub_addr, -1, NULL, lserror);
     
 #ifndef TARGET_EMULATOR
     if (!hub)
@@ -3219,7 +4060,7 @@ _LSTransportConnect(_LSTransport *transport, bool local, bool public_bus, LSErro
         }
 
         /* try connecting to the inet hub */
-        transport->type = _LSTransportTypeInet;
+        bus->type = _LSTransportTypeInet;
 
         if (!(hub_addr = getenv("HUB_INET_ADDRESS")))
         {
@@ -3234,7 +4075,7 @@ _LSTransportConnect(_LSTransport *transport, bool local, bool public_bus, LSErro
             }
         }
 
-        hub = _LSTransportConnectClient(transport, HUB_NAME, hub_addr, -1, NULL, lserror);
+        hub = _LSTransportConnectClient(bus, HUB_NAME, hub_addr, -1, NULL, lserror);
 #endif  /* !TARGET_EMULATOR */
 
         /* try to connect to emulator hub */
@@ -3246,7 +4087,7 @@ _LSTransportConnect(_LSTransport *transport, bool local, bool public_bus, LSErro
                 LSErrorInit(lserror);
             }
         
-            transport->type = _LSTransportTypeInet;
+            bus->type = _LSTransportTypeInet;
            
 #ifdef TARGET_DESKTOP 
             /* Running on the desktop and connecting to emulator */
@@ -3270,7 +4111,7 @@ _LSTransportConnect(_LSTransport *transport, bool local, bool public_bus, LSErro
             }
 #endif
         
-            hub = _LSTransportConnectClient(transport, HUB_NAME, hub_addr, -1, NULL, lserror);
+            hub = _LSTransportConnectClient(bus, HUB_NAME, hub_addr, -1, NULL, lserror);
 
             if (!hub)
             {
@@ -3282,31 +4123,65 @@ _LSTransportConnect(_LSTransport *transport, bool local, bool public_bus, LSErro
     }
 #endif
 
-    transport->hub = hub;
-    /* hub ref +1 (total = 1) */
-
     /* add hub to our hash table of known names (common names) */
     TRANSPORT_LOCK(&transport->lock);
+
+    int i;
+    for (i = 0; i < transport->num_buses; i++)
+    {
+        _LSTransportBus *other = transport->buses[i];
+
+        if (other != bus && other->hub && other->type != bus->type)
+        {
+            TRANSPORT_UNLOCK(&transport->lock);
+            _LSTransportClientUnref(hub);
+            _LSErrorSetNoPrint(lserror, -1, "Found a %s hub for the %s bus, but the other bus has a %s hub",
+                               bus->type == _LSTransportTypeLocal ? "local" : "inet",
+                               public_bus ? "public" : "private",
+                               other->type == _LSTransportTypeLocal ? "local" : "inet");
+            goto Done;
+        }
+    }
+
+    bus->hub = hub;
+    /* hub ref +1 (total = 1) */
+
     /* hub ref +1 (total = 2) */
-    _LSTransportAddClientHash(transport, hub, HUB_NAME);
+    _LSTransportAddClientHash(bus, hub, HUB_NAME);
     /* hub ref +1 (total = 3) */
     _LSTransportAddAllConnectionHash(transport, hub);
     TRANSPORT_UNLOCK(&transport->lock);
 
-    if (transport->type == _LSTransportTypeInet)
+    if (bus->type == _LSTransportTypeInet)
     {
-        if (!_LSTransportSetupListenerInet(transport, -1, lserror))
+        if (!_LSTransportSetupListenerInet(bus, -1, lserror))
         {
             goto Done;
         }
     }
 
     int listen_fd = -1;
+    int32_t resumed;
+
+    /* "NodeUp" doesn't have to wait for our name: the hub handles messages
+     * from a client in order, and the listen socket it hands us already
+     * queues connections until we watch it. So it goes out in the same
+     * write as "RequestName", and the whole handshake is one round trip. */
+    _LSTransportMessage *node_up = _LSTransportNodeUpMessageNew();
+
+    if (!node_up)
+    {
+        _LSErrorSetOOM(lserror);
+        goto Done;
+    }
 
     /* blocking send our requested name info to the hub */
-    transport->unique_name = _LSTransportRequestName(transport->service_name, hub, &listen_fd, &transport->privileged, lserror);
+    bus->unique_name = _LSTransportRequestName(transport->service_name, hub, node_up, NULL, 0,
+                                                     &listen_fd, &bus->privileged, &resumed, lserror);
 
-    if (!transport->unique_name)
+    _LSTransportMessageUnref(node_up);
+
+    if (!bus->unique_name)
     {
         goto Done;
     }
@@ -3318,27 +4193,25 @@ _LSTransportConnect(_LSTransport *transport, bool local, bool public_bus, LSErro
         goto Done;
     }
 
-    if (transport->type == _LSTransportTypeLocal)
+    if (bus->type == _LSTransportTypeLocal)
     {
         /* we've got our name and fd, so we start listening for messages */
-        if (!_LSTransportSetupListenerLocalWithFd(transport, transport->unique_name, listen_fd, lserror))
+        if (!_LSTransportSetupListenerLocalWithFd(bus, bus->unique_name, listen_fd, lserror))
         {
             goto Done;
         }
     }
 
-    /* Send the message to acknowledge we're up */
-    if (!_LSTransportNodeUp(hub, lserror))
-    {
-        goto Done;
-    }
-
     /* MONITOR: send *our* information to the client (hub in this case) */
-    if (!_LSTransportSendMessageClientInfo(hub, transport->service_name, transport->unique_name, false, lserror))
+    if (!_LSTransportSendMessageClientInfo(hub, transport->service_name, bus->unique_name, false, lserror))
     {
         goto Done;
     }
 
+    bus->hub_address = g_strdup(hub_addr);
+    bus->hub_reconnect = true;
+    bus->hub_reconnect_ms = LS_TRANSPORT_HUB_RECONNECT_MIN_MS;
+
     ret = true;
 
 Done:
@@ -3348,51 +4221,406 @@ Done:
 
 /** 
  *******************************************************************************
- * @brief Called when watch indicates that there is data to be read from a
- * channel. This function does non-blocking reads of the incoming data and
- * processes the complete messages.
- * 
- * @param  source       IN  io source
- * @param  condition    IN  condition that triggered this callback 
- * @param  data         IN  client 
+ * @brief Send "QueryName" again for the message at the head of each pending
+ * queue, since the hub that the original went to is gone.
  * 
- * @retval TRUE when client is still alive
- * @retval FALSE when client goes away so that this watch is removed
+ * @param  bus          IN  bus
  *******************************************************************************
  */
-gboolean
-_LSTransportReceiveClient(GIOChannel *source, GIOCondition condition,
-                         gpointer data)
+static void
+_LSTransportRequeryPendingNames(_LSTransportBus *bus)
 {
-    LSError lserror;
-    LSErrorInit(&lserror);
+    _LSTransport *transport = bus->transport;
 
-    _LSTransportClient *client = (_LSTransportClient*)data;
+    GHashTableIter iter;
+    gpointer key, value;
 
-    _ls_verbose("%s: client: %p\n", __func__, client);
+    TRANSPORT_LOCK(&transport->lock);
 
-    /* calculate bytes remaining in buf */
-    int num_bytes_to_read;
-    unsigned long offset;
-    
-    /* we're using the client's incoming buffer, so ref it */
-    _LSTransportClientRef(client);
-    _LSTransportIncoming *incoming = client->incoming;
-    
-    bool shutdown = false;
-    
-    /* 
-     * TODO: limit the number of messages that we queue up before processing
-     * them. We don't want to starve other parts of the program's operation
-     * and we don't want to use too much memory; this should be configurable
-     */
+    g_hash_table_iter_init(&iter, bus->pending);
 
-    /* TODO: review locking */
+    while (g_hash_table_iter_next(&iter, &key, &value))
+    {
+        _LSTransportOutgoing *pending = value;
 
-    //INCOMING_LOCK(&incoming->lock);
+        OUTGOING_LOCK(&pending->lock);
+        _LSTransportMessage *head = g_queue_peek_head(pending->queue);
+        if (head) _LSTransportMessageRef(head);
+        OUTGOING_UNLOCK(&pending->lock);
 
-    while (1)
-    {
+        if (head)
+        {
+            LSError lserror;
+            LSErrorInit(&lserror);
+
+            if (!_LSTransportQueryName(bus->hub, head, key, &lserror))
+            {
+                LSErrorPrint(&lserror, stderr);
+                LSErrorFree(&lserror);
+            }
+
+            _LSTransportMessageUnref(head);
+        }
+    }
+
+    TRANSPORT_UNLOCK(&transport->lock);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Connect to the hub again after it went away (e.g., it was
+ * restarted).
+ *
+ * We ask for our previous unique name and pass the digest of our signal
+ * registrations. A hub that restored our state from its snapshot gives us
+ * the name back, so our listen socket and the connections we have with
+ * other clients stay valid, and it restores our signal registrations if
+ * the digest matches its copy. Otherwise we take the new name and register
+ * our signals again.
+ *
+ * @attention This blocks until we get a name from the hub.
+ * 
+ * @param  bus          IN  bus
+ * @param  lserror      OUT set on error 
+ * 
+ * @retval  true on success
+ * @retval  false on failure
+ *******************************************************************************
+ */
+static bool
+_LSTransportHubReconnect(_LSTransportBus *bus, LSError *lserror)
+{
+    _LSTransport *transport = bus->transport;
+
+    bool ret = false;
+    int listen_fd = -1;
+    bool privileged = false;
+    int32_t resumed = LS_TRANSPORT_REQUEST_NAME_RESUME_NONE;
+    char *unique_name = NULL;
+    _LSTransportMessage *node_up = NULL;
+
+    _LSTransportClient *hub = _LSTransportConnectClient(bus, HUB_NAME, bus->hub_address, -1, NULL, lserror);
+
+    if (!hub)
+    {
+        return false;
+    }
+
+    node_up = _LSTransportNodeUpMessageNew();
+
+    if (!node_up)
+    {
+        _LSErrorSetOOM(lserror);
+        goto exit;
+    }
+
+    unique_name = _LSTransportRequestName(transport->service_name, hub, node_up, bus->unique_name,
+                                          _LSTransportSignalRegistrationsDigest(bus),
+                                          &listen_fd, &privileged, &resumed, lserror);
+
+    if (!unique_name)
+    {
+        goto exit;
+    }
+
+    if (!_LSTransportReceiveMonitorStatus(transport, hub, lserror))
+    {
+        goto exit;
+    }
+
+    if (resumed == LS_TRANSPORT_REQUEST_NAME_RESUME_NONE)
+    {
+        if (bus->type == _LSTransportTypeLocal)
+        {
+            /* the hub set up a socket for the new name */
+            if (bus->listen_channel.accept_watch)
+            {
+                _LSTransportRemoveAcceptWatch(&bus->listen_channel);
+            }
+            _LSTransportChannelClose(&bus->listen_channel, false);
+            _LSTransportChannelDeinit(&bus->listen_channel);
+
+            if (!_LSTransportSetupListenerLocalWithFd(bus, unique_name, listen_fd, lserror))
+            {
+                /* listen_fd is closed on the way out */
+                goto exit;
+            }
+            listen_fd = -1;
+
+            _LSTransportAddAcceptWatch(&bus->listen_channel, transport->mainloop_context, bus);
+        }
+
+        g_free(bus->unique_name);
+        bus->unique_name = unique_name;
+        unique_name = NULL;
+    }
+
+    bus->privileged = privileged;
+
+    TRANSPORT_LOCK(&transport->lock);
+    /* the new hub may have a different config */
+    g_hash_table_remove_all(bus->query_name_cache);
+    bus->hub_retired = g_slist_prepend(bus->hub_retired, bus->hub);
+    bus->hub = hub;
+    /* hub ref +1 (total = 2) */
+    _LSTransportAddClientHash(bus, hub, HUB_NAME);
+    /* hub ref +1 (total = 3) */
+    _LSTransportAddAllConnectionHash(transport, hub);
+    TRANSPORT_UNLOCK(&transport->lock);
+
+    /* bus->hub has our ref now */
+    hub = NULL;
+
+    _LSTransportAddClientWatches(NULL, bus->hub, transport->mainloop_context);
+
+    LSError tmp_lserror;
+    LSErrorInit(&tmp_lserror);
+
+    if (!_LSTransportSendMessageClientInfo(bus->hub, transport->service_name, bus->unique_name, false, &tmp_lserror))
+    {
+        LSErrorPrint(&tmp_lserror, stderr);
+        LSErrorFree(&tmp_lserror);
+    }
+
+    if (resumed != LS_TRANSPORT_REQUEST_NAME_RESUME_ALL &&
+        !_LSTransportSignalRegisterAgain(bus, &tmp_lserror))
+    {
+        LSErrorPrint(&tmp_lserror, stderr);
+        LSErrorFree(&tmp_lserror);
+    }
+
+    _LSTransportRequeryPendingNames(bus);
+
+    g_message("%s: reconnected to the hub as \"%s\" (%s)", __func__, bus->unique_name,
+              resumed == LS_TRANSPORT_REQUEST_NAME_RESUME_ALL ? "resumed" :
+              resumed == LS_TRANSPORT_REQUEST_NAME_RESUME_NAME ? "resumed name" : "new name");
+
+    ret = true;
+
+exit:
+    if (listen_fd != -1) close(listen_fd);
+    if (node_up) _LSTransportMessageUnref(node_up);
+    if (hub) _LSTransportClientUnref(hub);
+    g_free(unique_name);
+
+    return ret;
+}
+
+static void _LSTransportHubReconnectSchedule(_LSTransportBus *bus, guint delay_ms);
+
+static gboolean
+_LSTransportHubReconnectCallback(gpointer data)
+{
+    _LSTransportBus *bus = data;
+
+    g_source_unref(bus->hub_reconnect_source);
+    bus->hub_reconnect_source = NULL;
+
+    if (!bus->hub_reconnect)
+    {
+        return FALSE;
+    }
+
+    LSError lserror;
+    LSErrorInit(&lserror);
+
+    if (_LSTransportHubReconnect(bus, &lserror))
+    {
+        bus->hub_reconnect_ms = LS_TRANSPORT_HUB_RECONNECT_MIN_MS;
+    }
+    else
+    {
+        /* most likely the hub isn't back yet */
+        _ls_verbose("%s: unable to reconnect to the hub: %s\n", __func__, lserror.message);
+        LSErrorFree(&lserror);
+
+        guint delay_ms = bus->hub_reconnect_ms;
+
+        bus->hub_reconnect_ms = MIN(delay_ms * 2, LS_TRANSPORT_HUB_RECONNECT_MAX_MS);
+
+        _LSTransportHubReconnectSchedule(bus, delay_ms + g_random_int_range(0, delay_ms / 2 + 1));
+    }
+
+    return FALSE;
+}
+
+static void
+_LSTransportHubReconnectSchedule(_LSTransportBus *bus, guint delay_ms)
+{
+    _LSTransport *transport = bus->transport;
+
+    LS_ASSERT(bus->hub_reconnect_source == NULL);
+
+    bus->hub_reconnect_source = g_timeout_source_new(delay_ms);
+    g_source_set_callback(bus->hub_reconnect_source, _LSTransportHubReconnectCallback, bus, NULL);
+    g_source_attach(bus->hub_reconnect_source, transport->mainloop_context);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Called when our connection to the hub goes away. Unless we are the
+ * ones disconnecting, start trying to reconnect (see @ref
+ * _LSTransportHubReconnect).
+ * 
+ * @param  bus          IN  bus
+ *******************************************************************************
+ */
+static void
+_LSTransportHubLost(_LSTransportBus *bus)
+{
+    _LSTransport *transport = bus->transport;
+
+    if (!bus->hub_reconnect || !transport->mainloop_context || bus->hub_reconnect_source)
+    {
+        return;
+    }
+
+    g_warning("%s: lost connection to the hub; reconnecting", __func__);
+
+    bus->hub_reconnect_ms = LS_TRANSPORT_HUB_RECONNECT_MIN_MS;
+
+    _LSTransportHubReconnectSchedule(bus, g_random_int_range(0, LS_TRANSPORT_HUB_RECONNECT_JITTER_MS));
+}
+
+/** 
+ *******************************************************************************
+ * @brief Check the return value of a non-blocking recv() on a client.
+ * 
+ * @param  client   IN  client 
+ * @param  ret      IN  return value from recv() (must be <= 0)
+ * 
+ * @retval  true if client has shut down or hit a fatal error
+ * @retval  false if recv() would have blocked (or was interrupted)
+ *******************************************************************************
+ */
+static bool
+_LSTransportRecvIsShutdown(_LSTransportClient *client, int ret)
+{
+    LS_ASSERT(ret <= 0);
+
+    if (ret == 0)
+    {
+        _ls_verbose("%s: Orderly shutdown\n", __func__);
+        return true;
+    }
+    else if (errno != EAGAIN && errno != EINTR)
+    {
+        g_critical("Encountered error during recv: %d, %s [fd: %d, client service name: %s, client unique name: %s",
+                    errno, strerror(errno), client->channel.fd,
+                    _LSTransportClientGetServiceName(client),
+                    _LSTransportClientGetUniqueName(client));
+        return true;
+    }
+
+    return false;   /* errno == EAGAIN || errno == EINTR */
+}
+
+/** 
+ *******************************************************************************
+ * @brief Returns true if incoming data from this client can be read in large
+ * chunks.
+ *
+ * Our connection to the hub is also read with blocking receives (see
+ * @ref _LSTransportRecvMessageBlocking), which read exactly up to the end of
+ * each message and pick up connection fds with @ref _LSTransportRecvFd, so
+ * nothing may be buffered ahead on it. We read ahead on all other
+ * connections; fds passed on those are collected with the buffered data.
+ * 
+ * @param  client   IN  client 
+ * 
+ * @retval  true if read ahead is safe
+ * @retval  false otherwise
+ *******************************************************************************
+ */
+static inline bool
+_LSTransportClientCanReadAhead(const _LSTransportClient *client)
+{
+    return client != client->bus->hub;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Add a completely received message to the client's incoming queue.
+ * Compressed messages are decompressed and shm method calls get their
+ * payload from the segment passed with them first; they are dropped if
+ * that fails.
+ * 
+ * @param  client   IN  client 
+ * @param  message  IN  complete message (ownership is transferred)
+ *******************************************************************************
+ */
+static void
+_LSTransportIncomingPushMessage(_LSTransportClient *client, _LSTransportMessage *message)
+{
+    LS_TRACE_MESSAGE(_LSTracePointReceive, message);
+
+    client->incoming->received_messages++;
+    client->incoming->received_bytes += sizeof(_LSTransportHeader) + _LSTransportMessageGetHeader(message)->len;
+
+    _LSTransportIncomingCheckHeaderFlags(client, message);
+
+    if (_LSTransportMessageGetHeader(message)->type & LS_TRANSPORT_HEADER_FLAG_COMPRESSED)
+    {
+        LSError lserror;
+        LSErrorInit(&lserror);
+
+        if (!_LSTransportMessageDecompress(message, &lserror))
+        {
+            g_critical("%s: dropping compressed message (token: %d) from client: %p",
+                       __func__, (int)_LSTransportMessageGetToken(message), client);
+            LSErrorPrint(&lserror, stderr);
+            LSErrorFree(&lserror);
+            _LSTransportMessageUnref(message);
+            return;
+        }
+    }
+
+    if (_LSTransportMessageGetType(message) == _LSTransportMessageTypeMethodCallShm)
+    {
+        LSError lserror;
+        LSErrorInit(&lserror);
+
+        if (!_LSTransportMessageAttachShmPayload(message, &lserror))
+        {
+            g_critical("%s: dropping shm method call (token: %d) from client: %p",
+                       __func__, (int)_LSTransportMessageGetToken(message), client);
+            LSErrorPrint(&lserror, stderr);
+            LSErrorFree(&lserror);
+            _LSTransportMessageUnref(message);
+            return;
+        }
+    }
+
+    _LSTransportMessageIndexFields(message);
+
+    g_queue_push_tail(client->incoming->complete_messages, message);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Read in data from a client one message at a time: first the header
+ * and then the body directly into a newly allocated message. Complete
+ * messages are added to the incoming queue.
+ * 
+ * @param  client   IN  client 
+ * 
+ * @retval  true if the client shut down (or hit a fatal error)
+ * @retval  false otherwise
+ *******************************************************************************
+ */
+static bool
+_LSTransportReceiveClientMessages(_LSTransportClient *client)
+{
+    /* calculate bytes remaining in buf */
+    int num_bytes_to_read;
+    unsigned long offset;
+    
+    _LSTransportIncoming *incoming = client->incoming;
+    
+    bool shutdown = false;
+
+    while (1)
+    {
         char* buf = (char*)&incoming->tmp_header;
         int ret = 0;
         
@@ -3490,7 +4718,7 @@ _LSTransportReceiveClient(GIOChannel *source, GIOCondition condition,
                     _LSTransportMessageSetConnectionFd(incoming->tmp_msg, recv_fd);
                 }
                 
-                g_queue_push_tail(incoming->complete_messages, incoming->tmp_msg);
+                _LSTransportIncomingPushMessage(client, incoming->tmp_msg);
                 incoming->tmp_msg = NULL;
                 incoming->tmp_msg_offset = 0;
             }
@@ -3540,6 +4768,9 @@ _LSTransportReceiveClient(GIOChannel *source, GIOCondition condition,
                 /* TODO: can we fold this in better to the above code? */ 
                 if (_LSTransportMessageGetHeader(incoming->tmp_msg)->len == 0)
                 {
+                    LS_TRACE_MESSAGE(_LSTracePointReceive, incoming->tmp_msg);
+                    incoming->received_messages++;
+                    incoming->received_bytes += sizeof(_LSTransportHeader);
                     g_queue_push_tail(incoming->complete_messages, incoming->tmp_msg);
                     incoming->tmp_msg = NULL;
                 }
@@ -3550,23 +4781,295 @@ _LSTransportReceiveClient(GIOChannel *source, GIOCondition condition,
         }
     }
 
-    /* 
-     * Call the callbacks for methods and filter function callbacks for replies
-     * TODO: should this be done in another callback (idle handler?)
+    return shutdown;
+}
 
-     * <eeh> probably.  You want watch callbacks to return quickly.  But you
-     * don't want heavy network activity to starve message handlers either.
-     * Can you schedule the incomming queue to be processed in the main loop
-     * at a higher priority than idle?  Caveate: if this function and the one
-     * to process the queue have to hold the same mutex then they're going to
-     * starve one another anyway.  To avoid that you'd have to allow
-     * _LSTransportProcessIncomingMessages to return without emptying the
-     * queue and then reschedule it.  Maybe leave things alone but be aware
-     * when evaluating bug reports and performance data that this could be an
-     * issue.
-     */
+/** 
+ *******************************************************************************
+ * @brief Read in data from a client in large chunks into the incoming read
+ * buffer and parse complete messages out of it. Bodies that are larger than
+ * the read buffer are read directly into the message. Fds passed with
+ * messages are matched up with their marker bytes in the buffer. Complete
+ * messages are added to the incoming queue.
+ *
+ * @note Only use this on clients for which
+ * @ref _LSTransportClientCanReadAhead is true.
+ * 
+ * @param  client   IN  client 
+ * 
+ * @retval  true if the client shut down (or hit a fatal error)
+ * @retval  false otherwise
+ *******************************************************************************
+ */
+static bool
+_LSTransportReceiveClientBuffered(_LSTransportClient *client)
+{
+    _LSTransportIncoming *incoming = client->incoming;
+    bool shutdown = false;
 
-    //INCOMING_UNLOCK(&incoming->lock);
+    if (!incoming->read_buf)
+    {
+        incoming->read_buf = g_malloc(LS_TRANSPORT_INCOMING_READ_BUF_SIZE);
+
+        if (!incoming->read_buf)
+        {
+            g_critical("OOM, falling back to reading one message at a time");
+            return _LSTransportReceiveClientMessages(client);
+        }
+    }
+
+    while (1)
+    {
+        int ret = 0;
+        char *data = incoming->read_buf + incoming->read_buf_start;
+        unsigned long data_len = incoming->read_buf_end - incoming->read_buf_start;
+
+        if (incoming->tmp_msg)
+        {
+            /* copy as much of the body as we have */
+            unsigned long body_remaining = _LSTransportMessageGetBodySize(incoming->tmp_msg) - incoming->tmp_msg_offset;
+            unsigned long copy_len = MIN(body_remaining, data_len);
+
+            memcpy(incoming->tmp_msg->raw->data + incoming->tmp_msg_offset, data, copy_len);
+            incoming->tmp_msg_offset += copy_len;
+            incoming->read_buf_start += copy_len;
+            body_remaining -= copy_len;
+
+            if (body_remaining == 0)
+            {
+                bool complete = true;
+
+                if (_LSTransportMessageIsConnectionFdType(incoming->tmp_msg))
+                {
+                    /* the fd marker byte follows the body; if it's not here
+                     * yet, read more */
+                    complete = (incoming->read_buf_start < incoming->read_buf_end);
+
+                    if (complete)
+                    {
+                        int recv_fd = -1;
+
+                        /* see _LSTransportSendFd() -- zero means an fd was sent
+                         * with the marker */
+                        if (incoming->read_buf[incoming->read_buf_start] == 0)
+                        {
+                            if (!incoming->read_fds || g_queue_is_empty(incoming->read_fds))
+                            {
+                                g_critical("%s: expected an fd with message (type: %d) from client: %p",
+                                           __func__, (int)_LSTransportMessageGetType(incoming->tmp_msg), client);
+                            }
+                            else
+                            {
+                                recv_fd = GPOINTER_TO_INT(g_queue_pop_head(incoming->read_fds));
+                            }
+                        }
+
+                        incoming->read_buf_start++;
+                        _LSTransportMessageSetConnectionFd(incoming->tmp_msg, recv_fd);
+                    }
+                }
+
+                if (complete)
+                {
+                    _LSTransportIncomingPushMessage(client, incoming->tmp_msg);
+                    incoming->tmp_msg = NULL;
+                    incoming->tmp_msg_offset = 0;
+                    continue;
+                }
+
+                /* re-read the (now empty) buffer position */
+                data = incoming->read_buf + incoming->read_buf_start;
+                data_len = 0;
+            }
+
+            /* the read buffer is empty; read large bodies in place to
+             * avoid copying them twice */
+            if (body_remaining >= LS_TRANSPORT_INCOMING_READ_BUF_SIZE)
+            {
+                ret = recv(client->channel.fd, incoming->tmp_msg->raw->data + incoming->tmp_msg_offset, body_remaining, MSG_DONTWAIT);
+
+                if (ret <= 0)
+                {
+                    shutdown = _LSTransportRecvIsShutdown(client, ret);
+                    break;
+                }
+
+                incoming->tmp_msg_offset += ret;
+                continue;
+            }
+        }
+        else if (data_len >= sizeof(_LSTransportHeader))
+        {
+            /* header may not be aligned in the buffer */
+            _LSTransportHeader header;
+            memcpy(&header, data, sizeof(header));
+
+            if (header.len > MAX_MESSAGE_SIZE_BYTES)
+            {
+                const _LSTransportCred *cred = _LSTransportClientGetCred(client);
+                g_critical("Received message of size %ld bytes; shutting down client "
+                           "(service name: \"%s\", unique name: \"%s\", "
+                           "pid: "LS_PID_PRINTF_FORMAT", "
+                           "exe: \"%s\", cmdline: \"%s\")",
+                            header.len,
+                            _LSTransportClientGetServiceName(client),
+                            _LSTransportClientGetUniqueName(client),
+                            LS_PID_PRINTF_CAST(_LSTransportCredGetPid(cred)),
+                            _LSTransportCredGetExePath(cred),
+                            _LSTransportCredGetCmdLine(cred));
+                shutdown = true;
+                break;
+            }
+
+            incoming->tmp_msg = _LSTransportMessageNewRef(header.len);
+
+            if (!incoming->tmp_msg)
+            {
+                /* Not much we can do except give up and attempt to
+                 * process any messages that we've already allocated */
+                g_critical("Out of memory");
+                break; 
+            }
+
+            _LSTransportMessageSetHeader(incoming->tmp_msg, &header);
+            _LSTransportMessageSetClient(incoming->tmp_msg, client);
+
+            incoming->read_buf_start += sizeof(header);
+            incoming->tmp_msg_offset = 0;
+            continue;
+        }
+
+        /* need more data; move any partial header to the front of the
+         * buffer and read in another chunk */
+        if (incoming->read_buf_start > 0)
+        {
+            memmove(incoming->read_buf, data, data_len);
+            incoming->read_buf_start = 0;
+            incoming->read_buf_end = data_len;
+        }
+
+        LS_ASSERT(incoming->read_buf_end < LS_TRANSPORT_INCOMING_READ_BUF_SIZE);
+
+        /* fds passed with messages (see _LSTransportSendFd()) arrive as
+         * ancillary data; the kernel never merges data carrying fds with
+         * data after it, so there is at most one fd per read */
+        char cmsg_buf[FD_CMSG_SPACE];
+        struct iovec iov;
+        struct msghdr msg;
+
+        iov.iov_base = incoming->read_buf + incoming->read_buf_end;
+        iov.iov_len = LS_TRANSPORT_INCOMING_READ_BUF_SIZE - incoming->read_buf_end;
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = cmsg_buf;
+        msg.msg_controllen = sizeof(cmsg_buf);
+
+        ret = recvmsg(client->channel.fd, &msg, MSG_DONTWAIT);
+
+        if (ret <= 0)
+        {
+            shutdown = _LSTransportRecvIsShutdown(client, ret);
+            break;
+        }
+
+        struct cmsghdr *cmsg = NULL;
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+                cmsg->cmsg_len == FD_CMSG_LEN)
+            {
+                int *cmsg_data = (int*)CMSG_DATA(cmsg);
+
+                if (!incoming->read_fds)
+                {
+                    incoming->read_fds = g_queue_new();
+                }
+
+                g_queue_push_tail(incoming->read_fds, GINT_TO_POINTER(*cmsg_data));
+            }
+        }
+
+        incoming->read_buf_end += ret;
+    }
+
+    return shutdown;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Called when watch indicates that there is data to be read from a
+ * channel. This function does non-blocking reads of the incoming data and
+ * processes the complete messages.
+ * 
+ * @param  source       IN  io source
+ * @param  condition    IN  condition that triggered this callback 
+ * @param  data         IN  client 
+ * 
+ * @retval TRUE when client is still alive
+ * @retval FALSE when client goes away so that this watch is removed
+ *******************************************************************************
+ */
+gboolean
+_LSTransportReceiveClient(GIOChannel *source, GIOCondition condition,
+                         gpointer data)
+{
+    LSError lserror;
+    LSErrorInit(&lserror);
+
+    _LSTransportClient *client = (_LSTransportClient*)data;
+
+    _ls_verbose("%s: client: %p\n", __func__, client);
+
+    /* we're using the client's incoming buffer, so ref it */
+    _LSTransportClientRef(client);
+    
+    bool shutdown = false;
+    
+    /* 
+     * TODO: limit the number of messages that we queue up before processing
+     * them. We don't want to starve other parts of the program's operation
+     * and we don't want to use too much memory; this should be configurable
+     */
+
+    /* TODO: review locking */
+
+    //INCOMING_LOCK(&incoming->lock);
+
+    if (_LSTransportClientCanReadAhead(client))
+    {
+        shutdown = _LSTransportReceiveClientBuffered(client);
+    }
+    else
+    {
+        shutdown = _LSTransportReceiveClientMessages(client);
+    }
+
+    /* 
+     * Call the callbacks for methods and filter function callbacks for replies
+     * TODO: should this be done in another callback (idle handler?)
+
+     * <eeh> probably.  You want watch callbacks to return quickly.  But you
+     * don't want heavy network activity to starve message handlers either.
+     * Can you schedule the incomming queue to be processed in the main loop
+     * at a higher priority than idle?  Caveate: if this function and the one
+     * to process the queue have to hold the same mutex then they're going to
+     * starve one another anyway.  To avoid that you'd have to allow
+     * _LSTransportProcessIncomingMessages to return without emptying the
+     * queue and then reschedule it.  Maybe leave things alone but be aware
+     * when evaluating bug reports and performance data that this could be an
+     * issue.
+     */
+
+    //INCOMING_UNLOCK(&incoming->lock);
+
+    if (shutdown && client->incoming_parked)
+    {
+        /* process what the client sent before it went away instead of
+         * leaving it parked */
+        _LSTransportCredWaitResolved(client->cred);
+    }
 
     if (!_LSTransportProcessIncomingMessages(client, &lserror))
     {
@@ -3593,13 +5096,90 @@ _LSTransportReceiveClient(GIOChannel *source, GIOCondition condition,
     }
 }
 
+/** 
+ *******************************************************************************
+ * @brief Set up a client for a new incoming connection and start
+ * receiving from it.
+ * 
+ * @param  bus          IN  bus the connection is on
+ * @param  fd           IN  connected fd (the new client owns it)
+ *******************************************************************************
+ */
+static void
+_LSTransportAddIncomingClient(_LSTransportBus *bus, int fd)
+{
+    _LSTransport *transport = bus->transport;
+
+    /* Create a new io channel and add to mainloop */
+    _LSTransportClient *new_client = _LSTransportClientNewRef(bus, fd, NULL, NULL, NULL, false);
+    if (new_client)
+    {
+        _ls_verbose("%s: new_client: %p\n", __func__, new_client);
+        
+        /* client ref +1 (total = 1) */
+
+        TRANSPORT_LOCK(&transport->lock);
+        /* client ref +1 (total = 2) */
+        _LSTransportAddAllConnectionHash(transport, new_client);
+        TRANSPORT_UNLOCK(&transport->lock);
+
+        if (transport->shards)
+        {
+            /* this connection's I/O happens on one of the I/O threads */
+            new_client->channel.context = _LSTransportShardsNext(transport->shards);
+        }
+
+        /* TODO: maybe ref the client again here */
+        _LSTransportAddReceiveWatch(&new_client->channel, transport->mainloop_context, new_client);
+       
+        /* client ref -1 (total = 1) */
+        _ls_verbose("%s: unref'ing\n", __func__);
+        _LSTransportClientUnref(new_client);
+    }
+}
+
+/** 
+ *******************************************************************************
+ * @brief Handle a connection handed to us by the hub. This is the same as
+ * a client connecting to our listening socket, except that the hub made
+ * the connection with socketpair() instead of making the client connect().
+ * 
+ * @param  message  IN  incoming connection message with connection fd set
+ *******************************************************************************
+ */
+static void
+_LSTransportHandleIncomingConnection(_LSTransportMessage *message)
+{
+    _LSTransportClient *client = _LSTransportMessageGetClient(message);
+    _LSTransportBus *bus = _LSTransportClientGetBus(client);
+    int fd = _LSTransportMessageGetConnectionFd(message);
+
+    /* the connection is on the bus of the hub that made it */
+    if (client != bus->hub)
+    {
+        g_critical("%s: ignoring incoming connection that didn't come from the hub", __func__);
+        return;
+    }
+
+    if (fd == -1)
+    {
+        g_critical("%s: incoming connection without an fd", __func__);
+        return;
+    }
+
+    /* the new client owns the fd now */
+    _LSTransportMessageSetConnectionFd(message, -1);
+
+    _LSTransportAddIncomingClient(bus, fd);
+}
+
 /** 
  *******************************************************************************
  * @brief Callback to accept incoming connections.
  * 
  * @param  source       IN  io source 
  * @param  condition    IN  condition that triggered callback 
- * @param  data         IN  transport 
+ * @param  data         IN  bus the listen channel belongs to 
  * 
  * @retval TRUE always
  *******************************************************************************
@@ -3608,7 +5188,7 @@ gboolean
 _LSTransportAcceptConnection(GIOChannel *source, GIOCondition condition,
                              gpointer data)
 {
-    _LSTransport *transport = (_LSTransport*)data;
+    _LSTransportBus *bus = (_LSTransportBus*)data;
     struct sockaddr_un client_addr;
 
     /* Call accept to accept the connection */
@@ -3628,26 +5208,7 @@ _LSTransportAcceptConnection(GIOChannel *source, GIOCondition condition,
         }
         else
         {
-            /* Create a new io channel and add to mainloop */
-            _LSTransportClient *new_client = _LSTransportClientNewRef(transport, fd, NULL, NULL, NULL, false);
-            if (new_client)
-            {
-                _ls_verbose("%s: new_client: %p\n", __func__, new_client);
-                
-                /* client ref +1 (total = 1) */
-
-                TRANSPORT_LOCK(&transport->lock);
-                /* client ref +1 (total = 2) */
-                _LSTransportAddAllConnectionHash(transport, new_client);
-                TRANSPORT_UNLOCK(&transport->lock);
-
-                /* TODO: maybe ref the client again here */
-                _LSTransportAddReceiveWatch(&new_client->channel, transport->mainloop_context, new_client);
-               
-                /* client ref -1 (total = 1) */
-                _ls_verbose("%s: unref'ing\n", __func__);
-                _LSTransportClientUnref(new_client);
-            }
+            _LSTransportAddIncomingClient(bus, fd);
         }
     }
     else
@@ -3659,6 +5220,31 @@ _LSTransportAcceptConnection(GIOChannel *source, GIOCondition condition,
     return TRUE;    /* FALSE means this source should be removed */
 }
 
+/** 
+ *******************************************************************************
+ * @brief Tell the transport user that a destination became congested or
+ * drained, if its outgoing queue's congestion state changed since the last
+ * time.
+ *
+ * @attention The outgoing lock must NOT be held, since the callback may well
+ * send more messages.
+ * 
+ * @param  client       IN  client 
+ * @param  changed      IN  result of @ref _LSTransportOutgoingTakeCongestionChange
+ * @param  congested    IN  congestion state it returned
+ *******************************************************************************
+ */
+static inline void
+_LSTransportFlowControlNotify(_LSTransportClient *client, bool changed, bool congested)
+{
+    _LSTransportBus *bus = client->bus;
+
+    if (changed && bus->flow_control_handler)
+    {
+        bus->flow_control_handler(client, congested, bus->flow_control_context);
+    }
+}
+
 /** 
  *******************************************************************************
  * @brief Send a message that has been constructed as an io vector.
@@ -3687,6 +5273,9 @@ _LSTransportSendVector(const struct iovec *iov, int iovcnt, unsigned long total_
     //int i = 0;
     int bytes_written = 0;
 
+    const _LSTransportHeader *header = iov[0].iov_base;
+    LS_TRACE(_LSTracePointSend, LS_TRANSPORT_HEADER_GET_TYPE(header), header->token, header->len);
+
     _ls_verbose("%s: client: %p\n", __func__, client);
 
     /* If there is anything in the queue, we can't do a fast send
@@ -3739,9 +5328,12 @@ _LSTransportSendVector(const struct iovec *iov, int iovcnt, unsigned long total_
         {
             //_LSTransportHeader *header = (_LSTransportHeader*)iov[0].iov_base;
             //printf("writev: sent message: token %d, type: %d, len: %d\n", (int)header->token, (int)header->type, (int)header->len);
+            _LSTransportOutgoingDirectSent(client->outgoing, total_len);
             OUTGOING_UNLOCK(&client->outgoing->lock);
             return true;
         }
+
+        _LSTransportClientSocketFull(client);
     }
     
     /* either we don't send all the data or there is data on the queue, 
@@ -3771,10 +5363,15 @@ _LSTransportSendVector(const struct iovec *iov, int iovcnt, unsigned long total_
         }
     }
 
-    g_queue_push_tail(client->outgoing->queue, message);
+    _LSTransportOutgoingPush(client->outgoing, message, false);
+
+    bool congested = false;
+    bool congestion_changed = _LSTransportOutgoingTakeCongestionChange(client->outgoing, &congested);
     
     OUTGOING_UNLOCK(&client->outgoing->lock);
 
+    _LSTransportFlowControlNotify(client, congestion_changed, congested);
+
     return true;
 }
 
@@ -3806,6 +5403,9 @@ _LSTransportSendVectorRet(const struct iovec *iov, int iovcnt, unsigned long tot
     //int i = 0;
     int bytes_written = 0;
 
+    const _LSTransportHeader *header = iov[0].iov_base;
+    LS_TRACE(_LSTracePointSend, LS_TRANSPORT_HEADER_GET_TYPE(header), header->token, header->len);
+
     _ls_verbose("%s: client: %p\n", __func__, client);
 
     /* If there is anything in the queue, we can't do a fast send
@@ -3870,9 +5470,13 @@ _LSTransportSendVectorRet(const struct iovec *iov, int iovcnt, unsigned long tot
         {
             //_LSTransportHeader *header = (_LSTransportHeader*)iov[0].iov_base;
             //printf("writev: sent message: token %d, type: %d, len: %d\n", (int)header->token, (int)header->type, (int)header->len);
+            message->tx_bytes_remaining = 0;
+            _LSTransportOutgoingDirectSent(client->outgoing, total_len);
             OUTGOING_UNLOCK(&client->outgoing->lock);
             return message;
         }
+
+        _LSTransportClientSocketFull(client);
     }
     
     message->tx_bytes_remaining -= bytes_written;
@@ -3890,10 +5494,15 @@ _LSTransportSendVectorRet(const struct iovec *iov, int iovcnt, unsigned long tot
     }
 
     _LSTransportMessageRef(message);
-    g_queue_push_tail(client->outgoing->queue, message);
+    _LSTransportOutgoingPush(client->outgoing, message, false);
+
+    bool congested = false;
+    bool congestion_changed = _LSTransportOutgoingTakeCongestionChange(client->outgoing, &congested);
     
     OUTGOING_UNLOCK(&client->outgoing->lock);
 
+    _LSTransportFlowControlNotify(client, congestion_changed, congested);
+
     return message;
 }
 
@@ -3918,12 +5527,12 @@ _LSTransportSendMessageMonitor(_LSTransportMessage *message, _LSTransportClient
     bool ret = true;
     
     /* Get a serial number from the shared memory area (global serial) */
-    _LSTransportMonitorSerial monitor_serial = _LSTransportShmGetSerial(client->transport->shm);
+    _LSTransportMonitorSerial monitor_serial = _LSTransportShmGetSerial(client->bus->shm);
     unsigned long monitor_serial_size = sizeof(_LSTransportMonitorSerial);
 
     /* do the message copy and add the destination info */
     char nul = '\0';
-    unsigned long orig_msg_size = _LSTransportMessageGetBodySize(message);
+    unsigned long orig_msg_size = _LSTransportMessageGetCopyBodySize(message);
     const char *dest_service_name = client->service_name;
     const char *dest_unique_name = client->unique_name;
     unsigned long dest_service_name_len = strlen_safe(client->service_name) + 1;
@@ -3947,6 +5556,14 @@ _LSTransportSendMessageMonitor(_LSTransportMessage *message, _LSTransportClient
     {
         _LSTransportMessageCopy(monitor_message, message);
 
+        /* a received payload segment is copied inline, but the segment of
+         * a shm method call we're sending isn't passed on, so the monitor
+         * just sees the inline (empty) payload */
+        if (_LSTransportMessageGetType(monitor_message) == _LSTransportMessageTypeMethodCallShm)
+        {
+            _LSTransportMessageSetType(monitor_message, _LSTransportMessageTypeMethodCall);
+        }
+
         char *body = _LSTransportMessageGetBody(monitor_message);
         body += orig_msg_size;
         memcpy(body, dest_service_name, dest_service_name_len);
@@ -3959,7 +5576,7 @@ _LSTransportSendMessageMonitor(_LSTransportMessage *message, _LSTransportClient
 
         memcpy(body, &monitor_serial, monitor_serial_size);
 
-        if (!_LSTransportSendMessageRaw(monitor_message, client->transport->monitor, false, NULL, false, NULL))
+        if (!_LSTransportSendMessageRaw(monitor_message, client->bus->monitor, false, NULL, false, NULL))
         {
             ret = false;
         }
@@ -3974,7 +5591,11 @@ _LSTransportSendMessageMonitor(_LSTransportMessage *message, _LSTransportClient
  * @brief Send a "MonitorRequest" message, which is sent from the monitor to
  * the hub so that the hub can tell all the clients to connect to the monitor.
  * 
- * @param  transport    IN   transport 
+ * @param  bus          IN   bus
+ * @param  names        IN   comma-separated service/unique name globs that
+ *                           clients should mirror, NULL for all
+ * @param  types        IN   LS_TRANSPORT_MONITOR_TYPE_* mask, 0 for all
+ * @param  sample_rate  IN   mirror 1 in sample_rate calls, <= 1 for all
  * @param  lserror      OUT  set on error 
  * 
  * @retval true on success
@@ -3982,12 +5603,14 @@ _LSTransportSendMessageMonitor(_LSTransportMessage *message, _LSTransportClient
  *******************************************************************************
  */
 bool
-LSTransportSendMessageMonitorRequest(_LSTransport *transport, LSError *lserror)
+LSTransportSendMessageMonitorRequest(_LSTransportBus *bus, const char *names, int32_t types, int32_t sample_rate, LSError *lserror)
 {
-    LS_ASSERT(transport != NULL);
-    LS_ASSERT(transport->hub != NULL);
+    LS_ASSERT(bus != NULL);
+    LS_ASSERT(bus->hub != NULL);
 
-    _LSTransportMessage *message = _LSTransportMessageNewRef(0);
+    _LSTransportMessageIter iter;
+
+    _LSTransportMessage *message = _LSTransportMessageNewRef(LS_TRANSPORT_MESSAGE_DEFAULT_PAYLOAD_SIZE);
 
     if (!message)
     {
@@ -3997,15 +5620,25 @@ LSTransportSendMessageMonitorRequest(_LSTransport *transport, LSError *lserror)
 
     _LSTransportMessageSetType(message, _LSTransportMessageTypeMonitorRequest);
 
-    /* no body for the message */
+    /* the hub passes the filter on to every client */
+    _LSTransportMessageIterInit(message, &iter);
+    if (!_LSTransportMessageAppendString(&iter, names ? names : "")) goto error;
+    if (!_LSTransportMessageAppendInt32(&iter, types)) goto error;
+    if (!_LSTransportMessageAppendInt32(&iter, sample_rate)) goto error;
+    if (!_LSTransportMessageAppendInvalid(&iter)) goto error;
 
     /* send special message to the hub so that it can tell clients
      * to connect */
-    _LSTransportSendMessage(message, transport->hub, NULL, lserror);
+    _LSTransportSendMessage(message, bus->hub, NULL, lserror);
 
     _LSTransportMessageUnref(message);
 
     return true;
+
+error:
+    _LSTransportMessageUnref(message);
+    _LSErrorSetOOM(lserror);
+    return false;
 }
 
 /** 
@@ -4020,10 +5653,10 @@ LSTransportSendMessageMonitorRequest(_LSTransport *transport, LSError *lserror)
  *******************************************************************************
  */
 bool
-_LSTransportSendMessageListClients(_LSTransport *transport, LSError *lserror)
+_LSTransportSendMessageListClients(_LSTransportBus *bus, LSError *lserror)
 {
-    LS_ASSERT(transport != NULL);
-    LS_ASSERT(transport->hub != NULL);
+    LS_ASSERT(bus != NULL);
+    LS_ASSERT(bus->hub != NULL);
 
     bool ret = false;
 
@@ -4039,44 +5672,82 @@ _LSTransportSendMessageListClients(_LSTransport *transport, LSError *lserror)
 
     /* no body for message */
 
-    ret = _LSTransportSendMessage(message, transport->hub, NULL, lserror);
+    ret = _LSTransportSendMessage(message, bus->hub, NULL, lserror);
 
     _LSTransportMessageUnref(message);
 
     return ret;
 }
 
-
 /** 
  *******************************************************************************
- * @brief  Process a "ClientInfo" message. This message is used to know who
- * has connected to us.
+ * @brief Send a message to the hub requesting its statistics.
  * 
- * @param  message  IN  client info message 
+ * @param  transport    IN  transport connected to the hub 
+ * @param  lserror      OUT set on error 
+ * 
+ * @retval  true on success
+ * @retval  false on failure
  *******************************************************************************
  */
-static void
-_LSTransportHandleClientInfo(_LSTransportMessage *message)
+bool
+_LSTransportSendMessageHubStats(_LSTransportBus *bus, LSError *lserror)
 {
-    LS_ASSERT(message != NULL);
-
-    _LSTransportMessageIter iter;
-    const char *service_name = NULL;
-    const char *unique_name = NULL;
+    LS_ASSERT(bus != NULL);
+    LS_ASSERT(bus->hub != NULL);
 
-    _LSTransportClient *client = _LSTransportMessageGetClient(message);
-    
-    LS_ASSERT(client->service_name == NULL);
-    LS_ASSERT(client->unique_name == NULL);
+    bool ret = false;
 
-    _LSTransportMessageIterInit(message, &iter);
+    _LSTransportMessage *message = _LSTransportMessageNewRef(0);
 
-    _LSTransportMessageGetString(&iter, &service_name);
-    if (service_name)
+    if (!message)
     {
-        client->service_name = g_strdup(service_name);
-        if (!client->service_name)
-        {
+        _LSErrorSet(lserror, -ENOMEM, "OOM");
+        return false;
+    }
+
+    _LSTransportMessageSetType(message, _LSTransportMessageTypeHubStats);
+
+    /* no body for message */
+
+    ret = _LSTransportSendMessage(message, bus->hub, NULL, lserror);
+
+    _LSTransportMessageUnref(message);
+
+    return ret;
+}
+
+
+/** 
+ *******************************************************************************
+ * @brief  Process a "ClientInfo" message. This message is used to know who
+ * has connected to us.
+ * 
+ * @param  message  IN  client info message 
+ *******************************************************************************
+ */
+static void
+_LSTransportHandleClientInfo(_LSTransportMessage *message)
+{
+    LS_ASSERT(message != NULL);
+
+    _LSTransportMessageIter iter;
+    const char *service_name = NULL;
+    const char *unique_name = NULL;
+
+    _LSTransportClient *client = _LSTransportMessageGetClient(message);
+    
+    LS_ASSERT(client->service_name == NULL);
+    LS_ASSERT(client->unique_name == NULL);
+
+    _LSTransportMessageIterInit(message, &iter);
+
+    _LSTransportMessageGetString(&iter, &service_name);
+    if (service_name)
+    {
+        client->service_name = g_strdup(service_name);
+        if (!client->service_name)
+        {
             g_critical("OOM");
         }
     }
@@ -4093,7 +5764,99 @@ _LSTransportHandleClientInfo(_LSTransportMessage *message)
         }
     }
 
-    _ls_verbose("%s: client: %p, service_name: %s, unique_name: %s\n", __func__, client, client->service_name, client->unique_name);
+    /* capabilities are optional; older versions didn't send them */
+    _LSTransportMessageIterNext(&iter);
+
+    int32_t caps = 0;
+    if (_LSTransportMessageGetInt32(&iter, &caps))
+    {
+        client->peer_caps = caps & LS_TRANSPORT_CAPS;
+
+        /* let the other side know what we support, but only if it will
+         * understand the message */
+        LSError lserror;
+        LSErrorInit(&lserror);
+
+        if (!_LSTransportSendMessageCapabilities(client, &lserror))
+        {
+            LSErrorPrint(&lserror, stderr);
+            LSErrorFree(&lserror);
+        }
+    }
+
+    _ls_verbose("%s: client: %p, service_name: %s, unique_name: %s, peer_caps: 0x%x\n", __func__, client, client->service_name, client->unique_name, client->peer_caps);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Process a "Capabilities" message, which is the reply to the
+ * capabilities we sent in our "ClientInfo".
+ * 
+ * @param  message  IN  capabilities message 
+ *******************************************************************************
+ */
+static void
+_LSTransportHandleCapabilities(_LSTransportMessage *message)
+{
+    LS_ASSERT(message != NULL);
+
+    _LSTransportMessageIter iter;
+    int32_t caps = 0;
+
+    _LSTransportClient *client = _LSTransportMessageGetClient(message);
+
+    _LSTransportMessageIterInit(message, &iter);
+
+    if (_LSTransportMessageGetInt32(&iter, &caps))
+    {
+        client->peer_caps = caps & LS_TRANSPORT_CAPS;
+    }
+
+    _ls_verbose("%s: client: %p, peer_caps: 0x%x\n", __func__, client, client->peer_caps);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Send a "Capabilities" message with the capabilities that we
+ * support.
+ * 
+ * @param  client   IN  destination client 
+ * @param  lserror  OUT set on error 
+ * 
+ * @retval  true on success
+ * @retval  false on failure
+ *******************************************************************************
+ */
+static bool
+_LSTransportSendMessageCapabilities(_LSTransportClient *client, LSError *lserror)
+{
+    bool ret = false;
+    _LSTransportMessageIter iter;
+
+    _LSTransportMessage *message = _LSTransportMessageNewRef(sizeof(int32_t));
+
+    if (!message)
+    {
+        _LSErrorSetOOM(lserror);
+        return false;
+    }
+
+    _LSTransportMessageSetType(message, _LSTransportMessageTypeCapabilities);
+
+    _LSTransportMessageIterInit(message, &iter);
+    if (!_LSTransportMessageAppendInt32(&iter, LS_TRANSPORT_CAPS)) goto error;
+    if (!_LSTransportMessageAppendInvalid(&iter)) goto error;
+
+    ret = _LSTransportSendMessage(message, client, NULL, lserror);
+
+    _LSTransportMessageUnref(message);
+
+    return ret;
+
+error:
+    _LSErrorSetOOM(lserror);
+    _LSTransportMessageUnref(message);
+    return false;
 }
 
 /** 
@@ -4148,6 +5911,7 @@ _LSTransportMessageClientInfoNewRef(const char *service_name, const char *unique
     _LSTransportMessageIterInit(message, &iter);
     if (!_LSTransportMessageAppendString(&iter, service_name)) goto error;
     if (!_LSTransportMessageAppendString(&iter, unique_name)) goto error;
+    if (!_LSTransportMessageAppendInt32(&iter, LS_TRANSPORT_CAPS)) goto error;
     if (!_LSTransportMessageAppendInvalid(&iter)) goto error;
     
     return message;
@@ -4249,6 +6013,30 @@ _LSTransportSendMessageNodeUp(_LSTransportClient *client, LSError *lserror)
     return true;
 }
 
+/** 
+ *******************************************************************************
+ * @brief Check whether a message body of the given size should be
+ * compressed when it's sent to a client.
+ * 
+ * @param  client       IN  client 
+ * @param  body_size    IN  size of message body 
+ * 
+ * @retval  true if it should be compressed
+ * @retval  false otherwise
+ *******************************************************************************
+ */
+static inline bool
+_LSTransportShouldCompress(const _LSTransportClient *client, unsigned long body_size)
+{
+    /* the thresholds are only read here, so a racing update just applies
+     * to the next message */
+    unsigned long threshold = (client->bus->type == _LSTransportTypeInet)
+                              ? client->transport->compress_threshold_inet
+                              : client->transport->compress_threshold_local;
+
+    return threshold && body_size >= threshold && (client->peer_caps & LS_TRANSPORT_CAP_COMPRESSION);
+}
+
 /** 
  *******************************************************************************
  * @brief Underlying message sending function.
@@ -4285,7 +6073,7 @@ _LSTransportSendMessageRaw(_LSTransportMessage *message, _LSTransportClient *cli
      */
     if (set_token)
     {
-        /* give it a serial number -- LOCKS serial lock */
+        /* give it a serial number */
         _LSTransportMessageSetToken(message, _LSTransportGetNextToken(client->transport));
 
         if (token)
@@ -4294,6 +6082,14 @@ _LSTransportSendMessageRaw(_LSTransportMessage *message, _LSTransportClient *cli
         }
     }
 
+    LS_TRACE_MESSAGE(_LSTracePointSend, message);
+
+    /* after the token is set, since the header is part of what's sent */
+    if (_LSTransportShouldCompress(client, message->raw->header.len))
+    {
+        _LSTransportMessageCompress(message);
+    }
+
     /* TODO: lock the hash table of queues as well? (or only that?) */
     OUTGOING_LOCK(&client->outgoing->lock);
 
@@ -4346,14 +6142,20 @@ _LSTransportSendMessageRaw(_LSTransportMessage *message, _LSTransportClient *cli
          * by a caller. In our current usage, that means that we would break
          * the callmap lookups for a message.
          */    
-        g_queue_push_head(client->outgoing->queue, message);
+        _LSTransportOutgoingPush(client->outgoing, message, true);
     }
-    else
+    else if (!message->tx_coalesce || !_LSTransportOutgoingCoalesce(client->outgoing, message))
     {
-        g_queue_push_tail(client->outgoing->queue, message);
+        _LSTransportOutgoingPush(client->outgoing, message, false);
     }
+
+    bool congested = false;
+    bool congestion_changed = _LSTransportOutgoingTakeCongestionChange(client->outgoing, &congested);
+
     OUTGOING_UNLOCK(&client->outgoing->lock);
 
+    _LSTransportFlowControlNotify(client, congestion_changed, congested);
+
     return true;
 }
 
@@ -4378,9 +6180,9 @@ _LSTransportSendMessage(_LSTransportMessage *message, _LSTransportClient *client
     bool ret = _LSTransportSendMessageRaw(message, client, true, token, false, lserror);
 
     /* MONITOR */
-    if (client->transport->monitor)
+    if (client->bus->monitor)
     {
-        if (_LSTransportMessageIsMonitorType(message))
+        if (_LSTransportMessageIsMonitorType(message) && _LSTransportMonitorWantsMessage(message, client))
         {
             _LSTransportSendMessageMonitor(message, client, lserror);
         }
@@ -4393,24 +6195,28 @@ _LSTransportSendMessage(_LSTransportMessage *message, _LSTransportClient *client
  *******************************************************************************
  * @brief Underlying message reply implementation.
  * 
- * @param  message  IN  message to reply to 
- * @param  type     IN  reply type 
- * @param  payload  IN  payload 
- * @param  lserror  OUT set on error 
+ * @param  message      IN  message to reply to 
+ * @param  type         IN  reply type 
+ * @param  payload      IN  payload (nul-terminated at payload_len)
+ * @param  payload_len  IN  length of payload, not including the nul
+ * @param  binary       IN  true if payload is binary encoded
+ * @param  lserror      OUT set on error 
  * 
  * @retval  true on success
  * @retval  false on failure
  *******************************************************************************
  */
 static bool
-_LSTransportSendReplyRaw(const _LSTransportMessage *message, _LSTransportMessageType type, const char *payload, LSError *lserror)
+_LSTransportSendReplyRaw(const _LSTransportMessage *message, _LSTransportMessageType type,
+                         const char *payload, unsigned long payload_len, bool binary, LSError *lserror)
 {
     LS_ASSERT(_LSTransportMessageTypeIsReplyType(type));
+    LS_ASSERT(payload[payload_len] == '\0');
 
     /* TODO: use vector send */
 
     /* construct the reply message */
-    unsigned long payload_size = strlen(payload) + 1;
+    unsigned long payload_size = payload_len + 1;
 
     _LSTransportMessage *reply = _LSTransportMessageNewRef(payload_size + sizeof(LSMessageToken));
 
@@ -4432,7 +6238,20 @@ _LSTransportSendReplyRaw(const _LSTransportMessage *message, _LSTransportMessage
     offset += sizeof(LSMessageToken);
     memcpy(body + offset, payload, payload_size);
 
-    _ls_verbose("sending reply reply_token %d, type: %d, len: %d\n", (int)msg_token, (int)reply->raw->header.type, (int)reply->raw->header.len);
+    reply->tx_priority = message->reply_priority;
+
+    if (message->client->peer_caps & LS_TRANSPORT_CAP_HEADER_FLAGS)
+    {
+        reply->raw->header.type |= message->reply_flags;
+    }
+
+    if (binary)
+    {
+        /* only sent to peers with LS_TRANSPORT_CAP_BINARY_PAYLOAD */
+        reply->raw->header.type |= LS_TRANSPORT_HEADER_FLAG_BINARY_PAYLOAD;
+    }
+
+    _ls_verbose("sending reply reply_token %d, type: %d, len: %d\n", (int)msg_token, (int)_LSTransportMessageGetType(reply), (int)reply->raw->header.len);
 
     _LSTransportSendMessage(reply, message->client, NULL, NULL);
    
@@ -4459,7 +6278,7 @@ _LSTransportSendErrorReply(const _LSTransportMessage *message, _LSTransportMessa
 {
     LS_ASSERT(_LSTransportMessageTypeIsErrorType(error_type));
 
-    return _LSTransportSendReplyRaw(message, error_type, error_msg, lserror);
+    return _LSTransportSendReplyRaw(message, error_type, error_msg, strlen(error_msg), false, lserror);
 }
 
 /** 
@@ -4477,14 +6296,152 @@ _LSTransportSendErrorReply(const _LSTransportMessage *message, _LSTransportMessa
 bool
 _LSTransportSendReply(const _LSTransportMessage *message, const char *payload, LSError *lserror)
 {
-    return _LSTransportSendReplyRaw(message, _LSTransportMessageTypeReply, payload, lserror);
+    return _LSTransportSendReplyRaw(message, _LSTransportMessageTypeReply, payload, strlen(payload), false, lserror);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Send a reply to a message when the length of the payload is
+ * already known, so it doesn't have to be scanned for again.
+ * 
+ * @param  message      IN  message to reply to 
+ * @param  payload      IN  payload to send (nul-terminated at payload_len)
+ * @param  payload_len  IN  length of payload, not including the nul
+ * @param  lserror      OUT set on error 
+ * 
+ * @retval  true on success
+ * @retval  false on failure
+ *******************************************************************************
+ */
+bool
+_LSTransportSendReplyWithLen(const _LSTransportMessage *message, const char *payload,
+                             unsigned long payload_len, LSError *lserror)
+{
+    return _LSTransportSendReplyRaw(message, _LSTransportMessageTypeReply, payload, payload_len, false, lserror);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Send a reply with a binary encoded payload (see binary_payload.c).
+ * If the client that sent the message can't receive binary payloads, the
+ * reply is converted to JSON first.
+ * 
+ * @param  message      IN  message to reply to 
+ * @param  payload      IN  binary encoded payload (nul-terminated at payload_len)
+ * @param  payload_len  IN  length of payload, not including the nul
+ * @param  lserror      OUT set on error 
+ * 
+ * @retval  true on success
+ * @retval  false on failure
+ *******************************************************************************
+ */
+bool
+_LSTransportSendReplyBinary(const _LSTransportMessage *message, const char *payload,
+                            unsigned long payload_len, LSError *lserror)
+{
+    if (message->client->peer_caps & LS_TRANSPORT_CAP_BINARY_PAYLOAD)
+    {
+        return _LSTransportSendReplyRaw(message, _LSTransportMessageTypeReply, payload, payload_len, true, lserror);
+    }
+
+    unsigned long json_len = 0;
+    char *json = _LSBinaryPayloadDecodeToJson(payload, payload_len, &json_len);
+
+    if (!json)
+    {
+        _LSErrorSet(lserror, -EINVAL, "Invalid binary payload");
+        return false;
+    }
+
+    bool ret = _LSTransportSendReplyRaw(message, _LSTransportMessageTypeReply, json, json_len, false, lserror);
+
+    g_free(json);
+
+    return ret;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Send the same reply to many messages. The reply is built once and
+ * its body is shared by the messages queued for each recipient; only the
+ * header and the reply serial are per recipient.
+ * 
+ * @param  messages     IN  messages to reply to
+ * @param  num_messages IN  number of messages
+ * @param  payload      IN  payload to send (nul-terminated at payload_len)
+ * @param  payload_len  IN  length of payload, not including the nul
+ * @param  coalesce     IN  true to replace an older reply to the same message
+ *                          that is still queued for a recipient, rather than
+ *                          queueing behind it
+ * @param  lserror      OUT set on error 
+ * 
+ * @retval  true on success
+ * @retval  false on failure
+ *******************************************************************************
+ */
+bool
+_LSTransportSendReplyShared(_LSTransportMessage * const *messages, int num_messages,
+                            const char *payload, unsigned long payload_len, bool coalesce, LSError *lserror)
+{
+    if (num_messages == 1 && !coalesce)
+    {
+        return _LSTransportSendReplyWithLen(messages[0], payload, payload_len, lserror);
+    }
+
+    LS_ASSERT(payload[payload_len] == '\0');
+
+    unsigned long payload_size = payload_len + 1;
+
+    _LSTransportMessage *reply = _LSTransportMessageNewRef(payload_size + sizeof(LSMessageToken));
+
+    if (!reply)
+    {
+        _LSErrorSetOOM(lserror);
+        return false;
+    }
+
+    _LSTransportMessageSetType(reply, _LSTransportMessageTypeReply);
+
+    /* format: reply_serial (per recipient) + payload */
+    char *body = _LSTransportMessageGetBody(reply);
+    LSMessageToken invalid_token = LSMESSAGE_TOKEN_INVALID;
+
+    memcpy(body, &invalid_token, sizeof(LSMessageToken));
+    memcpy(body + sizeof(LSMessageToken), payload, payload_size);
+
+    bool ret = true;
+    int i;
+
+    for (i = 0; i < num_messages; i++)
+    {
+        _LSTransportMessage *share = _LSTransportMessageShareReplyNewRef(reply, _LSTransportMessageGetToken(messages[i]));
+
+        if (!share)
+        {
+            _LSErrorSetOOM(lserror);
+            ret = false;
+            break;
+        }
+
+        share->tx_coalesce = coalesce;
+        share->tx_priority = messages[i]->reply_priority;
+
+        _ls_verbose("sending shared reply reply_token %d, len: %d\n", (int)_LSTransportMessageGetToken(messages[i]), (int)payload_size);
+
+        _LSTransportSendMessage(share, messages[i]->client, NULL, NULL);
+        _LSTransportMessageUnref(share);
+    }
+
+    _LSTransportMessageUnref(reply);
+
+    return ret;
 }
 
 /** 
  *******************************************************************************
  * @brief Send a "cancel method call" message to the far side.
  * 
- * @param  transport        IN  transport
+ * @param  bus              IN  bus
  * @param  service_name     IN  service name 
  * @param  serial           IN  serial of message to cancel 
  * @param  lserror          OUT set on error 
@@ -4494,7 +6451,7 @@ _LSTransportSendReply(const _LSTransportMessage *message, const char *payload, L
  *******************************************************************************
  */
 bool
-LSTransportCancelMethodCall(_LSTransport *transport, const char *service_name, LSMessageToken serial, LSError *lserror)
+LSTransportCancelMethodCall(_LSTransportBus *bus, const char *service_name, LSMessageToken serial, LSError *lserror)
 {
     /*
      * FIXME: add generic code that can be shared with normal method call sending
@@ -4531,6 +6488,11 @@ LSTransportCancelMethodCall(_LSTransport *transport, const char *service_name, L
 
     _LSTransportMessageSetType(message, _LSTransportMessageTypeCancelMethodCall);
 
+    /* a cancel goes ahead of other traffic, but not ahead of the call
+     * itself if that's still queued */
+    message->tx_priority = _LSTransportPriorityHigh;
+    message->tx_follows = serial;
+
     char *message_body = _LSTransportMessageGetBody(message);
 
     memcpy(message_body, category, category_len);
@@ -4539,7 +6501,7 @@ LSTransportCancelMethodCall(_LSTransport *transport, const char *service_name, L
     message_body += method_len;
     memcpy(message_body, payload, payload_len);
 
-    ret = _LSTransportSendMessageToService(transport, service_name, message, NULL, lserror);
+    ret = _LSTransportSendMessageToService(bus, service_name, message, NULL, lserror);
 
 error:
     if (payload) g_free(payload);
@@ -4556,7 +6518,7 @@ error:
  *
  * The hub will reply with a boolean value of whether the service is up.
  * 
- * @param  transport        IN  transport
+ * @param  bus              IN  bus
  * @param  service_name     IN  service name to check status of
  * @param  serial           OUT serial for this query message 
  * @param  lserror          OUT set on error 
@@ -4566,10 +6528,10 @@ error:
  *******************************************************************************
  */
 bool
-LSTransportSendQueryServiceStatus(_LSTransport *transport, const char *service_name,
+LSTransportSendQueryServiceStatus(_LSTransportBus *bus, const char *service_name,
                                   LSMessageToken *serial, LSError *lserror)
 {
-    LS_ASSERT(transport != NULL);
+    LS_ASSERT(bus != NULL);
     LS_ASSERT(service_name != NULL);
 
     _LSTransportMessageIter iter;
@@ -4584,9 +6546,9 @@ LSTransportSendQueryServiceStatus(_LSTransport *transport, const char *service_n
     if (!_LSTransportMessageAppendString(&iter, service_name)) goto error;
     if (!_LSTransportMessageAppendInvalid(&iter)) goto error;
 
-    LS_ASSERT(transport->hub != NULL);
+    LS_ASSERT(bus->hub != NULL);
 
-    ret = _LSTransportSendMessage(message, transport->hub, serial, lserror);
+    ret = _LSTransportSendMessage(message, bus->hub, serial, lserror);
 
     if (message) _LSTransportMessageUnref(message);
 
@@ -4604,7 +6566,7 @@ error:
  * 
  * @attention locks the transport lock
  *
- * @param  transport        IN  transport 
+ * @param  bus              IN  bus
  * @param  service_name     IN  service name 
  * @param  message          IN  message to add 
  * @param  token            IN  token for message 
@@ -4615,12 +6577,14 @@ error:
  *******************************************************************************
  */
 bool
-_LSTransportAddPendingMessageWithToken(_LSTransport *transport, const char *service_name, _LSTransportMessage *message, LSMessageToken msg_token, LSError *lserror)
+_LSTransportAddPendingMessageWithToken(_LSTransportBus *bus, const char *service_name, _LSTransportMessage *message, LSMessageToken msg_token, LSError *lserror)
 {
+    _LSTransport *transport = bus->transport;
+
     /* check to see if we already have a pending queue for this service name */
     TRANSPORT_LOCK(&transport->lock);
 
-    _LSTransportOutgoing *pending = g_hash_table_lookup(transport->pending, service_name);
+    _LSTransportOutgoing *pending = g_hash_table_lookup(bus->pending, service_name);
 
     if (pending)
     {
@@ -4637,14 +6601,14 @@ _LSTransportAddPendingMessageWithToken(_LSTransport *transport, const char *serv
         _ls_verbose("%s: adding message to queue: serial: %d\n", __func__, (int)msg_token);
 
         _LSTransportMessageRef(message);
-        g_queue_push_tail(pending->queue, message);
+        _LSTransportOutgoingPush(pending, message, false);
         OUTGOING_UNLOCK(&pending->lock);
         TRANSPORT_UNLOCK(&transport->lock);  
     }
     else
     {
         /* no existing queue, create one and push message on it */ 
-        _LSTransportOutgoing *out = _LSTransportOutgoingNew();
+        _LSTransportOutgoing *out = _LSTransportOutgoingNew(&transport->watermarks);
 
         if (!out)
         {
@@ -4654,6 +6618,10 @@ _LSTransportAddPendingMessageWithToken(_LSTransport *transport, const char *serv
             return false;
         }
 
+        /* replies to name queries are matched up with the head of the
+         * queue, so it stays in FIFO order until we connect */
+        out->prioritize = false;
+
         _LSTransportMessageSetToken(message, msg_token);
         
         _LSTransportMessageType type = _LSTransportMessageGetType(message);
@@ -4665,16 +6633,56 @@ _LSTransportAddPendingMessageWithToken(_LSTransport *transport, const char *serv
 
         _ls_verbose("%s: adding message to new pending: %p, serial: %d\n", __func__, out, (int)msg_token);
         _LSTransportMessageRef(message);
-        g_queue_push_tail(out->queue, message);
+        _LSTransportOutgoingPush(out, message, false);
+
+        _ls_verbose("%s: inserting \"%s\" into pending: %p\n", __func__, service_name, bus->pending);
+        g_hash_table_insert(bus->pending, g_strdup(service_name), out);  
+       
+        /* a remembered unique name lets us connect to the service
+         * ourselves and skip asking the hub */
+        char *cached_unique_name = NULL;
+        bool cached_is_dynamic = false;
+
+        if (type == _LSTransportMessageTypeMethodCall)
+        {
+            _LSTransportQueryNameCacheEntry *entry =
+                _LSTransportQueryNameCacheLookup(bus, service_name, _LSTransportMessageGetAppId(message));
 
-        _ls_verbose("%s: inserting \"%s\" into pending: %p\n", __func__, service_name, transport->pending);
-        g_hash_table_insert(transport->pending, g_strdup(service_name), out);  
+            if (entry && entry->ret_code == LS_TRANSPORT_QUERY_NAME_SUCCESS)
+            {
+                cached_unique_name = g_strdup(entry->unique_name);
+                cached_is_dynamic = entry->is_dynamic;
+            }
+        }
        
         TRANSPORT_UNLOCK(&transport->lock);
+
+        if (cached_unique_name)
+        {
+            LSError connect_error;
+            LSErrorInit(&connect_error);
+
+            bool connected = _LSTransportConnectPendingService(bus, service_name, cached_unique_name,
+                                                               -1, cached_is_dynamic, false, &connect_error);
+            if (!connected)
+            {
+                /* stale; forget it and ask the hub like we normally would */
+                _ls_verbose("%s: cached unique name for \"%s\" failed: %s\n", __func__, service_name, connect_error.message);
+                LSErrorFree(&connect_error);
+                _LSTransportQueryNameCacheInvalidate(bus, service_name);
+            }
+
+            g_free(cached_unique_name);
+
+            if (connected)
+            {
+                return true;
+            }
+        }
         
-        LS_ASSERT(transport->hub != NULL);
+        LS_ASSERT(bus->hub != NULL);
         
-        if (!_LSTransportQueryName(transport->hub, message, service_name, lserror))
+        if (!_LSTransportQueryName(bus->hub, message, service_name, lserror))
         {
             return false;
         }
@@ -4689,7 +6697,7 @@ _LSTransportAddPendingMessageWithToken(_LSTransport *transport, const char *serv
  * 
  * @attention locks the transport lock
  *
- * @param  transport        IN  transport 
+ * @param  bus              IN  bus
  * @param  service_name     IN  service name 
  * @param  message          IN  message to add 
  * @param  token            OUT token for message 
@@ -4700,13 +6708,56 @@ _LSTransportAddPendingMessageWithToken(_LSTransport *transport, const char *serv
  *******************************************************************************
  */
 bool
-_LSTransportAddPendingMessage(_LSTransport *transport, const char *service_name, _LSTransportMessage *message, LSMessageToken *token, LSError *lserror)
+_LSTransportAddPendingMessage(_LSTransportBus *bus, const char *service_name, _LSTransportMessage *message, LSMessageToken *token, LSError *lserror)
 {
-    LSMessageToken msg_token = _LSTransportGetNextToken(transport);
+    _LSTransport *transport = bus->transport;
 
-    bool retVal = _LSTransportAddPendingMessageWithToken(transport, service_name, message, msg_token, lserror);
-
-    if (retVal && token)
+    if (_LSTransportMessageGetType(message) == _LSTransportMessageTypeMethodCall)
+    {
+        /* fail fast if the hub already told us we can't talk to this service */
+        TRANSPORT_LOCK(&transport->lock);
+        _LSTransportQueryNameCacheEntry *entry =
+            _LSTransportQueryNameCacheLookup(bus, service_name, _LSTransportMessageGetAppId(message));
+        int32_t cached_code = entry ? entry->ret_code : LS_TRANSPORT_QUERY_NAME_SUCCESS;
+
+        /* don't let a service that isn't coming up soak up unbounded memory;
+         * cancels are always let through since they let go of calls */
+        bool full = false;
+        _LSTransportOutgoing *pending = g_hash_table_lookup(bus->pending, service_name);
+
+        if (pending)
+        {
+            OUTGOING_LOCK(&pending->lock);
+            full = pending->queued_messages >= LS_TRANSPORT_PENDING_MAX_MESSAGES
+                   || pending->queued_bytes + _LSTransportMessageGetTxSize(message) > LS_TRANSPORT_PENDING_MAX_BYTES;
+            OUTGOING_UNLOCK(&pending->lock);
+        }
+        TRANSPORT_UNLOCK(&transport->lock);
+
+        if (cached_code == LS_TRANSPORT_QUERY_NAME_PERMISSION_DENIED)
+        {
+            _LSErrorSet(lserror, LS_ERROR_CODE_PERMISSION, LS_ERROR_TEXT_PERMISSION, service_name);
+            return false;
+        }
+
+        if (cached_code == LS_TRANSPORT_QUERY_NAME_SERVICE_NOT_EXIST)
+        {
+            _LSErrorSet(lserror, LS_ERROR_CODE_SERVICE_NOT_EXIST, LS_ERROR_TEXT_SERVICE_NOT_EXIST, service_name);
+            return false;
+        }
+
+        if (full)
+        {
+            _LSErrorSet(lserror, LS_ERROR_CODE_QUEUE_FULL, LS_ERROR_TEXT_QUEUE_FULL, service_name);
+            return false;
+        }
+    }
+
+    LSMessageToken msg_token = _LSTransportGetNextToken(transport);
+
+    bool retVal = _LSTransportAddPendingMessageWithToken(bus, service_name, message, msg_token, lserror);
+
+    if (retVal && token)
     {
         *token = msg_token;
     }
@@ -4720,7 +6771,7 @@ _LSTransportAddPendingMessage(_LSTransport *transport, const char *service_name,
  *
  * @attention locks the transport lock
  *
- * @param  transport        IN  transport 
+ * @param  bus              IN  bus
  * @param  service_name     IN  service 
  * @param  message          IN  message to send 
  * @param  token            OUT token for message 
@@ -4731,32 +6782,41 @@ _LSTransportAddPendingMessage(_LSTransport *transport, const char *service_name,
  *******************************************************************************
  */
 bool
-_LSTransportSendMessageToService(_LSTransport *transport, const char *service_name, _LSTransportMessage *message, LSMessageToken *token, LSError *lserror)
+_LSTransportSendMessageToService(_LSTransportBus *bus, const char *service_name, _LSTransportMessage *message, LSMessageToken *token, LSError *lserror)
 {
-    TRANSPORT_LOCK(&transport->lock);
-    _LSTransportClient *client = g_hash_table_lookup(transport->clients, service_name);
-    TRANSPORT_UNLOCK(&transport->lock);
+    _LSTransportClient *client = _LSTransportLookupClientRef(bus, service_name);
 
     if (!client)
     {
-        return _LSTransportAddPendingMessage(transport, service_name, message, token, lserror);
-    }
-    else
-    {
-        return _LSTransportSendMessage(message, client, token, lserror);
+        return _LSTransportAddPendingMessage(bus, service_name, message, token, lserror);
     }
+
+    bool ret = _LSTransportSendMessage(message, client, token, lserror);
+
+    _LSTransportClientUnref(client);
+
+    return ret;
 }
 
 /** 
  *******************************************************************************
- * @brief Send a method call.
+ * @brief Underlying method call implementation.
  * 
- * @param  transport        IN  transport 
+ * @param  bus              IN  bus
  * @param  service_name     IN  destination service name 
  * @param  category         IN  method category 
  * @param  method           IN  method 
- * @param  payload          IN  payload 
+ * @param  payload          IN  payload (nul-terminated at payload_len)
+ * @param  payload_len      IN  length of payload, not including the nul
+ * @param  binary           IN  true if payload is binary encoded; it's
+ *                              converted to JSON if the destination can't
+ *                              receive binary payloads (or isn't connected
+ *                              yet, since then we don't know)
  * @param  applicationId    IN  application id 
+ * @param  flush            IN  if not NULL, a connected destination isn't
+ *                              written to directly; the call is just queued
+ *                              and the client is added to this array (once)
+ *                              for @ref LSTransportFlushDeferred
  * @param  token            OUT message token 
  * @param  lserror          OUT set on error 
  * 
@@ -4764,24 +6824,48 @@ _LSTransportSendMessageToService(_LSTransport *transport, const char *service_na
  * @retval  false on failure
  *******************************************************************************
  */
-bool
-LSTransportSend(_LSTransport *transport, const char *service_name,
-                const char *category, const char *method,
-                const char *payload, const char* applicationId,
-                LSMessageToken *token, LSError *lserror)
+static bool
+_LSTransportSendMethodCall(_LSTransportBus *bus, const char *service_name,
+                           const char *category, const char *method,
+                           const char *payload, unsigned long payload_len, bool binary,
+                           const char* applicationId, GPtrArray *flush,
+                           LSMessageToken *token, LSError *lserror)
 {
+    _LSTransport *transport = bus->transport;
+
+    bool ret = false;
     _LSTransportMessage *message = NULL;
     _LSTransportHeader header; 
     struct iovec iov[5];
     char nul = '\0';
     unsigned long app_id_offset = 0;
     char *app_id_in_raw_msg = NULL;
+    char *json_payload = NULL;
+
+    /* Look up destination and connect to it if we haven't already */
+    _LSTransportClient *client = _LSTransportLookupClientRef(bus, service_name);
+
+    if (binary && !(client && (client->peer_caps & LS_TRANSPORT_CAP_BINARY_PAYLOAD)))
+    {
+        json_payload = _LSBinaryPayloadDecodeToJson(payload, payload_len, &payload_len);
+
+        if (!json_payload)
+        {
+            _LSErrorSet(lserror, -EINVAL, "Invalid binary payload");
+            goto exit;
+        }
+
+        payload = json_payload;
+        binary = false;
+    }
     
     unsigned long category_len = strlen(category) + 1;
     unsigned long method_len = strlen(method) + 1;
-    unsigned long payload_len = strlen(payload) + 1;
+    LS_ASSERT(payload[payload_len] == '\0');
+
+    unsigned long payload_size = payload_len + 1;
     unsigned long app_id_len = strlen_safe(applicationId) + 1;
-    unsigned long total_size =  sizeof(_LSTransportMessageRaw) + category_len + method_len + payload_len + app_id_len;
+    unsigned long total_size =  sizeof(_LSTransportMessageRaw) + category_len + method_len + payload_size + app_id_len;
 
 	/* header */
     iov[0].iov_base = &header;
@@ -4797,7 +6881,7 @@ LSTransportSend(_LSTransport *transport, const char *service_name,
 
     /* payload */
     iov[3].iov_base = (char*)payload;
-    iov[3].iov_len = payload_len;
+    iov[3].iov_len = payload_size;
 
     /* app id */
     if (!applicationId)
@@ -4814,14 +6898,8 @@ LSTransportSend(_LSTransport *transport, const char *service_name,
     app_id_offset = iov[1].iov_len + iov[2].iov_len + iov[3].iov_len;
 
     /* TODO: use accessors */    
-    header.len = category_len + method_len + payload_len + app_id_len;
-    header.type = _LSTransportMessageTypeMethodCall;
-    
-    /* Look up destination and connect to it if we haven't already */
-    TRANSPORT_LOCK(&transport->lock);
-    _LSTransportClient *client = g_hash_table_lookup(transport->clients, service_name);
-
-    TRANSPORT_UNLOCK(&transport->lock);
+    header.len = category_len + method_len + payload_size + app_id_len;
+    header.type = _LSTransportMessageTypeMethodCall | (binary ? LS_TRANSPORT_HEADER_FLAG_BINARY_PAYLOAD : 0);
 
     if (!client)
     {
@@ -4832,17 +6910,16 @@ LSTransportSend(_LSTransport *transport, const char *service_name,
 
         if (!message)
         {
-            return false;
+            goto exit;
         }
 
         app_id_in_raw_msg = _LSTransportMessageGetBody(message) + app_id_offset;
         _LSTransportMessageSetAppId(message, app_id_in_raw_msg);
 
         /* ref's the message */
-        if (!_LSTransportAddPendingMessage(transport, service_name, message, token, lserror))
+        if (!_LSTransportAddPendingMessage(bus, service_name, message, token, lserror))
         {
-            _LSTransportMessageUnref(message);
-            return false;
+            goto exit;
         }
     
         _ls_verbose("method call: token: %d, category: %s, method: %s, payload: %s\n", (int)_LSTransportMessageGetToken(message), _LSTransportMessageGetCategory(message), _LSTransportMessageGetMethod(message), _LSTransportMessageGetPayload(message));
@@ -4857,20 +6934,110 @@ LSTransportSend(_LSTransport *transport, const char *service_name,
         
         LSMessageToken msg_token = _LSTransportGetNextToken(transport);
 
+        /* decide up front so that a filtered call doesn't use up a serial */
+        bool monitor_wants = bus->monitor &&
+                             _LSTransportMonitorWants(bus, _LSTransportMessageTypeMethodCall, msg_token, client);
+
         _LSTransportMonitorSerial monitor_serial = 0;
-        if (transport->monitor)
+        if (monitor_wants)
         {    
-            monitor_serial = _LSTransportShmGetSerial(client->transport->shm);
+            monitor_serial = _LSTransportShmGetSerial(client->bus->shm);
         }
 
         _ls_verbose("method call: token: %d, category: %s, method: %s, payload: %s\n", (int)msg_token, category, method, payload);
        
         header.token = msg_token;
 
-        message = _LSTransportSendVectorRet(iov, ARRAY_SIZE(iov), total_size, app_id_offset, client, lserror);
-        if (!message)
+        int shm_fd = -1;
+
+        if (bus->type == _LSTransportTypeLocal && payload_size >= LS_TRANSPORT_SHM_PAYLOAD_THRESHOLD)
         {
-            return false;
+            LSError shm_lserror;
+            LSErrorInit(&shm_lserror);
+
+            shm_fd = _LSTransportShmPayloadNew(payload, payload_size, &shm_lserror);
+
+            if (shm_fd == -1)
+            {
+                /* not fatal; the payload just goes inline */
+                LSErrorPrint(&shm_lserror, stderr);
+                LSErrorFree(&shm_lserror);
+            }
+        }
+
+        if (shm_fd != -1)
+        {
+            /* Same message with an empty inline payload; the payload segment
+             * is sent as the message's connection fd */
+            _LSTransportHeader shm_header = header;
+            struct iovec iov_shm[ARRAY_SIZE(iov)];
+            memcpy(iov_shm, iov, sizeof(iov));
+
+            iov_shm[0].iov_base = &shm_header;
+            iov_shm[3].iov_base = &nul;
+            iov_shm[3].iov_len = sizeof(nul);
+
+            shm_header.len = header.len - payload_size + sizeof(nul);
+            shm_header.type = (shm_header.type & LS_TRANSPORT_HEADER_FLAGS_MASK) | _LSTransportMessageTypeMethodCallShm;
+
+            message = _LSTransportMessageFromVectorNewRef(iov_shm, ARRAY_SIZE(iov_shm), total_size - payload_size + sizeof(nul));
+
+            if (!message)
+            {
+                close(shm_fd);
+                goto exit;
+            }
+
+            app_id_in_raw_msg = _LSTransportMessageGetBody(message) + category_len + method_len + sizeof(nul);
+            _LSTransportMessageSetAppId(message, app_id_in_raw_msg);
+
+            /* closed when the message is freed */
+            _LSTransportMessageSetConnectionFd(message, shm_fd);
+
+            /* fd messages can't go through the vector fast path */
+            if (!_LSTransportSendMessageRaw(message, client, false, NULL, false, lserror))
+            {
+                goto exit;
+            }
+        }
+        else if (flush || _LSTransportShouldCompress(client, header.len))
+        {
+            /* deferred and compressed messages can't go through the vector
+             * fast path; header.token is already set */
+            message = _LSTransportMessageFromVectorNewRef(iov, ARRAY_SIZE(iov), total_size);
+
+            if (!message)
+            {
+                goto exit;
+            }
+
+            app_id_in_raw_msg = _LSTransportMessageGetBody(message) + app_id_offset;
+            _LSTransportMessageSetAppId(message, app_id_in_raw_msg);
+
+            if (!_LSTransportSendMessageRaw(message, client, false, NULL, false, lserror))
+            {
+                goto exit;
+            }
+
+            if (flush)
+            {
+                int i;
+                for (i = 0; i < flush->len && g_ptr_array_index(flush, i) != client; i++);
+
+                if (i == flush->len)
+                {
+                    _LSTransportClientRef(client);
+                    g_ptr_array_add(flush, client);
+                }
+            }
+        }
+        else
+        {
+            message = _LSTransportSendVectorRet(iov, ARRAY_SIZE(iov), total_size, app_id_offset, client, lserror);
+            if (!message)
+            {
+                goto exit;
+            }
         }
         
         /* Successfully sent the message so save the serial and set the
@@ -4881,7 +7048,7 @@ LSTransportSend(_LSTransport *transport, const char *service_name,
         *token = msg_token;
         
         /* MONITOR */
-        if (transport->monitor)
+        if (monitor_wants)
         {
             /* 
              * Add destination service name and destination unique name
@@ -4928,12 +7095,166 @@ LSTransportSend(_LSTransport *transport, const char *service_name,
            
             /* We don't really care if this fails and it may fail when the
              * monitor goes down */ 
-            (void)_LSTransportSendVector(iov_monitor, ARRAY_SIZE(iov_monitor), monitor_total_size, app_id_offset, transport->monitor, lserror);
+            (void)_LSTransportSendVector(iov_monitor, ARRAY_SIZE(iov_monitor), monitor_total_size, app_id_offset, bus->monitor, lserror);
         }
     }
-    _LSTransportMessageUnref(message);
 
-    return true;
+    ret = true;
+
+exit:
+    if (message) _LSTransportMessageUnref(message);
+    if (client) _LSTransportClientUnref(client);
+    g_free(json_payload);
+
+    return ret;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Send a method call whose payload length is already known.
+ * 
+ * @param  bus              IN  bus
+ * @param  service_name     IN  destination service name 
+ * @param  category         IN  method category 
+ * @param  method           IN  method 
+ * @param  payload          IN  payload (nul-terminated at payload_len)
+ * @param  payload_len      IN  length of payload, not including the nul
+ * @param  applicationId    IN  application id 
+ * @param  token            OUT message token 
+ * @param  lserror          OUT set on error 
+ * 
+ * @retval  true on success
+ * @retval  false on failure
+ *******************************************************************************
+ */
+bool
+LSTransportSendWithLen(_LSTransportBus *bus, const char *service_name,
+                       const char *category, const char *method,
+                       const char *payload, unsigned long payload_len,
+                       const char* applicationId,
+                       LSMessageToken *token, LSError *lserror)
+{
+    return _LSTransportSendMethodCall(bus, service_name, category, method,
+                                      payload, payload_len, false, applicationId, NULL, token, lserror);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Send a method call with a binary encoded payload (see
+ * binary_payload.c).
+ * 
+ * @param  bus              IN  bus
+ * @param  service_name     IN  destination service name 
+ * @param  category         IN  method category 
+ * @param  method           IN  method 
+ * @param  payload          IN  binary encoded payload (nul-terminated at payload_len)
+ * @param  payload_len      IN  length of payload, not including the nul
+ * @param  applicationId    IN  application id 
+ * @param  token            OUT message token 
+ * @param  lserror          OUT set on error 
+ * 
+ * @retval  true on success
+ * @retval  false on failure
+ *******************************************************************************
+ */
+bool
+LSTransportSendBinary(_LSTransportBus *bus, const char *service_name,
+                      const char *category, const char *method,
+                      const char *payload, unsigned long payload_len,
+                      const char* applicationId,
+                      LSMessageToken *token, LSError *lserror)
+{
+    return _LSTransportSendMethodCall(bus, service_name, category, method,
+                                      payload, payload_len, true, applicationId, NULL, token, lserror);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Queue a method call without writing it to its destination yet, so
+ * that a batch of calls can be written with one gathered send per
+ * destination by @ref LSTransportFlushDeferred. Calls to services we
+ * aren't connected to yet are handled like any other call.
+ * 
+ * @param  bus              IN  bus
+ * @param  service_name     IN  destination service name 
+ * @param  category         IN  method category 
+ * @param  method           IN  method 
+ * @param  payload          IN  payload (nul-terminated at payload_len)
+ * @param  payload_len      IN  length of payload, not including the nul
+ * @param  applicationId    IN  application id 
+ * @param  flush            IN  array that the destination client is added to
+ *                              (with a ref)
+ * @param  token            OUT message token 
+ * @param  lserror          OUT set on error 
+ * 
+ * @retval  true on success
+ * @retval  false on failure
+ *******************************************************************************
+ */
+bool
+LSTransportSendDeferred(_LSTransportBus *bus, const char *service_name,
+                        const char *category, const char *method,
+                        const char *payload, unsigned long payload_len,
+                        const char* applicationId, GPtrArray *flush,
+                        LSMessageToken *token, LSError *lserror)
+{
+    LS_ASSERT(flush != NULL);
+
+    return _LSTransportSendMethodCall(bus, service_name, category, method,
+                                      payload, payload_len, false, applicationId, flush, token, lserror);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Write out the calls queued by @ref LSTransportSendDeferred, as
+ * much as each socket takes right now; whatever doesn't fit is sent from
+ * the mainloop as usual.
+ * 
+ * @param  flush    IN  clients calls were queued for; the array is freed
+ *******************************************************************************
+ */
+void
+LSTransportFlushDeferred(GPtrArray *flush)
+{
+    int i;
+
+    for (i = 0; i < flush->len; i++)
+    {
+        _LSTransportClient *client = g_ptr_array_index(flush, i);
+
+        (void)_LSTransportSendClient(NULL, G_IO_OUT, client);
+
+        _LSTransportClientUnref(client);
+    }
+
+    g_ptr_array_free(flush, TRUE);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Send a method call.
+ * 
+ * @param  bus              IN  bus
+ * @param  service_name     IN  destination service name 
+ * @param  category         IN  method category 
+ * @param  method           IN  method 
+ * @param  payload          IN  payload 
+ * @param  applicationId    IN  application id 
+ * @param  token            OUT message token 
+ * @param  lserror          OUT set on error 
+ * 
+ * @retval  true on success
+ * @retval  false on failure
+ *******************************************************************************
+ */
+bool
+LSTransportSend(_LSTransportBus *bus, const char *service_name,
+                const char *category, const char *method,
+                const char *payload, const char* applicationId,
+                LSMessageToken *token, LSError *lserror)
+{
+    return LSTransportSendWithLen(bus, service_name, category, method,
+                                  payload, strlen(payload), applicationId, token, lserror);
 }
 
 /** 
@@ -4958,6 +7279,8 @@ _LSTransportSendClient(GIOChannel *source, GIOCondition condition,
      * and quit if the call will block */
     
     _LSTransportClient *client = (_LSTransportClient*)data;
+    bool congested = false;
+    bool congestion_changed = false;
 
     _ls_verbose("%s: client: %p\n", __func__, client);
 
@@ -4973,114 +7296,172 @@ _LSTransportSendClient(GIOChannel *source, GIOCondition condition,
                 /* remove the watch since we're done sending */
                 _LSTransportRemoveSendWatch(&client->channel);
 
+                congestion_changed = _LSTransportOutgoingTakeCongestionChange(client->outgoing, &congested);
+
                 OUTGOING_UNLOCK(&client->outgoing->lock);
+
+                _LSTransportFlowControlNotify(client, congestion_changed, congested);
                 return FALSE;
     	}
 
-        /* grab message off queue */
-        _LSTransportMessage *message = g_queue_pop_head(client->outgoing->queue);
+        _LSTransportMessage *message = g_queue_peek_head(client->outgoing->queue);
 
-        /* Warn and exit if we dequeue a null */
+        /* Warn and drop it if we find a null */
         if (!message)
         {
             g_warning ("%s: Found null message in outgoing queue", __func__);
+            _LSTransportOutgoingPop(client->outgoing);
             continue;
         }
 
-        //printf("SendClient: sending message: token %d, type: %d, len: %d, data: %s\n", (int)_LSTransportMessageGetToken(message), (int)_LSTransportMessageGetType(message), (int)message->raw->header.len, _LSTransportMessageGetBody(message));
-        //printf("sending %ld bytes\n", message->tx_bytes_remaining);   
-        
         if (message->tx_bytes_remaining > 0)
         {
-            /* attempt to send message */
+            /* Gather as many messages as we can off the head of the queue
+             * and send them with a single call. Messages that pass an fd
+             * end the batch, since the fd has to follow its message
+             * directly. */
+            struct iovec iov[MAX_SEND_BATCH_IOV];
+            struct msghdr msg = { 0 };
+            unsigned long batch_bytes = 0;
+            int iovcnt = 0;
+            GList *iter = NULL;
+
+            for (iter = g_queue_peek_head_link(client->outgoing->queue);
+                 iter != NULL && iovcnt + LS_TRANSPORT_MESSAGE_MAX_TX_IOV <= ARRAY_SIZE(iov);
+                 iter = g_list_next(iter))
+            {
+                _LSTransportMessage *cur_msg = iter->data;
 
-            /* TODO */ 
-            /* <eeh> This is a lot of math.  Can you calc a ptr upfront and increment it by ret? */
-            ret = send(client->channel.fd, (char*)message->raw + message->raw->header.len + sizeof(_LSTransportHeader) - message->tx_bytes_remaining, message->tx_bytes_remaining, MSG_DONTWAIT);
+                if (iovcnt > 0)
+                {
+                    if (!cur_msg || _LSTransportMessageIsConnectionFdType(cur_msg) ||
+                        batch_bytes + cur_msg->tx_bytes_remaining > MAX_SEND_BATCH_BYTES)
+                    {
+                        break;
+                    }
+                }
 
-            if (ret >= 0)
-            {
-                message->tx_bytes_remaining -= ret;
+                iovcnt += _LSTransportMessageGetTxVector(cur_msg, &iov[iovcnt]);
+                batch_bytes += cur_msg->tx_bytes_remaining;
 
+                if (_LSTransportMessageIsConnectionFdType(cur_msg))
+                {
+                    break;
+                }
             }
-            else if (errno == EAGAIN || errno == EINTR)
-            {
-                /* still have data left, so put it back on the queue
-                 * from where we took it off */
-                g_queue_push_head(client->outgoing->queue, message);
-                goto Done;
-            }
-            else
+
+            msg.msg_iov = iov;
+            msg.msg_iovlen = iovcnt;
+
+            ret = sendmsg(client->channel.fd, &msg, MSG_DONTWAIT);
+
+            if (ret < 0)
             {
+                if (errno == EAGAIN || errno == EINTR)
+                {
+                    /* still have data left and it's still on the queue */
+                    _LSTransportClientSocketFull(client);
+                    goto Done;
+                }
+
                 /* TODO: Handle better */
                 g_debug("Error when attempting to send: %d, %s [fd: %d, client service name: %s, client unique name: %s",
                         errno, g_strerror(errno), client->channel.fd,
                         _LSTransportClientGetServiceName(client),
                         _LSTransportClientGetUniqueName(client)); 
-                _LSTransportMessageUnref(message);
+                _LSTransportMessageUnref(_LSTransportOutgoingPop(client->outgoing));
                 goto Done;     /* <eeh> You're going to return TRUE here.  Want that? */
             }
-        }
 
-        if (message->tx_bytes_remaining == 0)
-        {
-            /* transmitted entire message */
-            
-            /* Send the connection fd if we have one
-             * 
-             * TODO: make sure this handles failure case correctly.
-             */
-            if (_LSTransportMessageIsConnectionFdType(message))
+            /* account for what was sent; retire fully sent messages so
+             * that at most one (partially sent or waiting for its fd to be
+             * sent) is left at the head of the queue */
+            unsigned long bytes_sent = ret;
+
+            while (bytes_sent > 0)
             {
-                bool need_retry = false;
-                LSError lserror;
-                LSErrorInit(&lserror);
+                _LSTransportMessage *sent_msg = g_queue_peek_head(client->outgoing->queue);
+                unsigned long sent_msg_bytes = MIN(bytes_sent, sent_msg->tx_bytes_remaining);
 
-                if (!_LSTransportSendFd(client->channel.fd, _LSTransportMessageGetConnectionFd(message), &need_retry, &lserror))
+                sent_msg->tx_bytes_remaining -= sent_msg_bytes;
+                bytes_sent -= sent_msg_bytes;
+
+                if (sent_msg->tx_bytes_remaining > 0 || _LSTransportMessageIsConnectionFdType(sent_msg))
                 {
-                    if (need_retry)
-                    {
-                        /* Still need to send fd, so push message back on
-                         * queue where it was and wait for fd to become
-                         * ready for sending */
-                        g_queue_push_head(client->outgoing->queue, message);
-                        goto Done;
-                    }
-                    else
-                    {
-                        LSErrorPrint(&lserror, stderr);
-                        LSErrorFree(&lserror);
-                    }
+                    break;
                 }
+
+                _ls_verbose("%s: sent message: client: %p, token %d, type: %d, len: %d\n",
+                            __func__,
+                            client,
+                            (int)_LSTransportMessageGetToken(sent_msg),
+                            (int)_LSTransportMessageGetType(sent_msg),
+                            (int)_LSTransportMessageGetBodySize(sent_msg));
+
+                _LSTransportOutgoingMessageSent(client->outgoing, sent_msg);
+                _LSTransportMessageUnref(_LSTransportOutgoingPop(client->outgoing));
             }
 
-            /* the fd is closed when the message ref count goes to 0 */
+            LS_ASSERT(bytes_sent == 0);
 
-            //_LSTransportHeader *header = &message->raw->header;
-            _ls_verbose("%s: sent message: client: %p, token %d, type: %d, len: %d\n",
-                        __func__,
-                        client,
-                        (int)_LSTransportMessageGetToken(message),
-                        (int)_LSTransportMessageGetType(message),
-                        (int)message->raw->header.len);
+            if ((unsigned long)ret < batch_bytes)
+            {
+                /* the socket buffer is full, so wait until we can send
+                 * again; whatever is left is still on the queue */
+                _LSTransportClientSocketFull(client);
+                goto Done;
+            }
 
-            _LSTransportMessageUnref(message);
+            continue;
         }
-        else
+
+        /* transmitted entire message */
+        
+        /* Send the connection fd if we have one
+         * 
+         * TODO: make sure this handles failure case correctly.
+         */
+        if (_LSTransportMessageIsConnectionFdType(message))
         {
-            /* still have data left, so put it back on the queue from
-             * where we took it off.
-             *
-             * TODO: we don't actually have to exit the loop here; as long as we're
-             * calling send with MSG_DONTWAIT, it won't block and we can
-             * give it another shot.. we'll get EAGAIN if we would block */
-            g_queue_push_head(client->outgoing->queue, message);
-            goto Done;
+            bool need_retry = false;
+            LSError lserror;
+            LSErrorInit(&lserror);
+
+            if (!_LSTransportSendFd(client->channel.fd, _LSTransportMessageGetConnectionFd(message), &need_retry, &lserror))
+            {
+                if (need_retry)
+                {
+                    /* Still need to send fd, so leave message on the
+                     * queue and wait for fd to become ready for sending */
+                    goto Done;
+                }
+                else
+                {
+                    LSErrorPrint(&lserror, stderr);
+                    LSErrorFree(&lserror);
+                }
+            }
         }
+
+        /* the fd is closed when the message ref count goes to 0 */
+
+        _ls_verbose("%s: sent message: client: %p, token %d, type: %d, len: %d\n",
+                    __func__,
+                    client,
+                    (int)_LSTransportMessageGetToken(message),
+                    (int)_LSTransportMessageGetType(message),
+                    (int)message->raw->header.len);
+
+        _LSTransportOutgoingMessageSent(client->outgoing, message);
+        _LSTransportMessageUnref(_LSTransportOutgoingPop(client->outgoing));
     }
 
 Done:
+    congestion_changed = _LSTransportOutgoingTakeCongestionChange(client->outgoing, &congested);
+
     OUTGOING_UNLOCK(&client->outgoing->lock);
+
+    _LSTransportFlowControlNotify(client, congestion_changed, congested);
     return TRUE;    /* FALSE means this source should be removed */
 }
 
@@ -5098,7 +7479,6 @@ _LSTransportGlobalTokenNew()
     _LSTransportGlobalToken* ret = g_new0(_LSTransportGlobalToken, 1);
     if (ret)
     {
-        pthread_mutex_init(&ret->lock, NULL);
         ret->value = LSMESSAGE_TOKEN_INVALID;
     }
     return ret; 
@@ -5152,9 +7532,240 @@ _LSTransportSetIsHub(bool is_hub)
     s_is_hub = is_hub;
 }
 
+static gboolean
+_freePending(gpointer key, _LSTransportOutgoing *outgoing, gpointer user_data)
+{
+    LS_ASSERT(outgoing != NULL);
+
+    //printf("%s: outgoing queue entries: %u, serial queue entries: %u\n", __func__,
+    //       g_queue_get_length(outgoing->queue), outgoing->serial->live);
+
+    _LSTransportOutgoingFree(outgoing);
+
+    return true;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Free a bus along with its tables. The bus must be disconnected.
+ * 
+ * @param  bus      IN  bus 
+ *******************************************************************************
+ */
+static void
+_LSTransportBusFree(_LSTransportBus *bus)
+{
+    /* destroy all hash tables */
+    if (bus->clients) g_hash_table_unref(bus->clients);
+    bus->clients = NULL;
+
+    /* nothing can be sending anymore */
+    LS_ASSERT(g_atomic_int_get(&bus->clients_readers) == 0);
+    g_slist_foreach(bus->clients_retired, (GFunc)g_hash_table_unref, NULL);
+    g_slist_free(bus->clients_retired);
+    bus->clients_retired = NULL;
+    if (bus->clients_snapshot) g_hash_table_unref(bus->clients_snapshot);
+    bus->clients_snapshot = NULL;
+
+    if (bus->pending)
+    {
+        g_hash_table_foreach_remove(bus->pending, (GHRFunc)_freePending, NULL);
+        g_hash_table_unref(bus->pending);
+    }
+    bus->pending = NULL;
+
+    if (bus->query_name_cache) g_hash_table_unref(bus->query_name_cache);
+    bus->query_name_cache = NULL;
+
+    if (bus->hub) _LSTransportClientUnref(bus->hub);
+    bus->hub = NULL;
+
+    g_slist_foreach(bus->hub_retired, (GFunc)_LSTransportClientUnref, NULL);
+    g_slist_free(bus->hub_retired);
+    bus->hub_retired = NULL;
+
+    g_free(bus->hub_address);
+    bus->hub_address = NULL;
+
+    if (bus->signal_registrations) g_hash_table_unref(bus->signal_registrations);
+    bus->signal_registrations = NULL;
+
+    pthread_mutex_lock(&bus->monitor_filter_lock);
+    _LSTransportMonitorFilter *monitor_filter = bus->monitor_filter;
+    bus->monitor_filter = NULL;
+    pthread_mutex_unlock(&bus->monitor_filter_lock);
+
+    _LSTransportMonitorFilterFree(monitor_filter);
+    pthread_mutex_destroy(&bus->monitor_filter_lock);
+
+    if (bus->shm) _LSTransportShmDeinit(&bus->shm);
+
+    g_free(bus->unique_name);
+    bus->unique_name = NULL;
+
+#ifdef MEMCHECK
+    memset(bus, 0xFF, sizeof(_LSTransportBus));
+#endif
+
+    g_free(bus);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Add a bus to a transport. The transport is created with one bus;
+ * a second one lets the same transport (and so the same I/O threads,
+ * watches and message tokens) serve both the public and the private bus.
+ * Connect it with @ref _LSTransportConnect.
+ *
+ * @attention must be called before the transport is connected or attached
+ * to a mainloop
+ * 
+ * @param  transport        IN   transport 
+ * @param  handlers         IN   handler callbacks for messages on the bus 
+ * @param  ret_bus          OUT  new bus 
+ * @param  lserror          OUT  set on error 
+ * 
+ * @retval  true on success
+ * @retval  false on failure
+ *******************************************************************************
+ */
+bool
+_LSTransportAddBus(_LSTransport *transport, LSTransportHandlers *handlers, _LSTransportBus **ret_bus, LSError *lserror)
+{
+    LS_ASSERT(transport != NULL);
+    LS_ASSERT(handlers != NULL);
+
+    if (transport->num_buses >= LS_TRANSPORT_MAX_BUSES)
+    {
+        _LSErrorSet(lserror, -1, "Transport already has %d buses", transport->num_buses);
+        return false;
+    }
+
+    _LSTransportBus *bus = g_new0(_LSTransportBus, 1);
+
+    if (!bus)
+    {
+        _LSErrorSetOOM(lserror);
+        return false;
+    }
+
+    bus->transport = transport;
+
+    /* set to a real value when we call _LSTransportConnect or _LSTransportSetupListener/Local/Inet */ 
+    bus->type = _LSTransportTypeInvalid;  
+
+    bus->shm = NULL;      /* Set in _LSTransportConnect */
+
+    pthread_mutex_init(&bus->monitor_filter_lock, NULL);
+
+    /* TODO: wrap this? */ 
+    bus->clients = g_hash_table_new_full(g_str_hash, g_str_equal,
+        (GDestroyNotify)g_free, (GDestroyNotify)_LSTransportClientUnref);
+
+    if (!bus->clients)
+    {
+        _LSErrorSet(lserror, -ENOMEM, "OOM");
+        goto Error;
+    }
+
+    bus->pending = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+    if (!bus->pending)
+    {
+        _LSErrorSet(lserror, -ENOMEM, "OOM");
+        goto Error;
+    }
+
+    bus->query_name_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)_LSTransportQueryNameCacheEntryFree);
+
+    if (!bus->query_name_cache)
+    {
+        _LSErrorSet(lserror, -ENOMEM, "OOM");
+        goto Error;
+    }
+
+    bus->signal_registrations = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+   
+    /* TODO: just copy the struct! */ 
+    bus->message_failure_handler = handlers->message_failure_handler;
+    bus->message_failure_context = handlers->message_failure_context;
+
+    bus->disconnect_handler = handlers->disconnect_handler;
+    bus->disconnect_context = handlers->disconnect_context;
+
+    bus->msg_handler = handlers->msg_handler;
+    bus->msg_context = handlers->msg_context;
+
+    bus->flow_control_handler = handlers->flow_control_handler;
+    bus->flow_control_context = handlers->flow_control_context;
+
+    bus->idle_handler = handlers->idle_handler;
+    bus->idle_context = handlers->idle_context;
+
+    TRANSPORT_LOCK(&transport->lock);
+    transport->buses[transport->num_buses++] = bus;
+    TRANSPORT_UNLOCK(&transport->lock);
+
+    if (ret_bus) *ret_bus = bus;
+    return true;
+
+Error:
+    _LSTransportBusFree(bus);
+    return false;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Get the bus a transport was created with.
+ * 
+ * @param  transport    IN  transport 
+ * 
+ * @retval  bus
+ *******************************************************************************
+ */
+_LSTransportBus*
+_LSTransportGetBus(const _LSTransport *transport)
+{
+    LS_ASSERT(transport != NULL);
+    return transport->buses[0];
+}
+
+_LSTransport*
+_LSTransportBusGetTransport(const _LSTransportBus *bus)
+{
+    LS_ASSERT(bus != NULL);
+    return bus->transport;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Replace the handler for incoming messages on a bus (e.g., to queue
+ * them instead of dispatching them from the mainloop).
+ *
+ * @attention must be called before the transport is attached to a mainloop
+ * 
+ * @param  bus          IN  bus 
+ * @param  msg_handler  IN  message handler 
+ * @param  msg_context  IN  context passed to @ref msg_handler
+ * 
+ * @retval  true always
+ *******************************************************************************
+ */
+bool
+_LSTransportBusSetMessageHandler(_LSTransportBus *bus, LSTransportMessageHandler msg_handler, void *msg_context)
+{
+    LS_ASSERT(bus != NULL);
+
+    bus->msg_handler = msg_handler;
+    bus->msg_context = msg_context;
+
+    return true;
+}
+
 /** 
  *******************************************************************************
- * @brief Allocate and initialize a new transport.
+ * @brief Allocate and initialize a new transport, with a single bus that
+ * uses @ref handlers (see @ref _LSTransportAddBus for adding another).
  * 
  * @param  *ret_transport   OUT  new transport 
  * @param  service_name     IN   service name 
@@ -5179,8 +7790,6 @@ _LSTransportInit(_LSTransport **ret_transport, const char *service_name,
         goto Error;
     }
  
-    /* set to a real value when we call _LSTransportConnect or _LSTransportSetupListener/Local/Inet */ 
-    transport->type = _LSTransportTypeInvalid;  
     transport->service_name = g_strdup(service_name);
 
     if (service_name && strcmp(service_name, HUB_NAME) == 0)
@@ -5195,8 +7804,6 @@ _LSTransportInit(_LSTransport **ret_transport, const char *service_name,
      */
     transport->source_priority = G_PRIORITY_DEFAULT;
 
-    transport->shm = NULL;      /* Set in _LSTransportConnect */
- 
     pthread_mutex_init(&transport->lock, NULL);
 
     transport->global_token = _LSTransportGlobalTokenNew();
@@ -5206,16 +7813,6 @@ _LSTransportInit(_LSTransport **ret_transport, const char *service_name,
         goto Error;
     }
  
-    /* TODO: wrap this? */ 
-    transport->clients = g_hash_table_new_full(g_str_hash, g_str_equal,
-        (GDestroyNotify)g_free, (GDestroyNotify)_LSTransportClientUnref);
-
-    if (!transport->clients)
-    {
-        _LSErrorSet(lserror, -ENOMEM, "OOM");
-        goto Error;
-    }
-
     transport->all_connections = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)_LSTransportClientUnref);
 
     if (!transport->all_connections)
@@ -5224,23 +7821,18 @@ _LSTransportInit(_LSTransport **ret_transport, const char *service_name,
         goto Error;
     }
 
-    transport->pending = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    transport->watermarks.high_bytes = LS_TRANSPORT_DEFAULT_HIGH_WATER_BYTES;
+    transport->watermarks.low_bytes = LS_TRANSPORT_DEFAULT_LOW_WATER_BYTES;
+    transport->watermarks.high_messages = LS_TRANSPORT_DEFAULT_HIGH_WATER_MESSAGES;
+    transport->watermarks.low_messages = LS_TRANSPORT_DEFAULT_LOW_WATER_MESSAGES;
 
-    if (!transport->pending)
+    transport->compress_threshold_inet = LS_TRANSPORT_COMPRESS_THRESHOLD_INET;
+    transport->compress_threshold_local = LS_TRANSPORT_COMPRESS_THRESHOLD_LOCAL;
+
+    if (!_LSTransportAddBus(transport, handlers, NULL, lserror))
     {
-        _LSErrorSet(lserror, -ENOMEM, "OOM");
         goto Error;
     }
-   
-    /* TODO: just copy the struct! */ 
-    transport->message_failure_handler = handlers->message_failure_handler;
-    transport->message_failure_context = handlers->message_failure_context;
-
-    transport->disconnect_handler = handlers->disconnect_handler;
-    transport->disconnect_context = handlers->disconnect_context;
-
-    transport->msg_handler = handlers->msg_handler;
-    transport->msg_context = handlers->msg_context;
 
     *ret_transport = transport;
     return true;
@@ -5248,11 +7840,9 @@ _LSTransportInit(_LSTransport **ret_transport, const char *service_name,
 Error:
     if (transport)
     {
-        if (transport->shm) _LSTransportShmDeinit(&transport->shm);
         if (transport->global_token) _LSTransportGlobalTokenFree(transport->global_token);
-        if (transport->clients) g_hash_table_destroy(transport->clients);
         if (transport->all_connections) g_hash_table_destroy(transport->all_connections);
-        if (transport->pending) g_hash_table_destroy(transport->pending);
+        g_free(transport->service_name);
         g_free(transport);
     }
     return false;
@@ -5330,6 +7920,73 @@ _LSTransportFlushQueueMessages(_LSTransportClient *client, GQueue *queue, LSErro
 }
 #endif
 
+/* idle callback for _LSTransportClientParkIncoming() */
+static gboolean
+_LSTransportClientUnparkIncoming(gpointer data)
+{
+    LSError lserror;
+    LSErrorInit(&lserror);
+
+    _LSTransportClient *client = data;
+
+    client->incoming_parked = false;
+
+    if (!_LSTransportProcessIncomingMessages(client, &lserror))
+    {
+        LSErrorPrint(&lserror, stderr);
+        LSErrorFree(&lserror);
+    }
+
+    /* ref taken when parked */
+    _LSTransportClientUnref(client);
+
+    return FALSE;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Hold off processing a client's incoming messages until its exe
+ * path and cmdline have been read (see @ref _LSTransportGetCredentials), so
+ * that the hub's decisions on them don't block its mainloop on /proc. The
+ * messages stay in the incoming queue and are processed, in order, from the
+ * client's context once the credentials are resolved.
+ * 
+ * @param  client   IN  client 
+ * 
+ * @retval  true if the messages have to wait
+ * @retval  false if they can be processed now
+ *******************************************************************************
+ */
+static bool
+_LSTransportClientParkIncoming(_LSTransportClient *client)
+{
+    if (!client->cred || g_queue_is_empty(client->incoming->complete_messages))
+    {
+        return false;
+    }
+
+    if (client->incoming_parked)
+    {
+        /* still waiting, unless something resolved the credentials in
+         * the meantime (e.g., the client is going away) */
+        return !_LSTransportCredIsResolved(client->cred);
+    }
+
+    GMainContext *context = client->channel.context ? client->channel.context : client->transport->mainloop_context;
+
+    _LSTransportClientRef(client);
+
+    if (!_LSTransportCredNotifyResolved(client->cred, context, _LSTransportClientUnparkIncoming, client))
+    {
+        _LSTransportClientUnref(client);
+        return false;
+    }
+
+    client->incoming_parked = true;
+
+    return true;
+}
+
 /** 
  *******************************************************************************
  * @brief Process incoming messages by calling the appropriate message
@@ -5349,6 +8006,12 @@ _LSTransportProcessIncomingMessages(_LSTransportClient *client, LSError *lserror
 {
     _LSTransportClientRef(client);
     _LSTransportIncoming *incoming = client->incoming;
+
+    if (_LSTransportClientParkIncoming(client))
+    {
+        _LSTransportClientUnref(client);
+        return true;
+    }
     
     /* TODO: review locking, this function can be called recursively because
      * we can call out to user code, which can potentially call LSUnregister,
@@ -5367,7 +8030,9 @@ _LSTransportProcessIncomingMessages(_LSTransportClient *client, LSError *lserror
         //INCOMING_UNLOCK(&incoming->lock);
 
         /* Handle "internal" messages, otherwise, let the registered handler take over */
-        _ls_verbose("%s: received message token %d, type: %d, len: %d\n", __func__, (int)tmsg->raw->header.token, (int)tmsg->raw->header.type, (int)tmsg->raw->header.len);
+        _ls_verbose("%s: received message token %d, type: %d, len: %d\n", __func__, (int)tmsg->raw->header.token, (int)_LSTransportMessageGetType(tmsg), (int)tmsg->raw->header.len);
+
+        LS_TRACE_MESSAGE(_LSTracePointDispatch, tmsg);
 
         switch (_LSTransportMessageGetType(tmsg))
         {
@@ -5388,7 +8053,7 @@ _LSTransportProcessIncomingMessages(_LSTransportClient *client, LSError *lserror
             _ls_verbose("%s: removing reply serial: %d, message serial: %d\n", __func__, (int)_LSTransportMessageGetReplyToken(tmsg), (int)_LSTransportMessageGetToken(tmsg));
             _LSTransportSerialRemove(client->outgoing->serial, _LSTransportMessageGetReplyToken(tmsg));
             _LSTransportHandleUserMessageHandler(tmsg);
-            //client->transport->msg_handler(tmsg, client->transport->msg_context);
+            //client->bus->msg_handler(tmsg, client->bus->msg_context);
             break;
 
         case _LSTransportMessageTypeMonitorConnected:
@@ -5400,6 +8065,43 @@ _LSTransportProcessIncomingMessages(_LSTransportClient *client, LSError *lserror
             _LSTransportHandleClientInfo(tmsg);
             break;
 
+        case _LSTransportMessageTypeCapabilities:
+            _LSTransportHandleCapabilities(tmsg);
+            break;
+
+        case _LSTransportMessageTypeIncomingConnection:
+            _LSTransportHandleIncomingConnection(tmsg);
+            break;
+
+        case _LSTransportMessageTypeServiceUpSignal:
+        case _LSTransportMessageTypeServiceDownSignal:
+        {
+            /* the hub says this service came or went, so anything we
+             * remember about it is suspect */
+            char *status_service_name = LSTransportServiceStatusSignalGetServiceName(tmsg);
+            if (status_service_name)
+            {
+                _LSTransportQueryNameCacheInvalidate(client->bus, status_service_name);
+                g_free(status_service_name);
+            }
+            _LSTransportHandleUserMessageHandler(tmsg);
+            break;
+        }
+
+        case _LSTransportMessageTypeSignal:
+            if (client == client->bus->hub &&
+                strcmp(_LSTransportMessageGetCategory(tmsg), HUB_CONTROL_CATEGORY) == 0 &&
+                strcmp(_LSTransportMessageGetMethod(tmsg), HUB_CONF_SCAN_COMPLETE_METHOD) == 0)
+            {
+                /* the hub reloaded its config, so permissions may have
+                 * changed */
+                TRANSPORT_LOCK(&client->transport->lock);
+                g_hash_table_remove_all(client->bus->query_name_cache);
+                TRANSPORT_UNLOCK(&client->transport->lock);
+            }
+            _LSTransportHandleUserMessageHandler(tmsg);
+            break;
+
         case _LSTransportMessageTypeMethodCall:
             /* Save message serial so we know what has been processed */
             incoming->last_serial_processed = _LSTransportMessageGetToken(tmsg);
@@ -5446,7 +8148,7 @@ _LSTransportFlushOutgoingMessages(_LSTransportClient *client, LSError *lserror)
 
     while (!g_queue_is_empty(client->outgoing->queue))
     {
-        _LSTransportMessage *message = g_queue_pop_head(client->outgoing->queue);
+        _LSTransportMessage *message = _LSTransportOutgoingPop(client->outgoing);
         if (!message)
         {
             /* LOCKED */
@@ -5498,229 +8200,743 @@ _LSTransportSendShutdownMessages(gpointer key, gpointer value, gpointer user_dat
     _ls_verbose("%s: client: %p\n", __func__, client); 
 
     /* remove watches */
-    if (client->channel.send_watch)
+    if (_LSTransportChannelHasSendWatch(&client->channel))
     {
         _LSTransportRemoveSendWatch(&client->channel);
     }
 
-    if (client->channel.recv_watch)
+    if (_LSTransportChannelHasReceiveWatch(&client->channel))
+    {
+        _LSTransportRemoveReceiveWatch(&client->channel);
+    }
+
+    _LSTransportBus *bus = _LSTransportClientGetBus(client);
+    if (bus->listen_channel.accept_watch)
+    {
+        _LSTransportRemoveAcceptWatch(&bus->listen_channel);
+        _LSTransportChannelClose(&bus->listen_channel, false);
+    }
+
+    /* we may not want to flush and send the shutdown messages if we are
+     * detaching from the mainloop */
+    if (flush_and_send_shutdown)
+    {
+        /* NOV-99802
+         *
+         * Don't process any more incoming messages. Otherwise we might
+         * trigger more callbacks and activity. When we send the shutdown
+         * message the far side will know the last message that we processed
+         * and generate errors for the others.
+         *
+         * TODO: What happens when two services talking with each other shut
+         * down at the exact same time?
+         */
+
+        /* flush any remaining messages in the outgoing queue */
+        if (!_LSTransportFlushOutgoingMessages(client, &lserror))
+        {
+            LSErrorPrint(&lserror, stderr);
+            LSErrorFree(&lserror);
+        }
+
+        /* If we got a shutdown message from this client already, then don't try
+         * to send a shutdown message to it */
+        if (client->state != _LSTransportClientStateShutdown)
+        {
+            /* send blocking shutdown messages to client (includes hub) */
+            /* not much we can do if any of these fail except log the fact that it
+             * happened */
+            if (!_LSTransportSendShutdownMessageBlocking(client, &lserror))
+            {
+                LSErrorPrint(&lserror, stderr);
+                LSErrorFree(&lserror);
+            }
+            client->state = _LSTransportClientStateShutdown;
+        }
+        else
+        {
+            /* We don't expect this to happen */
+            g_critical("%s: did not expect client [%s (%s)] to have already sent shut down message",
+                        __func__, client->service_name, client->unique_name);
+        }
+    }
+
+    /* close connections */
+    _LSTransportChannelClose(&client->channel, flush_and_send_shutdown);
+    _LSTransportChannelDeinit(&client->channel);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Callback to discard pending incoming messages for a given client.
+ *
+ * @attention This is callled with the transport lock held.
+ *  
+ * @param  client       IN  client 
+ *******************************************************************************
+ */
+void
+_LSTransportDiscardIncomingMessages(void *ignored, _LSTransportClient *client, GMainContext *ignored_mainloop_context)
+{
+    LS_ASSERT(client != NULL);
+
+    _ls_verbose("%s: client: %p\n", __func__, client);
+ 
+    _LSTransportClientRef(client);
+    _LSTransportIncoming *incoming = client->incoming;
+    int discards = 0;
+
+    while (!g_queue_is_empty(incoming->complete_messages))
+    {
+        _LSTransportMessage *tmsg = (_LSTransportMessage*) g_queue_pop_head(incoming->complete_messages);
+        _LSTransportMessageUnref(tmsg);
+        discards++;
+    }
+
+    if (discards)
+    {
+        g_warning("%s: discarded %d messages", __func__, discards);
+    }
+
+    _LSTransportClientUnref(client);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Discards all pending incoming messages for all clients in a transport.
+ *
+ * @attention locks the transport lock.
+ * 
+ * @param  transport    IN  transport 
+ *******************************************************************************
+ */
+void
+_LSTransportDiscardAllClientIncoming(_LSTransport *transport)
+{
+    int i;
+
+    TRANSPORT_LOCK(&transport->lock);
+    for (i = 0; i < transport->num_buses; i++)
+    {
+        g_hash_table_foreach(transport->buses[i]->clients, (GHFunc)_LSTransportDiscardIncomingMessages, NULL);
+    }
+    TRANSPORT_UNLOCK(&transport->lock);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Perform disconnect operations. Removes the watches, sends shutdown
+ * messages (if requested) and closes the connections.
+ *
+ * @attention locks the transport lock
+ *
+ * @param  transport    IN  transport
+ * 
+ * @retval  true on success
+ * @retval  false on failure
+ *******************************************************************************
+ */
+bool
+_LSTransportDisconnect(_LSTransport *transport, bool flush_and_send_shutdown)
+{
+    LS_ASSERT(transport != NULL);
+
+    _ls_verbose("%s: transport: %p\n", __func__, transport);
+
+    int i;
+
+    /* we're the ones going away */
+    for (i = 0; i < transport->num_buses; i++)
+    {
+        _LSTransportBus *bus = transport->buses[i];
+
+        bus->hub_reconnect = false;
+
+        if (bus->hub_reconnect_source)
+        {
+            g_source_destroy(bus->hub_reconnect_source);
+            g_source_unref(bus->hub_reconnect_source);
+            bus->hub_reconnect_source = NULL;
+        }
+    }
+
+    TRANSPORT_LOCK(&transport->lock);
+    for (i = 0; i < transport->num_buses; i++)
+    {
+        _LSTransportBus *bus = transport->buses[i];
+
+        if (bus->query_name_cache_watch_source)
+        {
+            g_source_destroy(bus->query_name_cache_watch_source);
+            g_source_unref(bus->query_name_cache_watch_source);
+            bus->query_name_cache_watch_source = NULL;
+        }
+    }
+    g_hash_table_foreach(transport->all_connections, _LSTransportSendShutdownMessages, GINT_TO_POINTER((gint)flush_and_send_shutdown));
+    TRANSPORT_UNLOCK(&transport->lock);
+
+    _LSTransportDiscardAllClientIncoming(transport);
+
+    for (i = 0; i < transport->num_buses; i++)
+    {
+        _LSTransportBus *bus = transport->buses[i];
+
+        _LSTransportChannelClose(&bus->listen_channel, flush_and_send_shutdown);
+        _LSTransportChannelDeinit(&bus->listen_channel);
+
+        if (bus->shm) _LSTransportShmDeinit(&bus->shm);
+    }
+
+    return true;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Clean up a disconnected transport. This function should be called
+ * after @ref _LSTransportDisconnect.
+ * 
+ * @param  transport    IN  transport
+ *******************************************************************************
+ */
+void
+_LSTransportDeinit(_LSTransport *transport)
+{
+    _ls_verbose("%s: transport: %p\n", __func__, transport);
+
+    if (transport)
+    {
+        int i;
+
+        /* destroy all hash tables */
+        for (i = 0; i < transport->num_buses; i++)
+        {
+            _LSTransportBusFree(transport->buses[i]);
+            transport->buses[i] = NULL;
+        }
+        transport->num_buses = 0;
+
+        if (transport->all_connections) g_hash_table_unref(transport->all_connections);
+        transport->all_connections = NULL;
+
+        if (transport->global_token) _LSTransportGlobalTokenFree(transport->global_token);
+        transport->global_token = NULL;
+
+        if (transport->trim_source)
+        {
+            g_source_destroy(transport->trim_source);
+            g_source_unref(transport->trim_source);
+            transport->trim_source = NULL;
+        }
+
+#ifdef LS_TRANSPORT_EPOLL
+        /* any watches left belong to clients that are still referenced
+         * elsewhere */
+        if (transport->epoll) _LSTransportEpollFree(transport->epoll);
+        transport->epoll = NULL;
+#endif
+
+        if (transport->shards) _LSTransportShardsFree(transport->shards);
+        transport->shards = NULL;
+
+        /* unref the GMainContext */
+        if (transport->mainloop_context) g_main_context_unref(transport->mainloop_context);
+        transport->mainloop_context = NULL;
+
+        if (transport->service_name) g_free(transport->service_name);
+        transport->service_name = NULL;
+
+        g_free(transport);
+    }
+}
+
+_LSTransportType
+_LSTransportGetTransportType(const _LSTransport *transport)
+{
+    LS_ASSERT(transport != NULL);
+
+    /* every bus of a transport is the same type (see _LSTransportConnect) */
+    return transport->buses[0]->type;
+}
+
+bool
+_LSTransportGetPrivileged(const _LSTransportBus *bus)
+{
+    LS_ASSERT(bus != NULL);
+    return bus->privileged;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Set the flow control thresholds used for every outgoing queue
+ * (including ones that already exist). They take effect the next time a
+ * queue grows or shrinks.
+ *
+ * @attention locks the transport lock
+ * 
+ * @param  transport    IN  transport 
+ * @param  watermarks   IN  thresholds 
+ *******************************************************************************
+ */
+void
+_LSTransportSetWatermarks(_LSTransport *transport, const _LSTransportWatermarks *watermarks)
+{
+    LS_ASSERT(transport != NULL);
+    LS_ASSERT(watermarks != NULL);
+
+    TRANSPORT_LOCK(&transport->lock);
+    transport->watermarks = *watermarks;
+    TRANSPORT_UNLOCK(&transport->lock);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Dispatch the send and receive watches of every connection from a
+ * single epoll fd instead of a GSource per watch, so the main context
+ * polls one fd no matter how many clients are connected. Must be called
+ * before @ref _LSTransportGmainAttach.
+ *
+ * @attention all sending must happen on the thread running the main
+ * context (as in the hub), since the dispatcher isn't thread-safe
+ * 
+ * @param  transport    IN  transport 
+ * @param  enable       IN  true to use epoll dispatch 
+ * @param  lserror      OUT set on error 
+ * 
+ * @retval  true on success
+ * @retval  false on failure
+ *******************************************************************************
+ */
+bool
+_LSTransportSetEpollDispatch(_LSTransport *transport, bool enable, LSError *lserror)
+{
+    _LSErrorIfFail(transport != NULL, lserror);
+
+    if (transport->mainloop_context)
+    {
+        _LSErrorSet(lserror, -1, "Epoll dispatch must be set before attaching to a main context");
+        return false;
+    }
+
+#ifdef LS_TRANSPORT_EPOLL
+    transport->epoll_dispatch = enable;
+    return true;
+#else
+    if (enable)
+    {
+        _LSErrorSet(lserror, -1, "Epoll dispatch isn't supported on this platform");
+        return false;
+    }
+    return true;
+#endif
+}
+
+/** 
+ *******************************************************************************
+ * @brief Spread the send and receive watches of the connections we accept
+ * over a set of I/O threads, so that reading, parsing and writing messages
+ * isn't limited to the thread running the main context. Must be called
+ * before @ref _LSTransportGmainAttach. Takes precedence over epoll
+ * dispatch.
+ *
+ * @attention the message and disconnect handlers are called on the I/O
+ * threads, so they have to be thread-safe (the hub hands everything over
+ * to its main thread)
+ * 
+ * @param  transport    IN  transport 
+ * @param  count        IN  number of I/O threads (0 to do all I/O on the
+ *                          main context)
+ * @param  lserror      OUT set on error 
+ * 
+ * @retval  true on success
+ * @retval  false on failure
+ *******************************************************************************
+ */
+bool
+_LSTransportSetShards(_LSTransport *transport, int count, LSError *lserror)
+{
+    _LSErrorIfFail(transport != NULL, lserror);
+
+    if (transport->mainloop_context)
+    {
+        _LSErrorSet(lserror, -1, "I/O threads must be set before attaching to a main context");
+        return false;
+    }
+
+    transport->shard_count = MAX(count, 0);
+
+    return true;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Set the bounds for socket buffer autotuning. The send and receive
+ * buffers of connections accepted or made after this start within the
+ * bounds, double when the socket keeps filling up, and are halved again
+ * when the connection goes quiet.
+ *
+ * @attention locks the transport lock
+ * 
+ * @param  transport    IN  transport 
+ * @param  min_bytes    IN  smallest buffer size (0 to not autotune)
+ * @param  max_bytes    IN  largest buffer size
+ *******************************************************************************
+ */
+void
+_LSTransportSetSocketBufferLimits(_LSTransport *transport, int min_bytes, int max_bytes)
+{
+    LS_ASSERT(transport != NULL);
+
+    TRANSPORT_LOCK(&transport->lock);
+    transport->sock_buf_min = MAX(min_bytes, 0);
+    transport->sock_buf_max = MAX(max_bytes, transport->sock_buf_min);
+    TRANSPORT_UNLOCK(&transport->lock);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Set how long a connection that we initiated can go without
+ * traffic before it's closed. This bounds the fds and watches held by a
+ * service that talks to many peers once in a while.
+ *
+ * @attention locks the transport lock
+ * 
+ * @param  transport    IN  transport 
+ * @param  timeout_sec  IN  idle time in seconds (0 to keep connections open)
+ *******************************************************************************
+ */
+void
+_LSTransportSetIdleTimeout(_LSTransport *transport, int timeout_sec)
+{
+    LS_ASSERT(transport != NULL);
+
+    TRANSPORT_LOCK(&transport->lock);
+    transport->idle_timeout_us = (gint64)MAX(timeout_sec, 0) * G_USEC_PER_SEC;
+    TRANSPORT_UNLOCK(&transport->lock);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Check whether a connection can be closed for being idle: we
+ * initiated it, it has had no traffic for the idle timeout, nothing is
+ * queued or half-read, no method calls on it are waiting for a reply, and
+ * the idle handler says nothing above the transport needs it (e.g.,
+ * subscriptions whose replies would come back on it).
+ * 
+ * @param  transport    IN  transport 
+ * @param  client       IN  client 
+ * @param  now_us       IN  current time (monotonic, us)
+ * 
+ * @retval  true if the connection can be closed
+ * @retval  false otherwise
+ *******************************************************************************
+ */
+static bool
+_LSTransportClientCanCloseIdle(_LSTransport *transport, _LSTransportClient *client, gint64 now_us)
+{
+    bool idle;
+    _LSTransportBus *bus = client->bus;
+
+    if (!bus->idle_handler)
+    {
+        return false;
+    }
+
+    if (!client->initiator || client == bus->hub || client == bus->monitor
+        || client->state != _LSTransportClientStateConnected)
+    {
+        return false;
+    }
+
+    OUTGOING_LOCK(&client->outgoing->lock);
+    idle = _LSTransportClientCheckIdle(client, now_us, transport->idle_timeout_us)
+           && client->outgoing->queued_messages == 0;
+    OUTGOING_UNLOCK(&client->outgoing->lock);
+
+    if (!idle)
     {
-        _LSTransportRemoveReceiveWatch(&client->channel);
+        return false;
     }
 
-    _LSTransport *transport = _LSTransportClientGetTransport(client);
-    if (transport->listen_channel.accept_watch)
+    if (_LSTransportSerialPeekHeadSerial(client->outgoing->serial) != LSMESSAGE_TOKEN_INVALID)
     {
-        _LSTransportRemoveAcceptWatch(&transport->listen_channel);
-        _LSTransportChannelClose(&transport->listen_channel, false);
+        return false;
     }
 
-    /* we may not want to flush and send the shutdown messages if we are
-     * detaching from the mainloop */
-    if (flush_and_send_shutdown)
+    if (!g_queue_is_empty(client->incoming->complete_messages)
+        || client->incoming->tmp_msg
+        || client->incoming->read_buf_start != client->incoming->read_buf_end)
     {
-        /* NOV-99802
-         *
-         * Don't process any more incoming messages. Otherwise we might
-         * trigger more callbacks and activity. When we send the shutdown
-         * message the far side will know the last message that we processed
-         * and generate errors for the others.
-         *
-         * TODO: What happens when two services talking with each other shut
-         * down at the exact same time?
-         */
-
-        /* flush any remaining messages in the outgoing queue */
-        if (!_LSTransportFlushOutgoingMessages(client, &lserror))
-        {
-            LSErrorPrint(&lserror, stderr);
-            LSErrorFree(&lserror);
-        }
-
-        /* If we got a shutdown message from this client already, then don't try
-         * to send a shutdown message to it */
-        if (client->state != _LSTransportClientStateShutdown)
-        {
-            /* send blocking shutdown messages to client (includes hub) */
-            /* not much we can do if any of these fail except log the fact that it
-             * happened */
-            if (!_LSTransportSendShutdownMessageBlocking(client, &lserror))
-            {
-                LSErrorPrint(&lserror, stderr);
-                LSErrorFree(&lserror);
-            }
-            client->state = _LSTransportClientStateShutdown;
-        }
-        else
-        {
-            /* We don't expect this to happen */
-            g_critical("%s: did not expect client [%s (%s)] to have already sent shut down message",
-                        __func__, client->service_name, client->unique_name);
-        }
+        return false;
     }
 
-    /* close connections */
-    _LSTransportChannelClose(&client->channel, flush_and_send_shutdown);
-    _LSTransportChannelDeinit(&client->channel);
+    return bus->idle_handler(client, bus->idle_context);
 }
 
 /** 
  *******************************************************************************
- * @brief Callback to discard pending incoming messages for a given client.
- *
- * @attention This is callled with the transport lock held.
- *  
- * @param  client       IN  client 
+ * @brief Close an idle connection with the same shutdown handshake used
+ * when unregistering, so the far side knows nothing was lost. The next
+ * message to the service goes through the hub and opens a new connection,
+ * just as if the far side had restarted.
+ * 
+ * @param  client   IN  client 
  *******************************************************************************
  */
-void
-_LSTransportDiscardIncomingMessages(void *ignored, _LSTransportClient *client, GMainContext *ignored_mainloop_context)
+static void
+_LSTransportCloseIdleConnection(_LSTransportClient *client)
 {
-    LS_ASSERT(client != NULL);
+    LSError lserror;
+    LSErrorInit(&lserror);
 
-    _ls_verbose("%s: client: %p\n", __func__, client);
- 
-    _LSTransportClientRef(client);
-    _LSTransportIncoming *incoming = client->incoming;
-    int discards = 0;
+    _ls_verbose("%s: closing idle connection to \"%s\" (%s)\n", __func__, client->service_name, client->unique_name);
 
-    while (!g_queue_is_empty(incoming->complete_messages))
+    if (!_LSTransportSendShutdownMessageBlocking(client, &lserror))
     {
-        _LSTransportMessage *tmsg = (_LSTransportMessage*) g_queue_pop_head(incoming->complete_messages);
-        _LSTransportMessageUnref(tmsg);
-        discards++;
+        /* the receive watch will notice that it's broken */
+        LSErrorPrint(&lserror, stderr);
+        LSErrorFree(&lserror);
+        return;
     }
 
-    if (discards)
+    client->state = _LSTransportClientStateShutdown;
+
+    /* nothing was outstanding when we checked; anything sent since then
+     * (by another thread) is failed just as if the far side went down */
+    _LSTransportClientShutdown(client, LSMESSAGE_TOKEN_INVALID, _LSTransportDisconnectTypeClean, false);
+
+    if (_LSTransportChannelHasReceiveWatch(&client->channel))
     {
-        g_warning("%s: discarded %d messages", __func__, discards);
+        _LSTransportRemoveReceiveWatch(&client->channel);
     }
 
-    _LSTransportClientUnref(client);
+    /* let the far side see EOF now; the fd itself is closed with the last
+     * ref, so a stale write can't go to a reused fd */
+    shutdown(client->channel.fd, SHUT_RDWR);
 }
 
 /** 
  *******************************************************************************
- * @brief Discards all pending incoming messages for all clients in a transport.
+ * @brief Fail method calls that have been waiting too long for a service
+ * that isn't coming up (see @ref LS_TRANSPORT_PENDING_MAX_AGE_US).
  *
- * @attention locks the transport lock.
+ * @attention locks the transport lock
  * 
- * @param  transport    IN  transport 
+ * @param  bus          IN  bus 
+ * @param  now_us       IN  current time (monotonic, us)
  *******************************************************************************
  */
-void
-_LSTransportDiscardAllClientIncoming(_LSTransport *transport)
+static void
+_LSTransportExpirePendingMessages(_LSTransportBus *bus, gint64 now_us)
 {
+    _LSTransport *transport = bus->transport;
+    GHashTableIter iter;
+    gpointer key = NULL;
+    gpointer value = NULL;
+    GSList *expired = NULL;
+    GSList *cur = NULL;
+
     TRANSPORT_LOCK(&transport->lock);
-    g_hash_table_foreach(transport->clients, (GHFunc)_LSTransportDiscardIncomingMessages, NULL);
+    g_hash_table_iter_init(&iter, bus->pending);
+    while (g_hash_table_iter_next(&iter, &key, &value))
+    {
+        _LSTransportOutgoing *pending = value;
+
+        OUTGOING_LOCK(&pending->lock);
+        GSList *service_expired = _LSTransportOutgoingExpire(pending, now_us - LS_TRANSPORT_PENDING_MAX_AGE_US);
+
+        for (cur = service_expired; cur != NULL; cur = g_slist_next(cur))
+        {
+            _LSTransportSerialRemove(pending->serial, _LSTransportMessageGetToken(cur->data));
+        }
+        OUTGOING_UNLOCK(&pending->lock);
+
+        if (service_expired)
+        {
+            g_warning("%s: gave up on %u messages waiting for service \"%s\"", __func__,
+                      g_slist_length(service_expired), (const char*)key);
+            expired = g_slist_concat(expired, service_expired);
+        }
+    }
     TRANSPORT_UNLOCK(&transport->lock);
+
+    for (cur = expired; cur != NULL; cur = g_slist_next(cur))
+    {
+        bus->message_failure_handler(_LSTransportMessageGetToken(cur->data),
+                                     _LSTransportMessageFailureTypeServiceUnavailable,
+                                     bus->message_failure_context);
+        _LSTransportMessageUnref(cur->data);
+    }
+
+    g_slist_free(expired);
+}
+
+/* idle callback for _LSTransportTrimIdleConnections(), on a shard's context */
+static gboolean
+_LSTransportClientReleaseIdleOnShard(gpointer data)
+{
+    _LSTransportClientReleaseIdle(data);
+
+    return FALSE;
 }
 
 /** 
  *******************************************************************************
- * @brief Perform disconnect operations. Removes the watches, sends shutdown
- * messages (if requested) and closes the connections.
+ * @brief Give back what idle connections don't need: read buffers and
+ * serial rings with nothing in them, and socket buffers grown for a burst
+ * that's over. Connections that have been idle for the idle timeout (see
+ * _LSTransportSetIdleTimeout()) are closed, and method calls that have
+ * waited too long for a service to come up are failed. Runs periodically
+ * on the transport's main context.
  *
  * @attention locks the transport lock
- *
- * @param  transport    IN  transport
  * 
- * @retval  true on success
- * @retval  false on failure
+ * @param  data     IN  transport 
+ *
+ * @retval  TRUE so the timeout is kept
  *******************************************************************************
  */
-bool
-_LSTransportDisconnect(_LSTransport *transport, bool flush_and_send_shutdown)
+static gboolean
+_LSTransportTrimIdleConnections(gpointer data)
 {
-    LS_ASSERT(transport != NULL);
-
-    _ls_verbose("%s: transport: %p\n", __func__, transport);
+    _LSTransport *transport = data;
+    GHashTableIter iter;
+    gpointer value = NULL;
+    GSList *clients = NULL;
+    GSList *cur = NULL;
 
+    /* don't hold the transport lock while taking the outgoing locks */
     TRANSPORT_LOCK(&transport->lock);
-    g_hash_table_foreach(transport->all_connections, _LSTransportSendShutdownMessages, GINT_TO_POINTER((gint)flush_and_send_shutdown));
+    g_hash_table_iter_init(&iter, transport->all_connections);
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+    {
+        _LSTransportClientRef(value);
+        clients = g_slist_prepend(clients, value);
+    }
     TRANSPORT_UNLOCK(&transport->lock);
 
-    _LSTransportDiscardAllClientIncoming(transport);
+    gint64 now_us = _LSLatencyNowUs();
+    int i;
 
-    _LSTransportChannelClose(&transport->listen_channel, flush_and_send_shutdown);
-    _LSTransportChannelDeinit(&transport->listen_channel);
+    for (i = 0; i < transport->num_buses; i++)
+    {
+        _LSTransportExpirePendingMessages(transport->buses[i], now_us);
+    }
 
-    if (transport->shm) _LSTransportShmDeinit(&transport->shm);
+    for (cur = clients; cur != NULL; cur = g_slist_next(cur))
+    {
+        _LSTransportClient *client = cur->data;
 
-    return true;
-}
+        if (transport->idle_timeout_us > 0
+            && _LSTransportClientCanCloseIdle(transport, client, now_us))
+        {
+            _LSTransportCloseIdleConnection(client);
+            _LSTransportClientUnref(client);
+            continue;
+        }
 
-static gboolean
-_freePending(gpointer key, _LSTransportOutgoing *outgoing, gpointer user_data)
-{
-    LS_ASSERT(outgoing != NULL);
+        if (client->channel.context)
+        {
+            /* its read buffer belongs to the shard thread receiving on it */
+            GSource *source = g_idle_source_new();
+            _LSTransportClientRef(client);
+            g_source_set_callback(source, _LSTransportClientReleaseIdleOnShard, client,
+                                  (GDestroyNotify)_LSTransportClientUnref);
+            g_source_attach(source, client->channel.context);
+            g_source_unref(source);
+        }
+        else
+        {
+            _LSTransportClientReleaseIdle(client);
+        }
 
-    //printf("%s: outgoing queue entries: %u, serial queue entries: %u\n", __func__,
-    //       g_queue_get_length(outgoing->queue), g_queue_get_length(outgoing->serial->queue));
+        if (transport->sock_buf_min > 0)
+        {
+            OUTGOING_LOCK(&client->outgoing->lock);
+            _LSTransportClientShrinkIdleSocketBuffers(client, now_us);
+            OUTGOING_UNLOCK(&client->outgoing->lock);
+        }
 
-    _LSTransportOutgoingFree(outgoing);
+        _LSTransportClientUnref(client);
+    }
 
-    return true;
+    g_slist_free(clients);
+
+    return TRUE;
 }
 
 /** 
  *******************************************************************************
- * @brief Clean up a disconnected transport. This function should be called
- * after @ref _LSTransportDisconnect.
+ * @brief Set the body size at or above which messages are compressed to
+ * peers that support it.
+ *
+ * @attention locks the transport lock
  * 
- * @param  transport    IN  transport
+ * @param  transport    IN  transport 
+ * @param  inet_bytes   IN  threshold for inet connections (0 to never compress)
+ * @param  local_bytes  IN  threshold for local connections (0 to never compress)
  *******************************************************************************
  */
 void
-_LSTransportDeinit(_LSTransport *transport)
+_LSTransportSetCompressThresholds(_LSTransport *transport, unsigned long inet_bytes, unsigned long local_bytes)
 {
-    _ls_verbose("%s: transport: %p\n", __func__, transport);
-
-    if (transport)
-    {
-        /* destroy all hash tables */
-        if (transport->clients) g_hash_table_unref(transport->clients);
-        transport->clients = NULL;
+    LS_ASSERT(transport != NULL);
 
-        if (transport->all_connections) g_hash_table_unref(transport->all_connections);
-        transport->all_connections = NULL;
+    TRANSPORT_LOCK(&transport->lock);
+    transport->compress_threshold_inet = inet_bytes;
+    transport->compress_threshold_local = local_bytes;
+    TRANSPORT_UNLOCK(&transport->lock);
+}
 
-        g_hash_table_foreach_remove(transport->pending, (GHRFunc)_freePending, NULL);
-        if (transport->pending) g_hash_table_unref(transport->pending);
-        transport->pending = NULL;
+/** 
+ *******************************************************************************
+ * @brief Check whether the outgoing queue for a service is congested
+ * (i.e., it reached a high-water mark and hasn't drained yet). A service
+ * we're still waiting to connect to is checked against the messages
+ * pending for it.
+ *
+ * @attention locks the transport and outgoing locks
+ * 
+ * @param  bus              IN  bus
+ * @param  service_name     IN  service name 
+ * 
+ * @retval  true if congested
+ * @retval  false otherwise (including if nothing is queued for the service)
+ *******************************************************************************
+ */
+bool
+_LSTransportIsServiceCongested(_LSTransportBus *bus, const char *service_name)
+{
+    _LSTransport *transport = bus->transport;
 
-        if (transport->hub) _LSTransportClientUnref(transport->hub);
-        transport->hub = NULL;
+    bool congested = false;
 
-        if (transport->global_token) _LSTransportGlobalTokenFree(transport->global_token);
-        transport->global_token = NULL;
+    LS_ASSERT(bus != NULL);
+    LS_ASSERT(service_name != NULL);
 
-        /* unref the GMainContext */
-        if (transport->mainloop_context) g_main_context_unref(transport->mainloop_context);
-        transport->mainloop_context = NULL;
+    TRANSPORT_LOCK(&transport->lock);
 
-        if (transport->service_name) g_free(transport->service_name);
-        transport->service_name = NULL;
+    _LSTransportOutgoing *outgoing = NULL;
+    _LSTransportClient *client = g_hash_table_lookup(bus->clients, service_name);
 
-        if (transport->unique_name) g_free(transport->unique_name);
-        transport->unique_name = NULL;
+    if (client)
+    {
+        outgoing = client->outgoing;
+    }
+    else
+    {
+        outgoing = g_hash_table_lookup(bus->pending, service_name);
+    }
 
-        g_free(transport);
+    if (outgoing)
+    {
+        OUTGOING_LOCK(&outgoing->lock);
+        congested = outgoing->congested;
+        OUTGOING_UNLOCK(&outgoing->lock);
     }
-}
 
-_LSTransportType
-_LSTransportGetTransportType(const _LSTransport *transport)
-{
-    LS_ASSERT(transport != NULL);
-    return transport->type;
-}
+    TRANSPORT_UNLOCK(&transport->lock);
 
-bool
-_LSTransportGetPrivileged(const _LSTransport *transport)
-{
-    LS_ASSERT(transport != NULL);
-    return transport->privileged;
+    return congested;
 }
 
 /* NOTE: This is a blocking call */
@@ -5755,10 +8971,12 @@ error:
 }
 
 bool
-LSTransportPushRole(_LSTransport *transport, const char *path, LSError *lserror)
+LSTransportPushRole(_LSTransportBus *bus, const char *path, LSError *lserror)
 {
-    LS_ASSERT(transport != NULL);
-    LS_ASSERT(transport->hub != NULL);
+    _LSTransport *transport = bus->transport;
+
+    LS_ASSERT(bus != NULL);
+    LS_ASSERT(bus->hub != NULL);
 
     _LSTransportMessage *message = NULL;
     _LSTransportMessageIter iter;
@@ -5766,14 +8984,14 @@ LSTransportPushRole(_LSTransport *transport, const char *path, LSError *lserror)
     bool ret = false;
 
     /* Blocking send a "push role" message to the hub */
-    if (!_LSTransportSendMessagePushRole(transport->hub, path, lserror))
+    if (!_LSTransportSendMessagePushRole(bus->hub, path, lserror))
     {
         return false;
     }
 
     /* Get the reply from the hub */
     _LSTransportMessageType msg_type = _LSTransportMessageTypePushRoleReply;
-    message = _LSTransportRecvMessageBlocking(transport->hub, &msg_type, 1, -1, lserror);
+    message = _LSTransportRecvMessageBlocking(bus->hub, &msg_type, 1, -1, lserror);
 
     if (!message)
     {
@@ -5807,7 +9025,122 @@ LSTransportPushRole(_LSTransport *transport, const char *path, LSError *lserror)
 
     _LSTransportMessageUnref(message);
 
+    /* the hub forgets its permission decisions when a role is pushed */
+    TRANSPORT_LOCK(&transport->lock);
+    g_hash_table_remove_all(bus->query_name_cache);
+    TRANSPORT_UNLOCK(&transport->lock);
+
     return ret;
 }
 
+/** 
+ *******************************************************************************
+ * @brief Get the outgoing queue stats for every connected service as json:
+ *
+ * [{"service": string, "unique_name": string, "direct_sends": int,
+ *   "sent_messages": int, "sent_bytes": int, "peak_queued_bytes": int,
+ *   "peak_queued_messages": int, "socket_buffer": int, "queue_depth": histogram,
+ *   "queue_dwell": histogram},...]
+ *
+ * followed by the services that we're still waiting to connect to:
+ *
+ * {"service": string, "pending": true, "queued_bytes": int,
+ *  "queued_messages": int, "peak_queued_bytes": int, "peak_queued_messages": int}
+ * 
+ * @param  bus          IN  bus
+ * 
+ * @retval  json array on success
+ * @retval  NULL on failure
+ *******************************************************************************
+ */
+struct json_object*
+_LSTransportGetQueueStatsJson(_LSTransportBus *bus)
+{
+    _LSTransport *transport = bus->transport;
+
+    GHashTableIter iter;
+    gpointer key = NULL;
+    gpointer value = NULL;
+    GSList *clients = NULL;
+    GSList *cur = NULL;
+
+    struct json_object *ret_obj = json_object_new_array();
+    if (JSON_ERROR(ret_obj)) return NULL;
+
+    /* don't hold the transport lock while taking the outgoing locks */
+    TRANSPORT_LOCK(&transport->lock);
+    g_hash_table_iter_init(&iter, bus->clients);
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+    {
+        _LSTransportClientRef(value);
+        clients = g_slist_prepend(clients, value);
+    }
+    TRANSPORT_UNLOCK(&transport->lock);
+
+    for (cur = clients; cur != NULL; cur = g_slist_next(cur))
+    {
+        _LSTransportClient *client = cur->data;
+        struct json_object *client_obj = json_object_new_object();
+
+        if (!JSON_ERROR(client_obj))
+        {
+            const char *service_name = _LSTransportClientGetServiceName(client);
+            const char *unique_name = _LSTransportClientGetUniqueName(client);
+
+            json_object_object_add(client_obj, "service", json_object_new_string(service_name ? service_name : ""));
+            json_object_object_add(client_obj, "unique_name", json_object_new_string(unique_name ? unique_name : ""));
+
+            OUTGOING_LOCK(&client->outgoing->lock);
+            json_object_object_add(client_obj, "direct_sends", json_object_new_int64(client->outgoing->direct_sends));
+            json_object_object_add(client_obj, "coalesced", json_object_new_int64(client->outgoing->coalesced));
+            json_object_object_add(client_obj, "sent_messages", json_object_new_int64(client->outgoing->sent_messages));
+            json_object_object_add(client_obj, "sent_bytes", json_object_new_int64(client->outgoing->sent_bytes));
+            json_object_object_add(client_obj, "peak_queued_bytes", json_object_new_int64(client->outgoing->peak_queued_bytes));
+            json_object_object_add(client_obj, "peak_queued_messages", json_object_new_int64(client->outgoing->peak_queued_messages));
+            json_object_object_add(client_obj, "queued_bytes", json_object_new_int64(client->outgoing->queued_bytes));
+            json_object_object_add(client_obj, "queued_messages", json_object_new_int64(client->outgoing->queued_messages));
+            json_object_object_add(client_obj, "congested", json_object_new_boolean(client->outgoing->congested));
+            json_object_object_add(client_obj, "socket_buffer", json_object_new_int(client->sock_buf_bytes));
+            const _LSTransportOutgoingHistograms *histograms = _LSTransportOutgoingGetHistograms(client->outgoing);
+            json_object_object_add(client_obj, "queue_depth", _LSLatencyHistogramGetJson(&histograms->queue_depth, "messages"));
+            json_object_object_add(client_obj, "queue_dwell", _LSLatencyHistogramGetJson(&histograms->queue_dwell, "us"));
+            OUTGOING_UNLOCK(&client->outgoing->lock);
+
+            json_object_array_add(ret_obj, client_obj);
+        }
+
+        _LSTransportClientUnref(client);
+    }
+
+    g_slist_free(clients);
+
+    /* pending queues go away when the service connects (or fails), so
+     * these are read with the transport lock held */
+    TRANSPORT_LOCK(&transport->lock);
+    g_hash_table_iter_init(&iter, bus->pending);
+    while (g_hash_table_iter_next(&iter, &key, &value))
+    {
+        _LSTransportOutgoing *pending = value;
+        struct json_object *pending_obj = json_object_new_object();
+
+        if (!JSON_ERROR(pending_obj))
+        {
+            json_object_object_add(pending_obj, "service", json_object_new_string(key));
+            json_object_object_add(pending_obj, "pending", json_object_new_boolean(true));
+
+            OUTGOING_LOCK(&pending->lock);
+            json_object_object_add(pending_obj, "queued_bytes", json_object_new_int64(pending->queued_bytes));
+            json_object_object_add(pending_obj, "queued_messages", json_object_new_int64(pending->queued_messages));
+            json_object_object_add(pending_obj, "peak_queued_bytes", json_object_new_int64(pending->peak_queued_bytes));
+            json_object_object_add(pending_obj, "peak_queued_messages", json_object_new_int64(pending->peak_queued_messages));
+            OUTGOING_UNLOCK(&pending->lock);
+
+            json_object_array_add(ret_obj, pending_obj);
+        }
+    }
+    TRANSPORT_UNLOCK(&transport->lock);
+
+    return ret_obj;
+}
+
 /* @} END OF LunaServiceTransport */
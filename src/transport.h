@@ -29,6 +29,7 @@
 #include "error.h"
 
 typedef struct LSTransport _LSTransport;
+typedef struct LSTransportBus _LSTransportBus;
 
 #include "transport_message.h"
 #include "transport_channel.h"
@@ -122,6 +123,56 @@ _padding_bytes(unsigned int align_bytes, unsigned int size_bytes)
 /** Messages larger than 10 MB are dropped */
 #define MAX_MESSAGE_SIZE_BYTES  10485760
 
+/** Max number of io vectors gathered from the outgoing queue into a single send */
+#define MAX_SEND_BATCH_IOV      64
+
+/** Byte budget for a single batched send from the outgoing queue */
+#define MAX_SEND_BATCH_BYTES    65536
+
+/** Method call payloads at least this large (including the nul) are passed in
+ * a shared memory segment instead of being copied through the socket */
+#define LS_TRANSPORT_SHM_PAYLOAD_THRESHOLD  (64 * 1024)
+
+/** Default size at or above which message bodies are compressed to peers
+ * that support it. Only inet connections (e.g., bridged to a desktop or the
+ * emulator) compress by default; big local method calls already go through
+ * shared memory */
+#define LS_TRANSPORT_COMPRESS_THRESHOLD_INET    1024
+#define LS_TRANSPORT_COMPRESS_THRESHOLD_LOCAL   0
+
+/** How long a remembered "QueryName" result is trusted */
+#define LS_TRANSPORT_QUERY_NAME_CACHE_TTL_US    (30 * G_USEC_PER_SEC)
+
+/** How long a "no such service" answer is trusted; short, since the
+ * service may just not have been installed yet */
+#define LS_TRANSPORT_QUERY_NAME_NOT_EXIST_TTL_US    (5 * G_USEC_PER_SEC)
+
+/** Most "QueryName" results remembered per transport */
+#define LS_TRANSPORT_QUERY_NAME_CACHE_MAX       256
+
+/** Most method calls (and bytes of them) held for a single service that we
+ * haven't connected to yet; more are refused instead of queued */
+#define LS_TRANSPORT_PENDING_MAX_MESSAGES       1024
+#define LS_TRANSPORT_PENDING_MAX_BYTES          (4 * 1024 * 1024)
+
+/** Method calls that wait this long behind another call for a service to
+ * come up are failed (the call at the head is bounded by the hub's
+ * "QueryName" timeout instead) */
+#define LS_TRANSPORT_PENDING_MAX_AGE_US         (60 * G_USEC_PER_SEC)
+
+/** After losing the hub, the first reconnect attempt is made at a random
+ * point within this window, so that a restarted hub isn't hit by every
+ * client at once */
+#define LS_TRANSPORT_HUB_RECONNECT_JITTER_MS    1000
+
+/** Delay between failed reconnect attempts, doubled after each one */
+#define LS_TRANSPORT_HUB_RECONNECT_MIN_MS       250
+#define LS_TRANSPORT_HUB_RECONNECT_MAX_MS       8000
+
+/** Most buses a single transport serves (a palm service in combined mode
+ * uses one for the public bus and one for the private bus) */
+#define LS_TRANSPORT_MAX_BUSES                  2
+
 #if 0
 #include <glib/gprintf.h>
 extern FILE *debug_print_file;
@@ -171,30 +222,54 @@ void _LSTransportDeinit(_LSTransport *transport);
 void _LSTransportGmainAttach(_LSTransport *transport, GMainContext *context);
 GMainContext* _LSTransportGetGmainContext(const _LSTransport *transport);
 bool _LSTransportGmainSetPriority(_LSTransport *transport, int priority, LSError *lserror);
-bool _LSTransportConnect(_LSTransport *transport, bool local, bool public_bus, LSError *lserror);
+bool _LSTransportAddBus(_LSTransport *transport, LSTransportHandlers *handlers, _LSTransportBus **ret_bus, LSError *lserror);
+_LSTransportBus* _LSTransportGetBus(const _LSTransport *transport);
+_LSTransport* _LSTransportBusGetTransport(const _LSTransportBus *bus);
+bool _LSTransportBusSetMessageHandler(_LSTransportBus *bus, LSTransportMessageHandler msg_handler, void *msg_context);
+bool _LSTransportConnect(_LSTransportBus *bus, bool local, bool public_bus, LSError *lserror);
 _LSTransportConnectState _LSTransportConnectLocal(const char *unique_name, bool new_socket, int *fd, LSError *lserror);
 bool _LSTransportListenLocal(const char *unique_name, mode_t mode, int *fd, LSError *lserror);
-bool _LSTransportSetupListenerLocal(_LSTransport *transport, const char *name, mode_t mode, LSError *lserror);
-bool _LSTransportSetupListenerInet(_LSTransport *transport, int port, LSError *lserror);
+bool _LSTransportSetupListenerLocal(_LSTransportBus *bus, const char *name, mode_t mode, LSError *lserror);
+bool _LSTransportSetupListenerInet(_LSTransportBus *bus, int port, LSError *lserror);
 bool _LSTransportSendMessage(_LSTransportMessage *message, _LSTransportClient *client,
                         LSMessageToken *token, LSError *lserror);
 void _LSTransportAddInitialWatches(_LSTransport *transport, GMainContext *context);
 _LSTransportType _LSTransportGetTransportType(const _LSTransport *transport);
-bool _LSTransportGetPrivileged(const _LSTransport *tansport);
+bool _LSTransportGetPrivileged(const _LSTransportBus *bus);
+LSMessageToken _LSTransportGetNextToken(_LSTransport *transport);
+void _LSTransportSetWatermarks(_LSTransport *transport, const _LSTransportWatermarks *watermarks);
+void _LSTransportSetCompressThresholds(_LSTransport *transport, unsigned long inet_bytes, unsigned long local_bytes);
+bool _LSTransportSetEpollDispatch(_LSTransport *transport, bool enable, LSError *lserror);
+bool _LSTransportSetShards(_LSTransport *transport, int count, LSError *lserror);
+void _LSTransportSetSocketBufferLimits(_LSTransport *transport, int min_bytes, int max_bytes);
+void _LSTransportSetIdleTimeout(_LSTransport *transport, int timeout_sec);
+bool _LSTransportIsServiceCongested(_LSTransportBus *bus, const char *service_name);
 
 inline bool _LSTransportIsHub(void);
 
-bool LSTransportSend(_LSTransport *transport, const char *service_name, const char *category, const char *method, const char *payload, const char* applicationId, LSMessageToken *token, LSError *lserror);
+bool LSTransportSend(_LSTransportBus *bus, const char *service_name, const char *category, const char *method, const char *payload, const char* applicationId, LSMessageToken *token, LSError *lserror);
+bool LSTransportSendWithLen(_LSTransportBus *bus, const char *service_name, const char *category, const char *method, const char *payload, unsigned long payload_len, const char* applicationId, LSMessageToken *token, LSError *lserror);
+bool LSTransportSendBinary(_LSTransportBus *bus, const char *service_name, const char *category, const char *method, const char *payload, unsigned long payload_len, const char* applicationId, LSMessageToken *token, LSError *lserror);
+bool LSTransportSendDeferred(_LSTransportBus *bus, const char *service_name, const char *category, const char *method, const char *payload, unsigned long payload_len, const char* applicationId, GPtrArray *flush, LSMessageToken *token, LSError *lserror);
+void LSTransportFlushDeferred(GPtrArray *flush);
 bool _LSTransportSendReply(const _LSTransportMessage *message, const char *payload, LSError *lserror);
+bool _LSTransportSendReplyWithLen(const _LSTransportMessage *message, const char *payload, unsigned long payload_len, LSError *lserror);
+bool _LSTransportSendReplyBinary(const _LSTransportMessage *message, const char *payload, unsigned long payload_len, LSError *lserror);
+bool _LSTransportSendReplyShared(_LSTransportMessage * const *messages, int num_messages, const char *payload, unsigned long payload_len, bool coalesce, LSError *lserror);
+void _LSTransportHandleMessageResult(const _LSTransportMessage *message, LSMessageHandlerResult ret);
+
+struct json_object;
+struct json_object* _LSTransportGetQueueStatsJson(_LSTransportBus *bus);
 
-bool LSTransportCancelMethodCall(_LSTransport *transport, const char *service_name, LSMessageToken serial, LSError *lserror);
+bool LSTransportCancelMethodCall(_LSTransportBus *bus, const char *service_name, LSMessageToken serial, LSError *lserror);
 
-bool LSTransportPushRole(_LSTransport *transport, const char *path, LSError *lserror);
+bool LSTransportPushRole(_LSTransportBus *bus, const char *path, LSError *lserror);
 
 /* TODO: move these */
-bool LSTransportSendMessageMonitorRequest(_LSTransport *transport, LSError *lserror);
-bool _LSTransportSendMessageListClients(_LSTransport *transport, LSError *lserror);
-bool LSTransportSendQueryServiceStatus(_LSTransport *transport, const char *service_name, LSMessageToken *serial, LSError *lserror);
+bool LSTransportSendMessageMonitorRequest(_LSTransportBus *bus, const char *names, int32_t types, int32_t sample_rate, LSError *lserror);
+bool _LSTransportSendMessageListClients(_LSTransportBus *bus, LSError *lserror);
+bool _LSTransportSendMessageHubStats(_LSTransportBus *bus, LSError *lserror);
+bool LSTransportSendQueryServiceStatus(_LSTransportBus *bus, const char *service_name, LSMessageToken *serial, LSError *lserror);
 const char* _LSTransportQueryNameReplyGetUniqueName(_LSTransportMessage *message);
 
 #endif // _TRANSPORT_H_
@@ -63,6 +63,9 @@ _LSTransportChannelInit(_LSTransport *transport, _LSTransportChannel *channel, i
     channel->channel = g_io_channel_unix_new(fd);
     channel->send_watch = NULL;
     channel->recv_watch = NULL;
+    channel->send_epoll = false;
+    channel->recv_epoll = false;
+    channel->context = NULL;
     channel->accept_watch = NULL;
     
     return true;
@@ -80,12 +83,12 @@ _LSTransportChannelDeinit(_LSTransportChannel *channel)
 {
     LS_ASSERT(channel != NULL);
    
-    if (channel->send_watch)
+    if (_LSTransportChannelHasSendWatch(channel))
     {
         _LSTransportRemoveSendWatch(channel);
     }
 
-    if (channel->recv_watch)
+    if (_LSTransportChannelHasReceiveWatch(channel))
     {
         _LSTransportRemoveReceiveWatch(channel);
     }
@@ -180,14 +183,14 @@ bool
 _LSTransportChannelHasReceiveWatch(const _LSTransportChannel *channel)
 {
     LS_ASSERT(channel != NULL);
-    return (channel->recv_watch != NULL);
+    return (channel->recv_watch != NULL || channel->recv_epoll);
 }
 
 bool
 _LSTransportChannelHasSendWatch(const _LSTransportChannel *channel)
 {
     LS_ASSERT(channel != NULL);
-    return (channel->send_watch != NULL);
+    return (channel->send_watch != NULL || channel->send_epoll);
 }
 
 /** 
@@ -36,6 +36,10 @@ struct LSTransportChannel {
     GSource *send_watch;
     GSource *recv_watch;
     GSource *accept_watch;      /**< only used on listen channel (one per transport */
+    bool send_epoll;            /**< send watch is on the transport's epoll dispatcher */
+    bool recv_epoll;            /**< receive watch is on the transport's epoll dispatcher */
+    GMainContext *context;      /**< context of the I/O thread that runs the send/recv
+                                     watches (NULL for the transport's context) */
 };
 
 typedef struct LSTransportChannel _LSTransportChannel;
@@ -18,6 +18,8 @@
 
 
 #include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
 
 #include "transport.h"
 #include "transport_priv.h"
@@ -35,11 +37,13 @@
  * @{
  */
 
+static void _LSTransportClientInitSocketBuffers(_LSTransportClient *client);
+
 /** 
  *******************************************************************************
  * @brief Allocate a new client.
  * 
- * @param  transport        IN  transport 
+ * @param  bus              IN  bus the connection is on
  * @param  fd               IN  fd 
  * @param  service_name     IN  client service name 
  * @param  unique_name      IN  client unique name 
@@ -51,8 +55,9 @@
  *******************************************************************************
  */
 _LSTransportClient*
-_LSTransportClientNew(_LSTransport* transport, int fd, const char *service_name, const char *unique_name, _LSTransportOutgoing *outgoing, bool initiator)
+_LSTransportClientNew(_LSTransportBus *bus, int fd, const char *service_name, const char *unique_name, _LSTransportOutgoing *outgoing, bool initiator)
 {
+    _LSTransport *transport = bus->transport;
     _LSTransportClient *new_client = g_slice_new0(_LSTransportClient);
 
     if (!new_client)
@@ -65,12 +70,16 @@ _LSTransportClientNew(_LSTransport* transport, int fd, const char *service_name,
     new_client->service_name = g_strdup(service_name);
     new_client->unique_name = g_strdup(unique_name);
     new_client->transport = transport;
+    new_client->bus = bus;
     new_client->state = _LSTransportClientStateInvalid;
     new_client->is_sysmgr_app_proxy = false;
     new_client->is_dynamic = false;
     new_client->initiator = initiator;
+    new_client->incoming_parked = false;
+    new_client->idle_since_us = _LSLatencyNowUs();
 
     _LSTransportChannelInit(transport, &new_client->channel, fd, transport->source_priority);
+    _LSTransportClientInitSocketBuffers(new_client);
 
     new_client->cred = _LSTransportCredNew();
     if (!new_client->cred)
@@ -80,7 +89,7 @@ _LSTransportClientNew(_LSTransport* transport, int fd, const char *service_name,
 
     /* Get pid, gid, and uid of client if we're local. It won't work for obvious
      * reasons if it's a TCP/IP connection */
-    if (_LSTransportGetTransportType(transport) == _LSTransportTypeLocal)
+    if (bus->type == _LSTransportTypeLocal)
     {
         LSError lserror;
         LSErrorInit(&lserror);
@@ -98,7 +107,7 @@ _LSTransportClientNew(_LSTransport* transport, int fd, const char *service_name,
     }
     else
     {
-        new_client->outgoing = _LSTransportOutgoingNew();
+        new_client->outgoing = _LSTransportOutgoingNew(&transport->watermarks);
         if (!new_client->outgoing)
         {
             goto error;
@@ -163,7 +172,7 @@ _LSTransportClientFree(_LSTransportClient* client)
  *******************************************************************************
  * @brief Allocate a new client with a ref count of 1.
  *
- * @param  transport        IN  transport 
+ * @param  bus              IN  bus the connection is on
  * @param  fd               IN  fd 
  * @param  service_name     IN  client service name 
  * @param  unique_name      IN  client unique name 
@@ -175,9 +184,9 @@ _LSTransportClientFree(_LSTransportClient* client)
  *******************************************************************************
  */
 _LSTransportClient*
-_LSTransportClientNewRef(_LSTransport* transport, int fd, const char *service_name, const char *unique_name, _LSTransportOutgoing *outgoing, bool initiator)
+_LSTransportClientNewRef(_LSTransportBus *bus, int fd, const char *service_name, const char *unique_name, _LSTransportOutgoing *outgoing, bool initiator)
 {
-    _LSTransportClient *client = _LSTransportClientNew(transport, fd, service_name, unique_name, outgoing, initiator);
+    _LSTransportClient *client = _LSTransportClientNew(bus, fd, service_name, unique_name, outgoing, initiator);
     if (client)
     {
         client->ref = 1;
@@ -288,6 +297,13 @@ _LSTransportClientGetTransport(const _LSTransportClient *client)
     return client->transport;
 }
 
+_LSTransportBus*
+_LSTransportClientGetBus(const _LSTransportClient *client)
+{
+    LS_ASSERT(client != NULL);
+    return client->bus;
+}
+
 /** 
  *******************************************************************************
  * @brief Get credentials for the client.
@@ -305,4 +321,200 @@ _LSTransportClientGetCred(const _LSTransportClient *client)
     return client->cred;
 }
 
+/** 
+ *******************************************************************************
+ * @brief Set the send and receive socket buffer sizes of a client and
+ * remember what the kernel actually gave us.
+ * 
+ * @param  client   IN  client 
+ * @param  bytes    IN  requested size 
+ *
+ * @retval  true on success
+ * @retval  false on failure
+ *******************************************************************************
+ */
+static bool
+_LSTransportClientSetSocketBuffers(_LSTransportClient *client, int bytes)
+{
+    int fd = client->channel.fd;
+    int actual = 0;
+    socklen_t len = sizeof(actual);
+
+    if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bytes, sizeof(bytes)) != 0
+        || setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes)) != 0)
+    {
+        g_debug("Unable to set socket buffer size to %d: %s", bytes, g_strerror(errno));
+        return false;
+    }
+
+    /* Linux reports double the size that was set (for bookkeeping overhead) */
+    if (getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &actual, &len) == 0 && actual > 0)
+    {
+        client->sock_buf_bytes = MIN(actual / 2, client->transport->sock_buf_max);
+    }
+    else
+    {
+        client->sock_buf_bytes = bytes;
+    }
+
+    _ls_verbose("%s: client: %p, socket buffers: %d\n", __func__, client, client->sock_buf_bytes);
+
+    return true;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Bring a new client's socket buffers within the transport's
+ * autotuning limits (if any).
+ * 
+ * @param  client   IN  client 
+ *******************************************************************************
+ */
+static void
+_LSTransportClientInitSocketBuffers(_LSTransportClient *client)
+{
+    int min_bytes = client->transport->sock_buf_min;
+    int max_bytes = client->transport->sock_buf_max;
+    int current = 0;
+    socklen_t len = sizeof(current);
+
+    if (min_bytes <= 0 || client->channel.fd < 0)
+    {
+        return;
+    }
+
+    if (getsockopt(client->channel.fd, SOL_SOCKET, SO_SNDBUF, &current, &len) != 0)
+    {
+        return;
+    }
+
+    current /= 2;
+    client->sock_full_us = _LSLatencyNowUs();
+
+    if (current < min_bytes || current > max_bytes)
+    {
+        _LSTransportClientSetSocketBuffers(client, CLAMP(current, min_bytes, max_bytes));
+    }
+    else
+    {
+        client->sock_buf_bytes = current;
+    }
+}
+
+/** 
+ *******************************************************************************
+ * @brief Note that a write to the client couldn't complete because the
+ * socket buffer was full. If that keeps happening, double the socket
+ * buffers (up to the transport's limit) so a busy client's queue drains in
+ * fewer wakeups.
+ *
+ * @attention call with the outgoing lock of the client held
+ * 
+ * @param  client   IN  client 
+ *******************************************************************************
+ */
+void
+_LSTransportClientSocketFull(_LSTransportClient *client)
+{
+    LS_ASSERT(client != NULL);
+
+    if (client->sock_buf_bytes == 0)
+    {
+        return;
+    }
+
+    client->sock_full_us = _LSLatencyNowUs();
+
+    if (++client->sock_full_count < LS_TRANSPORT_SOCKET_BUF_GROW_COUNT
+        || client->sock_buf_bytes >= client->transport->sock_buf_max)
+    {
+        return;
+    }
+
+    client->sock_full_count = 0;
+    _LSTransportClientSetSocketBuffers(client, MIN(client->sock_buf_bytes * 2, client->transport->sock_buf_max));
+}
+
+/** 
+ *******************************************************************************
+ * @brief Halve the socket buffers of a client (down to the transport's
+ * limit) if its socket hasn't been full for a while, so idle clients don't
+ * pin kernel memory.
+ *
+ * @attention call with the outgoing lock of the client held
+ * 
+ * @param  client   IN  client 
+ * @param  now_us   IN  current time 
+ *******************************************************************************
+ */
+void
+_LSTransportClientShrinkIdleSocketBuffers(_LSTransportClient *client, gint64 now_us)
+{
+    LS_ASSERT(client != NULL);
+
+    if (client->sock_buf_bytes <= client->transport->sock_buf_min
+        || now_us - client->sock_full_us < LS_TRANSPORT_SOCKET_BUF_IDLE_US)
+    {
+        return;
+    }
+
+    client->sock_full_count = 0;
+    client->sock_full_us = now_us;  /* wait another idle period before shrinking again */
+    _LSTransportClientSetSocketBuffers(client, MAX(client->sock_buf_bytes / 2, client->transport->sock_buf_min));
+}
+
+/** 
+ *******************************************************************************
+ * @brief Free the buffers an idle client doesn't need right now (they are
+ * allocated again on first use).
+ *
+ * @attention call from the thread receiving on the client (its shard's, if
+ * it has one)
+ * 
+ * @param  client   IN  client 
+ *******************************************************************************
+ */
+void
+_LSTransportClientReleaseIdle(_LSTransportClient *client)
+{
+    LS_ASSERT(client != NULL);
+
+    _LSTransportIncomingReleaseIdle(client->incoming);
+    _LSTransportSerialReleaseIdle(client->outgoing->serial);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Check whether a client has gone without sending or receiving a
+ * message for at least timeout_us. Traffic is noticed by comparing the
+ * message counters with the last check, so this is only as precise as the
+ * interval it's called at.
+ *
+ * @attention call with the outgoing lock held
+ * 
+ * @param  client       IN  client 
+ * @param  now_us       IN  current time (monotonic, us)
+ * @param  timeout_us   IN  idle time
+ * 
+ * @retval  true if client has been idle for timeout_us
+ * @retval  false otherwise
+ *******************************************************************************
+ */
+bool
+_LSTransportClientCheckIdle(_LSTransportClient *client, gint64 now_us, gint64 timeout_us)
+{
+    LS_ASSERT(client != NULL);
+
+    guint64 activity = client->incoming->received_messages + client->outgoing->sent_messages;
+
+    if (activity != client->activity_mark)
+    {
+        client->activity_mark = activity;
+        client->idle_since_us = now_us;
+        return false;
+    }
+
+    return now_us - client->idle_since_us >= timeout_us;
+}
+
 /* @} END OF LunaServiceTransportClient */
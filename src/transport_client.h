@@ -33,6 +33,12 @@ typedef enum LSTransportClientState {
     _LSTransportClientStateDisconnected,    /**< disconnected */
 } _LSTransportClientState;
 
+#define LS_TRANSPORT_SOCKET_BUF_GROW_COUNT  4   /**< grow the socket buffers after this many
+                                                     "socket full" events at the current size */
+#define LS_TRANSPORT_SOCKET_BUF_IDLE_US     (30 * G_USEC_PER_SEC)   /**< shrink the socket buffers
+                                                                         if the socket hasn't been
+                                                                         full for this long */
+
 /**
  * A "client" encapsulates a connection to someone that you want to
  * communicate with. In the Luna Service world, the name is a bit misleading
@@ -50,6 +56,7 @@ struct LSTransportClient {
     char *service_name;                 /**< well-known name (e.g., com.palm.foo) */
     _LSTransportClientState state;      /* TODO: locking? */
     _LSTransport *transport;            /**< ptr back to overall transport obj */
+    _LSTransportBus *bus;               /**< bus the connection is on */
     _LSTransportChannel channel;
     _LSTransportCred *cred;             /**< security credentials */
     _LSTransportOutgoing *outgoing;
@@ -59,17 +66,29 @@ struct LSTransportClient {
                                           used by apps */
     bool is_dynamic;                    /**< true for a dynamic service */
     bool initiator;                     /**< true if this is side that initiated the connection (typically by a method call) */
+    bool incoming_parked;               /**< true while incoming messages wait for cred to be resolved */
+    unsigned int peer_caps;             /**< LS_TRANSPORT_CAP_* that the other side supports */
+    int sock_buf_bytes;                 /**< current SO_SNDBUF/SO_RCVBUF size when autotuning (0 if not) */
+    unsigned int sock_full_count;       /**< "socket full" events since the buffers were last resized */
+    gint64 sock_full_us;                /**< time of the last "socket full" event */
+    guint64 activity_mark;              /**< messages sent and received as of the last idle check */
+    gint64 idle_since_us;               /**< time traffic was last seen by an idle check */
 };
 
-_LSTransportClient* _LSTransportClientNew(_LSTransport* transport, int fd, const char *service_name, const char *unique_name, _LSTransportOutgoing *outgoing, bool initiator);
+_LSTransportClient* _LSTransportClientNew(_LSTransportBus *bus, int fd, const char *service_name, const char *unique_name, _LSTransportOutgoing *outgoing, bool initiator);
 void _LSTransportClientFree(_LSTransportClient* client);
-_LSTransportClient* _LSTransportClientNewRef(_LSTransport* transport, int fd, const char *service_name, const char *unique_name, _LSTransportOutgoing *outgoing, bool initiator);
+_LSTransportClient* _LSTransportClientNewRef(_LSTransportBus *bus, int fd, const char *service_name, const char *unique_name, _LSTransportOutgoing *outgoing, bool initiator);
 void _LSTransportClientRef(_LSTransportClient *client);
 void _LSTransportClientUnref(_LSTransportClient *client);
 const char* _LSTransportClientGetUniqueName(const _LSTransportClient *client);
 const char* _LSTransportClientGetServiceName(const _LSTransportClient *client);
 _LSTransportChannel* _LSTransportClientGetChannel(_LSTransportClient *client);
 _LSTransport* _LSTransportClientGetTransport(const _LSTransportClient *client);
+_LSTransportBus* _LSTransportClientGetBus(const _LSTransportClient *client);
 const _LSTransportCred* _LSTransportClientGetCred(const _LSTransportClient *client);
+void _LSTransportClientSocketFull(_LSTransportClient *client);
+void _LSTransportClientShrinkIdleSocketBuffers(_LSTransportClient *client, gint64 now_us);
+void _LSTransportClientReleaseIdle(_LSTransportClient *client);
+bool _LSTransportClientCheckIdle(_LSTransportClient *client, gint64 now_us, gint64 timeout_us);
 
 #endif      // _TRANSPORT_CLIENT_H_
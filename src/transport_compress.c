@@ -0,0 +1,137 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2008-2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include <string.h>
+#include <zlib.h>
+#include <glib.h>
+
+#include "transport_compress.h"
+
+/**
+ * @addtogroup LunaServiceTransportCompress
+ *
+ * @{
+ */
+
+/** Favor speed; the links this is for are slow, but the sender's cpu
+ * shouldn't become the bottleneck either */
+#define COMPRESS_LEVEL  Z_BEST_SPEED
+
+/**
+ *******************************************************************************
+ * @brief Compress a message body.
+ *
+ * @param  data             IN  body
+ * @param  data_len         IN  size of body
+ * @param  reserve          IN  bytes to leave free at the start of the
+ *                              returned buffer (e.g., for a header)
+ * @param  compressed_len   OUT size of the compressed body (prefix + zlib
+ *                              stream, not including reserve)
+ *
+ * @retval  buffer (free with g_free) on success
+ * @retval  NULL on failure or if the body doesn't get any smaller
+ *******************************************************************************
+ */
+char*
+_LSTransportCompress(const char *data, unsigned long data_len, unsigned long reserve, unsigned long *compressed_len)
+{
+    if (data_len > UINT32_MAX)
+    {
+        return NULL;
+    }
+
+    uLongf stream_len = compressBound(data_len);
+
+    char *ret = g_malloc(reserve + LS_TRANSPORT_COMPRESS_PREFIX_SIZE + stream_len);
+
+    uint32_t orig_len = data_len;
+    memcpy(ret + reserve, &orig_len, sizeof(orig_len));
+
+    if (compress2((Bytef*)ret + reserve + LS_TRANSPORT_COMPRESS_PREFIX_SIZE, &stream_len,
+                  (const Bytef*)data, data_len, COMPRESS_LEVEL) != Z_OK
+        || LS_TRANSPORT_COMPRESS_PREFIX_SIZE + stream_len >= data_len)
+    {
+        g_free(ret);
+        return NULL;
+    }
+
+    *compressed_len = LS_TRANSPORT_COMPRESS_PREFIX_SIZE + stream_len;
+
+    return ret;
+}
+
+/**
+ *******************************************************************************
+ * @brief Get the size a compressed body will have once it's decompressed.
+ *
+ * @param  compressed       IN  compressed body
+ * @param  compressed_len   IN  size of compressed body
+ *
+ * @retval  size on success
+ * @retval  -1 if the body is too short to be compressed
+ *******************************************************************************
+ */
+long
+_LSTransportDecompressedSize(const char *compressed, unsigned long compressed_len)
+{
+    uint32_t orig_len = 0;
+
+    if (compressed_len < LS_TRANSPORT_COMPRESS_PREFIX_SIZE)
+    {
+        return -1;
+    }
+
+    memcpy(&orig_len, compressed, sizeof(orig_len));
+
+    return orig_len;
+}
+
+/**
+ *******************************************************************************
+ * @brief Decompress a message body.
+ *
+ * @param  compressed       IN  compressed body
+ * @param  compressed_len   IN  size of compressed body
+ * @param  out              OUT decompressed body
+ * @param  out_len          IN  size of decompressed body, from @ref
+ *                              _LSTransportDecompressedSize
+ * @param  lserror          OUT set on error
+ *
+ * @retval  true on success
+ * @retval  false on failure
+ *******************************************************************************
+ */
+bool
+_LSTransportDecompress(const char *compressed, unsigned long compressed_len, char *out, unsigned long out_len, LSError *lserror)
+{
+    uLongf dest_len = out_len;
+
+    int ret = uncompress((Bytef*)out, &dest_len,
+                         (const Bytef*)compressed + LS_TRANSPORT_COMPRESS_PREFIX_SIZE,
+                         compressed_len - LS_TRANSPORT_COMPRESS_PREFIX_SIZE);
+
+    if (ret != Z_OK || dest_len != out_len)
+    {
+        _LSErrorSet(lserror, -EINVAL, "Unable to decompress message body (zlib: %d)", ret);
+        return false;
+    }
+
+    return true;
+}
+
+/* @} END OF LunaServiceTransportCompress */
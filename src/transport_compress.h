@@ -0,0 +1,37 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2008-2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+#ifndef _TRANSPORT_COMPRESS_H_
+#define _TRANSPORT_COMPRESS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "error.h"
+
+/**
+ * A compressed message body is the size of the original body (uint32_t, in
+ * host byte order like the rest of the header) followed by the zlib stream.
+ */
+#define LS_TRANSPORT_COMPRESS_PREFIX_SIZE   sizeof(uint32_t)
+
+char* _LSTransportCompress(const char *data, unsigned long data_len, unsigned long reserve, unsigned long *compressed_len);
+long _LSTransportDecompressedSize(const char *compressed, unsigned long compressed_len);
+bool _LSTransportDecompress(const char *compressed, unsigned long compressed_len, char *out, unsigned long out_len, LSError *lserror);
+
+#endif  /* _TRANSPORT_COMPRESS_H_ */
@@ -0,0 +1,559 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2008-2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "transport_epoll.h"
+#include "transport_utils.h"
+
+#ifdef LS_TRANSPORT_EPOLL
+
+#include <sys/epoll.h>
+
+#define EPOLL_MAX_EVENTS    64  /**< most ready fds handled per dispatch */
+
+/**
+ * @defgroup LunaServiceTransportEpoll
+ * @ingroup LunaServiceTransport
+ * @brief Single-source epoll dispatch of channel watches
+ */
+
+/**
+ * @addtogroup LunaServiceTransportEpoll
+ * @{
+ */
+
+/**
+ * One watch (send or receive) on a channel. Behaves like the GSource that
+ * g_io_create_watch() would have made: the callback returning FALSE
+ * removes the watch and destroy_cb is called with user_data when it's
+ * removed.
+ */
+typedef struct _LSTransportEpollWatch {
+    bool active;
+    GIOFunc callback;
+    void *user_data;
+    GDestroyNotify destroy_cb;
+} _LSTransportEpollWatch;
+
+typedef struct _LSTransportEpollEntry {
+    int fd;
+    _LSTransportChannel *channel;   /**< channel that owns the watches on fd */
+    uint32_t events;                /**< events currently registered with epoll */
+    _LSTransportEpollWatch recv;
+    _LSTransportEpollWatch send;
+} _LSTransportEpollEntry;
+
+struct _LSTransportEpoll {
+    GSource source;                 /**< must be first */
+    GPollFD pollfd;                 /**< the epoll fd, polled by the main context */
+    GHashTable *entries;            /**< fd --> _LSTransportEpollEntry */
+    int dispatch_depth;             /**< > 0 while calling a watch callback */
+    GSList *deferred;               /**< _LSTransportEpollWatch whose destroy callbacks
+                                         wait until the callback returns */
+};
+
+static _LSTransportEpollWatch*
+_LSTransportEpollEntryGetWatch(_LSTransportEpollEntry *entry, GIOCondition condition)
+{
+    return (condition & G_IO_OUT) ? &entry->send : &entry->recv;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Bring the epoll registration of an fd in line with its active
+ * watches, dropping the entry once it has none.
+ * 
+ * @param  epoll    IN  epoll dispatcher 
+ * @param  entry    IN  entry (may be freed)
+ *******************************************************************************
+ */
+static void
+_LSTransportEpollEntryUpdate(_LSTransportEpoll *epoll, _LSTransportEpollEntry *entry)
+{
+    struct epoll_event event;
+    int ret = 0;
+
+    memset(&event, 0, sizeof(event));
+    event.data.fd = entry->fd;
+
+    if (entry->recv.active) event.events |= EPOLLIN;
+    if (entry->send.active) event.events |= EPOLLOUT;
+
+    if (event.events == entry->events)
+    {
+        /* nothing to do */
+    }
+    else if (event.events == 0)
+    {
+        /* an fd that was already closed is gone from the set, so ignore
+         * errors */
+        (void)epoll_ctl(epoll->pollfd.fd, EPOLL_CTL_DEL, entry->fd, &event);
+    }
+    else
+    {
+        ret = epoll_ctl(epoll->pollfd.fd, entry->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, entry->fd, &event);
+
+        /* the fd may have been closed (and reused) behind our back */
+        if (ret != 0 && errno == ENOENT)
+        {
+            ret = epoll_ctl(epoll->pollfd.fd, EPOLL_CTL_ADD, entry->fd, &event);
+        }
+        else if (ret != 0 && errno == EEXIST)
+        {
+            ret = epoll_ctl(epoll->pollfd.fd, EPOLL_CTL_MOD, entry->fd, &event);
+        }
+
+        if (ret != 0)
+        {
+            g_critical("%s: epoll_ctl failed for fd %d: %s", __func__, entry->fd, g_strerror(errno));
+        }
+    }
+
+    entry->events = event.events;
+
+    if (entry->events == 0)
+    {
+        g_hash_table_remove(epoll->entries, GINT_TO_POINTER(entry->fd));
+    }
+}
+
+/** 
+ *******************************************************************************
+ * @brief Deactivate a watch and call its destroy callback. The watch is
+ * marked inactive first, so the callback may safely remove the same watch
+ * again (and even free the channel). Like a GSource, a watch removed from
+ * inside a watch callback keeps its user_data alive until the callback
+ * returns.
+ * 
+ * @param  epoll    IN  epoll dispatcher 
+ * @param  watch    IN  watch 
+ *******************************************************************************
+ */
+static void
+_LSTransportEpollWatchDestroy(_LSTransportEpoll *epoll, _LSTransportEpollWatch *watch)
+{
+    _LSTransportEpollWatch removed = *watch;
+
+    memset(watch, 0, sizeof(*watch));
+
+    if (!removed.destroy_cb)
+    {
+        return;
+    }
+
+    if (epoll->dispatch_depth > 0)
+    {
+        epoll->deferred = g_slist_prepend(epoll->deferred, g_slice_dup(_LSTransportEpollWatch, &removed));
+    }
+    else
+    {
+        removed.destroy_cb(removed.user_data);
+    }
+}
+
+/** 
+ *******************************************************************************
+ * @brief Call the destroy callbacks of watches that were removed while a
+ * watch callback was running.
+ * 
+ * @param  epoll    IN  epoll dispatcher 
+ *******************************************************************************
+ */
+static void
+_LSTransportEpollRunDeferred(_LSTransportEpoll *epoll)
+{
+    while (epoll->deferred)
+    {
+        _LSTransportEpollWatch *removed = epoll->deferred->data;
+
+        epoll->deferred = g_slist_delete_link(epoll->deferred, epoll->deferred);
+        removed->destroy_cb(removed->user_data);
+        g_slice_free(_LSTransportEpollWatch, removed);
+    }
+}
+
+/** 
+ *******************************************************************************
+ * @brief Call a watch on fd, removing it if the callback returns FALSE.
+ * 
+ * @param  epoll        IN  epoll dispatcher 
+ * @param  fd           IN  fd that's ready
+ * @param  condition    IN  G_IO_OUT for the send watch, else the receive watch
+ * @param  revents      IN  what's ready
+ *******************************************************************************
+ */
+static void
+_LSTransportEpollDispatchWatch(_LSTransportEpoll *epoll, int fd, GIOCondition condition, GIOCondition revents)
+{
+    /* look the entry up each time, since an earlier callback may have
+     * removed it */
+    _LSTransportEpollEntry *entry = g_hash_table_lookup(epoll->entries, GINT_TO_POINTER(fd));
+
+    if (!entry)
+    {
+        return;
+    }
+
+    _LSTransportEpollWatch *watch = _LSTransportEpollEntryGetWatch(entry, condition);
+
+    if (!watch->active)
+    {
+        return;
+    }
+
+    _LSTransportChannel *channel = entry->channel;
+    void *user_data = watch->user_data;
+
+    epoll->dispatch_depth++;
+
+    if (!watch->callback(channel->channel, revents, user_data))
+    {
+        /* FALSE means the watch should be removed -- unless the callback
+         * already did that (possibly followed by adding a new one) */
+        entry = g_hash_table_lookup(epoll->entries, GINT_TO_POINTER(fd));
+
+        if (entry && entry->channel == channel)
+        {
+            watch = _LSTransportEpollEntryGetWatch(entry, condition);
+
+            if (watch->active && watch->user_data == user_data)
+            {
+                _LSTransportEpollWatchDestroy(epoll, watch);
+                _LSTransportEpollEntryUpdate(epoll, entry);
+            }
+        }
+    }
+
+    if (--epoll->dispatch_depth == 0)
+    {
+        _LSTransportEpollRunDeferred(epoll);
+    }
+}
+
+static gboolean
+_LSTransportEpollPrepare(GSource *source, gint *timeout)
+{
+    *timeout = -1;
+    return FALSE;
+}
+
+static gboolean
+_LSTransportEpollCheck(GSource *source)
+{
+    _LSTransportEpoll *epoll = (_LSTransportEpoll*)source;
+    return (epoll->pollfd.revents & G_IO_IN) != 0;
+}
+
+static gboolean
+_LSTransportEpollDispatch(GSource *source, GSourceFunc callback, gpointer user_data)
+{
+    _LSTransportEpoll *epoll = (_LSTransportEpoll*)source;
+    struct epoll_event events[EPOLL_MAX_EVENTS];
+    int i = 0;
+
+    int num_events = epoll_wait(epoll->pollfd.fd, events, EPOLL_MAX_EVENTS, 0);
+
+    if (num_events < 0 && errno != EINTR)
+    {
+        g_critical("%s: epoll_wait failed: %s", __func__, g_strerror(errno));
+    }
+
+    for (i = 0; i < num_events; i++)
+    {
+        int fd = events[i].data.fd;
+        uint32_t ready = events[i].events;
+        GIOCondition revents = 0;
+
+        if (ready & EPOLLIN) revents |= G_IO_IN;
+        if (ready & EPOLLOUT) revents |= G_IO_OUT;
+        if (ready & EPOLLERR) revents |= G_IO_ERR;
+        if (ready & EPOLLHUP) revents |= G_IO_HUP;
+
+        /* same order as separate watches at the same priority would run */
+        if (revents & (G_IO_IN | G_IO_ERR | G_IO_HUP))
+        {
+            _LSTransportEpollDispatchWatch(epoll, fd, G_IO_IN, revents);
+        }
+
+        if (revents & G_IO_OUT)
+        {
+            _LSTransportEpollDispatchWatch(epoll, fd, G_IO_OUT, revents);
+        }
+    }
+
+    return TRUE;
+}
+
+static void
+_LSTransportEpollFinalize(GSource *source)
+{
+    _LSTransportEpoll *epoll = (_LSTransportEpoll*)source;
+
+    if (epoll->entries) g_hash_table_unref(epoll->entries);
+    if (epoll->pollfd.fd >= 0) close(epoll->pollfd.fd);
+}
+
+static GSourceFuncs _LSTransportEpollFuncs = {
+    _LSTransportEpollPrepare,
+    _LSTransportEpollCheck,
+    _LSTransportEpollDispatch,
+    _LSTransportEpollFinalize,
+};
+
+static void
+_LSTransportEpollEntryFree(_LSTransportEpollEntry *entry)
+{
+#ifdef MEMCHECK
+    memset(entry, 0xFF, sizeof(_LSTransportEpollEntry));
+#endif
+
+    g_slice_free(_LSTransportEpollEntry, entry);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Create an epoll dispatcher and attach it to a main context.
+ *
+ * @attention all watches must be added, removed, and dispatched from the
+ * thread running the main context
+ * 
+ * @param  context      IN  main context 
+ * @param  priority     IN  glib priority of the dispatcher's source 
+ * @param  lserror      OUT set on error 
+ * 
+ * @retval  dispatcher on success
+ * @retval  NULL on failure
+ *******************************************************************************
+ */
+_LSTransportEpoll*
+_LSTransportEpollNew(GMainContext *context, int priority, LSError *lserror)
+{
+    LS_ASSERT(context != NULL);
+
+    int fd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (fd < 0)
+    {
+        _LSErrorSetFromErrno(lserror, errno);
+        return NULL;
+    }
+
+    _LSTransportEpoll *epoll = (_LSTransportEpoll*)g_source_new(&_LSTransportEpollFuncs, sizeof(_LSTransportEpoll));
+
+    epoll->pollfd.fd = fd;
+    epoll->pollfd.events = G_IO_IN;
+    epoll->entries = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                                           (GDestroyNotify)_LSTransportEpollEntryFree);
+
+    g_source_add_poll(&epoll->source, &epoll->pollfd);
+    g_source_set_can_recurse(&epoll->source, TRUE);
+
+    if (priority != G_PRIORITY_DEFAULT)
+    {
+        g_source_set_priority(&epoll->source, priority);
+    }
+
+    g_source_attach(&epoll->source, context);
+
+    return epoll;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Remove every watch (calling their destroy callbacks) and free the
+ * dispatcher.
+ * 
+ * @param  epoll    IN  epoll dispatcher 
+ *******************************************************************************
+ */
+void
+_LSTransportEpollFree(_LSTransportEpoll *epoll)
+{
+    GHashTableIter iter;
+    gpointer value = NULL;
+    GSList *entries = NULL;
+    GSList *cur = NULL;
+
+    LS_ASSERT(epoll != NULL);
+
+    /* destroy callbacks may remove other watches, so don't iterate the
+     * table while calling them */
+    g_hash_table_iter_init(&iter, epoll->entries);
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+    {
+        entries = g_slist_prepend(entries, GINT_TO_POINTER(((_LSTransportEpollEntry*)value)->fd));
+    }
+
+    for (cur = entries; cur != NULL; cur = g_slist_next(cur))
+    {
+        _LSTransportEpollEntry *entry = g_hash_table_lookup(epoll->entries, cur->data);
+
+        if (entry && entry->recv.active) _LSTransportEpollWatchDestroy(epoll, &entry->recv);
+
+        entry = g_hash_table_lookup(epoll->entries, cur->data);
+
+        if (entry && entry->send.active) _LSTransportEpollWatchDestroy(epoll, &entry->send);
+
+        entry = g_hash_table_lookup(epoll->entries, cur->data);
+
+        if (entry) _LSTransportEpollEntryUpdate(epoll, entry);
+    }
+
+    g_slist_free(entries);
+
+    g_source_destroy(&epoll->source);
+    g_source_unref(&epoll->source);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Set the priority of the dispatcher (and so of every watch on it).
+ * 
+ * @param  epoll        IN  epoll dispatcher 
+ * @param  priority     IN  glib priority 
+ *******************************************************************************
+ */
+void
+_LSTransportEpollSetPriority(_LSTransportEpoll *epoll, int priority)
+{
+    LS_ASSERT(epoll != NULL);
+
+    g_source_set_priority(&epoll->source, priority);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Add a watch on a channel.
+ * 
+ * @param  epoll        IN  epoll dispatcher 
+ * @param  channel      IN  channel to watch 
+ * @param  condition    IN  G_IO_OUT for a send watch, G_IO_IN (and
+ *                          G_IO_ERR | G_IO_HUP) for a receive watch
+ * @param  callback     IN  callback when watch is triggered 
+ * @param  user_data    IN  context passed to callback 
+ * @param  destroy_cb   IN  callback when watch is removed 
+ * 
+ * @retval  true on success
+ * @retval  false if the channel already has that watch
+ *******************************************************************************
+ */
+bool
+_LSTransportEpollAddWatch(_LSTransportEpoll *epoll, _LSTransportChannel *channel, GIOCondition condition,
+                          GIOFunc callback, void *user_data, GDestroyNotify destroy_cb)
+{
+    LS_ASSERT(epoll != NULL);
+    LS_ASSERT(channel != NULL);
+    LS_ASSERT(callback != NULL);
+
+    int fd = channel->fd;
+    _LSTransportEpollEntry *entry = g_hash_table_lookup(epoll->entries, GINT_TO_POINTER(fd));
+    _LSTransportEpollWatch stale_recv = { 0 };
+    _LSTransportEpollWatch stale_send = { 0 };
+
+    if (entry && entry->channel != channel)
+    {
+        /* what's left of a connection whose fd was closed without its
+         * watches being removed; the fd has since been reused. Take the
+         * entry over now and destroy the old watches once we're done
+         * with it, since their destroy callbacks may come back here */
+        stale_recv = entry->recv;
+        stale_send = entry->send;
+        memset(&entry->recv, 0, sizeof(entry->recv));
+        memset(&entry->send, 0, sizeof(entry->send));
+        entry->channel = channel;
+    }
+
+    if (!entry)
+    {
+        entry = g_slice_new0(_LSTransportEpollEntry);
+        entry->fd = fd;
+        entry->channel = channel;
+        g_hash_table_insert(epoll->entries, GINT_TO_POINTER(fd), entry);
+    }
+
+    _LSTransportEpollWatch *watch = _LSTransportEpollEntryGetWatch(entry, condition);
+
+    if (watch->active)
+    {
+        return false;
+    }
+
+    watch->active = true;
+    watch->callback = callback;
+    watch->user_data = user_data;
+    watch->destroy_cb = destroy_cb;
+
+    _LSTransportEpollEntryUpdate(epoll, entry);
+
+    if (stale_recv.active) _LSTransportEpollWatchDestroy(epoll, &stale_recv);
+    if (stale_send.active) _LSTransportEpollWatchDestroy(epoll, &stale_send);
+
+    return true;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Remove a watch from a channel (if it still has it) and call its
+ * destroy callback.
+ * 
+ * @param  epoll        IN  epoll dispatcher 
+ * @param  channel      IN  channel 
+ * @param  condition    IN  G_IO_OUT for the send watch, else the receive watch 
+ *******************************************************************************
+ */
+void
+_LSTransportEpollRemoveWatch(_LSTransportEpoll *epoll, _LSTransportChannel *channel, GIOCondition condition)
+{
+    LS_ASSERT(epoll != NULL);
+    LS_ASSERT(channel != NULL);
+
+    int fd = channel->fd;
+    _LSTransportEpollEntry *entry = g_hash_table_lookup(epoll->entries, GINT_TO_POINTER(fd));
+
+    if (!entry || entry->channel != channel)
+    {
+        /* already removed, e.g., by its callback returning FALSE */
+        return;
+    }
+
+    _LSTransportEpollWatch *watch = _LSTransportEpollEntryGetWatch(entry, condition);
+
+    if (watch->active)
+    {
+        _LSTransportEpollWatchDestroy(epoll, watch);
+
+        /* the destroy callback may have freed the channel and removed
+         * the other watch too */
+        entry = g_hash_table_lookup(epoll->entries, GINT_TO_POINTER(fd));
+
+        if (entry)
+        {
+            _LSTransportEpollEntryUpdate(epoll, entry);
+        }
+    }
+}
+
+/* @} END OF LunaServiceTransportEpoll */
+
+#endif  /* LS_TRANSPORT_EPOLL */
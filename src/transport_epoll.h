@@ -0,0 +1,49 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2008-2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+
+
+#ifndef _TRANSPORT_EPOLL_H_
+#define _TRANSPORT_EPOLL_H_
+
+#include <stdbool.h>
+#include <glib.h>
+#include "error.h"
+#include "transport_channel.h"
+
+/* comment out to compile the epoll dispatcher out entirely */
+#ifdef __linux__
+#define LS_TRANSPORT_EPOLL
+#endif
+
+/**
+ * Dispatches the send and receive watches of every client on a transport
+ * from one epoll fd, so the main context polls one fd instead of one (or
+ * two) per connection.
+ */
+typedef struct _LSTransportEpoll _LSTransportEpoll;
+
+_LSTransportEpoll* _LSTransportEpollNew(GMainContext *context, int priority, LSError *lserror);
+void _LSTransportEpollFree(_LSTransportEpoll *epoll);
+void _LSTransportEpollSetPriority(_LSTransportEpoll *epoll, int priority);
+bool _LSTransportEpollAddWatch(_LSTransportEpoll *epoll, _LSTransportChannel *channel, GIOCondition condition,
+                               GIOFunc callback, void *user_data, GDestroyNotify destroy_cb);
+void _LSTransportEpollRemoveWatch(_LSTransportEpoll *epoll, _LSTransportChannel *channel, GIOCondition condition);
+
+#endif      // _TRANSPORT_EPOLL_H_
@@ -53,6 +53,13 @@ typedef enum {
 
 typedef void (*LSTransportMessageFailure)(LSMessageToken global_token, _LSTransportMessageFailureType failure_type, void *context);
 
+/* client -- destination whose outgoing queue crossed a watermark */
+typedef void (*LSTransportFlowControlHandler)(_LSTransportClient *client, bool congested, void *context);
+
+/* client -- connection we initiated that has had no traffic for a while;
+ * return true if nothing above the transport still needs it */
+typedef bool (*LSTransportIdleHandler)(_LSTransportClient *client, void *context);
+
 typedef struct LSTransportHandlers {
     LSTransportMessageFailure    message_failure_handler;   /**< callback to handle when a message fails to be delivered to the other side */
     void *message_failure_context;
@@ -62,6 +69,15 @@ typedef struct LSTransportHandlers {
 
     LSTransportMessageHandler msg_handler;                  /**< callback to handle incoming messages */
     void *msg_context;
+
+    LSTransportFlowControlHandler flow_control_handler;     /**< callback to handle when a destination becomes
+                                                                 congested or drains (optional) */
+    void *flow_control_context;
+
+    LSTransportIdleHandler idle_handler;                    /**< callback to check whether an idle connection
+                                                                 can be closed (optional; idle connections
+                                                                 are kept without it) */
+    void *idle_context;
 } LSTransportHandlers;
 
 #endif      // _TRANSPORT_HANDLERS_H_
@@ -18,6 +18,7 @@
 
 
 #include <string.h>
+#include <unistd.h>
 
 #include "error.h"
 #include "transport_incoming.h"
@@ -72,6 +73,16 @@ _LSTransportIncomingFree(_LSTransportIncoming *incoming)
     LS_ASSERT(incoming->tmp_msg == NULL);
     LS_ASSERT(g_queue_is_empty(incoming->complete_messages));
     g_queue_free(incoming->complete_messages);
+    g_free(incoming->read_buf);
+
+    if (incoming->read_fds)
+    {
+        while (!g_queue_is_empty(incoming->read_fds))
+        {
+            close(GPOINTER_TO_INT(g_queue_pop_head(incoming->read_fds)));
+        }
+        g_queue_free(incoming->read_fds);
+    }
 
 #ifdef MEMCHECK
     memset(incoming, 0xFF, sizeof(_LSTransportIncoming));
@@ -80,4 +91,33 @@ _LSTransportIncomingFree(_LSTransportIncoming *incoming)
     g_slice_free(_LSTransportIncoming, incoming);
 }
 
+/** 
+ *******************************************************************************
+ * @brief Free the read buffer if nothing was received since the last call
+ * and it doesn't hold any unparsed data. It is allocated again by the
+ * next receive.
+ *
+ * @attention call from the thread that receives on the connection
+ * 
+ * @param  incoming IN incoming 
+ *******************************************************************************
+ */
+void
+_LSTransportIncomingReleaseIdle(_LSTransportIncoming *incoming)
+{
+    LS_ASSERT(incoming != NULL);
+
+    bool idle = (incoming->received_messages == incoming->idle_mark);
+
+    incoming->idle_mark = incoming->received_messages;
+
+    if (idle && incoming->read_buf && incoming->read_buf_start == incoming->read_buf_end)
+    {
+        g_free(incoming->read_buf);
+        incoming->read_buf = NULL;
+        incoming->read_buf_start = 0;
+        incoming->read_buf_end = 0;
+    }
+}
+
 /* @} END OF LunaServiceTransportIncoming */
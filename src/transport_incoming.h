@@ -25,6 +25,9 @@
 #include <luna-service2/lunaservice.h>
 #include "transport_message.h"
 
+#define LS_TRANSPORT_INCOMING_READ_BUF_SIZE     8192    /**< size of the buffer used to read
+                                                             in incoming data in large chunks */
+
 struct LSTransportIncoming {
     pthread_mutex_t lock;
     LSMessageToken last_serial_processed;   /**< last reply processed -- see LSTransportSerial */
@@ -33,11 +36,22 @@ struct LSTransportIncoming {
     _LSTransportMessage *tmp_msg;           /**< temp location when building up a message */
     unsigned long tmp_msg_offset;           /**< end of data in temp message */
     GQueue *complete_messages;              /**< completed messages; ready for processing */
+    char *read_buf;                         /**< buffer for reading in multiple messages with
+                                                 a single recv() (allocated on first use) */
+    unsigned long read_buf_start;           /**< start of unparsed data in read_buf */
+    unsigned long read_buf_end;             /**< end of valid data in read_buf */
+    GQueue *read_fds;                       /**< fds received with data in read_buf that haven't
+                                                 been matched with their messages yet (allocated
+                                                 on first use) */
+    guint64 received_messages;              /**< messages completely received */
+    guint64 received_bytes;                 /**< size of those messages on the wire */
+    guint64 idle_mark;                      /**< @ref received_messages as of the last idle check */
 };
 
 typedef struct LSTransportIncoming _LSTransportIncoming;
 
 _LSTransportIncoming* _LSTransportIncomingNew(void);
 void _LSTransportIncomingFree(_LSTransportIncoming *incoming);
+void _LSTransportIncomingReleaseIdle(_LSTransportIncoming *incoming);
 
 #endif      // _TRANSPORT_INCOMING_H_
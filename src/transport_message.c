@@ -20,9 +20,14 @@
 #include <string.h>
 #include <syslog.h>
 #include <unistd.h>
+#include <pthread.h>
 #include "error.h"
 #include "transport.h"
 #include "transport_message.h"
+#include "transport_utils.h"
+#include "transport_shm.h"
+#include "binary_payload.h"
+#include "transport_compress.h"
 
 /**
  * Returns true if it is safe to dereference the specificed type with the
@@ -46,6 +51,161 @@ const char* _LSTransportClientGetServiceName(const _LSTransportClient *client);
  * @{
  */
 
+/**
+ * Size classes (in bytes, including the header) of the raw message buffer
+ * pool. Raw buffers that fit in one of these are recycled instead of going
+ * back to the heap when the message is free'd.
+ */
+static const unsigned long _LSTransportMessagePoolSizes[LS_TRANSPORT_MESSAGE_POOL_NUM_CLASSES] = {
+    256, 1024, 4096, 16384
+};
+
+/** Max number of free buffers kept for each size class */
+static const unsigned long _LSTransportMessagePoolMaxFree[LS_TRANSPORT_MESSAGE_POOL_NUM_CLASSES] = {
+    64, 32, 16, 8
+};
+
+typedef struct _LSTransportMessagePoolItem {
+    struct _LSTransportMessagePoolItem *next;
+} _LSTransportMessagePoolItem;
+
+/**
+ * Free lists of raw message buffers. This is shared by all transports in
+ * the process since messages are allocated without a transport and may be
+ * free'd on a different thread than the one they were allocated on.
+ */
+typedef struct _LSTransportMessagePool {
+    pthread_mutex_t lock;
+    _LSTransportMessagePoolItem *free_list[LS_TRANSPORT_MESSAGE_POOL_NUM_CLASSES];
+    unsigned long free_count[LS_TRANSPORT_MESSAGE_POOL_NUM_CLASSES];
+    unsigned long hits[LS_TRANSPORT_MESSAGE_POOL_NUM_CLASSES];
+    unsigned long misses[LS_TRANSPORT_MESSAGE_POOL_NUM_CLASSES];
+} _LSTransportMessagePool;
+
+static _LSTransportMessagePool _ls_message_pool = { PTHREAD_MUTEX_INITIALIZER };
+
+/** 
+ *******************************************************************************
+ * @brief Allocate a raw message buffer, using the pool if the message fits
+ * in one of the size classes.
+ * 
+ * @param  payload_size     IN   size of payload (doesn't include header)
+ * @param  size_class       OUT  size class of buffer (-1 if not pooled)
+ * @param  alloc_body_size  OUT  usable size of the body (>= payload_size)
+ * 
+ * @retval  raw message on success
+ * @retval  NULL on failure
+ *******************************************************************************
+ */
+static _LSTransportMessageRaw*
+_LSTransportMessageRawAlloc(unsigned long payload_size, int *size_class, unsigned long *alloc_body_size)
+{
+    unsigned long raw_size = sizeof(_LSTransportMessageRaw) + payload_size;
+    int i;
+
+    for (i = 0; i < LS_TRANSPORT_MESSAGE_POOL_NUM_CLASSES; i++)
+    {
+        if (raw_size <= _LSTransportMessagePoolSizes[i])
+        {
+            MESSAGE_POOL_LOCK(&_ls_message_pool.lock);
+            _LSTransportMessagePoolItem *item = _ls_message_pool.free_list[i];
+            if (item)
+            {
+                _ls_message_pool.free_list[i] = item->next;
+                _ls_message_pool.free_count[i]--;
+                _ls_message_pool.hits[i]++;
+            }
+            else
+            {
+                _ls_message_pool.misses[i]++;
+            }
+            MESSAGE_POOL_UNLOCK(&_ls_message_pool.lock);
+
+            if (!item)
+            {
+                item = g_malloc(_LSTransportMessagePoolSizes[i]);
+                if (!item) return NULL;
+            }
+
+            *size_class = i;
+            *alloc_body_size = _LSTransportMessagePoolSizes[i] - sizeof(_LSTransportMessageRaw);
+            return (_LSTransportMessageRaw*)item;
+        }
+    }
+
+    *size_class = -1;
+    *alloc_body_size = payload_size;
+    return g_malloc(raw_size);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Release a raw message buffer allocated with @ref
+ * _LSTransportMessageRawAlloc.
+ * 
+ * @param  raw          IN  raw message
+ * @param  size_class   IN  size class returned when allocating
+ *******************************************************************************
+ */
+static void
+_LSTransportMessageRawFree(_LSTransportMessageRaw *raw, int size_class)
+{
+    if (size_class >= 0)
+    {
+        LS_ASSERT(size_class < LS_TRANSPORT_MESSAGE_POOL_NUM_CLASSES);
+
+        _LSTransportMessagePoolItem *item = (_LSTransportMessagePoolItem*)raw;
+
+        MESSAGE_POOL_LOCK(&_ls_message_pool.lock);
+        if (_ls_message_pool.free_count[size_class] < _LSTransportMessagePoolMaxFree[size_class])
+        {
+            item->next = _ls_message_pool.free_list[size_class];
+            _ls_message_pool.free_list[size_class] = item;
+            _ls_message_pool.free_count[size_class]++;
+            item = NULL;
+        }
+        MESSAGE_POOL_UNLOCK(&_ls_message_pool.lock);
+
+        /* free list is full */
+        g_free(item);
+    }
+    else
+    {
+        g_free(raw);
+    }
+}
+
+/** 
+ *******************************************************************************
+ * @brief Get statistics for a size class of the raw message buffer pool.
+ * 
+ * @param  size_class   IN   size class (0 to @ref
+ *                           LS_TRANSPORT_MESSAGE_POOL_NUM_CLASSES - 1)
+ * @param  stats        OUT  statistics 
+ * 
+ * @retval  true on success
+ * @retval  false if size_class is invalid
+ *******************************************************************************
+ */
+bool
+_LSTransportMessagePoolGetStats(int size_class, _LSTransportMessagePoolStats *stats)
+{
+    LS_ASSERT(stats != NULL);
+
+    if (size_class < 0 || size_class >= LS_TRANSPORT_MESSAGE_POOL_NUM_CLASSES)
+    {
+        return false;
+    }
+
+    MESSAGE_POOL_LOCK(&_ls_message_pool.lock);
+    stats->size = _LSTransportMessagePoolSizes[size_class];
+    stats->hits = _ls_message_pool.hits[size_class];
+    stats->misses = _ls_message_pool.misses[size_class];
+    stats->free = _ls_message_pool.free_count[size_class];
+    MESSAGE_POOL_UNLOCK(&_ls_message_pool.lock);
+
+    return true;
+}
 
 /** 
  *******************************************************************************
@@ -70,19 +230,18 @@ _LSTransportMessageNew(unsigned long payload_size)
         return NULL;
     }
     
-    ret->raw = g_malloc(sizeof(_LSTransportMessageRaw) + payload_size);
+    ret->raw = _LSTransportMessageRawAlloc(payload_size, &ret->raw_pool_class, &ret->alloc_body_size);
 
     if (!ret->raw)
     {
         g_critical("OOM");
-        g_free(ret);
+        g_slice_free(_LSTransportMessage, ret);
         return NULL;
     } 
    
     ret->raw->header.len = payload_size;
     ret->raw->header.token = LSMESSAGE_TOKEN_INVALID;
     ret->raw->header.type = _LSTransportMessageTypeUnknown;
-    ret->alloc_body_size = payload_size; 
     ret->tx_bytes_remaining = payload_size + sizeof(_LSTransportHeader); 
     ret->connection_fd = -1;
     ret->retries = MAX_SEND_RETRIES;
@@ -103,8 +262,19 @@ _LSTransportMessageReset(_LSTransportMessage *message)
 {
     LS_ASSERT(message);
     
+    /* the next recipient may not take compressed messages */
+    g_free(message->tx_wire);
+    message->tx_wire = NULL;
+    message->tx_wire_size = 0;
+
     message->tx_bytes_remaining = message->raw->header.len + sizeof(_LSTransportHeader); 
-    message->connection_fd = -1; 
+
+    /* the payload segment of a shm method call has to go out again with
+     * the message */
+    if (_LSTransportMessageGetType(message) != _LSTransportMessageTypeMethodCallShm)
+    {
+        message->connection_fd = -1; 
+    }
 }
 
 /** 
@@ -153,7 +323,23 @@ _LSTransportMessageFree(_LSTransportMessage *message)
 
     message->app_id = NULL;    /* just for sanity; this points inside the raw message */
 
-    g_free(message->raw);
+    if (message->shm_payload)
+    {
+        _LSTransportShmPayloadUnmap(message->shm_payload, message->shm_payload_size, message->shm_payload_mapped);
+        message->shm_payload = NULL;
+    }
+
+    g_free(message->tx_wire);
+
+    if (message->shared)
+    {
+        /* the raw message belongs to the message we're sharing it with */
+        _LSTransportMessageUnref(message->shared);
+    }
+    else
+    {
+        _LSTransportMessageRawFree(message->raw, message->raw_pool_class);
+    }
 
 #ifdef MEMCHECK
     memset(message, 0xFF, sizeof(_LSTransportMessage));
@@ -177,28 +363,93 @@ _LSTransportMessageFree(_LSTransportMessage *message)
 inline _LSTransportMessage*
 _LSTransportMessageCopyNewRef(_LSTransportMessage *message)
 {
-    int body_size = _LSTransportMessageGetBodySize(message);
-    _LSTransportMessage *ret = _LSTransportMessageNewRef(body_size);
+    _LSTransportMessage *ret = _LSTransportMessageNewRef(_LSTransportMessageGetCopyBodySize(message));
 
     if (ret)
     {
         /* NOTE: tx_bytes_remaining is set when we actually put the message
          * on the queue with _LSTransportSendMessage */
-            
-        if (message->app_id)
-        {
-            size_t offset = message->app_id - _LSTransportMessageGetBody(message);
-            ret->app_id = _LSTransportMessageGetBody(ret) + offset;
-        }
-        else
-        {
-            ret->app_id = NULL;
-        }
 
         /* NOTE: does not copy timeout source id */
-        _LSTransportMessageSetType(ret, _LSTransportMessageGetType(message));
-        _LSTransportMessageSetToken(ret, _LSTransportMessageGetToken(message));
-        _LSTransportMessageSetBody(ret, _LSTransportMessageGetBody(message), body_size);
+        _LSTransportMessageCopy(ret, message);
+    }
+
+    return ret;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Create a new message with ref count of 1 that references the body of
+ * the passed in message instead of copying it. The new message has its own
+ * header (so that it can be given its own token) and its own transmit state,
+ * which allows the same body to be queued for many clients at once.
+ *
+ * @note The shared body must not be modified while the new message is alive.
+ * 
+ * @param  message   IN  message whose body should be shared
+ * 
+ * @retval message on success
+ * @retval NULL on failure
+ *******************************************************************************
+ */
+_LSTransportMessage*
+_LSTransportMessageShareNewRef(_LSTransportMessage *message)
+{
+    LS_ASSERT(message != NULL);
+
+    _LSTransportMessage *ret = g_slice_new0(_LSTransportMessage);
+
+    if (!ret)
+    {
+        g_critical("OOM");
+        return NULL;
+    }
+
+    /* always reference the owner of the raw message so we don't build
+     * chains of shared messages */
+    _LSTransportMessage *owner = message->shared ? message->shared : message;
+
+    ret->ref = 1;
+    ret->shared = _LSTransportMessageRef(owner);
+    ret->raw = owner->raw;
+    ret->tx_header = *_LSTransportMessageGetHeader(message);
+    ret->alloc_body_size = _LSTransportMessageGetBodySize(message);
+    ret->tx_bytes_remaining = ret->tx_header.len + sizeof(_LSTransportHeader);
+    ret->app_id = message->app_id;
+    ret->connection_fd = -1;
+    ret->retries = MAX_SEND_RETRIES;
+    ret->connect_state = _LSTransportConnectStateNoError;
+    ret->raw_pool_class = -1;   /* raw is owned by the shared message */
+
+    return ret;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Create a new message with ref count of 1 that shares the body of a
+ * reply (see @ref _LSTransportMessageShareNewRef), but replies to a different
+ * message. The reply serial at the start of the shared body is replaced by
+ * @p reply_token when the message is sent.
+ * 
+ * @param  reply        IN  reply whose body should be shared
+ * @param  reply_token  IN  token of the message being replied to
+ * 
+ * @retval message on success
+ * @retval NULL on failure
+ *******************************************************************************
+ */
+_LSTransportMessage*
+_LSTransportMessageShareReplyNewRef(_LSTransportMessage *reply, LSMessageToken reply_token)
+{
+    LS_ASSERT(_LSTransportMessageIsReplyType(reply));
+    LS_ASSERT(_LSTransportMessageGetBodySize(reply) >= sizeof(LSMessageToken));
+
+    _LSTransportMessage *ret = _LSTransportMessageShareNewRef(reply);
+
+    if (ret)
+    {
+        ret->tx_reply_token_set = true;
+        ret->tx_reply_token = reply_token;
     }
 
     return ret;
@@ -206,13 +457,110 @@ _LSTransportMessageCopyNewRef(_LSTransportMessage *message)
 
 /** 
  *******************************************************************************
- * @brief Copies the message type, token, and body from src to dest.
+ * @brief Fill in io vectors describing the part of the message that has not
+ * been transmitted yet (based on tx_bytes_remaining).
+ * 
+ * @param  message  IN   message 
+ * @param  iov      OUT  array of at least @ref LS_TRANSPORT_MESSAGE_MAX_TX_IOV
+ *                       io vectors 
+ * 
+ * @retval  number of io vectors filled in
+ *******************************************************************************
+ */
+int
+_LSTransportMessageGetTxVector(_LSTransportMessage *message, struct iovec *iov)
+{
+    LS_ASSERT(message != NULL);
+    LS_ASSERT(iov != NULL);
+
+    unsigned long header_size = sizeof(_LSTransportHeader);
+    unsigned long total_size = _LSTransportMessageGetTxSize(message);
+    unsigned long offset = total_size - message->tx_bytes_remaining;
+    int iovcnt = 0;
+
+    LS_ASSERT(message->tx_bytes_remaining <= total_size);
+
+    if (message->tx_wire)
+    {
+        iov[0].iov_base = message->tx_wire + offset;
+        iov[0].iov_len = message->tx_bytes_remaining;
+        return 1;
+    }
+
+    if (!message->shared)
+    {
+        /* header and body are contiguous */
+        iov[0].iov_base = (char*)message->raw + offset;
+        iov[0].iov_len = message->tx_bytes_remaining;
+        return 1;
+    }
+
+    if (offset < header_size)
+    {
+        iov[iovcnt].iov_base = (char*)&message->tx_header + offset;
+        iov[iovcnt].iov_len = header_size - offset;
+        iovcnt++;
+        offset = header_size;
+    }
+
+    if (message->tx_reply_token_set && offset < header_size + sizeof(LSMessageToken))
+    {
+        unsigned long token_offset = offset - header_size;
+
+        iov[iovcnt].iov_base = (char*)&message->tx_reply_token + token_offset;
+        iov[iovcnt].iov_len = sizeof(LSMessageToken) - token_offset;
+        iovcnt++;
+        offset = header_size + sizeof(LSMessageToken);
+    }
+
+    if (offset < total_size)
+    {
+        iov[iovcnt].iov_base = (char*)message->raw + offset;
+        iov[iovcnt].iov_len = total_size - offset;
+        iovcnt++;
+    }
+
+    return iovcnt;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Get the body size of a copy of a message made by @ref
+ * _LSTransportMessageCopy. This is larger than the body of the message when
+ * its payload came in a shared memory segment, since the copy carries the
+ * payload inline.
+ * 
+ * @param  message  IN  message 
+ * 
+ * @retval  body size of the copy
+ *******************************************************************************
+ */
+unsigned long
+_LSTransportMessageGetCopyBodySize(const _LSTransportMessage *message)
+{
+    unsigned long body_size = _LSTransportMessageGetBodySize(message);
+
+    if (message->shm_payload)
+    {
+        /* the inline payload is just the nul; the segment size includes
+         * one too */
+        body_size += message->shm_payload_size - 1;
+    }
+
+    return body_size;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Copies the message type, token, and body from src to dest. A
+ * payload that came in a shared memory segment is copied inline.
  *
  * @note assumes that dest has already been allocated and does not adjust any
  * ref count associated with dest. Also, does not copy timeout source or transmit
  * bytes remaining.
  * 
- * @param  dest  IN/OUT   destination message (already allocated to correct size) 
+ * @param  dest  IN/OUT   destination message (allocated with at least
+ *                        @ref _LSTransportMessageGetCopyBodySize bytes of body)
  * @param  src   IN       src message     
  * 
  * @retval dest
@@ -227,21 +575,61 @@ _LSTransportMessageCopy(_LSTransportMessage *dest, const _LSTransportMessage *sr
     size_t dest_body_size = _LSTransportMessageGetBodySize(dest);
     size_t src_body_size = _LSTransportMessageGetBodySize(src);
 
-    LS_ASSERT(dest_body_size >= src_body_size);
-   
+    LS_ASSERT(dest_body_size >= _LSTransportMessageGetCopyBodySize(src));
+
+    const char *src_body = _LSTransportMessageGetBody(src);
+    char *dest_body = _LSTransportMessageGetBody(dest);
+
+    _LSTransportMessageSetType(dest, _LSTransportMessageGetType(src));
+    _LSTransportMessageSetToken(dest, _LSTransportMessageGetToken(src));
+
+    if (src->shm_payload)
+    {
+        /* category and method, then the segment in place of the empty
+         * inline payload, then whatever followed it (the app id) */
+        size_t payload_offset = strlen(src_body) + 1;
+        payload_offset += strlen(src_body + payload_offset) + 1;
+
+        size_t rest_offset = payload_offset + 1;
+        size_t grow = src->shm_payload_size - 1;
+
+        LS_ASSERT(rest_offset <= src_body_size);
+
+        _LSTransportMessageSetBody(dest, src_body, payload_offset);
+        memcpy(dest_body + payload_offset, src->shm_payload, src->shm_payload_size);
+        memcpy(dest_body + payload_offset + src->shm_payload_size,
+               src_body + rest_offset, src_body_size - rest_offset);
+
+        if (src->app_id)
+        {
+            size_t offset = src->app_id - src_body;
+            dest->app_id = dest_body + offset + (offset >= rest_offset ? grow : 0);
+        }
+        else
+        {
+            dest->app_id = NULL;
+        }
+
+        return dest;
+    }
+
     if (src->app_id)
     {
-        size_t offset = src->app_id - _LSTransportMessageGetBody(src);
-        dest->app_id = _LSTransportMessageGetBody(dest) + offset;
+        size_t offset = src->app_id - src_body;
+        dest->app_id = dest_body + offset;
     }
     else
     {
         dest->app_id = NULL;
     } 
 
-    _LSTransportMessageSetType(dest, _LSTransportMessageGetType(src));
-    _LSTransportMessageSetToken(dest, _LSTransportMessageGetToken(src));
-    _LSTransportMessageSetBody(dest, _LSTransportMessageGetBody(src), src_body_size);
+    _LSTransportMessageSetBody(dest, src_body, src_body_size);
+
+    if (src->tx_reply_token_set)
+    {
+        /* the shared body has another recipient's reply serial */
+        memcpy(dest_body, &src->tx_reply_token, sizeof(LSMessageToken));
+    }
 
     return dest;
 }
@@ -455,6 +843,8 @@ _LSTransportMessageIsConnectionFdType(const _LSTransportMessage *message)
     case _LSTransportMessageTypeQueryNameReply:
     case _LSTransportMessageTypeRequestNameLocalReply:
     case _LSTransportMessageTypeMonitorConnected:
+    case _LSTransportMessageTypeMethodCallShm:
+    case _LSTransportMessageTypeIncomingConnection:
         return true;
 
     default:
@@ -464,76 +854,196 @@ _LSTransportMessageIsConnectionFdType(const _LSTransportMessage *message)
 
 /** 
  *******************************************************************************
- * @brief Get an error string from an error message
+ * @brief Take the payload of a received @ref
+ * _LSTransportMessageTypeMethodCallShm message from the shared memory segment
+ * passed as its connection fd. On success, the fd is closed and the message
+ * becomes a standard method call whose payload is the segment contents.
  * 
- * @param  message  IN  error message 
+ * @param  message  IN  message with connection fd set
+ * @param  lserror  OUT set on error
  * 
- * @retval error string
+ * @retval  true on success
+ * @retval  false on failure
  *******************************************************************************
  */
-const char*
-_LSTransportMessageGetError(const _LSTransportMessage *message)
+bool
+_LSTransportMessageAttachShmPayload(_LSTransportMessage *message, LSError *lserror)
 {
-    LS_ASSERT(_LSTransportMessageIsErrorType(message));
+    LS_ASSERT(_LSTransportMessageGetType(message) == _LSTransportMessageTypeMethodCallShm);
+    LS_ASSERT(!message->shm_payload);
 
-    /* error message is just a string after the reply token */
-    return _LSTransportMessageGetPayload(message);
+    int fd = _LSTransportMessageGetConnectionFd(message);
+
+    if (fd == -1)
+    {
+        _LSErrorSet(lserror, -1, "Missing payload segment for shm method call");
+        return false;
+    }
+
+    char *shm_payload = _LSTransportShmPayloadMap(fd, &message->shm_payload_size, &message->shm_payload_mapped, lserror);
+
+    if (!shm_payload)
+    {
+        return false;
+    }
+
+    close(fd);
+    _LSTransportMessageSetConnectionFd(message, -1);
+
+    _LSTransportMessageSetType(message, _LSTransportMessageTypeMethodCall);
+
+    /* the app id follows the (empty) inline payload, so cache it before the
+     * payload lookup starts returning the segment */
+    const char *inline_payload = _LSTransportMessageGetPayload(message);
+    message->app_id = inline_payload ? inline_payload + strlen(inline_payload) + 1 : NULL;
+
+    message->shm_payload = shm_payload;
+
+    return true;
 }
 
 /** 
  *******************************************************************************
- * @brief Gets the timeout source id associated with the message.
+ * @brief Find the end of the nul-terminated field starting at @offset.
  * 
- * @param  message  IN  message
+ * @param  body     IN  message body 
+ * @param  size     IN  body size 
+ * @param  offset   IN  body offset of the field 
  * 
- * @retval  id (0 means no timeout source id)
+ * @retval  body offset just past the field's nul, if that is still inside
+ *          the body
+ * @retval  -1 otherwise
  *******************************************************************************
  */
-inline guint
-_LSTransportMessageGetTimeoutId(const _LSTransportMessage *message)
+static long
+_LSTransportMessageFieldEnd(const char *body, unsigned long size, long offset)
 {
-    LS_ASSERT(message != NULL);
-    return message->timeout_id;
-}
+    if (offset < 0 || (unsigned long)offset >= size)
+    {
+        return -1;
+    }
 
-/** 
- *******************************************************************************
- * @brief Set the timeout source id associated with the message.
- * 
- * @param  message      IN  message 
- * @param  timeout_id   IN  timeout source id (ret val from g_timeout_add())
- *******************************************************************************
- */
-inline void
-_LSTransportMessageSetTimeoutId(_LSTransportMessage *message, guint timeout_id)
-{
-    LS_ASSERT(message != NULL);
-    message->timeout_id = timeout_id;
+    const char *nul = memchr(body + offset, '\0', size - offset);
+
+    if (!nul || (unsigned long)(nul + 1 - body) >= size)
+    {
+        return -1;
+    }
+
+    return nul + 1 - body;
 }
 
 /** 
  *******************************************************************************
- * @brief Get the "connect" state from a message (used for non-blocking
- * connect())
+ * @brief Record where the NUL-separated fields of a completely received
+ * message start, so the getters don't have to re-walk the body with
+ * strlen() on every call. Any later change to the body, type or header
+ * drops the index.
  * 
- * @param  message  IN message to set state on 
- * 
- * @retval  state
+ * @param  message  IN  message 
  *******************************************************************************
  */
-inline _LSTransportConnectState
-_LSTransportMessageGetConnectState(const _LSTransportMessage * message)
+void
+_LSTransportMessageIndexFields(_LSTransportMessage *message)
 {
-    LS_ASSERT(message != NULL);
-    return message->connect_state;
-}
+    const char *body = _LSTransportMessageGetBody(message);
+    unsigned long size = _LSTransportMessageGetBodySize(message);
 
-/** 
- *******************************************************************************
- * @brief Set the "connect" state on a message (used for non-blocking
- * connect()).
- * 
- * @param  message  IN message to set state on 
+    message->method_offset = -1;
+    message->payload_offset = -1;
+    message->payload_end_offset = -1;
+
+    switch (_LSTransportMessageGetType(message))
+    {
+    case _LSTransportMessageTypeReply:
+    case _LSTransportMessageTypeError:
+    case _LSTransportMessageTypeErrorUnknownMethod:
+        /* skip over the reply serial */
+        if (size > sizeof(LSMessageToken))
+        {
+            message->payload_offset = sizeof(LSMessageToken);
+        }
+        break;
+
+    case _LSTransportMessageTypeMethodCall:
+    case _LSTransportMessageTypeCancelMethodCall:
+    case _LSTransportMessageTypeSignal:
+    case _LSTransportMessageTypeServiceUpSignal:
+    case _LSTransportMessageTypeServiceDownSignal:
+        message->method_offset = _LSTransportMessageFieldEnd(body, size, 0);
+        message->payload_offset = _LSTransportMessageFieldEnd(body, size, message->method_offset);
+        break;
+
+    case _LSTransportMessageTypeSignalRegister:
+    case _LSTransportMessageTypeSignalUnregister:
+        message->method_offset = _LSTransportMessageFieldEnd(body, size, 0);
+        break;
+
+    default:
+        break;
+    }
+
+    message->payload_end_offset = _LSTransportMessageFieldEnd(body, size, message->payload_offset);
+    message->fields_indexed = true;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Get an error string from an error message
+ * 
+ * @param  message  IN  error message 
+ * 
+ * @retval error string
+ *******************************************************************************
+ */
+const char*
+_LSTransportMessageGetError(const _LSTransportMessage *message)
+{
+    LS_ASSERT(_LSTransportMessageIsErrorType(message));
+
+    /* error message is just a string after the reply token */
+    return _LSTransportMessageGetPayload(message);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Gets the timer wheel entry for the message's timeout.
+ * 
+ * @param  message  IN  message
+ * 
+ * @retval  entry (see _LSTimerWheelEntryIsArmed())
+ *******************************************************************************
+ */
+inline _LSTimerWheelEntry*
+_LSTransportMessageGetTimeout(_LSTransportMessage *message)
+{
+    LS_ASSERT(message != NULL);
+    return &message->timeout;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Get the "connect" state from a message (used for non-blocking
+ * connect())
+ * 
+ * @param  message  IN message to set state on 
+ * 
+ * @retval  state
+ *******************************************************************************
+ */
+inline _LSTransportConnectState
+_LSTransportMessageGetConnectState(const _LSTransportMessage * message)
+{
+    LS_ASSERT(message != NULL);
+    return message->connect_state;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Set the "connect" state on a message (used for non-blocking
+ * connect()).
+ * 
+ * @param  message  IN message to set state on 
  * @param  state    IN new state
  *******************************************************************************
  */
@@ -610,6 +1120,12 @@ inline _LSTransportHeader*
 _LSTransportMessageGetHeader(const _LSTransportMessage *message)
 {
     LS_ASSERT(message != NULL);
+
+    if (message->shared)
+    {
+        /* the header in the raw message belongs to the owner */
+        return (_LSTransportHeader*)&message->tx_header;
+    }
     return &message->raw->header;
 }
 
@@ -627,7 +1143,8 @@ _LSTransportMessageSetHeader(_LSTransportMessage *message, _LSTransportHeader *h
     LS_ASSERT(message != NULL);
     LS_ASSERT(header != NULL);
 
-    memcpy(&message->raw->header, header, sizeof(_LSTransportHeader));
+    message->fields_indexed = false;
+    memcpy(_LSTransportMessageGetHeader(message), header, sizeof(_LSTransportHeader));
 }
 
 /** 
@@ -642,7 +1159,7 @@ _LSTransportMessageSetHeader(_LSTransportMessage *message, _LSTransportHeader *h
 inline _LSTransportMessageType
 _LSTransportMessageGetType(const _LSTransportMessage *message)
 {
-    return message->raw->header.type;
+    return LS_TRANSPORT_HEADER_GET_TYPE(_LSTransportMessageGetHeader(message));
 }
 
 /** 
@@ -656,7 +1173,10 @@ _LSTransportMessageGetType(const _LSTransportMessage *message)
 inline void
 _LSTransportMessageSetType(_LSTransportMessage *message, _LSTransportMessageType type)
 {
-    message->raw->header.type = type;
+    message->fields_indexed = false;
+
+    _LSTransportHeader *header = _LSTransportMessageGetHeader(message);
+    header->type = (header->type & LS_TRANSPORT_HEADER_FLAGS_MASK) | type;
 }
 
 /** 
@@ -670,7 +1190,7 @@ _LSTransportMessageSetType(_LSTransportMessage *message, _LSTransportMessageType
 inline void
 _LSTransportMessageSetToken(_LSTransportMessage *message, LSMessageToken token)
 {
-    message->raw->header.token = token;
+    _LSTransportMessageGetHeader(message)->token = token;
 }
 
 /** 
@@ -685,7 +1205,7 @@ _LSTransportMessageSetToken(_LSTransportMessage *message, LSMessageToken token)
 inline LSMessageToken
 _LSTransportMessageGetToken(const _LSTransportMessage *message)
 {
-    return message->raw->header.token;
+    return _LSTransportMessageGetHeader(message)->token;
 }
 
 /** 
@@ -711,6 +1231,11 @@ _LSTransportMessageGetReplyToken(const _LSTransportMessage *message)
         return 0;
     }
 
+    if (message->tx_reply_token_set)
+    {
+        return message->tx_reply_token;
+    }
+
     int token_size = sizeof(LSMessageToken);
     char *body = _LSTransportMessageGetBody(message);
     if (body && _LSTransportMessageGetBodySize(message) >= token_size)
@@ -760,7 +1285,9 @@ _LSTransportMessageSetBody(_LSTransportMessage *message, const void *body, int b
 {
     LS_ASSERT(message != NULL);
     LS_ASSERT(body != NULL);
+    LS_ASSERT(message->shared == NULL);
 
+    message->fields_indexed = false;
     return memcpy(message->raw->data, body, body_len);
 }
 
@@ -799,6 +1326,7 @@ _LSTransportMessageSetRawMessage(_LSTransportMessage *message, _LSTransportMessa
     LS_ASSERT(message != NULL);
     LS_ASSERT(raw != NULL);
     
+    message->fields_indexed = false;
     message->raw = raw;
     return raw;
 }
@@ -838,174 +1366,459 @@ _LSTransportMessageSetBodySize(const _LSTransportMessage *message, unsigned long
 
 /** 
  *******************************************************************************
- * @brief Checks to see if the specified pointer falls within the message body.
+ * @brief Checks to see if the specified pointer falls within the message body.
+ * 
+ * @param  message  IN  message 
+ * @param  ptr      IN  pointer to check 
+ * 
+ * @retval true if pointer points inside message body
+ * @retval false otherwise
+ *******************************************************************************
+ */
+static inline bool
+_LSTransportMessageIsValidMessageBodyPtr(const _LSTransportMessage *message, const char *ptr)
+{
+    if (ptr < message->raw->data + _LSTransportMessageGetBodySize(message))
+    {
+        return true;
+    }
+    g_critical("Message access out of bounds: requested: %p, end: %p",
+                ptr, message->raw->data + _LSTransportMessageGetBodySize(message));
+    return false;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Get the number of bytes allocated for the body of the message. (Does
+ * not include the message header, which is implicitly allocated).
+ * 
+ * @param  message  IN  message 
+ * 
+ * @retval  size (bytes)
+ *******************************************************************************
+ */
+static inline int
+_LSTransportMessageGetAllocBodySize(const _LSTransportMessage *message)
+{
+    LS_ASSERT(message != NULL);
+    return message->alloc_body_size;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Set number of bytes allocated for the body of the message. (Do not
+ * include the message header, which is implicitly allocated).
+ * 
+ * @param  message  IN  message
+ * @param  size     IN  size (bytes) 
+ *******************************************************************************
+ */
+static inline void
+_LSTransportMessageSetAllocBodySize(_LSTransportMessage *message, unsigned long size)
+{
+    LS_ASSERT(message != NULL);
+    message->alloc_body_size = size;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Expand the message body by @bytes_needed bytes. The message may be
+ * moved in memory, but its contents will not change. The additional bytes are
+ * not initialized.
+ * 
+ * @param  message          IN  message 
+ * @param  bytes_needed     IN  number of bytes to add to message 
+ * 
+ * @retval  message on success (may have been moved)
+ * @retval  NULL on failure
+ *******************************************************************************
+ */
+_LSTransportMessage*
+_LSTransportMessageBodyExpand(_LSTransportMessage *message, unsigned long bytes_needed)
+{
+    bool need_realloc = false;
+    unsigned long alloc_body_size = _LSTransportMessageGetAllocBodySize(message);
+    unsigned long body_size = _LSTransportMessageGetBodySize(message);
+    
+    _LSTransportMessageRaw *raw = _LSTransportMessageGetRawMessage(message);
+
+    LS_ASSERT(message->shared == NULL);
+    LS_ASSERT(alloc_body_size >= body_size);
+
+    unsigned long new_body_size = body_size + bytes_needed;
+    
+    while (alloc_body_size < new_body_size)
+    {
+        alloc_body_size *= 2;
+        need_realloc = true;
+    }
+   
+    if (need_realloc && message->raw_pool_class >= 0)
+    {
+        /* pooled buffers can't be realloc'd in place, so move the message
+         * to a buffer of the right size */
+        int new_pool_class = -1;
+        _LSTransportMessageRaw *new_raw = _LSTransportMessageRawAlloc(alloc_body_size, &new_pool_class, &alloc_body_size);
+
+        if (new_raw)
+        {
+            memcpy(new_raw, raw, sizeof(_LSTransportMessageRaw) + body_size);
+            _LSTransportMessageRawFree(raw, message->raw_pool_class);
+            message->raw_pool_class = new_pool_class;
+        }
+        else
+        {
+            new_body_size = 0;
+            alloc_body_size = 0;
+            g_critical("Unable to re-allocate message body, OOM");
+        }
+        raw = new_raw;
+
+        _LSTransportMessageSetRawMessage(message, raw);
+        _LSTransportMessageSetAllocBodySize(message, alloc_body_size);
+    }
+    else if (need_realloc)
+    { 
+        raw = g_try_realloc(raw, sizeof(_LSTransportMessageRaw) + alloc_body_size);
+
+        if (!raw)
+        {
+            new_body_size = 0;
+            alloc_body_size = 0;
+            g_critical("Unable to re-allocate message body, OOM");
+        }
+        
+        _LSTransportMessageSetRawMessage(message, raw);
+        _LSTransportMessageSetAllocBodySize(message, alloc_body_size);
+    }
+
+    _LSTransportMessageSetBodySize(message, new_body_size);
+    message->fields_indexed = false;
+
+    return message;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Get the payload for a message.
+ * 
+ * @param  message  IN  message 
+ * 
+ * @retval  payload
+ *******************************************************************************
+ */
+const char*
+_LSTransportMessageGetPayload(const _LSTransportMessage *message)
+{
+    //LS_ASSERT(message->raw->header.type == _LSTransportMessageTypeReply);
+    const char *ret = NULL;
+
+    if (message->fields_indexed && message->payload_offset >= 0 && !message->shm_payload)
+    {
+        return _LSTransportMessageGetBody(message) + message->payload_offset;
+    }
+
+    switch (_LSTransportMessageGetType(message))
+    {
+    case _LSTransportMessageTypeReply:
+    case _LSTransportMessageTypeError:
+    case _LSTransportMessageTypeErrorUnknownMethod:
+        /* skip over the reply serial */
+        ret = _LSTransportMessageGetBody(message) + sizeof(LSMessageToken);
+        if (!_LSTransportMessageIsValidMessageBodyPtr(message, ret))
+        {
+            return NULL;
+        }
+        return ret;
+
+    case _LSTransportMessageTypeMethodCall:
+        if (message->shm_payload)
+        {
+            return message->shm_payload;
+        }
+        /* fall through */
+    case _LSTransportMessageTypeCancelMethodCall:
+    case _LSTransportMessageTypeSignal:
+    case _LSTransportMessageTypeServiceUpSignal:
+    case _LSTransportMessageTypeServiceDownSignal:
+        /* skip over category */
+        ret = _LSTransportMessageGetBody(message) + strlen(_LSTransportMessageGetBody(message)) + 1;
+
+        if (!_LSTransportMessageIsValidMessageBodyPtr(message, ret))
+        {
+            return NULL;
+        }
+
+        /* skip over method */
+        ret = ret + strlen(ret) + 1;
+
+        if (!_LSTransportMessageIsValidMessageBodyPtr(message, ret))
+        {
+            return NULL;
+        }
+        return ret;
+
+    default:
+        /* When DEBUG_VERBOSE is enabled we expect to call this function on
+         * all types of messages; otherwise we don't */
+        if (!DEBUG_VERBOSE)
+        {
+            g_critical("No payload for message type: %d\n", _LSTransportMessageGetType(message));
+        }
+        return NULL;
+    } 
+
+    return NULL;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Get the number of bytes that go over the wire for a message
+ * (header included), which is less than the size of the message when it's
+ * sent compressed.
+ * 
+ * @param  message  IN  message 
+ * 
+ * @retval  size
+ *******************************************************************************
+ */
+unsigned long
+_LSTransportMessageGetTxSize(const _LSTransportMessage *message)
+{
+    if (message->tx_wire)
+    {
+        return message->tx_wire_size;
+    }
+
+    return sizeof(_LSTransportHeader) + _LSTransportMessageGetBodySize(message);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Prepare a compressed copy of a message that will be sent instead
+ * of it. The message itself isn't changed, so it can still be looked up,
+ * mirrored to the monitor, etc.
+ *
+ * Messages that share their body or pass an fd are never compressed, and
+ * neither are ones that don't get any smaller.
+ * 
+ * @param  message  IN  message that hasn't started to be sent (its
+ *                      tx_bytes_remaining is updated)
+ * 
+ * @retval  true if the message will be sent compressed
+ * @retval  false otherwise
+ *******************************************************************************
+ */
+bool
+_LSTransportMessageCompress(_LSTransportMessage *message)
+{
+    LS_ASSERT(message != NULL);
+
+    if (message->shared || _LSTransportMessageIsConnectionFdType(message))
+    {
+        return false;
+    }
+
+    /* e.g., compressed for a recipient that went away */
+    g_free(message->tx_wire);
+    message->tx_wire = NULL;
+    message->tx_wire_size = 0;
+
+    unsigned long compressed_len = 0;
+    char *wire = _LSTransportCompress(message->raw->data, message->raw->header.len,
+                                      sizeof(_LSTransportHeader), &compressed_len);
+
+    if (!wire)
+    {
+        return false;
+    }
+
+    _LSTransportHeader header = message->raw->header;
+    header.len = compressed_len;
+    header.type |= LS_TRANSPORT_HEADER_FLAG_COMPRESSED;
+    memcpy(wire, &header, sizeof(header));
+
+    message->tx_wire = wire;
+    message->tx_wire_size = sizeof(header) + compressed_len;
+    message->tx_bytes_remaining = message->tx_wire_size;
+
+    return true;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Replace the compressed body of a completely received message with
+ * the original one.
+ * 
+ * @param  message  IN  message with @ref LS_TRANSPORT_HEADER_FLAG_COMPRESSED
+ *                      set in its header
+ * @param  lserror  OUT set on error
+ * 
+ * @retval  true on success
+ * @retval  false on failure
+ *******************************************************************************
+ */
+bool
+_LSTransportMessageDecompress(_LSTransportMessage *message, LSError *lserror)
+{
+    LS_ASSERT(message != NULL);
+    LS_ASSERT(!message->shared);
+    LS_ASSERT(message->raw->header.type & LS_TRANSPORT_HEADER_FLAG_COMPRESSED);
+
+    long body_size = _LSTransportDecompressedSize(message->raw->data, message->raw->header.len);
+
+    if (body_size < 0 || body_size > MAX_MESSAGE_SIZE_BYTES)
+    {
+        _LSErrorSet(lserror, -EINVAL, "Bad compressed message size: %ld", body_size);
+        return false;
+    }
+
+    int raw_pool_class = -1;
+    unsigned long alloc_body_size = 0;
+    _LSTransportMessageRaw *raw = _LSTransportMessageRawAlloc(body_size, &raw_pool_class, &alloc_body_size);
+
+    if (!raw)
+    {
+        _LSErrorSetOOM(lserror);
+        return false;
+    }
+
+    if (!_LSTransportDecompress(message->raw->data, message->raw->header.len, raw->data, body_size, lserror))
+    {
+        _LSTransportMessageRawFree(raw, raw_pool_class);
+        return false;
+    }
+
+    raw->header = message->raw->header;
+    raw->header.len = body_size;
+    raw->header.type &= ~LS_TRANSPORT_HEADER_FLAG_COMPRESSED;
+
+    _LSTransportMessageRawFree(message->raw, message->raw_pool_class);
+
+    message->raw = raw;
+    message->raw_pool_class = raw_pool_class;
+    message->alloc_body_size = alloc_body_size;
+
+    return true;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Check whether the payload of a message is binary encoded rather
+ * than JSON.
  * 
  * @param  message  IN  message 
- * @param  ptr      IN  pointer to check 
  * 
- * @retval true if pointer points inside message body
- * @retval false otherwise
+ * @retval  true if binary
+ * @retval  false if JSON
  *******************************************************************************
  */
-static inline bool
-_LSTransportMessageIsValidMessageBodyPtr(const _LSTransportMessage *message, const char *ptr)
+bool
+_LSTransportMessageIsBinaryPayload(const _LSTransportMessage *message)
 {
-    if (ptr < message->raw->data + _LSTransportMessageGetBodySize(message))
-    {
-        return true;
-    }
-    g_critical("Message access out of bounds: requested: %p, end: %p",
-                ptr, message->raw->data + _LSTransportMessageGetBodySize(message));
-    return false;
+    return (_LSTransportMessageGetHeader(message)->type & LS_TRANSPORT_HEADER_FLAG_BINARY_PAYLOAD) != 0;
 }
 
 /** 
  *******************************************************************************
- * @brief Get the number of bytes allocated for the body of the message. (Does
- * not include the message header, which is implicitly allocated).
- * 
- * @param  message  IN  message 
+ * @brief Set the outgoing queue priority of replies to a received method
+ * call (including subscription updates sent in reply to it).
  * 
- * @retval  size (bytes)
+ * @param  message  IN  method call message 
+ * @param  priority IN  priority 
  *******************************************************************************
  */
-static inline int
-_LSTransportMessageGetAllocBodySize(const _LSTransportMessage *message)
+void
+_LSTransportMessageSetReplyPriority(_LSTransportMessage *message, _LSTransportPriority priority)
 {
     LS_ASSERT(message != NULL);
-    return message->alloc_body_size;
+    message->reply_priority = priority;
 }
 
 /** 
  *******************************************************************************
- * @brief Set number of bytes allocated for the body of the message. (Do not
- * include the message header, which is implicitly allocated).
+ * @brief Set header flags (LS_TRANSPORT_HEADER_FLAG_*) that replies to a
+ * received method call are sent with.
  * 
- * @param  message  IN  message
- * @param  size     IN  size (bytes) 
+ * @param  message  IN  method call message 
+ * @param  flags    IN  flags 
  *******************************************************************************
  */
-static inline void
-_LSTransportMessageSetAllocBodySize(_LSTransportMessage *message, unsigned long size)
+void
+_LSTransportMessageSetReplyFlags(_LSTransportMessage *message, unsigned int flags)
 {
     LS_ASSERT(message != NULL);
-    message->alloc_body_size = size;
+    message->reply_flags = flags;
 }
 
 /** 
  *******************************************************************************
- * @brief Expand the message body by @bytes_needed bytes. The message may be
- * moved in memory, but its contents will not change. The additional bytes are
- * not initialized.
+ * @brief Check whether a reply says that identical calls to the method it's
+ * from may share one reply.
  * 
- * @param  message          IN  message 
- * @param  bytes_needed     IN  number of bytes to add to message 
+ * @param  message  IN  reply message 
  * 
- * @retval  message on success (may have been moved)
- * @retval  NULL on failure
+ * @retval  true if the method is idempotent
+ * @retval  false otherwise
  *******************************************************************************
  */
-_LSTransportMessage*
-_LSTransportMessageBodyExpand(_LSTransportMessage *message, unsigned long bytes_needed)
+bool
+_LSTransportMessageIsIdempotentReply(const _LSTransportMessage *message)
 {
-    bool need_realloc = false;
-    unsigned long alloc_body_size = _LSTransportMessageGetAllocBodySize(message);
-    unsigned long body_size = _LSTransportMessageGetBodySize(message);
-    
-    _LSTransportMessageRaw *raw = _LSTransportMessageGetRawMessage(message);
-
-    LS_ASSERT(alloc_body_size >= body_size);
-
-    unsigned long new_body_size = body_size + bytes_needed;
-    
-    while (alloc_body_size < new_body_size)
-    {
-        alloc_body_size *= 2;
-        need_realloc = true;
-    }
-   
-    if (need_realloc)
-    { 
-        raw = g_try_realloc(raw, sizeof(_LSTransportMessageRaw) + alloc_body_size);
-
-        if (!raw)
-        {
-            new_body_size = 0;
-            alloc_body_size = 0;
-            g_critical("Unable to re-allocate message body, OOM");
-        }
-        
-        _LSTransportMessageSetRawMessage(message, raw);
-        _LSTransportMessageSetAllocBodySize(message, alloc_body_size);
-    }
-
-    _LSTransportMessageSetBodySize(message, new_body_size);
-
-    return message;
+    return (_LSTransportMessageGetHeader(message)->type & LS_TRANSPORT_HEADER_FLAG_IDEMPOTENT) != 0;
 }
 
 /** 
  *******************************************************************************
- * @brief Get the payload for a message.
+ * @brief Get the length of the payload for a message.
+ *
+ * For a completely received message, this comes from the field index and
+ * the stored body size, so the payload isn't scanned again. Otherwise, it
+ * falls back to a bounded scan of the payload.
  * 
  * @param  message  IN  message 
  * 
- * @retval  payload
+ * @retval  length of payload, not including the nul
+ * @retval  -1 if the message has no payload
  *******************************************************************************
  */
-const char*
-_LSTransportMessageGetPayload(const _LSTransportMessage *message)
+long
+_LSTransportMessageGetPayloadLen(const _LSTransportMessage *message)
 {
-    //LS_ASSERT(message->raw->header.type == _LSTransportMessageTypeReply);
-    const char *ret = NULL;
-
-    /* TODO: make this less expensive */
-    switch (_LSTransportMessageGetType(message))
+    if (message->shm_payload)
     {
-    case _LSTransportMessageTypeReply:
-    case _LSTransportMessageTypeError:
-    case _LSTransportMessageTypeErrorUnknownMethod:
-        /* skip over the reply serial */
-        ret = _LSTransportMessageGetBody(message) + sizeof(LSMessageToken);
-        if (!_LSTransportMessageIsValidMessageBodyPtr(message, ret))
-        {
-            return NULL;
-        }
-        return ret;
+        /* segment size includes the nul (checked when it was mapped) */
+        return message->shm_payload_size - 1;
+    }
 
-    case _LSTransportMessageTypeMethodCall:
-    case _LSTransportMessageTypeCancelMethodCall:
-    case _LSTransportMessageTypeSignal:
-    case _LSTransportMessageTypeServiceUpSignal:
-    case _LSTransportMessageTypeServiceDownSignal:
-        /* skip over category */
-        ret = _LSTransportMessageGetBody(message) + strlen(_LSTransportMessageGetBody(message)) + 1;
+    const char *payload = _LSTransportMessageGetPayload(message);
 
-        if (!_LSTransportMessageIsValidMessageBodyPtr(message, ret))
-        {
-            return NULL;
-        }
+    if (!payload)
+    {
+        return -1;
+    }
 
-        /* skip over method */
-        ret = ret + strlen(ret) + 1;
+    const char *body = _LSTransportMessageGetBody(message);
+    unsigned long size = _LSTransportMessageGetBodySize(message);
+    long offset = payload - body;
 
-        if (!_LSTransportMessageIsValidMessageBodyPtr(message, ret))
+    if (message->fields_indexed && message->payload_offset == offset)
+    {
+        if (message->payload_end_offset >= 0)
         {
-            return NULL;
+            return message->payload_end_offset - offset - 1;
         }
-        return ret;
 
-    default:
-        /* When DEBUG_VERBOSE is enabled we expect to call this function on
-         * all types of messages; otherwise we don't */
-        if (!DEBUG_VERBOSE)
+        /* no field after the payload, so its nul is the last byte of the
+         * body (the index only leaves the end unset in that case or if there
+         * is no nul at all) */
+        if (size > 0 && body[size - 1] == '\0')
         {
-            g_critical("No payload for message type: %d\n", _LSTransportMessageGetType(message));
+            return size - offset - 1;
         }
-        return NULL;
-    } 
+    }
 
-    return NULL;
+    return strnlen(payload, size - offset);
 }
 
 /** 
@@ -1041,10 +1854,13 @@ _LSTransportMessageGetAppIdPtr(_LSTransportMessage *message)
     /* Check if value is cached */ 
     if (!message->app_id)
     {
-        if (msg_type == _LSTransportMessageTypeMethodCall)
+        if (msg_type == _LSTransportMessageTypeMethodCall && message->fields_indexed &&
+            message->payload_end_offset >= 0)
+        {
+            message->app_id = _LSTransportMessageGetBody(message) + message->payload_end_offset;
+        }
+        else if (msg_type == _LSTransportMessageTypeMethodCall)
         {
-            /* TODO: very inefficient */
-            
             const char *payload = _LSTransportMessageGetPayload(message);
             
             /* skip over payload */
@@ -1100,7 +1916,11 @@ _LSTransportMessageGetAppId(_LSTransportMessage *message)
 const char*
 _LSTransportMessageGetMethod(const _LSTransportMessage *message)
 {
-    /* TODO: make this less expensive */
+    if (message->fields_indexed && message->method_offset >= 0)
+    {
+        return _LSTransportMessageGetBody(message) + message->method_offset;
+    }
+
     /* skip over category and the method is after the NUL */
     switch (_LSTransportMessageGetType(message))
     {
@@ -1226,6 +2046,11 @@ _LSTransportMessageGetDestServiceName(_LSTransportMessage *message)
     case _LSTransportMessageTypeSignal:
     case _LSTransportMessageTypeReply:
     {
+        if (message->fields_indexed && message->payload_end_offset >= 0)
+        {
+            return _LSTransportMessageGetBody(message) + message->payload_end_offset;
+        }
+
         /* move past the payload to get the destination service name */
         const char *payload = _LSTransportMessageGetPayload(message);
         const char *ret = payload + strlen(payload) + 1;
@@ -1378,7 +2203,17 @@ _LSTransportMessagePrintPayload(const _LSTransportMessage *message, FILE *file)
 {
     /* Raw UTF-8 encoding for 'Left-Pointing double angle quotation mark */
     fprintf(file, "\xc2\xab");
-    fprintf(file, "%s", _LSTransportMessageGetPayload(message));
+    if (_LSTransportMessageIsBinaryPayload(message))
+    {
+        const char *encoded = _LSTransportMessageGetPayload(message);
+        char *json = encoded ? _LSBinaryPayloadDecodeToJson(encoded, strlen(encoded), NULL) : NULL;
+        fprintf(file, "%s", json ? json : "(binary)");
+        g_free(json);
+    }
+    else
+    {
+        fprintf(file, "%s", _LSTransportMessageGetPayload(message));
+    }
     /* Raw UTF-8 encoding for 'Right-Pointing double angle quotation mark' */
     fprintf(file, "\xc2\xbb");
 }
@@ -1523,6 +2358,238 @@ LSTransportMessageFilterMatch(_LSTransportMessage *message, const char *filter)
 
 }
 
+/**
+ * Filter that the monitor asks senders to apply before mirroring a message
+ * to it. It's pushed to each client by the hub, so a message that doesn't
+ * match costs the sender nothing beyond the check.
+ */
+struct LSTransportMonitorFilter
+{
+    GPatternSpec **names;   /**< NULL-terminated globs matched against sender
+                                 and destination names; NULL matches all */
+    int32_t types;          /**< LS_TRANSPORT_MONITOR_TYPE_* mask */
+    uint32_t sample_rate;   /**< mirror 1 in sample_rate calls; <= 1 mirrors all */
+};
+
+/** 
+ *******************************************************************************
+ * @brief Create a monitor filter.
+ * 
+ * @param  names        IN  comma-separated service/unique name globs, NULL
+ *                          or empty for all
+ * @param  types        IN  LS_TRANSPORT_MONITOR_TYPE_* mask, 0 for all
+ * @param  sample_rate  IN  mirror 1 in sample_rate calls, <= 1 for all
+ * 
+ * @retval  filter on success
+ * @retval  NULL if the filter would match everything
+ *******************************************************************************
+ */
+_LSTransportMonitorFilter*
+_LSTransportMonitorFilterNew(const char *names, int32_t types, int32_t sample_rate)
+{
+    types &= LS_TRANSPORT_MONITOR_TYPE_ALL;
+
+    if (types == 0) types = LS_TRANSPORT_MONITOR_TYPE_ALL;
+    if (sample_rate < 1) sample_rate = 1;
+
+    if ((names == NULL || names[0] == '\0') && types == LS_TRANSPORT_MONITOR_TYPE_ALL && sample_rate == 1)
+    {
+        return NULL;
+    }
+
+    _LSTransportMonitorFilter *filter = g_slice_new0(_LSTransportMonitorFilter);
+
+    filter->types = types;
+    filter->sample_rate = sample_rate;
+
+    if (names && names[0] != '\0')
+    {
+        char **globs = g_strsplit(names, ",", -1);
+        int num_globs = g_strv_length(globs);
+        int i, j;
+
+        filter->names = g_new0(GPatternSpec*, num_globs + 1);
+
+        for (i = 0, j = 0; i < num_globs; i++)
+        {
+            if (globs[i][0] != '\0')
+            {
+                filter->names[j++] = g_pattern_spec_new(globs[i]);
+            }
+        }
+
+        g_strfreev(globs);
+
+        if (j == 0)
+        {
+            g_free(filter->names);
+            filter->names = NULL;
+        }
+    }
+
+    return filter;
+}
+
+void
+_LSTransportMonitorFilterFree(_LSTransportMonitorFilter *filter)
+{
+    if (!filter) return;
+
+    if (filter->names)
+    {
+        GPatternSpec **spec;
+
+        for (spec = filter->names; *spec; spec++)
+        {
+            g_pattern_spec_free(*spec);
+        }
+        g_free(filter->names);
+    }
+
+#ifdef MEMCHECK
+    memset(filter, 0xFF, sizeof(_LSTransportMonitorFilter));
+#endif
+
+    g_slice_free(_LSTransportMonitorFilter, filter);
+}
+
+static bool
+_LSTransportMonitorFilterMatchName(const _LSTransportMonitorFilter *filter, const char *name)
+{
+    GPatternSpec **spec;
+
+    if (!name) return false;
+
+    for (spec = filter->names; *spec; spec++)
+    {
+        if (g_pattern_match_string(*spec, name))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Check whether a message passes a monitor filter. This is called by
+ * the sender before the message is mirrored, so it only uses what the
+ * sender knows.
+ *
+ * Sampling is keyed on the caller's unique name and the call's token, so a
+ * call and its replies (which carry the call's token as their reply token)
+ * are kept or dropped together, by every sender, without any shared state.
+ * 
+ * @param  filter               IN  filter (NULL matches all)
+ * @param  type                 IN  message type
+ * @param  token                IN  message token (reply token for replies)
+ * @param  sender_service_name  IN  sender service name (may be NULL)
+ * @param  sender_unique_name   IN  sender unique name
+ * @param  dest_service_name    IN  destination service name (may be NULL)
+ * @param  dest_unique_name     IN  destination unique name
+ * 
+ * @retval  true if the message should be mirrored
+ * @retval  false otherwise
+ *******************************************************************************
+ */
+bool
+_LSTransportMonitorFilterMatchFields(const _LSTransportMonitorFilter *filter, _LSTransportMessageType type, LSMessageToken token,
+                                     const char *sender_service_name, const char *sender_unique_name,
+                                     const char *dest_service_name, const char *dest_unique_name)
+{
+    int32_t type_bit;
+    bool check_dest = true;
+    bool sample = true;
+    const char *caller_unique_name = sender_unique_name;
+
+    if (!filter) return true;
+
+    switch (type)
+    {
+    case _LSTransportMessageTypeMethodCall:
+    case _LSTransportMessageTypeMethodCallShm:
+        type_bit = LS_TRANSPORT_MONITOR_TYPE_CALL;
+        break;
+    case _LSTransportMessageTypeCancelMethodCall:
+        /* cancels are rare, and a sampled call would look odd without one */
+        type_bit = LS_TRANSPORT_MONITOR_TYPE_CALL;
+        sample = false;
+        break;
+    case _LSTransportMessageTypeReply:
+        type_bit = LS_TRANSPORT_MONITOR_TYPE_REPLY;
+        caller_unique_name = dest_unique_name;
+        break;
+    case _LSTransportMessageTypeSignal:
+        /* signals go to the hub, so the destination doesn't mean anything */
+        type_bit = LS_TRANSPORT_MONITOR_TYPE_SIGNAL;
+        check_dest = false;
+        break;
+    default:
+        return true;
+    }
+
+    if (!(filter->types & type_bit))
+    {
+        return false;
+    }
+
+    if (filter->names &&
+        !_LSTransportMonitorFilterMatchName(filter, sender_service_name) &&
+        !_LSTransportMonitorFilterMatchName(filter, sender_unique_name) &&
+        (!check_dest ||
+         (!_LSTransportMonitorFilterMatchName(filter, dest_service_name) &&
+          !_LSTransportMonitorFilterMatchName(filter, dest_unique_name))))
+    {
+        return false;
+    }
+
+    if (sample && filter->sample_rate > 1)
+    {
+        guint hash = caller_unique_name ? g_str_hash(caller_unique_name) : 0;
+
+        /* multiplicative hash; the high bits are the well-mixed ones */
+        hash = (hash ^ (guint)token) * 2654435761u;
+
+        if ((hash >> 8) % filter->sample_rate != 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Check whether a message received by the monitor passes a monitor
+ * filter. Senders that predate sender-side filtering mirror everything, so
+ * the monitor applies the same filter again.
+ * 
+ * @param  filter   IN  filter (NULL matches all)
+ * @param  message  IN  mirrored message 
+ * 
+ * @retval  true if match found
+ * @retval  false otherwise
+ *******************************************************************************
+ */
+bool
+LSTransportMonitorFilterMatch(const _LSTransportMonitorFilter *filter, _LSTransportMessage *message)
+{
+    if (!filter) return true;
+
+    _LSTransportMessageType type = _LSTransportMessageGetType(message);
+    LSMessageToken token = (type == _LSTransportMessageTypeReply) ?
+                           _LSTransportMessageGetReplyToken(message) :
+                           _LSTransportMessageGetToken(message);
+
+    return _LSTransportMonitorFilterMatchFields(filter, type, token,
+                                                _LSTransportMessageGetSenderServiceName(message),
+                                                _LSTransportMessageGetSenderUniqueName(message),
+                                                _LSTransportMessageGetDestServiceName(message),
+                                                _LSTransportMessageGetDestUniqueName(message));
+}
+
 /** 
  *******************************************************************************
  * @brief Print a message.
@@ -25,6 +25,7 @@
 //#include "transport_client.h"
 
 #include "transport_shm.h"
+#include "timerwheel.h"
 
 /**
  * @addtogroup LunaServiceTransportMessage
@@ -68,6 +69,18 @@ typedef enum LSTransportMessageType
     _LSTransportMessageTypeListClientsReply,         /**< reply from hub with list of connected clients */
     _LSTransportMessageTypePushRole,                 /**< push a role (security state) to the hub */
     _LSTransportMessageTypePushRoleReply,            /**< reply for a push role message */
+    _LSTransportMessageTypeMethodCallShm,            /**< method call whose payload is passed in a shared memory
+                                                          segment (followed by fd); seen as a standard method call
+                                                          once received */
+    _LSTransportMessageTypeIncomingConnection,       /**< message from hub to a service handing it one end of a
+                                                          socketpair whose other end went to a client that queried
+                                                          its name (followed by fd) */
+    _LSTransportMessageTypeSignalRegisterMany,       /**< register several signals with the bus at once; the reply
+                                                          is the same as for a single registration */
+    _LSTransportMessageTypeCapabilities,             /**< reply to a ClientInfo that advertised capabilities, with
+                                                          the capabilities of this side of the connection */
+    _LSTransportMessageTypeHubStats,                 /**< message to hub to request its statistics */
+    _LSTransportMessageTypeHubStatsReply,            /**< reply from hub with its statistics as a json string */
     _LSTransportMessageTypeUnknown,                  /**< tag uninitialized types */
 } _LSTransportMessageType;
 
@@ -98,6 +111,13 @@ typedef enum LSTransportMessageType
 #define LS_TRANSPORT_REQUEST_NAME_NAME_ALREADY_REGISTERED    -2  /**< the name has already been registered by someone else */
 #define LS_TRANSPORT_REQUEST_NAME_INVALID_PROTOCOL_VERSION   -3  /**< protocol versions do not match */
 
+/* how much of a reconnecting client's previous registration a restarted hub
+ * restored (sent after the name in a successful reply) */
+#define LS_TRANSPORT_REQUEST_NAME_RESUME_NONE                 0  /**< new unique name (and listen socket) */
+#define LS_TRANSPORT_REQUEST_NAME_RESUME_NAME                 1  /**< previous unique name; signals have to be
+                                                                      registered again */
+#define LS_TRANSPORT_REQUEST_NAME_RESUME_ALL                  2  /**< previous unique name and signal registrations */
+
 /** @} LSTransportRequestNameReturnCodes */
 
 /**
@@ -125,13 +145,63 @@ typedef enum LSTransportConnectState {
     _LSTransportConnectStateOtherFailure    /**< connect() returned other error, which is considered fatal */
 } _LSTransportConnectState;
 
+/**
+ * Priority of a message in an outgoing queue. A message is sent ahead of
+ * lower priority messages that are still waiting; messages of the same
+ * priority go out in the order they were queued.
+ */
+typedef enum LSTransportPriority {
+    _LSTransportPriorityBulk = -1,      /**< behind everything else (e.g., large data feeds) */
+    _LSTransportPriorityNormal = 0,     /**< default */
+    _LSTransportPriorityHigh = 1,       /**< control messages and latency-sensitive replies */
+} _LSTransportPriority;
+
+#define LS_TRANSPORT_PRIORITY_LANES             3
+#define LS_TRANSPORT_PRIORITY_LANE(priority)    ((priority) - _LSTransportPriorityBulk)
+
+/**
+ * The header's type field holds the _LSTransportMessageType in its low 24
+ * bits and flags in the high 8, which older versions always send as 0. Flags
+ * are only sent to (and honored from) peers with LS_TRANSPORT_CAP_HEADER_FLAGS.
+ */
+#define LS_TRANSPORT_HEADER_TYPE_MASK               0x00FFFFFFu
+#define LS_TRANSPORT_HEADER_FLAGS_MASK              0xFF000000u
+
+#define LS_TRANSPORT_HEADER_FLAG_BINARY_PAYLOAD     (1u << 24)  /**< payload is binary encoded (see
+                                                                     binary_payload.c) instead of JSON */
+#define LS_TRANSPORT_HEADER_FLAG_COMPRESSED         (1u << 25)  /**< body is compressed (see
+                                                                     transport_compress.c) */
+#define LS_TRANSPORT_HEADER_FLAG_IDEMPOTENT         (1u << 26)  /**< reply is from a method whose replies depend
+                                                                     only on the payload, so identical calls
+                                                                     may share one (LUNA_METHOD_FLAG_IDEMPOTENT) */
+
+#define LS_TRANSPORT_HEADER_GET_TYPE(header)        ((_LSTransportMessageType)((header)->type & LS_TRANSPORT_HEADER_TYPE_MASK))
+
+/**
+ * Capabilities that the two sides of a connection agree on. The side that
+ * connects sends its capabilities at the end of its ClientInfo, and the
+ * other side answers with a Capabilities message; a side that sends
+ * neither (e.g., an older version) has none.
+ */
+#define LS_TRANSPORT_CAP_BINARY_PAYLOAD             (1 << 0)    /**< can receive binary encoded payloads */
+#define LS_TRANSPORT_CAP_HEADER_FLAGS               (1 << 1)    /**< sends and understands LS_TRANSPORT_HEADER_FLAG_* */
+#define LS_TRANSPORT_CAP_COMPRESSION                (1 << 2)    /**< can receive compressed messages */
+#define LS_TRANSPORT_CAP_INCOMING_CONNECTION        (1 << 3)    /**< takes connections the hub hands over in
+                                                                     _LSTransportMessageTypeIncomingConnection */
+
+#define LS_TRANSPORT_CAPS                           (LS_TRANSPORT_CAP_BINARY_PAYLOAD | \
+                                                     LS_TRANSPORT_CAP_HEADER_FLAGS | \
+                                                     LS_TRANSPORT_CAP_COMPRESSION | \
+                                                     LS_TRANSPORT_CAP_INCOMING_CONNECTION)  /**< what we support */
+
 /**
  * Header for the raw message.
  */
 struct LSTransportHeader {
     unsigned long len;            /**< len of the data portion of the message (doesn't include size of header itself) */
     LSMessageToken token;         /**< serial associated with message */
-    _LSTransportMessageType type; /**< signal, method call, reply, etc. */
+    unsigned int type;            /**< signal, method call, reply, etc. (_LSTransportMessageType)
+                                       and LS_TRANSPORT_HEADER_FLAG_* (see LS_TRANSPORT_HEADER_TYPE_MASK) */
 };
 
 typedef struct LSTransportHeader _LSTransportHeader;
@@ -154,7 +224,7 @@ struct LSTransportMessage {
     int ref;
     _LSTransportClient *client;         /**< only valid for received messages -- client from which a message came */
     unsigned long tx_bytes_remaining;   /**< bytes of raw message left to transmit */
-    guint timeout_id;                   /**< timeout source id (currently only used by hub) */
+    _LSTimerWheelEntry timeout;         /**< timeout (currently only used by hub) */
     unsigned long alloc_body_size;      /**< size of allocated memory for the body of
                                              the message (not including header). This
                                              can be larger than the actual len of the 
@@ -168,11 +238,72 @@ struct LSTransportMessage {
     int retries;                        /**< remaining send retries */
     _LSTransportConnectState connect_state;   /**< state of connect() -- e.g., if we fail to connect()
                                                    due to non-blocking sockets we save the state here */
+    struct LSTransportMessage *shared;  /**< message that owns @ref raw when this message
+                                             only references its body (NULL otherwise) */
+    _LSTransportHeader tx_header;       /**< per-recipient header; only used when @ref shared
+                                             is set since the header in @ref raw is shared */
+    int raw_pool_class;                 /**< size class of @ref raw in the raw buffer pool
+                                             (-1 if it was allocated from the heap) */
+    char *shm_payload;                  /**< payload received in a shared memory segment
+                                             (NULL if the payload is inline) */
+    unsigned long shm_payload_size;     /**< size of @ref shm_payload */
+    bool shm_payload_mapped;            /**< true if @ref shm_payload is mapped, false if copied */
+    gint64 queued_us;                   /**< when the message was added to an outgoing queue */
+    bool tx_reply_token_set;            /**< true if @ref tx_reply_token replaces the reply
+                                             serial at the start of the shared body */
+    LSMessageToken tx_reply_token;      /**< per-recipient reply serial of a shared reply */
+    bool tx_coalesce;                   /**< true if this reply supersedes an unsent reply with the
+                                             same reply serial still queued for the recipient */
+    _LSTransportPriority tx_priority;   /**< lane of the outgoing queue this message goes in */
+    LSMessageToken tx_follows;          /**< method call this message may not overtake while the call
+                                             is still queued (e.g., the call a cancel is for); 0 if none */
+    _LSTransportPriority reply_priority;    /**< priority of replies to this (received) method call */
+    unsigned int reply_flags;           /**< LS_TRANSPORT_HEADER_FLAG_* given to replies to this (received)
+                                             method call */
+    bool fields_indexed;                /**< true if the field offsets below are valid; set once a
+                                             message has been completely received */
+    long method_offset;                 /**< body offset of the method (-1 if none) */
+    long payload_offset;                /**< body offset of the inline payload (-1 if none) */
+    long payload_end_offset;            /**< body offset just past the payload's nul: the app id of
+                                             a method call, the destination of a monitor copy
+                                             (-1 if none) */
+    char *tx_wire;                      /**< compressed header + body that is sent instead of
+                                             @ref raw (NULL if the message is sent as is) */
+    unsigned long tx_wire_size;         /**< size of @ref tx_wire */
 };
 
 typedef struct LSTransportMessage _LSTransportMessage;
 
+#define LS_TRANSPORT_MESSAGE_POOL_NUM_CLASSES   4   /**< number of raw buffer pool size classes */
+
+/**
+ * Statistics for one size class of the raw message buffer pool
+ */
+typedef struct LSTransportMessagePoolStats {
+    unsigned long size;         /**< size of buffers in this class (includes header) */
+    unsigned long hits;         /**< allocations satisfied from the free list */
+    unsigned long misses;       /**< allocations that had to go to the heap */
+    unsigned long free;         /**< buffers currently on the free list */
+} _LSTransportMessagePoolStats;
+
+bool _LSTransportMessagePoolGetStats(int size_class, _LSTransportMessagePoolStats *stats);
+
 bool LSTransportMessageFilterMatch(_LSTransportMessage *message, const char *filter);
+
+/** Message types that a monitor can ask senders to mirror (bit mask) */
+#define LS_TRANSPORT_MONITOR_TYPE_CALL      (1 << 0)    /**< method calls and cancels */
+#define LS_TRANSPORT_MONITOR_TYPE_REPLY     (1 << 1)    /**< replies */
+#define LS_TRANSPORT_MONITOR_TYPE_SIGNAL    (1 << 2)    /**< signals */
+#define LS_TRANSPORT_MONITOR_TYPE_ALL       (LS_TRANSPORT_MONITOR_TYPE_CALL | LS_TRANSPORT_MONITOR_TYPE_REPLY | LS_TRANSPORT_MONITOR_TYPE_SIGNAL)
+
+typedef struct LSTransportMonitorFilter _LSTransportMonitorFilter;
+
+_LSTransportMonitorFilter* _LSTransportMonitorFilterNew(const char *names, int32_t types, int32_t sample_rate);
+void _LSTransportMonitorFilterFree(_LSTransportMonitorFilter *filter);
+bool _LSTransportMonitorFilterMatchFields(const _LSTransportMonitorFilter *filter, _LSTransportMessageType type, LSMessageToken token,
+                                          const char *sender_service_name, const char *sender_unique_name,
+                                          const char *dest_service_name, const char *dest_unique_name);
+bool LSTransportMonitorFilterMatch(const _LSTransportMonitorFilter *filter, _LSTransportMessage *message);
 void LSTransportMessagePrint(_LSTransportMessage *message, FILE *file);
 
 inline _LSTransportMessage* _LSTransportMessageNew(unsigned long payload_size);
@@ -183,11 +314,16 @@ inline _LSTransportMessage* _LSTransportMessageRef(_LSTransportMessage *message)
 inline void _LSTransportMessageUnref(_LSTransportMessage *message);
 inline _LSTransportMessage* _LSTransportMessageCopyNewRef(_LSTransportMessage *message);
 inline _LSTransportMessage* _LSTransportMessageCopy(_LSTransportMessage *dest, const _LSTransportMessage *src);
+unsigned long _LSTransportMessageGetCopyBodySize(const _LSTransportMessage *message);
+_LSTransportMessage* _LSTransportMessageShareNewRef(_LSTransportMessage *message);
+_LSTransportMessage* _LSTransportMessageShareReplyNewRef(_LSTransportMessage *reply, LSMessageToken reply_token);
+
+#define LS_TRANSPORT_MESSAGE_MAX_TX_IOV     3   /**< max io vectors filled in by _LSTransportMessageGetTxVector */
+int _LSTransportMessageGetTxVector(_LSTransportMessage *message, struct iovec *iov);
 
 _LSTransportMessage* _LSTransportMessageFromVectorNewRef(const struct iovec *iov, int iovcnt, unsigned long total_len);
 
-inline guint _LSTransportMessageGetTimeoutId(const _LSTransportMessage *message);
-inline void _LSTransportMessageSetTimeoutId(_LSTransportMessage *message, guint timeout_id);
+inline _LSTimerWheelEntry* _LSTransportMessageGetTimeout(_LSTransportMessage *message);
 inline _LSTransportConnectState _LSTransportMessageGetConnectState(const _LSTransportMessage * message);
 inline void _LSTransportMessageSetConnectState(_LSTransportMessage *message, _LSTransportConnectState state);
 inline int _LSTransportMessageGetConnectionFd(const _LSTransportMessage *message);
@@ -213,10 +349,20 @@ inline bool _LSTransportMessageTypeIsMonitorType(_LSTransportMessageType type);
 inline bool _LSTransportMessageTypeIsErrorType(_LSTransportMessageType type);
 inline bool _LSTransportMessageTypeIsReplyType(_LSTransportMessageType type);
 bool _LSTransportMessageIsConnectionFdType(const _LSTransportMessage *message);
+bool _LSTransportMessageAttachShmPayload(_LSTransportMessage *message, LSError *lserror);
+void _LSTransportMessageIndexFields(_LSTransportMessage *message);
 
 const char* _LSTransportMessageGetMethod(const _LSTransportMessage *message);
 const char* _LSTransportMessageGetCategory(const _LSTransportMessage *message);
 const char* _LSTransportMessageGetPayload(const _LSTransportMessage *message);
+bool _LSTransportMessageIsBinaryPayload(const _LSTransportMessage *message);
+unsigned long _LSTransportMessageGetTxSize(const _LSTransportMessage *message);
+bool _LSTransportMessageCompress(_LSTransportMessage *message);
+bool _LSTransportMessageDecompress(_LSTransportMessage *message, LSError *lserror);
+void _LSTransportMessageSetReplyPriority(_LSTransportMessage *message, _LSTransportPriority priority);
+void _LSTransportMessageSetReplyFlags(_LSTransportMessage *message, unsigned int flags);
+bool _LSTransportMessageIsIdempotentReply(const _LSTransportMessage *message);
+long _LSTransportMessageGetPayloadLen(const _LSTransportMessage *message);
 inline void _LSTransportMessageSetAppId(_LSTransportMessage *message, const char *app_id);
 const char* _LSTransportMessageGetAppId(_LSTransportMessage *message);
 const char* _LSTransportMessageGetSenderServiceName(const _LSTransportMessage *message);
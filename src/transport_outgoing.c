@@ -21,6 +21,7 @@
 
 #include "error.h"
 #include "transport_message.h"
+#include "transport_serial.h"
 #include "transport_outgoing.h"
 
 /**
@@ -38,18 +39,22 @@
  *******************************************************************************
  * @brief Allocate a new outgoing queue.
  * 
+ * @param  watermarks   IN  flow control thresholds (must outlive the queue)
+ *
  * @retval  queue on success
  * @retval  NULL on failure
  *******************************************************************************
  */
 _LSTransportOutgoing*
-_LSTransportOutgoingNew(void)
+_LSTransportOutgoingNew(const _LSTransportWatermarks *watermarks)
 {
     _LSTransportOutgoing *outgoing = g_slice_new0(_LSTransportOutgoing);
     if (outgoing)
     {
         pthread_mutex_init(&outgoing->lock, NULL);
+        outgoing->watermarks = watermarks;
         outgoing->queue = g_queue_new();
+        outgoing->prioritize = true;
         outgoing->serial = _LSTransportSerialNew();
     }
     return outgoing;
@@ -78,6 +83,11 @@ _LSTransportOutgoingFree(_LSTransportOutgoing *outgoing)
    
     _LSTransportSerialFree(outgoing->serial);
 
+    if (outgoing->histograms)
+    {
+        g_slice_free(_LSTransportOutgoingHistograms, outgoing->histograms);
+    }
+
 #ifdef MEMCHECK
     memset(outgoing, 0xFF, sizeof(_LSTransportOutgoing));
 #endif
@@ -85,4 +95,511 @@ _LSTransportOutgoingFree(_LSTransportOutgoing *outgoing)
     g_slice_free(_LSTransportOutgoing, outgoing);
 }
 
+static inline unsigned long
+_LSTransportOutgoingMessageSize(const _LSTransportMessage *message)
+{
+    return _LSTransportMessageGetTxSize(message);
+}
+
+static inline bool
+_LSTransportOutgoingMessageStarted(const _LSTransportMessage *message)
+{
+    return message->tx_bytes_remaining != _LSTransportOutgoingMessageSize(message);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Get the priority a message should be queued with. This is the
+ * message's own priority, except that a message that follows a method call
+ * (e.g., a cancel for it) is held back to the priority of the call if the
+ * call hasn't been completely sent yet, so that it doesn't overtake it.
+ *
+ * @attention The outgoing lock must be held.
+ * 
+ * @param  outgoing     IN  outgoing queue
+ * @param  message      IN  message
+ *
+ * @retval  priority
+ *******************************************************************************
+ */
+static _LSTransportPriority
+_LSTransportOutgoingGetPriority(_LSTransportOutgoing *outgoing, const _LSTransportMessage *message)
+{
+    _LSTransportPriority priority = message->tx_priority;
+
+    if (message->tx_follows != LSMESSAGE_TOKEN_INVALID && priority > _LSTransportPriorityBulk)
+    {
+        _LSTransportMessage *call = _LSTransportSerialLookupRef(outgoing->serial, message->tx_follows);
+
+        if (call)
+        {
+            if (call->tx_bytes_remaining > 0 && call->tx_priority < priority)
+            {
+                priority = call->tx_priority;
+            }
+
+            _LSTransportMessageUnref(call);
+        }
+    }
+
+    return priority;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Insert a message behind the queued messages of the same or higher
+ * priority, but ahead of any of lower priority.
+ *
+ * The queue is kept sorted by priority (from the head, or from just after
+ * the head if the head is partially sent), and @ref lane_tail marks where
+ * each priority ends, so this doesn't have to walk the queue.
+ *
+ * @attention The outgoing lock must be held.
+ * 
+ * @param  outgoing     IN  outgoing queue
+ * @param  message      IN  message (queue takes over a ref)
+ *******************************************************************************
+ */
+static void
+_LSTransportOutgoingInsert(_LSTransportOutgoing *outgoing, _LSTransportMessage *message)
+{
+    message->tx_priority = _LSTransportOutgoingGetPriority(outgoing, message);
+
+    int lane = LS_TRANSPORT_PRIORITY_LANE(message->tx_priority);
+    GList *after = NULL;
+    int i;
+
+    for (i = lane; i < LS_TRANSPORT_PRIORITY_LANES && !after; i++)
+    {
+        after = outgoing->lane_tail[i];
+    }
+
+    if (!after)
+    {
+        GList *head = g_queue_peek_head_link(outgoing->queue);
+
+        if (head && _LSTransportOutgoingMessageStarted(head->data))
+        {
+            /* the rest of the head has to go out first; since nothing can
+             * get ahead of it anymore, it no longer marks the end of its
+             * priority */
+            after = head;
+
+            int head_lane = LS_TRANSPORT_PRIORITY_LANE(((_LSTransportMessage*)head->data)->tx_priority);
+
+            if (outgoing->lane_tail[head_lane] == head)
+            {
+                outgoing->lane_tail[head_lane] = NULL;
+            }
+        }
+    }
+
+    if (after)
+    {
+        g_queue_insert_after(outgoing->queue, after, message);
+        outgoing->lane_tail[lane] = g_list_next(after);
+    }
+    else
+    {
+        g_queue_push_head(outgoing->queue, message);
+        outgoing->lane_tail[lane] = g_queue_peek_head_link(outgoing->queue);
+    }
+}
+
+/** 
+ *******************************************************************************
+ * @brief Re-evaluate whether the queue is congested after its size changed.
+ *
+ * @attention The outgoing lock must be held.
+ * 
+ * @param  outgoing     IN  outgoing queue
+ *******************************************************************************
+ */
+static void
+_LSTransportOutgoingUpdateCongestion(_LSTransportOutgoing *outgoing)
+{
+    const _LSTransportWatermarks *marks = outgoing->watermarks;
+
+    if (!marks)
+    {
+        return;
+    }
+
+    bool congested = outgoing->congested;
+
+    if (!congested)
+    {
+        congested = (marks->high_bytes && outgoing->queued_bytes >= marks->high_bytes) ||
+                    (marks->high_messages && outgoing->queued_messages >= marks->high_messages);
+    }
+    else
+    {
+        congested = (marks->high_bytes && outgoing->queued_bytes > marks->low_bytes) ||
+                    (marks->high_messages && outgoing->queued_messages > marks->low_messages);
+    }
+
+    if (congested != outgoing->congested)
+    {
+        outgoing->congested = congested;
+        outgoing->congestion_changed = !outgoing->congestion_changed;
+    }
+}
+
+/** 
+ *******************************************************************************
+ * @brief Add a message to an outgoing queue and record the queue depth.
+ *
+ * @attention The outgoing lock must be held.
+ * 
+ * @param  outgoing     IN  outgoing queue
+ * @param  message      IN  message (queue takes over a ref)
+ * @param  prepend      IN  true to add to the head of the queue
+ *******************************************************************************
+ */
+void
+_LSTransportOutgoingPush(_LSTransportOutgoing *outgoing, _LSTransportMessage *message, bool prepend)
+{
+    if (!outgoing->histograms)
+    {
+        outgoing->histograms = g_slice_new0(_LSTransportOutgoingHistograms);
+    }
+
+    _LSLatencyHistogramAdd(&outgoing->histograms->queue_depth, g_queue_get_length(outgoing->queue));
+    message->queued_us = _LSLatencyNowUs();
+
+    if (!outgoing->prioritize)
+    {
+        if (prepend)
+        {
+            g_queue_push_head(outgoing->queue, message);
+        }
+        else
+        {
+            g_queue_push_tail(outgoing->queue, message);
+        }
+    }
+    else if (prepend)
+    {
+        /* it goes ahead of everything, so it counts as the highest priority
+         * to keep the queue sorted */
+        message->tx_priority = _LSTransportPriorityHigh;
+        g_queue_push_head(outgoing->queue, message);
+
+        int lane = LS_TRANSPORT_PRIORITY_LANE(_LSTransportPriorityHigh);
+
+        if (!outgoing->lane_tail[lane])
+        {
+            outgoing->lane_tail[lane] = g_queue_peek_head_link(outgoing->queue);
+        }
+    }
+    else
+    {
+        _LSTransportOutgoingInsert(outgoing, message);
+    }
+
+    outgoing->queued_bytes += _LSTransportOutgoingMessageSize(message);
+    outgoing->queued_messages++;
+
+    if (outgoing->queued_bytes > outgoing->peak_queued_bytes)
+    {
+        outgoing->peak_queued_bytes = outgoing->queued_bytes;
+    }
+
+    if (outgoing->queued_messages > outgoing->peak_queued_messages)
+    {
+        outgoing->peak_queued_messages = outgoing->queued_messages;
+    }
+
+    _LSTransportOutgoingUpdateCongestion(outgoing);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Take the message at the head of an outgoing queue off the queue.
+ *
+ * @attention The outgoing lock must be held.
+ * 
+ * @param  outgoing     IN  outgoing queue
+ *
+ * @retval  message (caller takes over the queue's ref)
+ * @retval  NULL if the queue is empty
+ *******************************************************************************
+ */
+_LSTransportMessage*
+_LSTransportOutgoingPop(_LSTransportOutgoing *outgoing)
+{
+    GList *head = g_queue_peek_head_link(outgoing->queue);
+
+    if (head)
+    {
+        int lane = LS_TRANSPORT_PRIORITY_LANE(((_LSTransportMessage*)head->data)->tx_priority);
+
+        if (outgoing->lane_tail[lane] == head)
+        {
+            outgoing->lane_tail[lane] = NULL;
+        }
+    }
+
+    _LSTransportMessage *message = g_queue_pop_head(outgoing->queue);
+
+    if (message)
+    {
+        LS_ASSERT(outgoing->queued_messages > 0);
+
+        outgoing->queued_bytes -= _LSTransportOutgoingMessageSize(message);
+        outgoing->queued_messages--;
+        _LSTransportOutgoingUpdateCongestion(outgoing);
+    }
+
+    return message;
+}
+
+static gint
+_LSTransportOutgoingComparePriority(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+    const _LSTransportMessage *msg_a = a;
+    const _LSTransportMessage *msg_b = b;
+
+    /* highest first */
+    return (int)msg_b->tx_priority - (int)msg_a->tx_priority;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Start ordering a FIFO queue (i.e., a pending queue that is
+ * becoming the outgoing queue of a connected client) by priority. Nothing on
+ * the queue can have been sent yet.
+ *
+ * @attention The outgoing lock must be held.
+ * 
+ * @param  outgoing     IN  outgoing queue
+ *******************************************************************************
+ */
+void
+_LSTransportOutgoingPrioritize(_LSTransportOutgoing *outgoing)
+{
+    GList *iter = NULL;
+
+    if (outgoing->prioritize)
+    {
+        return;
+    }
+
+    for (iter = g_queue_peek_head_link(outgoing->queue); iter != NULL; iter = g_list_next(iter))
+    {
+        _LSTransportMessage *message = iter->data;
+        message->tx_priority = _LSTransportOutgoingGetPriority(outgoing, message);
+    }
+
+    /* stable, so messages of the same priority stay in queue order */
+    g_queue_sort(outgoing->queue, _LSTransportOutgoingComparePriority, NULL);
+
+    memset(outgoing->lane_tail, 0, sizeof(outgoing->lane_tail));
+
+    for (iter = g_queue_peek_head_link(outgoing->queue); iter != NULL; iter = g_list_next(iter))
+    {
+        _LSTransportMessage *message = iter->data;
+        outgoing->lane_tail[LS_TRANSPORT_PRIORITY_LANE(message->tx_priority)] = iter;
+    }
+
+    outgoing->prioritize = true;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Find out whether the queue became congested or decongested since
+ * the last time this was called.
+ *
+ * @attention The outgoing lock must be held.
+ * 
+ * @param  outgoing     IN  outgoing queue
+ * @param  congested    OUT current congestion state
+ *
+ * @retval  true if the state changed
+ * @retval  false otherwise
+ *******************************************************************************
+ */
+bool
+_LSTransportOutgoingTakeCongestionChange(_LSTransportOutgoing *outgoing, bool *congested)
+{
+    if (!outgoing->congestion_changed)
+    {
+        return false;
+    }
+
+    outgoing->congestion_changed = false;
+    *congested = outgoing->congested;
+
+    return true;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Put a coalescing reply in the place of a queued reply with the same
+ * reply serial (i.e., an older update for the same subscription) that
+ * hasn't started going out yet. The replacement takes over the position,
+ * token and queue time of the old reply, so the queue stays in token order
+ * and the dwell time covers how long the subscriber has been behind.
+ *
+ * @attention The outgoing lock must be held.
+ * 
+ * @param  outgoing     IN  outgoing queue
+ * @param  message      IN  reply with @ref tx_coalesce set (queue takes over
+ *                          a ref if it replaces a message)
+ *
+ * @retval  true if a queued reply was replaced
+ * @retval  false if there was nothing to replace (message was not queued)
+ *******************************************************************************
+ */
+bool
+_LSTransportOutgoingCoalesce(_LSTransportOutgoing *outgoing, _LSTransportMessage *message)
+{
+    LS_ASSERT(message->tx_coalesce);
+
+    LSMessageToken reply_token = _LSTransportMessageGetReplyToken(message);
+    GList *head = g_queue_peek_head_link(outgoing->queue);
+    GList *iter = NULL;
+
+    /* newest first, since that's where the last update for a subscriber
+     * that's behind will be; the head may already be partially sent */
+    for (iter = g_queue_peek_tail_link(outgoing->queue); iter != NULL && iter != head; iter = g_list_previous(iter))
+    {
+        _LSTransportMessage *queued = iter->data;
+
+        if (queued && queued->tx_coalesce &&
+            _LSTransportMessageGetReplyToken(queued) == reply_token &&
+            queued->tx_priority == message->tx_priority &&
+            !_LSTransportOutgoingMessageStarted(queued))
+        {
+            _LSTransportMessageSetToken(message, _LSTransportMessageGetToken(queued));
+            message->queued_us = queued->queued_us;
+
+            iter->data = message;
+
+            outgoing->queued_bytes += _LSTransportOutgoingMessageSize(message);
+            outgoing->queued_bytes -= _LSTransportOutgoingMessageSize(queued);
+            _LSTransportOutgoingUpdateCongestion(outgoing);
+
+            _LSTransportMessageUnref(queued);
+
+            outgoing->coalesced++;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Take method calls that have been waiting too long off a FIFO
+ * (i.e., pending) queue. The head is left alone, since the name query in
+ * flight is for it, and so are cancels, which are small and let go of a
+ * call.
+ *
+ * @attention The outgoing lock must be held.
+ * 
+ * @param  outgoing     IN  outgoing queue
+ * @param  queued_before_us IN  expire messages queued before this time
+ *
+ * @retval  list of expired messages, oldest first (caller takes over the
+ *          queue's refs)
+ *******************************************************************************
+ */
+GSList*
+_LSTransportOutgoingExpire(_LSTransportOutgoing *outgoing, gint64 queued_before_us)
+{
+    LS_ASSERT(!outgoing->prioritize);
+
+    GSList *expired = NULL;
+    GList *head = g_queue_peek_head_link(outgoing->queue);
+    GList *iter = head ? g_list_next(head) : NULL;
+
+    while (iter != NULL)
+    {
+        GList *next = g_list_next(iter);
+        _LSTransportMessage *message = iter->data;
+
+        if (message->queued_us < queued_before_us
+            && _LSTransportMessageGetType(message) == _LSTransportMessageTypeMethodCall)
+        {
+            g_queue_delete_link(outgoing->queue, iter);
+
+            outgoing->queued_bytes -= _LSTransportOutgoingMessageSize(message);
+            outgoing->queued_messages--;
+
+            expired = g_slist_prepend(expired, message);
+        }
+
+        iter = next;
+    }
+
+    if (expired)
+    {
+        _LSTransportOutgoingUpdateCongestion(outgoing);
+    }
+
+    return g_slist_reverse(expired);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Record that a queued message has been completely sent.
+ *
+ * @attention The outgoing lock must be held.
+ * 
+ * @param  outgoing     IN  outgoing queue
+ * @param  message      IN  message
+ *******************************************************************************
+ */
+void
+_LSTransportOutgoingMessageSent(_LSTransportOutgoing *outgoing, _LSTransportMessage *message)
+{
+    outgoing->sent_messages++;
+    outgoing->sent_bytes += _LSTransportOutgoingMessageSize(message);
+
+    if (message->queued_us && outgoing->histograms)
+    {
+        _LSLatencyHistogramAdd(&outgoing->histograms->queue_dwell, _LSLatencyNowUs() - message->queued_us);
+    }
+}
+
+/** 
+ *******************************************************************************
+ * @brief Record that a message was sent completely without being queued.
+ *
+ * @attention The outgoing lock must be held.
+ * 
+ * @param  outgoing     IN  outgoing queue
+ * @param  size         IN  bytes sent
+ *******************************************************************************
+ */
+void
+_LSTransportOutgoingDirectSent(_LSTransportOutgoing *outgoing, unsigned long size)
+{
+    outgoing->direct_sends++;
+    outgoing->sent_messages++;
+    outgoing->sent_bytes += size;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Get the queueing histograms of an outgoing queue.
+ *
+ * @attention The outgoing lock must be held.
+ * 
+ * @param  outgoing     IN  outgoing queue
+ *
+ * @retval  histograms (empty ones shared by every queue that hasn't queued
+ *          anything yet)
+ *******************************************************************************
+ */
+const _LSTransportOutgoingHistograms*
+_LSTransportOutgoingGetHistograms(const _LSTransportOutgoing *outgoing)
+{
+    static const _LSTransportOutgoingHistograms empty_histograms;
+
+    return outgoing->histograms ? outgoing->histograms : &empty_histograms;
+}
+
 /* @} END OF LunaServiceTransportOutgoing */
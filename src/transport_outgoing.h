@@ -22,17 +22,72 @@
 
 #include <pthread.h>
 #include <glib.h>
+#include "transport_message.h"
 #include "transport_serial.h"
+#include "latency.h"
+
+#define LS_TRANSPORT_DEFAULT_HIGH_WATER_BYTES       (1024 * 1024)   /**< default bytes queued to a client before it's congested */
+#define LS_TRANSPORT_DEFAULT_LOW_WATER_BYTES        (256 * 1024)    /**< default bytes it has to drain to before it isn't */
+#define LS_TRANSPORT_DEFAULT_HIGH_WATER_MESSAGES    1024            /**< default messages queued to a client before it's congested */
+#define LS_TRANSPORT_DEFAULT_LOW_WATER_MESSAGES     256             /**< default messages it has to drain to before it isn't */
+
+/**
+ * Flow control thresholds for outgoing queues. A queue becomes congested
+ * when the bytes or the messages queued reach their high-water mark and
+ * stops being congested when both have drained to their low-water mark.
+ * A high-water mark of 0 turns that limit off.
+ */
+typedef struct LSTransportWatermarks {
+    unsigned long high_bytes;
+    unsigned long low_bytes;
+    unsigned int high_messages;
+    unsigned int low_messages;
+} _LSTransportWatermarks;
+
+/**
+ * Queueing histograms of an outgoing queue. Allocated when the first
+ * message is queued, since most connections never queue anything.
+ */
+typedef struct LSTransportOutgoingHistograms {
+    _LSLatencyHistogram queue_depth;    /**< queue length seen by queued messages */
+    _LSLatencyHistogram queue_dwell;    /**< time (us) from queueing a message to sending all of it */
+} _LSTransportOutgoingHistograms;
 
 struct LSTransportOutgoing {
-    pthread_mutex_t lock;           /**< protects queue */
-    GQueue *queue;                  /**< queue of LSTransportMessages that need to be sent */
+    pthread_mutex_t lock;           /**< protects queue and stats */
+    GQueue *queue;                  /**< queue of LSTransportMessages that need to be sent, highest
+                                         priority first (except for a head that's partially sent) */
+    GList *lane_tail[LS_TRANSPORT_PRIORITY_LANES];  /**< last message of each priority on @ref queue
+                                                         (NULL if none) */
+    bool prioritize;                /**< false to keep @ref queue in FIFO order instead (pending
+                                         queues, where each name query is for the head message) */
     _LSTransportSerial *serial;     /**< keeps track of clean shutdown state */
+    const _LSTransportWatermarks *watermarks;   /**< flow control thresholds (owned by the transport) */
+    unsigned long queued_bytes;     /**< size of the messages on @ref queue */
+    unsigned int queued_messages;   /**< number of messages on @ref queue */
+    bool congested;                 /**< true from reaching a high-water mark until draining to the low-water marks */
+    bool congestion_changed;        /**< true if @ref congested changed since it was last taken */
+    guint64 direct_sends;           /**< messages sent completely without being queued */
+    guint64 coalesced;              /**< queued messages replaced by a newer one before being sent */
+    guint64 sent_messages;          /**< messages completely sent, queued or not */
+    guint64 sent_bytes;             /**< size of the messages completely sent */
+    unsigned long peak_queued_bytes;    /**< highest @ref queued_bytes seen */
+    unsigned int peak_queued_messages;  /**< highest @ref queued_messages seen */
+    _LSTransportOutgoingHistograms *histograms; /**< NULL until a message is queued */
 };
 
 typedef struct LSTransportOutgoing _LSTransportOutgoing;
 
-_LSTransportOutgoing* _LSTransportOutgoingNew(void);
+_LSTransportOutgoing* _LSTransportOutgoingNew(const _LSTransportWatermarks *watermarks);
 void _LSTransportOutgoingFree(_LSTransportOutgoing *outgoing);
+void _LSTransportOutgoingPush(_LSTransportOutgoing *outgoing, _LSTransportMessage *message, bool prepend);
+_LSTransportMessage* _LSTransportOutgoingPop(_LSTransportOutgoing *outgoing);
+void _LSTransportOutgoingPrioritize(_LSTransportOutgoing *outgoing);
+bool _LSTransportOutgoingCoalesce(_LSTransportOutgoing *outgoing, _LSTransportMessage *message);
+GSList* _LSTransportOutgoingExpire(_LSTransportOutgoing *outgoing, gint64 queued_before_us);
+bool _LSTransportOutgoingTakeCongestionChange(_LSTransportOutgoing *outgoing, bool *congested);
+void _LSTransportOutgoingMessageSent(_LSTransportOutgoing *outgoing, _LSTransportMessage *message);
+void _LSTransportOutgoingDirectSent(_LSTransportOutgoing *outgoing, unsigned long size);
+const _LSTransportOutgoingHistograms* _LSTransportOutgoingGetHistograms(const _LSTransportOutgoing *outgoing);
 
 #endif      // _TRANSPORT_OUTGOING_H_
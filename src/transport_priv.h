@@ -32,6 +32,10 @@
 #include "transport_channel.h"
 #include "transport_signal.h"
 #include "transport_shm.h"
+#include "transport_epoll.h"
+#include "transport_shard.h"
+
+#define LS_TRANSPORT_TRIM_INTERVAL_SEC  10  /**< how often idle connections are trimmed */
 
 /**
  * "Global" in this case means that the token is unique for this transport to
@@ -47,19 +51,26 @@
  * Example serial numbers used for com.palm.bar2: 3, 4
  */
 typedef struct LSTransportGlobalToken {
-    pthread_mutex_t lock;
-    LSMessageToken value;
+    volatile LSMessageToken value;  /**< last token handed out; only updated atomically */
 } _LSTransportGlobalToken;
 
-struct LSTransport {
-    _LSTransportType    type;                 /*<< local transport (domain socket) or inet transport */
-    char                *service_name;        /*<< pretty name (e.g., com.palm.foo), NULL if there is no service name (e.g., anonymous client */
-    char                *unique_name;         /*<< unique name (e.g., local socket address) */
-    GMainContext        *mainloop_context;   /*<< glib mainloop context -- ref'd when added, so make sure to deref when done */
-
-    int                  source_priority;    /*<< io watch priority (for glib mainloop) */
+/**
+ * Everything that belongs to one bus: the connection to that bus's hub, the
+ * socket peers on that bus connect to, and the clients reached through it.
+ * A transport normally has a single bus; a palm service registered in
+ * combined mode has one for the public bus and one for the private bus,
+ * sharing the rest of the transport.
+ */
+struct LSTransportBus {
+    _LSTransport        *transport;         /*<< transport the bus belongs to */
+    bool                public_bus;         /*<< true if this is the public bus (set when connecting) */
+    _LSTransportType    type;               /*<< local transport (domain socket) or inet transport; the
+                                                 same for every bus of a transport once connected */
+    char                *unique_name;       /*<< unique name on this bus (e.g., local socket address) */
 
-    _LSTransportChannel  listen_channel;     /*<< accept incoming connections */
+    _LSTransportChannel  listen_channel;     /*<< accept incoming connections; per bus since the hub
+                                                  hands out the socket, and which socket a peer came
+                                                  in on is what tells us the bus it is on */
 
     _LSTransportShm      *shm;               /*<< shared memory for ordering of monitor messages */
 
@@ -74,17 +85,73 @@ struct LSTransport {
     LSTransportMessageHandler msg_handler;          /**< callback to handle incoming messages */
     void *msg_context;                              /**< private context passed to message handling callback */
 
+    LSTransportFlowControlHandler flow_control_handler; /**< callback to handle when a destination becomes congested or drains */
+    void *flow_control_context;
+
+    LSTransportIdleHandler idle_handler;        /**< callback to check whether an idle connection can be closed */
+    void *idle_context;
+
     _LSTransportClient      *hub;           /*<< client info for hub; should always be valid after connecting */
+    char                    *hub_address;   /*<< address we reached the hub at, for reconnecting */
+    bool                    hub_reconnect;  /*<< reconnect if the hub goes away (cleared when we disconnect) */
+    guint                   hub_reconnect_ms;       /*<< delay before the next reconnect attempt */
+    GSource                 *hub_reconnect_source;  /*<< pending reconnect attempt (NULL if none) */
+    GSList                  *hub_retired;   /*<< hub clients from before reconnecting; kept until deinit
+                                                 since other threads may still be sending to them */
     _LSTransportClient      *monitor;       /*<< client info for monitor; NULL when there is no monitor */
-  
-    _LSTransportGlobalToken *global_token;  /*<< global token that provides unique identity for messages sent by this transport */
+    _LSTransportMonitorFilter *monitor_filter;  /*<< what the monitor wants mirrored; NULL for everything */
+    pthread_mutex_t         monitor_filter_lock;    /*<< protects monitor_filter; taken last, with no
+                                                         other lock acquired while it's held */
 
-    pthread_mutex_t         lock;               /*<< lock for clients, all_connections, pending */ 
+    /* the tables below are protected by the transport's lock */
     GHashTable              *clients;           /*<< hash of _LSTransportClients by *service* name */
-    GHashTable              *all_connections;   /*<< hash of fd to _LSTransportClient */
+    GHashTable              *clients_snapshot;  /*<< read-only copy of clients that senders look up without
+                                                     the lock; replaced (never changed) under the lock
+                                                     whenever clients changes */
+    gint                    clients_readers;    /*<< number of lock-free lookups in progress */
+    GSList                  *clients_retired;   /*<< replaced snapshots that a lookup may still be using */
     GHashTable              *pending;           /*<< hash of _LSTransportOutgoing by service name */
+    GHashTable              *query_name_cache;  /*<< hash of remembered "QueryName" results by
+                                                     service name and app id */
+    bool                    query_name_cache_watched;   /*<< registered (or about to register) for the
+                                                             hub's config reload signal, which flushes
+                                                             @ref query_name_cache */
+    GSource                 *query_name_cache_watch_source; /*<< pending registration for that signal */
+    GHashTable              *signal_registrations;  /*<< "category\nmethod" to how many times we registered
+                                                         it with the hub */
+
+    bool                    privileged;         /*<< true if we are a privileged service on this bus */
+};
+
+struct LSTransport {
+    char                *service_name;        /*<< pretty name (e.g., com.palm.foo), NULL if there is no service name (e.g., anonymous client */
+    GMainContext        *mainloop_context;   /*<< glib mainloop context -- ref'd when added, so make sure to deref when done */
+
+    int                  source_priority;    /*<< io watch priority (for glib mainloop) */
+
+    _LSTransportBus      *buses[LS_TRANSPORT_MAX_BUSES];    /*<< buses served by this transport; the
+                                                                  first one is created with it */
+    int                  num_buses;
+
+    _LSTransportWatermarks  watermarks;         /*<< flow control thresholds for every outgoing queue */
+    unsigned long           compress_threshold_inet;    /*<< compress message bodies at least this big on inet
+                                                             connections (0 to never compress) */
+    unsigned long           compress_threshold_local;   /*<< same for local connections */
+    int                     sock_buf_min;       /*<< smallest socket buffer size when autotuning (0 to not autotune) */
+    int                     sock_buf_max;       /*<< largest socket buffer size when autotuning */
+    bool                    epoll_dispatch;     /*<< dispatch client watches from one epoll fd once attached */
+    _LSTransportEpoll       *epoll;             /*<< epoll dispatcher (NULL if client watches are GSources) */
+    int                     shard_count;        /*<< I/O threads to start for accepted connections once attached */
+    _LSTransportShards      *shards;            /*<< I/O threads (NULL if everything runs on mainloop_context) */
+    GSource                 *trim_source;       /*<< periodically trims idle connections */
+    gint64                  idle_timeout_us;    /*<< close connections we initiated after this long without
+                                                     traffic (0 to keep them until the far side goes away) */
+
+    _LSTransportGlobalToken *global_token;  /*<< global token that provides unique identity for messages sent
+                                                 by this transport (on any of its buses) */
 
-    bool                    privileged;         /*<< true if we are a privileged service */
+    pthread_mutex_t         lock;               /*<< lock for all_connections and each bus's tables */ 
+    GHashTable              *all_connections;   /*<< hash of fd to _LSTransportClient, on every bus */
 };
 
 #endif      // _TRANSPORT_PRIV_H_
@@ -24,6 +24,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <string.h>
+#include <pthread.h>
 #include <glib.h>
 
 #include "transport.h"
@@ -40,17 +41,43 @@
  * @{
  */
 
+/** Max threads used to read exe path and cmdline out of /proc */
+#define LS_TRANSPORT_CRED_RESOLVE_THREADS   4
+
+/**
+ * The exe path and cmdline come from /proc, which can be slow when lots of
+ * clients connect at once (e.g., boot), so they are resolved off the
+ * mainloop and only waited for when someone asks for them.
+ */
+typedef enum {
+    _LSTransportCredStateResolved,      /**< exe_path and cmd_line are final */
+    _LSTransportCredStateQueued,        /**< waiting for a resolver thread */
+    _LSTransportCredStateResolving,     /**< someone is reading /proc right now */
+} _LSTransportCredState;
+
 /**
  * Represents credentials for a client
  */
 struct _LSTransportCred {
+    int ref;                /**< ref count (a queued resolve holds one) */
     pid_t pid;              /**< process pid */
     uid_t uid;              /**< process uid */
     gid_t gid;              /**< process gid */
     const char *exe_path;   /**< full path to process' executable */
     const char *cmd_line;   /**< process' cmdline */
+
+    pthread_mutex_t lock;   /**< protects state, exe_path, cmd_line, and notify_* */
+    pthread_cond_t cond;    /**< signaled when state becomes resolved */
+    _LSTransportCredState state;
+
+    GMainContext *notify_context;   /**< context to run notify_callback in */
+    GSourceFunc notify_callback;    /**< idle callback run once resolved (see _LSTransportCredNotifyResolved()) */
+    gpointer notify_data;
 };
 
+/** Only the hub creates this, see _LSTransportCredResolveInit() */
+static GThreadPool *cred_resolve_pool = NULL;
+
 /** 
  *******************************************************************************
  * @brief Allocate a new credentials object.
@@ -66,19 +93,38 @@ _LSTransportCredNew(void)
 
     if (ret)
     {
+        ret->ref = 1;
         ret->pid = LS_PID_INVALID;
         ret->uid = LS_UID_INVALID;
         ret->gid = LS_GID_INVALID;
         ret->exe_path = NULL;
         ret->cmd_line = NULL;
+        pthread_mutex_init(&ret->lock, NULL);
+        pthread_cond_init(&ret->cond, NULL);
+        ret->state = _LSTransportCredStateResolved;
+        ret->notify_context = NULL;
+        ret->notify_callback = NULL;
+        ret->notify_data = NULL;
     }
 
     return ret;
 }
 
+static void
+_LSTransportCredRef(_LSTransportCred *cred)
+{
+    LS_ASSERT(cred != NULL);
+    LS_ASSERT(g_atomic_int_get(&cred->ref) > 0);
+
+    g_atomic_int_inc(&cred->ref);
+}
+
 /** 
  *******************************************************************************
  * @brief Free a credentials object.
+ *
+ * The memory isn't actually released until a pending background resolve
+ * (see @ref _LSTransportGetCredentials) is also done with it.
  * 
  * @param  cred     IN  credentials
  *******************************************************************************
@@ -87,8 +133,17 @@ void
 _LSTransportCredFree(_LSTransportCred *cred)
 {
     LS_ASSERT(cred != NULL);
+    LS_ASSERT(g_atomic_int_get(&cred->ref) > 0);
+
+    if (!g_atomic_int_dec_and_test(&cred->ref))
+    {
+        return;
+    }
+
     g_free((char*)cred->exe_path);
     g_free((char*)cred->cmd_line);
+    pthread_mutex_destroy(&cred->lock);
+    pthread_cond_destroy(&cred->cond);
 
 #ifdef MEMCHECK
     memset(cred, 0xFF, sizeof(_LSTransportCred));
@@ -162,6 +217,7 @@ inline const char*
 _LSTransportCredGetExePath(const _LSTransportCred *cred)
 {
     LS_ASSERT(cred != NULL);
+    _LSTransportCredWaitResolved((_LSTransportCred*)cred);
     return cred->exe_path;
 }
 
@@ -179,6 +235,7 @@ inline const char*
 _LSTransportCredGetCmdLine(const _LSTransportCred *cred)
 {
     LS_ASSERT(cred != NULL);
+    _LSTransportCredWaitResolved((_LSTransportCred*)cred);
     return cred->cmd_line;
 }
 
@@ -308,6 +365,215 @@ cleanup:
     return cmd_line;
 }
 
+/** 
+ *******************************************************************************
+ * @brief Read the exe path and cmdline for the credentials out of /proc
+ * and mark them resolved.
+ *
+ * @attention caller must have moved the state to resolving
+ * 
+ * @param  cred     IN/OUT  credentials 
+ *******************************************************************************
+ */
+static void
+_LSTransportCredResolve(_LSTransportCred *cred)
+{
+    LSError lserror;
+    LSErrorInit(&lserror);
+
+    char *exe_path = _LSTransportPidToExe(cred->pid, &lserror);
+    char *cmd_line = NULL;
+
+    if (exe_path)
+    {
+        cmd_line = _LSTransportPidToCmdLine(cred->pid, &lserror);
+
+        if (!cmd_line)
+        {
+            g_free(exe_path);
+            exe_path = NULL;
+        }
+    }
+
+    if (!exe_path)
+    {
+        LSErrorPrint(&lserror, stderr);
+        LSErrorFree(&lserror);
+    }
+
+    pthread_mutex_lock(&cred->lock);
+    LS_ASSERT(cred->state == _LSTransportCredStateResolving);
+    cred->exe_path = exe_path;
+    cred->cmd_line = cmd_line;
+    cred->state = _LSTransportCredStateResolved;
+    pthread_cond_broadcast(&cred->cond);
+
+    GSourceFunc notify_callback = cred->notify_callback;
+    GMainContext *notify_context = cred->notify_context;
+    gpointer notify_data = cred->notify_data;
+
+    cred->notify_callback = NULL;
+    cred->notify_context = NULL;
+    cred->notify_data = NULL;
+    pthread_mutex_unlock(&cred->lock);
+
+    if (notify_callback)
+    {
+        GSource *source = g_idle_source_new();
+        g_source_set_callback(source, notify_callback, notify_data, NULL);
+        g_source_attach(source, notify_context);
+        g_source_unref(source);
+    }
+}
+
+/** 
+ *******************************************************************************
+ * @brief Make sure the exe path and cmdline have been resolved. If the
+ * background resolve hasn't started yet we do it ourselves instead of
+ * waiting in line behind other clients.
+ * 
+ * @param  cred     IN/OUT  credentials 
+ *******************************************************************************
+ */
+void
+_LSTransportCredWaitResolved(_LSTransportCred *cred)
+{
+    pthread_mutex_lock(&cred->lock);
+
+    if (cred->state == _LSTransportCredStateQueued)
+    {
+        cred->state = _LSTransportCredStateResolving;
+        pthread_mutex_unlock(&cred->lock);
+        _LSTransportCredResolve(cred);
+        return;
+    }
+
+    while (cred->state != _LSTransportCredStateResolved)
+    {
+        pthread_cond_wait(&cred->cond, &cred->lock);
+    }
+
+    pthread_mutex_unlock(&cred->lock);
+}
+
+/* GThreadPool worker */
+static void
+_LSTransportCredResolveWorker(gpointer data, gpointer user_data)
+{
+    _LSTransportCred *cred = data;
+
+    pthread_mutex_lock(&cred->lock);
+    bool resolve = (cred->state == _LSTransportCredStateQueued);
+    if (resolve)
+    {
+        cred->state = _LSTransportCredStateResolving;
+    }
+    pthread_mutex_unlock(&cred->lock);
+
+    if (resolve)
+    {
+        _LSTransportCredResolve(cred);
+    }
+
+    /* drop the ref taken when queued */
+    _LSTransportCredFree(cred);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Check whether the exe path and cmdline have been resolved, i.e.,
+ * whether getting them would not block.
+ * 
+ * @param  cred     IN  credentials 
+ * 
+ * @retval  true if resolved
+ * @retval  false otherwise
+ *******************************************************************************
+ */
+bool
+_LSTransportCredIsResolved(_LSTransportCred *cred)
+{
+    LS_ASSERT(cred != NULL);
+
+    pthread_mutex_lock(&cred->lock);
+    bool ret = (cred->state == _LSTransportCredStateResolved);
+    pthread_mutex_unlock(&cred->lock);
+
+    return ret;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Ask for a callback once the exe path and cmdline are resolved,
+ * so that a caller can hold off work that needs them instead of blocking
+ * in @ref _LSTransportCredGetExePath or @ref _LSTransportCredGetCmdLine.
+ *
+ * Only one callback can be pending per credentials object.
+ * 
+ * @param  cred         IN  credentials 
+ * @param  context      IN  context to run callback in (NULL for default)
+ * @param  callback     IN  idle callback
+ * @param  data         IN  data to pass to callback
+ * 
+ * @retval  true if callback will be called
+ * @retval  false if already resolved (callback won't be called)
+ *******************************************************************************
+ */
+bool
+_LSTransportCredNotifyResolved(_LSTransportCred *cred, GMainContext *context, GSourceFunc callback, gpointer data)
+{
+    LS_ASSERT(cred != NULL);
+    LS_ASSERT(callback != NULL);
+
+    bool ret = false;
+
+    pthread_mutex_lock(&cred->lock);
+
+    if (cred->state != _LSTransportCredStateResolved)
+    {
+        LS_ASSERT(cred->notify_callback == NULL);
+        cred->notify_context = context;
+        cred->notify_callback = callback;
+        cred->notify_data = data;
+        ret = true;
+    }
+
+    pthread_mutex_unlock(&cred->lock);
+
+    return ret;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Start the threads that read credentials out of /proc. Only the hub
+ * calls this; without it the exe path and cmdline are read when the
+ * connection's credentials are.
+ * 
+ * @param  lserror  OUT set on error 
+ * 
+ * @retval  true on success
+ * @retval  false on failure
+ *******************************************************************************
+ */
+bool
+_LSTransportCredResolveInit(LSError *lserror)
+{
+    GError *error = NULL;
+
+    LS_ASSERT(cred_resolve_pool == NULL);
+
+    cred_resolve_pool = g_thread_pool_new(_LSTransportCredResolveWorker, NULL,
+                                          LS_TRANSPORT_CRED_RESOLVE_THREADS, FALSE, &error);
+    if (!cred_resolve_pool)
+    {
+        _LSErrorSet(lserror, -1, "Unable to create credential threads: %s", error ? error->message : "unknown");
+        if (error) g_error_free(error);
+        return false;
+    }
+
+    return true;
+}
+
 /** 
  *******************************************************************************
  * @brief Get the credentials from a unix domain socket.
@@ -345,20 +611,22 @@ _LSTransportGetCredentials(int fd, _LSTransportCred *cred, LSError *lserror)
     {
         if (tmp_cred.pid != LS_PID_INVALID)
         {
-            cred->exe_path = _LSTransportPidToExe(tmp_cred.pid, lserror);
-
-            if (!cred->exe_path)
+            /* The pid, uid, and gid above are all that's needed to accept
+             * the connection; the exe path and cmdline are read in the
+             * background (or by the first caller that needs them) so that
+             * a burst of connections doesn't stall the mainloop on /proc.
+             * Failures are reported when they're resolved and leave them
+             * NULL */
+            if (cred_resolve_pool)
             {
-                return false;
+                cred->state = _LSTransportCredStateQueued;
+                _LSTransportCredRef(cred);
+                g_thread_pool_push(cred_resolve_pool, cred, NULL);
             }
-
-            cred->cmd_line = _LSTransportPidToCmdLine(tmp_cred.pid, lserror);
-
-            if (!cred->cmd_line)
+            else
             {
-                g_free((char*)cred->exe_path);
-                cred->exe_path = NULL;
-                return false;
+                cred->state = _LSTransportCredStateResolving;
+                _LSTransportCredResolve(cred);
             }
         }
     }
@@ -20,6 +20,7 @@
 #define _TRANSPORT_SECURITY_H_
 
 #include <stdbool.h>
+#include <glib.h>
 #include "error.h"
 
 #define LS_PID_INVALID      -1
@@ -47,4 +48,9 @@ gid_t _LSTransportCredGetGid(const _LSTransportCred *cred);
 const char* _LSTransportCredGetExePath(const _LSTransportCred *cred);
 const char* _LSTransportCredGetCmdLine(const _LSTransportCred *cred);
 
+bool _LSTransportCredResolveInit(LSError *lserror);
+void _LSTransportCredWaitResolved(_LSTransportCred *cred);
+bool _LSTransportCredIsResolved(_LSTransportCred *cred);
+bool _LSTransportCredNotifyResolved(_LSTransportCred *cred, GMainContext *context, GSourceFunc callback, gpointer data);
+
 #endif  /* _TRANSPORT_SECURITY_H_ */
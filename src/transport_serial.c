@@ -36,158 +36,268 @@
  * @{
  */
 
+#define SERIAL_RING_INITIAL_CAPACITY    16
+
+#define SERIAL_RING_SLOT(serial_info, i)    \
+    (&(serial_info)->slots[((serial_info)->head + (i)) & ((serial_info)->capacity - 1)])
+
 /** 
  *******************************************************************************
- * @brief Allocate a new serial map entry.
- * 
- * @param  serial       IN  serial 
- * @param  list_item    IN  pointer to item in list 
+ * @brief Allocate a new transport serial.
  * 
- * @retval  entry on success
+ * @retval  transport serial on success
  * @retval  NULL on failure
  *******************************************************************************
  */
-_LSTransportSerialMapEntry*
-_LSTransportSerialMapEntryNew(LSMessageToken serial, GList *list_item)
+_LSTransportSerial*
+_LSTransportSerialNew(void)
 {
-    _LSTransportSerialMapEntry* entry = g_slice_new0(_LSTransportSerialMapEntry);
-    if (entry)
+    _LSTransportSerial *serial_info = g_slice_new0(_LSTransportSerial);
+
+    if (serial_info)
     {
-        entry->serial = serial;
-        entry->serial_list_item = list_item;
+        /* the ring is allocated by the first save, since most
+         * connections never make a method call */
+        pthread_mutex_init(&serial_info->lock, NULL);
     }
-    return entry;
+    return serial_info; 
 }
 
 /** 
  *******************************************************************************
- * @brief Free a serial map entry.
+ * @brief Free transport serial info
  * 
- * @param  entry    IN  entry 
+ * @param  serial_info  IN  serial info 
  *******************************************************************************
  */
 void
-_LSTransportSerialMapEntryFree(_LSTransportSerialMapEntry *entry)
+_LSTransportSerialFree(_LSTransportSerial *serial_info)
 {
-    LS_ASSERT(entry != NULL);
+    LS_ASSERT(serial_info != NULL);
+
+    SERIAL_INFO_LOCK(&serial_info->lock);
+
+    unsigned int i;
+    for (i = 0; i < serial_info->len; i++)
+    {
+        _LSTransportSerialSlot *slot = SERIAL_RING_SLOT(serial_info, i);
+        if (slot->message)
+        {
+            _LSTransportMessageUnref(slot->message);
+        }
+    }
+
+    g_free(serial_info->slots);
+
+    SERIAL_INFO_UNLOCK(&serial_info->lock);
 
 #ifdef MEMCHECK
-    memset(entry, 0xFF, sizeof(_LSTransportSerialMapEntry));
+    memset(serial_info, 0xFF, sizeof(_LSTransportSerial));
 #endif
 
-    g_slice_free(_LSTransportSerialMapEntry, entry);
+    g_slice_free(_LSTransportSerial, serial_info);
 }
 
 /** 
  *******************************************************************************
- * @brief Allocate a new serial list item.
- * 
- * @param  serial   IN  serial (token) 
- * 
- * @retval  item on success
- * @retval  NULL on failure
+ * @brief Drop tombstones from both ends of the window so that the head
+ * and tail slots are always live.
+ *
+ * @attention caller must hold the serial info lock
+ *
+ * @param  serial_info  IN  serial info 
  *******************************************************************************
  */
-_LSTransportSerialListItem*
-_LSTransportSerialListItemNew(LSMessageToken serial, _LSTransportMessage *message)
+static void
+_LSTransportSerialTrim(_LSTransportSerial *serial_info)
 {
-    _LSTransportSerialListItem *item = g_slice_new0(_LSTransportSerialListItem);
+    while (serial_info->len > 0 && SERIAL_RING_SLOT(serial_info, 0)->message == NULL)
+    {
+        serial_info->head = (serial_info->head + 1) & (serial_info->capacity - 1);
+        serial_info->len--;
+    }
 
-    if (item)
+    while (serial_info->len > 0 && SERIAL_RING_SLOT(serial_info, serial_info->len - 1)->message == NULL)
     {
-        item->serial = serial;
-        _LSTransportMessageRef(message);
-        item->message = message;
+        serial_info->len--;
+    }
+
+    if (serial_info->len == 0)
+    {
+        serial_info->head = 0;
     }
-    return item;
 }
 
 /** 
  *******************************************************************************
- * @brief Free a serial list item.
+ * @brief Make room for one more slot at the tail of the window, compacting
+ * away tombstones in place if there are enough of them and growing the
+ * ring otherwise.
+ *
+ * @attention caller must hold the serial info lock
+ *
+ * @param  serial_info  IN  serial info 
  * 
- * @param  list_item    IN serial list item to free 
+ * @retval  true on success
+ * @retval  false on failure
  *******************************************************************************
  */
-void
-_LSTransportSerialListItemFree(_LSTransportSerialListItem *list_item)
+static bool
+_LSTransportSerialReserve(_LSTransportSerial *serial_info)
 {
-    LS_ASSERT(list_item != NULL);
+    if (serial_info->len < serial_info->capacity)
+    {
+        return true;
+    }
 
-    _LSTransportMessageUnref(list_item->message);
+    unsigned int new_capacity = serial_info->capacity;
 
-#ifdef MEMCHECK
-    memset(list_item, 0xFF, sizeof(_LSTransportSerialListItem));
-#endif
+    if (new_capacity == 0)
+    {
+        new_capacity = SERIAL_RING_INITIAL_CAPACITY;
+    }
+    else if (serial_info->live > serial_info->capacity / 2)
+    {
+        new_capacity = serial_info->capacity * 2;
+    }
 
-    g_slice_free(_LSTransportSerialListItem, list_item);
+    unsigned int i;
+    unsigned int live = 0;
+
+    if (new_capacity == serial_info->capacity)
+    {
+        /* enough tombstones: slide the live slots down over them, in
+         * place (a slot only ever moves to a lower position) */
+        for (i = 0; i < serial_info->len; i++)
+        {
+            _LSTransportSerialSlot *slot = SERIAL_RING_SLOT(serial_info, i);
+            if (slot->message)
+            {
+                *SERIAL_RING_SLOT(serial_info, live) = *slot;
+                live++;
+            }
+        }
+
+        LS_ASSERT(live == serial_info->live);
+
+        serial_info->len = live;
+
+        return true;
+    }
+
+    _LSTransportSerialSlot *slots = g_try_new(_LSTransportSerialSlot, new_capacity);
+    if (!slots)
+    {
+        return false;
+    }
+
+    /* copy the live slots to the start of the new ring, in order */
+    for (i = 0; i < serial_info->len; i++)
+    {
+        _LSTransportSerialSlot *slot = SERIAL_RING_SLOT(serial_info, i);
+        if (slot->message)
+        {
+            slots[live++] = *slot;
+        }
+    }
+
+    LS_ASSERT(live == serial_info->live);
+
+    g_free(serial_info->slots);
+    serial_info->slots = slots;
+    serial_info->capacity = new_capacity;
+    serial_info->head = 0;
+    serial_info->len = live;
+
+    return true;
 }
 
 /** 
  *******************************************************************************
- * @brief Allocate a new transport serial.
+ * @brief Find the window position of a serial.
+ *
+ * @attention caller must hold the serial info lock
+ *
+ * @param  serial_info  IN  serial info 
+ * @param  serial       IN  serial (token) to find
+ * @param  pos          OUT position of the first slot with a serial greater
+ *                          than or equal to @serial
  * 
- * @retval  transport serial on success
- * @retval  NULL on failure
+ * @retval  true if a slot with @serial exists (it may be a tombstone)
+ * @retval  false otherwise
  *******************************************************************************
  */
-_LSTransportSerial*
-_LSTransportSerialNew(void)
+static bool
+_LSTransportSerialFind(_LSTransportSerial *serial_info, LSMessageToken serial, unsigned int *pos)
 {
-    _LSTransportSerial *serial_info = g_slice_new0(_LSTransportSerial);
+    unsigned int lo = 0;
+    unsigned int hi = serial_info->len;
 
-    if (serial_info)
+    /* replies usually come back in order, so check the head first */
+    if (hi > 0 && SERIAL_RING_SLOT(serial_info, 0)->serial >= serial)
     {
-        pthread_mutex_init(&serial_info->lock, NULL);
-        serial_info->queue = g_queue_new();
+        *pos = 0;
+        return SERIAL_RING_SLOT(serial_info, 0)->serial == serial;
+    }
 
-        /* TODO: make custom 64-bit int hash function since we may need to 
-         * increase the size of LSMessageToken */
-        serial_info->map = g_hash_table_new_full(g_int_hash, g_int_equal, NULL, (GDestroyNotify)_LSTransportSerialMapEntryFree);
+    if (hi > 0 && SERIAL_RING_SLOT(serial_info, hi - 1)->serial < serial)
+    {
+        *pos = hi;
+        return false;
     }
-    return serial_info; 
+
+    while (lo < hi)
+    {
+        unsigned int mid = lo + (hi - lo) / 2;
+
+        if (SERIAL_RING_SLOT(serial_info, mid)->serial < serial)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    *pos = lo;
+    return lo < serial_info->len && SERIAL_RING_SLOT(serial_info, lo)->serial == serial;
 }
 
 /** 
  *******************************************************************************
- * @brief Free transport serial info
+ * @brief Free the ring if there are no outstanding method calls in it. It
+ * is allocated again by the next save.
  * 
+ * @attention locks the serial lock
+ *
  * @param  serial_info  IN  serial info 
  *******************************************************************************
  */
 void
-_LSTransportSerialFree(_LSTransportSerial *serial_info)
+_LSTransportSerialReleaseIdle(_LSTransportSerial *serial_info)
 {
-    LS_ASSERT(serial_info != NULL);
-
     SERIAL_INFO_LOCK(&serial_info->lock);
-   
-    while (!g_queue_is_empty(serial_info->queue))
+
+    if (serial_info->len == 0 && serial_info->slots)
     {
-         _LSTransportSerialListItem *item = g_queue_pop_head(serial_info->queue);
-        _LSTransportSerialListItemFree(item);
+        g_free(serial_info->slots);
+        serial_info->slots = NULL;
+        serial_info->capacity = 0;
+        serial_info->head = 0;
     }
 
-    g_queue_free(serial_info->queue);
-    g_hash_table_destroy(serial_info->map); /* key and value destroy functions clean this up */
-    
     SERIAL_INFO_UNLOCK(&serial_info->lock);
-
-#ifdef MEMCHECK
-    memset(serial_info, 0xFF, sizeof(_LSTransportSerial));
-#endif
-
-    g_slice_free(_LSTransportSerial, serial_info);
 }
 
 /** 
  *******************************************************************************
- * @brief Save a serial (token) in the queue and map.
+ * @brief Save a serial (token) in the serial window.
  * 
  * @attention locks the serial lock
  *
  * @param  serial_info  IN  serial info 
- * @param  serial       IN  message serial (token) to save 
+ * @param  message      IN  method call message to save (ref'd) 
  * @param  lserror      OUT set on error 
  * 
  * @retval  true on success
@@ -198,47 +308,60 @@ bool
 _LSTransportSerialSave(_LSTransportSerial *serial_info, _LSTransportMessage *message, LSError *lserror)
 {
     LSMessageToken serial = _LSTransportMessageGetToken(message);
-    _LSTransportSerialListItem *item = _LSTransportSerialListItemNew(serial, message);
-    if (!item)
-    {
-        _LSErrorSet(lserror, -ENOMEM, "OOM");
-        goto error;
-    }
 
     SERIAL_INFO_LOCK(&serial_info->lock);
 
-    g_queue_push_tail(serial_info->queue, item);
-    GList *list = g_queue_peek_tail_link(serial_info->queue);
+    if (!_LSTransportSerialReserve(serial_info))
+    {
+        SERIAL_INFO_UNLOCK(&serial_info->lock);
+        _LSErrorSet(lserror, -ENOMEM, "OOM");
+        return false;
+    }
 
-    LS_ASSERT(list != NULL);
+    unsigned int pos = serial_info->len;
 
-    _LSTransportSerialMapEntry *map_entry = _LSTransportSerialMapEntryNew(serial, list);
-    if (!map_entry)
+    /* The serial is saved after the message is sent, so two threads
+     * sending on the same connection can save slightly out of order. Shift
+     * the few newer slots up to keep the window sorted. */
+    if (pos > 0 && SERIAL_RING_SLOT(serial_info, pos - 1)->serial >= serial)
     {
-        _LSErrorSet(lserror, -ENOMEM, "OOM");
-        SERIAL_INFO_UNLOCK(&serial_info->lock);
-        goto error;
+        bool found = _LSTransportSerialFind(serial_info, serial, &pos);
+
+        if (found)
+        {
+            /* same serial saved again after being removed; reuse the tombstone */
+            LS_ASSERT(SERIAL_RING_SLOT(serial_info, pos)->message == NULL);
+        }
+        else
+        {
+            unsigned int i;
+            for (i = serial_info->len; i > pos; i--)
+            {
+                *SERIAL_RING_SLOT(serial_info, i) = *SERIAL_RING_SLOT(serial_info, i - 1);
+            }
+            serial_info->len++;
+        }
     }
+    else
+    {
+        serial_info->len++;
+    }
+
+    _LSTransportSerialSlot *slot = SERIAL_RING_SLOT(serial_info, pos);
+    slot->serial = serial;
+    _LSTransportMessageRef(message);
+    slot->message = message;
 
-    LS_ASSERT(NULL == g_hash_table_lookup(serial_info->map, &map_entry->serial));
+    serial_info->live++;
 
-    g_hash_table_insert(serial_info->map, &map_entry->serial, map_entry);
-    
     SERIAL_INFO_UNLOCK(&serial_info->lock);
 
     return true;
-
-error:
-    if (item)
-    {
-        _LSTransportSerialListItemFree(item);
-    }
-    return false;
 }
 
 /** 
  *******************************************************************************
- * @brief Remove a serial (token) from the queue and map.
+ * @brief Remove a serial (token) from the serial window.
  *
  * @attention locks the serial info lock
  *
@@ -249,16 +372,21 @@ error:
 void
 _LSTransportSerialRemove(_LSTransportSerial *serial_info, LSMessageToken serial)
 {
-    SERIAL_INFO_LOCK(&serial_info->lock);
+    unsigned int pos;
 
-    _LSTransportSerialMapEntry *map_entry = g_hash_table_lookup(serial_info->map, &serial);
+    SERIAL_INFO_LOCK(&serial_info->lock);
 
-    if (map_entry)
+    if (_LSTransportSerialFind(serial_info, serial, &pos))
     {
-        _LSTransportSerialListItem *item = (_LSTransportSerialListItem*)map_entry->serial_list_item->data;
-        g_queue_delete_link(serial_info->queue, map_entry->serial_list_item);
-        _LSTransportSerialListItemFree(item);
-        g_hash_table_remove(serial_info->map, &serial);
+        _LSTransportSerialSlot *slot = SERIAL_RING_SLOT(serial_info, pos);
+
+        if (slot->message)
+        {
+            _LSTransportMessageUnref(slot->message);
+            slot->message = NULL;
+            serial_info->live--;
+            _LSTransportSerialTrim(serial_info);
+        }
     }
 
     SERIAL_INFO_UNLOCK(&serial_info->lock);
@@ -266,29 +394,62 @@ _LSTransportSerialRemove(_LSTransportSerial *serial_info, LSMessageToken serial)
 
 /** 
  *******************************************************************************
- * @brief Pops a message from the serial queue and removes it from the serial map.
+ * @brief Check whether a serial (token) is still outstanding.
  *
  * @attention locks the serial info lock
  *
  * @param  serial_info  IN  serial info 
+ * @param  serial       IN  serial (token) 
  *
- * @retval message on success
- * @retval NULL on empty serial queue
+ * @retval true if the serial is in the window
+ * @retval false otherwise
+ *******************************************************************************
+ */
+bool
+_LSTransportSerialContains(_LSTransportSerial *serial_info, LSMessageToken serial)
+{
+    unsigned int pos;
+    bool ret;
+
+    SERIAL_INFO_LOCK(&serial_info->lock);
+
+    ret = _LSTransportSerialFind(serial_info, serial, &pos) &&
+          SERIAL_RING_SLOT(serial_info, pos)->message != NULL;
+
+    SERIAL_INFO_UNLOCK(&serial_info->lock);
+
+    return ret;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Get the method call saved for a serial (token).
+ *
+ * @attention locks the serial info lock
+ *
+ * @param  serial_info  IN  serial info 
+ * @param  serial       IN  serial (token) 
+ *
+ * @retval message (ref'd; caller must unref) if the serial is in the window
+ * @retval NULL otherwise
  *******************************************************************************
  */
 _LSTransportMessage*
-_LSTransportSerialPopHead(_LSTransportSerial *serial_info)
+_LSTransportSerialLookupRef(_LSTransportSerial *serial_info, LSMessageToken serial)
 {
+    unsigned int pos;
     _LSTransportMessage *message = NULL;
+
     SERIAL_INFO_LOCK(&serial_info->lock);
 
-    _LSTransportSerialListItem *item = g_queue_pop_head(serial_info->queue);
-    if (item)
+    if (_LSTransportSerialFind(serial_info, serial, &pos))
     {
-        message = item->message;
-        _LSTransportMessageRef(message);
-        g_hash_table_remove(serial_info->map, &item->serial);
-        _LSTransportSerialListItemFree(item);
+        message = SERIAL_RING_SLOT(serial_info, pos)->message;
+
+        if (message)
+        {
+            _LSTransportMessageRef(message);
+        }
     }
 
     SERIAL_INFO_UNLOCK(&serial_info->lock);
@@ -296,4 +457,122 @@ _LSTransportSerialPopHead(_LSTransportSerial *serial_info)
     return message;
 }
 
+/** 
+ *******************************************************************************
+ * @brief Get the oldest outstanding serial (token).
+ *
+ * @attention locks the serial info lock
+ *
+ * @param  serial_info  IN  serial info 
+ *
+ * @retval serial on success
+ * @retval LSMESSAGE_TOKEN_INVALID if there are no outstanding serials
+ *******************************************************************************
+ */
+LSMessageToken
+_LSTransportSerialPeekHeadSerial(_LSTransportSerial *serial_info)
+{
+    LSMessageToken serial = LSMESSAGE_TOKEN_INVALID;
+
+    SERIAL_INFO_LOCK(&serial_info->lock);
+
+    if (serial_info->len > 0)
+    {
+        serial = SERIAL_RING_SLOT(serial_info, 0)->serial;
+    }
+
+    SERIAL_INFO_UNLOCK(&serial_info->lock);
+
+    return serial;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Pops the oldest message from the serial window without locking.
+ *
+ * @attention caller must hold the serial info lock
+ *
+ * @param  serial_info  IN  serial info 
+ *
+ * @retval message (caller owns the ref) on success
+ * @retval NULL on empty serial window
+ *******************************************************************************
+ */
+static _LSTransportMessage*
+_LSTransportSerialPopHeadCommon(_LSTransportSerial *serial_info, LSMessageToken *serial)
+{
+    if (serial_info->len == 0)
+    {
+        return NULL;
+    }
+
+    _LSTransportSerialSlot *slot = SERIAL_RING_SLOT(serial_info, 0);
+    _LSTransportMessage *message = slot->message;
+
+    LS_ASSERT(message != NULL);
+
+    if (serial)
+    {
+        *serial = slot->serial;
+    }
+
+    slot->message = NULL;
+    serial_info->live--;
+    _LSTransportSerialTrim(serial_info);
+
+    return message;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Pops a message from the serial window.
+ *
+ * @attention locks the serial info lock
+ *
+ * @param  serial_info  IN  serial info 
+ *
+ * @retval message on success
+ * @retval NULL on empty serial window
+ *******************************************************************************
+ */
+_LSTransportMessage*
+_LSTransportSerialPopHead(_LSTransportSerial *serial_info)
+{
+    SERIAL_INFO_LOCK(&serial_info->lock);
+
+    _LSTransportMessage *message = _LSTransportSerialPopHeadCommon(serial_info, NULL);
+
+    SERIAL_INFO_UNLOCK(&serial_info->lock);
+
+    return message;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Pops the oldest serial from the serial window and drops its
+ * message. Used to drain the window while holding the lock.
+ *
+ * @attention caller must hold the serial info lock
+ *
+ * @param  serial_info  IN  serial info 
+ * @param  serial       OUT popped serial
+ *
+ * @retval true on success
+ * @retval false on empty serial window
+ *******************************************************************************
+ */
+bool
+_LSTransportSerialPopHeadSerialLocked(_LSTransportSerial *serial_info, LSMessageToken *serial)
+{
+    _LSTransportMessage *message = _LSTransportSerialPopHeadCommon(serial_info, serial);
+
+    if (!message)
+    {
+        return false;
+    }
+
+    _LSTransportMessageUnref(message);
+    return true;
+}
+
 /* @} END OF LunaServiceTransportSerial */
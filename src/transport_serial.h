@@ -24,32 +24,33 @@
 #include <glib.h>
 #include <luna-service2/lunaservice.h>
 
-typedef struct LSTransportSerialMapEntry {
-    LSMessageToken serial;  /**< global serial */
-    GList *serial_list_item;
-} _LSTransportSerialMapEntry;
-
-typedef struct LSTransportSerialListItem {
-    LSMessageToken serial;  /**< global */
-    _LSTransportMessage *message;
-} _LSTransportSerialListItem;
+typedef struct LSTransportSerialSlot {
+    LSMessageToken serial;          /**< global */
+    _LSTransportMessage *message;   /**< NULL marks a tombstone */
+} _LSTransportSerialSlot;
 
 /**
  * In order to handle clean shutdown (i.e., making sure that we know which
  * method calls have been received and/or processed on the far end), we keep
- * a queue of @LSTransportSerialListItem that saves the serial number for
- * each method call that we make. In additon, we save a pointer to the
- * actual item on the queue as a @LSTransportSerialMapEntry in the @map,
- * which allows us to do a fast lookup and remove from the list when
- * receive a method call reply.
+ * a window of @LSTransportSerialSlot that saves the serial number for
+ * each method call that we make.
+ *
+ * Serials come from a per-transport counter, so the slots of a single
+ * connection are in increasing serial order, but not contiguous (other
+ * connections share the counter). The window is a ring buffer kept sorted
+ * by serial: saving appends at the tail, and a reply is found by checking
+ * the head and tail and then binary searching the ring. Removing a serial
+ * from the middle leaves a tombstone that is dropped once the head or tail
+ * reaches it, so the first and last slots in the window are always live.
+ * The ring only allocates when it runs out of room; tombstones are
+ * compacted away before growing. It isn't allocated until the first save
+ * and is freed again while a connection has no calls outstanding.
  *
  * When a client shuts down cleanly, it will send the serial number of the
- * last method call that it has processed. We then look up that serial
- * number in the map and get the pointer to the item on the queue that
- * represents that message. We know that every serial in the list beyond
- * this one has not been processed and can iterate over that list and call
- * a failure callback with the serial number of each message that didn't
- * get processed.
+ * last method call that it has processed. We know that every serial in the
+ * window beyond this one has not been processed and can iterate over the
+ * window and call a failure callback with the serial number of each
+ * message that didn't get processed.
  *
  * Example:
  * 3 Method calls on com.palm.foo:
@@ -63,24 +64,28 @@ typedef struct LSTransportSerialListItem {
  *
  * We then call the failure handler on serial 6.
  *
- * Note that we also remove serial numbers from the queue when we receive
+ * Note that we also remove serial numbers from the window when we receive
  * a reply, since that indicates that the far side has processed the
  * message as well.
  */
 typedef struct LSTransportSerial {
-    pthread_mutex_t lock;           /**< protects the queue and map */
-    GQueue *queue;                  /**< ordered linked list of serial #s */
-    GHashTable *map;                /**< map of serial number to ll item */
+    pthread_mutex_t lock;           /**< protects the ring */
+    _LSTransportSerialSlot *slots;  /**< ring buffer ordered by serial (NULL until first save) */
+    unsigned int capacity;          /**< number of slots (power of 2, or 0) */
+    unsigned int head;              /**< index of the oldest slot */
+    unsigned int len;               /**< slots in the window, incl. tombstones */
+    unsigned int live;              /**< slots in the window with a message */
 } _LSTransportSerial;
 
-_LSTransportSerialMapEntry* _LSTransportSerialMapEntryNew(LSMessageToken serial, GList *list_item);
-void _LSTransportSerialMapEntryFree(_LSTransportSerialMapEntry *entry);
-_LSTransportSerialListItem* _LSTransportSerialListItemNew(LSMessageToken serial, _LSTransportMessage *message);
-void _LSTransportSerialListItemFree(_LSTransportSerialListItem *list_item);
 _LSTransportSerial* _LSTransportSerialNew(void);
 void _LSTransportSerialFree(_LSTransportSerial *serial_info);
+void _LSTransportSerialReleaseIdle(_LSTransportSerial *serial_info);
 bool _LSTransportSerialSave(_LSTransportSerial *serial_info, _LSTransportMessage *message, LSError *lserror);
 void _LSTransportSerialRemove(_LSTransportSerial *serial_info, LSMessageToken serial);
+bool _LSTransportSerialContains(_LSTransportSerial *serial_info, LSMessageToken serial);
+_LSTransportMessage* _LSTransportSerialLookupRef(_LSTransportSerial *serial_info, LSMessageToken serial);
+LSMessageToken _LSTransportSerialPeekHeadSerial(_LSTransportSerial *serial_info);
 _LSTransportMessage *_LSTransportSerialPopHead(_LSTransportSerial *serial_info);
+bool _LSTransportSerialPopHeadSerialLocked(_LSTransportSerial *serial_info, LSMessageToken *serial);
 
 #endif      // _TRANSPORT_SERIAL_H_
@@ -0,0 +1,160 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2008-2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include <pthread.h>
+#include <string.h>
+
+#include "transport_shard.h"
+#include "transport_utils.h"
+
+/**
+ * @defgroup LunaServiceTransportShard
+ * @ingroup LunaServiceTransport
+ * @brief I/O threads for the connections of a transport
+ */
+
+/**
+ * @addtogroup LunaServiceTransportShard
+ * @{
+ */
+
+typedef struct _LSTransportShard {
+    GMainContext *context;
+    GMainLoop *loop;
+    pthread_t thread;
+    bool started;
+} _LSTransportShard;
+
+struct _LSTransportShards {
+    int count;
+    guint next;                 /**< next shard handed out (atomic) */
+    _LSTransportShard *shards;
+};
+
+static void*
+_LSTransportShardThread(void *data)
+{
+    _LSTransportShard *shard = data;
+
+    g_main_loop_run(shard->loop);
+
+    return NULL;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Start a set of I/O threads.
+ * 
+ * @param  count    IN  number of threads 
+ * @param  lserror  OUT set on error 
+ * 
+ * @retval  shards on success
+ * @retval  NULL on failure
+ *******************************************************************************
+ */
+_LSTransportShards*
+_LSTransportShardsNew(int count, LSError *lserror)
+{
+    int i;
+
+    LS_ASSERT(count > 0);
+
+    _LSTransportShards *shards = g_new0(_LSTransportShards, 1);
+
+    shards->count = count;
+    shards->shards = g_new0(_LSTransportShard, count);
+
+    for (i = 0; i < count; i++)
+    {
+        _LSTransportShard *shard = &shards->shards[i];
+
+        shard->context = g_main_context_new();
+        shard->loop = g_main_loop_new(shard->context, FALSE);
+
+        int ret = pthread_create(&shard->thread, NULL, _LSTransportShardThread, shard);
+
+        if (ret != 0)
+        {
+            _LSErrorSetFromErrno(lserror, ret);
+            _LSTransportShardsFree(shards);
+            return NULL;
+        }
+
+        shard->started = true;
+    }
+
+    return shards;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Stop the I/O threads and free them. Watches still attached to their
+ * contexts are never dispatched again.
+ * 
+ * @param  shards   IN  shards 
+ *******************************************************************************
+ */
+void
+_LSTransportShardsFree(_LSTransportShards *shards)
+{
+    int i;
+
+    LS_ASSERT(shards != NULL);
+
+    for (i = 0; i < shards->count; i++)
+    {
+        _LSTransportShard *shard = &shards->shards[i];
+
+        if (shard->started)
+        {
+            g_main_loop_quit(shard->loop);
+            g_main_context_wakeup(shard->context);
+            pthread_join(shard->thread, NULL);
+        }
+
+        if (shard->loop) g_main_loop_unref(shard->loop);
+        if (shard->context) g_main_context_unref(shard->context);
+    }
+
+    g_free(shards->shards);
+
+#ifdef MEMCHECK
+    memset(shards, 0xFF, sizeof(_LSTransportShards));
+#endif
+
+    g_free(shards);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Pick the context for a new connection (round-robin).
+ * 
+ * @param  shards   IN  shards 
+ * 
+ * @retval  context (owned by shards)
+ *******************************************************************************
+ */
+GMainContext*
+_LSTransportShardsNext(_LSTransportShards *shards)
+{
+    guint next = (guint)g_atomic_int_exchange_and_add((gint*)&shards->next, 1);
+
+    return shards->shards[next % shards->count].context;
+}
+
+/* @} END OF LunaServiceTransportShard */
@@ -0,0 +1,37 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2008-2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef _TRANSPORT_SHARD_H_
+#define _TRANSPORT_SHARD_H_
+
+#include <stdbool.h>
+#include <glib.h>
+#include "error.h"
+
+/**
+ * A set of I/O threads, each running its own main context, that the send
+ * and receive watches of a transport's accepted connections are spread
+ * over. A connection stays on the thread it was given for its lifetime.
+ */
+typedef struct _LSTransportShards _LSTransportShards;
+
+_LSTransportShards* _LSTransportShardsNew(int count, LSError *lserror);
+void _LSTransportShardsFree(_LSTransportShards *shards);
+GMainContext* _LSTransportShardsNext(_LSTransportShards *shards);
+
+#endif      // _TRANSPORT_SHARD_H_
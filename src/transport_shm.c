@@ -22,6 +22,8 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
 #include <errno.h>
 #include <pthread.h>
 #include <stdbool.h>
@@ -30,18 +32,30 @@
 
 #include "transport_shm.h"
 
-#define SHM_NAME_PUB    "/ls2.monitor.pub.shm"
-#define SHM_NAME_PRV    "/ls2.monitor.priv.shm"
+/* Older versions increment the serial in "/ls2.monitor.{pub,priv}.shm"
+ * under a process-shared mutex, which doesn't exclude our atomic adds; so
+ * the serial lives in a region of its own that only atomic adds touch */
+#define SHM_NAME_PUB    "/ls2.monitor.pub.2.shm"
+#define SHM_NAME_PRV    "/ls2.monitor.priv.2.shm"
 
 #define SHM_MODE      0666
 
+#define SHM_PAYLOAD_NAME_FORMAT     "/ls2.payload.%d.%u"    /**< pid, counter */
+#define SHM_PAYLOAD_MODE            0600
+
+/* Payload segments are sealed against modification when memfd sealing is
+ * available, which makes it safe for the receiver to map them */
+#if defined(MFD_ALLOW_SEALING) && defined(F_ADD_SEALS)
+#define SHM_PAYLOAD_USE_MEMFD
+#define SHM_PAYLOAD_SEALS   (F_SEAL_SEAL | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE)
+#endif
+
 #define FENCE_VAL       0xdeadbeef
 
 struct _LSTransportShmData
 {
     uint32_t front_fence;
-    pthread_mutex_t lock;
-    _LSTransportMonitorSerial serial;
+    _LSTransportMonitorSerial serial;   /**< only modified with atomic operations */
     uint32_t back_fence;
 };
 
@@ -158,13 +172,6 @@ _LSTransportShmInitOnce(bool public_bus, LSError *lserror)
 
     if (shm_needs_init)
     {
-        pthread_mutexattr_t attr;
-
-        /* mark mutex as being shared by multiple processes */
-        pthread_mutexattr_init(&attr);
-        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
-
-        pthread_mutex_init(&map->lock, &attr);
         map->serial = MONITOR_SERIAL_INVALID;
         map->front_fence = FENCE_VAL;
         map->back_fence = FENCE_VAL;
@@ -221,6 +228,20 @@ error:
     return false;
 }
 
+/** 
+ *******************************************************************************
+ * @brief Get the next global monitor serial.
+ *
+ * The serial is shared by every process on the bus, so it is incremented
+ * with an atomic fetch-and-add instead of taking a lock that all senders
+ * would contend on.
+ * 
+ * @param  shm  IN  shared memory
+ * 
+ * @retval  serial on success
+ * @retval  MONITOR_SERIAL_INVALID if the shared memory has been corrupted
+ *******************************************************************************
+ */
 _LSTransportMonitorSerial
 _LSTransportShmGetSerial(_LSTransportShm* shm)
 {
@@ -232,14 +253,13 @@ _LSTransportShmGetSerial(_LSTransportShm* shm)
     if (shm->data->front_fence == FENCE_VAL &&
         shm->data->back_fence == FENCE_VAL)
     {
-        pthread_mutex_lock(&shm->data->lock);
-        ret = ++shm->data->serial;
+        ret = __sync_add_and_fetch(&shm->data->serial, 1);
 
         if (unlikely(ret == MONITOR_SERIAL_INVALID))
         {
-            ret++;
+            /* wrapped around; skip the invalid value */
+            ret = __sync_add_and_fetch(&shm->data->serial, 1);
         }
-        pthread_mutex_unlock(&shm->data->lock);
     }
 
     return ret;
@@ -255,3 +275,185 @@ _LSTransportShmDeinit(_LSTransportShm** shm)
     g_free((*shm));
     *shm = NULL;
 }
+
+/** 
+ *******************************************************************************
+ * @brief Create an anonymous shared memory segment holding a copy of a
+ * payload, so that the payload can be passed to another process as an fd
+ * instead of being copied through the socket.
+ * 
+ * @param  payload          IN   payload (including the terminating nul)
+ * @param  payload_size     IN   size of payload in bytes
+ * @param  lserror          OUT  set on error
+ * 
+ * @retval  fd of segment on success
+ * @retval  -1 on failure
+ *******************************************************************************
+ */
+int
+_LSTransportShmPayloadNew(const char *payload, unsigned long payload_size, LSError *lserror)
+{
+    int fd = -1;
+    char *map = MAP_FAILED;
+
+#ifdef SHM_PAYLOAD_USE_MEMFD
+    fd = memfd_create("ls2.payload", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#else
+    static unsigned int counter = 0;
+    char shm_name[64];
+
+    snprintf(shm_name, sizeof(shm_name), SHM_PAYLOAD_NAME_FORMAT, (int)getpid(),
+             (unsigned int)g_atomic_int_exchange_and_add((gint*)&counter, 1));
+
+    fd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, SHM_PAYLOAD_MODE);
+
+    if (fd != -1)
+    {
+        /* only accessible through the fd from now on */
+        shm_unlink(shm_name);
+    }
+#endif
+
+    if (fd == -1)
+    {
+        _LSErrorSetFromErrno(lserror, errno);
+        return -1;
+    }
+
+    if (ftruncate(fd, payload_size) == -1)
+    {
+        _LSErrorSetFromErrno(lserror, errno);
+        goto error;
+    }
+
+    map = mmap(NULL, payload_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (map == MAP_FAILED)
+    {
+        _LSErrorSetFromErrno(lserror, errno);
+        goto error;
+    }
+
+    memcpy(map, payload, payload_size);
+    munmap(map, payload_size);
+
+#ifdef SHM_PAYLOAD_USE_MEMFD
+    if (fcntl(fd, F_ADD_SEALS, SHM_PAYLOAD_SEALS) == -1)
+    {
+        _LSErrorSetFromErrno(lserror, errno);
+        goto error;
+    }
+#endif
+
+    return fd;
+
+error:
+    close(fd);
+    return -1;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Get the payload from a segment created with @ref
+ * _LSTransportShmPayloadNew.
+ *
+ * The segment is mapped read-only if the sender sealed it. Otherwise, the
+ * sender could still change the size of the segment underneath us, so the
+ * payload is copied out instead.
+ * 
+ * @param  fd               IN   fd of segment (not closed by this function)
+ * @param  payload_size     OUT  size of payload
+ * @param  mapped           OUT  true if payload was mapped, false if copied
+ * @param  lserror          OUT  set on error
+ * 
+ * @retval  payload on success (release with @ref _LSTransportShmPayloadUnmap)
+ * @retval  NULL on failure
+ *******************************************************************************
+ */
+char*
+_LSTransportShmPayloadMap(int fd, unsigned long *payload_size, bool *mapped, LSError *lserror)
+{
+    struct stat st;
+    char *payload = NULL;
+    bool sealed = false;
+
+    if (fstat(fd, &st) == -1)
+    {
+        _LSErrorSetFromErrno(lserror, errno);
+        return NULL;
+    }
+
+    if (st.st_size <= 0)
+    {
+        _LSErrorSet(lserror, -1, "Invalid payload segment size: %ld", (long)st.st_size);
+        return NULL;
+    }
+
+#ifdef SHM_PAYLOAD_USE_MEMFD
+    int seals = fcntl(fd, F_GET_SEALS);
+    sealed = (seals != -1) && ((seals & SHM_PAYLOAD_SEALS) == SHM_PAYLOAD_SEALS);
+#endif
+
+    if (sealed)
+    {
+        payload = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+        if (payload == MAP_FAILED)
+        {
+            _LSErrorSetFromErrno(lserror, errno);
+            return NULL;
+        }
+    }
+    else
+    {
+        payload = g_malloc(st.st_size);
+
+        if (!payload)
+        {
+            _LSErrorSetOOM(lserror);
+            return NULL;
+        }
+
+        if (pread(fd, payload, st.st_size, 0) != st.st_size)
+        {
+            _LSErrorSetFromErrno(lserror, errno);
+            g_free(payload);
+            return NULL;
+        }
+    }
+
+    /* the payload is used as a string */
+    if (payload[st.st_size - 1] != '\0')
+    {
+        _LSErrorSet(lserror, -1, "Payload segment is not nul terminated");
+        _LSTransportShmPayloadUnmap(payload, st.st_size, sealed);
+        return NULL;
+    }
+
+    *payload_size = st.st_size;
+    *mapped = sealed;
+
+    return payload;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Release a payload returned by @ref _LSTransportShmPayloadMap.
+ * 
+ * @param  payload          IN  payload
+ * @param  payload_size     IN  size of payload
+ * @param  mapped           IN  true if payload was mapped
+ *******************************************************************************
+ */
+void
+_LSTransportShmPayloadUnmap(char *payload, unsigned long payload_size, bool mapped)
+{
+    if (mapped)
+    {
+        munmap(payload, payload_size);
+    }
+    else
+    {
+        g_free(payload);
+    }
+}
@@ -34,4 +34,8 @@ bool _LSTransportShmInit(_LSTransportShm** shm, bool public_bus, LSError* lserro
 uint64_t _LSTransportShmGetSerial(_LSTransportShm* shm);
 void _LSTransportShmDeinit(_LSTransportShm** shm);
 
+int _LSTransportShmPayloadNew(const char *payload, unsigned long payload_size, LSError *lserror);
+char* _LSTransportShmPayloadMap(int fd, unsigned long *payload_size, bool *mapped, LSError *lserror);
+void _LSTransportShmPayloadUnmap(char *payload, unsigned long payload_size, bool mapped);
+
 #endif  /* _TRANSPORT_SHM_H */
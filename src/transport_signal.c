@@ -35,11 +35,120 @@
  * @{
  */
 
+#define FNV_64_OFFSET_BASIS     14695981039346656037ULL
+#define FNV_64_PRIME            1099511628211ULL
+
+static guint64
+_LSTransportSignalHashString(guint64 hash, const char *str)
+{
+    const unsigned char *p;
+
+    for (p = (const unsigned char*)str; *p != '\0'; p++)
+    {
+        hash ^= *p;
+        hash *= FNV_64_PRIME;
+    }
+
+    return hash;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Add a signal registration to a digest of registrations. The digest
+ * doesn't depend on the order that registrations are added in, so the hub
+ * and a client can each build it from their own records and compare.
+ * 
+ * @param  digest       IN  digest so far (0 for no registrations)
+ * @param  category     IN  category
+ * @param  method       IN  method (NULL or "" for the whole category)
+ * @param  count        IN  number of times it is registered
+ * 
+ * @retval  digest including the registration
+ *******************************************************************************
+ */
+guint64
+_LSTransportSignalDigestAdd(guint64 digest, const char *category, const char *method, int count)
+{
+    guint64 hash = _LSTransportSignalHashString(FNV_64_OFFSET_BASIS, category);
+
+    hash = _LSTransportSignalHashString(hash, "\n");
+    hash = _LSTransportSignalHashString(hash, method ? method : "");
+
+    return digest + hash * (guint64)count;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Keep count of a registration sent to the hub, so that it can be
+ * made again with a restarted hub (see @ref _LSTransportSignalRegisterAgain).
+ * 
+ * @param  bus          IN  bus 
+ * @param  category     IN  category 
+ * @param  method       IN  method (optional, NULL means none) 
+ * @param  delta        IN  1 for a registration, -1 for an unregistration
+ *******************************************************************************
+ */
+static void
+_LSTransportSignalTrack(_LSTransportBus *bus, const char *category, const char *method, int delta)
+{
+    /* same key format as _LSTransportSignalDigestAdd hashes */
+    char *key = g_strconcat(category, "\n", method ? method : "", NULL);
+
+    TRANSPORT_LOCK(&bus->transport->lock);
+
+    int count = GPOINTER_TO_INT(g_hash_table_lookup(bus->signal_registrations, key)) + delta;
+
+    if (count > 0)
+    {
+        g_hash_table_replace(bus->signal_registrations, key, GINT_TO_POINTER(count));
+    }
+    else
+    {
+        g_hash_table_remove(bus->signal_registrations, key);
+        g_free(key);
+    }
+
+    TRANSPORT_UNLOCK(&bus->transport->lock);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Digest of the signals we have registered with the hub (see @ref
+ * _LSTransportSignalDigestAdd).
+ * 
+ * @param  bus          IN  bus 
+ * 
+ * @retval  digest
+ *******************************************************************************
+ */
+guint64
+_LSTransportSignalRegistrationsDigest(_LSTransportBus *bus)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+    guint64 digest = 0;
+
+    TRANSPORT_LOCK(&bus->transport->lock);
+
+    g_hash_table_iter_init(&iter, bus->signal_registrations);
+
+    while (g_hash_table_iter_next(&iter, &key, &value))
+    {
+        guint64 hash = _LSTransportSignalHashString(FNV_64_OFFSET_BASIS, key);
+
+        digest += hash * (guint64)GPOINTER_TO_INT(value);
+    }
+
+    TRANSPORT_UNLOCK(&bus->transport->lock);
+
+    return digest;
+}
+
 /** 
  *******************************************************************************
  * @brief Send a signal registration message.
  * 
- * @param  transport    IN  transport 
+ * @param  bus          IN  bus 
  * @param  reg          IN  true to register, false to unregister 
  * @param  category     IN  category (required) 
  * @param  method       IN  method (optional, NULL means none) 
@@ -51,7 +160,7 @@
  *******************************************************************************
  */
 bool
-_LSTransportSignalRegistration(_LSTransport *transport, bool reg, const char *category,
+_LSTransportSignalRegistration(_LSTransportBus *bus, bool reg, const char *category,
                                const char *method, LSMessageToken *token, LSError *lserror)
 {
     /* 
@@ -100,12 +209,16 @@ _LSTransportSignalRegistration(_LSTransport *transport, bool reg, const char *ca
         memcpy(message_body, method, method_len);
     }
 
-    LS_ASSERT(transport->hub != NULL);
+    LS_ASSERT(bus->hub != NULL);
 
-    if (!_LSTransportSendMessage(message, transport->hub, token, lserror))
+    if (!_LSTransportSendMessage(message, bus->hub, token, lserror))
     {
         ret = false;
     }
+    else
+    {
+        _LSTransportSignalTrack(bus, category, method, reg ? 1 : -1);
+    }
 
     _LSTransportMessageUnref(message);
 
@@ -117,7 +230,7 @@ _LSTransportSignalRegistration(_LSTransport *transport, bool reg, const char *ca
  * @brief Register a signal. It should only be called from users of the
  * transport (i.e., not from within this file).
  * 
- * @param  transport    IN  transport 
+ * @param  bus          IN  bus 
  * @param  category     IN  category 
  * @param  method       IN  method (optional, NULL means none) 
  * @param  token        OUT message token 
@@ -128,10 +241,209 @@ _LSTransportSignalRegistration(_LSTransport *transport, bool reg, const char *ca
  *******************************************************************************
  */
 bool
-LSTransportRegisterSignal(_LSTransport *transport, const char *category, const char *method,
+LSTransportRegisterSignal(_LSTransportBus *bus, const char *category, const char *method,
                            LSMessageToken *token, LSError *lserror)
 {
-    return _LSTransportSignalRegistration(transport, true, category, method, token, lserror);
+    return _LSTransportSignalRegistration(bus, true, category, method, token, lserror);
+}
+
+/** 
+ *******************************************************************************
+ * @brief Send one message registering several signals, without counting
+ * them as new registrations.
+ * 
+ * @param  bus          IN  bus 
+ * @param  categories   IN  categories (required) 
+ * @param  methods      IN  method for each category (optional, NULL or a
+ *                          NULL entry means none) 
+ * @param  count        IN  number of categories 
+ * @param  token        OUT message token 
+ * @param  lserror      OUT set on error 
+ * 
+ * @retval  true on success
+ * @retval  false on failure
+ *******************************************************************************
+ */
+static bool
+_LSTransportSignalRegisterMany(_LSTransportBus *bus, const char **categories, const char **methods,
+                               int count, LSMessageToken *token, LSError *lserror)
+{
+    /* 
+     * format:
+     *
+     * category + NUL
+     * method + NUL (if method is NULL, then we just have NUL)
+     *
+     * repeated for each registration
+     */
+    bool ret = true;
+    int i;
+    int body_len = 0;
+
+    LS_ASSERT(categories != NULL);
+
+    if (count <= 0)
+    {
+        _LSErrorSet(lserror, -EINVAL, "No signals to register");
+        return false;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        if (!categories[i])
+        {
+            _LSErrorSet(lserror, -EINVAL, "Invalid signal registration (no category)");
+            return false;
+        }
+
+        body_len += strlen(categories[i]) + 1;
+        body_len += strlen_safe(methods ? methods[i] : NULL) + 1;
+    }
+
+    _ls_verbose("%s: registering %d signals\n", __func__, count);
+
+    _LSTransportMessage *message = _LSTransportMessageNewRef(body_len);
+
+    if (!message)
+    {
+        _LSErrorSet(lserror, -ENOMEM, "OOM");
+        return false;
+    }
+
+    _LSTransportMessageSetType(message, _LSTransportMessageTypeSignalRegisterMany);
+
+    char *message_body = _LSTransportMessageGetBody(message);
+
+    LS_ASSERT(message_body != NULL);
+
+    for (i = 0; i < count; i++)
+    {
+        const char *method = methods ? methods[i] : NULL;
+        int category_len = strlen(categories[i]) + 1;
+        int method_len = strlen_safe(method) + 1;
+
+        memcpy(message_body, categories[i], category_len);
+        message_body += category_len;
+
+        if (method_len == 1)
+        {
+            *message_body = '\0';
+        }
+        else
+        {
+            memcpy(message_body, method, method_len);
+        }
+        message_body += method_len;
+    }
+
+    LS_ASSERT(bus->hub != NULL);
+
+    if (!_LSTransportSendMessage(message, bus->hub, token, lserror))
+    {
+        ret = false;
+    }
+
+    _LSTransportMessageUnref(message);
+
+    return ret;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Register several signals with a single message to the hub, which
+ * sends back a single reply. It should only be called from users of the
+ * transport (i.e., not from within this file).
+ *
+ * Each registration is undone separately with @ref
+ * LSTransportUnregisterSignal.
+ * 
+ * @param  bus          IN  bus 
+ * @param  categories   IN  categories (required) 
+ * @param  methods      IN  method for each category (optional, NULL or a
+ *                          NULL entry means none) 
+ * @param  count        IN  number of categories 
+ * @param  token        OUT message token 
+ * @param  lserror      OUT set on error 
+ * 
+ * @retval  true on success
+ * @retval  false on failure
+ *******************************************************************************
+ */
+bool
+LSTransportRegisterSignalMany(_LSTransportBus *bus, const char **categories, const char **methods,
+                              int count, LSMessageToken *token, LSError *lserror)
+{
+    if (!_LSTransportSignalRegisterMany(bus, categories, methods, count, token, lserror))
+    {
+        return false;
+    }
+
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        _LSTransportSignalTrack(bus, categories[i], methods ? methods[i] : NULL, 1);
+    }
+
+    return true;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Make all of our signal registrations again, with a single message,
+ * after connecting to a hub that doesn't have them (i.e., one that was
+ * restarted and couldn't restore them).
+ * 
+ * @param  bus          IN  bus 
+ * @param  lserror      OUT set on error 
+ * 
+ * @retval  true on success
+ * @retval  false on failure
+ *******************************************************************************
+ */
+bool
+_LSTransportSignalRegisterAgain(_LSTransportBus *bus, LSError *lserror)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+    GPtrArray *categories = g_ptr_array_new_with_free_func(g_free);
+    GPtrArray *methods = g_ptr_array_new_with_free_func(g_free);
+
+    TRANSPORT_LOCK(&bus->transport->lock);
+
+    g_hash_table_iter_init(&iter, bus->signal_registrations);
+
+    while (g_hash_table_iter_next(&iter, &key, &value))
+    {
+        const char *newline = strchr(key, '\n');
+        int count = GPOINTER_TO_INT(value);
+
+        LS_ASSERT(newline != NULL);
+
+        /* the hub keeps a count per registration, so each one is sent
+         * as many times as it was made */
+        while (count-- > 0)
+        {
+            g_ptr_array_add(categories, g_strndup(key, newline - (const char*)key));
+            g_ptr_array_add(methods, g_strdup(newline + 1));
+        }
+    }
+
+    TRANSPORT_UNLOCK(&bus->transport->lock);
+
+    bool ret = true;
+
+    if (categories->len > 0)
+    {
+        ret = _LSTransportSignalRegisterMany(bus, (const char**)categories->pdata,
+                                             (const char**)methods->pdata, categories->len,
+                                             NULL, lserror);
+    }
+
+    g_ptr_array_free(categories, TRUE);
+    g_ptr_array_free(methods, TRUE);
+
+    return ret;
 }
 
 /** 
@@ -139,7 +451,7 @@ LSTransportRegisterSignal(_LSTransport *transport, const char *category, const c
  * @brief Unregister a signal. It should only be called from users of the
  * transport (i.e., not from within this file).
  * 
- * @param  transport    IN  transport 
+ * @param  bus          IN  bus 
  * @param  category     IN  category 
  * @param  method       IN  method (optional, NULL means none) 
  * @param  token        OUT message token 
@@ -150,17 +462,17 @@ LSTransportRegisterSignal(_LSTransport *transport, const char *category, const c
  *******************************************************************************
  */
 bool
-LSTransportUnregisterSignal(_LSTransport *transport, const char *category, const char *method,
+LSTransportUnregisterSignal(_LSTransportBus *bus, const char *category, const char *method,
                            LSMessageToken *token, LSError *lserror)
 {
-    return _LSTransportSignalRegistration(transport, false, category, method, token, lserror);
+    return _LSTransportSignalRegistration(bus, false, category, method, token, lserror);
 }
 
 /** 
  *******************************************************************************
  * @brief Register for server status signals.
  * 
- * @param  transport        IN  transport 
+ * @param  bus              IN  bus 
  * @param  service_name     IN  service name 
  * @param  token            OUT message token 
  * @param  lserror          OUT set on error 
@@ -170,16 +482,16 @@ LSTransportUnregisterSignal(_LSTransport *transport, const char *category, const
  *******************************************************************************
  */
 bool
-LSTransportRegisterSignalServiceStatus(_LSTransport *transport, const char *service_name,  LSMessageToken *token, LSError *lserror)
+LSTransportRegisterSignalServiceStatus(_LSTransportBus *bus, const char *service_name,  LSMessageToken *token, LSError *lserror)
 {
-    return _LSTransportSignalRegistration(transport, true, SERVICE_STATUS_CATEGORY, service_name, token, lserror);
+    return _LSTransportSignalRegistration(bus, true, SERVICE_STATUS_CATEGORY, service_name, token, lserror);
 }
 
 /** 
  *******************************************************************************
  * @brief Unregister for server status signals.
  * 
- * @param  transport        IN  transport 
+ * @param  bus              IN  bus 
  * @param  service_name     IN  service name 
  * @param  token            OUT message token 
  * @param  lserror          OUT set on error 
@@ -189,9 +501,9 @@ LSTransportRegisterSignalServiceStatus(_LSTransport *transport, const char *serv
  *******************************************************************************
  */
 bool
-LSTransportUnregisterSignalServiceStatus(_LSTransport *transport, const char *service_name,  LSMessageToken *token, LSError *lserror)
+LSTransportUnregisterSignalServiceStatus(_LSTransportBus *bus, const char *service_name,  LSMessageToken *token, LSError *lserror)
 {
-    return _LSTransportSignalRegistration(transport, false, SERVICE_STATUS_CATEGORY, service_name, token, lserror);
+    return _LSTransportSignalRegistration(bus, false, SERVICE_STATUS_CATEGORY, service_name, token, lserror);
 }
 
 /** 
@@ -241,7 +553,7 @@ LSTransportMessageSignalNewRef(const char *category, const char *method, const c
  *******************************************************************************
  * @brief Send a signal.
  * 
- * @param  transport    IN  transport 
+ * @param  bus          IN  bus 
  * @param  category     IN  category 
  * @param  method       IN  method (optional, NULL means none) 
  * @param  payload      IN  payload 
@@ -252,7 +564,7 @@ LSTransportMessageSignalNewRef(const char *category, const char *method, const c
  *******************************************************************************
  */
 bool
-LSTransportSendSignal(_LSTransport *transport, const char *category, const char *method, const char *payload, LSError *lserror)
+LSTransportSendSignal(_LSTransportBus *bus, const char *category, const char *method, const char *payload, LSError *lserror)
 {
     bool ret = true;
 
@@ -264,9 +576,9 @@ LSTransportSendSignal(_LSTransport *transport, const char *category, const char
         return false;
     }
 
-    LS_ASSERT(transport->hub != NULL);
+    LS_ASSERT(bus->hub != NULL);
 
-    ret = _LSTransportSendMessage(message, transport->hub, NULL, lserror);
+    ret = _LSTransportSendMessage(message, bus->hub, NULL, lserror);
 
     _LSTransportMessageUnref(message);
 
@@ -29,13 +29,18 @@
 
 #define SERVICE_STATUS_SERVICE_NAME     "serviceName"
 
-bool LSTransportRegisterSignal(_LSTransport *transport, const char *category, const char *method, LSMessageToken *token, LSError *lserror);
-bool LSTransportUnregisterSignal(_LSTransport *transport, const char *category, const char *method, LSMessageToken *token, LSError *lserror);
-bool LSTransportSendSignal(_LSTransport *transport, const char *category, const char *method, const char *payload, LSError *lserror);
+bool LSTransportRegisterSignal(_LSTransportBus *bus, const char *category, const char *method, LSMessageToken *token, LSError *lserror);
+bool LSTransportRegisterSignalMany(_LSTransportBus *bus, const char **categories, const char **methods, int count, LSMessageToken *token, LSError *lserror);
+bool LSTransportUnregisterSignal(_LSTransportBus *bus, const char *category, const char *method, LSMessageToken *token, LSError *lserror);
+bool LSTransportSendSignal(_LSTransportBus *bus, const char *category, const char *method, const char *payload, LSError *lserror);
 ;
 
-bool LSTransportRegisterSignalServiceStatus(_LSTransport *transport, const char *service_name,  LSMessageToken *token, LSError *lserror);
-bool LSTransportUnregisterSignalServiceStatus(_LSTransport *transport, const char *service_name,  LSMessageToken *token, LSError *lserror);
+guint64 _LSTransportSignalDigestAdd(guint64 digest, const char *category, const char *method, int count);
+guint64 _LSTransportSignalRegistrationsDigest(_LSTransportBus *bus);
+bool _LSTransportSignalRegisterAgain(_LSTransportBus *bus, LSError *lserror);
+
+bool LSTransportRegisterSignalServiceStatus(_LSTransportBus *bus, const char *service_name,  LSMessageToken *token, LSError *lserror);
+bool LSTransportUnregisterSignalServiceStatus(_LSTransportBus *bus, const char *service_name,  LSMessageToken *token, LSError *lserror);
 
 char* LSTransportServiceStatusSignalGetServiceName(_LSTransportMessage *message);
 _LSTransportMessage* LSTransportMessageSignalNewRef(const char *category, const char *method, const char *payload);
@@ -27,19 +27,16 @@ int _ls_debug_tracing = 0;
 
 #ifdef COMPILE_VERBOSE_MESSAGES
 void
-_ls_verbose(const char *format, ...)
+_ls_verbose_print(const char *format, ...)
 {
     va_list vargs;
 
-    if (DEBUG_VERBOSE)/*(DEBUG_VERBOSE)*/
-    {
-        fprintf(stderr, "%lx: ", pthread_self());
-        va_start(vargs, format);
-        vfprintf(stderr, format, vargs);
-        va_end(vargs);
+    fprintf(stderr, "%lx: ", pthread_self());
+    va_start(vargs, format);
+    vfprintf(stderr, format, vargs);
+    va_end(vargs);
 
-        fflush(stderr);
-    } 
+    fflush(stderr);
 }
 #endif
 
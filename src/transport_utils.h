@@ -36,7 +36,17 @@ extern int _ls_debug_tracing;
 #define DEBUG_VERBOSE (_ls_debug_tracing > 1)
 
 #ifdef COMPILE_VERBOSE_MESSAGES
-void _ls_verbose(const char *format, ...) __attribute__((__format__ (__printf__, 1, 2)));
+void _ls_verbose_print(const char *format, ...) __attribute__((__format__ (__printf__, 1, 2)));
+
+/* check the level here so that the arguments aren't evaluated (and nothing
+ * is called) unless verbose messages are on */
+#define _ls_verbose(format...)                                          \
+do {                                                                    \
+    if (G_UNLIKELY(DEBUG_VERBOSE))                                      \
+    {                                                                   \
+        _ls_verbose_print(format);                                      \
+    }                                                                   \
+} while (0)
 #else
 #define _ls_verbose(format...)
 #endif
@@ -95,16 +105,6 @@ do {                                                        \
     UNLOCK("Serial Info", mutex);                           \
 } while (0)
 
-#define GLOBAL_TOKEN_LOCK(mutex)                            \
-do {                                                        \
-    LOCK("Global Token", mutex);                            \
-} while (0)
-
-#define GLOBAL_TOKEN_UNLOCK(mutex)                          \
-do {                                                        \
-    UNLOCK("Global Token", mutex);                          \
-} while (0)
-
 #define OUTGOING_LOCK(mutex)                                \
 do {                                                        \
     LOCK("Outgoing", mutex);                                \
@@ -125,6 +125,16 @@ do {                                                        \
     UNLOCK("Outgoing Serial", mutex);                       \
 } while (0)
 
+#define MESSAGE_POOL_LOCK(mutex)                            \
+do {                                                        \
+    LOCK("Message Pool", mutex);                            \
+} while (0)
+
+#define MESSAGE_POOL_UNLOCK(mutex)                          \
+do {                                                        \
+    UNLOCK("Message Pool", mutex);                          \
+} while (0)
+
 #define INCOMING_LOCK(mutex)                                \
 do {                                                        \
     LOCK("Incoming", mutex);                                \
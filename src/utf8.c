@@ -0,0 +1,335 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2008-2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define LS_UTF8_SSE2
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define LS_UTF8_NEON
+#endif
+
+#include "utf8.h"
+
+/**
+ * @defgroup LunaServiceUtf8
+ * @ingroup LunaServiceInternals
+ * @brief UTF-8 validation of payloads
+ */
+
+/**
+ * @addtogroup LunaServiceUtf8
+ * @{
+ */
+
+#define UTF8_BLOCK_SIZE         16          /**< bytes checked at a time */
+
+#define UTF8_BLOCK_NON_ASCII    (1 << 0)    /**< block has a byte >= 0x80 */
+#define UTF8_BLOCK_NUL          (1 << 1)    /**< block has a nul */
+
+/** 
+ *******************************************************************************
+ * @brief Check a block of @ref UTF8_BLOCK_SIZE bytes for anything other
+ * than (non-nul) ASCII, which is almost all of a JSON payload.
+ * 
+ * @param  p    IN  block (must be 16-byte aligned if it may run past the end
+ *                  of the string, so that it can't cross a page)
+ * 
+ * @retval  UTF8_BLOCK_* flags, 0 if it's all ASCII
+ *******************************************************************************
+ */
+static inline int
+_LSUtf8CheckBlock(const unsigned char *p)
+{
+#if defined(LS_UTF8_SSE2)
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    int flags = 0;
+
+    if (_mm_movemask_epi8(v))
+    {
+        flags |= UTF8_BLOCK_NON_ASCII;
+    }
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())))
+    {
+        flags |= UTF8_BLOCK_NUL;
+    }
+    return flags;
+#elif defined(LS_UTF8_NEON)
+    /* pairwise max/min work on both armv7 and aarch64 */
+    uint8x16_t v = vld1q_u8(p);
+    uint8x8_t max = vmax_u8(vget_low_u8(v), vget_high_u8(v));
+    uint8x8_t min = vmin_u8(vget_low_u8(v), vget_high_u8(v));
+    int flags = 0;
+
+    max = vpmax_u8(max, max);
+    max = vpmax_u8(max, max);
+    max = vpmax_u8(max, max);
+    min = vpmin_u8(min, min);
+    min = vpmin_u8(min, min);
+    min = vpmin_u8(min, min);
+
+    if (vget_lane_u8(max, 0) >= 0x80)
+    {
+        flags |= UTF8_BLOCK_NON_ASCII;
+    }
+    if (vget_lane_u8(min, 0) == 0)
+    {
+        flags |= UTF8_BLOCK_NUL;
+    }
+    return flags;
+#else
+    /* a word at a time */
+    const uint64_t ones = 0x0101010101010101ULL;
+    const uint64_t highs = 0x8080808080808080ULL;
+    uint64_t a;
+    uint64_t b;
+    int flags = 0;
+
+    memcpy(&a, p, sizeof(a));
+    memcpy(&b, p + sizeof(a), sizeof(b));
+
+    if ((a | b) & highs)
+    {
+        flags |= UTF8_BLOCK_NON_ASCII;
+    }
+    if (((a - ones) & ~a & highs) || ((b - ones) & ~b & highs))
+    {
+        flags |= UTF8_BLOCK_NUL;
+    }
+    return flags;
+#endif
+}
+
+/** 
+ *******************************************************************************
+ * @brief Validate one multi-byte sequence (RFC 3629: no overlong forms,
+ * surrogates or code points above U+10FFFF).
+ * 
+ * @param  p    IN  lead byte (>= 0x80)
+ * @param  end  IN  end of the string, or NULL if it's nul-terminated (a nul
+ *                  is never a continuation byte, so it stops there)
+ * 
+ * @retval  pointer just past the sequence if it's valid
+ * @retval  NULL otherwise
+ *******************************************************************************
+ */
+static inline const unsigned char*
+_LSUtf8ValidateSequence(const unsigned char *p, const unsigned char *end)
+{
+    unsigned char lo = 0x80;
+    unsigned char hi = 0xBF;
+    int n;
+    int i;
+
+    if (p[0] < 0xC2)
+    {
+        /* continuation byte or overlong 2-byte form */
+        return NULL;
+    }
+    else if (p[0] < 0xE0)
+    {
+        n = 1;
+    }
+    else if (p[0] < 0xF0)
+    {
+        n = 2;
+        if (p[0] == 0xE0) lo = 0xA0;        /* overlong */
+        else if (p[0] == 0xED) hi = 0x9F;   /* surrogates */
+    }
+    else if (p[0] < 0xF5)
+    {
+        n = 3;
+        if (p[0] == 0xF0) lo = 0x90;        /* overlong */
+        else if (p[0] == 0xF4) hi = 0x8F;   /* above U+10FFFF */
+    }
+    else
+    {
+        return NULL;
+    }
+
+    if (end && end - p <= n)
+    {
+        return NULL;
+    }
+
+    if (p[1] < lo || p[1] > hi)
+    {
+        return NULL;
+    }
+
+    for (i = 2; i <= n; i++)
+    {
+        if ((p[i] & 0xC0) != 0x80)
+        {
+            return NULL;
+        }
+    }
+
+    return p + n + 1;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Validate a nul-terminated string and find its length in the same
+ * pass.
+ * 
+ * @param  p    IN  string
+ * @param  len  OUT length of the string, not including the nul
+ * 
+ * @retval  true if valid
+ * @retval  false otherwise
+ *******************************************************************************
+ */
+static bool
+_LSUtf8ValidateNulTerminated(const unsigned char *p, size_t *len)
+{
+    const unsigned char *start = p;
+    const unsigned char *block_end = p;
+
+    for (;;)
+    {
+        if (p >= block_end && ((uintptr_t)p % UTF8_BLOCK_SIZE) == 0)
+        {
+            /* aligned blocks never cross a page, so it's safe to read
+             * past the nul */
+            while (_LSUtf8CheckBlock(p) == 0)
+            {
+                p += UTF8_BLOCK_SIZE;
+            }
+
+            /* go a character at a time through the rest of this block */
+            block_end = p + UTF8_BLOCK_SIZE;
+        }
+
+        if (*p < 0x80)
+        {
+            if (*p == '\0')
+            {
+                break;
+            }
+            p++;
+        }
+        else
+        {
+            p = _LSUtf8ValidateSequence(p, NULL);
+            if (!p)
+            {
+                return false;
+            }
+        }
+    }
+
+    *len = p - start;
+    return true;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Validate exactly len bytes. A nul in them is invalid.
+ * 
+ * @param  p    IN  string
+ * @param  len  IN  length
+ * 
+ * @retval  true if valid
+ * @retval  false otherwise
+ *******************************************************************************
+ */
+static bool
+_LSUtf8ValidateLen(const unsigned char *p, size_t len)
+{
+    const unsigned char *end = p + len;
+
+    while (p < end)
+    {
+        if (end - p >= UTF8_BLOCK_SIZE && _LSUtf8CheckBlock(p) == 0)
+        {
+            p += UTF8_BLOCK_SIZE;
+        }
+        else if (*p < 0x80)
+        {
+            if (*p == '\0')
+            {
+                return false;
+            }
+            p++;
+        }
+        else
+        {
+            p = _LSUtf8ValidateSequence(p, end);
+            if (!p)
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/** 
+ *******************************************************************************
+ * @brief Check that a string is valid UTF-8; a replacement for
+ * g_utf8_validate() in the payload paths.
+ *
+ * ASCII is checked 16 bytes at a time (SSE2 or NEON when available), so
+ * the cost is close to a strlen(). When max_len is negative the string is
+ * nul-terminated and its length is found in the same pass, so callers
+ * that need both don't walk the payload twice.
+ * 
+ * @param  str      IN  string
+ * @param  max_len  IN  length of str, or -1 if it's nul-terminated
+ * @param  len      OUT length of str (not including the nul) if valid; may
+ *                      be NULL
+ * 
+ * @retval  true if valid
+ * @retval  false otherwise
+ *******************************************************************************
+ */
+bool
+_LSUtf8Validate(const char *str, ssize_t max_len, size_t *len)
+{
+    size_t str_len;
+
+    if (max_len < 0)
+    {
+        if (!_LSUtf8ValidateNulTerminated((const unsigned char*)str, &str_len))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        str_len = max_len;
+
+        if (!_LSUtf8ValidateLen((const unsigned char*)str, str_len))
+        {
+            return false;
+        }
+    }
+
+    if (len)
+    {
+        *len = str_len;
+    }
+    return true;
+}
+
+/* @} END OF LunaServiceUtf8 */
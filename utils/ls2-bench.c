@@ -0,0 +1,981 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2008-2012 Hewlett-Packard Development Company, L.P.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+/**
+ * ls2-bench: bus benchmarks.
+ *
+ * Run "ls2-bench --server" once (or install it as a dynamic service), then
+ * "ls2-bench" to run the scenarios against it. Every scenario prints one
+ * line of JSON to stdout, so runs can be collected and compared:
+ *
+ *   latency      call/reply round trip, serially, for each payload size
+ *   throughput   calls/s with --window calls in flight
+ *   fanout       one LSSubscriptionReply() delivered to --subscribers
+ *                subscriptions
+ *   signal       LSSignalSend() from the server through the hub
+ *   contention   LSSubscriptionAcquire() lookups/s in the server with 1, 2,
+ *                4, ... up to --threads threads iterating the same
+ *                subscription list (shows whether readers of the
+ *                subscription catalog serialize)
+ *   firstcall    time until the first reply from --first-call (e.g., a
+ *                dynamic service that isn't running yet)
+ */
+
+#include <glib.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <cjson/json.h>
+#include <luna-service2/lunaservice.h>
+
+#define BENCH_SERVICE_NAME      "com.palm.ls2bench"
+#define BENCH_CLIENT_NAME       "com.palm.ls2benchclient"
+#define BENCH_URI(method)       "palm://" BENCH_SERVICE_NAME "/" method
+
+#define BENCH_SUBSCRIPTION_KEY  "bench"
+#define BENCH_SIGNAL_CATEGORY   "/bench"
+#define BENCH_SIGNAL_METHOD     "tick"
+
+static gboolean opt_server = FALSE;
+static gboolean opt_public = FALSE;
+static const char *opt_scenario = "all";
+static int opt_iterations = 1000;
+static int opt_window = 16;
+static int opt_subscribers = 32;
+static int opt_posts = 100;
+static int opt_signals = 1000;
+static int opt_threads = 8;
+static const char *opt_first_call = NULL;
+
+static const int payload_sizes[] = { 16, 256, 4096, 65536 };
+
+static GMainLoop *main_loop = NULL;
+
+static gint64
+_BenchNowUs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (gint64)now.tv_sec * G_GINT64_CONSTANT(1000000) + now.tv_nsec / 1000;
+}
+
+/* {"data":"xxx..."} padded to size bytes (or a little more for tiny sizes) */
+static char*
+_BenchPayloadNew(int size)
+{
+    int data_len = MAX(size - (int)strlen("{\"data\":\"\"}"), 0);
+    char *data = g_malloc(data_len + 1);
+
+    memset(data, 'x', data_len);
+    data[data_len] = '\0';
+
+    char *payload = g_strdup_printf("{\"data\":\"%s\"}", data);
+    g_free(data);
+
+    return payload;
+}
+
+/* Server-side timestamp in a payload, or -1 if it doesn't have one */
+static gint64
+_BenchPayloadGetTime(const char *payload)
+{
+    const char *t = strstr(payload, "\"t\":");
+
+    if (!t) return -1;
+
+    return g_ascii_strtoll(t + strlen("\"t\":"), NULL, 10);
+}
+
+static void
+_BenchPrintError(LSError *lserror)
+{
+    LSErrorPrint(lserror, stderr);
+    LSErrorFree(lserror);
+}
+
+/*
+ * Server
+ */
+
+static bool
+_BenchEcho(LSHandle *sh, LSMessage *message, void *ctx)
+{
+    LSError lserror;
+    LSErrorInit(&lserror);
+
+    if (!LSMessageReply(sh, message, LSMessageGetPayload(message), &lserror))
+    {
+        _BenchPrintError(&lserror);
+    }
+
+    return true;
+}
+
+static bool
+_BenchSubscribe(LSHandle *sh, LSMessage *message, void *ctx)
+{
+    LSError lserror;
+    LSErrorInit(&lserror);
+
+    if (!LSSubscriptionAdd(sh, BENCH_SUBSCRIPTION_KEY, message, &lserror))
+    {
+        _BenchPrintError(&lserror);
+    }
+
+    if (!LSMessageReply(sh, message, "{\"returnValue\":true,\"subscribed\":true}", &lserror))
+    {
+        _BenchPrintError(&lserror);
+    }
+
+    return true;
+}
+
+/* Reads {"count":N,"size":S} */
+static void
+_BenchGetCountAndSize(LSMessage *message, int *count, int *size)
+{
+    struct json_object *obj = json_tokener_parse(LSMessageGetPayload(message));
+    struct json_object *val = NULL;
+
+    *count = 1;
+    *size = 16;
+
+    if (!obj || is_error(obj)) return;
+
+    if (json_object_object_get_ex(obj, "count", &val)) *count = json_object_get_int(val);
+    if (json_object_object_get_ex(obj, "size", &val)) *size = json_object_get_int(val);
+
+    json_object_put(obj);
+}
+
+/* {"seq":i,"t":now,"data":"xxx..."} */
+static char*
+_BenchTimedPayloadNew(int seq, const char *data)
+{
+    return g_strdup_printf("{\"seq\":%d,\"t\":%" G_GINT64_FORMAT ",\"data\":\"%s\"}", seq, _BenchNowUs(), data);
+}
+
+static bool
+_BenchPost(LSHandle *sh, LSMessage *message, void *ctx)
+{
+    LSError lserror;
+    LSErrorInit(&lserror);
+    int count, size, i;
+
+    _BenchGetCountAndSize(message, &count, &size);
+
+    char *data = g_malloc0(size + 1);
+    memset(data, 'x', size);
+
+    for (i = 0; i < count; i++)
+    {
+        char *payload = _BenchTimedPayloadNew(i, data);
+
+        if (!LSSubscriptionReply(sh, BENCH_SUBSCRIPTION_KEY, payload, &lserror))
+        {
+            _BenchPrintError(&lserror);
+        }
+
+        g_free(payload);
+    }
+
+    g_free(data);
+
+    if (!LSMessageReply(sh, message, "{\"returnValue\":true}", &lserror))
+    {
+        _BenchPrintError(&lserror);
+    }
+
+    return true;
+}
+
+static bool
+_BenchBroadcast(LSHandle *sh, LSMessage *message, void *ctx)
+{
+    LSError lserror;
+    LSErrorInit(&lserror);
+    int count, size, i;
+
+    _BenchGetCountAndSize(message, &count, &size);
+
+    char *data = g_malloc0(size + 1);
+    memset(data, 'x', size);
+
+    for (i = 0; i < count; i++)
+    {
+        char *payload = _BenchTimedPayloadNew(i, data);
+
+        if (!LSSignalSend(sh, "palm://" BENCH_SERVICE_NAME BENCH_SIGNAL_CATEGORY "/" BENCH_SIGNAL_METHOD,
+                          payload, &lserror))
+        {
+            _BenchPrintError(&lserror);
+        }
+
+        g_free(payload);
+    }
+
+    g_free(data);
+
+    if (!LSMessageReply(sh, message, "{\"returnValue\":true}", &lserror))
+    {
+        _BenchPrintError(&lserror);
+    }
+
+    return true;
+}
+
+/** One reader thread of the contention scenario */
+typedef struct _BenchContender
+{
+    pthread_t   thread;
+    LSHandle   *sh;
+    int         count;      //< lookups to do
+    bool        started;
+} _BenchContender;
+
+static void*
+_BenchContendThread(void *data)
+{
+    _BenchContender *contender = data;
+    LSError lserror;
+    LSErrorInit(&lserror);
+    int i;
+
+    for (i = 0; i < contender->count; i++)
+    {
+        LSSubscriptionIter *iter = NULL;
+
+        if (!LSSubscriptionAcquire(contender->sh, BENCH_SUBSCRIPTION_KEY, &iter, &lserror))
+        {
+            _BenchPrintError(&lserror);
+            break;
+        }
+
+        while (LSSubscriptionHasNext(iter))
+        {
+            (void)LSSubscriptionNext(iter);
+        }
+
+        LSSubscriptionRelease(iter);
+    }
+
+    return NULL;
+}
+
+/* Reads {"count":N,"threads":T}; T threads each do N lookups */
+static bool
+_BenchContend(LSHandle *sh, LSMessage *message, void *ctx)
+{
+    LSError lserror;
+    LSErrorInit(&lserror);
+    struct json_object *obj = json_tokener_parse(LSMessageGetPayload(message));
+    struct json_object *val = NULL;
+    int count = 1;
+    int threads = 1;
+    int i;
+
+    if (obj && !is_error(obj))
+    {
+        if (json_object_object_get_ex(obj, "count", &val)) count = json_object_get_int(val);
+        if (json_object_object_get_ex(obj, "threads", &val)) threads = json_object_get_int(val);
+        json_object_put(obj);
+    }
+
+    threads = CLAMP(threads, 1, 256);
+
+    _BenchContender *contenders = g_new0(_BenchContender, threads);
+    gint64 start_us = _BenchNowUs();
+
+    for (i = 0; i < threads; i++)
+    {
+        contenders[i].sh = sh;
+        contenders[i].count = count;
+        contenders[i].started = (pthread_create(&contenders[i].thread, NULL, _BenchContendThread, &contenders[i]) == 0);
+    }
+
+    int started = 0;
+
+    for (i = 0; i < threads; i++)
+    {
+        if (!contenders[i].started) continue;
+
+        pthread_join(contenders[i].thread, NULL);
+        started++;
+    }
+
+    gint64 elapsed_us = _BenchNowUs() - start_us;
+
+    g_free(contenders);
+
+    char *reply = g_strdup_printf("{\"returnValue\":%s,\"threads\":%d,\"elapsed_us\":%" G_GINT64_FORMAT "}",
+                                  started == threads ? "true" : "false", started, elapsed_us);
+
+    if (!LSMessageReply(sh, message, reply, &lserror))
+    {
+        _BenchPrintError(&lserror);
+    }
+
+    g_free(reply);
+
+    return true;
+}
+
+static LSMethod bench_methods[] = {
+    { "echo", _BenchEcho },
+    { "subscribe", _BenchSubscribe },
+    { "post", _BenchPost },
+    { "broadcast", _BenchBroadcast },
+    { "contend", _BenchContend },
+    { },
+};
+
+static LSSignal bench_signals[] = {
+    { BENCH_SIGNAL_METHOD },
+    { },
+};
+
+static int
+_BenchServerRun(LSHandle *sh, LSError *lserror)
+{
+    if (!LSRegisterCategory(sh, "/", bench_methods, NULL, NULL, lserror)) return EXIT_FAILURE;
+    if (!LSRegisterCategory(sh, BENCH_SIGNAL_CATEGORY, NULL, bench_signals, NULL, lserror)) return EXIT_FAILURE;
+
+    g_main_loop_run(main_loop);
+
+    return EXIT_SUCCESS;
+}
+
+/*
+ * Client
+ */
+
+/** Latency samples (us) of a scenario */
+typedef struct _BenchSamples
+{
+    GArray *us;
+    int     errors;
+} _BenchSamples;
+
+static void
+_BenchSamplesInit(_BenchSamples *samples)
+{
+    samples->us = g_array_new(false, false, sizeof(gint64));
+    samples->errors = 0;
+}
+
+static void
+_BenchSamplesAdd(_BenchSamples *samples, gint64 us)
+{
+    g_array_append_val(samples->us, us);
+}
+
+static gint
+_BenchCompareSample(gconstpointer a, gconstpointer b)
+{
+    gint64 x = *(const gint64*)a;
+    gint64 y = *(const gint64*)b;
+
+    return (x > y) - (x < y);
+}
+
+static gint64
+_BenchPercentile(const _BenchSamples *samples, int pct)
+{
+    guint idx = ((guint64)(samples->us->len - 1) * pct) / 100;
+    return g_array_index(samples->us, gint64, idx);
+}
+
+/* Adds count, errors, min/mean/p50/p90/p99/max (us) to obj and frees samples */
+static void
+_BenchSamplesToJson(_BenchSamples *samples, struct json_object *obj)
+{
+    json_object_object_add(obj, "count", json_object_new_int(samples->us->len));
+    json_object_object_add(obj, "errors", json_object_new_int(samples->errors));
+
+    if (samples->us->len > 0)
+    {
+        gint64 total = 0;
+        guint i;
+
+        g_array_sort(samples->us, _BenchCompareSample);
+
+        for (i = 0; i < samples->us->len; i++)
+        {
+            total += g_array_index(samples->us, gint64, i);
+        }
+
+        json_object_object_add(obj, "min_us", json_object_new_int(g_array_index(samples->us, gint64, 0)));
+        json_object_object_add(obj, "mean_us", json_object_new_double((double)total / samples->us->len));
+        json_object_object_add(obj, "p50_us", json_object_new_int(_BenchPercentile(samples, 50)));
+        json_object_object_add(obj, "p90_us", json_object_new_int(_BenchPercentile(samples, 90)));
+        json_object_object_add(obj, "p99_us", json_object_new_int(_BenchPercentile(samples, 99)));
+        json_object_object_add(obj, "max_us", json_object_new_int(g_array_index(samples->us, gint64, samples->us->len - 1)));
+    }
+
+    g_array_free(samples->us, true);
+}
+
+static void
+_BenchPrintResult(struct json_object *obj)
+{
+    printf("%s\n", json_object_to_json_string(obj));
+    fflush(stdout);
+    json_object_put(obj);
+}
+
+/* Run the main loop until *done is set */
+static void
+_BenchWait(const bool *done)
+{
+    GMainContext *context = g_main_loop_get_context(main_loop);
+
+    while (!*done)
+    {
+        g_main_context_iteration(context, TRUE);
+    }
+}
+
+static bool
+_BenchIsError(LSMessage *reply)
+{
+    return LSMessageIsHubErrorMessage(reply) || strstr(LSMessageGetPayload(reply), "\"returnValue\":false") != NULL;
+}
+
+/** One outstanding call of the latency, throughput and firstcall scenarios */
+typedef struct _BenchCall
+{
+    struct _BenchRun *run;
+    gint64            start_us;
+} _BenchCall;
+
+typedef struct _BenchRun
+{
+    LSHandle       *sh;
+    const char     *uri;
+    const char     *payload;
+    int             total;      //< calls to make
+    int             issued;
+    int             completed;
+    _BenchSamples   samples;
+    bool            done;
+} _BenchRun;
+
+static bool _BenchIssue(_BenchRun *run);
+
+static bool
+_BenchCallReply(LSHandle *sh, LSMessage *reply, void *ctx)
+{
+    _BenchCall *call = ctx;
+    _BenchRun *run = call->run;
+
+    if (_BenchIsError(reply))
+    {
+        run->samples.errors++;
+    }
+    else
+    {
+        _BenchSamplesAdd(&run->samples, _BenchNowUs() - call->start_us);
+    }
+
+    g_free(call);
+
+    run->completed++;
+
+    if (run->issued < run->total)
+    {
+        _BenchIssue(run);
+    }
+    else if (run->completed == run->total)
+    {
+        run->done = true;
+    }
+
+    return true;
+}
+
+static bool
+_BenchIssue(_BenchRun *run)
+{
+    LSError lserror;
+    LSErrorInit(&lserror);
+
+    _BenchCall *call = g_new0(_BenchCall, 1);
+    call->run = run;
+    call->start_us = _BenchNowUs();
+
+    run->issued++;
+
+    if (!LSCallOneReply(run->sh, run->uri, run->payload, _BenchCallReply, call, NULL, &lserror))
+    {
+        _BenchPrintError(&lserror);
+        g_free(call);
+        run->samples.errors++;
+        run->completed++;
+
+        if (run->completed == run->total) run->done = true;
+
+        return false;
+    }
+
+    return true;
+}
+
+/* Make total calls with window of them in flight; returns the elapsed time */
+static gint64
+_BenchRunCalls(_BenchRun *run, LSHandle *sh, const char *uri, const char *payload, int total, int window)
+{
+    int i;
+
+    memset(run, 0, sizeof(*run));
+    run->sh = sh;
+    run->uri = uri;
+    run->payload = payload;
+    run->total = total;
+    _BenchSamplesInit(&run->samples);
+
+    gint64 start_us = _BenchNowUs();
+
+    for (i = 0; i < window && i < total; i++)
+    {
+        _BenchIssue(run);
+    }
+
+    _BenchWait(&run->done);
+
+    return _BenchNowUs() - start_us;
+}
+
+static void
+_BenchLatency(LSHandle *sh)
+{
+    int i;
+
+    for (i = 0; i < G_N_ELEMENTS(payload_sizes); i++)
+    {
+        _BenchRun run;
+        char *payload = _BenchPayloadNew(payload_sizes[i]);
+
+        /* warm up: connect to the server and fault everything in */
+        _BenchRunCalls(&run, sh, BENCH_URI("echo"), payload, 10, 1);
+        g_array_free(run.samples.us, true);
+
+        _BenchRunCalls(&run, sh, BENCH_URI("echo"), payload, opt_iterations, 1);
+
+        struct json_object *obj = json_object_new_object();
+        json_object_object_add(obj, "scenario", json_object_new_string("latency"));
+        json_object_object_add(obj, "payload_bytes", json_object_new_int(strlen(payload)));
+        _BenchSamplesToJson(&run.samples, obj);
+        _BenchPrintResult(obj);
+
+        g_free(payload);
+    }
+}
+
+static void
+_BenchThroughput(LSHandle *sh)
+{
+    _BenchRun run;
+    char *payload = _BenchPayloadNew(256);
+
+    gint64 elapsed_us = _BenchRunCalls(&run, sh, BENCH_URI("echo"), payload, opt_iterations, opt_window);
+
+    struct json_object *obj = json_object_new_object();
+    json_object_object_add(obj, "scenario", json_object_new_string("throughput"));
+    json_object_object_add(obj, "payload_bytes", json_object_new_int(strlen(payload)));
+    json_object_object_add(obj, "window", json_object_new_int(opt_window));
+    json_object_object_add(obj, "elapsed_us", json_object_new_int(elapsed_us));
+    json_object_object_add(obj, "calls_per_sec", json_object_new_double(elapsed_us > 0 ? (double)run.completed * 1000000.0 / elapsed_us : 0.0));
+    _BenchSamplesToJson(&run.samples, obj);
+    _BenchPrintResult(obj);
+
+    g_free(payload);
+}
+
+/** State of the fanout and signal scenarios: messages stamped by the server */
+typedef struct _BenchDelivery
+{
+    int             acks_expected;
+    int             acks;
+    int             expected;   //< stamped messages to wait for
+    int             received;
+    _BenchSamples   samples;
+    bool            acked;      //< all acks are in
+    bool            done;
+} _BenchDelivery;
+
+static bool
+_BenchDeliveryReply(LSHandle *sh, LSMessage *reply, void *ctx)
+{
+    _BenchDelivery *delivery = ctx;
+    const char *payload = LSMessageGetPayload(reply);
+    gint64 sent_us = _BenchPayloadGetTime(payload);
+
+    if (sent_us < 0)
+    {
+        /* subscription or signal registration ack */
+        if (_BenchIsError(reply))
+        {
+            g_critical("Registration failed: %s", payload);
+            delivery->samples.errors++;
+        }
+
+        if (++delivery->acks == delivery->acks_expected) delivery->acked = true;
+
+        return true;
+    }
+
+    _BenchSamplesAdd(&delivery->samples, _BenchNowUs() - sent_us);
+
+    if (++delivery->received == delivery->expected) delivery->done = true;
+
+    return true;
+}
+
+/* Ask the server to send count stamped messages with method, then wait for
+ * them; returns the elapsed time */
+static gint64
+_BenchTrigger(LSHandle *sh, const char *uri, int count, _BenchDelivery *delivery)
+{
+    LSError lserror;
+    LSErrorInit(&lserror);
+
+    char *request = g_strdup_printf("{\"count\":%d,\"size\":%d}", count, 256);
+    gint64 start_us = _BenchNowUs();
+
+    /* the reply itself isn't interesting */
+    if (!LSCallOneReply(sh, uri, request, NULL, NULL, NULL, &lserror))
+    {
+        _BenchPrintError(&lserror);
+        delivery->done = true;
+    }
+
+    g_free(request);
+
+    _BenchWait(&delivery->done);
+
+    return _BenchNowUs() - start_us;
+}
+
+/* Make opt_subscribers subscriptions to the server and wait for their
+ * acks; tokens has room for opt_subscribers tokens */
+static bool
+_BenchSubscribeAll(LSHandle *sh, _BenchDelivery *delivery, LSMessageToken *tokens)
+{
+    LSError lserror;
+    LSErrorInit(&lserror);
+    int i;
+
+    delivery->acks_expected = opt_subscribers;
+
+    for (i = 0; i < opt_subscribers; i++)
+    {
+        if (!LSCall(sh, BENCH_URI("subscribe"), "{\"subscribe\":true}", _BenchDeliveryReply, delivery,
+                    &tokens[i], &lserror))
+        {
+            _BenchPrintError(&lserror);
+            return false;
+        }
+    }
+
+    _BenchWait(&delivery->acked);
+
+    return true;
+}
+
+static void
+_BenchUnsubscribeAll(LSHandle *sh, LSMessageToken *tokens)
+{
+    LSError lserror;
+    LSErrorInit(&lserror);
+    int i;
+
+    for (i = 0; i < opt_subscribers; i++)
+    {
+        if (tokens[i] != LSMESSAGE_TOKEN_INVALID && !LSCallCancel(sh, tokens[i], &lserror))
+        {
+            _BenchPrintError(&lserror);
+        }
+    }
+}
+
+static void
+_BenchFanout(LSHandle *sh)
+{
+    _BenchDelivery delivery;
+    LSMessageToken *tokens = g_new0(LSMessageToken, opt_subscribers);
+
+    memset(&delivery, 0, sizeof(delivery));
+    _BenchSamplesInit(&delivery.samples);
+    delivery.expected = opt_subscribers * opt_posts;
+
+    if (!_BenchSubscribeAll(sh, &delivery, tokens))
+    {
+        goto exit;
+    }
+
+    gint64 elapsed_us = _BenchTrigger(sh, BENCH_URI("post"), opt_posts, &delivery);
+
+    struct json_object *obj = json_object_new_object();
+    json_object_object_add(obj, "scenario", json_object_new_string("fanout"));
+    json_object_object_add(obj, "subscribers", json_object_new_int(opt_subscribers));
+    json_object_object_add(obj, "posts", json_object_new_int(opt_posts));
+    json_object_object_add(obj, "elapsed_us", json_object_new_int(elapsed_us));
+    json_object_object_add(obj, "deliveries_per_sec", json_object_new_double(elapsed_us > 0 ? (double)delivery.received * 1000000.0 / elapsed_us : 0.0));
+    _BenchSamplesToJson(&delivery.samples, obj);
+    _BenchPrintResult(obj);
+
+exit:
+    _BenchUnsubscribeAll(sh, tokens);
+    g_free(tokens);
+}
+
+/** Result of one "contend" call */
+typedef struct _BenchContention
+{
+    int     threads;        //< threads the server actually ran
+    gint64  elapsed_us;     //< time the server took for all lookups
+    bool    failed;
+    bool    done;
+} _BenchContention;
+
+static bool
+_BenchContentionReply(LSHandle *sh, LSMessage *reply, void *ctx)
+{
+    _BenchContention *contention = ctx;
+    struct json_object *obj = json_tokener_parse(LSMessageGetPayload(reply));
+    struct json_object *val = NULL;
+
+    contention->failed = _BenchIsError(reply);
+
+    if (obj && !is_error(obj))
+    {
+        if (json_object_object_get_ex(obj, "threads", &val)) contention->threads = json_object_get_int(val);
+        if (json_object_object_get_ex(obj, "elapsed_us", &val)) contention->elapsed_us = json_object_get_int64(val);
+        json_object_put(obj);
+    }
+
+    contention->done = true;
+
+    return true;
+}
+
+static void
+_BenchContention(LSHandle *sh)
+{
+    LSError lserror;
+    LSErrorInit(&lserror);
+    _BenchDelivery delivery;
+    LSMessageToken *tokens = g_new0(LSMessageToken, opt_subscribers);
+    int threads = 1;
+
+    memset(&delivery, 0, sizeof(delivery));
+    _BenchSamplesInit(&delivery.samples);
+
+    if (!_BenchSubscribeAll(sh, &delivery, tokens))
+    {
+        goto exit;
+    }
+
+    while (true)
+    {
+        _BenchContention contention;
+        memset(&contention, 0, sizeof(contention));
+
+        char *request = g_strdup_printf("{\"count\":%d,\"threads\":%d}", opt_iterations, threads);
+
+        if (!LSCallOneReply(sh, BENCH_URI("contend"), request, _BenchContentionReply, &contention, NULL, &lserror))
+        {
+            _BenchPrintError(&lserror);
+            g_free(request);
+            break;
+        }
+
+        g_free(request);
+
+        _BenchWait(&contention.done);
+
+        gint64 lookups = (gint64)contention.threads * opt_iterations;
+
+        struct json_object *obj = json_object_new_object();
+        json_object_object_add(obj, "scenario", json_object_new_string("contention"));
+        json_object_object_add(obj, "subscribers", json_object_new_int(opt_subscribers));
+        json_object_object_add(obj, "threads", json_object_new_int(contention.threads));
+        json_object_object_add(obj, "errors", json_object_new_int(contention.failed ? 1 : 0));
+        json_object_object_add(obj, "lookups", json_object_new_int64(lookups));
+        json_object_object_add(obj, "elapsed_us", json_object_new_int64(contention.elapsed_us));
+        json_object_object_add(obj, "lookups_per_sec", json_object_new_double(contention.elapsed_us > 0 ? (double)lookups * 1000000.0 / contention.elapsed_us : 0.0));
+        _BenchPrintResult(obj);
+
+        if (threads >= opt_threads) break;
+
+        threads = MIN(threads * 2, opt_threads);
+    }
+
+exit:
+    _BenchUnsubscribeAll(sh, tokens);
+    g_array_free(delivery.samples.us, true);
+    g_free(tokens);
+}
+
+static void
+_BenchSignal(LSHandle *sh)
+{
+    LSError lserror;
+    LSErrorInit(&lserror);
+    _BenchDelivery delivery;
+    LSMessageToken token = LSMESSAGE_TOKEN_INVALID;
+
+    memset(&delivery, 0, sizeof(delivery));
+    _BenchSamplesInit(&delivery.samples);
+    delivery.acks_expected = 1;
+    delivery.expected = opt_signals;
+
+    if (!LSSignalCall(sh, BENCH_SIGNAL_CATEGORY, BENCH_SIGNAL_METHOD, _BenchDeliveryReply, &delivery, &token, &lserror))
+    {
+        _BenchPrintError(&lserror);
+        g_array_free(delivery.samples.us, true);
+        return;
+    }
+
+    _BenchWait(&delivery.acked);
+
+    gint64 elapsed_us = _BenchTrigger(sh, BENCH_URI("broadcast"), opt_signals, &delivery);
+
+    struct json_object *obj = json_object_new_object();
+    json_object_object_add(obj, "scenario", json_object_new_string("signal"));
+    json_object_object_add(obj, "signals", json_object_new_int(opt_signals));
+    json_object_object_add(obj, "elapsed_us", json_object_new_int(elapsed_us));
+    json_object_object_add(obj, "signals_per_sec", json_object_new_double(elapsed_us > 0 ? (double)delivery.received * 1000000.0 / elapsed_us : 0.0));
+    _BenchSamplesToJson(&delivery.samples, obj);
+    _BenchPrintResult(obj);
+
+    if (!LSSignalCallCancel(sh, token, &lserror))
+    {
+        _BenchPrintError(&lserror);
+    }
+}
+
+static void
+_BenchFirstCall(LSHandle *sh)
+{
+    _BenchRun run;
+
+    _BenchRunCalls(&run, sh, opt_first_call, "{}", 1, 1);
+
+    struct json_object *obj = json_object_new_object();
+    json_object_object_add(obj, "scenario", json_object_new_string("firstcall"));
+    json_object_object_add(obj, "uri", json_object_new_string(opt_first_call));
+    _BenchSamplesToJson(&run.samples, obj);
+    _BenchPrintResult(obj);
+}
+
+static bool
+_BenchWants(const char *scenario)
+{
+    return strcmp(opt_scenario, "all") == 0 || strcmp(opt_scenario, scenario) == 0;
+}
+
+static int
+_BenchClientRun(LSHandle *sh)
+{
+    /* first, so that the service is really started by this call */
+    if (opt_first_call && _BenchWants("firstcall")) _BenchFirstCall(sh);
+
+    if (_BenchWants("latency")) _BenchLatency(sh);
+    if (_BenchWants("throughput")) _BenchThroughput(sh);
+    if (_BenchWants("fanout")) _BenchFanout(sh);
+    if (_BenchWants("signal")) _BenchSignal(sh);
+    if (_BenchWants("contention")) _BenchContention(sh);
+
+    return EXIT_SUCCESS;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int ret = EXIT_FAILURE;
+    GError *gerror = NULL;
+    GOptionContext *opt_context = NULL;
+    LSHandle *sh = NULL;
+    LSError lserror;
+    LSErrorInit(&lserror);
+
+    static GOptionEntry opt_entries[] =
+    {
+        {"server", 's', 0, G_OPTION_ARG_NONE, &opt_server, "Run the benchmark server (" BENCH_SERVICE_NAME ")", NULL},
+        {"public", 'P', 0, G_OPTION_ARG_NONE, &opt_public, "Use the public bus (private is the default)", NULL},
+        {"scenario", 'S', 0, G_OPTION_ARG_STRING, &opt_scenario, "Scenario to run: latency, throughput, fanout, signal, contention, firstcall or all (default)", "NAME"},
+        {"iterations", 'n', 0, G_OPTION_ARG_INT, &opt_iterations, "Calls per latency/throughput run, lookups per thread for contention (default 1000)", "N"},
+        {"window", 'w', 0, G_OPTION_ARG_INT, &opt_window, "Calls in flight for throughput (default 16)", "N"},
+        {"subscribers", 'k', 0, G_OPTION_ARG_INT, &opt_subscribers, "Subscriptions for fanout (default 32)", "N"},
+        {"posts", 'p', 0, G_OPTION_ARG_INT, &opt_posts, "Subscription posts for fanout (default 100)", "N"},
+        {"signals", 'g', 0, G_OPTION_ARG_INT, &opt_signals, "Signals for signal (default 1000)", "N"},
+        {"first-call", 'f', 0, G_OPTION_ARG_STRING, &opt_first_call, "Uri to time the first reply from, e.g. of a dynamic service", "URI"},
+        {"threads", 't', 0, G_OPTION_ARG_INT, &opt_threads, "Most server threads for contention (default 8)", "N"},
+        { NULL }
+    };
+
+    opt_context = g_option_context_new("- luna-service2 bus benchmarks");
+    g_option_context_add_main_entries(opt_context, opt_entries, NULL);
+
+    if (!g_option_context_parse(opt_context, &argc, &argv, &gerror))
+    {
+        g_critical("Error processing commandline args: %s", gerror->message);
+        g_error_free(gerror);
+        exit(EXIT_FAILURE);
+    }
+
+    g_option_context_free(opt_context);
+
+    if (opt_iterations < 1 || opt_window < 1 || opt_subscribers < 1 || opt_posts < 1 || opt_signals < 1 || opt_threads < 1)
+    {
+        fprintf(stderr, "Counts must be at least 1\n");
+        exit(EXIT_FAILURE);
+    }
+
+    main_loop = g_main_loop_new(NULL, FALSE);
+
+    if (!LSRegisterPubPriv(opt_server ? BENCH_SERVICE_NAME : BENCH_CLIENT_NAME, &sh, opt_public, &lserror))
+    {
+        goto exit;
+    }
+
+    if (!LSGmainAttach(sh, main_loop, &lserror))
+    {
+        goto exit;
+    }
+
+    ret = opt_server ? _BenchServerRun(sh, &lserror) : _BenchClientRun(sh);
+
+exit:
+    if (LSErrorIsSet(&lserror))
+    {
+        _BenchPrintError(&lserror);
+    }
+
+    if (sh && !LSUnregister(sh, &lserror))
+    {
+        _BenchPrintError(&lserror);
+    }
+
+    g_main_loop_unref(main_loop);
+
+    return ret;
+}
@@ -46,6 +46,20 @@ static gchar *url = NULL;
 static gchar *message = NULL;
 static gchar *appId = NULL;
 
+/* load generation (-L) */
+static int loadCount = 0;           /* calls to make */
+static double loadRate = 0.0;       /* calls/s, 0 for as fast as the window allows */
+static int loadWindow = 16;         /* max calls in flight */
+static gchar **loadPayloads = NULL; /* from -F, used round-robin */
+static int loadNumPayloads = 0;
+static int loadIssued = 0;
+static int loadInFlight = 0;
+static int loadCompleted = 0;
+static int loadErrors = 0;
+static int loadSendErrors = 0;
+static GArray *loadLatencies = NULL;    /* ms */
+static struct timespec loadStartTime;
+
 static gboolean
 goodbye (gpointer data)
 {
@@ -287,6 +301,196 @@ timingServiceResponse(LSHandle *sh, LSMessage *reply, void *ctx)
     return true;
 }
 
+static GMainLoop *loadLoop = NULL;
+
+static double
+timespec_to_ms(const struct timespec *ts)
+{
+    return ((double)ts->tv_sec * 1000.0) + ((double)ts->tv_nsec / 1000000.0);
+}
+
+static double
+load_now_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return timespec_to_ms(&now) - timespec_to_ms(&loadStartTime);
+}
+
+/* One call of the load run. Latency is taken from when the call was
+ * scheduled, not from when the window let it out, so that a slow service
+ * can't hide its queueing delay. */
+typedef struct LoadCall {
+    double scheduled_ms;
+} LoadCall;
+
+static void load_issue(LSHandle *sh);
+
+static void
+load_done(void)
+{
+    if (loadCompleted == loadCount)
+    {
+        g_main_loop_quit(loadLoop);
+    }
+}
+
+static bool
+loadServiceResponse(LSHandle *sh, LSMessage *reply, void *ctx)
+{
+    LoadCall *call = (LoadCall*)ctx;
+    double latency = load_now_ms() - call->scheduled_ms;
+
+    g_array_append_val(loadLatencies, latency);
+
+    if (LSMessageIsHubErrorMessage(reply) ||
+        strstr(LSMessageGetPayload(reply), "\"returnValue\":false") != NULL)
+    {
+        loadErrors++;
+    }
+
+    g_free(call);
+
+    loadInFlight--;
+    loadCompleted++;
+
+    /* send whatever is due now that there's room in the window */
+    load_issue(sh);
+    load_done();
+
+    return true;
+}
+
+/* Send the calls that are due (all of them up to the window if there's no
+ * rate limit) */
+static void
+load_issue(LSHandle *sh)
+{
+    LSError lserror;
+    LSErrorInit(&lserror);
+
+    double now_ms = load_now_ms();
+
+    while (loadIssued < loadCount && loadInFlight < loadWindow)
+    {
+        double scheduled_ms = (loadRate > 0.0) ? (loadIssued * 1000.0 / loadRate) : now_ms;
+
+        if (scheduled_ms > now_ms)
+        {
+            break;
+        }
+
+        const char *payload = loadNumPayloads ? loadPayloads[loadIssued % loadNumPayloads] : message;
+
+        LoadCall *call = g_new0(LoadCall, 1);
+        call->scheduled_ms = scheduled_ms;
+
+        loadIssued++;
+
+        bool retVal = LSCallFromApplicationOneReply(sh, url, payload, appId,
+                    loadServiceResponse, call, NULL, &lserror);
+        if (!retVal)
+        {
+            LSErrorPrint (&lserror, stderr);
+            LSErrorFree (&lserror);
+            g_free(call);
+            loadSendErrors++;
+            loadCompleted++;
+            continue;
+        }
+
+        loadInFlight++;
+    }
+}
+
+static gboolean
+load_tick(gpointer data)
+{
+    load_issue((LSHandle*)data);
+    load_done();
+
+    return loadIssued < loadCount;
+}
+
+static gint
+compare_double(gconstpointer a, gconstpointer b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+
+    return (x > y) - (x < y);
+}
+
+static double
+load_percentile(int pct)
+{
+    guint idx = ((guint64)(loadLatencies->len - 1) * pct) / 100;
+    return g_array_index(loadLatencies, double, idx);
+}
+
+static void
+load_print_summary(void)
+{
+    double elapsed_ms = load_now_ms();
+
+    printf("%d calls sent, %d replies, %d errors, %d send failures in %.02f ms (%.02f calls/s)\n",
+        loadIssued - loadSendErrors, loadLatencies->len, loadErrors, loadSendErrors,
+        elapsed_ms, elapsed_ms > 0.0 ? loadLatencies->len * 1000.0 / elapsed_ms : 0.0);
+
+    if (loadLatencies->len > 0)
+    {
+        g_array_sort(loadLatencies, compare_double);
+
+        printf("latency ms: p50 %.02f, p90 %.02f, p99 %.02f, max %.02f\n",
+            load_percentile(50), load_percentile(90), load_percentile(99),
+            g_array_index(loadLatencies, double, loadLatencies->len - 1));
+    }
+}
+
+/* One payload per non-empty line */
+static bool
+load_read_payloads(const char *path)
+{
+    gchar *contents = NULL;
+    GError *gerror = NULL;
+    int i, j;
+
+    if (!g_file_get_contents(path, &contents, NULL, &gerror))
+    {
+        g_critical("Unable to read payload file: %s", gerror->message);
+        g_error_free(gerror);
+        return false;
+    }
+
+    loadPayloads = g_strsplit(contents, "\n", -1);
+    g_free(contents);
+
+    /* drop empty lines */
+    for (i = 0, j = 0; loadPayloads[i]; i++)
+    {
+        g_strstrip(loadPayloads[i]);
+
+        if (loadPayloads[i][0] == '\0')
+        {
+            g_free(loadPayloads[i]);
+        }
+        else
+        {
+            loadPayloads[j++] = loadPayloads[i];
+        }
+    }
+    loadPayloads[j] = NULL;
+    loadNumPayloads = j;
+
+    if (loadNumPayloads == 0)
+    {
+        g_critical("No payloads in %s", path);
+        return false;
+    }
+
+    return true;
+}
+
 void
 PrintUsage(const char* progname)
 {
@@ -300,6 +504,10 @@ PrintUsage(const char* progname)
            " -i turn on interactive mode\n"
            " -t x average over x times getting one response\n"
            " -n x exit interactive mode after x replies\n"
+           " -L x load mode: make x calls and print a latency summary\n"
+           " -r x load mode: send x calls per second (default is as fast as the window allows)\n"
+           " -w x load mode: keep at most x calls in flight (default 16)\n"
+           " -F file load mode: take payloads from file, one per line (message is optional)\n"
            " -l number responses\n"
            " -f format JSON responses usefully\n"
            " -q apply specific query to responses (multiple queries may be supplied), e.g.:\n"
@@ -337,8 +545,9 @@ main(int argc, char **argv)
     char *serviceName = NULL;
     int optionCount = 0;
     int opt;
+    char *payloadFile = NULL;
 
-    while ((opt = getopt(argc, argv, "hdisPrlfn:t:m:a:q:")) != -1)
+    while ((opt = getopt(argc, argv, "hdisPlfn:t:m:a:q:L:r:w:F:")) != -1)
     {
     switch (opt) {
     case 'i':
@@ -387,6 +596,22 @@ main(int argc, char **argv)
         query_list = g_list_append(query_list, g_strdup(optarg));
         optionCount+=2;
         break;
+    case 'L':
+        loadCount = atoi(optarg);
+        optionCount+=2;
+        break;
+    case 'r':
+        loadRate = atof(optarg);
+        optionCount+=2;
+        break;
+    case 'w':
+        loadWindow = MAX(atoi(optarg), 1);
+        optionCount+=2;
+        break;
+    case 'F':
+        payloadFile = g_strdup(optarg);
+        optionCount+=2;
+        break;
     case 'h':
     default:
         PrintUsage(argv[0]);
@@ -394,11 +619,15 @@ main(int argc, char **argv)
         }
     }
 
-    if (argc < 3 + optionCount) {
+    if (argc < (payloadFile ? 2 : 3) + optionCount) {
         PrintUsage(argv[0]);
         return 0;
     }
 
+    if (payloadFile && !load_read_payloads(payloadFile)) {
+        exit(EXIT_FAILURE);
+    }
+
     g_log_set_default_handler(g_log_filter, NULL);
 
     GMainLoop *mainLoop = g_main_loop_new(NULL, FALSE); 
@@ -422,12 +651,38 @@ main(int argc, char **argv)
     if (!gmainAttach) goto exit;    
 
     url = g_strdup(argv[optionCount + 1]);
-    message = g_strdup(argv[optionCount + 2]);
+    message = (argc > optionCount + 2) ? g_strdup(argv[optionCount + 2]) : NULL;
+
+    if (!message && (loadCount <= 0 || loadNumPayloads == 0)) {
+        PrintUsage(argv[0]);
+        goto exit;
+    }
 
     LSMessageToken sessionToken;
     bool retVal;
 
-    if (timing) {
+    if (loadCount > 0) {
+
+      /* Load generation */
+      loadLoop = mainLoop;
+      loadLatencies = g_array_sized_new(false, false, sizeof(double), loadCount);
+      clock_gettime(CLOCK_MONOTONIC, &loadStartTime);
+
+      load_issue(sh);
+
+      if (loadRate > 0.0 && loadIssued < loadCount) {
+          /* the tick only matters for pacing; replies refill the window */
+          g_timeout_add(MAX((guint)(1000.0 / loadRate), 1), load_tick, sh);
+      }
+
+      if (loadCompleted < loadCount)
+          g_main_loop_run(mainLoop);
+
+      load_print_summary();
+
+      g_array_free(loadLatencies, true);
+
+    } else if (timing) {
 
       /* Timing loop */
       clock_gettime(CLOCK_MONOTONIC, &startTime);
@@ -502,5 +757,8 @@ exit:
     if (message)
         g_free (message);
 
+    g_strfreev(loadPayloads);
+    g_free(payloadFile);
+
     return 0;
 }